@@ -37,6 +37,10 @@
 #include <util/maat-io.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 #include <apb/contracts.h>
 #include <apb.h>
@@ -71,62 +75,257 @@ extern respect_desired_execcon_t libmaat_apbmain_asps_respect_desired_execcon;
 //extern execcon_unique_categories_t libmaat_apbmain_asps_use_unique_categories;
 //extern respect_desired_execcon_t libmaat_apbmain_asps_respect_desired_execcon;
 
+/* how long stop_asp() gives an ASP to exit after SIGHUP */
+#define STOP_ASP_GRACE_MS 3000
+/* how often ASPs without a pidfd are checked on while waiting */
+#define WAIT_ASP_POLL_MS 10
+
+/*
+ * Each running ASP holds one of these slots, handed out in turn by a
+ * counter that skips slots still held. The slot and the low bits of
+ * the APB's pid make up the seed of the ASP's unique SELinux
+ * categories, so no two ASPs of this APB share them, and ASPs of
+ * another APB only do if its pid matches ours in those bits.
+ */
+#define ASP_CATEGORY_SLOTS 4096
+static unsigned char asp_category_slots[ASP_CATEGORY_SLOTS / 8];
+static unsigned int next_asp_category_slot;
+static GMutex asp_category_slots_lock;
+
+static int claim_category_slot(void)
+{
+    int slot = -EAGAIN;
+
+    g_mutex_lock(&asp_category_slots_lock);
+    for(unsigned int i = 0; i < ASP_CATEGORY_SLOTS; i++) {
+        unsigned int s = (next_asp_category_slot + i) % ASP_CATEGORY_SLOTS;
+        if(!(asp_category_slots[s / 8] & (1 << (s % 8)))) {
+            asp_category_slots[s / 8] |= (unsigned char)(1 << (s % 8));
+            next_asp_category_slot = s + 1;
+            slot = (int)s;
+            break;
+        }
+    }
+    g_mutex_unlock(&asp_category_slots_lock);
+    return slot;
+}
+
+static void release_category_slot(struct asp *asp)
+{
+    int s = asp->category_slot;
+
+    if(s < 0) {
+        return;
+    }
+    g_mutex_lock(&asp_category_slots_lock);
+    asp_category_slots[s / 8] &= (unsigned char)~(1 << (s % 8));
+    g_mutex_unlock(&asp_category_slots_lock);
+    asp->category_slot = -1;
+}
+
 static int asp_is_running(struct asp *asp)
 {
     return asp->pid > 0;
 }
 
-/**
- * Calls waitpid() on the pid of the passed asp
- * Returns -EINVAL if asp is NULL or not running,
- *         -1 if waitpid() failed,
- *         WIFEXTED of the exit status of the ASP otherwise
+static int64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * A pidfd becomes readable when its process exits, so any number of
+ * ASPs can be waited on with one poll(). Without kernel support (before
+ * Linux 5.3) this returns -1 and the ASP is checked on with WNOHANG.
  */
-int wait_asp(struct asp *asp)
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * Reap the ASP and turn its wait status into wait_asp()'s return value.
+ */
+static int reap_asp(struct asp *asp, int options)
 {
     int exitstatus = 0;
-    int ret_val = 0;
-    if (!asp || !asp_is_running(asp)) {
-        return -EINVAL;
+    pid_t pid = asp->pid;
+    pid_t ret;
+
+    do {
+        ret = waitpid(pid, &exitstatus, options);
+    } while(ret < 0 && errno == EINTR);
+    if(ret == 0) {
+        return -EAGAIN;
     }
 
-    ret_val = waitpid(asp->pid, &exitstatus, 0);
-    if (ret_val == -1) {
-        dlog(0, "Error: waitpid failure\n");
-        return ret_val;
+    if(asp->pidfd >= 0) {
+        close(asp->pidfd);
     }
+    asp->pidfd    = -1;
+    asp->pid      = 0;
+    asp->deadline = 0;
+    release_category_slot(asp);
 
-    asp->pid = 0;
+    if (ret == -1) {
+        dlog(0, "Error: waitpid failure\n");
+        return -1;
+    }
 
     if (WIFEXITED(exitstatus)) {
-        dlog(4, "PID %d exited with status %d\n", asp->pid, WEXITSTATUS(exitstatus));
+        dlog(4, "PID %d exited with status %d\n", pid, WEXITSTATUS(exitstatus));
         return WEXITSTATUS(exitstatus);
     } else {
-        dlog(4, "PID %d exited without an exit status\n", asp->pid);
+        dlog(4, "PID %d exited without an exit status\n", pid);
         return 0;
     }
 }
 
+int wait_asps(struct asp **asps, size_t nr_asps, int *statuses)
+{
+    struct pollfd pfds[nr_asps > 0 ? nr_asps : 1];
+    size_t polled[nr_asps > 0 ? nr_asps : 1];
+    size_t remaining = 0;
+    size_t i;
+
+    for(i = 0; i < nr_asps; i++) {
+        if(asps[i] == NULL || !asp_is_running(asps[i])) {
+            statuses[i] = -EINVAL;
+        } else {
+            statuses[i] = -EAGAIN;
+            remaining++;
+        }
+    }
+
+    while(remaining > 0) {
+        int64_t now = monotonic_ms();
+        int64_t timeout = -1;
+        nfds_t nfds = 0;
+
+        for(i = 0; i < nr_asps; i++) {
+            struct asp *asp = asps[i];
+            if(statuses[i] != -EAGAIN) {
+                continue;
+            }
+            if(asp->pidfd < 0 && (statuses[i] = reap_asp(asp, WNOHANG)) != -EAGAIN) {
+                remaining--;
+                continue;
+            }
+            if(asp->deadline > 0 && now >= asp->deadline) {
+                dlog(0, "ASP %s (PID %d) timed out after %us, killing it\n",
+                     asp->name, asp->pid, asp->timeout);
+                kill(asp->pid, SIGKILL);
+                reap_asp(asp, 0);
+                statuses[i] = -ETIMEDOUT;
+                remaining--;
+                continue;
+            }
+            if(asp->deadline > 0 && (timeout < 0 || asp->deadline - now < timeout)) {
+                timeout = asp->deadline - now;
+            }
+            if(asp->pidfd < 0) {
+                if(timeout < 0 || timeout > WAIT_ASP_POLL_MS) {
+                    timeout = WAIT_ASP_POLL_MS;
+                }
+            } else {
+                pfds[nfds].fd     = asp->pidfd;
+                pfds[nfds].events = POLLIN;
+                polled[nfds++]    = i;
+            }
+        }
+        if(remaining == 0) {
+            break;
+        }
+
+        if(poll(pfds, nfds, (int)timeout) < 0) {
+            /* revents is not written when poll() fails */
+            if(errno == EINTR) {
+                continue;
+            }
+            dlog(0, "Error: poll on ASP pidfds failed: %s\n", strerror(errno));
+            return -errno;
+        }
+        for(i = 0; i < nfds; i++) {
+            if(pfds[i].revents != 0) {
+                statuses[polled[i]] = reap_asp(asps[polled[i]], 0);
+                remaining--;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Waits for the passed asp to exit, or kills it if it runs past its
+ * timeout.
+ * Returns -EINVAL if asp is NULL or not running,
+ *         -ETIMEDOUT if the ASP timed out,
+ *         -1 if waitpid() failed,
+ *         WIFEXTED of the exit status of the ASP otherwise
+ */
+int wait_asp(struct asp *asp)
+{
+    int status;
+    int ret_val;
+
+    if (!asp || !asp_is_running(asp)) {
+        return -EINVAL;
+    }
+
+    if((ret_val = wait_asps(&asp, 1, &status)) < 0) {
+        return ret_val;
+    }
+    return status;
+}
+
 /**
  * kills the pid of the passed asp
  */
 int stop_asp(struct asp *asp)
 {
     int ret_val = 0;
+    struct pollfd pfd;
+    int64_t deadline, left;
+
     if (!asp) {
         return -ENOENT;
     }
+    if (!asp_is_running(asp)) {
+        return ret_val;
+    }
 
     //function description says this is supposed to call the ASP's exit function
     dlog(2, "Sending SIGHUP to pid %d\n", asp->pid);
     kill(asp->pid, SIGHUP);
 
-    sleep(3);
+    /* give it a chance to exit cleanly, but no longer than it needs */
+    deadline = monotonic_ms() + STOP_ASP_GRACE_MS;
+    if(asp->pidfd >= 0) {
+        pfd.fd     = asp->pidfd;
+        pfd.events = POLLIN;
+        while((left = deadline - monotonic_ms()) > 0 &&
+                poll(&pfd, 1, (int)left) < 0 && errno == EINTR);
+        reap_asp(asp, WNOHANG);
+    } else {
+        while(monotonic_ms() < deadline && reap_asp(asp, WNOHANG) == -EAGAIN) {
+            usleep(WAIT_ASP_POLL_MS * 1000);
+        }
+    }
 
-    dlog(2, "Sending SIGKILL to pid %d\n", asp->pid);
-    kill(asp->pid, SIGKILL);
+    if(asp_is_running(asp)) {
+        dlog(2, "Sending SIGKILL to pid %d\n", asp->pid);
+        kill(asp->pid, SIGKILL);
+        reap_asp(asp, 0);
+    }
 
-    asp->pid     = 0;
     return ret_val;
 }
 
@@ -144,39 +343,26 @@ int stop_asp(struct asp *asp)
  * Provide all of the file descriptors followed by a -1 to indicate termination of the list. NOTE THAT
  * A -1 IS REQUIRED EVEN IF NO FILE DESCRIPTORS ARE SPECIFIED - the variadic arguments parsing library
  * will not know where to stop parsing otherwise and may close all sorts of random file descriptors.
+ *
+ * The ASP is started with posix_spawn() rather than fork(), so launching it does not copy the page
+ * tables of the APB, however large the APB is. Everything the child used to do between fork() and
+ * exec() is prepared here instead: the argument vector is built in the parent, the descriptors to
+ * close become spawn file actions, and the SELinux exec context is set on this thread for the spawn
+ * and reset afterwards.
  */
 int run_asp(struct asp *asp, int infd, int outfd, bool async, int asp_argc, char *asp_argv[], ...)
 {
-    pid_t pid = 0;
-
-    pid = fork();
-    if(pid < 0) {
-        dlog(0, "Fork failed: %s\n", strerror(errno));
-        return -1;
-    } else if(pid > 0) {
-        //Executing in the parent
-        asp->pid = pid;
-
-        if(async) {
-            return 0;
-        } else {
-            return wait_asp(asp);
-        }
-    }
-
-    //Executing in the child
-
-    /* Make sure any sensitive file descriptors are closed in the child */
-    int fd, len, err;
-    va_list args;
-    va_start(args, asp_argv);
-    while((fd = va_arg(args, int)) != -1) {
-        close(fd);
-    }
-    va_end(args);
-
+    posix_spawn_file_actions_t actions;
     int aspmain_argc = 0;
     char *aspmain_argv[asp_argc + 10];
+    char infd_str[16];
+    char outfd_str[16];
+    pid_t pid = 0;
+    va_list args;
+    int fd, err;
+#ifdef USE_LIBCAP
+    char *cap_str = NULL;
+#endif
 
     aspmain_argv[aspmain_argc] = asp->file->full_filename; /* max(aspmain_argc) = 0 */
 
@@ -184,63 +370,16 @@ int run_asp(struct asp *asp, int infd, int outfd, bool async, int asp_argc, char
      * Note: this does not only fulfill a protective purpose: some ASPs do not take an Infd and Outfd,
      * or at least not in this order. Defining these as negative 1 allows you to do this manually in argv */
     if (infd > -1) {
-        len = snprintf(NULL, 0, "%d", infd);
-        if(len < 0) {
-            dlog(0, "Unable to represent the in file descriptor as a string\n");
-            return -1;
-        }
-
-        /* Type coercion is justified because the value of len+1 should not exceed
-         * the semantic length of a file descriptor, which is lower than the maximum
-         * value which can be expressed by a size_t */
-        aspmain_argv[++aspmain_argc] = malloc((size_t)(len + 1)); /* max(aspmain_argc) = 1 */
-        if(aspmain_argv[aspmain_argc] == NULL) {
-            dlog(0, "Unable to allocate memory for temporary buffer\n");
-            return -1;
-        }
-
-        /* Type coercion is justified because the length of the buffer will never exceed the
-         * maximum semantic length of an int, which should be smaller than a size_t */
-        err = snprintf(aspmain_argv[aspmain_argc], (size_t)(len + 1), "%d", infd);
-        if(err < len) {
-            dlog(0, "Unable to convert the in file descriptor to a string\n");
-            free(aspmain_argv[aspmain_argc]); /* infd slot */
-            return -1;
-        }
+        snprintf(infd_str, sizeof(infd_str), "%d", infd);
+        aspmain_argv[++aspmain_argc] = infd_str;    /* max(aspmain_argc) = 1 */
     }
 
     if(outfd > -1) {
-        len = snprintf(NULL, 0, "%d", outfd);
-        if(len < 0) {
-            dlog(0, "Unable to represent the out file descriptor as a string\n");
-            free(aspmain_argv[aspmain_argc]); /* infd slot */
-            return -1;
-        }
-
-        /* Type coercion is justified because the value of len+1 should not exceed
-         * the semantic length of a file descriptor, which is lower than the maximum
-         * value which can be expressed by a size_t */
-        aspmain_argv[++aspmain_argc] = malloc((size_t)(len + 1));  /* max(aspmain_argc) = 2 */
-        if(aspmain_argv[aspmain_argc] == NULL) {
-            dlog(0, "Unable to allocate memory for temporary buffer\n");
-            free(aspmain_argv[aspmain_argc-1]); /* infd slot */
-            return -1;
-        }
-
-        /* Type coercion is justified because the length of the buffer will never exceed the
-         * maximum semantic length of an int, which should be smaller than a size_t */
-        err = snprintf(aspmain_argv[aspmain_argc], (size_t)(len + 1), "%d", outfd);
-        if(err < len) {
-            dlog(0, "Unable to convert the out file descriptor to a string\n");
-            free(aspmain_argv[aspmain_argc]);    /* outfd */
-            free(aspmain_argv[aspmain_argc-1]);  /* infd */
-            return -1;
-        }
+        snprintf(outfd_str, sizeof(outfd_str), "%d", outfd);
+        aspmain_argv[++aspmain_argc] = outfd_str;   /* max(aspmain_argc) = 2 */
     }
 
 #ifdef USE_LIBCAP
-    char *cap_str = NULL;
-
     if(asp->desired_sec_ctxt.cap_set) {
         cap_str = cap_to_text(asp->desired_sec_ctxt.capabilities, NULL);
         aspmain_argv[++aspmain_argc] = "-c";              /* max(aspmain_argc) = 3 */
@@ -256,18 +395,58 @@ int run_asp(struct asp *asp, int infd, int outfd, bool async, int asp_argc, char
     aspmain_argc++;
     aspmain_argv[aspmain_argc] = NULL;
 
-    exe_sec_ctxt_set_execcon(asp->file->full_filename,
-                             &asp->desired_sec_ctxt,
-                             libmaat_apbmain_asps_respect_desired_execcon,
-                             libmaat_apbmain_asps_use_unique_categories,
-                             256, 0, 0);
+    /* Make sure any sensitive file descriptors are closed in the child */
+    posix_spawn_file_actions_init(&actions);
+    va_start(args, asp_argv);
+    while((fd = va_arg(args, int)) != -1) {
+        posix_spawn_file_actions_addclose(&actions, fd);
+    }
+    va_end(args);
 
-    dlog(5, "PRESENTATION MODE (self): APB forks ASP of name %s.\n", asp->name);
-    dlog(6, "Executing ASP executable: %s\n", asp->file->full_filename);
-    execv(asp->file->full_filename, aspmain_argv);
-    dlog(0, "Failed to exec the ASP \"%s\": %s\n", asp->name, strerror(errno));
+    err = 0;
+    if(libmaat_apbmain_asps_use_unique_categories == EXECCON_SET_UNIQUE_CATEGORIES &&
+            (err = claim_category_slot()) >= 0) {
+        asp->category_slot = err;
+        err = 0;
+    }
+    if(err == 0) {
+        err = exe_sec_ctxt_try_set_execcon(asp->file->full_filename,
+                                           &asp->desired_sec_ctxt,
+                                           libmaat_apbmain_asps_respect_desired_execcon,
+                                           libmaat_apbmain_asps_use_unique_categories,
+                                           ((getpid() & 0xfff) << 12) |
+                                           (asp->category_slot & 0xfff),
+                                           256, 0, 0);
+    }
+    if(err == 0) {
+        dlog(5, "PRESENTATION MODE (self): APB spawns ASP of name %s.\n", asp->name);
+        dlog(6, "Executing ASP executable: %s\n", asp->file->full_filename);
+        err = posix_spawn(&pid, asp->file->full_filename, &actions, NULL,
+                          aspmain_argv, environ);
+        exe_sec_ctxt_clear_execcon();
+    } else {
+        err = -err;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+#ifdef USE_LIBCAP
+    cap_free(cap_str);
+#endif
 
-    return -1;
+    if(err != 0) {
+        dlog(0, "Failed to spawn the ASP \"%s\": %s\n", asp->name, strerror(err));
+        release_category_slot(asp);
+        return -1;
+    }
+
+    asp->pid      = pid;
+    asp->pidfd    = open_pidfd(pid);
+    asp->deadline = asp->timeout > 0 ? monotonic_ms() + (int64_t)asp->timeout * 1000 : 0;
+
+    if(async) {
+        return 0;
+    } else {
+        return wait_asp(asp);
+    }
 }
 
 /*
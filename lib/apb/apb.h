@@ -37,10 +37,23 @@
 int stop_asp(struct asp *asp);
 
 /**
- * Waits for the asp to finish
+ * Waits for the asp to finish. An ASP whose metadata sets a <timeout>
+ * is killed once it has run that many seconds, and -ETIMEDOUT is
+ * returned.
  */
 int wait_asp(struct asp *asp);
 
+/**
+ * Waits for all @nr_asps ASPs in @asps, started asynchronously with
+ * run_asp(), reaping each as soon as it exits. They are waited on
+ * together, so one slow ASP does not delay reaping the others, and
+ * each is killed when it runs past its own timeout. The result for
+ * @asps[i], as wait_asp() would return it, is stored in @statuses[i].
+ *
+ * Returns 0, or a negative errno if waiting failed.
+ */
+int wait_asps(struct asp **asps, size_t nr_asps, int *statuses);
+
 /*
  * Spawns a child process which will run the asp specified by the asp struct. The specified infd and
  * outfd will be passed to the command line as a file descriptor to read from and a file descriptor to
@@ -56,6 +69,9 @@ int wait_asp(struct asp *asp);
  * A -1 IS REQUIRED EVEN IF NO FILE DESCRIPTORS ARE SPECIFIED - the variadic arguments parsing library
  * will not know where to stop parsing otherwise and may close all sorts of random file descriptors.
  *
+ * The ASP is launched with posix_spawn(), so the cost of launching it does not grow with the size of
+ * the APB.
+ *
  * Most APBs assume async is false, but the APBs generated by the Ocaml compiler asssume that they are
  * asynchronous. If run_asp executed with async set to true, invoke wait_asp or stop_asp on asp before
  * using run_asp again, otherwise, the PID of the first invocation of run_asp will be lost.
@@ -32,6 +32,7 @@
 #include <util/crypto.h>
 #include <util/maat-io.h>
 #include <util/signfile.h>
+#include <util/sign.h>
 
 #include <common/scenario.h>
 
@@ -41,6 +42,7 @@
 
 static int handle_satisfier(struct scenario *scen, xmlNode *sat,
                             const char *workdir, appraise_fn *appraise,
+                            const unsigned char *payload, size_t payload_size,
                             int *failed)
 {
     GList *values = NULL, *vals = NULL;
@@ -52,6 +54,7 @@ static int handle_satisfier(struct scenario *scen, xmlNode *sat,
     size_t encsize, keysize;
     size_t zipsize;
     size_t msmtsize;
+    int owned;			/* the current stage's buffer is ours to b64_free() */
     unsigned char key[16], iv[16];
     char scratch[200];
     int fail;
@@ -122,23 +125,48 @@ static int handle_satisfier(struct scenario *scen, xmlNode *sat,
             free(rawkey);
         }
 
-        b64msmt = xmlNodeGetContentASCII(tmp);
-        if(b64msmt == NULL) {
-            dlog(1, "Failed to extract base64 encoded measurement\n");
-            continue;
-        }
+        if(is_detached_payload(tmp)) {
+            if(check_detached_payload(tmp, payload, payload_size) != 1) {
+                /*
+                 * The contract signature only covers the payload's
+                 * digest, so a payload that is missing or does not
+                 * match it fails the appraisal.
+                 */
+                dlog(1, "Detached measurement does not match its contract\n");
+                xmlNewTextChild(sat, NULL, (xmlChar*)"result", (xmlChar*)"FAIL");
+                dlog(5, "PRESENTATION MODE (self): Appraisal result: FAIL\n");
+                *failed = 1;
+                xmlUnlinkNode(tmp);
+                xmlFreeNode(tmp);
+                break;
+            }
+            /* the payload belongs to the caller, so it is read in place */
+            encmsmt = (void *)payload;
+            encsize = payload_size;
+            owned = 0;
+        } else {
+            b64msmt = xmlNodeGetContentASCII(tmp);
+            if(b64msmt == NULL) {
+                dlog(1, "Failed to extract base64 encoded measurement\n");
+                continue;
+            }
 
-        encmsmt = b64_decode(b64msmt, &encsize);
-        xmlFree(b64msmt);
+            encmsmt = b64_decode(b64msmt, &encsize);
+            xmlFree(b64msmt);
+            owned = 1;
+        }
 
         if(is_encrypted) {
             ret = decrypt_buffer(key, iv, encmsmt, encsize,
                                  &zipmsmt, &zipsize);
-            b64_free(encmsmt);
+            if(owned) {
+                b64_free(encmsmt);
+            }
             if(ret < 0) {
                 dlog(1, "Failed to decrypt buffer\n");
                 continue;
             }
+            owned = 1;
         } else {
             zipmsmt = encmsmt;
             zipsize = encsize;
@@ -146,11 +174,14 @@ static int handle_satisfier(struct scenario *scen, xmlNode *sat,
 
         if(is_compressed) {
             ret = uncompress_buffer(zipmsmt, zipsize, &msmt, &msmtsize);
-            b64_free(zipmsmt);
+            if(owned) {
+                b64_free(zipmsmt);
+            }
             if(ret < 0) {
                 dlog(1, "Failed to uncompress buffer\n");
                 continue;
             }
+            owned = 1;
         } else {
             msmt = zipmsmt;
             msmtsize = zipsize;
@@ -183,7 +214,9 @@ static int handle_satisfier(struct scenario *scen, xmlNode *sat,
             fail = 0;
             /* Maat would add a POM here */
         }
-        b64_free(msmt);
+        if(owned) {
+            b64_free(msmt);
+        }
 
         /* Remove the measurement from the contract and exit */
         xmlUnlinkNode(tmp);
@@ -202,6 +235,169 @@ static int handle_satisfier(struct scenario *scen, xmlNode *sat,
     return fail;
 }
 
+/*
+ * Subcontracts are verified on a pool of at most this many threads.
+ */
+#define MAX_VERIFY_THREADS 8
+
+struct subcontract_check {
+    xmlDoc *doc;
+    xmlNode *node;
+    X509 *cert;
+    X509 *cacert;
+    struct scenario *scen;
+    int result;
+};
+
+static void verify_subcontract(gpointer data, gpointer user_data UNUSED)
+{
+    struct subcontract_check *chk = data;
+    struct scenario *scen = chk->scen;
+
+    chk->result = verify_xml_x509(chk->doc, chk->node, chk->cert, chk->cacert,
+                                  scen->nonce, scen->akpubkey,
+                                  scen->verify_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL);
+}
+
+/*
+ * Find the certificate with fingerprint @fprint: first among the
+ * credentials carried by @doc, then among those saved under @prefix
+ * by an earlier stage of the negotiation. Certificates are loaded
+ * once and kept in @certs.
+ */
+static X509 *subcontract_signer(xmlDoc *doc, GHashTable *certs,
+                                const char *prefix, xmlNode *subc)
+{
+    xmlXPathObject *obj;
+    X509 *cert = NULL;
+    char *fprint;
+    char *certfile;
+    int i;
+
+    if((fprint = signature_key_fingerprint(subc)) == NULL) {
+        return NULL;
+    }
+    if((cert = g_hash_table_lookup(certs, fprint)) != NULL) {
+        free(fprint);
+        return cert;
+    }
+
+    obj = xpath(doc, "/contract/AttestationCredential");
+    for(i = 0; obj && obj->nodesetval && i < obj->nodesetval->nodeNr && !cert; i++) {
+        xmlNode *node = obj->nodesetval->nodeTab[i];
+        char *nodefpr = validate_pubkey_fingerprint(xmlGetProp(node, (xmlChar*)"fingerprint"),
+                        SIZE_MAX);
+        char *pem;
+
+        if(nodefpr != NULL && strcmp(nodefpr, fprint) == 0 &&
+                (pem = xmlNodeGetContentASCII(node)) != NULL) {
+            cert = load_cert_mem(pem, strlen(pem));
+            xmlFree(pem);
+        }
+        free(nodefpr);
+    }
+    xmlXPathFreeObject(obj);
+
+    if(cert == NULL && (certfile = construct_cert_filename(prefix, subc)) != NULL) {
+        cert = load_cert(certfile);
+        free(certfile);
+    }
+
+    if(cert != NULL) {
+        g_hash_table_insert(certs, fprint, cert);
+    } else {
+        dlog(1, "No certificate for subcontract signer %s\n", fprint);
+        free(fprint);
+    }
+    return cert;
+}
+
+/*
+ * Verify the signature of each subcontract in @subcobj. Certificates
+ * are loaded once and subcontracts signed with openssl are checked
+ * concurrently. Returns 0 if all signatures are good.
+ */
+static int verify_subcontracts(struct scenario *scen, xmlDoc *doc,
+                               xmlXPathObject *subcobj, const char *credprefix)
+{
+    struct subcontract_check *checks;
+    GHashTable *certs;
+    GThreadPool *pool = NULL;
+    X509 *cacert = NULL;
+    int nr = 0;
+    int ret = -1;
+    int i;
+
+    checks = calloc((size_t)subcobj->nodesetval->nodeNr + 1, sizeof(*checks));
+    certs = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                  (GDestroyNotify)X509_free);
+    if(checks == NULL || certs == NULL) {
+        goto out;
+    }
+
+    /*
+     * Subcontracts are checked with openssl without TPM support, and
+     * with it whenever a subcontract carries no quote, so the CA
+     * certificate is needed unless every signature is a quote.
+     */
+    if(scen->cacert != NULL && scen->cacert[0] != '\0') {
+        cacert = load_cert(scen->cacert);
+    }
+#ifdef USE_TPM
+    if(cacert == NULL && !scen->verify_tpm) {
+#else
+    if(cacert == NULL) {
+#endif
+        dlog(0, "Failed to load CA certificate %s\n", scen->cacert ? : "(none)");
+        goto out;
+    }
+
+    for(i = 0; i < subcobj->nodesetval->nodeNr; i++) {
+        xmlNode *subc = subcobj->nodesetval->nodeTab[i];
+        if(subc->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        checks[nr].doc    = doc;
+        checks[nr].node   = subc;
+        checks[nr].scen   = scen;
+        checks[nr].cacert = cacert;
+        checks[nr].cert   = subcontract_signer(doc, certs, credprefix, subc);
+        checks[nr].result = -1;
+        nr++;
+    }
+
+    /* the TPM is not shared between threads */
+    if(nr > 1 && !scen->verify_tpm) {
+        pool = g_thread_pool_new(verify_subcontract, NULL,
+                                 MIN(nr, MIN((int)g_get_num_processors(), MAX_VERIFY_THREADS)),
+                                 TRUE, NULL);
+    }
+    for(i = 0; i < nr; i++) {
+        if(pool == NULL || !g_thread_pool_push(pool, &checks[i], NULL)) {
+            verify_subcontract(&checks[i], NULL);
+        }
+    }
+    if(pool != NULL) {
+        /* waits for every pushed check */
+        g_thread_pool_free(pool, FALSE, TRUE);
+    }
+
+    ret = 0;
+    for(i = 0; i < nr; i++) {
+        if(checks[i].result != 1) { /* 1 == good signature */
+            ret = -1;
+        }
+    }
+
+out:
+    X509_free(cacert);
+    if(certs != NULL) {
+        g_hash_table_destroy(certs);
+    }
+    free(checks);
+    return ret;
+}
+
 /*
  * Now to handle a measurement contract and produce an access contract.
  * Appraises a measurement
@@ -217,14 +413,23 @@ int handle_measurement_contract(struct scenario *scen, appraise_fn *appraise, in
     char tmpstr[200];
     int i = 0;
     int respsize = 0;
+    const unsigned char *payload = NULL;
+    size_t payload_size = 0;
+    size_t xml_size = 0;
     *failed = 0;
 
-    if(scen->size > INT_MAX) {
+    if(split_detached_payload((unsigned char *)scen->contract, scen->size,
+                              &xml_size, &payload, &payload_size) < 0) {
+        dlog(0, "Malformed measurement contract framing\n");
+        goto bad_xml;
+    }
+
+    if(xml_size > INT_MAX) {
         dlog(0, "Measurement contract is too big\n");
         goto bad_xml;
     }
 
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    doc = xmlReadMemory(scen->contract, (int)xml_size, NULL, NULL, 0);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         goto bad_xml;
@@ -268,24 +473,9 @@ int handle_measurement_contract(struct scenario *scen, appraise_fn *appraise, in
         goto no_subcontracts;
     }
 
-    for (i=0; i<subcobj->nodesetval->nodeNr; i++) {
-        if (subcobj->nodesetval->nodeTab[i]->type == XML_ELEMENT_NODE) {
-            if (scen->verify_tpm)
-                ret = verify_xml(doc,
-                                 subcobj->nodesetval->nodeTab[i], tmpstr,
-                                 scen->nonce, scen->akpubkey, SIGNATURE_TPM, scen->cacert);
-            else
-                ret = verify_xml(doc,
-                                 subcobj->nodesetval->nodeTab[i], tmpstr,
-                                 scen->nonce, scen->akpubkey, SIGNATURE_OPENSSL,
-                                 scen->cacert);
-
-
-            if (ret != 1) { /* 1 == good signature */
-                dlog(0, "subcontract signature failed\n");
-                goto subcontract_signature_failed;
-            }
-        }
+    if (verify_subcontracts(scen, doc, subcobj, tmpstr) != 0) {
+        dlog(0, "subcontract signature failed\n");
+        goto subcontract_signature_failed;
     }
     xmlXPathFreeObject(subcobj);
     subcobj = NULL;
@@ -306,10 +496,10 @@ int handle_measurement_contract(struct scenario *scen, appraise_fn *appraise, in
     for (i=0; i<optobj->nodesetval->nodeNr; i++) {
         if (optobj->nodesetval->nodeTab[i]->type == XML_ELEMENT_NODE) {
             dlog(4, "Handling satisfying option\n");
-            ret = handle_satisfier(scen, optobj->nodesetval->nodeTab[i],
-                                   scen->workdir, appraise, failed);
-            if (ret)
-                break;
+            /* every section of a multi-resource contract is appraised */
+            handle_satisfier(scen, optobj->nodesetval->nodeTab[i],
+                             scen->workdir, appraise, payload,
+                             payload_size, failed);
         }
     }
 
@@ -507,86 +697,52 @@ integrity_response_cleanup:
 }
 
 
-unsigned char *generate_measurement_contract(struct scenario *scen,
-        unsigned char *msmt, size_t msmtsize,
-        unsigned char **outbuf, size_t *outsize)
+/*
+ * Compresses @msmt, encrypts it for scen->partner_cert (if there is
+ * one) and adds it to @opt_node as a measurement node. If @payload is
+ * given the measurement is detached: the node is bound to it and
+ * *@payload is set to the buffer to send after the contract.
+ * Returns 0 on success, < 0 on error.
+ */
+static int add_measurement_node(struct scenario *scen, xmlNode *opt_node,
+                                unsigned char *msmt, size_t msmtsize,
+                                void **payload, size_t *payload_size)
 {
-    xmlDoc *doc		= NULL;
-    xmlNode *root		= NULL;
-    xmlNode *opt_node      	= NULL;
-    xmlNode *msmtnode       = NULL;
-    unsigned char *key	= NULL;
-    unsigned char *iv	= NULL;
-    void *compbuf		= NULL;
-    void *encbuf		= NULL;
-    void *b64               = NULL;
-    size_t compsize		= 0;
-    size_t encsize		= 0;
-    xmlXPathObject *obj     = NULL;
-    char *scratch;
-    char tmpstr[PATH_MAX];
+    xmlNode *msmtnode   = NULL;
+    unsigned char *key  = NULL;
+    unsigned char *iv   = NULL;
+    void *compbuf       = NULL;
+    void *encbuf        = NULL;
+    void *enckey        = NULL;
+    char *b64           = NULL;
+    size_t compsize     = 0;
+    size_t encsize      = 0;
+    size_t enckeysize   = 0;
     int ret;
 
-    if(scen->size > INT_MAX) {
-        dlog(0, "Contract too big!\n");
-        goto parse_failed;
-    }
-
-    /* FIXME: we should actually validate this  */
-    if ((doc = UNTAINT(xmlReadMemory(scen->contract, (int)scen->size,
-                                     NULL, NULL, 0))) == NULL) {
-        dlog(0, "bad xml?\n");
-        dlog(5, "\t%s\n", scen->contract);
-        goto parse_failed;
-    }
-
-    root = xmlDocGetRootElement(doc);
-    if (!root) {
-        dlog(0, "Unable to find root node?\n");
-        goto get_root_failed;
-    }
-
-    xmlSetProp(root, (xmlChar*)"type", (xmlChar*)"measurement");
-    obj = xpath(doc, CONTRACT_OPTION_XPATH_STR);
-
-    if (!obj || !obj->nodesetval) {
-        dlog(0, "Couldn't find option node in exe contract\n");
-        goto xpath_failed;
-    }
-
-    if (obj->nodesetval->nodeNr != 1) {
-        dlog(0, "Multiple option nodes in exe contract (%d)\n", obj->nodesetval->nodeNr);
-        goto xpath_failed;
-    }
-
-    opt_node = obj->nodesetval->nodeTab[0];
-    xmlXPathFreeObject(obj);
-    obj = NULL;
-
     // compress, encrypt, and insert measurement
     if ((ret = compress_buffer(msmt, msmtsize,
                                &compbuf, &compsize, 9)) < 0) {
         dlog(0, "Failed to compress measurement data %d\n", ret);
-        goto compress_failed;
+        goto out;
     }
+    ret = -1;
 
     if(scen->partner_cert) {
         if ((key = get_random_bytes(16)) == NULL) {
             dlog(0, "Failed to get random bytes for key\n");
-            goto genkey_failed;
+            goto out;
         }
 
         if ((iv = get_random_bytes(16)) == NULL) {
             dlog(0, "Failed to get random bytes for iv\n");
-            goto geniv_failed;
+            goto out;
         }
 
         if ((encrypt_buffer(key, iv, compbuf, compsize,
                             &encbuf, &encsize)) != 0) {
             dlog(0, "Failed to encrypt buffer\n");
-            goto encrypt_failed;
-        } else {
-            xmlSetProp(msmtnode, (xmlChar*)"encrypted", (xmlChar*)"true");
+            goto out;
         }
     } else {
         encbuf	= compbuf;
@@ -594,22 +750,22 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
         compbuf	= NULL;
     }
 
-    if ((b64 = b64_encode(encbuf, encsize)) == NULL) {
+    if (payload == NULL && (b64 = b64_encode(encbuf, encsize)) == NULL) {
         dlog(0, "Failed to base64 encode encrypted buffer\n");
-        goto b64_encode_failed;
+        goto out;
     }
 
     if((msmtnode = xmlNewTextChild(opt_node, NULL,
-                                   (xmlChar*)"measurement", b64)) == NULL) {
+                                   (xmlChar*)"measurement", (xmlChar*)b64)) == NULL) {
         dlog(0, "Failed to create measurement node\n");
-        goto msmtnode_failed;
+        goto out;
     }
 
-
-    free(encbuf);
-    //free(compbuf);
-    b64_free(b64);
-    encbuf = b64 = NULL;
+    if (payload != NULL &&
+            bind_detached_payload(msmtnode, encbuf, encsize) != 0) {
+        dlog(0, "Failed to bind detached measurement to contract\n");
+        goto out;
+    }
 
     xmlSetProp(msmtnode, (xmlChar*)"compressed", (xmlChar*)"true");
 
@@ -620,13 +776,14 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
         memcpy(keyivbuf + 16, iv, 16);
 
         if((rsa_encrypt_buffer(scen->partner_cert, keyivbuf,
-                               32, &encbuf, &encsize)) != 0) {
+                               32, &enckey, &enckeysize)) != 0) {
             dlog(0, "Failed to encrypt key\n");
-            goto encrypt_key_failed;
+            goto out;
         }
-        if((b64 = b64_encode(encbuf, encsize)) == NULL) {
+        b64_free(b64);
+        if((b64 = b64_encode(enckey, enckeysize)) == NULL) {
             dlog(0, "Failed to base64 encode key\n");
-            goto b64_encode_key_failed;
+            goto out;
         }
         xmlSetProp(msmtnode, (xmlChar*)"encrypted", (xmlChar*)"true");
         xmlSetProp(msmtnode, (xmlChar*)"key", (xmlChar*)b64);
@@ -634,6 +791,40 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
         xmlSetProp(msmtnode, (xmlChar*)"encrypted", (xmlChar*)"false");
     }
 
+    if (payload != NULL) {
+        /* keep the buffer around to append it to the serialized contract */
+        *payload      = encbuf;
+        *payload_size = encsize;
+        encbuf        = NULL;
+    }
+    ret = 0;
+
+out:
+    b64_free(b64);
+    free(enckey);
+    free(encbuf);
+    free(compbuf);
+    free(iv);
+    free(key);
+    return ret;
+}
+
+/*
+ * Signs the subcontract of the measurement contract @doc with
+ * scen->certfile (if one is given), saves it to the workdir and
+ * serializes it into *@outbuf, followed by @payload if it is not
+ * NULL. Returns *@outbuf, which is NULL on failure.
+ */
+static unsigned char *finish_measurement_contract(struct scenario *scen, xmlDoc *doc,
+        void *payload, size_t payload_size,
+        unsigned char **outbuf, size_t *outsize)
+{
+    xmlXPathObject *obj;
+    char *scratch;
+    char tmpstr[PATH_MAX];
+    int outsize_int;
+    int ret;
+
     /* sign contract with the cert (if one is given) */
     if(scen->certfile) {
         xmlNode *subc = NULL;
@@ -645,8 +836,6 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
             dlog(4, "Couldn't find subcontract for my type\n");
         } else {
             subc = obj->nodesetval->nodeTab[0];
-            xmlXPathFreeObject(obj);
-            obj = NULL;
             scratch = get_fingerprint(scen->certfile, NULL);
 
             ret = sign_xml(doc, subc, scratch, scen->keyfile, scen->keypass,
@@ -659,44 +848,191 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
 
             free(scratch);
         }
+        if(obj) xmlXPathFreeObject(obj);
     }
     snprintf(tmpstr, 200, "%s/measurement_contract.xml", scen->workdir);
     save_document(doc, tmpstr);
 
-    int outsize_int;
     xmlDocDumpMemory(doc, (xmlChar**)outbuf, &outsize_int);
 
-    if(outsize_int > 0) {
+    if(outsize_int > 0 && payload != NULL) {
+        unsigned char *xml = *outbuf;
+
+        if(frame_detached_payload(xml, (size_t)outsize_int, payload, payload_size,
+                                  outbuf, outsize) < 0) {
+            dlog(0, "Failed to attach measurement to contract\n");
+            *outbuf  = NULL;
+            *outsize = 0;
+        }
+        free(xml);
+    } else if(outsize_int > 0) {
         *outsize = (size_t)outsize_int;
     } else {
         free(*outbuf);
         *outbuf  = NULL;
         *outsize = 0;
     }
+    return *outbuf;
+}
+
+/*
+ * Parses the execute contract in @scen and turns it into the
+ * measurement contract to fill in. Returns the document and sets
+ * *@options to its options, or NULL on failure.
+ */
+static xmlDoc *start_measurement_contract(struct scenario *scen,
+        xmlXPathObject **options)
+{
+    xmlDoc *doc;
+    xmlNode *root;
+    xmlXPathObject *obj;
+
+    if(scen->size > INT_MAX) {
+        dlog(0, "Contract too big!\n");
+        return NULL;
+    }
+
+    /* FIXME: we should actually validate this  */
+    if ((doc = UNTAINT(xmlReadMemory(scen->contract, (int)scen->size,
+                                     NULL, NULL, 0))) == NULL) {
+        dlog(0, "bad xml?\n");
+        dlog(5, "\t%s\n", scen->contract);
+        return NULL;
+    }
+
+    root = xmlDocGetRootElement(doc);
+    if (!root) {
+        dlog(0, "Unable to find root node?\n");
+        xmlFreeDoc(doc);
+        return NULL;
+    }
+
+    xmlSetProp(root, (xmlChar*)"type", (xmlChar*)"measurement");
+    obj = xpath(doc, CONTRACT_OPTION_XPATH_STR);
+
+    if (!obj || !obj->nodesetval || obj->nodesetval->nodeNr == 0) {
+        dlog(0, "Couldn't find option node in exe contract\n");
+        if(obj) xmlXPathFreeObject(obj);
+        xmlFreeDoc(doc);
+        return NULL;
+    }
+
+    *options = obj;
+    return doc;
+}
+
+unsigned char *generate_measurement_contract(struct scenario *scen,
+        unsigned char *msmt, size_t msmtsize,
+        unsigned char **outbuf, size_t *outsize)
+{
+    xmlDoc *doc		= NULL;
+    xmlNode *opt_node      	= NULL;
+    void *payload           = NULL;
+    size_t payload_size     = 0;
+    int detached            = 0;
+    xmlXPathObject *obj     = NULL;
+
+    if ((doc = start_measurement_contract(scen, &obj)) == NULL) {
+        goto parse_failed;
+    }
+
+    if (obj->nodesetval->nodeNr != 1) {
+        dlog(0, "Multiple option nodes in exe contract (%d)\n", obj->nodesetval->nodeNr);
+        goto xpath_failed;
+    }
+
+    /* only send the measurement after the XML if the appraiser asked for it */
+    detached = is_detached_payload(xmlDocGetRootElement(doc));
+
+    opt_node = obj->nodesetval->nodeTab[0];
+    xmlXPathFreeObject(obj);
+    obj = NULL;
+
+    if (add_measurement_node(scen, opt_node, msmt, msmtsize,
+                             detached ? &payload : NULL, &payload_size) != 0) {
+        goto msmtnode_failed;
+    }
+
+    finish_measurement_contract(scen, doc, payload, payload_size,
+                                outbuf, outsize);
 
-b64_encode_key_failed:
-    free(encbuf);
-    encbuf = NULL;
-encrypt_key_failed:
 msmtnode_failed:
-    b64_free(b64);
-b64_encode_failed:
-    free(encbuf);
-encrypt_failed:
-    free(iv);
-geniv_failed:
-    free(key);
-genkey_failed:
-compress_failed:
-    free(compbuf);
+    free(payload);
 xpath_failed:
     if(obj) xmlXPathFreeObject(obj);
-get_root_failed:
     xmlFreeDoc(doc);
 parse_failed:
     return *outbuf;
 }
 
+unsigned char *generate_sectioned_measurement_contract(struct scenario *scen,
+        GList *sections, unsigned char **outbuf, size_t *outsize)
+{
+    xmlDoc *doc         = NULL;
+    xmlXPathObject *obj = NULL;
+    GList *l;
+    int i;
+
+    *outbuf  = NULL;
+    *outsize = 0;
+
+    if ((doc = start_measurement_contract(scen, &obj)) == NULL) {
+        return NULL;
+    }
+
+    if (obj->nodesetval->nodeNr != (int)g_list_length(sections)) {
+        dlog(0, "Execute contract has %d options for %u sections\n",
+             obj->nodesetval->nodeNr, g_list_length(sections));
+        goto out;
+    }
+
+    for (i = 0; i < obj->nodesetval->nodeNr; i++) {
+        xmlNode *opt_node = obj->nodesetval->nodeTab[i];
+        struct measurement_section *section = NULL;
+        xmlNode *val;
+        char *resource;
+
+        resource = xmlGetPropASCII(opt_node, "resource");
+        if (resource == NULL) {
+            dlog(0, "Option of a sectioned execute contract names no resource\n");
+            goto out;
+        }
+        for (l = sections; l != NULL && section == NULL; l = l->next) {
+            if (strcmp(((struct measurement_section *)l->data)->resource, resource) == 0) {
+                section = l->data;
+            }
+        }
+        if (section == NULL) {
+            dlog(0, "No measurement for resource %s\n", resource);
+            xmlFree(resource);
+            goto out;
+        }
+        xmlFree(resource);
+
+        /* the appraiser finds the section by this value */
+        val = xmlNewTextChild(opt_node, NULL, (xmlChar*)"value",
+                              (xmlChar*)section->resource);
+        if (val == NULL) {
+            dlog(0, "Failed to create resource value of section\n");
+            goto out;
+        }
+        xmlNewProp(val, (xmlChar*)"name", (xmlChar*)MEASUREMENT_SECTION_VALUE);
+
+        if (add_measurement_node(scen, opt_node, section->msmt,
+                                 section->msmtsize, NULL, NULL) != 0) {
+            dlog(0, "Failed to add measurement of resource %s\n", section->resource);
+            goto out;
+        }
+    }
+
+    finish_measurement_contract(scen, doc, NULL, 0, outbuf, outsize);
+
+out:
+    xmlXPathFreeObject(obj);
+    xmlFreeDoc(doc);
+    return *outbuf;
+}
+
 int generate_and_send_back_measurement_contract(int chan, struct scenario *scen,
         unsigned char *msmt, size_t msmtsize)
 {
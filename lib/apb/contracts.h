@@ -101,6 +101,35 @@ unsigned char *generate_measurement_contract(struct scenario *scen,
         unsigned char *msmt, size_t msmtsize,
         unsigned char **outbuf, size_t *outsize);
 
+/**
+ * The measurement of one resource of a multi-resource execute
+ * contract.
+ */
+struct measurement_section {
+    char *resource;
+    unsigned char *msmt;
+    size_t msmtsize;
+};
+
+/**
+ * Name of the value that identifies the resource of each option of
+ * a sectioned measurement contract. It is in the values list the
+ * appraise_fn of handle_measurement_contract() is given.
+ */
+#define MEASUREMENT_SECTION_VALUE "resource"
+
+/**
+ * Like generate_measurement_contract(), for an execute contract with
+ * an option per resource (see the resource attribute of its options).
+ * @sections is a list of struct measurement_section, one per option;
+ * each measurement is added to the option of its resource, with a
+ * MEASUREMENT_SECTION_VALUE value naming the resource, and the one
+ * subcontract signature covers them all. Measurements are never
+ * detached.
+ */
+unsigned char *generate_sectioned_measurement_contract(struct scenario *scen,
+        GList *sections, unsigned char **outbuf, size_t *outsize);
+
 /**
  * Given the current attestation scenario, the measurement evidence
  * (as a raw C string) to be returned, and its size, generate a
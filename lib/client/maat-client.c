@@ -105,10 +105,29 @@ int create_integrity_request(target_id_type_t target_typ,
 
     }
 
-    if((resource != NULL) &&
-            (xmlNewTextChild(root, NULL, (xmlChar*)"resource", resource) == NULL)) {
-        fprintf(stderr, "Failed to add resource identifier node to integrity request\n");
-        goto out;
+    /* each of a comma separated list of resources gets its own node */
+    if(resource != NULL) {
+        char *resources = strdup((char*)resource);
+        char *r, *next;
+
+        if(resources == NULL) {
+            fprintf(stderr, "Failed to copy resource identifiers for integrity request\n");
+            goto out;
+        }
+        for(r = resources; r != NULL; r = next) {
+            if((next = strchr(r, ',')) != NULL) {
+                *next++ = '\0';
+            }
+            if(*r == '\0') {
+                continue;
+            }
+            if(xmlNewTextChild(root, NULL, (xmlChar*)"resource", (xmlChar*)r) == NULL) {
+                fprintf(stderr, "Failed to add resource identifier node to integrity request\n");
+                free(resources);
+                goto out;
+            }
+        }
+        free(resources);
     }
 
     if((nonce != NULL) &&
@@ -78,7 +78,9 @@ target_id_type_t parse_target_id_type(unsigned char *typname);
  *                by this attestation. The receiving AM will use this
  *                as an input to the selection process to by comparing
  *                it against match_condition nodes with
- *                attr="resource".
+ *                attr="resource". Several resources may be given
+ *                separated by commas; they are attested together
+ *                and reported in one response.
  *   @nonce:      a string indicating freshness of the attestation.
  *                The nonce is preserved through use cases where
  *                multiple negotiations occur.
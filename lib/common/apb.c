@@ -111,6 +111,57 @@ void parse_asps(struct apb *apb, GList *asps, xmlNode *asps_node)
     return;
 }
 
+/*
+ * Parse the local settings of an APB, given as
+ *
+ *     <config>
+ *       <option name="premeasure_dir">/var/lib/maat</option>
+ *     </config>
+ *
+ * into apb->config. Later options override earlier ones with the same
+ * name.
+ */
+static void parse_config(struct apb *apb, xmlNode *config_node)
+{
+    xmlNode *opt;
+    struct key_value *kv;
+    char *name, *unstripped, *stripped;
+
+    for (opt = config_node->children; opt; opt = opt->next) {
+        char *optname = validate_cstring_ascii(opt->name, SIZE_MAX);
+        if (opt->type != XML_ELEMENT_NODE || optname == NULL ||
+                strcasecmp(optname, "option") != 0) {
+            continue;
+        }
+
+        name = xmlGetPropASCII(opt, "name");
+        if (name == NULL) {
+            dlog(2, "Warning: APB config option without a name, skipping\n");
+            continue;
+        }
+
+        unstripped = xmlNodeGetContentASCII(opt);
+        if (unstripped == NULL || strip_whitespace(unstripped, &stripped) < 0) {
+            dlog(2, "Warning: failed to read APB config option %s\n", name);
+            free(unstripped);
+            free(name);
+            continue;
+        }
+        free(unstripped);
+
+        kv = malloc(sizeof(*kv));
+        if (kv == NULL) {
+            dlog(0, "Error: failed to allocate APB config option\n");
+            free(stripped);
+            free(name);
+            continue;
+        }
+        kv->key	  = name;
+        kv->value = stripped;
+        apb->config = g_list_prepend(apb->config, kv);
+    }
+}
+
 struct apb *load_apb_info(const char *xmlfile, GList *asps, GList *meas_specs)
 {
     xmlDoc *doc = NULL;
@@ -255,6 +306,11 @@ struct apb *load_apb_info(const char *xmlfile, GList *asps, GList *meas_specs)
             parse_exe_sec_ctxt(&apb->desired_sec_ctxt, tmp);
             continue;
         }
+
+        if (strcasecmp(tmpname, "config") == 0) {
+            parse_config(apb, tmp);
+            continue;
+        }
     }
     xmlFreeDoc(doc);
     doc = NULL;
@@ -441,6 +497,10 @@ void unload_apb(struct apb *apb)
         g_list_free(apb->asps);
     }
 
+    if(apb->config) {
+        g_list_free_full(apb->config, (GDestroyNotify)free_key_value);
+    }
+
     free_exe_sec_ctxt(&apb->desired_sec_ctxt);
 
     free(apb);
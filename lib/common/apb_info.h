@@ -66,6 +66,11 @@ struct apb {
                              * List of information that this APB has with
                              * respect to each place it interacts with
 			     */
+    GList *config;      /**
+			 * struct key_value settings from the
+			 * <config> element of the APB's metadata,
+			 * which the APB trusts over its arguments
+			 */
 
     exe_sec_ctxt desired_sec_ctxt;
 };
@@ -72,6 +72,8 @@ struct asp *load_asp_info(const char *xmlfile)
     }
     memset(asp, 0, sizeof(struct asp));
     asp->filename = strdup(xmlfile);
+    asp->pidfd = -1;
+    asp->category_slot = -1;
 
     asp->metadata_version = 0;
     char *version_str = xmlGetPropASCII(root, "version");
@@ -153,6 +155,44 @@ struct asp *load_asp_info(const char *xmlfile)
             parse_exe_sec_ctxt(&asp->desired_sec_ctxt, tmp);
             continue;
         }
+
+        if (strcasecmp(tmpname, "timeout") == 0) {
+            unstripped = xmlNodeGetContentASCII(tmp);
+
+            ret = strip_whitespace(unstripped, &stripped);
+            free(unstripped);
+            if (ret) {
+                dlog(2, "Unable to strip whitespace from ASP timeout\n");
+                continue;
+            }
+
+            if(sscanf(stripped, "%u", &asp->timeout) != 1) {
+                dlog(1, "WARNING: invalid ASP timeout \"%s\" (defaulting to none)\n",
+                     stripped);
+                asp->timeout = 0;
+            }
+            free(stripped);
+            continue;
+        }
+
+        if (strcasecmp(tmpname, "batch") == 0) {
+            unstripped = xmlNodeGetContentASCII(tmp);
+
+            ret = strip_whitespace(unstripped, &stripped);
+            free(unstripped);
+            if (ret) {
+                dlog(2, "Unable to strip whitespace from ASP batch size\n");
+                continue;
+            }
+
+            if(sscanf(stripped, "%u", &asp->batch) != 1) {
+                dlog(1, "WARNING: invalid ASP batch size \"%s\" (defaulting to one node)\n",
+                     stripped);
+                asp->batch = 0;
+            }
+            free(stripped);
+            continue;
+        }
     }
     xmlFreeDoc(doc);
 
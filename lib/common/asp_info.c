@@ -97,6 +97,11 @@ int copy_asp(struct asp **dest, struct asp *src)
     //Special
     uuid_copy(tmp->uuid, src->uuid);
     tmp->pid = 0;
+    tmp->pidfd = -1;
+    tmp->category_slot = -1;
+    tmp->timeout = src->timeout;
+    tmp->batch = src->batch;
+    tmp->deadline = 0;
 
     if((ret_val = copy_xml_file_info(&tmp->file, src->file)) != 0) {
         goto file_error;
@@ -40,6 +40,29 @@ struct asp {
     uuid_t uuid;
     struct xml_file_info *file;
     pid_t pid;
+    int pidfd;                         /**< pidfd of the running ASP, or -1 */
+    int category_slot;                 /**
+					* SELinux category slot held
+					* by the running ASP, or -1
+					*/
+    unsigned int timeout;              /**
+					* seconds the ASP may run
+					* before it is killed, from
+					* the metadata's <timeout>; 0
+					* for no limit
+					*/
+    unsigned int batch;                /**
+					* most nodes the ASP measures
+					* in one run, passed as a
+					* comma separated list of
+					* ids, from the metadata's
+					* <batch>; 0 if it takes one
+					*/
+    int64_t deadline;                  /**
+					* CLOCK_MONOTONIC milliseconds
+					* at which the running ASP
+					* times out, or 0
+					*/
 
     exe_sec_ctxt desired_sec_ctxt;     /**
 					* How does this ASP want to be
@@ -20,6 +20,7 @@
 #include <config.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -1085,11 +1086,108 @@ int parse_copland_from_pair_list(const char *phrase_and_args, const GList *phras
  * Parse the Copland Phrase with respect to a list of APBs which contain Copland Phrase templates.
  * Returns 0 if the phrase can be parsed or -1 otherwise.
  */
-int parse_copland_from_apb_list(const char *phrase_and_args, const GList *apbs, copland_phrase **phrase)
+static int parse_single_copland(const char *phrase_and_args, const GList *apbs, copland_phrase **phrase)
 {
     struct apb *apb;
     GList *l;
 
+    for(l = (GList *) apbs; l && l->data; l = g_list_next(l)) {
+        apb = (struct apb *)l->data;
+
+        if(parse_copland_from_pair_list(phrase_and_args, apb->phrase_specs, phrase) == 0) {
+            return 0;
+        }
+
+    }
+    return -1;
+}
+
+/*
+ * Parses each of the @branch_strs with respect to the APBs into a
+ * GList of copland phrases returned in *@branches. Returns 0 on
+ * success or -1 if some branch is not carried out by any APB.
+ */
+static int parse_branch_list(GList *branch_strs, const GList *apbs, GList **branches)
+{
+    copland_phrase *branch;
+    GList *l;
+
+    *branches = NULL;
+    for(l = branch_strs; l != NULL; l = l->next) {
+        if(parse_single_copland(l->data, apbs, &branch) < 0) {
+            dlog(3, "No APB carries out the branch \"%s\"\n", (char *)l->data);
+            g_list_free_full(*branches, free_copland_phrase_glist);
+            *branches = NULL;
+            return -1;
+        }
+        *branches = g_list_append(*branches, branch);
+    }
+    return 0;
+}
+
+/*
+ * Parses a branch-parallel phrase into a phrase without arguments
+ * whose string is the parsed branches joined by COPLAND_BRANCH_OP, so
+ * that both sides of a negotiation compare the same string however
+ * the phrase was written. Returns 0 on success and -1 otherwise.
+ */
+static int parse_branched_copland(const char *phrase_and_args, const GList *apbs,
+                                  copland_phrase **phrase)
+{
+    GList *strs = NULL, *branches = NULL, *l;
+    GString *joined;
+    copland_phrase *tmp;
+    char *str;
+    int ret = -1;
+
+    if(split_copland_branches(phrase_and_args, &strs) <= 0) {
+        return -1;
+    }
+    if(parse_branch_list(strs, apbs, &branches) < 0) {
+        goto out;
+    }
+
+    joined = g_string_new(NULL);
+    for(l = branches; l != NULL; l = l->next) {
+        if(copland_phrase_to_string(l->data, &str) < 0) {
+            g_string_free(joined, TRUE);
+            goto out;
+        }
+        if(l != branches) {
+            g_string_append(joined, " " COPLAND_BRANCH_OP " ");
+        }
+        g_string_append(joined, str);
+        free(str);
+    }
+
+    tmp = calloc(1, sizeof(copland_phrase));
+    if(tmp == NULL) {
+        dlog(0, "Unable to allocate memory for copland phrase\n");
+        g_string_free(joined, TRUE);
+        goto out;
+    }
+    tmp->phrase = strdup(joined->str);
+    g_string_free(joined, TRUE);
+    if(tmp->phrase == NULL) {
+        free(tmp);
+        goto out;
+    }
+    tmp->role = ACTUAL;
+    *phrase = tmp;
+    ret = 0;
+
+out:
+    g_list_free_full(branches, free_copland_phrase_glist);
+    g_list_free_full(strs, free);
+    return ret;
+}
+
+/*
+ * Parse the Copland Phrase with respect to a list of APBs which contain Copland Phrase templates.
+ * Returns 0 if the phrase can be parsed or -1 otherwise.
+ */
+int parse_copland_from_apb_list(const char *phrase_and_args, const GList *apbs, copland_phrase **phrase)
+{
     if(phrase == NULL || phrase_and_args == NULL || apbs == NULL) {
         dlog(1, "Null argument provided\n");
         return -1;
@@ -1097,19 +1195,154 @@ int parse_copland_from_apb_list(const char *phrase_and_args, const GList *apbs,
 
     dlog(6, "Parsing Copland phrase: %s\n", phrase_and_args);
 
-    for(l = (GList *) apbs; l && l->data; l = g_list_next(l)) {
-        apb = (struct apb *)l->data;
+    if(parse_single_copland(phrase_and_args, apbs, phrase) == 0 ||
+            parse_branched_copland(phrase_and_args, apbs, phrase) == 0) {
+        return 0;
+    }
 
-        if(parse_copland_from_pair_list(phrase_and_args, apb->phrase_specs, phrase) == 0) {
-            return 0;
+    dlog(3, "Error: Unable to find the Copland phrase \"%s\" from the APBs provided\n", phrase_and_args);
+    return -1;
+}
+
+/*
+ * Returns the length of the branch operator at @p, which lies between
+ * @start and @end, or 0 if there is none. Operators must be surrounded
+ * by whitespace so that they are not confused with a ~ in an argument.
+ */
+static size_t branch_op_len(const char *p, const char *start, const char *end)
+{
+    static const char *ops[] = {"-~-", "+~+", "-~+", "+~-", COPLAND_BRANCH_OP, NULL};
+    size_t len;
+    int i;
+
+    if(p == start || !isspace((unsigned char)p[-1])) {
+        return 0;
+    }
+    for(i = 0; ops[i] != NULL; i++) {
+        len = strlen(ops[i]);
+        if(p + len < end && strncmp(p, ops[i], len) == 0 &&
+                isspace((unsigned char)p[len])) {
+            return len;
         }
+    }
+    return 0;
+}
 
+/*
+ * Appends the branch between @start and @end, without surrounding
+ * whitespace, to *@branches. Returns 0 on success or -1 if it is empty.
+ */
+static int append_branch(GList **branches, const char *start, const char *end)
+{
+    while(start < end && isspace((unsigned char)*start)) {
+        start++;
     }
+    while(end > start && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    if(start == end) {
+        return -1;
+    }
+    *branches = g_list_append(*branches, g_strndup(start, (gsize)(end - start)));
+    return 0;
+}
 
-    dlog(3, "Error: Unable to find the Copland phrase \"%s\" from the APBs provided\n", phrase_and_args);
+int split_copland_branches(const char *phrase_and_args, GList **branches)
+{
+    const char *start, *end, *p, *part;
+    GList *out = NULL;
+    int depth = 0;
+    size_t len;
+
+    if(phrase_and_args == NULL || branches == NULL) {
+        dlog(1, "Null argument provided\n");
+        return -1;
+    }
+    *branches = NULL;
+
+    start = phrase_and_args;
+    end   = start + strlen(start);
+    while(start < end && isspace((unsigned char)*start)) {
+        start++;
+    }
+    while(end > start && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+
+    /* (branch1 ~ branch2) is the same as branch1 ~ branch2 */
+    if(end - start >= 2 && *start == '(' && end[-1] == ')') {
+        for(p = start; p < end - 1; p++) {
+            depth += (*p == '(') - (*p == ')');
+            if(depth == 0) {
+                break;
+            }
+        }
+        if(p == end - 1) {
+            start++;
+            end--;
+        }
+        depth = 0;
+    }
+
+    for(p = part = start; p < end; p++) {
+        if(*p == '(') {
+            depth++;
+        } else if(*p == ')') {
+            if(--depth < 0) {
+                goto malformed;
+            }
+        } else if(depth == 0 && (len = branch_op_len(p, start, end)) > 0) {
+            if(append_branch(&out, part, p) < 0) {
+                goto malformed;
+            }
+            p   += len - 1;
+            part = p + 1;
+        }
+    }
+    if(depth != 0) {
+        goto malformed;
+    }
+    if(out == NULL) {
+        return 0;
+    }
+    if(append_branch(&out, part, end) < 0) {
+        goto malformed;
+    }
+
+    *branches = out;
+    return (int)g_list_length(out);
+
+malformed:
+    dlog(2, "Malformed branch-parallel Copland phrase: %s\n", phrase_and_args);
+    g_list_free_full(out, free);
     return -1;
 }
 
+int parse_copland_branches(const copland_phrase *copl, const GList *apbs, GList **branches)
+{
+    GList *strs = NULL;
+    int nr;
+
+    if(copl == NULL || branches == NULL) {
+        dlog(1, "Null argument provided\n");
+        return -1;
+    }
+    *branches = NULL;
+
+    /* an APB may carry out a branch-parallel phrase all by itself */
+    if(copl->num_args != 0 ||
+            find_apb_copl_phrase_by_template((GList *)apbs, (copland_phrase *)copl, NULL) != NULL) {
+        return 0;
+    }
+
+    nr = split_copland_branches(copl->phrase, &strs);
+    if(nr > 0 && parse_branch_list(strs, apbs, branches) < 0) {
+        nr = -1;
+    }
+    g_list_free_full(strs, free);
+    return nr;
+}
+
 
 /*
  * Free the memory associated with a phrase arg
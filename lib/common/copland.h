@@ -278,9 +278,55 @@ int parse_copland_from_pair_list(const char *phrase_and_args, const GList *phras
  * argument and 0 is returned. Otherwise, -1 is returned and the phrase argument
  * is left unmodified. The caller is responsible for freeing the contents of
  * phrase.
+ *
+ * If no APB carries out the whole phrase, it may be a branch-parallel
+ * composition of phrases that APBs do carry out (see
+ * split_copland_branches()). It is then parsed into a phrase without
+ * arguments holding the parsed branches joined by " ~ ", which
+ * parse_copland_branches() takes apart again.
  */
 int parse_copland_from_apb_list(const char *phrase_and_args, const GList *apbs, copland_phrase **phrase);
 
+/*******************************************************************************
+ * Copland Branch-Parallel Composition
+ */
+
+/**
+ * Operator that joins the branches of a parsed branch-parallel phrase.
+ */
+#define COPLAND_BRANCH_OP "~"
+
+/**
+ * Splits a branch-parallel Copland phrase of the form
+ *
+ * branch1 ~ branch2 [~ ... ~ branchN]
+ *
+ * optionally in parentheses, at its top level operators. -~-, +~+,
+ * -~+ and +~- are accepted in place of ~; they say how evidence is
+ * split between the branches, and since no evidence flows into an APB
+ * they all mean the same here. Operators must be surrounded by
+ * whitespace, and each branch is of the form phrase[:args].
+ *
+ * On success *@branches is set to a newly allocated GList of the
+ * branches as strings, which the caller must free with
+ * g_list_free_full(branches, free).
+ *
+ * Returns the number of branches, 0 if @phrase_and_args has no top
+ * level branch operator, or -1 if it is malformed.
+ */
+int split_copland_branches(const char *phrase_and_args, GList **branches);
+
+/**
+ * If no APB in @apbs carries out @copl as a whole but each branch of
+ * it does (see split_copland_branches()), sets *@branches to a newly
+ * allocated GList of the parsed branch phrases in order. The caller
+ * must free it with g_list_free_full(branches, free_copland_phrase_glist).
+ *
+ * Returns the number of branches, 0 if @copl is a single phrase, or -1
+ * if it is a branch-parallel phrase with a branch no APB carries out.
+ */
+int parse_copland_branches(const copland_phrase *copl, const GList *apbs, GList **branches);
+
 /*******************************************************************************
  * Copland Struct to String Parsing
  */
@@ -173,23 +173,25 @@ int parse_exe_sec_ctxt(exe_sec_ctxt *ctxt, xmlNode *node)
 }
 
 #ifndef ENABLE_SELINUX
-void exe_sec_ctxt_set_execcon(char *exe_path UNUSED,
-                              exe_sec_ctxt *c UNUSED,
-                              respect_desired_execcon_t behavior UNUSED,
-                              execcon_unique_categories_t set_categories UNUSED,
-                              int min_category UNUSED,
-                              int min_default_category UNUSED,
-                              int max_default_category UNUSED
-                             )
+int exe_sec_ctxt_try_set_execcon(char *exe_path UNUSED,
+                                 exe_sec_ctxt *c UNUSED,
+                                 respect_desired_execcon_t behavior UNUSED,
+                                 execcon_unique_categories_t set_categories UNUSED,
+                                 int category_seed UNUSED,
+                                 int min_category UNUSED,
+                                 int min_default_category UNUSED,
+                                 int max_default_category UNUSED
+                                )
 #else
-void exe_sec_ctxt_set_execcon(char *exe_path,
-                              exe_sec_ctxt *c,
-                              respect_desired_execcon_t execcon_behavior,
-                              execcon_unique_categories_t set_categories,
-                              int min_category,
-                              int min_default_category,
-                              int max_default_category
-                             )
+int exe_sec_ctxt_try_set_execcon(char *exe_path,
+                                 exe_sec_ctxt *c,
+                                 respect_desired_execcon_t execcon_behavior,
+                                 execcon_unique_categories_t set_categories,
+                                 int category_seed,
+                                 int min_category,
+                                 int min_default_category,
+                                 int max_default_category
+                                )
 #endif
 {
 #ifdef ENABLE_SELINUX
@@ -211,36 +213,40 @@ void exe_sec_ctxt_set_execcon(char *exe_path,
             if(getcon(&my_context) < 0) {
                 int the_error = errno;
                 dlog(0, "Failed to get current SELinux context: %s\n", strerror(the_error));
-                exit(the_error);
+                return -the_error;
             }
             if(getfilecon(exe_path, &file_context) < 0) {
                 int the_error = errno;
                 dlog(0, "Failed to get SELinux security context for executable: %s\n",
                      strerror(the_error));
-                exit(the_error);
+                freecon(my_context);
+                return -the_error;
             }
             if(security_compute_create(my_context, file_context,
                                        SECCLASS_PROCESS, &new_context)) {
                 int the_error = errno;
                 dlog(0, "Failed to compute default SELinux destination context: %s\n",
                      strerror(the_error));
-                exit(the_error);
+                freecon(my_context);
+                freecon(file_context);
+                return -the_error;
             }
-            if((ctxt = context_new(new_context)) == NULL) {
+            ctxt = context_new(new_context);
+            freecon(my_context);
+            freecon(file_context);
+            freecon(new_context);
+            if(ctxt == NULL) {
                 int the_error = errno;
                 dlog(0, "Failed to create new context structure: %s\n",
                      strerror(the_error));
-                exit(the_error);
+                return -the_error;
             }
             ctxt_needs_free = 1;
-            freecon(my_context);
-            freecon(file_context);
-            freecon(new_context);
         }
 
         if(set_categories == EXECCON_SET_UNIQUE_CATEGORIES) {
             char categories[256];
-            int p  = (int)getpid();
+            int p  = category_seed;
             snprintf(categories, 256, "s0:c%d,c%d,c%d,c%d",
                      min_category + (p & 0x3f),
                      min_category + ((p >> 6)  & 0x3f) + 64,
@@ -261,9 +267,14 @@ void exe_sec_ctxt_set_execcon(char *exe_path,
             int the_error = errno;
             dlog(0, "Failed to set SELinux security context: %s\n",
                  strerror(the_error));
-            getcon(&sec_ctxt);
-            dlog(0, "My context is: %s\n", sec_ctxt);
-            exit(the_error);
+            if(getcon(&sec_ctxt) == 0) {
+                dlog(0, "My context is: %s\n", sec_ctxt);
+                freecon(sec_ctxt);
+            }
+            if(ctxt_needs_free) {
+                context_free(ctxt);
+            }
+            return -the_error;
         }
         if(ctxt_needs_free) {
             context_free(ctxt);
@@ -271,6 +282,32 @@ void exe_sec_ctxt_set_execcon(char *exe_path,
     }
 #else
     dlog(3, "SELinux support disabled\n");
+#endif
+    return 0;
+}
+
+void exe_sec_ctxt_set_execcon(char *exe_path,
+                              exe_sec_ctxt *c,
+                              respect_desired_execcon_t execcon_behavior,
+                              execcon_unique_categories_t set_categories,
+                              int min_category,
+                              int min_default_category,
+                              int max_default_category)
+{
+    int ret = exe_sec_ctxt_try_set_execcon(exe_path, c, execcon_behavior, set_categories,
+                                           (int)getpid(), min_category,
+                                           min_default_category, max_default_category);
+    if(ret < 0) {
+        exit(-ret);
+    }
+}
+
+void exe_sec_ctxt_clear_execcon(void)
+{
+#ifdef ENABLE_SELINUX
+    if(is_selinux_enabled() && setexeccon(NULL) < 0) {
+        dlog(1, "Failed to reset SELinux exec context: %s\n", strerror(errno));
+    }
 #endif
 }
 
@@ -119,6 +119,30 @@ void exe_sec_ctxt_set_execcon(char *exe_path,
                               int min_category,
                               int min_default_category,
                               int max_default_category);
+
+/**
+ * As exe_sec_ctxt_set_execcon(), but for a process about to spawn
+ * @exe_path rather than one about to exec it: failures are returned
+ * as a negative errno instead of exiting, and the unique categories
+ * are derived from @category_seed instead of the caller's pid. The
+ * context applies to every process the calling thread launches until
+ * exe_sec_ctxt_clear_execcon() is called.
+ */
+int exe_sec_ctxt_try_set_execcon(char *exe_path,
+                                 exe_sec_ctxt *c,
+                                 respect_desired_execcon_t execcon_behavior,
+                                 execcon_unique_categories_t set_categories,
+                                 int category_seed,
+                                 int min_category,
+                                 int min_default_category,
+                                 int max_default_category);
+
+/**
+ * Go back to the default context for processes launched by the
+ * calling thread.
+ */
+void exe_sec_ctxt_clear_execcon(void);
+
 int copy_exe_sec_ctxt(exe_sec_ctxt *dest, const exe_sec_ctxt *src);
 void free_exe_sec_ctxt(const exe_sec_ctxt *ctxt);
 
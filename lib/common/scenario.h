@@ -195,6 +195,13 @@ struct scenario {
     char *attester_tunnel_path;
     unsigned long attester_portnum;
     char *resource;
+    GList *resources;           /**
+				 * Every resource named by the request
+				 * contract, in order; resource is the
+				 * first. With more than one, a single
+				 * evidence package with a section per
+				 * resource is negotiated.
+				 */
     int requester_chan;
 
     /* fields presumed to be attester specific */
@@ -257,6 +264,7 @@ static inline void free_scenario(struct scenario *scen)
         free(scen->attester_hostname);
         free(scen->attester_tunnel_path);
         free(scen->resource);
+        g_list_free_full(scen->resources, free);
 
         if(scen->requester_chan >= 0) {
             close(scen->requester_chan);
@@ -103,15 +103,141 @@ int merge_measurement_graphs(measurement_graph *in1, measurement_graph *in2,
 
 /**
  * Serialize a measurement graph to a NULL terminated string
- */
+ *
+ * The document is of version 0 (attribute mgversion of the graph
+ * element), which every parser understands. From version 1 on, see
+ * the version rule of serialize_measurement_graph_filtered(), data
+ * that several nodes share in the graph's data store is written once;
+ * the measurement elements of the other nodes carry the document id
+ * of the first node in the attribute GRAPH_DATA_REF_ATTR instead of
+ * the data.
+ */
+#define MEASUREMENT_GRAPH_VERSION	1
+#define GRAPH_DATA_REF_ATTR	"data_ref"
 int serialize_measurement_graph(measurement_graph *g, size_t *sz,
                                 unsigned char **serial);
 
+/**
+ * An export filter selects the part of a graph that
+ * serialize_measurement_graph_filtered() writes out. It is built from
+ * rules of the form "<rule>=<value>":
+ *
+ *   keep-target, drop-target             target type name
+ *   keep-space, drop-space               address space name
+ *   keep-measurement, drop-measurement   measurement type name
+ *   keep-label, drop-label               edge label ("" for none)
+ *   project                              measurement type name
+ *   root                                 node id
+ *   root-target                          target type name
+ *   version                              document version
+ *
+ * The version rule sets the version of the document written (0 by
+ * default, at most MEASUREMENT_GRAPH_VERSION); a peer that asks for
+ * a later version must be able to parse it.
+ *
+ * A node is written if its target type and address space pass the
+ * keep (if any are given) and drop rules of their kind, it has data
+ * of a kept measurement type (if any are given) and none of a
+ * dropped type. Edges are written if both ends are and their label
+ * passes. Data of projected types is left out of the nodes. If any
+ * roots are given, only the nodes reachable from them along edges
+ * whose label passes are candidates; the nodes in between need not
+ * be written themselves.
+ */
+typedef struct measurement_graph_filter measurement_graph_filter;
+
+typedef struct measurement_graph_export_stats {
+    size_t nr_nodes, nodes_written;
+    size_t nr_edges, edges_written;
+    size_t nr_data, data_written;
+    uint64_t data_bytes, data_bytes_written;
+} measurement_graph_export_stats;
+
+measurement_graph_filter *new_measurement_graph_filter(void);
+void free_measurement_graph_filter(measurement_graph_filter *f);
+
+/**
+ * Add @rule to @f. Returns 0 on success, -EINVAL if the rule is
+ * malformed or -ENOENT if it names an unknown type.
+ */
+int measurement_graph_filter_add_rule(measurement_graph_filter *f,
+                                      const char *rule);
+
+/**
+ * Like serialize_measurement_graph(), but only writes the part of @g
+ * selected by @f (everything if @f is NULL). If @stats is not NULL it
+ * is filled in with the size of @g and of the part written.
+ */
+int serialize_measurement_graph_filtered(measurement_graph *g,
+        measurement_graph_filter *f,
+        size_t *sz, unsigned char **serial,
+        measurement_graph_export_stats *stats);
+
 /**
  * Parse a serializd measurement graph
  */
 measurement_graph *parse_measurement_graph(char *s, size_t size);
 
+/**
+ * A graph index is a serialized graph whose data is described rather
+ * than included: each measurement element carries the type, size and
+ * hex SHA-256 digest (attribute GRAPH_INDEX_DIGEST_ATTR) of a datum,
+ * and node ids are those of the indexed graph. It lets a peer learn
+ * the shape of a graph and fetch only the data it needs, checking
+ * each datum against the index. The graph element of an index has
+ * the attribute GRAPH_EVIDENCE_ATTR set to GRAPH_EVIDENCE_INDEX, and
+ * parse_measurement_graph() refuses it.
+ */
+#define GRAPH_EVIDENCE_ATTR	"evidence"
+#define GRAPH_EVIDENCE_INDEX	"index"
+#define GRAPH_INDEX_DIGEST_ATTR	"digest"
+
+typedef struct graph_index_entry {
+    node_id_t source_node;	/* id of the node in the indexed graph */
+    magic_t type;
+    size_t size;		/* marshalled size, including the NUL */
+    char *digest;
+} graph_index_entry;
+
+typedef struct graph_index graph_index;
+
+/**
+ * Serialize an index of @g to a NULL terminated string.
+ */
+int serialize_measurement_graph_index(measurement_graph *g, size_t *sz,
+                                      unsigned char **serial);
+
+/**
+ * Parse a serialized graph index. Returns a graph with the nodes and
+ * edges of the indexed graph but no data, and sets *@idx to the
+ * description of the data, keyed by the nodes of the returned graph.
+ */
+measurement_graph *parse_measurement_graph_index(char *s, size_t size,
+        graph_index **idx);
+
+/**
+ * Return 1 if @s is a serialized graph index, 0 otherwise.
+ */
+int is_measurement_graph_index(char *s, size_t size);
+
+/**
+ * Return the list of (graph_index_entry *) describing the data of
+ * @node, or NULL if it has none. The list belongs to @idx.
+ */
+GList *graph_index_entries(graph_index *idx, node_id_t node);
+
+graph_index_entry *graph_index_find(graph_index *idx, node_id_t node,
+                                    magic_t type);
+
+/**
+ * Check that the marshalled @data of @size bytes (including its
+ * terminating NUL) is the datum described by @e. Returns 1 if it is,
+ * 0 if it is not and < 0 on error.
+ */
+int graph_index_check(graph_index_entry *e, const char *data, size_t size);
+
+void free_graph_index(graph_index *idx);
+
 /**
  * Makes a copy of the measurement graph
  */
@@ -137,6 +263,49 @@ int map_measurement_graph(char *path, measurement_graph **out);
  */
 void unmap_measurement_graph(measurement_graph *graph);
 
+/**
+ * High-water marks of a graph: the ids the next node and edge added to
+ * it will get. Clients that checkpoint the construction of a graph
+ * save them, so that a run interrupted after the checkpoint can be
+ * rolled back to it with measurement_graph_truncate().
+ */
+typedef struct measurement_graph_marks {
+    node_id_t next_node;
+    edge_id_t next_edge;
+} measurement_graph_marks;
+
+/**
+ * Store the current high-water marks of @g in *@marks, and record in
+ * @g which data its nodes carry. Returns 0 on success or < 0 on error.
+ */
+int measurement_graph_get_marks(measurement_graph *g, measurement_graph_marks *marks);
+
+/**
+ * Remove the nodes and edges added to @g since @marks were taken and
+ * reset its marks to them. Data added to older nodes since the last
+ * measurement_graph_get_marks() is removed as well; data replaced
+ * since then is not restored, which measurement_graph_digest() shows.
+ *
+ * Returns 0 on success, -EINVAL if @g has fewer nodes or edges than
+ * @marks record (so they were not taken from @g, or @g lost data), or
+ * < 0 on other errors.
+ */
+int measurement_graph_truncate(measurement_graph *g,
+                               const measurement_graph_marks *marks);
+
+#define MEASUREMENT_GRAPH_DIGEST_LEN 32
+
+/**
+ * Compute in @digest the SHA-256 of @g below @marks: the type and
+ * address of each node with the type and contents of its data, and
+ * the ends and label of each edge. Clients that checkpoint a graph
+ * save it with the marks, to check that the graph they roll back is
+ * the one they left. Returns 0 on success or < 0 on error.
+ */
+int measurement_graph_digest(measurement_graph *g,
+                             const measurement_graph_marks *marks,
+                             unsigned char digest[MEASUREMENT_GRAPH_DIGEST_LEN]);
+
 /******************************************************************************/
 /*                         Measurement Node Functions                         */
 /******************************************************************************/
@@ -641,4 +810,24 @@ int consume_from_pipe(int pfd, aggregator *aggregators, int nr_aggregators, GLis
  */
 void graph_print_stats(measurement_graph *g, int loglevel);
 
+/**
+ * Statistics of the content addressed measurement data store. Data
+ * that could not be stored there (and was copied instead) is not
+ * counted.
+ */
+typedef struct measurement_graph_data_stats {
+    size_t nr_refs;		/* data items of all nodes */
+    size_t nr_blobs;		/* distinct data items referenced */
+    size_t nr_unreferenced;	/* blobs of removed data */
+    uint64_t data_bytes;	/* size of the data of all nodes */
+    uint64_t stored_bytes;	/* size of the referenced blobs */
+} measurement_graph_data_stats;
+
+/**
+ * Fills in @stats for @g. The dedup ratio is data_bytes/stored_bytes.
+ * Returns 0 on success or < 0 on error.
+ */
+int measurement_graph_get_data_stats(measurement_graph *g,
+                                     measurement_graph_data_stats *stats);
+
 #endif
@@ -16,6 +16,7 @@
  */
 
 #include "graph-fs-private.h"
+#include <glib.h>
 
 char *path_for_node_data_dir(measurement_graph *g, node_id_t n, char *buf, size_t sz)
 {
@@ -40,12 +41,97 @@ char *path_for_data(measurement_graph *g, node_id_t n,
     return sncatf(buf, sz, "/" MAGIC_FMT, data_type);
 }
 
+/*
+ * Measurement data is content addressed: each distinct datum is
+ * stored once under DATA_STORE_SUBDIR, named by the SHA-256 digest of
+ * its marshalled form, and the data file of every node carrying it is
+ * a hard link to that blob. The link count of a blob is thus one more
+ * than the number of nodes referencing it, and readers of the node
+ * data files see no difference.
+ *
+ * Blobs are read-only and never modified in place: replacing a datum
+ * replaces the node's link. When a link can not be made (e.g. the
+ * blob was stored by another user and fs.protected_hardlinks is set)
+ * the node gets a private copy of the data instead.
+ */
+char *path_for_blob(measurement_graph *g, const char *digest, char *buf, size_t sz)
+{
+    if(construct_path(buf, sz, g->path, DATA_STORE_SUBDIR, digest, NULL) < 0) {
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Ensures the blob for @data is in the data store and puts its path
+ * in @blob. Returns 0 on success or < 0 on error.
+ */
+static int store_blob(measurement_graph *g, marshalled_data *data,
+                      char *blob, size_t sz)
+{
+    char tmp[PATH_MAX];
+    gchar *digest;
+    size_t written = 0;
+    int fd;
+
+    digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                         (guchar*)data->marshalled_data,
+                                         data->marshalled_data_length);
+    if(digest == NULL) {
+        return -ENOMEM;
+    }
+    if(path_for_blob(g, digest, blob, sz) == NULL ||
+            construct_path(tmp, PATH_MAX, g->path, DATA_STORE_SUBDIR,
+                           ".blob.XXXXXX", NULL) < 0) {
+        g_free(digest);
+        return -ENAMETOOLONG;
+    }
+    g_free(digest);
+
+    if(access(blob, F_OK) == 0) {
+        return 0;
+    }
+
+    if(mkdir_p_containing(tmp, S_IRWXU | S_IRWXG) != 0 ||
+            (fd = mkstemp(tmp)) < 0) {
+        return -errno;
+    }
+    while(written < data->marshalled_data_length) {
+        ssize_t rc = write(fd, data->marshalled_data + written,
+                           data->marshalled_data_length - written);
+        if(rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if(rc <= 0) {
+            break;
+        }
+        written += (size_t)rc;
+    }
+    if(written < data->marshalled_data_length ||
+            fchmod(fd, S_IRUSR | S_IRGRP) != 0 || close(fd) != 0) {
+        int err = errno ? errno : EIO;
+        close(fd);
+        unlink(tmp);
+        return -err;
+    }
+
+    /* another process may have stored the same blob meanwhile */
+    if(link(tmp, blob) != 0 && errno != EEXIST) {
+        int err = errno;
+        unlink(tmp);
+        return -err;
+    }
+    unlink(tmp);
+    return 0;
+}
+
 int measurement_node_add_data(measurement_graph *g, node_id_t n, marshalled_data *data)
 {
     if(n == INVALID_NODE_ID) {
         return -1;
     }
     char path[PATH_MAX];
+    char blob[PATH_MAX];
 
     if(data->marshalled_data_length > SSIZE_MAX) {
         dlog(1, "Error storing node: data is too large\n");
@@ -62,6 +148,17 @@ int measurement_node_add_data(measurement_graph *g, node_id_t n, marshalled_data
         return -1;
     }
 
+    /* never write through an existing link into a shared blob */
+    if(unlink(path) != 0 && errno != ENOENT) {
+        dlog(1, "Error storing node: unable to replace data at \"%s\"\n", path);
+        return -1;
+    }
+
+    if(store_blob(g, data, blob, PATH_MAX) == 0 && link(blob, path) == 0) {
+        return 0;
+    }
+    dlog(6, "Storing a private copy of data at \"%s\": %s\n", path, strerror(errno));
+
     if(buffer_to_file_perm(path,
                            (unsigned char *)data->marshalled_data,
                            data->marshalled_data_length,
@@ -73,6 +170,48 @@ int measurement_node_add_data(measurement_graph *g, node_id_t n, marshalled_data
     return 0;
 }
 
+int measurement_node_stat_data(measurement_graph *g, node_id_t n,
+                               magic_t data_type, struct stat *st)
+{
+    char path[PATH_MAX];
+
+    if(n == INVALID_NODE_ID ||
+            path_for_data(g, n, data_type, path, PATH_MAX) == NULL) {
+        return -EINVAL;
+    }
+    return stat(path, st) == 0 ? 0 : -errno;
+}
+
+int measurement_node_share_data(measurement_graph *g, node_id_t dest,
+                                node_id_t src, magic_t data_type, size_t size)
+{
+    char src_path[PATH_MAX];
+    char dest_path[PATH_MAX];
+    struct stat st;
+
+    if(src == INVALID_NODE_ID || dest == INVALID_NODE_ID ||
+            path_for_data(g, src, data_type, src_path, PATH_MAX) == NULL ||
+            path_for_data(g, dest, data_type, dest_path, PATH_MAX) == NULL) {
+        return -EINVAL;
+    }
+
+    if(stat(src_path, &st) != 0) {
+        return -errno;
+    }
+    if(!S_ISREG(st.st_mode) || (size_t)st.st_size != size) {
+        return -EINVAL;
+    }
+
+    if(mkdir_p_containing(dest_path, S_IRWXU | S_IRWXG) != 0) {
+        return -errno;
+    }
+    if((unlink(dest_path) != 0 && errno != ENOENT) ||
+            link(src_path, dest_path) != 0) {
+        return -errno;
+    }
+    return 0;
+}
+
 int measurement_node_add_rawdata(measurement_graph *g, node_id_t node, measurement_data *data)
 {
     if(node == INVALID_NODE_ID) {
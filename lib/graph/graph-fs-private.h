@@ -52,6 +52,8 @@
 #define EDGE_DEST_ENTRY "dest"
 #define EDGE_LABEL_FILE "label"
 #define EDGES_SUBDIR "edges"
+#define DATA_STORE_SUBDIR "data_store"
+#define DATA_MARKS_FILE "data_marks"
 
 
 struct measurement_graph {
@@ -71,6 +73,7 @@ char *path_for_node_id_file(measurement_graph *g, node_id_t n, char *buf, size_t
 char *path_for_node_data_dir(measurement_graph *g, node_id_t n, char *buf, size_t sz);
 char *path_for_data(measurement_graph *g, node_id_t n, magic_t data_type,
                     char *buf, size_t sz);
+char *path_for_blob(measurement_graph *g, const char *digest, char *buf, size_t sz);
 char *path_for_node_inbound_edge_dir(measurement_graph *g, node_id_t n,
                                      char *buf, size_t sz);
 char *path_for_node_inbound_edge(measurement_graph *g, node_id_t n, edge_id_t e,
@@ -85,5 +88,33 @@ char *path_for_edge_label_file(measurement_graph *g, edge_id_t e, char *buf, siz
 char *path_for_edge_src_entry(measurement_graph *g, edge_id_t e, char *buf, size_t sz);
 char *path_for_edge_dest_entry(measurement_graph *g, edge_id_t e, char *buf, size_t sz);
 
+/**
+ * stat() the data file of type @data_type of node @n. Data stored in
+ * the data store has st_nlink > 1 and data with equal contents shares
+ * its st_ino.
+ */
+int measurement_node_stat_data(measurement_graph *g, node_id_t n,
+                               magic_t data_type, struct stat *st);
+
+/**
+ * Give node @dest the same data of type @data_type as node @src
+ * without copying it. Fails with -EINVAL if that data is not @size
+ * bytes long.
+ */
+int measurement_node_share_data(measurement_graph *g, node_id_t dest,
+                                node_id_t src, magic_t data_type, size_t size);
+
 node_id_t load_measurement_node(measurement_graph *g, char *path);
+
+/**
+ * Record which data the nodes below @next_node carry, for
+ * truncate_data().
+ */
+int save_data_marks(measurement_graph *g, node_id_t next_node);
+
+/**
+ * Remove the data of the nodes below @next_node that was not recorded
+ * by the last save_data_marks(). Does nothing if it was never called.
+ */
+int truncate_data(measurement_graph *g, node_id_t next_node);
 #endif
@@ -23,15 +23,256 @@
 #include <errno.h>
 #include <glib.h>
 #include <util/util.h>
+#include <dirent.h>
+
+static gint compare_names(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Names of the data files of node @n, sorted, or NULL if it has no
+ * data directory.
+ */
+static GPtrArray *node_data_names(measurement_graph *g, node_id_t n)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    GPtrArray *names;
+    DIR *dir;
+
+    if(path_for_node_data_dir(g, n, path, PATH_MAX) == NULL ||
+            (dir = opendir(path)) == NULL) {
+        return NULL;
+    }
+    names = g_ptr_array_new_with_free_func(g_free);
+    while((de = readdir(dir)) != NULL) {
+        if(de->d_name[0] != '.') {
+            g_ptr_array_add(names, g_strdup(de->d_name));
+        }
+    }
+    closedir(dir);
+    g_ptr_array_sort(names, compare_names);
+    return names;
+}
+
+static inline int node_exists(measurement_graph *g, node_id_t n)
+{
+    char path[PATH_MAX];
+    return path_for_node(g, n, path, PATH_MAX) != NULL;
+}
+
+int save_data_marks(measurement_graph *g, node_id_t next_node)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    GString *marks = g_string_new(NULL);
+    node_id_t n;
+    guint i;
+    int rc = 0;
+
+    for(n = 0; n < next_node; n++) {
+        GPtrArray *names = node_data_names(g, n);
+        if(names == NULL) {
+            continue;
+        }
+        for(i = 0; i < names->len; i++) {
+            g_string_append_printf(marks, ID_FMT" %s\n", n,
+                                   (char *)g_ptr_array_index(names, i));
+        }
+        g_ptr_array_free(names, TRUE);
+    }
+
+    if(construct_path(path, PATH_MAX, g->path, DATA_MARKS_FILE, NULL) < 0 ||
+            construct_path(tmp, PATH_MAX, g->path, "."DATA_MARKS_FILE, NULL) < 0) {
+        rc = -ENAMETOOLONG;
+    } else if(buffer_to_file_perm(tmp, (unsigned char *)marks->str, marks->len,
+                                  S_IRUSR | S_IWUSR | S_IRGRP) < (ssize_t)marks->len ||
+              rename(tmp, path) != 0) {
+        rc = -EIO;
+    }
+    g_string_free(marks, TRUE);
+    return rc;
+}
+
+int truncate_data(measurement_graph *g, node_id_t next_node)
+{
+    char path[PATH_MAX];
+    char data_path[PATH_MAX];
+    GHashTable *kept;
+    gchar *contents = NULL;
+    gchar **lines;
+    node_id_t n;
+    guint i;
+    int rc = 0;
+
+    if(construct_path(path, PATH_MAX, g->path, DATA_MARKS_FILE, NULL) < 0) {
+        return -ENAMETOOLONG;
+    }
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        return access(path, F_OK) == 0 ? -EIO : 0;
+    }
+    kept = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    lines = g_strsplit(contents, "\n", -1);
+    for(i = 0; lines[i] != NULL; i++) {
+        if(lines[i][0] != '\0') {
+            g_hash_table_add(kept, g_strdup(lines[i]));
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+
+    for(n = 0; n < next_node; n++) {
+        GPtrArray *names = node_data_names(g, n);
+        if(names == NULL) {
+            continue;
+        }
+        for(i = 0; i < names->len; i++) {
+            char *name = g_ptr_array_index(names, i);
+            char *entry = g_strdup_printf(ID_FMT" %s", n, name);
+
+            if(!g_hash_table_contains(kept, entry) &&
+                    (path_for_node_data_dir(g, n, data_path, PATH_MAX) == NULL ||
+                     sncatf(data_path, PATH_MAX, "/%s", name) == NULL ||
+                     unlink(data_path) != 0)) {
+                rc = -EIO;
+            }
+            g_free(entry);
+        }
+        g_ptr_array_free(names, TRUE);
+    }
+    g_hash_table_destroy(kept);
+    return rc;
+}
 
 /* end helper functions, begin api functions */
 
+int measurement_graph_digest(measurement_graph *g,
+                             const measurement_graph_marks *marks,
+                             unsigned char digest[MEASUREMENT_GRAPH_DIGEST_LEN])
+{
+    char path[PATH_MAX];
+    GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize len = MEASUREMENT_GRAPH_DIGEST_LEN;
+    node_id_t n;
+    edge_id_t e;
+    char *entry;
+    guint i;
+    int rc = 0;
+
+    entry = g_strdup_printf("M "ID_FMT" "ID_FMT"\n", marks->next_node, marks->next_edge);
+    g_checksum_update(sum, (const guchar *)entry, (gssize)strlen(entry));
+    g_free(entry);
+
+    /* a node's directory is named by its type and address */
+    for(n = 0; n < marks->next_node && rc == 0; n++) {
+        GPtrArray *names;
+        char *name;
+
+        if(path_for_node(g, n, path, PATH_MAX) == NULL) {
+            continue;
+        }
+        name = strrchr(path, '/');
+        name = g_strdup_printf("N "ID_FMT" %s\n", n, name ? name + 1 : path);
+        g_checksum_update(sum, (const guchar *)name, (gssize)strlen(name));
+        g_free(name);
+
+        if((names = node_data_names(g, n)) == NULL) {
+            continue;
+        }
+        for(i = 0; i < names->len && rc == 0; i++) {
+            unsigned char *data;
+            size_t size = 0;
+            gchar *data_sum;
+
+            if(path_for_node_data_dir(g, n, path, PATH_MAX) == NULL ||
+                    sncatf(path, PATH_MAX, "/%s",
+                           (char *)g_ptr_array_index(names, i)) == NULL ||
+                    (data = file_to_buffer(path, &size)) == NULL) {
+                rc = -EIO;
+                break;
+            }
+            data_sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, data, size);
+            free(data);
+            entry = g_strdup_printf("D %s %s\n", (char *)g_ptr_array_index(names, i),
+                                    data_sum);
+            g_checksum_update(sum, (const guchar *)entry, (gssize)strlen(entry));
+            g_free(entry);
+            g_free(data_sum);
+        }
+        g_ptr_array_free(names, TRUE);
+    }
+
+    for(e = 0; e < marks->next_edge && rc == 0; e++) {
+        char *label;
+
+        if(path_for_edge(g, e, path, PATH_MAX) == NULL || access(path, F_OK) != 0) {
+            continue;
+        }
+        label = measurement_edge_get_label(g, e);
+        entry = g_strdup_printf("E "ID_FMT" "ID_FMT" "ID_FMT" %s\n", e,
+                                measurement_edge_get_source(g, e),
+                                measurement_edge_get_destination(g, e),
+                                label ? label : "");
+        g_checksum_update(sum, (const guchar *)entry, (gssize)strlen(entry));
+        g_free(entry);
+        free(label);
+    }
+
+    if(rc == 0) {
+        g_checksum_get_digest(sum, digest, &len);
+    }
+    g_checksum_free(sum);
+    return rc;
+}
+
+int measurement_graph_get_data_stats(measurement_graph *g,
+                                     measurement_graph_data_stats *stats)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    DIR *dir;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if(construct_path(path, PATH_MAX, g->path, DATA_STORE_SUBDIR, NULL) < 0) {
+        return -ENAMETOOLONG;
+    }
+    if((dir = opendir(path)) == NULL) {
+        /* nothing has been stored yet */
+        return errno == ENOENT ? 0 : -errno;
+    }
+
+    while((de = readdir(dir)) != NULL) {
+        struct stat st;
+
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        if(fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+                !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if(st.st_nlink <= 1) {
+            stats->nr_unreferenced++;
+            continue;
+        }
+        stats->nr_blobs++;
+        stats->nr_refs      += (size_t)st.st_nlink - 1;
+        stats->stored_bytes += (uint64_t)st.st_size;
+        stats->data_bytes   += (uint64_t)st.st_size * (st.st_nlink - 1);
+    }
+    closedir(dir);
+    return 0;
+}
+
 void graph_print_stats(measurement_graph *graph, int loglevel)
 {
     int numnodes = 0;
     int numedges = 0;
     node_iterator *niter = NULL;
     edge_iterator *eiter = NULL;
+    measurement_graph_data_stats dstats;
     GHashTableIter hiter;
     void *key, *value;
 
@@ -113,6 +354,13 @@ void graph_print_stats(measurement_graph *graph, int loglevel)
         dlog(loglevel, "\t\t%d edges with label %s\n", *(int *)value, (char *)key);
     }
 
+    if(measurement_graph_get_data_stats(graph, &dstats) == 0 && dstats.nr_blobs > 0) {
+        dlog(loglevel, "\tData: %zu items in %zu blobs, %"PRIu64" bytes stored "
+             "for %"PRIu64" (dedup ratio %.2f)\n", dstats.nr_refs, dstats.nr_blobs,
+             dstats.stored_bytes, dstats.data_bytes,
+             dstats.stored_bytes ? (double)dstats.data_bytes / (double)dstats.stored_bytes : 1.0);
+    }
+
 out_free:
     destroy_node_iterator(niter);
     destroy_edge_iterator(eiter);
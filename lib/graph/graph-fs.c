@@ -261,6 +261,98 @@ node_id_t max_node_id(measurement_graph *g)
     return id;
 }
 
+static int read_marks(measurement_graph *g, measurement_graph_marks *marks)
+{
+    char path[PATH_MAX+1];
+    char *buf;
+
+    marks->next_node = max_node_id(g);
+    if(marks->next_node == INVALID_NODE_ID) {
+        return -EIO;
+    }
+
+    if(construct_path(path, PATH_MAX+1, g->path,
+                      NEXT_EDGE_ID_FILE, NULL)< 0) {
+        return -ENAMETOOLONG;
+    }
+    buf = file_to_string(path);
+    if(buf == NULL) {
+        return -EIO;
+    }
+    marks->next_edge = edge_id_of_str(buf);
+    free(buf);
+
+    return marks->next_edge == INVALID_EDGE_ID ? -EIO : 0;
+}
+
+int measurement_graph_get_marks(measurement_graph *g, measurement_graph_marks *marks)
+{
+    int rc;
+
+    if((rc = read_marks(g, marks)) < 0) {
+        return rc;
+    }
+    return save_data_marks(g, marks->next_node);
+}
+
+int measurement_graph_truncate(measurement_graph *g,
+                               const measurement_graph_marks *marks)
+{
+    measurement_graph_marks now;
+    char path[PATH_MAX+1];
+    node_id_str idstr;
+    node_id_t n;
+    edge_id_t e;
+    int rc;
+
+    if((rc = read_marks(g, &now)) < 0) {
+        return rc;
+    }
+    if(now.next_node < marks->next_node || now.next_edge < marks->next_edge) {
+        dlog(1, "Graph %s is behind its high-water marks\n", g->path);
+        return -EINVAL;
+    }
+
+    /* edges first: every edge of a removed node is newer than the
+       edge mark, since the node was newer when it was connected */
+    for(e = marks->next_edge; e < now.next_edge; e++) {
+        if(path_for_edge(g, e, path, PATH_MAX+1) == NULL) {
+            rc = -ENAMETOOLONG;
+        } else if(access(path, F_OK) == 0 && measurement_graph_delete_edge(g, e) != 0) {
+            rc = -EIO;
+        }
+    }
+    for(n = marks->next_node; n < now.next_node; n++) {
+        str_of_node_id(n, idstr);
+        if(construct_path(path, PATH_MAX+1, g->path,
+                          NODES_BY_ID_SUBDIR, idstr, NULL) < 0) {
+            rc = -ENAMETOOLONG;
+        } else if(access(path, F_OK) == 0 && measurement_graph_delete_node(g, n) != 0) {
+            rc = -EIO;
+        }
+    }
+    if(rc == 0) {
+        rc = truncate_data(g, marks->next_node);
+    }
+    if(rc < 0) {
+        return rc;
+    }
+
+    str_of_node_id(marks->next_node, idstr);
+    if(construct_path(path, PATH_MAX+1, g->path, NEXT_NODE_ID_FILE, NULL) < 0 ||
+            buffer_to_file_perm(path, (unsigned char *)idstr, strlen(idstr),
+                                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) < 0) {
+        return -EIO;
+    }
+    str_of_edge_id(marks->next_edge, idstr);
+    if(construct_path(path, PATH_MAX+1, g->path, NEXT_EDGE_ID_FILE, NULL) < 0 ||
+            buffer_to_file_perm(path, (unsigned char *)idstr, strlen(idstr),
+                                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
 int consume_from_pipe(int pfd, aggregator *aggregators, int nr_aggregators, GList **unconsumed)
 {
     char *line  = NULL;
@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include <util/util.h>
 #include <util/xml_util.h>
@@ -31,6 +32,9 @@
 #include <util/base64.h>
 #include <inttypes.h>
 
+#include <libxml/xmlwriter.h>
+#include <libxml/xmlreader.h>
+
 #include <graph-core.h>
 #include "graph-fs-private.h"
 
@@ -39,127 +43,586 @@
 
 /* Serializing */
 
+/*
+ * The graph is written with an xmlTextWriter as it is iterated rather
+ * than by building a DOM first. The output is byte for byte what
+ * xmlDocDumpFormatMemory() produced for the equivalent DOM. The
+ * writer's attribute escaping already matches, but its escaping of
+ * element content does not, so that is done by xml_write_text().
+ */
+#define GRAPHML_INDENT "  "
+
+/**
+ * Internal function to write @text as the content of the current
+ * element, escaped the way libxml2's xmlsave module escapes text
+ * nodes. Text that is not valid XML character data is dropped, as
+ * xmlsave does.
+ */
+static int xml_write_text(xmlTextWriterPtr writer, const char *text)
+{
+    const unsigned char *in = (const unsigned char *)text;
+    GString *out = g_string_sized_new(strlen(text) + 16);
+    int ret;
+
+    while(*in != '\0') {
+        unsigned int c;
+        int len;
+
+        if(*in == '<') {
+            g_string_append(out, "&lt;");
+        } else if(*in == '>') {
+            g_string_append(out, "&gt;");
+        } else if(*in == '&') {
+            g_string_append(out, "&amp;");
+        } else if((*in >= 0x20 && *in < 0x7f) || *in == '\n' || *in == '\t') {
+            g_string_append_c(out, (gchar)*in);
+        } else if(*in == '\r') {
+            g_string_append(out, "&#xD;");
+        } else {
+            /* multi-byte UTF-8 sequences become character references */
+            if(*in >= 0xf0 && *in < 0xf8) {
+                c = *in & 0x07;
+                len = 4;
+            } else if(*in >= 0xe0) {
+                c = *in & 0x0f;
+                len = 3;
+            } else if(*in >= 0xc0) {
+                c = *in & 0x1f;
+                len = 2;
+            } else {
+                goto invalid;
+            }
+            if(*in >= 0xf8) {
+                goto invalid;
+            }
+            for(int i = 1; i < len; i++) {
+                if((in[i] & 0xc0) != 0x80) {
+                    goto invalid;
+                }
+                c = (c << 6) | (in[i] & 0x3f);
+            }
+            g_string_append_printf(out, "&#x%X;", c);
+            in += len;
+            continue;
+        }
+        in++;
+    }
+
+    ret = xmlTextWriterWriteRaw(writer, (xmlChar*)out->str);
+    g_string_free(out, TRUE);
+    return ret;
+
+invalid:
+    dlog(2, "Warning: dropping text that is not valid XML from serialized graph\n");
+    g_string_free(out, TRUE);
+    return xmlTextWriterWriteRaw(writer, (xmlChar*)"");
+}
+
+/* Export filters, see serialize_measurement_graph_filtered() */
+
+/* keys to keep (all if NULL) and keys to drop (none if NULL) */
+struct filter_set {
+    GHashTable *keep;
+    GHashTable *drop;
+};
+
+struct measurement_graph_filter {
+    struct filter_set targets;
+    struct filter_set spaces;
+    struct filter_set measurements;
+    struct filter_set labels;
+    GHashTable *project;
+    GHashTable *root_targets;
+    GArray *roots;
+    unsigned int version;
+};
+
+enum filter_key {
+    FILTER_TARGET,
+    FILTER_SPACE,
+    FILTER_MEASUREMENT,
+    FILTER_LABEL,
+};
+
+static const struct filter_rule {
+    const char *name;
+    enum filter_key key;
+    size_t set;		/* offset of the set in the filter */
+} filter_rules[] = {
+    {"keep-target",      FILTER_TARGET,      offsetof(measurement_graph_filter, targets.keep)},
+    {"drop-target",      FILTER_TARGET,      offsetof(measurement_graph_filter, targets.drop)},
+    {"root-target",      FILTER_TARGET,      offsetof(measurement_graph_filter, root_targets)},
+    {"keep-space",       FILTER_SPACE,       offsetof(measurement_graph_filter, spaces.keep)},
+    {"drop-space",       FILTER_SPACE,       offsetof(measurement_graph_filter, spaces.drop)},
+    {"keep-measurement", FILTER_MEASUREMENT, offsetof(measurement_graph_filter, measurements.keep)},
+    {"drop-measurement", FILTER_MEASUREMENT, offsetof(measurement_graph_filter, measurements.drop)},
+    {"project",          FILTER_MEASUREMENT, offsetof(measurement_graph_filter, project)},
+    {"keep-label",       FILTER_LABEL,       offsetof(measurement_graph_filter, labels.keep)},
+    {"drop-label",       FILTER_LABEL,       offsetof(measurement_graph_filter, labels.drop)},
+};
+
+measurement_graph_filter *new_measurement_graph_filter(void)
+{
+    measurement_graph_filter *f = calloc(1, sizeof(*f));
+    if(f == NULL) {
+        return NULL;
+    }
+    f->roots = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+    return f;
+}
+
+void free_measurement_graph_filter(measurement_graph_filter *f)
+{
+    size_t i;
+
+    if(f == NULL) {
+        return;
+    }
+    for(i = 0; i < sizeof(filter_rules)/sizeof(filter_rules[0]); i++) {
+        GHashTable *set = *(GHashTable **)((char *)f + filter_rules[i].set);
+        if(set != NULL) {
+            g_hash_table_destroy(set);
+        }
+    }
+    g_array_free(f->roots, TRUE);
+    free(f);
+}
+
+int measurement_graph_filter_add_rule(measurement_graph_filter *f,
+                                      const char *rule)
+{
+    const char *value;
+    const struct filter_rule *r = NULL;
+    GHashTable **set;
+    size_t len, i;
+    magic_t magic = 0;
+
+    if(f == NULL || rule == NULL || (value = strchr(rule, '=')) == NULL) {
+        dlog(1, "Invalid export filter rule %s\n", rule ? rule : "(null)");
+        return -EINVAL;
+    }
+    len = (size_t)(value - rule);
+    value++;
+
+    if(len == strlen("root") && strncmp(rule, "root", len) == 0) {
+        node_id_t n = node_id_of_str(value);
+        if(n == INVALID_NODE_ID) {
+            dlog(1, "Invalid root node %s in export filter\n", value);
+            return -EINVAL;
+        }
+        g_array_append_val(f->roots, n);
+        return 0;
+    }
+
+    if(len == strlen("version") && strncmp(rule, "version", len) == 0) {
+        char *end;
+        unsigned long v;
+        errno = 0;
+        v = strtoul(value, &end, 10);
+        if(errno != 0 || *value == '\0' || *end != '\0' ||
+                v > MEASUREMENT_GRAPH_VERSION) {
+            dlog(1, "Unsupported graph version %s in export filter\n", value);
+            return -EINVAL;
+        }
+        f->version = (unsigned int)v;
+        return 0;
+    }
+
+    for(i = 0; i < sizeof(filter_rules)/sizeof(filter_rules[0]); i++) {
+        if(strlen(filter_rules[i].name) == len &&
+                strncmp(filter_rules[i].name, rule, len) == 0) {
+            r = &filter_rules[i];
+            break;
+        }
+    }
+    if(r == NULL) {
+        dlog(1, "Unknown export filter rule %s\n", rule);
+        return -EINVAL;
+    }
+
+    if(r->key == FILTER_TARGET) {
+        target_type *t = find_target_type_by_name(value);
+        if(t == NULL) {
+            dlog(1, "Unknown target type %s in export filter\n", value);
+            return -ENOENT;
+        }
+        magic = t->magic;
+    } else if(r->key == FILTER_SPACE) {
+        address_space *sp = find_address_space_by_name(value);
+        if(sp == NULL) {
+            dlog(1, "Unknown address space %s in export filter\n", value);
+            return -ENOENT;
+        }
+        magic = sp->magic;
+    } else if(r->key == FILTER_MEASUREMENT) {
+        measurement_type *mt = find_measurement_type_by_name(value);
+        if(mt == NULL) {
+            dlog(1, "Unknown measurement type %s in export filter\n", value);
+            return -ENOENT;
+        }
+        magic = mt->magic;
+    }
+
+    set = (GHashTable **)((char *)f + r->set);
+    if(r->key == FILTER_LABEL) {
+        if(*set == NULL) {
+            *set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        }
+        g_hash_table_add(*set, g_strdup(value));
+    } else {
+        if(*set == NULL) {
+            *set = g_hash_table_new(g_direct_hash, g_direct_equal);
+        }
+        g_hash_table_add(*set, GUINT_TO_POINTER(magic));
+    }
+    return 0;
+}
+
+static inline int filter_set_passes(struct filter_set *s, gconstpointer key)
+{
+    return (s->keep == NULL || g_hash_table_contains(s->keep, key)) &&
+           (s->drop == NULL || !g_hash_table_contains(s->drop, key));
+}
+
+static inline int filter_has_roots(measurement_graph_filter *f)
+{
+    return f->roots->len > 0 || f->root_targets != NULL;
+}
+
+/* unlabeled edges are matched by the label "" */
+static int filter_edge(measurement_graph_filter *f, const char *label)
+{
+    return filter_set_passes(&f->labels, label ? label : "");
+}
+
+static int filter_node(measurement_graph_filter *f, measurement_graph *g,
+                       node_id_t n)
+{
+    target_type *type = measurement_node_get_target_type(g, n);
+    address_space *space = measurement_node_get_address_space(g, n);
+    measurement_iterator *it;
+    int kept = f->measurements.keep == NULL;
+
+    /* left for xml_write_node() to report */
+    if(type == NULL || space == NULL) {
+        return 1;
+    }
+    if(!filter_set_passes(&f->targets, GUINT_TO_POINTER(type->magic)) ||
+            !filter_set_passes(&f->spaces, GUINT_TO_POINTER(space->magic))) {
+        return 0;
+    }
+    if(f->measurements.keep == NULL && f->measurements.drop == NULL) {
+        return 1;
+    }
+    for(it = measurement_node_iterate_data(g, n); it != NULL;
+            it = measurement_iterator_next(it)) {
+        gpointer key = GUINT_TO_POINTER(measurement_iterator_get_type(it));
+        if(f->measurements.drop != NULL && g_hash_table_contains(f->measurements.drop, key)) {
+            destroy_measurement_iterator(it);
+            return 0;
+        }
+        if(f->measurements.keep != NULL && g_hash_table_contains(f->measurements.keep, key)) {
+            kept = 1;
+        }
+    }
+    return kept;
+}
+
+/*
+ * Marks in @reach (indexed by node id, below @max) the nodes that can
+ * be reached from the roots of @f along edges that pass the filter.
+ */
+static void filter_reachable(measurement_graph_filter *f, measurement_graph *g,
+                             node_id_t max, guint8 *reach)
+{
+    GArray *stack = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+    node_iterator *n_iter;
+    guint i;
+
+    for(i = 0; i < f->roots->len; i++) {
+        node_id_t n = g_array_index(f->roots, node_id_t, i);
+        if(n < max && !reach[n]) {
+            reach[n] = 1;
+            g_array_append_val(stack, n);
+        }
+    }
+    if(f->root_targets != NULL) {
+        for(n_iter = measurement_graph_iterate_nodes(g); n_iter != NULL;
+                n_iter = node_iterator_next(n_iter)) {
+            node_id_t n = node_iterator_get(n_iter);
+            target_type *type;
+            if(n >= max || reach[n] ||
+                    (type = measurement_node_get_target_type(g, n)) == NULL ||
+                    !g_hash_table_contains(f->root_targets, GUINT_TO_POINTER(type->magic))) {
+                continue;
+            }
+            reach[n] = 1;
+            g_array_append_val(stack, n);
+        }
+    }
+
+    while(stack->len > 0) {
+        node_id_t n = g_array_index(stack, node_id_t, stack->len - 1);
+        edge_iterator *e_iter;
+
+        g_array_set_size(stack, stack->len - 1);
+        for(e_iter = measurement_node_iterate_outbound_edges(g, n); e_iter != NULL;
+                e_iter = edge_iterator_next(e_iter)) {
+            edge_id_t e = edge_iterator_get(e_iter);
+            node_id_t d = measurement_edge_get_destination(g, e);
+            char *label;
+            int pass;
+
+            if(d == INVALID_NODE_ID || d >= max || reach[d]) {
+                continue;
+            }
+            label = measurement_edge_get_label(g, e);
+            pass  = filter_edge(f, label);
+            free(label);
+            if(pass) {
+                reach[d] = 1;
+                g_array_append_val(stack, d);
+            }
+        }
+    }
+    g_array_free(stack, TRUE);
+}
+
+/* adds the data of node @n to the totals in @stats */
+static void count_node_data(measurement_graph *g, node_id_t n,
+                            measurement_graph_export_stats *stats)
+{
+    measurement_iterator *it;
+
+    for(it = measurement_node_iterate_data(g, n); it != NULL;
+            it = measurement_iterator_next(it)) {
+        struct stat st;
+        stats->nr_data++;
+        if(measurement_node_stat_data(g, n, measurement_iterator_get_type(it), &st) == 0) {
+            stats->data_bytes += (uint64_t)st.st_size;
+        }
+    }
+}
+
 /**
- * Internal function to add a measurement_node as an XML node to the
- * parent node. Used by serialize_measurement_graph().
+ * Internal function to write a measurement_node as a GraphML node
+ * element. Used by serialize_measurement_graph(). If @index is set
+ * the data of the node is described by its size and digest instead
+ * of being written out.
+ * Returns 0 on success, 1 if the node was skipped, or < 0 if the
+ * writer failed.
  */
-static int xml_add_node(xmlNode *node, char* id_value,
-                        measurement_graph *g, node_id_t mn)
+/**
+ * Internal function to write a measurement element for data of type
+ * @mtyp that is the same as that of the node with document id @ref.
+ */
+static int xml_write_data_ref(xmlTextWriterPtr writer, const char *ref,
+                              magic_t mtyp, const char *type_name, size_t size)
+{
+    char buf[32];
+
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"measurement") < 0) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%zd", size);
+    if(xmlTextWriterWriteAttribute(writer, (xmlChar*)"data_size", (xmlChar*)buf) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)GRAPH_DATA_REF_ATTR,
+                                        (xmlChar*)ref) < 0) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%"PRIx32, mtyp);
+    if(xmlTextWriterWriteAttribute(writer, (xmlChar*)"meas_type_magic", (xmlChar*)buf) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"meas_type_name",
+                                        (xmlChar*)type_name) < 0) {
+        return -1;
+    }
+    return xmlTextWriterEndElement(writer) < 0 ? -1 : 0;
+}
+
+/**
+ * Internal function to write node @mn with document id @id_value. In
+ * @index mode, the digest of each datum is written instead of the
+ * datum. Otherwise, if @shared is not NULL, data that is shared with
+ * a node written earlier (according to the data store, see
+ * graph-fs-data.c) is written as a reference to that node, and data
+ * shared with later nodes is recorded in @shared.
+ */
+static int xml_write_node(xmlTextWriterPtr writer, char* id_value,
+                          measurement_graph *g, node_id_t mn, int index,
+                          GHashTable *shared, measurement_graph_filter *f,
+                          measurement_graph_export_stats *stats)
 {
-    int numchar = 0;
     char buf[256];
     measurement_iterator *iter;
-    xmlNode *tmp, *addr_node, *node_meas;
     char *serialized_address;
+    address *address;
+    magic_t space_magic;
+    int rc = 0;
 
     target_type *type = measurement_node_get_target_type(g, mn);
-    address *address;
     if(type == NULL) {
         dlog(1, "Failed to get target type of measurement node\n");
-        return -1;
+        return 1;
     }
 
     address  = measurement_node_get_address(g, mn);
     if(address == NULL) {
         dlog(1, "Failed to get address of measurement node\n");
-        return -1;
-    }
-
-    tmp = xmlNewTextChild(node, NULL, (xmlChar*)"node", NULL);
-    xmlNewProp(tmp, (xmlChar*)"id", (xmlChar*)id_value);
-
-    xmlNewProp(tmp, (xmlChar*)"type", (xmlChar*)type->name);
-    numchar = snprintf(buf,256,"%"PRIx32,type->magic);
-    if(numchar > 0) {
-        xmlNewProp(tmp, (xmlChar*)"type_magic",(xmlChar*)buf);
+        return 1;
     }
 
+    space_magic = address->space->magic;
     serialized_address = serialize_address(address);
+    free_address(address);
     if(serialized_address == NULL) {
         dlog(1, "Failed to serialize measurement address\n");
-        free_address(address);
-        return -1;
+        return 1;
     }
 
-    addr_node = xmlNewTextChild(tmp, NULL, (xmlChar*)"address",
-                                (xmlChar*)serialized_address);
-    free(serialized_address);
+    snprintf(buf, 256, "%"PRIx32, type->magic);
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"node") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"id", (xmlChar*)id_value) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"type", (xmlChar*)type->name) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"type_magic", (xmlChar*)buf) < 0) {
+        free(serialized_address);
+        return -1;
+    }
 
-    numchar = snprintf(buf,256,"%"PRIx32,address->space->magic);
-    if(numchar > 0) {
-        xmlNewProp(addr_node, (xmlChar*)"space", (xmlChar*)buf);
+    snprintf(buf, 256, "%"PRIx32, space_magic);
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"address") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"space", (xmlChar*)buf) < 0 ||
+            xml_write_text(writer, serialized_address) < 0 ||
+            xmlTextWriterEndElement(writer) < 0) {
+        free(serialized_address);
+        return -1;
     }
-    free_address(address);
-    address = NULL;
+    free(serialized_address);
 
     for(iter = measurement_node_iterate_data(g, mn); iter != NULL ;
             iter = measurement_iterator_next(iter)) {
         magic_t mtyp        = measurement_iterator_get_type(iter);
         measurement_type *typ = find_measurement_type(mtyp);
         marshalled_data *md;
+        struct stat st;
+        gchar *key = NULL;
 
-        if(typ == NULL) {
+        if(typ == NULL || (f != NULL && f->project != NULL &&
+                           g_hash_table_contains(f->project, GUINT_TO_POINTER(mtyp)))) {
             continue;
         }
 
+        /* a blob linked from only one node can not be shared */
+        if(shared != NULL && measurement_node_stat_data(g, mn, mtyp, &st) == 0 &&
+                st.st_nlink > 2) {
+            char *ref;
+            key = g_strdup_printf("%"PRIx32":%ju", mtyp, (uintmax_t)st.st_ino);
+            if((ref = g_hash_table_lookup(shared, key)) != NULL) {
+                g_free(key);
+                rc = xml_write_data_ref(writer, ref, mtyp, typ->name, (size_t)st.st_size);
+                if(rc < 0) {
+                    destroy_measurement_iterator(iter);
+                    return -1;
+                }
+                if(stats != NULL) {
+                    stats->data_written++;
+                }
+                continue;
+            }
+        }
+
         if(measurement_node_get_data(g, mn, typ, &md) != 0) {
+            g_free(key);
             continue;
         }
-        node_meas = xmlNewTextChild(tmp, NULL, (xmlChar*)"measurement", NULL);
-        //snprintf(buf,256,"%zu",md->length);
-        numchar = snprintf(buf,256,"%zd",md->marshalled_data_length);
-        if(numchar > 0) {
-            xmlNewProp(node_meas,(xmlChar*)"data_size",(xmlChar*)buf);
-            xmlNewProp(node_meas,(xmlChar*)"meas_data",(xmlChar*)md->marshalled_data);
+        if(key != NULL) {
+            g_hash_table_insert(shared, key, g_strdup(id_value));
         }
 
-        numchar = snprintf(buf,256,"%"PRIx32,md->unmarshalled_type);
-        if(numchar > 0) {
-            xmlNewProp(node_meas,(xmlChar*)"meas_type_magic",(xmlChar*)buf);
+        if(rc == 0) {
+            rc = xmlTextWriterStartElement(writer, (xmlChar*)"measurement");
+        }
+        if(rc >= 0) {
+            snprintf(buf, 256, "%zd", md->marshalled_data_length);
+            rc = xmlTextWriterWriteAttribute(writer, (xmlChar*)"data_size", (xmlChar*)buf);
+        }
+        if(rc >= 0 && index) {
+            gchar *digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                            (guchar*)md->marshalled_data,
+                            strlen(md->marshalled_data));
+            rc = digest == NULL ? -1 :
+                 xmlTextWriterWriteAttribute(writer, (xmlChar*)GRAPH_INDEX_DIGEST_ATTR,
+                                             (xmlChar*)digest);
+            g_free(digest);
+        } else if(rc >= 0) {
+            rc = xmlTextWriterWriteAttribute(writer, (xmlChar*)"meas_data",
+                                             (xmlChar*)md->marshalled_data);
+        }
+        if(rc >= 0) {
+            snprintf(buf, 256, "%"PRIx32, md->unmarshalled_type);
+            rc = xmlTextWriterWriteAttribute(writer, (xmlChar*)"meas_type_magic", (xmlChar*)buf);
+        }
+        if(rc >= 0) {
+            rc = xmlTextWriterWriteAttribute(writer, (xmlChar*)"meas_type_name",
+                                             (xmlChar*)md->meas_data.type->name);
+        }
+        if(rc >= 0) {
+            rc = xmlTextWriterEndElement(writer);
         }
 
-        xmlNewProp(node_meas,(xmlChar*)"meas_type_name",(xmlChar*)md->meas_data.type->name);
-
+        if(stats != NULL) {
+            stats->data_written++;
+            stats->data_bytes_written += md->marshalled_data_length;
+        }
         free_measurement_data(&md->meas_data);
+        if(rc < 0) {
+            destroy_measurement_iterator(iter);
+            return -1;
+        }
+        rc = 0;
     }
-    return 0;
+
+    return xmlTextWriterEndElement(writer) < 0 ? -1 : 0;
 }
 
 /**
- * Internal function to add a measurement_edge as an XML node to the
- * parent node. Used by serialize_measurement_graph().
+ * Internal function to write a measurement_edge as a GraphML edge
+ * element. Used by serialize_measurement_graph().
  */
-static int xml_add_edge(xmlNode *node,
-                        char* s_id_value,
-                        char *label,
-                        char* d_id_value)
+static int xml_write_edge(xmlTextWriterPtr writer,
+                          char* s_id_value,
+                          char *label,
+                          char* d_id_value)
 {
-    xmlNode *tmp;
-
-    tmp = xmlNewTextChild(node, NULL, (xmlChar*)"edge", NULL);
-    if(label) {
-        xmlNewProp(tmp, (xmlChar*)"label", (xmlChar*)label);
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"edge") < 0 ||
+            (label != NULL &&
+             xmlTextWriterWriteAttribute(writer, (xmlChar*)"label", (xmlChar*)label) < 0) ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"source", (xmlChar*)s_id_value) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"target", (xmlChar*)d_id_value) < 0 ||
+            xmlTextWriterEndElement(writer) < 0) {
+        return -1;
     }
-    xmlNewProp(tmp, (xmlChar*)"source", (xmlChar*)s_id_value);
-    xmlNewProp(tmp, (xmlChar*)"target", (xmlChar*)d_id_value);
     return 0;
 }
 
 /**
- * Serialize a measurement graph to a NULL terminated string
- * Returns a char * that needs to be freed.
+ * Internal function to write the GraphML document for @g to @writer.
+ * Nodes are renumbered densely from 0 in iteration order, except in
+ * an index (@index set), whose node ids must name the nodes of @g.
+ * Only the part of @g selected by the filter @f (if any) is written,
+ * and the sizes of both are counted in @stats (if any).
  */
-int serialize_measurement_graph(measurement_graph *g, size_t *sz,
-                                unsigned char **serial)
+static int xml_write_graph(xmlTextWriterPtr writer, measurement_graph *g,
+                           int index, measurement_graph_filter *f,
+                           measurement_graph_export_stats *stats)
 {
-    dlog(1, "Serializing Measurement Graph\n");
     node_id_t node_id_max;
-    xmlDoc *doc;
-    xmlNode *root, *node;
-    int32_t size;
-    xmlChar *tmp;
+    node_id_t *node_id_map;
     node_id_t nr_nodes = 0;
-    xmlAttrPtr docprop = NULL;
+    GHashTable *shared = NULL;
+    guint8 *reach = NULL;
+    unsigned int version = f != NULL ? f->version : 0;
+    char versionstr[16];
+    int ret = -1;
 
     node_id_max = max_node_id(g);
     if(node_id_max  == INVALID_NODE_ID) {
@@ -167,54 +630,88 @@ int serialize_measurement_graph(measurement_graph *g, size_t *sz,
         return -1;
     }
 
-    node_id_t node_id_map[node_id_max]; /* FIXME: this increments the node id on each call */
-
-    xmlKeepBlanksDefault(0);
-    doc = xmlNewDoc((xmlChar*)"1.0");
-
+    /* maps graph node ids to their (dense) ids in the document */
+    node_id_map = malloc((node_id_max > 0 ? node_id_max : 1) * sizeof(node_id_t));
+    if(node_id_map == NULL) {
+        dlog(0, "Failed to allocate node id map for %"PRIu64" nodes\n",
+             (uint64_t)node_id_max);
+        return -1;
+    }
     memset(node_id_map, -1, node_id_max*sizeof(node_id_map[0]));
 
-    if(!doc) {
-        dlog( 1, "XML: null doc\n");
-        return -1;
+    if(f != NULL && filter_has_roots(f)) {
+        if((reach = calloc(node_id_max > 0 ? node_id_max : 1, 1)) == NULL) {
+            dlog(0, "Failed to allocate reachability map\n");
+            goto out;
+        }
+        filter_reachable(f, g, node_id_max, reach);
     }
-    docprop = xmlNewDocProp(doc,(xmlChar*)"encoding",(xmlChar*)"UTF-8");
-    root = xmlNewNode(NULL, (xmlChar*)"graphml");
-    if(!root) {
-        dlog(1, "XML: null root\n");
-        return -1;
+
+    /* data references are only understood from version 1 on */
+    if(!index && version >= 1 && (shared = g_hash_table_new_full(g_str_hash, g_str_equal,
+                           g_free, g_free)) == NULL) {
+        goto out;
     }
-    xmlDocSetRootElement(doc, root);
-    xmlNewProp(root, (xmlChar*)"xmlns",(xmlChar*)"http://graphdrawing.org/xmlns");
-    xmlNewProp(root, (xmlChar*)"xmlns:xsi",(xmlChar*)"http://www.w3.org/2001/XMLSchema-instance");
-    xmlNewProp(root, (xmlChar*)"xsi:schemaLocation",
-               (xmlChar*)"http://www.graphdrawing.org/xmlns http://graphml.graphdrawing.org/xmlns/1.0/graphml.xsd");
 
+    if(xmlTextWriterSetIndent(writer, 1) < 0 ||
+            xmlTextWriterSetIndentString(writer, (xmlChar*)GRAPHML_INDENT) < 0 ||
+            xmlTextWriterStartDocument(writer, NULL, NULL, NULL) < 0) {
+        goto out;
+    }
+
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"graphml") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"xmlns",
+                                        (xmlChar*)"http://graphdrawing.org/xmlns") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"xmlns:xsi",
+                                        (xmlChar*)"http://www.w3.org/2001/XMLSchema-instance") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"xsi:schemaLocation",
+                                        (xmlChar*)"http://www.graphdrawing.org/xmlns http://graphml.graphdrawing.org/xmlns/1.0/graphml.xsd") < 0) {
+        goto out;
+    }
 
-    node = xmlNewTextChild(root, NULL, (xmlChar*)"graph", NULL);
-    xmlNewProp(node, (xmlChar*)"mgversion", (xmlChar*)"0");
-    xmlNewProp(node, (xmlChar*)"id",(xmlChar*)"G");
-    xmlNewProp(node, (xmlChar*)"edgedefault",(xmlChar*)"undirected");
-    //compact edge and node vectors
+    snprintf(versionstr, sizeof(versionstr), "%u", version);
+    if(xmlTextWriterStartElement(writer, (xmlChar*)"graph") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"mgversion", (xmlChar*)versionstr) < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"id", (xmlChar*)"G") < 0 ||
+            xmlTextWriterWriteAttribute(writer, (xmlChar*)"edgedefault",
+                                        (xmlChar*)"undirected") < 0 ||
+            (index && xmlTextWriterWriteAttribute(writer, (xmlChar*)GRAPH_EVIDENCE_ATTR,
+                    (xmlChar*)GRAPH_EVIDENCE_INDEX) < 0)) {
+        goto out;
+    }
 
     do {
         node_iterator *n_iter;
         dlog(6, "Serializing nodes\n");
         for(n_iter = measurement_graph_iterate_nodes(g); n_iter != NULL; n_iter = node_iterator_next(n_iter)) {
             node_id_t n = node_iterator_get(n_iter);
-            if(n != INVALID_NODE_ID) {
+            if(n != INVALID_NODE_ID && n < node_id_max) {
                 node_id_str idstr;
-                str_of_node_id(nr_nodes, idstr);
-                node_id_map[n] = nr_nodes;
+                int rc;
+                if(stats != NULL) {
+                    stats->nr_nodes++;
+                    count_node_data(g, n, stats);
+                }
+                if(f != NULL && ((reach != NULL && !reach[n]) || !filter_node(f, g, n))) {
+                    continue;
+                }
+                node_id_map[n] = index ? n : nr_nodes;
+                str_of_node_id(node_id_map[n], idstr);
                 nr_nodes++;
-                if(xml_add_node(node, idstr, g, n) != 0) {
+                rc = xml_write_node(writer, idstr, g, n, index, shared, f, stats);
+                if(rc < 0) {
+                    destroy_node_iterator(n_iter);
+                    goto out;
+                } else if(rc != 0) {
                     dlog(1, "Error failed to serialize node "ID_FMT"\n", nr_nodes-1);
                 }
+                if(stats != NULL) {
+                    stats->nodes_written++;
+                }
             }
         }
     } while(0);
 
-
     do {
         edge_iterator *e_iter;
         dlog(6, "Serializing edges\n");
@@ -225,6 +722,7 @@ int serialize_measurement_graph(measurement_graph *g, size_t *sz,
                 node_id_t s_node_id, d_node_id;
                 node_id_str s_node_id_str, d_node_id_str;
                 char *label;
+                int rc;
 
                 s_node_id = measurement_edge_get_source(g, e);
                 d_node_id = measurement_edge_get_destination(g, e);
@@ -233,43 +731,132 @@ int serialize_measurement_graph(measurement_graph *g, size_t *sz,
                     dlog(1, "Edge has invalid source/destination node\n");
                     continue;
                 }
+                if(stats != NULL) {
+                    stats->nr_edges++;
+                }
 
                 s_node_id = node_id_map[s_node_id];
                 d_node_id = node_id_map[d_node_id];
-                if(s_node_id == INVALID_NODE_ID || s_node_id >= nr_nodes ||
-                        d_node_id ==INVALID_NODE_ID || d_node_id >= nr_nodes) {
-                    dlog(1, "Edge has invalid source/destination node\n");
+                if(s_node_id == INVALID_NODE_ID || d_node_id ==INVALID_NODE_ID) {
+                    /* an end was left out by the filter */
+                    if(f == NULL) {
+                        dlog(1, "Edge has invalid source/destination node\n");
+                    }
+                    continue;
+                }
+
+                label = measurement_edge_get_label(g, e);
+                if(f != NULL && !filter_edge(f, label)) {
+                    free(label);
                     continue;
                 }
 
                 str_of_node_id(s_node_id, s_node_id_str);
                 str_of_node_id(d_node_id, d_node_id_str);
 
-                label = measurement_edge_get_label(g, e);
-
                 dlog(5, "creating edge %s -> %s (label = %s)\n",
                      s_node_id_str, d_node_id_str, label ? label : "");
 
-                xml_add_edge(node, s_node_id_str, label, d_node_id_str);
+                rc = xml_write_edge(writer, s_node_id_str, label, d_node_id_str);
                 free(label);
+                if(rc < 0) {
+                    destroy_edge_iterator(e_iter);
+                    goto out;
+                }
+                if(stats != NULL) {
+                    stats->edges_written++;
+                }
             }
         }
     } while(0);
 
-    xmlDocDumpFormatMemory(doc, &tmp, &size, 1);
-    xmlFreeProp(docprop); /* for some reason this doesn't get freed with the doc. */
-    xmlFreeDoc(doc);
-    if(size < 0) {
+    /* closes the graph and graphml elements */
+    if(xmlTextWriterEndDocument(writer) < 0) {
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if(ret != 0) {
+        dlog(1, "Failed to write graph xml document\n");
+    }
+    if(shared != NULL) {
+        g_hash_table_destroy(shared);
+    }
+    free(reach);
+    free(node_id_map);
+    return ret;
+}
+
+static int serialize_graph(measurement_graph *g, size_t *sz,
+                           unsigned char **serial, int index,
+                           measurement_graph_filter *f,
+                           measurement_graph_export_stats *stats)
+{
+    xmlBufferPtr buf;
+    xmlTextWriterPtr writer;
+    int ret;
+
+    if((buf = xmlBufferCreate()) == NULL) {
+        dlog(1, "XML: failed to create buffer\n");
+        return -1;
+    }
+
+    if((writer = xmlNewTextWriterMemory(buf, 0)) == NULL) {
+        dlog(1, "XML: failed to create writer\n");
+        xmlBufferFree(buf);
+        return -1;
+    }
+
+    ret = xml_write_graph(writer, g, index, f, stats);
+    /* flushes any output still held by the writer into buf */
+    xmlFreeTextWriter(writer);
+    if(ret != 0) {
         dlog(1, "Failed to serialize graph xml document.");
-        free(tmp);
+        xmlBufferFree(buf);
         return -1;
     }
 
-    *serial = tmp;
-    *sz =  (size_t)size;
+    *sz = (size_t)xmlBufferLength(buf);
+    *serial = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+    if(*serial == NULL) {
+        dlog(1, "Failed to serialize graph xml document.");
+        return -1;
+    }
     return 0;
 }
 
+/**
+ * Serialize a measurement graph to a NULL terminated string
+ * Returns a char * that needs to be freed.
+ */
+int serialize_measurement_graph(measurement_graph *g, size_t *sz,
+                                unsigned char **serial)
+{
+    dlog(1, "Serializing Measurement Graph\n");
+    return serialize_graph(g, sz, serial, 0, NULL, NULL);
+}
+
+int serialize_measurement_graph_filtered(measurement_graph *g,
+        measurement_graph_filter *f,
+        size_t *sz, unsigned char **serial,
+        measurement_graph_export_stats *stats)
+{
+    dlog(1, "Serializing Filtered Measurement Graph\n");
+    if(stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return serialize_graph(g, sz, serial, 0, f, stats);
+}
+
+int serialize_measurement_graph_index(measurement_graph *g, size_t *sz,
+                                      unsigned char **serial)
+{
+    dlog(1, "Serializing Measurement Graph Index\n");
+    return serialize_graph(g, sz, serial, 1, NULL, NULL);
+}
+
 /* Loading */
 
 /**
@@ -391,6 +978,152 @@ error_cleanup:
     return NULL;
 }
 
+struct graph_index {
+    GHashTable *nodes;	/* node id -> GList of (graph_index_entry *) */
+};
+
+static void free_graph_index_entry(graph_index_entry *e)
+{
+    if(e != NULL) {
+        free(e->digest);
+        free(e);
+    }
+}
+
+static void free_graph_index_entries(gpointer entries)
+{
+    g_list_free_full((GList *)entries, (GDestroyNotify)free_graph_index_entry);
+}
+
+static graph_index *new_graph_index(void)
+{
+    graph_index *idx = malloc(sizeof(*idx));
+    if(idx == NULL) {
+        return NULL;
+    }
+    idx->nodes = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                       g_free, free_graph_index_entries);
+    return idx;
+}
+
+void free_graph_index(graph_index *idx)
+{
+    if(idx != NULL) {
+        g_hash_table_destroy(idx->nodes);
+        free(idx);
+    }
+}
+
+GList *graph_index_entries(graph_index *idx, node_id_t node)
+{
+    return g_hash_table_lookup(idx->nodes, &node);
+}
+
+graph_index_entry *graph_index_find(graph_index *idx, node_id_t node,
+                                    magic_t type)
+{
+    GList *l;
+    for(l = graph_index_entries(idx, node); l != NULL; l = l->next) {
+        graph_index_entry *e = l->data;
+        if(e->type == type) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+int graph_index_check(graph_index_entry *e, const char *data, size_t size)
+{
+    gchar *digest;
+    int ret;
+
+    /* sizes count the terminating NUL, as in the serialized graph */
+    if(size != e->size || data[size-1] != '\0' || strlen(data) != size-1) {
+        return 0;
+    }
+    digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (guchar*)data,
+                                         size-1);
+    if(digest == NULL) {
+        return -1;
+    }
+    ret = strcmp(digest, e->digest) == 0;
+    g_free(digest);
+    return ret;
+}
+
+/**
+   internal function to record the measurement described by the index
+   element @n as held by node @node of the indexed graph (used by
+   load_node())
+*/
+static int parse_index_entry(xmlNode *n, node_id_t node, node_id_t source_node,
+                             graph_index *idx)
+{
+    graph_index_entry *e;
+    unsigned long m;
+    char *tmp;
+    char *strend;
+    GList *entries;
+
+    if((e = calloc(1, sizeof(*e))) == NULL) {
+        dlog(1, "Malloc error\n");
+        return -1;
+    }
+    e->source_node = source_node;
+
+    if((tmp = xmlGetPropASCII(n, "data_size")) == NULL) {
+        dlog(1, "Index entry has no size attribute\n");
+        goto error;
+    }
+    errno = 0;
+    e->size = strtoul(tmp, &strend, 10);
+    if(errno != 0 || *strend != '\0' || e->size == 0) {
+        dlog(1, "Index entry has invalid size attribute\n");
+        xmlFree(tmp);
+        goto error;
+    }
+    xmlFree(tmp);
+
+    if((tmp = xmlGetPropASCII(n, "meas_type_magic")) == NULL) {
+        dlog(1, "Index entry has no type magic\n");
+        goto error;
+    }
+    m = strtoul(tmp, NULL, 16);
+    xmlFree(tmp);
+    if(m > MAGIC_MAX) {
+        dlog(1, "Index entry type magic is too large\n");
+        goto error;
+    }
+    e->type = (magic_t)m;
+
+    e->digest = xmlGetPropASCII(n, GRAPH_INDEX_DIGEST_ATTR);
+    if(e->digest == NULL ||
+            strlen(e->digest) != 2*(size_t)g_checksum_type_get_length(G_CHECKSUM_SHA256)) {
+        dlog(1, "Index entry has no valid digest\n");
+        goto error;
+    }
+
+    if(graph_index_find(idx, node, e->type) != NULL) {
+        dlog(1, "Index lists type "MAGIC_FMT" twice for one node\n", e->type);
+        goto error;
+    }
+
+    entries = g_hash_table_lookup(idx->nodes, &node);
+    if(entries == NULL) {
+        node_id_t *key = g_new(node_id_t, 1);
+        *key = node;
+        g_hash_table_insert(idx->nodes, key, g_list_prepend(NULL, e));
+    } else {
+        /* the list head stays the same, so the table need not be updated */
+        entries = g_list_append(entries, e);
+    }
+    return 0;
+
+error:
+    free_graph_index_entry(e);
+    return -1;
+}
+
 /**
    internal function to extract a measurement_variable structure from
    an xmlNode (used by parse_measurement_graph())
@@ -494,21 +1227,180 @@ error:
 
 
 /**
-   Parse a serialized measurement graph.
+   internal function to give @node the data referenced by the
+   measurement element @n, if it has a GRAPH_DATA_REF_ATTR (see
+   serialize_measurement_graph()). The referenced node must have been
+   loaded already, and references are only valid in documents of
+   version 1 or later. Returns 0 if the data was added, 1 if @n holds
+   its data itself and < 0 on error.
+*/
+static int load_data_ref(unsigned long mgversion,
+                         struct measurement_graph *g, node_id_t node,
+                         xmlNode *n, node_id_t *node_map,
+                         node_id_t node_map_capacity)
+{
+    char *ref;
+    char *data_size = NULL;
+    char *type_magic = NULL;
+    char *strend;
+    node_id_t src;
+    unsigned long m;
+    size_t size;
+    int ret = -EINVAL;
 
-   @s contains the serialized XML graph with size @size (NULL
-   determination is not assumed).
+    if((ref = xmlGetPropASCII(n, GRAPH_DATA_REF_ATTR)) == NULL) {
+        return 1;
+    }
+    if(mgversion < 1) {
+        dlog(1, "Measurement data reference in a version %lu graph\n", mgversion);
+        goto out;
+    }
 
-   Returns a pointer to the graph on success or NULL on failure.
+    src = node_id_of_str(ref);
+    if(src == INVALID_NODE_ID || src >= node_map_capacity ||
+            (src = node_map[src]) == INVALID_NODE_ID) {
+        dlog(1, "Measurement data refers to unknown node %s\n", ref);
+        goto out;
+    }
+
+    if((data_size = xmlGetPropASCII(n, "data_size")) == NULL ||
+            (type_magic = xmlGetPropASCII(n, "meas_type_magic")) == NULL) {
+        dlog(1, "Measurement data reference has no size or type magic\n");
+        goto out;
+    }
+    errno = 0;
+    size = strtoul(data_size, &strend, 10);
+    if(errno != 0 || *strend != '\0') {
+        dlog(1, "Measurement data has invalid size attribute\n");
+        goto out;
+    }
+    m = strtoul(type_magic, &strend, 16);
+    if(*strend != '\0' || m > MAGIC_MAX) {
+        dlog(1, "Measurement type magic %s is invalid\n", type_magic);
+        goto out;
+    }
+
+    if((ret = measurement_node_share_data(g, node, src, (magic_t)m, size)) != 0) {
+        dlog(1, "Failed to add data of type %s referenced from node %s\n",
+             type_magic, ref);
+    }
+
+out:
+    xmlFree(ref);
+    xmlFree(data_size);
+    xmlFree(type_magic);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+   internal function to add the node described by the expanded node
+   element @n to @g and record its document id in @node_map (used by
+   parse_measurement_graph())
 */
-measurement_graph *parse_measurement_graph(char *s, size_t size)
+static int load_node(unsigned long mgversion, struct measurement_graph *g,
+                     xmlNode *n, node_id_t **node_map,
+                     node_id_t *node_map_capacity, graph_index *idx)
 {
-    xmlNode *root, *node, *iter, *meas;
+    node_id_t node;
+    node_id_t original_id;
+    xmlNode *meas;
+    int rc;
+    measurement_variable *var = parse_node(mgversion, n, &original_id);
+
+    if(var == NULL) {
+        dlog(1, "Null measurement variable\n");
+        return -1;
+    }
+
+    if(original_id >= *node_map_capacity) {
+        node_id_t *tmp;
+        node_id_t new_capacity;
+        if(original_id >= NODE_ID_MAX) {
+            dlog(1, "Error: node id "ID_FMT" out of bounds\n", original_id);
+            free_measurement_variable(var);
+            return -1;
+        }
+        if(original_id >= NODE_ID_MAX/2) {
+            new_capacity = original_id + 1;
+        } else {
+            new_capacity = 2*original_id;
+        }
+
+        if((tmp = realloc(*node_map, (size_t)new_capacity*sizeof(node_id_t))) == NULL) {
+            dlog(1, "Error parsing graph: too many nodes (allocation failed)!\n");
+            free_measurement_variable(var);
+            return -1;
+        }
+        /* ids that never appear must not map to an arbitrary node */
+        memset(tmp + *node_map_capacity, -1,
+               (size_t)(new_capacity - *node_map_capacity)*sizeof(node_id_t));
+        *node_map = tmp;
+        *node_map_capacity = new_capacity;
+    }
+
+    if(measurement_graph_add_node(g, var, NULL, &node)<0) {
+        dlog(1, "Parse_node: add node failed\n");
+        free_measurement_variable(var);
+        return -1;
+    }
+    free_measurement_variable(var);
+    if(node == INVALID_NODE_ID) { //generate measurement_node failed
+        dlog(1, "Error Parsing MG: measurment_node is null\n");
+        return -1;
+    }
+    (*node_map)[original_id] = node;
+
+    for(meas = n->children; meas != NULL; meas = meas->next) {
+        char *measname = validate_cstring_ascii(meas->name, SIZE_MAX);
+
+        if(measname == NULL || strcmp(measname, "measurement") != 0) {
+            continue;
+        }
+
+        if(idx != NULL) {
+            if(parse_index_entry(meas, node, original_id, idx) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if((rc = load_data_ref(mgversion, g, node, meas, *node_map,
+                               *node_map_capacity)) < 0) {
+            return -1;
+        } else if(rc == 0) {
+            continue;
+        }
+
+        dlog(6, "Parsing measurement in node\n");
+        //create new measurement data node
+        marshalled_data *md = parse_measurement(mgversion, meas);
+        if(md != NULL) {
+            measurement_node_add_data(g, node, md);
+            free_measurement_data(&md->meas_data);
+        }
+    }
+    return 0;
+}
+
+/**
+   Parse a serialized measurement graph, or a graph index if @idx is
+   non-NULL, in which case *@idx is set to the parsed index.
+
+   The document is read with an xmlTextReader: each node or edge
+   element is expanded, loaded into the graph and then discarded, so
+   only one element of the document is held in memory at a time.
+*/
+static measurement_graph *parse_graph(char *s, size_t size, graph_index **idx)
+{
+    xmlTextReaderPtr reader = NULL;
     struct measurement_graph *ret_graph = NULL;
-    xmlDoc *doc = NULL;
     node_id_t *node_map = NULL;
     node_id_t node_map_capacity;
     unsigned long mgversion = 0;
+    char *mgversionstr;
+    char *evidence;
+    int graph_depth = -1;
+    int rc;
 
     dlog(6, "Parse Measurement Graph\n");
 
@@ -524,50 +1416,39 @@ measurement_graph *parse_measurement_graph(char *s, size_t size)
     }
 
     if((node_map = malloc(sizeof(node_id_t)*64)) == NULL) {
-        dlog(1, "Error: failed to allocate node map when parsing measurement graph\b");
+        dlog(1, "Error: failed to allocate node map when parsing measurement graph\n");
         goto error;
     }
+    memset(node_map, -1, sizeof(node_id_t)*64);
     node_map_capacity = 64;
 
     /* FIXME: we should do schema validation here */
-    if((doc = xmlReadMemory(s, (int)size, NULL, NULL, XML_PARSE_HUGE)) == NULL) {
-        dlog(1, "Error Parsing MG: doc is null\n");
-    }
-
-    if((root = xmlDocGetRootElement(doc)) == NULL) {
-        dlog(1, "Error Parsing MG: root is null\n");
+    if((reader = xmlReaderForMemory(s, (int)size, NULL, NULL, XML_PARSE_HUGE)) == NULL) {
+        dlog(1, "Error Parsing MG: failed to create reader\n");
         goto error;
     }
 
-    /* Something fragile about the serialized graphs.
-     *  Sometimes root->children is graph, sometimes it's text */
     //TODO: handle case where multiple graphs exist in graphml document
-    node = NULL;
-
-
-    if(root->children) {
-        char *childname = validate_cstring_ascii(root->children->name, SIZE_MAX);
-        if (childname != NULL && strcmp(childname, "graph")==0) {
-            node = root->children;
+    while((rc = xmlTextReaderRead(reader)) == 1) {
+        char *name;
+        if(xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+                xmlTextReaderDepth(reader) != 1) {
+            continue;
         }
-
-        if(root->children->next) {
-            childname = validate_cstring_ascii(root->children->next->name, SIZE_MAX);
-            if (childname != NULL && strcmp(childname, "graph")==0) {
-                node = root->children->next;
-            }
+        name = validate_cstring_ascii(xmlTextReaderConstLocalName(reader), SIZE_MAX);
+        if(name != NULL && strcmp(name, "graph") == 0) {
+            graph_depth = 1;
+            break;
         }
     }
 
-    if(!node) {
+    if(graph_depth < 0) {
         dlog(1, "Error Parsing MG: node is null\n");
         goto error;
     }
 
-    char *mgversionstr = xmlGetPropASCII(node, "mgversion");
-    if(mgversionstr == NULL) {
-        mgversion = 0;
-    } else {
+    mgversionstr = (char*)xmlTextReaderGetAttribute(reader, (xmlChar*)"mgversion");
+    if(mgversionstr != NULL) {
         char *endptr;
         mgversion = strtoul(mgversionstr, &endptr, 10);
         if(mgversion == ULONG_MAX || *endptr != '\0') {
@@ -575,73 +1456,55 @@ measurement_graph *parse_measurement_graph(char *s, size_t size)
                  mgversionstr);
             mgversion = 0;
         }
-        free(mgversionstr);
+        xmlFree(mgversionstr);
     }
 
-    for(iter = xmlFirstElementChild(node); iter != NULL; iter = xmlNextElementSibling(iter)) {
-        char *itername = validate_cstring_ascii(iter->name, SIZE_MAX);
-        if(itername == NULL) {
-            continue;
-        }
+    /* an index must never be mistaken for a graph without data */
+    evidence = (char*)xmlTextReaderGetAttribute(reader, (xmlChar*)GRAPH_EVIDENCE_ATTR);
+    if((evidence != NULL && strcmp(evidence, GRAPH_EVIDENCE_INDEX) == 0) != (idx != NULL)) {
+        dlog(1, "Error Parsing MG: expected a graph %s but got a graph %s\n",
+             idx != NULL ? "index" : "with data",
+             idx != NULL ? "with data" : "index");
+        xmlFree(evidence);
+        goto error;
+    }
+    xmlFree(evidence);
 
-        if(strcmp(itername, "node")==0) {
-            dlog(5, "Parsing new node\n");
-            node_id_t node;
-            node_id_t original_id;
-            measurement_variable *var = parse_node(mgversion, iter, &original_id);
+    if(idx != NULL && (*idx = new_graph_index()) == NULL) {
+        dlog(1, "Error: failed to allocate graph index\n");
+        goto error;
+    }
 
-            if(var == NULL) {
-                dlog(1, "Null measurement variable\n");
-                goto error;
-            }
+    if(xmlTextReaderIsEmptyElement(reader)) {
+        goto done;
+    }
 
-            if(original_id >= node_map_capacity) {
-                node_id_t *tmp;
-                if(original_id >= NODE_ID_MAX) {
-                    dlog(1, "Error: node id "ID_FMT" out of bounds\n", original_id);
-                    free_measurement_variable(var);
-                    goto error;
-                }
-                if(original_id >= NODE_ID_MAX/2) {
-                    node_map_capacity = original_id + 1;
-                } else {
-                    node_map_capacity = 2*original_id;
-                }
+    rc = xmlTextReaderRead(reader);
+    while(rc == 1 && xmlTextReaderDepth(reader) > graph_depth) {
+        xmlNode *iter;
+        char *itername;
 
-                if((tmp = realloc(node_map, (size_t)node_map_capacity*sizeof(node_id_t))) == NULL) {
-                    dlog(1, "Error parsing graph: too many nodes (allocation failed)!\n");
-                    free_measurement_variable(var);
-                    goto error;
-                }
-                node_map = tmp;
-            }
-
-            if(measurement_graph_add_node(ret_graph, var, NULL, &node)<0) {
-                dlog(1, "Parse_node: add node failed\n");
-                free_measurement_variable(var);
-                goto error;
-            }
-            node_map[original_id] = node;
+        if(xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+            rc = xmlTextReaderRead(reader);
+            continue;
+        }
 
-            free_measurement_variable(var);
-            if(node == INVALID_NODE_ID) { //generate measurement_node failed
-                dlog(1, "Error Parsing MG: measurment_node is null\n");
-                goto error;
-            }
-            for(meas = iter->children; meas != NULL; meas = meas->next) {
-                char *measname = validate_cstring_ascii(meas->name, SIZE_MAX);
+        itername = validate_cstring_ascii(xmlTextReaderConstLocalName(reader), SIZE_MAX);
+        if(itername == NULL || strcmp(itername, "text") == 0) {
+            rc = xmlTextReaderNext(reader);
+            continue;
+        }
 
-                if(measname == NULL || strcmp(measname, "measurement") != 0) {
-                    continue;
-                }
+        if((iter = xmlTextReaderExpand(reader)) == NULL) {
+            dlog(1, "Error parsing graph: failed to expand %s element\n", itername);
+            goto error;
+        }
 
-                dlog(6, "Parsing measurement in node\n");
-                //create new measurement data node
-                marshalled_data *md = parse_measurement(mgversion, meas);
-                if(md != NULL) {
-                    measurement_node_add_data(ret_graph, node, md);
-                    free_measurement_data(&md->meas_data);
-                }
+        if(strcmp(itername, "node")==0) {
+            dlog(5, "Parsing new node\n");
+            if(load_node(mgversion, ret_graph, iter, &node_map, &node_map_capacity,
+                         idx != NULL ? *idx : NULL) != 0) {
+                goto error;
             }
         } else if(strcmp(itername, "edge")==0) {
             dlog(5, "Parsing new edge\n");
@@ -650,20 +1513,84 @@ measurement_graph *parse_measurement_graph(char *s, size_t size)
                 dlog(1, "Error parsing edge\n");
                 goto error;
             }
-        } else if(strcmp(itername, "text")==0) {
         } else {
-            dlog(1, "Error parsing graph: a non-node/edge: %s\n",iter->name);
+            dlog(1, "Error parsing graph: a non-node/edge: %s\n", itername);
             goto error;
         }
+
+        /* skips the subtree, letting the reader release it */
+        rc = xmlTextReaderNext(reader);
     }
+
+    if(rc < 0) {
+        dlog(1, "Error Parsing MG: malformed document\n");
+        goto error;
+    }
+
+done:
     dlog(6, "Done parsing measurement graph\n");
-    xmlFreeDoc(doc);
+    xmlFreeTextReader(reader);
     free(node_map);
     return ret_graph;
 
 error:
     free(node_map);
-    xmlFreeDoc(doc);
+    xmlFreeTextReader(reader);
     destroy_measurement_graph(ret_graph);
+    if(idx != NULL) {
+        free_graph_index(*idx);
+        *idx = NULL;
+    }
     return NULL;
 }
+
+/**
+   Parse a serialized measurement graph.
+
+   @s contains the serialized XML graph with size @size (NULL
+   determination is not assumed).
+
+   Returns a pointer to the graph on success or NULL on failure.
+*/
+measurement_graph *parse_measurement_graph(char *s, size_t size)
+{
+    return parse_graph(s, size, NULL);
+}
+
+measurement_graph *parse_measurement_graph_index(char *s, size_t size,
+        graph_index **idx)
+{
+    *idx = NULL;
+    return parse_graph(s, size, idx);
+}
+
+int is_measurement_graph_index(char *s, size_t size)
+{
+    xmlTextReaderPtr reader;
+    char *evidence = NULL;
+    int rc;
+
+    if(size > INT_MAX ||
+            (reader = xmlReaderForMemory(s, (int)size, NULL, NULL, XML_PARSE_HUGE)) == NULL) {
+        return 0;
+    }
+
+    while((rc = xmlTextReaderRead(reader)) == 1) {
+        char *name;
+        if(xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+                xmlTextReaderDepth(reader) != 1) {
+            continue;
+        }
+        name = validate_cstring_ascii(xmlTextReaderConstLocalName(reader), SIZE_MAX);
+        if(name != NULL && strcmp(name, "graph") == 0) {
+            evidence = (char*)xmlTextReaderGetAttribute(reader,
+                       (xmlChar*)GRAPH_EVIDENCE_ATTR);
+            break;
+        }
+    }
+    xmlFreeTextReader(reader);
+
+    rc = evidence != NULL && strcmp(evidence, GRAPH_EVIDENCE_INDEX) == 0;
+    xmlFree(evidence);
+    return rc;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_graph_dedup.c: measures the content addressed data store of
+ * the graph on a graph shaped like a userspace measurement. Not run
+ * by 'make check'; build it with 'make bench_graph_dedup'.
+ *
+ * usage: bench_graph_dedup [nr_processes]   (default 1000)
+ *
+ * Each process node carries an environment block (about 1.5KiB),
+ * most of them one of a handful of common environments, and has
+ * MAPPINGS_PER_PROCESS mapping nodes each carrying the sha256 of a
+ * library. Libraries are drawn with a heavy skew so that, as on a
+ * real host, a few (libc, ld.so, ...) are mapped by every process.
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <graph/graph-core.h>
+#include <measurement_spec/find_types.h>
+#include <util/util.h>
+
+#include "dummy_types.h"
+
+#define DEFAULT_NR_PROCESSES 1000UL
+#define MAPPINGS_PER_PROCESS 40
+#define NR_LIBRARIES 300
+#define NR_ENVIRONMENTS 8
+#define ENVIRONMENT_SIZE 1536
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static long max_rss_kb(void)
+{
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+    return ru.ru_maxrss;
+}
+
+/* adds the NUL terminated @str as the dummy measurement of node @n */
+static int add_string_data(measurement_graph *g, node_id_t n, const char *str)
+{
+    marshalled_data *md;
+    int rc;
+
+    md = (marshalled_data*)alloc_measurement_data(&marshalled_data_measurement_type);
+    if(md == NULL) {
+        return -1;
+    }
+    md->unmarshalled_type = dummy_measurement_type.magic;
+    md->marshalled_data_length = strlen(str) + 1;
+    if((md->marshalled_data = strdup(str)) == NULL) {
+        free_measurement_data(&md->meas_data);
+        return -1;
+    }
+    rc = measurement_node_add_data(g, n, md);
+    free_measurement_data(&md->meas_data);
+    return rc;
+}
+
+static void make_environment(char *buf, unsigned long seed)
+{
+    size_t i;
+    for(i = 0; i < ENVIRONMENT_SIZE; i++) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        buf[i] = (char)('a' + (seed >> 59) % 26);
+    }
+    buf[ENVIRONMENT_SIZE] = '\0';
+}
+
+static measurement_graph *build_graph(unsigned long nr_processes, size_t *nr_nodes)
+{
+    measurement_graph *g;
+    measurement_variable v;
+    char env[ENVIRONMENT_SIZE + 1];
+    char digest[65];
+    uint32_t addr = 0;
+    unsigned long i;
+    int j;
+
+    if((g = create_measurement_graph(NULL)) == NULL) {
+        return NULL;
+    }
+
+    v.type = &dummy_target_type;
+    if((v.address = alloc_simple_address()) == NULL) {
+        destroy_measurement_graph(g);
+        return NULL;
+    }
+
+    srandom(1);
+    for(i = 0; i < nr_processes; i++) {
+        node_id_t proc;
+
+        ((simple_address*)v.address)->addr = addr++;
+        if(measurement_graph_add_node(g, &v, NULL, &proc) < 0) {
+            goto error;
+        }
+        /* one process in 16 has an environment of its own */
+        make_environment(env, random() % 16 == 0 ? NR_ENVIRONMENTS + i :
+                         (unsigned long)random() % NR_ENVIRONMENTS);
+        if(add_string_data(g, proc, env) != 0) {
+            goto error;
+        }
+
+        for(j = 0; j < MAPPINGS_PER_PROCESS; j++) {
+            double u = (double)random() / RAND_MAX;
+            unsigned long lib = (unsigned long)(NR_LIBRARIES * u * u * u);
+            node_id_t map;
+            edge_id_t e;
+
+            ((simple_address*)v.address)->addr = addr++;
+            if(measurement_graph_add_node(g, &v, NULL, &map) < 0 ||
+                    measurement_graph_add_edge(g, proc, "mappings", map, &e) < 0) {
+                goto error;
+            }
+            snprintf(digest, sizeof(digest), "%016lx%048x", lib * 0x9e3779b97f4a7c15UL, 0);
+            if(add_string_data(g, map, digest) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    free_address(v.address);
+    *nr_nodes = addr;
+    return g;
+
+error:
+    free_address(v.address);
+    destroy_measurement_graph(g);
+    return NULL;
+}
+
+static void print_stats(const char *what, measurement_graph *g)
+{
+    measurement_graph_data_stats st;
+
+    if(measurement_graph_get_data_stats(g, &st) != 0) {
+        printf("%s: failed to get data statistics\n", what);
+        return;
+    }
+    printf("%s: %zu data in %zu blobs, %"PRIu64" of %"PRIu64" bytes stored "
+           "(dedup ratio %.2f)\n", what, st.nr_refs, st.nr_blobs,
+           st.stored_bytes, st.data_bytes,
+           st.stored_bytes ? (double)st.data_bytes / (double)st.stored_bytes : 1.0);
+}
+
+static size_t count_occurrences(const unsigned char *buf, size_t size, const char *str)
+{
+    size_t len = strlen(str);
+    size_t i, n = 0;
+    for(i = 0; i + len <= size; i++) {
+        if(memcmp(buf + i, str, len) == 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long nr_processes = DEFAULT_NR_PROCESSES;
+    measurement_graph *g, *parsed;
+    measurement_graph_filter *f = NULL;
+    unsigned char *serial = NULL;
+    size_t size = 0;
+    size_t nr_nodes = 0;
+    struct timespec start;
+    int ret = EXIT_FAILURE;
+
+    if(argc > 1) {
+        char *end;
+        nr_processes = strtoul(argv[1], &end, 10);
+        if(*end != '\0' || nr_processes == 0 ||
+                nr_processes > UINT32_MAX / (MAPPINGS_PER_PROCESS + 1)) {
+            fprintf(stderr, "usage: %s [nr_processes]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    libmaat_init(0, 0);
+    register_target_type(&dummy_target_type);
+    register_measurement_type(&dummy_measurement_type);
+    register_address_space(&simple_address_space);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((g = build_graph(nr_processes, &nr_nodes)) == NULL) {
+        fprintf(stderr, "Failed to build graph of %lu processes\n", nr_processes);
+        return EXIT_FAILURE;
+    }
+    printf("build:     %zu nodes in %.3fs (max rss %ld KiB)\n",
+           nr_nodes, elapsed(&start), max_rss_kb());
+    print_stats("store", g);
+
+    /* data references are written from version 1 on */
+    if((f = new_measurement_graph_filter()) == NULL ||
+            measurement_graph_filter_add_rule(f, "version=1") != 0) {
+        fprintf(stderr, "Failed to build export filter\n");
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(serialize_measurement_graph_filtered(g, f, &size, &serial, NULL) != 0) {
+        fprintf(stderr, "serialize_measurement_graph_filtered failed\n");
+        goto out;
+    }
+    printf("serialize: %zu bytes, %zu data, %zu references in %.3fs (max rss %ld KiB)\n",
+           size, count_occurrences(serial, size, "meas_data="),
+           count_occurrences(serial, size, GRAPH_DATA_REF_ATTR"="),
+           elapsed(&start), max_rss_kb());
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((parsed = parse_measurement_graph((char*)serial, size)) == NULL) {
+        fprintf(stderr, "parse_measurement_graph failed\n");
+        goto out;
+    }
+    printf("parse:     %.3fs (max rss %ld KiB)\n",
+           elapsed(&start), max_rss_kb());
+    print_stats("parsed", parsed);
+    destroy_measurement_graph(parsed);
+    ret = EXIT_SUCCESS;
+
+out:
+    free(serial);
+    free_measurement_graph_filter(f);
+    destroy_measurement_graph(g);
+    return ret;
+}
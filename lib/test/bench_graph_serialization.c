@@ -0,0 +1,191 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_graph_serialization.c: times serialize_measurement_graph() and
+ * parse_measurement_graph() on a large graph. Not run by 'make check';
+ * build it with 'make bench_graph_serialization'.
+ *
+ * usage: bench_graph_serialization [nr_nodes]   (default 1000000)
+ *
+ * The graph is a chain of nodes, each carrying one dummy measurement
+ * and linked to its predecessor by a labeled edge.
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <graph/graph-core.h>
+#include <measurement_spec/find_types.h>
+#include <util/util.h>
+
+#include "dummy_types.h"
+
+#define DEFAULT_NR_NODES 1000000UL
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static long max_rss_kb(void)
+{
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+    return ru.ru_maxrss;
+}
+
+static size_t count_nodes(measurement_graph *g)
+{
+    node_iterator *it;
+    size_t n = 0;
+    for(it = measurement_graph_iterate_nodes(g); it != NULL; it = node_iterator_next(it)) {
+        n++;
+    }
+    return n;
+}
+
+static size_t count_edges(measurement_graph *g)
+{
+    edge_iterator *it;
+    size_t n = 0;
+    for(it = measurement_graph_iterate_edges(g); it != NULL; it = edge_iterator_next(it)) {
+        n++;
+    }
+    return n;
+}
+
+static measurement_graph *build_graph(unsigned long nr_nodes)
+{
+    measurement_graph *g;
+    measurement_variable v;
+    node_id_t prev = INVALID_NODE_ID;
+    unsigned long i;
+
+    if((g = create_measurement_graph(NULL)) == NULL) {
+        return NULL;
+    }
+
+    v.type = &dummy_target_type;
+    if((v.address = alloc_simple_address()) == NULL) {
+        destroy_measurement_graph(g);
+        return NULL;
+    }
+
+    for(i = 0; i < nr_nodes; i++) {
+        node_id_t n;
+        edge_id_t e;
+        measurement_data *d;
+
+        ((simple_address*)v.address)->addr = (uint32_t)i;
+        if(measurement_graph_add_node(g, &v, NULL, &n) < 0) {
+            goto error;
+        }
+
+        if((d = alloc_measurement_data(&dummy_measurement_type)) == NULL) {
+            goto error;
+        }
+        container_of(d, dummy_measurement_data, d)->x = (uint32_t)i;
+        if(measurement_node_add_rawdata(g, n, d) != 0) {
+            free_measurement_data(d);
+            goto error;
+        }
+        free_measurement_data(d);
+
+        if(prev != INVALID_NODE_ID &&
+                measurement_graph_add_edge(g, prev, "next", n, &e) < 0) {
+            goto error;
+        }
+        prev = n;
+    }
+
+    free_address(v.address);
+    return g;
+
+error:
+    free_address(v.address);
+    destroy_measurement_graph(g);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long nr_nodes = DEFAULT_NR_NODES;
+    measurement_graph *g, *parsed;
+    unsigned char *serial = NULL;
+    size_t size = 0;
+    struct timespec start;
+    int ret = EXIT_FAILURE;
+
+    if(argc > 1) {
+        char *end;
+        nr_nodes = strtoul(argv[1], &end, 10);
+        if(*end != '\0' || nr_nodes == 0 || nr_nodes > UINT32_MAX) {
+            fprintf(stderr, "usage: %s [nr_nodes]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    libmaat_init(0, 0);
+    register_target_type(&dummy_target_type);
+    register_measurement_type(&dummy_measurement_type);
+    register_address_space(&simple_address_space);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((g = build_graph(nr_nodes)) == NULL) {
+        fprintf(stderr, "Failed to build graph of %lu nodes\n", nr_nodes);
+        return EXIT_FAILURE;
+    }
+    printf("build:     %lu nodes in %.3fs (max rss %ld KiB)\n",
+           nr_nodes, elapsed(&start), max_rss_kb());
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(serialize_measurement_graph(g, &size, &serial) != 0) {
+        fprintf(stderr, "serialize_measurement_graph failed\n");
+        goto out;
+    }
+    printf("serialize: %zu bytes in %.3fs (max rss %ld KiB)\n",
+           size, elapsed(&start), max_rss_kb());
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((parsed = parse_measurement_graph((char*)serial, size)) == NULL) {
+        fprintf(stderr, "parse_measurement_graph failed\n");
+        goto out;
+    }
+    printf("parse:     %.3fs (max rss %ld KiB)\n",
+           elapsed(&start), max_rss_kb());
+
+    if(count_nodes(parsed) != nr_nodes || count_edges(parsed) != nr_nodes - 1) {
+        fprintf(stderr, "Parsed graph does not match the serialized graph\n");
+    } else {
+        ret = EXIT_SUCCESS;
+    }
+    destroy_measurement_graph(parsed);
+
+out:
+    free(serial);
+    destroy_measurement_graph(g);
+    return ret;
+}
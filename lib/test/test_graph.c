@@ -19,6 +19,7 @@
 #include <graph/graph-core.h>
 #include <measurement_spec/find_types.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <check.h>
 #include <stdio.h>
 #include <util/xml_util.h>
@@ -188,6 +189,24 @@ START_TEST (test_add_edge)
 }
 END_TEST
 
+/* What serialize_measurement_graph() emits for GRAPH_TEST_FILE_0 */
+static const char graph_serialized_0[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<graphml xmlns=\"http://graphdrawing.org/xmlns\" "
+    "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+    "xsi:schemaLocation=\"http://www.graphdrawing.org/xmlns "
+    "http://graphml.graphdrawing.org/xmlns/1.0/graphml.xsd\">\n"
+    "  <graph mgversion=\"0\" id=\"G\" edgedefault=\"undirected\">\n"
+    "    <node id=\"0\" type=\"dummy\" type_magic=\"beefdead\">\n"
+    "      <address space=\"deadbeef\">deadbeef</address>\n"
+    "    </node>\n"
+    "    <node id=\"1\" type=\"dummy\" type_magic=\"beefdead\">\n"
+    "      <address space=\"deadbeef\">feedface</address>\n"
+    "    </node>\n"
+    "    <edge label=\"my_edge\" source=\"0\" target=\"1\"/>\n"
+    "  </graph>\n"
+    "</graphml>\n";
+
 START_TEST (test_serialization_and_parse)
 {
     measurement_graph *g;
@@ -236,13 +255,352 @@ START_TEST (test_serialization_and_parse)
     ret = serialize_measurement_graph(g, &size, &tmp2);
     fail_unless(ret == 0, "serialize_measurement_graph failed");
     fail_if(tmp2 == NULL, "serialized graph is null");
-    /*     fail_unless(memcmp(tmp,tmp2,size)==0, "not same: %d", memcmp(tmp,tmp2,size)); */
+    fail_unless(size == strlen(graph_serialized_0) &&
+                memcmp(tmp2, graph_serialized_0, size) == 0,
+                "Serialized graph differs from expected output:\n%.*s",
+                (int)size, tmp2);
     free(tmp);
+    destroy_measurement_graph(g);
+
+    /* and the serialized form must parse back to the same shape */
+    g = parse_measurement_graph((char*)tmp2, size);
+    fail_unless(g != NULL, "Failed to re-parse serialized graph");
+    fail_if((eit = measurement_graph_iterate_edges(g)) == NULL,
+            "Re-parsed graph has no edges!");
+    destroy_edge_iterator(eit);
     free(tmp2);
     destroy_measurement_graph(g);
 }
 END_TEST
 
+START_TEST (test_graph_index)
+{
+    measurement_graph *g, *ig;
+    measurement_variable v;
+    node_id_t n, m, in;
+    edge_id_t e;
+    measurement_data *d;
+    marshalled_data *md;
+    graph_index *idx = NULL;
+    graph_index_entry *ent;
+    node_iterator *nit;
+    edge_iterator *eit;
+    unsigned char *serial;
+    size_t size;
+    int nr_entries = 0;
+
+    fail_unless(register_target_type(&dummy_target_type) == 0,
+                "Failed to register target type\n");
+    fail_unless(register_measurement_type(&dummy_measurement_type) == 0,
+                "Failed to register measurement type\n");
+    fail_unless(register_address_space(&simple_address_space) == 0,
+                "Failed to register address space\n");
+
+    fail_unless((g = create_measurement_graph(NULL)) != NULL,
+                "Failed to allocate measurement graph");
+    v.type = &dummy_target_type;
+    fail_unless((v.address = alloc_simple_address()) != NULL,
+                "Failed to allocate simple address");
+    ((simple_address*)v.address)->addr = 0xdeadbeef;
+    fail_unless(measurement_graph_add_node(g, &v, NULL, &n) >= 0,
+                "Failed to add node");
+    ((simple_address*)v.address)->addr = 0xfeedface;
+    fail_unless(measurement_graph_add_node(g, &v, NULL, &m) >= 0,
+                "Failed to add node");
+    free_address(v.address);
+    fail_unless(measurement_graph_add_edge(g, n, "my_edge", m, &e) == 0,
+                "Failed to add edge");
+
+    fail_unless((d = alloc_measurement_data(&dummy_measurement_type)) != NULL,
+                "Failed to alloc dummy data\n");
+    container_of(d, dummy_measurement_data, d)->x = 0xfeedface;
+    fail_unless(measurement_node_add_rawdata(g, m, d) == 0,
+                "Failed to add data to node");
+    free_measurement_data(d);
+
+    fail_unless(serialize_measurement_graph_index(g, &size, &serial) == 0,
+                "Failed to serialize graph index");
+    fail_unless(is_measurement_graph_index((char*)serial, size),
+                "Serialized index is not recognized as an index");
+    fail_unless(parse_measurement_graph((char*)serial, size) == NULL,
+                "Graph index parsed as a graph");
+
+    ig = parse_measurement_graph_index((char*)serial, size, &idx);
+    free(serial);
+    fail_unless(ig != NULL && idx != NULL, "Failed to parse graph index");
+
+    /* same shape, no data, and the data of m is described in the index */
+    for(nit = measurement_graph_iterate_nodes(ig); nit != NULL;
+            nit = node_iterator_next(nit)) {
+        in = node_iterator_get(nit);
+        fail_unless(measurement_node_has_data(ig, in, &dummy_measurement_type) == 0,
+                    "Index graph node has data");
+        if(graph_index_entries(idx, in) != NULL) {
+            nr_entries++;
+            ent = graph_index_find(idx, in, dummy_measurement_type.magic);
+            fail_unless(ent != NULL && ent->source_node == m,
+                        "Index entry does not refer to the node holding the data");
+        }
+    }
+    fail_unless(nr_entries == 1, "Index describes %d nodes with data", nr_entries);
+    fail_if((eit = measurement_graph_iterate_edges(ig)) == NULL,
+            "Index graph has no edges");
+    destroy_edge_iterator(eit);
+
+    /* the datum as held by g checks out against the index, a changed one does not */
+    fail_unless(measurement_node_get_data(g, m, &dummy_measurement_type, &md) == 0,
+                "Failed to get marshalled data");
+    fail_unless(graph_index_check(ent, md->marshalled_data, md->marshalled_data_length) == 1,
+                "Datum does not match its index entry");
+    md->marshalled_data[0] ^= 1;
+    fail_unless(graph_index_check(ent, md->marshalled_data, md->marshalled_data_length) == 0,
+                "Changed datum matches its index entry");
+    free_measurement_data(&md->meas_data);
+
+    free_graph_index(idx);
+    destroy_measurement_graph(ig);
+    destroy_measurement_graph(g);
+}
+END_TEST
+
+START_TEST (test_data_dedup)
+{
+    measurement_graph *g, *pg;
+    measurement_graph_data_stats stats;
+    measurement_variable v;
+    measurement_data *d;
+    node_id_t nodes[4];
+    node_iterator *nit;
+    measurement_graph_filter *f;
+    unsigned char *serial;
+    char *s, *bad;
+    size_t size;
+    int i, nr_copies = 0, nr_refs = 0;
+
+    fail_unless(register_target_type(&dummy_target_type) == 0,
+                "Failed to register target type\n");
+    fail_unless(register_measurement_type(&dummy_measurement_type) == 0,
+                "Failed to register measurement type\n");
+    fail_unless(register_address_space(&simple_address_space) == 0,
+                "Failed to register address space\n");
+
+    fail_unless((g = create_measurement_graph(NULL)) != NULL,
+                "Failed to allocate measurement graph");
+    v.type = &dummy_target_type;
+    fail_unless((v.address = alloc_simple_address()) != NULL,
+                "Failed to allocate simple address");
+    fail_unless((d = alloc_measurement_data(&dummy_measurement_type)) != NULL,
+                "Failed to alloc dummy data\n");
+
+    /* three nodes carry the same datum, the last one a different one */
+    for(i = 0; i < 4; i++) {
+        ((simple_address*)v.address)->addr = (uint32_t)i;
+        fail_unless(measurement_graph_add_node(g, &v, NULL, &nodes[i]) >= 0,
+                    "Failed to add node");
+        container_of(d, dummy_measurement_data, d)->x = i < 3 ? 0xfeedface : 0xdeadbeef;
+        fail_unless(measurement_node_add_rawdata(g, nodes[i], d) == 0,
+                    "Failed to add data to node");
+    }
+    free_measurement_data(d);
+    free_address(v.address);
+
+    fail_unless(measurement_graph_get_data_stats(g, &stats) == 0,
+                "Failed to get data store statistics");
+    fail_unless(stats.nr_refs == 4 && stats.nr_blobs == 2 &&
+                stats.data_bytes > stats.stored_bytes,
+                "Unexpected data store statistics: %zu refs, %zu blobs",
+                stats.nr_refs, stats.nr_blobs);
+
+    /* replacing a shared datum must not change it for the other nodes */
+    fail_unless((d = alloc_measurement_data(&dummy_measurement_type)) != NULL,
+                "Failed to alloc dummy data\n");
+    container_of(d, dummy_measurement_data, d)->x = 0xdeadbeef;
+    fail_unless(measurement_node_add_rawdata(g, nodes[2], d) == 0,
+                "Failed to replace data of node");
+    free_measurement_data(d);
+    fail_unless(measurement_node_get_rawdata(g, nodes[0], &dummy_measurement_type, &d) == 0,
+                "Failed to get data of node");
+    fail_unless(container_of(d, dummy_measurement_data, d)->x == 0xfeedface,
+                "Replacing shared data changed it for another node");
+    free_measurement_data(d);
+
+    /* a version 0 document carries every datum itself */
+    fail_unless(serialize_measurement_graph(g, &size, &serial) == 0,
+                "Failed to serialize graph");
+    for(s = (char*)serial; (s = strstr(s, "meas_data=")) != NULL; s++) {
+        nr_copies++;
+    }
+    fail_unless(nr_copies == 4 && strstr((char*)serial, GRAPH_DATA_REF_ATTR"=") == NULL,
+                "Serialized %d copies of data and references in version 0", nr_copies);
+    free(serial);
+
+    /* from version 1 on, each distinct datum is serialized once, the
+       others refer to it */
+    fail_unless((f = new_measurement_graph_filter()) != NULL,
+                "Failed to allocate export filter");
+    fail_unless(measurement_graph_filter_add_rule(f, "version=2") == -EINVAL &&
+                measurement_graph_filter_add_rule(f, "version=1") == 0,
+                "Export filter does not check the version");
+    fail_unless(serialize_measurement_graph_filtered(g, f, &size, &serial, NULL) == 0,
+                "Failed to serialize graph");
+    free_measurement_graph_filter(f);
+    nr_copies = 0;
+    for(s = (char*)serial; (s = strstr(s, "meas_data=")) != NULL; s++) {
+        nr_copies++;
+    }
+    for(s = (char*)serial; (s = strstr(s, GRAPH_DATA_REF_ATTR"=")) != NULL; s++) {
+        nr_refs++;
+    }
+    fail_unless(nr_copies == 2 && nr_refs == 2,
+                "Serialized %d copies and %d references of data", nr_copies, nr_refs);
+
+    /* a reference to an unknown node, or in a version 0 document,
+       fails the parse */
+    bad = strdup((char*)serial);
+    s = strstr(bad, GRAPH_DATA_REF_ATTR"=\"");
+    s[strlen(GRAPH_DATA_REF_ATTR"=\"")] = '9';
+    fail_unless(parse_measurement_graph(bad, strlen(bad)) == NULL,
+                "Parsed a reference to an unknown node");
+    free(bad);
+    bad = strdup((char*)serial);
+    s = strstr(bad, "mgversion=\"1\"");
+    s[strlen("mgversion=\"")] = '0';
+    fail_unless(parse_measurement_graph(bad, strlen(bad)) == NULL,
+                "Parsed a reference in a version 0 graph");
+    free(bad);
+
+    fail_unless((pg = parse_measurement_graph((char*)serial, size)) != NULL,
+                "Failed to parse serialized graph");
+    free(serial);
+    i = 0;
+    for(nit = measurement_graph_iterate_nodes(pg); nit != NULL;
+            nit = node_iterator_next(nit)) {
+        dummy_measurement_data *dmd;
+        fail_unless(measurement_node_get_rawdata(pg, node_iterator_get(nit),
+                    &dummy_measurement_type, &d) == 0,
+                    "Parsed node has no data");
+        dmd = container_of(d, dummy_measurement_data, d);
+        if(dmd->x == 0xfeedface) {
+            i++;
+        }
+        free_measurement_data(d);
+    }
+    fail_unless(i == 2, "Parsed graph has %d nodes with the shared datum", i);
+
+    fail_unless(measurement_graph_get_data_stats(pg, &stats) == 0 &&
+                stats.nr_refs == 4 && stats.nr_blobs == 2,
+                "Parsed graph does not share its data");
+
+    destroy_measurement_graph(pg);
+    destroy_measurement_graph(g);
+}
+END_TEST
+
+START_TEST (test_filtered_export)
+{
+    measurement_graph *g, *pg;
+    measurement_graph_filter *f;
+    measurement_graph_export_stats stats;
+    measurement_variable v;
+    measurement_data *d;
+    node_id_t nodes[4];
+    edge_id_t e;
+    node_id_str nstr;
+    unsigned char *serial;
+    char *rule;
+    size_t size;
+    int i;
+
+    fail_unless(register_target_type(&dummy_target_type) == 0,
+                "Failed to register target type\n");
+    fail_unless(register_measurement_type(&dummy_measurement_type) == 0,
+                "Failed to register measurement type\n");
+    fail_unless(register_address_space(&simple_address_space) == 0,
+                "Failed to register address space\n");
+
+    /* 0 -a-> 1 -b-> 2, and 3 on its own */
+    fail_unless((g = create_measurement_graph(NULL)) != NULL,
+                "Failed to allocate measurement graph");
+    v.type = &dummy_target_type;
+    fail_unless((v.address = alloc_simple_address()) != NULL,
+                "Failed to allocate simple address");
+    fail_unless((d = alloc_measurement_data(&dummy_measurement_type)) != NULL,
+                "Failed to alloc dummy data\n");
+    for(i = 0; i < 4; i++) {
+        ((simple_address*)v.address)->addr = (uint32_t)i;
+        fail_unless(measurement_graph_add_node(g, &v, NULL, &nodes[i]) >= 0,
+                    "Failed to add node");
+        container_of(d, dummy_measurement_data, d)->x = (uint32_t)i;
+        fail_unless(measurement_node_add_rawdata(g, nodes[i], d) == 0,
+                    "Failed to add data to node");
+    }
+    free_measurement_data(d);
+    free_address(v.address);
+    fail_unless(measurement_graph_add_edge(g, nodes[0], "a", nodes[1], &e) >= 0 &&
+                measurement_graph_add_edge(g, nodes[1], "b", nodes[2], &e) >= 0,
+                "Failed to add edges");
+
+    /* reachable from 0 without crossing a "b" edge */
+    fail_unless((f = new_measurement_graph_filter()) != NULL,
+                "Failed to allocate filter");
+    str_of_node_id(nodes[0], nstr);
+    rule = g_strdup_printf("root=%s", nstr);
+    fail_unless(measurement_graph_filter_add_rule(f, rule) == 0 &&
+                measurement_graph_filter_add_rule(f, "drop-label=b") == 0,
+                "Failed to add filter rules");
+    g_free(rule);
+    fail_unless(serialize_measurement_graph_filtered(g, f, &size, &serial, &stats) == 0,
+                "Failed to serialize filtered graph");
+    fail_unless(stats.nr_nodes == 4 && stats.nodes_written == 2 &&
+                stats.nr_edges == 2 && stats.edges_written == 1 &&
+                stats.nr_data == 4 && stats.data_written == 2 &&
+                stats.data_bytes_written < stats.data_bytes,
+                "Unexpected export statistics: %zu/%zu nodes, %zu/%zu edges",
+                stats.nodes_written, stats.nr_nodes,
+                stats.edges_written, stats.nr_edges);
+    fail_unless((pg = parse_measurement_graph((char*)serial, size)) != NULL,
+                "Failed to parse filtered graph");
+    free(serial);
+    destroy_measurement_graph(pg);
+    free_measurement_graph_filter(f);
+
+    /* projecting the data type away keeps the nodes but not their data */
+    fail_unless((f = new_measurement_graph_filter()) != NULL,
+                "Failed to allocate filter");
+    rule = g_strdup_printf("project=%s", dummy_measurement_type.name);
+    fail_unless(measurement_graph_filter_add_rule(f, rule) == 0,
+                "Failed to add projection");
+    g_free(rule);
+    fail_unless(serialize_measurement_graph_filtered(g, f, &size, &serial, &stats) == 0,
+                "Failed to serialize projected graph");
+    fail_unless(stats.nodes_written == 4 && stats.edges_written == 2 &&
+                stats.data_written == 0 && strstr((char*)serial, "meas_data=") == NULL,
+                "Projected graph still has data");
+    free(serial);
+    free_measurement_graph_filter(f);
+
+    /* dropping the only target type leaves nothing */
+    fail_unless((f = new_measurement_graph_filter()) != NULL,
+                "Failed to allocate filter");
+    rule = g_strdup_printf("drop-target=%s", dummy_target_type.name);
+    fail_unless(measurement_graph_filter_add_rule(f, rule) == 0,
+                "Failed to add target type rule");
+    g_free(rule);
+    fail_unless(measurement_graph_filter_add_rule(f, "keep-target") == -EINVAL &&
+                measurement_graph_filter_add_rule(f, "keep-colour=red") == -EINVAL &&
+                measurement_graph_filter_add_rule(f, "keep-measurement=no-such-type") == -ENOENT,
+                "Accepted an invalid filter rule");
+    fail_unless(serialize_measurement_graph_filtered(g, f, &size, &serial, &stats) == 0,
+                "Failed to serialize empty graph");
+    fail_unless(stats.nodes_written == 0 && stats.edges_written == 0,
+                "Dropped nodes were written");
+    free(serial);
+    free_measurement_graph_filter(f);
+
+    destroy_measurement_graph(g);
+}
+END_TEST
+
 START_TEST (test_has_data)
 {
     measurement_graph *g;
@@ -287,6 +645,84 @@ START_TEST (test_has_data)
 }
 END_TEST
 
+START_TEST (test_truncate)
+{
+    measurement_graph *g;
+    measurement_graph_marks marks, after;
+    unsigned char digest[MEASUREMENT_GRAPH_DIGEST_LEN];
+    unsigned char rolled_back[MEASUREMENT_GRAPH_DIGEST_LEN];
+    measurement_variable v;
+    measurement_data *d;
+    node_id_t n, m, k;
+    edge_id_t e;
+
+    v.type = &dummy_target_type;
+    fail_unless((g = create_measurement_graph(NULL)) != NULL,
+                "Failed to create a graph");
+    fail_unless((v.address = alloc_simple_address()) != NULL,
+                "Failed to allocate an address");
+
+    ((simple_address *)v.address)->addr = 0xdeadbeef;
+    fail_unless(measurement_graph_add_node(g, &v, NULL, &n) == 1,
+                "Failed to add measurement node");
+    fail_unless(measurement_graph_get_marks(g, &marks) == 0,
+                "Failed to get graph marks");
+    fail_unless(marks.next_node == n + 1 && marks.next_edge == 0,
+                "Wrong marks "ID_FMT" "ID_FMT, marks.next_node, marks.next_edge);
+    fail_unless(measurement_graph_digest(g, &marks, digest) == 0,
+                "Failed to digest graph");
+
+    /* data for the old node, a node and an edge to it from the old
+       node, added after the marks */
+    fail_unless((d = alloc_measurement_data(&dummy_measurement_type)) != NULL,
+                "Failed to alloc dummy data");
+    container_of(d, dummy_measurement_data, d)->x = 0xfeedface;
+    fail_unless(measurement_node_add_rawdata(g, n, d) == 0,
+                "Failed to add data to node");
+    ((simple_address *)v.address)->addr = 0xfeedface;
+    fail_unless(measurement_graph_add_node(g, &v, NULL, &m) == 1,
+                "Failed to add measurement node");
+    fail_unless(measurement_graph_add_edge(g, n, "my_edge", m, &e) == 0,
+                "Failed to add edge");
+
+    fail_unless(measurement_graph_truncate(g, &marks) == 0,
+                "Failed to truncate graph");
+    fail_unless(measurement_graph_get_node(g, &v) == INVALID_NODE_ID,
+                "Node added after the marks survived truncation");
+    fail_unless(measurement_node_iterate_outbound_edges(g, n) == NULL,
+                "Edge added after the marks survived truncation");
+    fail_unless(measurement_node_has_data(g, n, &dummy_measurement_type) == 0,
+                "Data added after the marks survived truncation");
+    fail_unless(measurement_graph_digest(g, &marks, rolled_back) == 0 &&
+                memcmp(digest, rolled_back, sizeof(digest)) == 0,
+                "Truncated graph differs from the graph at the marks");
+
+    /* data the graph had at the marks is part of its digest */
+    fail_unless(measurement_node_add_rawdata(g, n, d) == 0,
+                "Failed to add data to node");
+    fail_unless(measurement_graph_digest(g, &marks, rolled_back) == 0 &&
+                memcmp(digest, rolled_back, sizeof(digest)) != 0,
+                "Digest does not cover node data");
+    free_measurement_data(d);
+    fail_unless(measurement_graph_get_marks(g, &after) == 0 &&
+                after.next_node == marks.next_node &&
+                after.next_edge == marks.next_edge,
+                "Truncation did not reset the marks");
+
+    /* ids are handed out again from the marks */
+    fail_unless(measurement_graph_add_node(g, &v, NULL, &k) == 1 && k == m,
+                "Node added after truncation got id "ID_FMT, k);
+
+    /* marks the graph has not reached are refused */
+    marks.next_node = k + 10;
+    fail_unless(measurement_graph_truncate(g, &marks) == -EINVAL,
+                "Truncated to marks ahead of the graph");
+
+    free_address(v.address);
+    destroy_measurement_graph(g);
+}
+END_TEST
+
 START_TEST (test_get_nonexistent)
 {
     measurement_graph *g;
@@ -332,7 +768,11 @@ Suite * graph_suite (void)
     tcase_add_test (tc_feature, test_iteration);
     tcase_add_test (tc_feature, test_add_edge);
     tcase_add_test (tc_feature, test_serialization_and_parse);
+    tcase_add_test (tc_feature, test_graph_index);
+    tcase_add_test (tc_feature, test_data_dedup);
+    tcase_add_test (tc_feature, test_filtered_export);
     tcase_add_test (tc_feature, test_has_data);
+    tcase_add_test (tc_feature, test_truncate);
 
     suite_add_tcase (s, tc_feature);
 
@@ -48,6 +48,7 @@
 #include <util/compress.h>
 #include <util/crypto.h>
 #include <util/sign.h>
+#include <util/signfile.h>
 #include <util/validate.h>
 #include <util/maat-io.h>
 
@@ -579,6 +580,96 @@ START_TEST(test_sign_openssl_big)
 }
 END_TEST
 
+static xmlNode *nth_subcontract(xmlDoc *doc, int n)
+{
+    xmlNode *node;
+
+    for(node = xmlDocGetRootElement(doc)->children; node; node = node->next) {
+        if(node->type == XML_ELEMENT_NODE &&
+                strcmp((char *)node->name, "subcontract") == 0 && n-- == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+START_TEST(test_verify_xml_in_place)
+{
+    const char *contract =
+        "<contract type=\"measurement\"><nonce>abcd</nonce>\n"
+        "  <subcontract><option><value name=\"k\">v &amp; w</value>"
+        "<measurement>QUJD</measurement></option></subcontract>\n"
+        "  <subcontract><option/></subcontract>\n"
+        "</contract>";
+    xmlDoc *doc;
+    xmlChar *before, *after;
+    int before_size, after_size;
+    X509 *cert, *cacert;
+    int i;
+
+    doc = xmlReadMemory(contract, (int)strlen(contract), NULL, NULL, 0);
+    fail_if(doc == NULL, "failed to parse contract");
+    for(i = 0; i < 2; i++) {
+        fail_if(sign_xml(doc, nth_subcontract(doc, i), "00:11", keyfile, NULL,
+                         NULL, NULL, NULL, SIGNATURE_OPENSSL) != 0,
+                "signing subcontract %d failed", i);
+    }
+
+    cert   = load_cert(certfile);
+    cacert = load_cert(cacertfile);
+    fail_if(cert == NULL || cacert == NULL, "failed to load certificates");
+
+    xmlDocDumpMemory(doc, &before, &before_size);
+    for(i = 0; i < 2; i++) {
+        fail_if(verify_xml_x509(doc, nth_subcontract(doc, i), cert, cacert,
+                                "abcd", NULL, SIGNATURE_OPENSSL) != 1,
+                "verification of subcontract %d failed", i);
+    }
+    fail_if(verify_xml_x509(doc, nth_subcontract(doc, 0), cert, cacert,
+                            "abce", NULL, SIGNATURE_OPENSSL) == 1,
+            "verification with the wrong nonce succeeded");
+    fail_if(verify_xml_x509(doc, nth_subcontract(doc, 0), cert, cert,
+                            "abcd", NULL, SIGNATURE_OPENSSL) == 1,
+            "verification with the wrong CA succeeded");
+
+    /* verification must leave the document untouched */
+    xmlDocDumpMemory(doc, &after, &after_size);
+    fail_if(before_size != after_size || memcmp(before, after, (size_t)after_size) != 0,
+            "verification modified the document");
+
+    xmlSetProp(nth_subcontract(doc, 1), (xmlChar *)"tampered", (xmlChar *)"yes");
+    fail_if(verify_xml_x509(doc, nth_subcontract(doc, 1), cert, cacert,
+                            "abcd", NULL, SIGNATURE_OPENSSL) == 1,
+            "verification of a modified subcontract succeeded");
+
+    xmlFree(before);
+    xmlFree(after);
+    X509_free(cert);
+    X509_free(cacert);
+    xmlFreeDoc(doc);
+}
+END_TEST
+
+START_TEST(test_verified_chain_cache)
+{
+    X509 *cert   = load_cert(certfile);
+    X509 *cacert = load_cert(cacertfile);
+
+    fail_if(cert == NULL || cacert == NULL, "failed to load certificates");
+
+    flush_verified_chain_cache();
+    fail_if(verify_cert_cached(cert, cacert) != 1, "chain verification failed");
+    fail_if(verify_cert_cached(cert, cacert) != 1, "cached chain verification failed");
+    /* a failed chain is never cached */
+    fail_if(verify_cert_cached(cert, cert) == 1, "self issued chain verified");
+    fail_if(verify_cert_cached(cert, cert) == 1, "self issued chain verified twice");
+    flush_verified_chain_cache();
+
+    X509_free(cert);
+    X509_free(cacert);
+}
+END_TEST
+
 #ifdef USE_TPM
 
 START_TEST(test_sign_tpm_small)
@@ -794,6 +885,8 @@ int main(void)
     tcase_set_timeout(sign, 60);
     tcase_add_test(sign, test_sign_openssl_small);
     tcase_add_test(sign, test_sign_openssl_big);
+    tcase_add_test(sign, test_verify_xml_in_place);
+    tcase_add_test(sign, test_verified_chain_cache);
 
     utils = tcase_create("util");
     tcase_add_unchecked_fixture(utils, unchecked_setup,
@@ -37,9 +37,11 @@
 #include <openssl/engine.h>
 #include <openssl/x509_vfy.h>
 #include <openssl/x509.h>
+#include <openssl/sha.h>
 
 #include <util/util.h>
 #include <util/base64.h>
+#include <util/sign.h>
 
 /*
  * Given an arbitrary buffer and a key file, sign it with openssl using
@@ -127,6 +129,25 @@ X509 *load_cert(const char* filename)
     return cert;
 }
 
+X509 *load_cert_mem(const char *pem, size_t size)
+{
+    X509 *cert = NULL;
+    BIO *bio;
+
+    if(size > INT_MAX) {
+        return NULL;
+    }
+    if((bio = BIO_new_mem_buf(pem, (int)size)) == NULL) {
+        return NULL;
+    }
+    if ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) == NULL) {
+        ERR_print_errors_fp(stderr);
+    }
+    BIO_free(bio);
+
+    return cert;
+}
+
 int verify_cert(X509* cert, X509* cacert)
 {
     int rc = 0;
@@ -221,6 +242,102 @@ out:
     return rc;
 }
 
+/*
+ * Chains that verified recently, keyed by the SHA-256 of the
+ * fingerprints of the certificate and the CA certificate. The cache
+ * is a small ring; the oldest entry is replaced when it is full.
+ */
+static unsigned char verified_chains[VERIFIED_CHAIN_CACHE_SIZE][SHA256_DIGEST_LENGTH];
+static unsigned int nr_verified_chains;
+static unsigned int next_verified_chain;
+static GMutex verified_chains_lock;
+
+static int chain_cache_key(X509 *cert, X509 *cacert,
+                           unsigned char key[SHA256_DIGEST_LENGTH])
+{
+    unsigned char fprs[2 * EVP_MAX_MD_SIZE];
+    unsigned int len1, len2;
+
+    if(X509_digest(cert, EVP_sha256(), fprs, &len1) != 1 ||
+            X509_digest(cacert, EVP_sha256(), fprs + len1, &len2) != 1) {
+        return -1;
+    }
+    SHA256(fprs, len1 + len2, key);
+    return 0;
+}
+
+/*
+ * A cached chain still has to be within its validity period, which
+ * is the only part of the verification that depends on the time.
+ */
+static int cert_is_current(X509 *cert)
+{
+    return X509_cmp_current_time(X509_get0_notBefore(cert)) < 0 &&
+           X509_cmp_current_time(X509_get0_notAfter(cert)) > 0;
+}
+
+int verify_cert_cached(X509 *cert, X509 *cacert)
+{
+    unsigned char key[SHA256_DIGEST_LENGTH];
+    unsigned int i;
+    int found = 0;
+    int rc;
+
+    if(chain_cache_key(cert, cacert, key) != 0) {
+        return verify_cert(cert, cacert);
+    }
+
+    g_mutex_lock(&verified_chains_lock);
+    for(i = 0; i < nr_verified_chains && !found; i++) {
+        found = memcmp(verified_chains[i], key, sizeof(key)) == 0;
+    }
+    g_mutex_unlock(&verified_chains_lock);
+
+    if(found && cert_is_current(cert) && cert_is_current(cacert)) {
+        dlog(6, "Certificate chain found in the verified chain cache\n");
+        return 1;
+    }
+
+    if((rc = verify_cert(cert, cacert)) != 1 || found) {
+        return rc;
+    }
+
+    g_mutex_lock(&verified_chains_lock);
+    memcpy(verified_chains[next_verified_chain], key, sizeof(key));
+    next_verified_chain = (next_verified_chain + 1) % VERIFIED_CHAIN_CACHE_SIZE;
+    if(nr_verified_chains < VERIFIED_CHAIN_CACHE_SIZE) {
+        nr_verified_chains++;
+    }
+    g_mutex_unlock(&verified_chains_lock);
+
+    return rc;
+}
+
+void flush_verified_chain_cache(void)
+{
+    g_mutex_lock(&verified_chains_lock);
+    nr_verified_chains  = 0;
+    next_verified_chain = 0;
+    g_mutex_unlock(&verified_chains_lock);
+}
+
+int verify_buffer_x509(const unsigned char *buf, size_t size,
+                       const unsigned char *sig, size_t sigsize,
+                       X509 *cert, X509 *cacert)
+{
+    int rc;
+
+    if ((rc = verify_cert_cached(cert, cacert)) != 1) {
+        fprintf(stderr, "Certificate failed verification!\n");
+        return rc;
+    }
+
+    if ((rc = verify_sig(buf, size, sig, sigsize, cert)) != 1) {
+        fprintf(stderr, "Signature verification failed!\n");
+    }
+    return rc;
+}
+
 int verify_buffer_openssl(const unsigned char *buf, size_t size, const unsigned char *sig,
                           size_t sigsize, const char *certfile, const char *cacertfile)
 {
@@ -237,16 +354,7 @@ int verify_buffer_openssl(const unsigned char *buf, size_t size, const unsigned
         rc = -1;
         goto out;
     }
-    if ((rc = verify_cert(cert, cacert)) != 1) {
-        fprintf(stderr, "Certificate %s failed verification!\n",
-                certfile);
-        goto out;
-    }
-
-    if ((rc = verify_sig(buf, size, sig, sigsize, cert)) != 1) {
-        fprintf(stderr, "Signature verification failed!\n");
-        goto out;
-    }
+    rc = verify_buffer_x509(buf, size, sig, sigsize, cert, cacert);
 
 out:
     X509_free(cacert);
@@ -29,7 +29,29 @@
 #define __UTIL__SIGN_H__
 
 X509 *load_cert(const char* filename);
+/**
+ * Parse the PEM encoded certificate in the @size bytes at @pem.
+ */
+X509 *load_cert_mem(const char *pem, size_t size);
 int verify_cert(X509* cert, X509* cacert);
+
+/**
+ * Number of certificate chains remembered by verify_cert_cached().
+ */
+#define VERIFIED_CHAIN_CACHE_SIZE 64
+
+/**
+ * Like verify_cert(), but chains that verified before are only
+ * checked to still be within their validity period. Chains are
+ * remembered by the fingerprints of @cert and @cacert in a bounded
+ * cache shared by all threads of the process.
+ */
+int verify_cert_cached(X509 *cert, X509 *cacert);
+
+/**
+ * Forget all chains remembered by verify_cert_cached().
+ */
+void flush_verified_chain_cache(void);
 int verify_sig(const unsigned char *buf, size_t size, const unsigned char *sig,
                size_t sigsize, X509 *cert);
 
@@ -37,5 +59,12 @@ unsigned char *sign_buffer_openssl(const unsigned char *buf, unsigned int *size,
                                    const char *keyfile, const char *password);
 int verify_buffer_openssl(const unsigned char *buf, size_t size, const unsigned char *sig,
                           size_t sigsize, const char *certfile, const char *cacertfile);
+/**
+ * Verify the signature @sig over @buf with the already loaded
+ * certificates @cert and @cacert. Returns 1 if the signature is good.
+ */
+int verify_buffer_x509(const unsigned char *buf, size_t size,
+                       const unsigned char *sig, size_t sigsize,
+                       X509 *cert, X509 *cacert);
 
 #endif /* __UTIL__SIGN_H__ */
@@ -20,6 +20,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <glib.h>
 
 #include <libxml/tree.h>
@@ -94,37 +96,35 @@ static xmlNode *signature_node(const char *certid, int flags)
 }
 
 
-char *construct_cert_filename(const char *prefix, xmlNode *root)
+/*
+ * Find the child of @parent named @name (case insensitively).
+ */
+static xmlNode *find_child(xmlNode *parent, const char *name)
+{
+    xmlNode *node;
+
+    for (node = parent->children; node; node = node->next) {
+        char *nodename = validate_cstring_ascii(node->name, SIZE_MAX);
+        if (nodename != NULL && strcasecmp(nodename, name) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+char *signature_key_fingerprint(xmlNode *root)
 {
     xmlNode *sig;
     xmlNode *keyinfo;
     char *fprint;
-    char *certfile;
-    size_t size;
 
     /* find signature element */
-    for (sig = root->children; sig; sig = sig->next) {
-        char *signame = validate_cstring_ascii(sig->name, SIZE_MAX);
-
-        if (signame != NULL && strcasecmp(signame, "signature") == 0) {
-            break;
-        }
-    }
-
-    if (!sig) {
+    if ((sig = find_child(root, "signature")) == NULL) {
         dlog(1, "No xml Signature node.\n");
         return NULL;
     }
 
-    /* Find keyinfo and construct credential filename */
-    for (keyinfo = sig->children; keyinfo; keyinfo = keyinfo->next) {
-        char *keyname = validate_cstring_ascii(keyinfo->name, SIZE_MAX);
-        if (keyname != NULL && strcasecmp(keyname, "keyinfo") == 0) {
-            break;
-        }
-    }
-
-    if (!keyinfo) {
+    if ((keyinfo = find_child(sig, "keyinfo")) == NULL) {
         dlog(1, "No xml KeyInfo node.\n");
         return NULL;
     }
@@ -135,11 +135,24 @@ char *construct_cert_filename(const char *prefix, xmlNode *root)
         dlog(1, "Failed to get contents of keyinfo node (pubkey fingerprint)\n");
         return NULL;
     }
+    return fprint;
+}
+
+char *construct_cert_filename(const char *prefix, xmlNode *root)
+{
+    char *fprint;
+    char *certfile;
+    size_t size;
+
+    if ((fprint = signature_key_fingerprint(root)) == NULL) {
+        return NULL;
+    }
 
     size	= strlen(fprint)+strlen(prefix)+strlen(".pem")+1;
     certfile	= malloc(size);
     if (!certfile) {
         dperror("Error allocating filename buffer\n");
+        free(fprint);
         return NULL;
     }
     memset(certfile, 0, size);
@@ -288,56 +301,131 @@ out:
 }
 
 /*
- * Given an XML doc and root node, verify the signature of the root element
+ * The part of a document covered by a signature: the subtree at
+ * ->root, except for the contents of the ->hidden elements (the
+ * signature and quote values, which were empty when it was signed).
  */
-int verify_xml(xmlDoc *doc, xmlNode *root, const char *prefix,
-               const char* nonce,
+struct signed_subtree {
+    xmlNode *root;
+    xmlNode *hidden[2];
+};
+
+static int signed_subtree_visible(void *user_data, xmlNodePtr node,
+                                  xmlNodePtr parent)
+{
+    struct signed_subtree *st = user_data;
+    xmlNode *n = node;
+    xmlNode *a;
+
+    /* attributes and namespaces belong to their element */
+    if (node->type == XML_ATTRIBUTE_NODE || node->type == XML_NAMESPACE_DECL) {
+        n = parent;
+    }
+
+    for (a = n; a != NULL; a = a->parent) {
+        if (a != n && (a == st->hidden[0] || a == st->hidden[1])) {
+            return 0;
+        }
+        if (a == st->root) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Canonicalize the subtree described by @st directly from @doc. The
+ * result is the same as canonicalizing a copy of the subtree with the
+ * hidden elements emptied, as sign_xml() does, provided the ancestors
+ * of the subtree declare no namespaces or xml: attributes (which
+ * contracts never do).
+ */
+static unsigned char *c14n_signed_subtree(xmlDoc *doc, struct signed_subtree *st,
+        size_t *size)
+{
+    xmlOutputBuffer *out;
+    unsigned char *buf = NULL;
+    const xmlChar *content;
+    size_t len;
+
+    if ((out = xmlAllocOutputBuffer(NULL)) == NULL) {
+        return NULL;
+    }
+
+    if (xmlC14NExecute(doc, signed_subtree_visible, st, XML_C14N_1_0,
+                       NULL, 0, out) < 0 ||
+            (content = xmlOutputBufferGetContent(out)) == NULL) {
+        goto out;
+    }
+
+    len = xmlOutputBufferGetSize(out);
+    if ((buf = malloc(len + 1)) == NULL) {
+        goto out;
+    }
+    memcpy(buf, content, len);
+    buf[len] = '\0';
+    *size = len;
+
+out:
+    xmlOutputBufferClose(out);
+    return buf;
+}
+
+/*
+ * Check the nonce of the contract in @doc against @nonce.
+ */
+static int check_contract_nonce(xmlDoc *doc, const char *nonce)
+{
+    char *contract_nonce = xpath_get_content(doc, "/contract/nonce");
+    int ret = -1;
+
+    if(!contract_nonce) {
+        dlog(0, "Unable to extract nonce in the contract\n");
+        return -1;
+    }
+
+    dlog(7, "Retained Nonce: %s Nonce in Contract: %s\n", nonce, contract_nonce);
+
+    if(strlen(contract_nonce) != strlen(nonce)) {
+        dlog(1, "Nonce lengths do not match\n");
+    } else if(memcmp(nonce, contract_nonce, strlen(nonce)) != 0) {
+        dlog(0, "Nonce in the contract did not match\n");
+    } else {
+        ret = 0;
+    }
+
+    free(contract_nonce);
+    return ret;
+}
+
+int verify_xml_x509(xmlDoc *doc, xmlNode *root, X509 *cert, X509 *cacert,
+                    const char *nonce,
 #ifdef USE_TPM
-	           const char *akpubkey,
+                    const char *akpubkey,
 #else
-	           const char *akpubkey UNUSED,
+                    const char *akpubkey UNUSED,
 #endif
-               int flags, const char *cacertfile)
+                    int flags)
 {
+    struct signed_subtree st = {.root = root, .hidden = {NULL, NULL}};
     xmlNode *sig;
     xmlNode *sigval;
-    xmlDoc *tmpdoc;
-    xmlNode *newroot;
     char *b64sig;
-    unsigned char *signature, *tpmquote, *buf;
-    size_t sigsize, quotesize;
-    int size;
-    int ret = 0;
-    char *certfile = NULL;
+    unsigned char *signature = NULL, *buf = NULL;
+    size_t sigsize, size;
+#ifdef USE_TPM
+    unsigned char *tpmquote = NULL;
+    size_t quotesize = 0;
+#endif
+    int ret = -1;
 
     /* Prevents segfaults in weird situations, but is it really needed? */
     if (!root || !doc)
         return -1;
 
-    tmpdoc = xmlNewDoc((xmlChar*)"1.0");
-    newroot = xmlCopyNode(root, 1);
-    if(!newroot) {
-        fprintf(stderr, "Error xml_verify: Failed to copy root node for signature check.\n");
-        goto out;
-    }
-
-    xmlDocSetRootElement(tmpdoc, newroot);
-
     /* find signature element */
-    for (sig = newroot->children; sig; sig = sig->next) {
-        char *signame = validate_cstring_ascii(sig->name, SIZE_MAX);
-        if (signame != NULL && strcasecmp(signame, "signature") == 0)
-            break;
-    }
-
-    if (!sig) {
+    if ((sig = find_child(root, "signature")) == NULL) {
         fprintf(stderr, "Error xml_verify: No xml Signature node.\n");
-        goto out;
-    }
-
-    certfile = construct_cert_filename(prefix, newroot);
-    if (!certfile) {
-        fprintf(stderr, "Error xml_verify: failed to construct cert file.\n");
         return -1;
     }
 
@@ -345,47 +433,33 @@ int verify_xml(xmlDoc *doc, xmlNode *root, const char *prefix,
 #ifdef USE_TPM
         xmlNode *quoteval;
         char *b64quote;
-        
-        /* Find quote value within that element */
-        for (quoteval = sig->children; quoteval; quoteval=quoteval->next) {
-            char *quotevalname = validate_cstring_ascii(quoteval->name, SIZE_MAX);
-            if (quotevalname != NULL && strcasecmp(quotevalname, "tpmquotevalue") == 0)
-                break;
-        }
 
-        if (!quoteval) {
+        /* Find quote value within that element */
+        if ((quoteval = find_child(sig, "tpmquotevalue")) == NULL) {
             fprintf(stderr, "Error verify_xml: No xml TPM Quote node. Will use OPENSSL.\n");
             flags = SIGNATURE_OPENSSL;
-            goto get_sig;
-        }
-        
-        b64quote = xmlNodeGetContentASCII(quoteval);
-        if (!b64quote) {
-            fprintf(stderr, "Error verify_xml: empty TPM quote value.\n");
-            goto out;
-        }
+        } else {
+            b64quote = xmlNodeGetContentASCII(quoteval);
+            if (!b64quote) {
+                fprintf(stderr, "Error verify_xml: empty TPM quote value.\n");
+                goto out;
+            }
 
-        tpmquote = b64_decode(b64quote, &quotesize);
-        if (!tpmquote) {
-            fprintf(stderr, "Error verify_xml: could not decode quote.\n");
+            tpmquote = b64_decode(b64quote, &quotesize);
             xmlFree(b64quote);
-            goto out;
-        }
-        xmlFree(b64quote);
+            if (!tpmquote) {
+                fprintf(stderr, "Error verify_xml: could not decode quote.\n");
+                goto out;
+            }
 
-        /* remove the quote from the doc */
-        xmlNodeSetContent(quoteval, NULL);
+            /* the quote is left out of the signed data */
+            st.hidden[1] = quoteval;
+        }
 #endif
     }
- get_sig:
-    /* Find signature value within that element */
-    for (sigval = sig->children; sigval; sigval=sigval->next) {
-        char *sigvalname = validate_cstring_ascii(sigval->name, SIZE_MAX);
-        if (sigvalname != NULL && strcasecmp(sigvalname, "signaturevalue") == 0)
-            break;
-    }
 
-    if (!sigval) {
+    /* Find signature value within that element */
+    if ((sigval = find_child(sig, "signaturevalue")) == NULL) {
         fprintf(stderr, "Error verify_xml: No xml Signature node.\n");
         goto out;
     }
@@ -397,93 +471,295 @@ int verify_xml(xmlDoc *doc, xmlNode *root, const char *prefix,
     }
 
     signature = b64_decode(b64sig, &sigsize);
+    xmlFree(b64sig);
     if (!signature) {
         fprintf(stderr, "Error verify_xml: could not decode sig.\n");
-        xmlFree(b64sig);
         goto out;
     }
-    xmlFree(b64sig);
 
-    /* remove the signature from the doc */
-    xmlNodeSetContent(sigval, NULL);
-    size = xmlC14NDocDumpMemory(tmpdoc, NULL, XML_C14N_1_0,
-                                NULL, 0, &buf);
-    if(size < 0 || buf == NULL) {
+    /* the signature is left out of the signed data */
+    st.hidden[0] = sigval;
+    if ((buf = c14n_signed_subtree(doc, &st, &size)) == NULL || size == 0) {
         fprintf(stderr, "Error verify_xml: failed to dump canonicalized document.\n");
         goto out;
     }
-    size = size -1; /* we want strlen not buffer size */
+    /*
+     * sign_xml() takes the length returned by xmlC14NDocDumpMemory()
+     * for a buffer size and so signs all but the final '>'.
+     */
+    size = size - 1;
 
     /* Evaluate nonce if one is provided */
-    char *contract_nonce = NULL;
-    if(nonce) {
-        char *contract_nonce = xpath_get_content(doc, "/contract/nonce");
-        if(!contract_nonce) {
-            dlog(0, "Unable to extract nonce in the contract\n");
-            goto out;
-        }
-
-        size_t nonce_len = strlen(nonce);
-        if(strlen(contract_nonce) != nonce_len) {
-            dlog(1, "Nonce lengths do not match\n");
-            goto non_out;
-        }
-
-        dlog(7, "Retained Nonce: %s Nonce in Contract: %s\n", nonce, contract_nonce);
-
-        if(memcmp((char *)nonce, contract_nonce, nonce_len)) {
-            dlog(0, "Nonce in the contract did not match\n");
-            goto non_out;
-        }
-
-        free(contract_nonce);
-        contract_nonce = NULL;
+    if (nonce && check_contract_nonce(doc, nonce) != 0) {
+        goto out;
     }
 
-    if (flags & SIGNATURE_OPENSSL) {
-        ret = verify_buffer_openssl(buf, (size_t)size, signature, sigsize,
-                                    certfile, cacertfile);
-    } else if (flags & SIGNATURE_TPM)  {
 #ifdef USE_TPM
+    if (flags & SIGNATURE_TPM) {
         dlog(6, "Using TPM to verify.\n");
-        int res = checkquote(buf, size, signature, sigsize, nonce, akpubkey, tpmquote, quotesize);
-        if (res == 0) {
-            ret = 1;
-        } else {
-            ret = -1;
+        if(size > INT_MAX) {
+            goto out;
         }
+        ret = checkquote(buf, (int)size, signature, sigsize, nonce, akpubkey,
+                         tpmquote, quotesize) == 0 ? 1 : -1;
+        goto out;
+    }
 #else
+    if (flags & SIGNATURE_TPM) {
         dlog(4,"WARNING: TPM support disabled at compile time"
              "using OPENSSL\n");
-        ret = verify_buffer_openssl(buf, (size_t) size, signature, sigsize,
-                                    certfile, cacertfile);
+    }
 #endif
+
+    if (!cert || !cacert) {
+        fprintf(stderr, "Error verify_xml: no certificate to verify with.\n");
+        goto out;
     }
+    ret = verify_buffer_x509(buf, size, signature, sigsize, cert, cacert);
 
+out:
     if(ret != 1) {
-        fprintf(stderr, "Error verify_xml: verify_buffer_openssl returned %d.\n", ret);
+        fprintf(stderr, "Error verify_xml: signature verification returned %d.\n", ret);
     }
-
-    free(certfile);
     b64_free(signature);
-    if (flags & SIGNATURE_TPM) {
 #ifdef USE_TPM
-        b64_free(tpmquote);
+    b64_free(tpmquote);
 #endif
-}
     free(buf);
 
-    xmlFreeDoc(tmpdoc);
+    return ret;
+}
+
+/*
+ * Given an XML doc and root node, verify the signature of the root element
+ */
+int verify_xml(xmlDoc *doc, xmlNode *root, const char *prefix,
+               const char* nonce, const char *akpubkey,
+               int flags, const char *cacertfile)
+{
+    X509 *cert = NULL;
+    X509 *cacert = NULL;
+    char *certfile;
+    int ret;
+
+    /* Prevents segfaults in weird situations, but is it really needed? */
+    if (!root || !doc)
+        return -1;
+
+    certfile = construct_cert_filename(prefix, root);
+    if (!certfile) {
+        fprintf(stderr, "Error xml_verify: failed to construct cert file.\n");
+        return -1;
+    }
+
+    /* a TPM signature does not need the certificates */
+    if ((cert = load_cert(certfile)) == NULL ||
+            (cacert = load_cert(cacertfile)) == NULL) {
+        dlog(4, "Failed to load certificates %s and %s\n", certfile, cacertfile);
+    }
+
+    ret = verify_xml_x509(doc, root, cert, cacert, nonce, akpubkey, flags);
+
+    X509_free(cacert);
+    X509_free(cert);
+    free(certfile);
 
     return ret;
+}
 
-non_out:
-    free(contract_nonce);
+/*
+ * Compute the lowercase hex SHA-256 digest of @payload into @hex,
+ * which must have room for 2 * SHA256_DIGEST_LENGTH + 1 characters.
+ */
+static int detached_payload_digest(const unsigned char *payload, size_t size,
+                                   char *hex)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen = 0;
+    unsigned int i;
+
+    if(EVP_Digest(payload, size, md, &mdlen, EVP_sha256(), NULL) != 1) {
+        dlog(0, "Failed to digest detached payload\n");
+        return -1;
+    }
+
+    for(i = 0; i < mdlen; i++) {
+        sprintf(hex + (2 * i), "%02x", md[i]);
+    }
+    hex[2 * mdlen] = '\0';
+    return 0;
+}
+
+int bind_detached_payload(xmlNode *node, const unsigned char *payload,
+                          size_t size)
+{
+    char hex[(2 * EVP_MAX_MD_SIZE) + 1];
+    char len[32];
+
+    if(detached_payload_digest(payload, size, hex) != 0) {
+        return -1;
+    }
+    snprintf(len, sizeof(len), "%zu", size);
+
+    if(xmlSetProp(node, (xmlChar*)DETACHED_PAYLOAD_ATTR,
+                  (xmlChar*)DETACHED_PAYLOAD_VALUE) == NULL ||
+            xmlSetProp(node, (xmlChar*)"digestmethod", (xmlChar*)"SHA-256") == NULL ||
+            xmlSetProp(node, (xmlChar*)"digest", (xmlChar*)hex) == NULL ||
+            xmlSetProp(node, (xmlChar*)"length", (xmlChar*)len) == NULL) {
+        dlog(0, "Failed to record detached payload digest\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int is_detached_payload(xmlNode *node)
+{
+    char *val = xmlGetPropASCII(node, DETACHED_PAYLOAD_ATTR);
+    int ret   = 0;
+
+    if(val != NULL && strcasecmp(val, DETACHED_PAYLOAD_VALUE) == 0) {
+        ret = 1;
+    }
+    xmlFree(val);
+    return ret;
+}
+
+int check_detached_payload(xmlNode *node, const unsigned char *payload,
+                           size_t size)
+{
+    char hex[(2 * EVP_MAX_MD_SIZE) + 1];
+    char *method = NULL;
+    char *digest = NULL;
+    char *len    = NULL;
+    char *end    = NULL;
+    unsigned long long expected;
+    int ret      = -1;
+
+    if(payload == NULL) {
+        dlog(1, "Contract references a detached payload but none was attached\n");
+        return 0;
+    }
+
+    method = xmlGetPropASCII(node, "digestmethod");
+    digest = xmlGetPropASCII(node, "digest");
+    len    = xmlGetPropASCII(node, "length");
+    if(method == NULL || digest == NULL || len == NULL) {
+        dlog(1, "Detached payload reference is missing its digest or length\n");
+        goto out;
+    }
+
+    if(strcasecmp(method, "SHA-256") != 0) {
+        dlog(1, "Unsupported detached payload digest method %s\n", method);
+        goto out;
+    }
+
+    errno = 0;
+    expected = strtoull(len, &end, 10);
+    if(errno != 0 || end == len || *end != '\0') {
+        dlog(1, "Bad detached payload length \"%s\"\n", len);
+        goto out;
+    }
+
+    /* the length check is free and spares hashing a truncated payload */
+    if(expected != size) {
+        dlog(1, "Detached payload is %zu bytes, contract expects %llu\n",
+             size, expected);
+        ret = 0;
+        goto out;
+    }
+
+    if(detached_payload_digest(payload, size, hex) != 0) {
+        goto out;
+    }
+
+    ret = (strcasecmp(hex, digest) == 0) ? 1 : 0;
+    if(ret == 0) {
+        dlog(1, "Detached payload digest does not match contract\n");
+    }
 
 out:
-    if (certfile)
-        free(certfile);
-    xmlFreeDoc(tmpdoc);
+    xmlFree(method);
+    xmlFree(digest);
+    xmlFree(len);
+    return ret;
+}
 
-    return -1;
+int frame_detached_payload(const unsigned char *xml, size_t xmlsize,
+                           const unsigned char *payload, size_t size,
+                           unsigned char **out, size_t *outsize)
+{
+    unsigned char *buf;
+    size_t total;
+    uint64_t len = size;
+    int i;
+
+    if(xmlsize > SIZE_MAX - size ||
+            xmlsize + size > SIZE_MAX - DETACHED_PAYLOAD_HDR_SIZE - 1) {
+        dlog(0, "Detached payload too large to frame\n");
+        return -EINVAL;
+    }
+    total = xmlsize + 1 + DETACHED_PAYLOAD_HDR_SIZE + size;
+
+    if((buf = malloc(total)) == NULL) {
+        dlog(0, "Failed to allocate framed contract\n");
+        return -ENOMEM;
+    }
+
+    memcpy(buf, xml, xmlsize);
+    buf[xmlsize] = '\0';
+    memcpy(buf + xmlsize + 1, DETACHED_PAYLOAD_MAGIC, DETACHED_PAYLOAD_MAGIC_LEN);
+    for(i = 0; i < 8; i++) {
+        buf[xmlsize + 1 + DETACHED_PAYLOAD_MAGIC_LEN + i] =
+            (unsigned char)(len >> (56 - (8 * i)));
+    }
+    memcpy(buf + xmlsize + 1 + DETACHED_PAYLOAD_HDR_SIZE, payload, size);
+
+    *out     = buf;
+    *outsize = total;
+    return 0;
+}
+
+int split_detached_payload(const unsigned char *buf, size_t size,
+                           size_t *xmlsize, const unsigned char **payload,
+                           size_t *payload_size)
+{
+    const unsigned char *nul;
+    const unsigned char *hdr;
+    size_t rest;
+    uint64_t len = 0;
+    int i;
+
+    *payload      = NULL;
+    *payload_size = 0;
+
+    nul = memchr(buf, '\0', size);
+    if(nul == NULL || (size_t)(nul - buf) + 1 == size) {
+        /* plain (possibly NUL terminated) XML contract */
+        *xmlsize = size;
+        return 0;
+    }
+
+    rest = size - (size_t)(nul - buf) - 1;
+    hdr  = nul + 1;
+    if(rest < DETACHED_PAYLOAD_HDR_SIZE ||
+            memcmp(hdr, DETACHED_PAYLOAD_MAGIC, DETACHED_PAYLOAD_MAGIC_LEN) != 0) {
+        dlog(1, "Unrecognized data following contract XML\n");
+        return -EINVAL;
+    }
+
+    for(i = 0; i < 8; i++) {
+        len = (len << 8) | hdr[DETACHED_PAYLOAD_MAGIC_LEN + i];
+    }
+
+    if(len != rest - DETACHED_PAYLOAD_HDR_SIZE) {
+        dlog(1, "Detached payload frame length %"PRIu64" does not match the %zu bytes received\n",
+             len, rest - DETACHED_PAYLOAD_HDR_SIZE);
+        return -EINVAL;
+    }
+
+    *xmlsize      = (size_t)(nul - buf);
+    *payload      = hdr + DETACHED_PAYLOAD_HDR_SIZE;
+    *payload_size = (size_t)len;
+    return 0;
 }
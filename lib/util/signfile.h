@@ -22,6 +22,7 @@
 #include <util/xml_util.h>
 #include <util/util.h>
 #include <config.h>
+#include <openssl/x509.h>
 
 #ifndef __SIGNFILE_H__
 #define __SIGNFILE_H__
@@ -63,21 +64,34 @@ int sign_xml(xmlDoc *doc, xmlNode *root, const char *certid,
  * Return 1 on success.
  * doc is the xml document to sign
  * root is the root node of the doc
- * keyfile is the file which holds the private key used in signing the doc
+ * keyfile is the prefix of the file which holds the certificate of
+ * the signer, see construct_cert_filename()
  * nonce is a unique value only used once
  * flags are status values as to how was signed.
  * cacertfile is the file containing the certificate to used to sign the doc
  *
  */
 int verify_xml(xmlDoc *doc, xmlNode *root, const char *keyfile,
-               const char* nonce, 
-#ifdef USE_TPM
- 	           const char* akpubkey,
-#else
- 	           const char* akpubkey UNUSED,
-#endif
+               const char* nonce, const char* akpubkey,
                int flags, const char* cacertfile);
 
+/**
+ * Like verify_xml(), but with the signer certificate @cert and the CA
+ * certificate @cacert already in memory (they may be NULL if @flags is
+ * SIGNATURE_TPM). The signed subtree is canonicalized in place, so
+ * @doc is neither copied nor modified and several subtrees of the same
+ * document may be verified concurrently.
+ * Return 1 on success.
+ */
+int verify_xml_x509(xmlDoc *doc, xmlNode *root, X509 *cert, X509 *cacert,
+                    const char *nonce, const char *akpubkey, int flags);
+
+/**
+ * Return the fingerprint of the key that signed the xml node @root,
+ * as recorded in its signature, or NULL if it has none.
+ */
+char *signature_key_fingerprint(xmlNode *root);
+
 /**
  * Create a filename for a certificate file which corresponds to the xml root.
  * Return filename on success.
@@ -86,4 +100,72 @@ int verify_xml(xmlDoc *doc, xmlNode *root, const char *keyfile,
  */
 char *construct_cert_filename(const char *prefix, xmlNode *root);
 
+/**
+ * Detached payloads let a contract carry a large binary blob (e.g., a
+ * measurement) outside of the XML document. The XML node that refers
+ * to the blob records its SHA-256 digest and length, so a signature
+ * over the XML also authenticates the blob without the blob being
+ * base64 encoded and canonicalized along with the document.
+ *
+ * On the wire a contract with a detached payload is the serialized
+ * XML, a NUL byte, the 8 byte DETACHED_PAYLOAD_MAGIC, the payload
+ * length as a 64 bit big endian integer, and finally the payload.
+ *
+ * A peer advertises that it accepts detached payloads by setting the
+ * DETACHED_PAYLOAD_ATTR attribute of the root node of the contract it
+ * sends to DETACHED_PAYLOAD_VALUE. Peers that do not advertise it
+ * receive the payload base64 encoded in the XML as before.
+ */
+#define DETACHED_PAYLOAD_ATTR		"payload"
+#define DETACHED_PAYLOAD_VALUE		"detached"
+#define DETACHED_PAYLOAD_MAGIC		"MAATBLOB"
+#define DETACHED_PAYLOAD_MAGIC_LEN	8
+#define DETACHED_PAYLOAD_HDR_SIZE	(DETACHED_PAYLOAD_MAGIC_LEN + 8)
+
+/**
+ * Mark @node as referring to the detached @payload of @size bytes by
+ * recording its digest and length as attributes of @node. Must be
+ * called before the enclosing node is signed.
+ * Return 0 on success, -1 on failure.
+ */
+int bind_detached_payload(xmlNode *node, const unsigned char *payload,
+                          size_t size);
+
+/**
+ * Return 1 if @node refers to a detached payload, 0 otherwise.
+ */
+int is_detached_payload(xmlNode *node);
+
+/**
+ * Check that @payload of @size bytes is the one bound to @node by
+ * bind_detached_payload(). @payload may be NULL if the contract had
+ * no attachment.
+ * Return 1 if it matches, 0 if it does not, < 0 on error.
+ */
+int check_detached_payload(xmlNode *node, const unsigned char *payload,
+                           size_t size);
+
+/**
+ * Build the wire form of a contract with a detached payload from the
+ * serialized XML @xml of @xmlsize bytes (not including any NUL
+ * terminator) and @payload of @size bytes. On success *@out is a
+ * newly allocated buffer of *@outsize bytes.
+ * Return 0 on success, < 0 on failure.
+ */
+int frame_detached_payload(const unsigned char *xml, size_t xmlsize,
+                           const unsigned char *payload, size_t size,
+                           unsigned char **out, size_t *outsize);
+
+/**
+ * Split a received contract @buf of @size bytes into its XML and
+ * detached payload. *@xmlsize is set to the number of bytes of @buf
+ * to hand to the XML parser. If the contract has no attachment,
+ * *@payload is set to NULL and *@xmlsize to @size. Otherwise
+ * *@payload points into @buf and *@payload_size is its length.
+ * Return 0 on success, < 0 if the framing is malformed.
+ */
+int split_detached_payload(const unsigned char *buf, size_t size,
+                           size_t *xmlsize, const unsigned char **payload,
+                           size_t *payload_size);
+
 #endif /* __SIGNFILE_H__ */
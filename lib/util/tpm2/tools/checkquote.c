@@ -259,11 +259,22 @@ static bool verify_signature() {
     goto err;
   }
 
-  // Also ensure digest from quote matches PCR digest
+  result = true;
+
+ err:
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(pkey_ctx);
+
+  return result;
+}
+
+static bool pcr_digest_matches() {
+
+  // Ensure digest from quote matches PCR digest
   // Sanity check -- they should at least be same size!
   if (cq_ctx.attest.attested.quote.pcrDigest.size != cq_ctx.pcr_hash.size) {
     dlog(3, "FATAL ERROR: PCR values failed to match quote's digest!\n");
-    goto err;
+    return false;
   }
 
   // Compare running digest with quote's digest
@@ -271,25 +282,20 @@ static bool verify_signature() {
   for (k = 0; k < cq_ctx.attest.attested.quote.pcrDigest.size; k++) {
     if (cq_ctx.attest.attested.quote.pcrDigest.buffer[k] != cq_ctx.pcr_hash.buffer[k]) {
       dlog(3, "FATAL ERROR: PCR values failed to match quote's digest!\n");
-      goto err;
+      return false;
     }   
   }   
 
-  result = true;
-
- err:
-  EVP_PKEY_free(pkey);
-  EVP_PKEY_CTX_free(pkey_ctx);
-
-  return result;
+  return true;
 }
 
-static tool_rc init(const unsigned char *buf, int buf_size, unsigned char *sig, int sigsize, unsigned char *quote, int quotesize) {
+/*
+ * Load the signature @sig and the quote @quote and hash the quote for
+ * verify_signature().
+ */
+static tool_rc load_quote(unsigned char *sig, int sigsize, unsigned char *quote, int quotesize) {
 
   tool_rc return_value = tool_rc_general_error;
-  BYTE digest_data[TPM2_SHA256_DIGEST_SIZE];
-  UINT16 digest_size;
-  BYTE extended[TPM2_SHA256_DIGEST_SIZE*2];
   size_t offset = 0;
   TPMT_SIGNATURE tmp;
   
@@ -306,6 +312,33 @@ static tool_rc init(const unsigned char *buf, int buf_size, unsigned char *sig,
       goto err;
   }
   memcpy(cq_ctx.signature.buffer, tmp.signature.rsassa.sig.buffer, cq_ctx.signature.size);
+
+  offset = 0;
+  rval = Tss2_MU_TPMS_ATTEST_Unmarshal(quote,
+  				       quotesize, &offset, &cq_ctx.attest);
+  if (rval != TSS2_RC_SUCCESS) {
+    dlog(3, "%s(0x%X) - %s", "Tss2_MU_TPM2B_ATTEST_Unmarshal\n", rval, Tss2_RC_Decode(rval));
+    return_value = tool_rc_from_tpm(rval);
+    goto err;
+  }
+
+  bool result = openssl_check(quote, quotesize, cq_ctx.msg_hash.buffer, &cq_ctx.msg_hash.size);
+  if (!result) {
+    dlog(3, "Compute message hash failed!\n");
+    goto err;
+  }
+  return_value = tool_rc_success;
+
+ err:
+  return return_value;
+}
+
+static tool_rc init(const unsigned char *buf, int buf_size, unsigned char *sig, int sigsize, unsigned char *quote, int quotesize) {
+
+  tool_rc return_value = tool_rc_general_error;
+  BYTE digest_data[TPM2_SHA256_DIGEST_SIZE];
+  UINT16 digest_size;
+  BYTE extended[TPM2_SHA256_DIGEST_SIZE*2];
   
   bool result = openssl_check((BYTE *)buf, buf_size, digest_data, &digest_size);  
   if (!result) {
@@ -328,21 +361,7 @@ static tool_rc init(const unsigned char *buf, int buf_size, unsigned char *sig,
     goto err;
   }  
 
-  offset = 0;
-  rval = Tss2_MU_TPMS_ATTEST_Unmarshal(quote,
-  				       quotesize, &offset, &cq_ctx.attest);
-  if (rval != TSS2_RC_SUCCESS) {
-    dlog(3, "%s(0x%X) - %s", "Tss2_MU_TPM2B_ATTEST_Unmarshal\n", rval, Tss2_RC_Decode(rval));
-    return_value = tool_rc_from_tpm(rval);
-    goto err;
-  }
-
-  result = openssl_check(quote, quotesize, cq_ctx.msg_hash.buffer, &cq_ctx.msg_hash.size);
-  if (!result) {
-    dlog(3, "Compute message hash failed!\n");
-    goto err;
-  }
-  return_value = tool_rc_success;
+  return_value = load_quote(sig, sigsize, quote, quotesize);
 
  err:
   return return_value;
@@ -356,7 +375,7 @@ static tool_rc checkquote_onrun(const unsigned char *buf, int buf_size, unsigned
     return rc;
   }
 
-  bool res = verify_signature();
+  bool res = verify_signature() && pcr_digest_matches();
   if (!res) {
     dlog(3, "Verify signature failed!\n");
     return tool_rc_general_error;
@@ -399,3 +418,53 @@ int checkquote(const unsigned char *buf, int buf_size, unsigned char *sig, int s
   return ret;
 }
 
+int checkquote_pcrs(unsigned char *sig, int sigsize, const char *nonce, const char *pubkey,
+		    unsigned char *quote, int quotesize, uint16_t *pcr_alg, uint32_t *pcr_mask,
+		    unsigned char *pcr_digest, int *pcr_digest_size) {
+
+  tool_rc ret = tool_rc_general_error;
+  TPMS_PCR_SELECTION *sel;
+  UINT8 i;
+
+  if (pubkey == NULL || nonce == NULL) {
+    dlog(3, "AK pubkey and nonce required.\n");
+    return ret;
+  }
+  cq_ctx.pubkey_file_path = pubkey;
+  cq_ctx.extra_data.size = sizeof(cq_ctx.extra_data.buffer);
+  if (!bin_from_hex(nonce, &cq_ctx.extra_data.size, cq_ctx.extra_data.buffer)) {
+    dlog(3, "Unable to get nonce.\n");
+    goto out;
+  }
+
+  if (load_quote(sig, sigsize, quote, quotesize) != tool_rc_success ||
+      !verify_signature()) {
+    dlog(3, "Verify signature failed!\n");
+    goto out;
+  }
+
+  if (cq_ctx.attest.magic != TPM2_GENERATED_VALUE ||
+      cq_ctx.attest.type != TPM2_ST_ATTEST_QUOTE ||
+      cq_ctx.attest.attested.quote.pcrSelect.count != 1) {
+    dlog(3, "Quote does not attest a single PCR bank\n");
+    goto out;
+  }
+  sel = &cq_ctx.attest.attested.quote.pcrSelect.pcrSelections[0];
+  if (sel->sizeofSelect > 3) {
+    dlog(3, "Quote selects PCRs beyond PCR 23\n");
+    goto out;
+  }
+  *pcr_alg = sel->hash;
+  *pcr_mask = 0;
+  for (i = 0; i < sel->sizeofSelect; i++) {
+    *pcr_mask |= (uint32_t)sel->pcrSelect[i] << (8 * i);
+  }
+  memcpy(pcr_digest, cq_ctx.attest.attested.quote.pcrDigest.buffer,
+	 cq_ctx.attest.attested.quote.pcrDigest.size);
+  *pcr_digest_size = cq_ctx.attest.attested.quote.pcrDigest.size;
+  ret = tool_rc_success;
+
+ out:
+  cq_ctx.pubkey_file_path = NULL;
+  return ret;
+}
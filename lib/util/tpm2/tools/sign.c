@@ -71,6 +71,10 @@ static tpm_quote_ctx q_ctx = {
 
 static tpm_sig_quote sig_quote;
 
+/* tpm2_sign() quotes the PCR it extended and reads it back to check
+   the quote; tpm2_quote() selects PCRs the caller verifies instead */
+static bool quote_readback = true;
+
 static bool write_output_files(TPM2B_ATTEST *quoted, TPMT_SIGNATURE *signature) {
   bool res = true;
   size_t offset = 0; 
@@ -259,6 +263,10 @@ static tool_rc quote_onrun(ESYS_CONTEXT *ectx) {
     return tool_rc_from_tpm(rval);
   }
 
+  if (!quote_readback) {
+    goto write;
+  }
+
   // Gather PCR values from the TPM (the quote doesn't have them!)
   // call pcr_read
   TPML_PCR_SELECTION *pcr_selection_out;
@@ -314,6 +322,7 @@ static tool_rc quote_onrun(ESYS_CONTEXT *ectx) {
   }
       
   // Write everything out
+ write:;
   bool ret = write_output_files(quoted, signature);
   free(quoted);
   free(signature);
@@ -368,19 +377,18 @@ static void main_onexit(void) {
   teardown_full(&ctx.ectx);
  }
 
-struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const char *pass, const char *nonce, const char *ctx_path) {
+/*
+ * Quote the PCRs in q_ctx.pcr_selections with @nonce using the AK in
+ * @ctx_path, after extending PCR 16 with the digest of @buf if @buf is
+ * not NULL.
+ */
+static struct tpm_sig_quote *run_quote(const unsigned char *buf, int buf_size, const char *pass,
+				       const char *nonce, const char *ctx_path) {
 
   bool result = false;
   tool_rc ret = tool_rc_general_error;
   TSS2_TCTI_CONTEXT *tcti = NULL;
-  
-  q_ctx.pcr_selections.count = 1;
-  q_ctx.pcr_selections.pcrSelections[0].hash = TPM2_ALG_SHA256;
-  q_ctx.pcr_selections.pcrSelections[0].sizeofSelect = 3;
-  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[0] = 0;
-  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[1] = 0;
-  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[2] = 1;
-  
+
   atexit(main_onexit);
   atexit(pcr_onexit);
 
@@ -408,9 +416,11 @@ struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const ch
       dlog(3, "Failed to get nonce.\n");
     }
   }
-  result = pcr_on_arg(buf, buf_size);
-  if (!result) {
-    goto out;
+  if (buf != NULL) {
+    result = pcr_on_arg(buf, buf_size);
+    if (!result) {
+      goto out;
+    }
   }
   TSS2_RC rc_tcti = Tss2_TctiLdr_Initialize("tabrmd", &tcti);
   if (rc_tcti != TSS2_RC_SUCCESS || !tcti) {
@@ -428,9 +438,11 @@ struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const ch
     }
   }
 
-  ret = pcr_onrun(ctx.ectx);
-  if (ret != tool_rc_success) {
-    goto out;
+  if (buf != NULL) {
+    ret = pcr_onrun(ctx.ectx);
+    if (ret != tool_rc_success) {
+      goto out;
+    }
   }
   ret  = quote_onrun(ctx.ectx);
   tool_rc tmp_rc = quote_onstop();
@@ -446,3 +458,29 @@ struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const ch
   }
   
 }
+
+struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const char *pass, const char *nonce, const char *ctx_path) {
+
+  q_ctx.pcr_selections.count = 1;
+  q_ctx.pcr_selections.pcrSelections[0].hash = TPM2_ALG_SHA256;
+  q_ctx.pcr_selections.pcrSelections[0].sizeofSelect = 3;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[0] = 0;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[1] = 0;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[2] = 1;
+  quote_readback = true;
+
+  return run_quote(buf, buf_size, pass, nonce, ctx_path);
+}
+
+struct tpm_sig_quote *tpm2_quote(uint32_t pcr_mask, const char *pass, const char *nonce, const char *ctx_path) {
+
+  q_ctx.pcr_selections.count = 1;
+  q_ctx.pcr_selections.pcrSelections[0].hash = TPM2_ALG_SHA256;
+  q_ctx.pcr_selections.pcrSelections[0].sizeofSelect = 3;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[0] = pcr_mask & 0xff;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[1] = (pcr_mask >> 8) & 0xff;
+  q_ctx.pcr_selections.pcrSelections[0].pcrSelect[2] = (pcr_mask >> 16) & 0xff;
+  quote_readback = false;
+
+  return run_quote(NULL, 0, pass, nonce, ctx_path);
+}
@@ -45,6 +45,12 @@ struct tpm_sig_quote {
 
 struct tpm_sig_quote *tpm2_sign(const unsigned char *buf, int buf_size, const char *pass, const char *nonce, const char *ctx_path);
 
+/*
+  Quote the SHA-256 PCRs in @pcr_mask (bit n for PCR n) with @nonce,
+  without extending any PCR first.
+*/
+struct tpm_sig_quote *tpm2_quote(uint32_t pcr_mask, const char *pass, const char *nonce, const char *ctx_path);
+
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
   TPM2B_DIGEST msg_hash;
@@ -58,3 +64,13 @@ struct tpm2_verifysig_ctx {
 //tool_rc handle_checkquote_options(int argc, char **argv);
 
 int checkquote(const unsigned char *buf, int buf_size, unsigned char *sig, int sigsize, const char *nonce, const char *pubkey, unsigned char *quote, int quotesize);
+
+/*
+  Check that @quote is signed with @sig by the AK in @pubkey and was
+  made over @nonce, and return the bank (@pcr_alg), PCRs (@pcr_mask)
+  and composite digest (@pcr_digest, at least TPM2_SHA512_DIGEST_SIZE
+  bytes) it attests. Returns 0 on success.
+*/
+int checkquote_pcrs(unsigned char *sig, int sigsize, const char *nonce, const char *pubkey,
+		    unsigned char *quote, int quotesize, uint16_t *pcr_alg, uint32_t *pcr_mask,
+		    unsigned char *pcr_digest, int *pcr_digest_size);
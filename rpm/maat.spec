@@ -25,7 +25,7 @@ Source:         %{name}-%{version}.tar.gz
 BuildRequires: autoconf, automake, libtool, glib2-devel, libxml2-devel, 
 BuildRequires: openssl-devel, libuuid-devel, make, python3-devel
 BuildRequires: selinux-policy-devel, libselinux
-BuildRequires: elfutils-devel, libcap-devel, json-c-devel
+BuildRequires: elfutils-devel, libcap-devel, json-c-devel, liburing-devel
 BuildRequires: mongo-c-driver, tpm2-tss, tpm2-tss-devel, tpm2-tools
 Requires:       libcap, json-c, mongo-c-driver-devel, libbson
 %{?el7:Requires: systemd}
@@ -78,6 +78,7 @@ make %{?_smp_mflags}
 %install
 rm -rf $RPM_BUILD_ROOT
 %make_install
+install -d $RPM_BUILD_ROOT%{_localstatedir}/lib/maat
 
 #
 # Maat scriptlets
@@ -196,6 +197,7 @@ setsebool -P httpd_can_network_connect=off
 %{_datadir}/maat/apbs/*
 %{_datadir}/maat/asps/*
 %{_datadir}/maat/measurement-specifications/*
+%dir %{_localstatedir}/lib/maat
 %{_datadir}/dbus-1/services/org.AttestationManager.service
 %{_bindir}/am_service
 %{_bindir}/attestmgr
@@ -228,7 +230,10 @@ setsebool -P httpd_can_network_connect=off
 %{_libexecdir}/maat/asps/send_request_asp
 %{_libexecdir}/maat/asps/hashfileserviceasp
 %{_libexecdir}/maat/asps/hashserviceasp
+%{_libexecdir}/maat/asps/iptables_asp
 %attr(4755, -, -) %{_libexecdir}/maat/asps/ima_asp
+%attr(4755, -, -) %{_libexecdir}/maat/asps/tpm_eventlog_asp
+%{_libexecdir}/maat/asps/tpm_eventlog_appraise_asp
 %attr(4755, -, -) %{_libexecdir}/maat/asps/listdirectoryserviceasp
 %{_libexecdir}/maat/asps/lsmod
 %{_libexecdir}/maat/asps/lsprocasp
@@ -268,6 +273,8 @@ setsebool -P httpd_can_network_connect=off
 %{_libexecdir}/maat/asps/receive_asp
 %{_libexecdir}/maat/asps/passport_maker_asp
 %attr(4755, -, -) %{_libexecdir}/maat/asps/proc_namespaces_asp
+%attr(4755, -, -) %{_libexecdir}/maat/asps/container_layers_asp
+%attr(4755, -, -) %{_libexecdir}/maat/asps/file_metadata_asp
 %{_libexecdir}/maat/asps/kernel_msmt_asp
 %{_datadir}/maat/selector-configurations/*
 %if 0%{?rhel} >= 7
@@ -25,13 +25,16 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <dirent.h>
 #include <common/apb_info.h>
 #include <common/copland.h>
 #include <common/asp.h>
 #include <common/measurement_spec.h>
 #include "am.h"
 #include "selector.h"
+#include "branches.h"
 #include <util/xml_util.h>
 #include <util/util.h>
 #include <util/maat-io.h>
@@ -105,6 +108,66 @@ void free_attestation_manager(struct attestation_manager* ptr)
     }
 }
 
+guint am_nr_loaded_apbs(const struct attestation_manager *self)
+{
+    struct am_impl *am = container_of((struct attestation_manager *)self, struct am_impl, am);
+    return g_list_length(am->loaded_apbs);
+}
+
+/**
+ * Count the metadata files in @dirname, chosen as the load_all_*_info()
+ * functions choose them. Returns the count or < 0 on error.
+ */
+static int count_metadata_files(const char *dirname)
+{
+    struct dirent *dent;
+    DIR *dir;
+    int count = 0;
+
+    if((dir = opendir(dirname)) == NULL) {
+        int err = errno;
+        dlog(0, "Error opening directory %s: %s\n", dirname, strerror(err));
+        return -err;
+    }
+    for(dent = readdir(dir); dent; dent = readdir(dir)) {
+        char *xml_suffix = strstr(dent->d_name, ".xml");
+        if(xml_suffix && *(xml_suffix + 4) == '\0') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static int check_loaded(const char *what, const char *dirname, guint loaded)
+{
+    int count = count_metadata_files(dirname);
+
+    if(count < 0) {
+        return count;
+    }
+    if(loaded != (guint)count) {
+        dlog(0, "Error: loaded %u of %d %s in %s\n", loaded, count, what, dirname);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int am_check_loaded(const struct attestation_manager *self, const char *aspdir,
+                    const char *specdir, const char *apbdir)
+{
+    struct am_impl *am = container_of((struct attestation_manager *)self, struct am_impl, am);
+    int ret;
+
+    if((ret = check_loaded("ASPs", aspdir, g_list_length(am->loaded_asps))) != 0 ||
+            (ret = check_loaded("measurement specifications", specdir,
+                                g_list_length(am->loaded_specs))) != 0 ||
+            (ret = check_loaded("APBs", apbdir, g_list_length(am->loaded_apbs))) != 0) {
+        return ret;
+    }
+    return 0;
+}
+
 /**
  * Get a list of phrases to be offered to the client. The result
  * is used to generate the initial contract
@@ -193,6 +256,149 @@ static gint g_list_node_compare(gconstpointer a, gconstpointer b)
     return (gint) eval_bounds_of_args(phr_a, phr_b);
 }
 
+/**
+ * Check that the partner_cert fingerprint is the same as during
+ * attester_select_options. Returns 0 if it is, -1 otherwise.
+ */
+static int check_partner_fingerprint(struct scenario *scen)
+{
+    char *fingerprint;
+
+    if(scen->partner_cert == NULL) {
+        return 0;
+    }
+
+    fingerprint = get_fingerprint(scen->partner_cert, NULL);
+    if(fingerprint == NULL) {
+        const char *msg = "Error: Failed to get fingerprint from partner certification";
+        scen->error_message = strdup(msg);
+        dlog(0, "%s\n", msg);
+        return -1;
+    }
+
+    if(strcmp(fingerprint, scen->partner_fingerprint) != 0) {
+        const char *msg = ("Error: Partner_cert fingerprint does not match previous "
+                           "partner_cert fingerprint");
+        scen->error_message = strdup(msg);
+        dlog(0, "%s\n", msg);
+        free(fingerprint);
+        return -1;
+    }
+    free(fingerprint);
+    return 0;
+}
+
+/**
+ * Appends a section=<resource>:<spec uuid> argument, naming one
+ * resource of a multi-resource request and the measurement spec that
+ * covers it, to the APB arguments *@args (which may be NULL).
+ * Returns 0 on success, < 0 on error.
+ */
+static int append_section_arg(char **args, const char *resource,
+                              const uuid_t spec_uuid)
+{
+    char uuid_str[37];
+    char *tmp;
+    int rc;
+
+    /* APB arguments are a comma separated list of key=value pairs */
+    if(strpbrk(resource, ",=") != NULL) {
+        dlog(0, "Resource \"%s\" cannot be passed to an APB\n", resource);
+        return -EINVAL;
+    }
+
+    uuid_unparse(spec_uuid, uuid_str);
+    if(*args == NULL) {
+        rc = asprintf(&tmp, "section=%s:%s", resource, uuid_str);
+    } else {
+        rc = asprintf(&tmp, "%s,section=%s:%s", *args, resource, uuid_str);
+    }
+    if(rc < 0) {
+        dlog(0, "Unable to allocate APB arguments\n");
+        return -ENOMEM;
+    }
+    free(*args);
+    *args = tmp;
+    return 0;
+}
+
+/**
+ * Takes the phrases in @phrases (a GList of copland_phrase) and makes
+ * a branch of each, carried out by the APB from @apbs whose template
+ * it fits. Returns the branches, or NULL on error; @phrases is freed
+ * either way.
+ */
+static struct am_branch *new_branches(GList *apbs, struct scenario *scen, GList *phrases)
+{
+    struct am_branch *branches;
+    struct phrase_meas_spec_pair *pair = NULL;
+    size_t nr = g_list_length(phrases), i;
+    GList *l;
+
+    branches = new_am_branches(nr);
+    if(branches == NULL) {
+        dlog(0, "Unable to allocate branches\n");
+        g_list_free_full(phrases, free_copland_phrase_glist);
+        return NULL;
+    }
+    for(l = phrases, i = 0; l != NULL; l = l->next, i++) {
+        branches[i].phrase = l->data;
+    }
+    g_list_free(phrases);
+
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+
+        b->apb = find_apb_copl_phrase_by_template(apbs, b->phrase, &pair);
+        if(b->apb == NULL) {
+            dlog(1, "APB does not exist\n");
+            goto err;
+        }
+        uuid_copy(b->spec_uuid, pair->spec_uuid);
+
+        if(has_place_args(b->phrase) == 1 &&
+                query_place_information(b->apb, scen, b->phrase) < 0) {
+            dlog(1, "Error writing place information to the csv file, launching will continue\n");
+        }
+
+        if(copland_args_to_string((const phrase_arg **)b->phrase->args,
+                                  b->phrase->num_args, &b->args) < 0) {
+            dlog(0, "Unable to get the arguments for the selected Copland Phrase\n");
+            goto err;
+        }
+    }
+    return branches;
+
+err:
+    free_am_branches(branches, nr);
+    return NULL;
+}
+
+/**
+ * Called on the receipt of an execute contract whose option is a
+ * branch-parallel phrase with the @phrases of its branches. The APBs
+ * of all branches run concurrently in a process that sends the
+ * joined evidence to the appraiser.
+ */
+static int attester_spawn_branches(struct am_impl *atm, struct scenario *scen,
+                                   GList *phrases)
+{
+    size_t nr = g_list_length(phrases);
+    struct am_branch *branches;
+    pid_t pid;
+
+    branches = new_branches(atm->loaded_apbs, scen, phrases);
+    if(branches == NULL) {
+        return -1;
+    }
+
+    dlog(2, "Attester: Spawning APBs for %zu branches\n", nr);
+    pid = attester_run_branches(scen, branches, nr, atm->execcon_behavior,
+                                atm->use_unique_categories);
+    free_am_branches(branches, nr);
+    return pid >= 0 ? 0 : -1;
+}
+
 /**
  * Called on the receipt of an execute contract. This call is expected to spawn a
  * thread or process executing the APB that will take over the connection.
@@ -204,9 +410,10 @@ int attester_spawn_protocol(struct attestation_manager *self,
     struct am_impl *atm = container_of(self, struct am_impl, am);
     struct apb *apb;
     int ret;
-    char *args = NULL, *fingerprint = NULL;
+    char *args = NULL;
     struct phrase_meas_spec_pair *pair = NULL;
     GList *temp = NULL;
+    GList *branches = NULL;
 
     dlog(6, "Attester: in spawn protocol\n");
 
@@ -220,25 +427,13 @@ int attester_spawn_protocol(struct attestation_manager *self,
         return -1 ;
     }
 
-    //Check that the partner_cert fingerprint is the same as during attester_select_options
-    if(scen->partner_cert != NULL) {
-        fingerprint = get_fingerprint(scen->partner_cert, NULL);
-        if(fingerprint == NULL) {
-            const char *msg = "Error: Failed to get fingerprint from partner certification";
-            scen->error_message = strdup(msg);
-            dlog(0, "%s\n", msg);
-            return -1;
-        }
+    if(check_partner_fingerprint(scen) != 0) {
+        return -1;
+    }
 
-        if(strcmp(fingerprint, scen->partner_fingerprint) != 0) {
-            const char *msg = ("Error: Partner_cert fingerprint does not match previous "
-                               "partner_cert fingerprint");
-            scen->error_message = strdup(msg);
-            dlog(0, "%s\n", msg);
-            free(fingerprint);
-            return -1;
-        }
-        free(fingerprint);
+    ret = parse_copland_branches(phrase, atm->loaded_apbs, &branches);
+    if(ret != 0) {
+        return ret < 0 ? ret : attester_spawn_branches(atm, scen, branches);
     }
 
     apb = find_apb_copl_phrase_by_template(atm->loaded_apbs, phrase, &pair);
@@ -276,6 +471,136 @@ out_err:
     return ret;
 }
 
+/**
+ * Called on the receipt of an execute contract with an option per
+ * resource. Every phrase must be carried out by the same APB, which is
+ * spawned once with a section argument per resource, so measurements
+ * the resources have in common are only taken once.
+ */
+int attester_spawn_sections(struct attestation_manager *self,
+                            struct scenario *scen,
+                            GList *phrases, GList *resources)
+{
+    struct am_impl *atm = container_of(self, struct am_impl, am);
+    struct apb *apb = NULL, *sec_apb;
+    struct phrase_meas_spec_pair *pair = NULL, *sec_pair = NULL;
+    char *args = NULL, *sec_args = NULL, *tmp;
+    GList *p, *r;
+    int ret = -1;
+
+    dlog(6, "Attester: in spawn sections\n");
+
+    if(phrases == NULL || g_list_length(phrases) != g_list_length(resources)) {
+        dlog(0, "Execute contract needs one option per resource\n");
+        return -1;
+    }
+
+    if(check_partner_fingerprint(scen) != 0) {
+        return -1;
+    }
+
+    for(p = phrases, r = resources; p != NULL; p = p->next, r = r->next) {
+        copland_phrase *phrase = p->data;
+
+        if(g_list_find_custom(scen->current_options, (gconstpointer)phrase,
+                              g_list_node_compare) == NULL) {
+            scen->error_message = g_strdup_printf("Error: option %s not found in initial options.",
+                                                  phrase->phrase);
+            dlog(0, "%s\n", scen->error_message);
+            goto out;
+        }
+
+        sec_apb = find_apb_copl_phrase_by_template(atm->loaded_apbs, phrase, &sec_pair);
+        if(sec_apb == NULL) {
+            dlog(1, "APB does not exist\n");
+            goto out;
+        }
+        if(apb == NULL) {
+            apb  = sec_apb;
+            pair = sec_pair;
+        } else if(sec_apb != apb) {
+            scen->error_message = g_strdup_printf("Error: resources %s and %s are measured "
+                                                  "by different APBs.",
+                                                  (char *)resources->data, (char *)r->data);
+            dlog(0, "%s\n", scen->error_message);
+            goto out;
+        }
+
+        if(has_place_args(phrase) == 1 &&
+                query_place_information(apb, scen, phrase) < 0) {
+            dlog(1, "Error writing place information to the csv file, launching will continue\n");
+        }
+
+        if(copland_args_to_string((const phrase_arg **)phrase->args, phrase->num_args,
+                                  &sec_args) < 0) {
+            dlog(0, "Unable to get the arguments for the selected Copland Phrase\n");
+            goto out;
+        }
+        if(sec_args != NULL) {
+            if(asprintf(&tmp, "%s%s%s", args ? args : "", args ? "," : "", sec_args) < 0) {
+                dlog(0, "Unable to allocate APB arguments\n");
+                free(sec_args);
+                goto out;
+            }
+            free(sec_args);
+            free(args);
+            args = tmp;
+        }
+
+        if(append_section_arg(&args, r->data, sec_pair->spec_uuid) < 0) {
+            goto out;
+        }
+    }
+
+    dlog(2, "Attester: Spawning APB %s for %u resources\n", apb->name,
+         g_list_length(resources));
+    ret = run_apb_async(apb,
+                        atm->execcon_behavior,
+                        atm->use_unique_categories,
+                        scen, (unsigned char *)pair->spec_uuid,
+                        scen->peer_chan, -1, NULL, NULL, NULL, args);
+    ret = ret >= 0 ? 0 : ret;
+
+out:
+    free(args);
+    return ret;
+}
+
+/**
+ * Runs the execute phase of the selector once for each resource of a
+ * multi-resource request, leaving one phrase per resource in
+ * scen->current_options, in the order of scen->resources.
+ */
+static int appraiser_select_sections(struct am_impl *atm, struct scenario *scen,
+                                     GList *options)
+{
+    char *first = scen->resource;
+    copland_phrase *phrase;
+    GList *r;
+    int rtn = 0;
+
+    for(r = scen->resources; r != NULL; r = r->next) {
+        /* the selector matches on scen->resource */
+        scen->resource = r->data;
+        phrase = NULL;
+        rtn = selector_get_first_action(atm->selector, APPRAISER, EXEC, ACCEPT,
+                                        scen, options, &phrase);
+        if((phrase == NULL) || (rtn != 0)) {
+            scen->error_message = g_strdup_printf("Error: Selector returned no option "
+                                                  "for resource %s", (char *)r->data);
+            dlog(0, "%s\n", scen->error_message);
+            rtn = -1;
+            break;
+        }
+
+        dlog(5, "PRESENTATION MODE (self): From subset of options in modified contract, appraiser selects option for resource %s: %s\n",
+             (char *)r->data, phrase->phrase);
+        scen->current_options = g_list_append(scen->current_options, (gpointer)phrase);
+    }
+    scen->resource = first;
+    return rtn;
+}
+
 /**
  * In response to a modified contract, select which of the options should be executed
  * by the client.  This should check to make sure the returned option is one of the
@@ -320,6 +645,15 @@ int appraiser_select_option(struct attestation_manager *self, struct scenario *s
     }
     g_list_free(scen->current_options);
     scen->current_options = NULL;
+
+    if(scen->resources != NULL && scen->resources->next != NULL) {
+        rtn = appraiser_select_sections(atm, scen, options);
+        if(rtn == 0) {
+            *selected = scen->current_options->data;
+        }
+        goto out;
+    }
+
     rtn = selector_get_first_action(atm->selector, APPRAISER, EXEC, ACCEPT, scen, options, &phrase);
 
     if((phrase == NULL) || (rtn != 0)) {
@@ -336,6 +670,121 @@ out:
     return rtn;
 }
 
+/**
+ * For a multi-resource request, checks that the appraiser phrase for
+ * every resource is carried out by @apb and adds a section argument
+ * for each resource to *@args. Returns 0 on success, < 0 on error.
+ */
+static int appraiser_section_args(struct am_impl *atm, struct scenario *scen,
+                                  struct apb *apb, char **args)
+{
+    char *first = scen->resource;
+    GList *r, *p;
+    int ret = 0;
+
+    for(r = scen->resources, p = scen->current_options;
+            r != NULL && p != NULL && ret == 0; r = r->next, p = p->next) {
+        GList *option = g_list_append(NULL, p->data);
+        copland_phrase *selected = NULL;
+        struct phrase_meas_spec_pair *ele = NULL;
+
+        scen->resource = r->data;
+        if(selector_get_first_action(atm->selector, APPRAISER, SPAWN,
+                                     ACCEPT, scen, option, &selected) != AM_OK) {
+            dlog(0, "No appraiser phrase for resource %s\n", (char *)r->data);
+            ret = -1;
+        } else if(find_apb_copl_phrase_by_template(atm->loaded_apbs, selected, &ele) != apb) {
+            dlog(0, "Resource %s is not appraised by APB %s\n", (char *)r->data, apb->name);
+            ret = -1;
+        } else {
+            ret = append_section_arg(args, r->data, ele->spec_uuid);
+        }
+
+        if(selected != NULL) {
+            selector_free_condition(atm->selector, selected);
+        }
+        g_list_free(option);
+    }
+    scen->resource = first;
+
+    if(ret == 0 && (r != NULL || p != NULL)) {
+        dlog(0, "Selected %u options for %u resources\n",
+             g_list_length(scen->current_options), g_list_length(scen->resources));
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * Spawns the process that appraises the branches of a branch-parallel
+ * phrase, with the attester's @phrases of the branches. The selector
+ * picks the appraiser phrase for each branch as it would if the
+ * branch were the attester's only phrase.
+ */
+static int appraiser_spawn_branches(struct am_impl *atm, struct scenario *scen,
+                                    GList *phrases)
+{
+    size_t nr = g_list_length(phrases), i;
+    struct am_branch *branches;
+    pid_t pid = -1;
+
+    branches = new_am_branches(nr);
+    if(branches == NULL) {
+        dlog(0, "Unable to allocate branches\n");
+        g_list_free_full(phrases, free_copland_phrase_glist);
+        return -1;
+    }
+    for(i = 0; phrases != NULL; phrases = g_list_delete_link(phrases, phrases), i++) {
+        branches[i].phrase = phrases->data;
+    }
+
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+        struct phrase_meas_spec_pair *ele = NULL;
+        GList *option = g_list_append(NULL, b->phrase);
+        copland_phrase *selected = NULL;
+        int ret = -1;
+
+        if(selector_get_first_action(atm->selector, APPRAISER, SPAWN,
+                                     ACCEPT, scen, option, &selected) != AM_OK) {
+            scen->error_message = g_strdup_printf("Failed to accept spawning of APB "
+                                                  "for branch %s", b->phrase->phrase);
+        } else if((b->apb = find_apb_copl_phrase_by_template(atm->loaded_apbs,
+                            selected, &ele)) == NULL) {
+            scen->error_message = g_strdup_printf("Failed to get appraiser apb "
+                                                  "for branch %s", b->phrase->phrase);
+        } else if(copland_args_to_string((const phrase_arg **)selected->args,
+                                         selected->num_args, &b->args) < 0) {
+            scen->error_message = strdup("Unable to get the arguments for the "
+                                         "selected Copland Phrase");
+        } else {
+            uuid_copy(b->spec_uuid, ele->spec_uuid);
+            if(has_place_args(b->phrase) == 1 &&
+                    query_place_information(b->apb, scen, b->phrase) < 0) {
+                dlog(1, "Error writing place information to the csv file, launching will continue\n");
+            }
+            ret = 0;
+        }
+
+        if(selected != NULL) {
+            selector_free_condition(atm->selector, selected);
+        }
+        g_list_free(option);
+        if(ret < 0) {
+            dlog(0, "%s\n", scen->error_message);
+            goto out;
+        }
+    }
+
+    dlog(2, "Appraiser: Spawning APBs for %zu branches\n", nr);
+    pid = appraiser_run_branches(scen, branches, nr, atm->execcon_behavior,
+                                 atm->use_unique_categories);
+
+out:
+    free_am_branches(branches, nr);
+    return pid;
+}
+
 /**
  * Spawns a thread or process executing the APB that will take over the connection.
  */
@@ -349,7 +798,7 @@ int appraiser_spawn_protocol(struct attestation_manager *self, struct scenario *
     struct phrase_meas_spec_pair *ele;
     copland_phrase *selected;
     GList *option = NULL;
-    option = g_list_append(option, copl);
+    GList *branches = NULL;
 
     //Add option passed to attr if its in original appraiser selected options
     ret = g_list_node_compare(g_list_first(scen->current_options)->data, copl);
@@ -360,6 +809,13 @@ int appraiser_spawn_protocol(struct attestation_manager *self, struct scenario *
         return -1;
     }
 
+    ret = parse_copland_branches(copl, atm->loaded_apbs, &branches);
+    if(ret != 0) {
+        return ret < 0 ? ret : appraiser_spawn_branches(atm, scen, branches);
+    }
+
+    option = g_list_append(option, copl);
+
     if(selector_get_first_action(atm->selector, APPRAISER, SPAWN,
                                  ACCEPT, scen, option, &selected) == AM_OK) {
 
@@ -394,6 +850,14 @@ int appraiser_spawn_protocol(struct attestation_manager *self, struct scenario *
             goto out;
         }
 
+        /* one APB appraises every section of a multi-resource request */
+        if(scen->resources != NULL && scen->resources->next != NULL &&
+                (ret = appraiser_section_args(atm, scen, apb, &args)) < 0) {
+            selector_free_condition(atm->selector, selected);
+            scen->error_message = strdup("Failed to appraise the resources together");
+            goto out;
+        }
+
         ret = run_apb_async(apb,
                             atm->execcon_behavior,
                             atm->use_unique_categories,
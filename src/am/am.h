@@ -84,6 +84,21 @@ struct attestation_manager* new_attestation_manager(char *aspdir, char *specdir,
         execcon_unique_categories_t use_unique_categories);
 void free_attestation_manager(struct attestation_manager*);
 
+/**
+ * Return the number of APBs loaded by the attestation manager @self.
+ */
+guint am_nr_loaded_apbs(const struct attestation_manager *self);
+
+/**
+ * Check that @self loaded every ASP, measurement specification and APB
+ * metadata file in @aspdir, @specdir and @apbdir. The loaders skip
+ * files they fail to load, so a malformed file otherwise goes
+ * unnoticed. Returns 0 if all were loaded, -EINVAL if any was skipped
+ * and < 0 if a directory can not be read.
+ */
+int am_check_loaded(const struct attestation_manager *self, const char *aspdir,
+                    const char *specdir, const char *apbdir);
+
 
 /**
  * Get the peer channel for the scenario @scen.
@@ -152,6 +167,14 @@ int appraiser_select_option(struct attestation_manager *self, struct scenario *s
 int attester_spawn_protocol(struct attestation_manager *self,
                             struct scenario *scen,
                             copland_phrase *copl);
+/**
+ * Like attester_spawn_protocol(), for an execute contract with an
+ * option per resource: @phrases and @resources are parallel lists.
+ * One APB is spawned to measure all of the resources together.
+ */
+int attester_spawn_sections(struct attestation_manager *self,
+                            struct scenario *scen,
+                            GList *phrases, GList *resources);
 /**
  * Spawns a process executing the APB that will take over the connection.
  */
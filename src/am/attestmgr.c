@@ -782,6 +782,63 @@ static int create_root_workdir(am_config *cfg)
     return 0;
 }
 
+/**
+ * Load the ASP, APB, measurement specification and selector
+ * configuration again and use it for all new connections.
+ *
+ * Each connection is handled by a fork()ed child holding its own copy
+ * of the attestation manager, so scenarios already in progress finish
+ * with the configuration they started with. The new generation is
+ * built completely before it replaces the current one; if it fails to
+ * load, loads no APBs or skips any metadata file it fails to load
+ * (e.g., because a directory is being rewritten), the current
+ * configuration is kept.
+ *
+ * Returns 0 if the new configuration is in use, < 0 otherwise.
+ */
+static int reload_attestation_manager(am_config *cfg)
+{
+    static unsigned int generation = 0;
+    struct attestation_manager *next;
+    struct attestation_manager *prev;
+
+    dlog(2, "Reloading attestation manager configuration\n");
+
+    next = new_attestation_manager(cfg->asp_metadata_dir,
+                                   cfg->mspec_dir,
+                                   cfg->apb_metadata_dir,
+                                   cfg->selector_source.method,
+                                   cfg->selector_source.loc,
+                                   cfg->execcon_behavior,
+                                   cfg->use_unique_categories);
+    if(next == NULL) {
+        dlog(0, "Error: failed to reload configuration, keeping the current configuration\n");
+        return -1;
+    }
+
+    if(am_nr_loaded_apbs(next) == 0) {
+        dlog(0, "Error: reloaded configuration has no APBs, keeping the current configuration\n");
+        free_attestation_manager(next);
+        return -1;
+    }
+
+    if(am_check_loaded(next, cfg->asp_metadata_dir, cfg->mspec_dir,
+                       cfg->apb_metadata_dir) != 0) {
+        dlog(0, "Error: reloaded configuration is incomplete, keeping the current configuration\n");
+        free_attestation_manager(next);
+        return -1;
+    }
+
+    prev = am;
+    am   = next;
+    free_attestation_manager(prev);
+
+    generation++;
+    dlog(2, "Configuration reloaded (generation %u, %u APBs)\n",
+         generation, am_nr_loaded_apbs(am));
+    return 0;
+}
+
 /**
  * Main function to handle the initial call to the attester/appraiser and to
  * hand the process off to handle_invoke_appraiser or handle_invoke_attester
@@ -877,6 +934,10 @@ int setup_dispatch_loop(int argc, char **argv)
             if(bread!= sizeof(sig)) {
                 dlog(0, "ERROR: Failed to process signal. Aborting.\n");
                 rc = errno;
+            } else if(sig.ssi_signo == SIGHUP) {
+                dlog(2, "Caught SIGHUP\n");
+                reload_attestation_manager(&cfg);
+                continue;
             } else {
                 dlog(0, "Caught signal %d. Cleaning up and exiting\n", sig.ssi_signo);
                 rc = (int)sig.ssi_signo;
@@ -0,0 +1,846 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Runs the APBs for the branches of a branch-parallel Copland phrase
+ * concurrently and joins their evidence and results.
+ */
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include <util/util.h>
+#include <util/base64.h>
+#include <util/maat-io.h>
+#include <util/signfile.h>
+#include <util/xml_util.h>
+
+#include "branches.h"
+#include "contracts.h"
+
+#define BRANCH_OPTION_XPATH "/contract/subcontract/option"
+#define BRANCH_NODE_XPATH BRANCH_OPTION_XPATH "/branch"
+
+struct am_branch *new_am_branches(size_t nr)
+{
+    struct am_branch *branches = calloc(nr, sizeof(struct am_branch));
+    size_t i;
+
+    for(i = 0; branches != NULL && i < nr; i++) {
+        branches[i].chan       = -1;
+        branches[i].resultchan = -1;
+    }
+    return branches;
+}
+
+void free_am_branches(struct am_branch *branches, size_t nr)
+{
+    size_t i;
+
+    if(branches == NULL) {
+        return;
+    }
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+
+        if(b->chan >= 0) {
+            close(b->chan);
+        }
+        if(b->resultchan >= 0) {
+            close(b->resultchan);
+        }
+        free_copland_phrase(b->phrase);
+        free(b->args);
+        free(b->evidence);
+        free(b->response);
+        free(b->result);
+        g_free(b->error);
+    }
+    free(branches);
+}
+
+/*
+ * Marks branch @b as failed with the given reason, unless it already
+ * failed.
+ */
+static void branch_failed(struct am_branch *b, const char *fmt, ...)
+__attribute__((format(printf, 2, 3)));
+
+static void branch_failed(struct am_branch *b, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(b->error != NULL) {
+        return;
+    }
+    va_start(ap, fmt);
+    b->error = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    dlog(1, "Branch %s failed: %s\n", b->phrase->phrase, b->error);
+}
+
+/*
+ * Returns a copy of the execute contract in @scen whose option is the
+ * phrase of branch @b alone, with the signature that no longer holds
+ * removed, or NULL on failure.
+ */
+static char *branch_execute_contract(struct scenario *scen, struct am_branch *b,
+                                     size_t *size)
+{
+    xmlDoc *doc;
+    xmlXPathObject *obj;
+    xmlChar *out = NULL;
+    char *phrase = NULL;
+    int outsize = 0;
+
+    if(scen->size > INT_MAX) {
+        return NULL;
+    }
+    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    if(doc == NULL) {
+        dlog(0, "Failed to parse execute contract\n");
+        return NULL;
+    }
+
+    obj = xpath(doc, BRANCH_OPTION_XPATH "/value");
+    if(obj == NULL || obj->nodesetval == NULL || obj->nodesetval->nodeNr != 1) {
+        dlog(0, "Execute contract of a branch-parallel phrase needs exactly one option\n");
+        goto out;
+    }
+    if(copland_phrase_to_string(b->phrase, &phrase) < 0) {
+        goto out;
+    }
+    xmlNodeSetContent(obj->nodesetval->nodeTab[0], NULL);
+    xmlNodeAddContent(obj->nodesetval->nodeTab[0], (xmlChar *)phrase);
+    xpath_delete_node(doc, "/contract/signature");
+
+    xmlDocDumpMemory(doc, &out, &outsize);
+    if(out != NULL && outsize < 0) {
+        xmlFree(out);
+        out = NULL;
+    }
+    *size = (size_t)outsize;
+
+out:
+    free(phrase);
+    if(obj != NULL) {
+        xmlXPathFreeObject(obj);
+    }
+    xmlFreeDoc(doc);
+    return (char *)out;
+}
+
+/*
+ * Creates a socket pair whose first end the AM keeps (closed on exec)
+ * and whose second end is passed to an APB. Returns 0 on success.
+ */
+static int branch_socketpair(int sv[2])
+{
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        dperror("Failed to create channel for branch APB");
+        return -1;
+    }
+    if(fcntl(sv[0], F_SETFD, FD_CLOEXEC) != 0) {
+        dperror("Failed to set close on exec");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Launches the APB of branch @b with its peer channel (and, if
+ * @with_result, its result channel) connected to the AM. On the
+ * attester the APB gets an execute contract with only its branch's
+ * phrase. Returns 0 on success, < 0 on error.
+ */
+static int launch_branch(struct scenario *scen, struct am_branch *b, int with_result,
+                         respect_desired_execcon_t execcon_behavior,
+                         execcon_unique_categories_t use_unique_categories)
+{
+    int peer[2], result[2] = {-1, -1};
+    char *contract = scen->contract;
+    size_t size = scen->size;
+    char *branch_contract = NULL;
+    pid_t pid;
+
+    if(branch_socketpair(peer) < 0) {
+        return -1;
+    }
+    if(with_result && branch_socketpair(result) < 0) {
+        close(peer[0]);
+        close(peer[1]);
+        return -1;
+    }
+
+    if(!with_result) {
+        branch_contract = branch_execute_contract(scen, b, &scen->size);
+        if(branch_contract == NULL) {
+            scen->size = size;
+            pid = -1;
+            goto out;
+        }
+        scen->contract = branch_contract;
+    }
+
+    dlog(2, "Spawning APB %s for branch %s\n", b->apb->name, b->phrase->phrase);
+    pid = run_apb_async(b->apb, execcon_behavior, use_unique_categories,
+                        scen, b->spec_uuid, peer[1], result[1],
+                        with_result ? scen->attester_hostname : NULL,
+                        with_result ? scen->target_type : NULL,
+                        with_result ? scen->resource : NULL,
+                        b->args);
+    if(pid == 0) {
+        /* the APB failed to exec() */
+        _exit(1);
+    }
+    scen->contract = contract;
+    scen->size     = size;
+    xmlFree(branch_contract);
+
+out:
+    close(peer[1]);
+    if(result[1] >= 0) {
+        close(result[1]);
+    }
+    if(pid < 0) {
+        close(peer[0]);
+        if(result[0] >= 0) {
+            close(result[0]);
+        }
+        return -1;
+    }
+    b->pid        = pid;
+    b->chan       = peer[0];
+    b->resultchan = result[0];
+    return 0;
+}
+
+/*
+ * Waits for the APB of branch @b to exit and fails the branch if it
+ * did not exit successfully.
+ */
+static void reap_branch(struct am_branch *b)
+{
+    int status;
+
+    if(b->pid <= 0) {
+        return;
+    }
+    while(waitpid(b->pid, &status, 0) < 0) {
+        if(errno != EINTR) {
+            branch_failed(b, "Failed to wait for APB %s: %s", b->apb->name,
+                          strerror(errno));
+            b->pid = 0;
+            return;
+        }
+    }
+    b->pid = 0;
+
+    if(WIFSIGNALED(status)) {
+        branch_failed(b, "APB %s was killed by signal %d", b->apb->name,
+                      WTERMSIG(status));
+    } else if(WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        branch_failed(b, "APB %s exited with status %d", b->apb->name,
+                      WEXITSTATUS(status));
+    }
+}
+
+/*
+ * Reads one buffer from @chan into *@buf. Returns 0 on success or a
+ * description of the failure.
+ */
+static const char *read_branch_buf(int chan, unsigned char **buf, size_t *size)
+{
+    int eof_encountered = 0;
+    int status;
+
+    status = maat_read_sz_buf(chan, buf, size, NULL, &eof_encountered,
+                              AM_BRANCH_TIMEOUT, 0);
+    if(status == 0 && !eof_encountered) {
+        return NULL;
+    }
+    free(*buf);
+    *buf  = NULL;
+    *size = 0;
+    if(status == EAGAIN || status == -EAGAIN) {
+        return "timed out";
+    }
+    return "sent nothing";
+}
+
+static int write_joined(int chan, unsigned char *buf, size_t size)
+{
+    size_t written = 0;
+    int status;
+
+    status = maat_write_sz_buf(chan, buf, size, &written, AM_BRANCH_TIMEOUT);
+    if(status != 0 || written != size + sizeof(uint32_t)) {
+        dlog(0, "Failed to send joined contract: %s\n",
+             strerror(status < 0 ? -status : status));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Body of the process forked by attester_run_branches().
+ */
+static int attester_join_branches(struct scenario *scen, struct am_branch *branches,
+                                  size_t nr, respect_desired_execcon_t execcon_behavior,
+                                  execcon_unique_categories_t use_unique_categories)
+{
+    unsigned char *joined = NULL;
+    size_t joined_size = 0;
+    const char *err;
+    size_t i;
+    int ret;
+
+    /* every branch starts before any is waited on */
+    for(i = 0; i < nr; i++) {
+        if(launch_branch(scen, &branches[i], 0, execcon_behavior,
+                         use_unique_categories) < 0) {
+            branch_failed(&branches[i], "Failed to launch APB %s", branches[i].apb->name);
+        }
+    }
+
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+
+        if(b->chan < 0) {
+            continue;
+        }
+        err = read_branch_buf(b->chan, &b->evidence, &b->evidence_size);
+        if(err != NULL) {
+            branch_failed(b, "APB %s %s", b->apb->name, err);
+        }
+        close(b->chan);
+        b->chan = -1;
+        reap_branch(b);
+    }
+
+    ret = create_branch_measurement_contract(scen, branches, nr, &joined, &joined_size);
+    if(ret == 0) {
+        dlog(5, "PRESENTATION MODE (self): Attester sends joined measurement contract of %zu branches\n", nr);
+        ret = write_joined(scen->peer_chan, joined, joined_size);
+    }
+    free(joined);
+    return ret;
+}
+
+/*
+ * Returns the text of the result node of the integrity response @doc,
+ * or NULL if it has none.
+ */
+static char *response_result(xmlDoc *doc)
+{
+    xmlXPathObject *obj = xpath(doc, "/contract/result");
+    char *result = NULL;
+
+    if(obj != NULL && obj->nodesetval != NULL && obj->nodesetval->nodeNr > 0) {
+        result = xmlNodeGetContentASCII(obj->nodesetval->nodeTab[0]);
+    }
+    if(obj != NULL) {
+        xmlXPathFreeObject(obj);
+    }
+    return result;
+}
+
+/*
+ * Body of the process forked by appraiser_run_branches().
+ */
+static int appraiser_join_branches(struct scenario *scen, struct am_branch *branches,
+                                   size_t nr, respect_desired_execcon_t execcon_behavior,
+                                   execcon_unique_categories_t use_unique_categories)
+{
+    unsigned char *joined = NULL;
+    size_t joined_size = 0;
+    const char *err;
+    size_t i;
+    int ret = 0;
+
+    err = read_branch_buf(scen->peer_chan, &joined, &joined_size);
+    if(err != NULL) {
+        dlog(0, "Attester %s measurement contract\n", err);
+        ret = -1;
+    } else {
+        dlog(5, "PRESENTATION MODE (in): Appraiser receives joined measurement contract\n");
+        ret = read_branch_measurement_contract(scen, joined, joined_size, branches, nr);
+    }
+    free(joined);
+    joined = NULL;
+    if(ret < 0) {
+        for(i = 0; i < nr; i++) {
+            branch_failed(&branches[i], "No valid measurement contract from the attester");
+        }
+    }
+
+    for(i = 0; i < nr; i++) {
+        if(branches[i].error == NULL &&
+                launch_branch(scen, &branches[i], 1, execcon_behavior,
+                              use_unique_categories) < 0) {
+            branch_failed(&branches[i], "Failed to launch APB %s", branches[i].apb->name);
+        }
+    }
+
+    /* the APBs appraise concurrently, each as soon as it has its evidence */
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+
+        if(b->chan < 0) {
+            continue;
+        }
+        if(write_joined(b->chan, b->evidence, b->evidence_size) < 0) {
+            branch_failed(b, "Failed to send measurement contract to APB %s", b->apb->name);
+        }
+        close(b->chan);
+        b->chan = -1;
+    }
+
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+        xmlDoc *doc;
+
+        if(b->resultchan < 0) {
+            continue;
+        }
+        err = read_branch_buf(b->resultchan, &b->response, &b->response_size);
+        close(b->resultchan);
+        b->resultchan = -1;
+        reap_branch(b);
+        if(err != NULL) {
+            branch_failed(b, "APB %s %s", b->apb->name, err);
+            continue;
+        }
+
+        doc = b->response_size <= INT_MAX ?
+              xmlReadMemory((char *)b->response, (int)b->response_size, NULL, NULL, 0) : NULL;
+        if(doc != NULL) {
+            b->result = response_result(doc);
+            xmlFreeDoc(doc);
+        }
+        if(b->result == NULL) {
+            branch_failed(b, "APB %s sent a malformed integrity response", b->apb->name);
+        }
+    }
+
+    ret = create_branch_response(scen, branches, nr, &joined, &joined_size);
+    if(ret == 0) {
+        dlog(5, "PRESENTATION MODE (self): Appraiser sends joined integrity response\n");
+        ret = write_joined(scen->requester_chan, joined, joined_size);
+    }
+    free(joined);
+    return ret;
+}
+
+typedef int (*join_fn)(struct scenario *scen, struct am_branch *branches, size_t nr,
+                       respect_desired_execcon_t execcon_behavior,
+                       execcon_unique_categories_t use_unique_categories);
+
+static pid_t fork_joiner(join_fn join, struct scenario *scen, struct am_branch *branches,
+                         size_t nr, respect_desired_execcon_t execcon_behavior,
+                         execcon_unique_categories_t use_unique_categories)
+{
+    pid_t pid;
+
+    pid = fork();
+    if(pid < 0) {
+        dperror("Error forking to join branches");
+        return -1;
+    }
+    if(pid == 0) {
+        /* the APBs are reaped here, not by the AM's handler */
+        signal(SIGCHLD, SIG_DFL);
+        _exit(join(scen, branches, nr, execcon_behavior,
+                   use_unique_categories) == 0 ? 0 : 1);
+    }
+    return pid;
+}
+
+pid_t attester_run_branches(struct scenario *scen, struct am_branch *branches,
+                            size_t nr, respect_desired_execcon_t execcon_behavior,
+                            execcon_unique_categories_t use_unique_categories)
+{
+    return fork_joiner(attester_join_branches, scen, branches, nr,
+                       execcon_behavior, use_unique_categories);
+}
+
+pid_t appraiser_run_branches(struct scenario *scen, struct am_branch *branches,
+                             size_t nr, respect_desired_execcon_t execcon_behavior,
+                             execcon_unique_categories_t use_unique_categories)
+{
+    return fork_joiner(appraiser_join_branches, scen, branches, nr,
+                       execcon_behavior, use_unique_categories);
+}
+
+/*
+ * Adds a node for branch @index to @parent, with its phrase and
+ * @status as attributes. Returns the node or NULL on failure.
+ */
+static xmlNode *new_branch_node(xmlNode *parent, size_t index, struct am_branch *b,
+                                const char *status_attr, const char *status)
+{
+    char index_str[24];
+    char *phrase = NULL;
+    xmlNode *node;
+
+    if(copland_phrase_to_string(b->phrase, &phrase) < 0) {
+        return NULL;
+    }
+    snprintf(index_str, sizeof(index_str), "%zu", index);
+
+    node = xmlNewChild(parent, NULL, (xmlChar *)"branch", NULL);
+    if(node == NULL ||
+            xmlNewProp(node, (xmlChar *)"index", (xmlChar *)index_str) == NULL ||
+            xmlNewProp(node, (xmlChar *)"phrase", (xmlChar *)phrase) == NULL ||
+            xmlNewProp(node, (xmlChar *)status_attr, (xmlChar *)status) == NULL) {
+        dlog(0, "Failed to create branch node\n");
+        node = NULL;
+    }
+    free(phrase);
+    return node;
+}
+
+/*
+ * Adds @buf, base64 encoded, to @node as a child named @name, or the
+ * error of @b as a message node if @buf is NULL. Returns 0 on success.
+ */
+static int add_branch_content(xmlNode *node, const char *name, struct am_branch *b,
+                              unsigned char *buf, size_t size)
+{
+    char *b64;
+    xmlNode *child;
+
+    if(buf == NULL) {
+        child = xmlNewTextChild(node, NULL, (xmlChar *)"message",
+                                (xmlChar *)(b->error ? b->error : "No evidence"));
+        return child == NULL ? -1 : 0;
+    }
+
+    b64 = b64_encode(buf, size);
+    if(b64 == NULL) {
+        dlog(0, "Failed to encode %s of branch %s\n", name, b->phrase->phrase);
+        return -1;
+    }
+    child = xmlNewTextChild(node, NULL, (xmlChar *)name, (xmlChar *)b64);
+    b64_free(b64);
+    return child == NULL ? -1 : 0;
+}
+
+static int dump_doc(xmlDoc *doc, unsigned char **out, size_t *outsize)
+{
+    int size = 0;
+
+    *out = NULL;
+    xmlDocDumpMemory(doc, (xmlChar **)out, &size);
+    if(*out == NULL || size < 0) {
+        dlog(0, "Failed to serialize contract\n");
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+    *outsize = (size_t)size;
+    return 0;
+}
+
+int create_branch_measurement_contract(struct scenario *scen,
+                                       struct am_branch *branches, size_t nr,
+                                       unsigned char **out, size_t *outsize)
+{
+    xmlDoc *doc;
+    xmlNode *root, *opt, *node;
+    xmlXPathObject *obj = NULL;
+    char *fprint = NULL;
+    size_t i;
+    int ret = -1;
+
+    *out     = NULL;
+    *outsize = 0;
+
+    if(scen->size > INT_MAX) {
+        return -1;
+    }
+    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    if(doc == NULL || (root = xmlDocGetRootElement(doc)) == NULL) {
+        dlog(0, "Failed to parse execute contract\n");
+        goto out;
+    }
+
+    obj = xpath(doc, BRANCH_OPTION_XPATH);
+    if(obj == NULL || obj->nodesetval == NULL || obj->nodesetval->nodeNr != 1) {
+        dlog(0, "Execute contract of a branch-parallel phrase needs exactly one option\n");
+        goto out;
+    }
+    opt = obj->nodesetval->nodeTab[0];
+
+    xmlSetProp(root, (xmlChar *)"type", (xmlChar *)"measurement");
+    /* the evidence of every branch is base64 encoded in the XML */
+    xmlUnsetProp(root, (xmlChar *)DETACHED_PAYLOAD_ATTR);
+
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+        int ok = b->evidence != NULL && b->error == NULL;
+
+        node = new_branch_node(opt, i, b, "status", ok ? "ok" : "failed");
+        if(node == NULL ||
+                add_branch_content(node, "evidence", b, ok ? b->evidence : NULL,
+                                   b->evidence_size) < 0) {
+            goto out;
+        }
+    }
+
+    xpath_delete_node(doc, "/contract/signature");
+
+    /* the AM vouches for the joined evidence */
+    fprint = get_fingerprint(scen->certfile, NULL);
+    if(sign_xml(doc, opt->parent, fprint, scen->keyfile, scen->keypass, scen->nonce,
+                scen->tpmpass, scen->akctx,
+                scen->sign_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL) != 0) {
+        dlog(0, "Failed to sign joined measurement contract\n");
+        goto out;
+    }
+
+    do {
+        char contractfile[201];
+        snprintf(contractfile, 200, "%s/measurement_contract.xml", scen->workdir);
+        save_document(doc, contractfile);
+    } while(0);
+
+    ret = dump_doc(doc, out, outsize);
+
+out:
+    free(fprint);
+    if(obj != NULL) {
+        xmlXPathFreeObject(obj);
+    }
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+int read_branch_measurement_contract(struct scenario *scen,
+                                     const unsigned char *contract, size_t size,
+                                     struct am_branch *branches, size_t nr)
+{
+    xmlDoc *doc;
+    xmlNode *root, *subc;
+    xmlXPathObject *obj = NULL;
+    char creddir[201];
+    char *type = NULL;
+    size_t i;
+    int ret = -1;
+    int n;
+
+    if(size > INT_MAX) {
+        dlog(0, "Joined measurement contract is too big\n");
+        return -1;
+    }
+    doc = xmlReadMemory((const char *)contract, (int)size, NULL, NULL, 0);
+    if(doc == NULL || (root = xmlDocGetRootElement(doc)) == NULL) {
+        dlog(0, "Failed to parse joined measurement contract\n");
+        goto out;
+    }
+
+    type = xmlGetPropASCII(root, "type");
+    if(type == NULL || strcasecmp(type, "measurement") != 0) {
+        dlog(0, "Not a measurement contract\n");
+        goto out;
+    }
+
+    obj = xpath(doc, BRANCH_OPTION_XPATH);
+    if(obj == NULL || obj->nodesetval == NULL || obj->nodesetval->nodeNr != 1) {
+        dlog(0, "Joined measurement contract needs exactly one option\n");
+        goto out;
+    }
+    subc = obj->nodesetval->nodeTab[0]->parent;
+    xmlXPathFreeObject(obj);
+    obj = NULL;
+
+    snprintf(creddir, 200, "%s/cred", scen->workdir);
+    if(verify_xml(doc, subc, creddir, scen->nonce, scen->akpubkey,
+                  scen->verify_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL,
+                  scen->cacert) != 1) {
+        dlog(0, "Joined measurement contract signature failed\n");
+        goto out;
+    }
+
+    obj = xpath(doc, BRANCH_NODE_XPATH);
+    for(n = 0; obj != NULL && obj->nodesetval != NULL && n < obj->nodesetval->nodeNr; n++) {
+        xmlNode *node = obj->nodesetval->nodeTab[n];
+        char *index = xmlGetPropASCII(node, "index");
+        char *phrase = xmlGetPropASCII(node, "phrase");
+        char *status = xmlGetPropASCII(node, "status");
+        char *expected = NULL;
+        struct am_branch *b = NULL;
+        xmlNode *child;
+        char *end;
+        unsigned long idx;
+
+        idx = index ? strtoul(index, &end, 10) : ULONG_MAX;
+        if(index != NULL && *end == '\0' && idx < nr) {
+            b = &branches[idx];
+        }
+        if(b == NULL || phrase == NULL || status == NULL || b->evidence != NULL ||
+                copland_phrase_to_string(b->phrase, &expected) < 0 ||
+                strcmp(expected, phrase) != 0) {
+            dlog(1, "Ignoring unexpected branch %s (%s)\n", index ? index : "(none)",
+                 phrase ? phrase : "(none)");
+            goto next;
+        }
+
+        for(child = node->children; child != NULL; child = child->next) {
+            char *name = validate_cstring_ascii(child->name, SIZE_MAX);
+            char *text;
+
+            if(child->type != XML_ELEMENT_NODE || name == NULL) {
+                continue;
+            }
+            text = xmlNodeGetContentASCII(child);
+            if(strcasecmp(status, "ok") == 0 && strcmp(name, "evidence") == 0 && text != NULL) {
+                b->evidence = b64_decode(text, &b->evidence_size);
+            } else if(strcmp(name, "message") == 0) {
+                branch_failed(b, "Attester: %s", text ? text : "failed");
+            }
+            free(text);
+        }
+
+next:
+        free(expected);
+        free(index);
+        free(phrase);
+        free(status);
+    }
+
+    for(i = 0; i < nr; i++) {
+        if(branches[i].evidence == NULL) {
+            branch_failed(&branches[i], "Attester sent no evidence");
+        }
+    }
+    ret = 0;
+
+out:
+    if(obj != NULL) {
+        xmlXPathFreeObject(obj);
+    }
+    free(type);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+int create_branch_response(struct scenario *scen, struct am_branch *branches,
+                           size_t nr, unsigned char **out, size_t *outsize)
+{
+    xmlDoc *doc;
+    xmlNode *root, *node;
+    const char *result = "PASS";
+    char *fprint = NULL;
+    size_t i;
+    int ret = -1;
+
+    *out     = NULL;
+    *outsize = 0;
+
+    for(i = 0; i < nr; i++) {
+        if(branches[i].error == NULL && branches[i].result != NULL &&
+                strcasecmp(branches[i].result, "PASS") == 0) {
+            continue;
+        }
+        if(branches[i].error == NULL) {
+            result = "FAIL";
+        } else if(strcmp(result, "PASS") == 0) {
+            result = "ERROR";
+        }
+    }
+
+    doc  = xmlNewDoc((xmlChar *)"1.0");
+    root = xmlNewNode(NULL, (xmlChar *)"contract");
+    if(doc == NULL || root == NULL) {
+        dlog(0, "Failed to create integrity response\n");
+        xmlFreeNode(root);
+        goto out;
+    }
+    xmlDocSetRootElement(doc, root);
+
+    if(xmlNewProp(root, (xmlChar *)"version", (xmlChar *)MAAT_CONTRACT_VERSION) == NULL ||
+            xmlNewProp(root, (xmlChar *)"type", (xmlChar *)"response") == NULL) {
+        dlog(0, "Failed to create integrity response attributes\n");
+        goto out;
+    }
+    if((node = xmlNewTextChild(root, NULL, (xmlChar *)"target",
+                               (xmlChar *)scen->attester_hostname)) == NULL ||
+            xmlNewProp(node, (xmlChar *)"type", (xmlChar *)scen->target_type) == NULL ||
+            xmlNewTextChild(root, NULL, (xmlChar *)"resource", (xmlChar *)scen->resource) == NULL ||
+            xmlNewTextChild(root, NULL, (xmlChar *)"result", (xmlChar *)result) == NULL) {
+        dlog(0, "Failed to create integrity response\n");
+        goto out;
+    }
+
+    /* each branch's own signed response, or why there is none */
+    for(i = 0; i < nr; i++) {
+        struct am_branch *b = &branches[i];
+        const char *branch_result = b->error ? "ERROR" : b->result;
+
+        node = new_branch_node(root, i, b, "result", branch_result);
+        if(node == NULL ||
+                add_branch_content(node, "response", b, b->error ? NULL : b->response,
+                                   b->response_size) < 0) {
+            goto out;
+        }
+    }
+
+    if(scen->certfile != NULL && scen->keyfile != NULL) {
+        if((node = create_credential_node(scen->certfile)) == NULL) {
+            dlog(0, "Failed to create credential node in integrity response\n");
+            goto out;
+        }
+        xmlAddChild(root, node);
+        if(scen->nonce != NULL &&
+                xmlNewTextChild(root, NULL, (xmlChar *)"nonce", (xmlChar *)scen->nonce) == NULL) {
+            dlog(0, "Failed to add nonce node to integrity response\n");
+            goto out;
+        }
+
+        fprint = get_fingerprint(scen->certfile, NULL);
+        if(sign_xml(doc, root, fprint, scen->keyfile, scen->keypass, scen->nonce,
+                    scen->tpmpass, scen->akctx,
+                    scen->sign_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL) != 0) {
+            dlog(0, "Failed to sign integrity response contract\n");
+            goto out;
+        }
+    }
+
+    ret = dump_doc(doc, out, outsize);
+
+out:
+    free(fprint);
+    xmlFreeDoc(doc);
+    return ret;
+}
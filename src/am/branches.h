@@ -0,0 +1,155 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Branch-parallel execution of Copland phrases. The APBs carrying out
+ * the branches of a phrase such as
+ *
+ *   ((USM mtab) -> SIG) ~ ((USM full) -> SIG)
+ *
+ * are launched at the same time against the same scenario, and the AM
+ * joins what they produce under a single signature.
+ *
+ * On the attester, each branch APB sends its measurement contract to
+ * the AM instead of the appraiser. The AM sends the appraiser a single
+ * measurement contract holding the contract of every branch, or the
+ * reason a branch failed, signed with its own key.
+ *
+ * On the appraiser, the AM takes that contract apart, hands each
+ * branch's measurement contract to the appraiser APB for the branch
+ * and sends the requester a single integrity response with the result
+ * of every branch. The response passes only if every branch passes.
+ */
+
+#ifndef __MAAT_AM_BRANCHES_H__
+#define __MAAT_AM_BRANCHES_H__
+
+#include <sys/types.h>
+#include <uuid/uuid.h>
+#include <common/apb_info.h>
+#include <common/copland.h>
+#include <common/scenario.h>
+#include <common/exe_sec_ctxt.h>
+
+/**
+ * Seconds the AM waits on the APB of a branch or on the peer, as long
+ * as an appraiser APB waits for its measurement contract.
+ */
+#define AM_BRANCH_TIMEOUT 10000
+
+/**
+ * One branch of a branch-parallel phrase.
+ */
+struct am_branch {
+    /* the attester's phrase for the branch */
+    copland_phrase *phrase;
+    /* the APB carrying out the branch on this side, its measurement
+       specification and arguments */
+    struct apb *apb;
+    uuid_t spec_uuid;
+    char *args;
+
+    /* the running APB and the AM's ends of its channels */
+    pid_t pid;
+    int chan;
+    int resultchan;
+
+    /* the measurement contract of the branch */
+    unsigned char *evidence;
+    size_t evidence_size;
+
+    /* on the appraiser, the integrity response of the branch and its
+       result */
+    unsigned char *response;
+    size_t response_size;
+    char *result;
+
+    /* why the branch failed, NULL if it did not */
+    char *error;
+};
+
+/**
+ * Allocates @nr branches with no APB running. Returns NULL on failure.
+ */
+struct am_branch *new_am_branches(size_t nr);
+
+/**
+ * Frees @nr branches along with their phrases, closing any channel
+ * still open.
+ */
+void free_am_branches(struct am_branch *branches, size_t nr);
+
+/**
+ * Forks a process that runs the APBs of the @nr @branches on the
+ * attester concurrently, waits for them all and sends the joined
+ * measurement contract over scen->peer_chan.
+ *
+ * Returns the pid of the process, or < 0 on error.
+ */
+pid_t attester_run_branches(struct scenario *scen, struct am_branch *branches,
+                            size_t nr, respect_desired_execcon_t execcon_behavior,
+                            execcon_unique_categories_t use_unique_categories);
+
+/**
+ * Forks a process that reads the joined measurement contract from
+ * scen->peer_chan, runs the appraiser APBs of the @nr @branches on it
+ * concurrently and sends the joined integrity response over
+ * scen->requester_chan.
+ *
+ * Returns the pid of the process, or < 0 on error.
+ */
+pid_t appraiser_run_branches(struct scenario *scen, struct am_branch *branches,
+                             size_t nr, respect_desired_execcon_t execcon_behavior,
+                             execcon_unique_categories_t use_unique_categories);
+
+/**
+ * Builds the joined measurement contract from the execute contract in
+ * scen->contract and the evidence or error of each of the @nr
+ * @branches, and signs it with scen->keyfile. The contract is returned
+ * in *@out, which the caller must free().
+ *
+ * Returns 0 on success, < 0 on error.
+ */
+int create_branch_measurement_contract(struct scenario *scen,
+                                       struct am_branch *branches, size_t nr,
+                                       unsigned char **out, size_t *outsize);
+
+/**
+ * Verifies the joined measurement @contract against the credentials
+ * saved in the work directory and sets the evidence of each of the
+ * @nr @branches, or its error if the attester reports it failed or
+ * sent nothing for it.
+ *
+ * Returns 0 if the contract is valid, even if some branches failed,
+ * and < 0 otherwise.
+ */
+int read_branch_measurement_contract(struct scenario *scen,
+                                     const unsigned char *contract, size_t size,
+                                     struct am_branch *branches, size_t nr);
+
+/**
+ * Builds the integrity response joining the results of the @nr
+ * @branches, signed with scen->keyfile. The result is PASS if every
+ * branch passed, FAIL if one failed appraisal and ERROR otherwise.
+ * The response is returned in *@out, which the caller must free().
+ *
+ * Returns 0 on success, < 0 on error.
+ */
+int create_branch_response(struct scenario *scen, struct am_branch *branches,
+                           size_t nr, unsigned char **out, size_t *outsize);
+
+#endif /* __MAAT_AM_BRANCHES_H__ */
@@ -270,6 +270,7 @@ static int get_targ_and_resource_info(struct scenario *scenario,
     char *nonce;
     char *info;
     char *tunnel;
+    int i;
 
     if(contract_size > INT_MAX) {
         dlog(0, "Error: contract is too large (%zd bytes)\n",
@@ -331,12 +332,37 @@ static int get_targ_and_resource_info(struct scenario *scenario,
         scenario->attester_tunnel_path = NULL;
     }
 
-    resource = xpath_get_content(doc, "/contract/resource");
-    if(resource == NULL) {
+    xmlXPathFreeObject(obj);
+    obj = xpath(doc, "/contract/resource");
+    if(obj == NULL || obj->nodesetval == NULL) {
+        goto error;
+    }
+    for(i = 0; i < obj->nodesetval->nodeNr; i++) {
+        if(obj->nodesetval->nodeTab[i]->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        resource = xmlNodeGetContentASCII(obj->nodesetval->nodeTab[i]);
+        if(resource == NULL || *resource == '\0') {
+            dlog(0, "Integrity request has an empty resource\n");
+            free(resource);
+            goto error;
+        }
+        if(g_list_find_custom(scenario->resources, resource,
+                              (GCompareFunc)strcmp) != NULL) {
+            dlog(2, "Ignoring repeated resource %s\n", resource);
+            free(resource);
+            continue;
+        }
+        scenario->resources = g_list_append(scenario->resources, resource);
+        dlog(7, "DEBUG: resource = %s\n", resource);
+    }
+    if(scenario->resources == NULL) {
+        goto error;
+    }
+    scenario->resource = strdup(scenario->resources->data);
+    if(scenario->resource == NULL) {
         goto error;
     }
-    scenario->resource = resource;
-    dlog(7, "DEBUG: resource = %s\n", scenario->resource);
 
     nonce = xpath_get_content(doc, "/contract/nonce");
 
@@ -368,12 +394,14 @@ error:
     free(scenario->attester_hostname);
     free(scenario->attester_tunnel_path);
     free(scenario->resource);
+    g_list_free_full(scenario->resources, free);
     free(scenario->target_fingerprint);
     b64_free(scenario->info);
     scenario->attester_hostname		= NULL;
     scenario->attester_tunnel_path	= NULL;
     scenario->attester_portnum		= ULONG_MAX;
     scenario->resource			= NULL;
+    scenario->resources			= NULL;
     scenario->target_fingerprint        = NULL;
     scenario->info                      = NULL;
     xmlXPathFreeObject(obj);
@@ -706,6 +734,37 @@ xml_parse_failed:
     return -1;
 }
 
+/*
+ * Adds an option to @subc for each resource of a multi-resource
+ * request, naming the resource in its resource attribute. The
+ * phrases chosen for them are in scen->current_options.
+ */
+static int add_section_options(struct scenario *scen, xmlNode *subc)
+{
+    GList *r, *p;
+    xmlNode *optnode;
+    char *opt;
+
+    for(r = scen->resources, p = scen->current_options; r != NULL && p != NULL;
+            r = r->next, p = p->next) {
+        if(copland_phrase_to_string(p->data, &opt) < 0) {
+            dlog(1, "Unable to parse copland phrase into string\n");
+            return -1;
+        }
+
+        create_option_node(opt, subc);
+        free(opt);
+
+        optnode = xmlGetLastChild(subc);
+        if(optnode == NULL ||
+                xmlNewProp(optnode, (xmlChar*)"resource", (xmlChar*)r->data) == NULL) {
+            dlog(1, "Unable to add option for resource %s\n", (char *)r->data);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /*
  * Appraiser chooses the measurements that it can provide to the
  * attester and creates a modified contract
@@ -818,7 +877,12 @@ int handle_modified_contract(struct attestation_manager *manager,
         goto out;
     }
 
-    if(selected != NULL) {
+    if(selected != NULL && scen->resources != NULL && scen->resources->next != NULL) {
+        rc = add_section_options(scen, subc);
+        if(rc < 0) {
+            goto out;
+        }
+    } else if(selected != NULL) {
         rc = copland_phrase_to_string(selected, &opt);
         if(rc < 0) {
             dlog(1, "Unable to parse copland phrase into string\n");
@@ -835,6 +899,9 @@ int handle_modified_contract(struct attestation_manager *manager,
     /* add the nonce back in, as part of the main contract */
     xmlNewTextChild(root, NULL, (xmlChar*)"nonce", (xmlChar*)scen->nonce);
 
+    /* let the attester send the measurement after the XML instead of base64 encoding it */
+    xmlSetProp(root, (xmlChar*)DETACHED_PAYLOAD_ATTR, (xmlChar*)DETACHED_PAYLOAD_VALUE);
+
     /* sign contract with that cert */
     fingerprint = get_fingerprint(scen->certfile, NULL);
     rc = sign_xml(doc, root, fingerprint, scen->keyfile, scen->keypass, scen->nonce,
@@ -945,20 +1012,22 @@ int handle_execute_cache_hit_setup(struct attestation_manager *manager,
     if (obj && obj->nodesetval && obj->nodesetval->nodeNr > 0) {
         char *phrase = NULL;
 
+        /* a multi-resource contract has an option per resource */
         for (i=0; i < obj->nodesetval->nodeNr; i++) {
-            if (obj->nodesetval->nodeTab[i]->type == XML_ELEMENT_NODE) {
-                phrase = parse_option_node(obj->nodesetval->nodeTab[i]);
-                break;
+            if (obj->nodesetval->nodeTab[i]->type != XML_ELEMENT_NODE) {
+                continue;
+            }
+            phrase = parse_option_node(obj->nodesetval->nodeTab[i]);
+            if(phrase == NULL) {
+                continue;
             }
-        }
-
-        if(phrase != NULL) {
             dlog(6, "Found option.\n");
 
             ret = am_parse_copland(manager, phrase, &copl);
             if(ret != 0) {
                 dlog(1, "Unable to parse option phrase %s\n", phrase);
                 free(phrase);
+                xmlXPathFreeObject(obj);
                 goto out;
             }
 
@@ -974,6 +1043,53 @@ out:
     return ret;
 }
 
+/*
+ * Spawns the APB for an execute contract with an option per resource
+ * of a multi-resource request. Every option must name its resource.
+ */
+static int handle_section_options(struct attestation_manager *manager,
+                                  struct scenario *scen, xmlXPathObject *obj)
+{
+    GList *phrases = NULL, *resources = NULL;
+    copland_phrase *copl;
+    char *phrase, *resource;
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < obj->nodesetval->nodeNr && ret == 0; i++) {
+        xmlNode *optnode = obj->nodesetval->nodeTab[i];
+
+        if (optnode->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+
+        phrase   = parse_option_node(optnode);
+        resource = xmlGetPropASCII(optnode, "resource");
+        if (phrase == NULL || resource == NULL) {
+            dlog(0, "Option of a multi-resource execute contract is incomplete\n");
+            ret = -1;
+        } else if ((ret = am_parse_copland(manager, phrase, &copl)) != 0) {
+            dlog(1, "Unable to parse option phrase %s\n", phrase);
+        } else {
+            dlog(5, "PRESENTATION MODE (self): %s for resource %s\n", phrase, resource);
+            phrases   = g_list_append(phrases, copl);
+            resources = g_list_append(resources, strdup(resource));
+        }
+        free(phrase);
+        xmlFree(resource);
+    }
+
+    if (ret == 0) {
+        dlog(5, "PRESENTATION MODE (in): Attester receives execute contract for %u resources\n",
+             g_list_length(resources));
+        ret = attester_spawn_sections(manager, scen, phrases, resources);
+    }
+
+    g_list_free_full(phrases, (GDestroyNotify)free_copland_phrase);
+    g_list_free_full(resources, free);
+    return ret;
+}
+
 /**
  * Attester has the chance to spawn its thread for the APB
  */
@@ -1061,7 +1177,9 @@ int handle_execute_contract(struct attestation_manager *manager,
      */
 
     obj = xpath(doc, "/contract/subcontract/option");
-    if (obj && obj->nodesetval && obj->nodesetval->nodeNr > 0) {
+    if (obj && obj->nodesetval && obj->nodesetval->nodeNr > 1) {
+        ret = handle_section_options(manager, scen, obj);
+    } else if (obj && obj->nodesetval && obj->nodesetval->nodeNr > 0) {
         char *phrase = NULL;
 
         for (i=0; i < obj->nodesetval->nodeNr; i++) {
@@ -272,8 +272,6 @@ static int load_condition(unsigned int xml_version UNUSED, xmlNode *node,
     int rtn = 0;
     char *scratch = NULL, *stripped = NULL;
     copland_phrase *temp = NULL;
-    GList *l = NULL;
-    struct apb *apb = NULL;
 
     scratch = xmlGetPropASCII(node, PHRASE_FIELD);
     if(scratch == NULL || strlen(scratch) == 0) {
@@ -288,15 +286,8 @@ static int load_condition(unsigned int xml_version UNUSED, xmlNode *node,
         return -1;
     }
 
-    for(l = (GList *)apbs; l && l->data; l = g_list_next(l)) {
-        apb = (struct apb *)l->data;
-
-        if(parse_copland_from_pair_list(stripped, apb->phrase_specs, &temp) >= 0) {
-            break;
-        }
-    }
-
-    if(temp == NULL) {
+    /* a branch-parallel phrase may be carried out by several APBs */
+    if(parse_copland_from_apb_list(stripped, apbs, &temp) < 0) {
         dlog(0, "Error: Unable to find APB to execute Copland Phrase %s in selection policy\n", stripped);
         free(stripped);
         return -1;
@@ -18,16 +18,35 @@
 /**
  * mongo_selector.c: Implementation of the selector interface for loading
  * and querying a selector policy.
+ *
+ * By default every selector call queries the database. With a location
+ * of the form "snapshot:<mongodb uri>" the whole selector collection is
+ * read into memory when the selector loads, indexed by role and phase,
+ * and selector calls are answered from that copy. The copy is replaced
+ * when the version document ({ "type" : "version", "version" : ... })
+ * in the collection changes, which is checked at most every
+ * SNAPSHOT_POLL_SECS seconds (or $MAAT_SELECTOR_POLL_SECS). With
+ * "json:<path>" the documents are read from a mongoexport dump of the
+ * collection instead, reloaded when the file changes and its version
+ * document differs.
  */
 #include <stddef.h>
 #include <config.h>
 #include "selector_impl.h"
 #include "am.h"
 #include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 #include <common/apb_info.h>
+#include <maat-envvars.h>
 
 #include <mongoc.h>
 
+#define SNAPSHOT_PREFIX		"snapshot:"
+#define JSON_PREFIX		"json:"
+#define SNAPSHOT_POLL_SECS	5
+
 /* Functions exported from this file */
 static void api_free_selector(selectordb_t *selector);
 static enum selector_action api_selector_get_first_condition(selectordb_t *selector, role_t r,
@@ -47,8 +66,86 @@ static int api_selector_get_first_conditions(selectordb_t *user_selector, role_t
 static void api_selector_free_condition(selectordb_t *user_selector, char *phrase);
 static void api_selector_free_condition_list(selectordb_t *user_selector, GList *conditions);
 
+static enum selector_action api_snapshot_get_first_condition(selectordb_t *user_selector, role_t r,
+        enum phase p,
+        struct scenario *scen,
+        GList *options,
+        copland_phrase **condition);
+static int api_snapshot_get_first_action(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, copland_phrase **condition);
+static int api_snapshot_get_all_conditions(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, GList **conditions);
+static int api_snapshot_get_first_conditions(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, GList **conditions);
+static void api_snapshot_free_condition(selectordb_t *user_selector, copland_phrase *phrase);
+static void api_snapshot_free_condition_list(selectordb_t *user_selector, GList *conditions);
+
+/* scenario attributes a snapshot rule can match on */
+enum snapshot_attr {ATTR_UNKNOWN=0, ATTR_FINGERPRINT, ATTR_CLIENT, ATTR_RESOURCE, ATTR_OPTIONS};
+
+struct snapshot_match {
+    enum snapshot_attr attr;
+    enum operator operator;
+    char *value;
+    /* value parsed as a Copland phrase, for the options attribute */
+    copland_phrase *phrase;
+};
+
+struct snapshot_rule {
+    /**
+     * GPtrArray of struct snapshot_match, all of which must hold
+     */
+    GPtrArray *matches;
+    enum selector_action action;
+    /**
+     * GList of copland phrases
+     */
+    GList *conditions;
+};
+
+/* An in-memory copy of one version of the selector collection */
+struct selector_snapshot {
+    char *version;
+    /**
+     * GPtrArrays of struct snapshot_rule for each role and phase, in
+     * the order the database returned them
+     */
+    GPtrArray *rules[ATTESTER + 1][SPAWN + 1];
+    /**
+     * Collection name -> set of its items
+     */
+    GHashTable *collections;
+    /**
+     * One for being the current snapshot and one for each phrase
+     * handed out from it and not yet released
+     */
+    unsigned int refs;
+};
+
 typedef struct mongo_selectordb {
     mongoc_client_pool_t *client_pool;
+
+    /* the rest is only used in snapshot mode */
+    struct selector_snapshot *snapshot;
+    /**
+     * Replaced snapshots that phrases handed out from them still
+     * hold. Each is freed when the last of those is released.
+     */
+    GList *retired;
+    /**
+     * Handed out phrase -> the snapshot it belongs to
+     */
+    GHashTable *owners;
+    GList *apbs;
+    /* set for a json: location, NULL to read the database */
+    char *json_path;
+    struct timespec json_mtime;
+    off_t json_size;
+    gint64 poll_usecs;
+    gint64 next_poll;
 } mongo_selectordb;
 
 static void  populate_api_ptrs(selectordb_t* user_selector)
@@ -62,6 +159,568 @@ static void  populate_api_ptrs(selectordb_t* user_selector)
     user_selector->selector_api.free_condition_list = api_selector_free_condition_list;
 }
 
+static void populate_snapshot_api_ptrs(selectordb_t* user_selector)
+{
+    user_selector->selector_api.free_selector = api_free_selector;
+    user_selector->selector_api.get_first_condition = api_snapshot_get_first_condition;
+    user_selector->selector_api.get_first_action = api_snapshot_get_first_action;
+    user_selector->selector_api.get_all_conditions = api_snapshot_get_all_conditions;
+    user_selector->selector_api.get_first_conditions = api_snapshot_get_first_conditions;
+    user_selector->selector_api.free_condition = api_snapshot_free_condition;
+    user_selector->selector_api.free_condition_list = api_snapshot_free_condition_list;
+}
+
+static void free_snapshot_match(struct snapshot_match *m)
+{
+    if(m) {
+        free(m->value);
+        free_copland_phrase(m->phrase);
+        free(m);
+    }
+}
+
+static void free_snapshot_rule(struct snapshot_rule *rule)
+{
+    if(rule) {
+        g_ptr_array_free(rule->matches, TRUE);
+        g_list_free_full(rule->conditions, (GDestroyNotify)free_copland_phrase);
+        free(rule);
+    }
+}
+
+static void free_snapshot(struct selector_snapshot *snap)
+{
+    int r, p;
+
+    if(snap == NULL) {
+        return;
+    }
+
+    for(r = APPRAISER; r <= ATTESTER; r++) {
+        for(p = INITL; p <= SPAWN; p++) {
+            g_ptr_array_free(snap->rules[r][p], TRUE);
+        }
+    }
+    g_hash_table_destroy(snap->collections);
+    free(snap->version);
+    free(snap);
+}
+
+static struct selector_snapshot *new_snapshot(void)
+{
+    struct selector_snapshot *snap = calloc(1, sizeof(struct selector_snapshot));
+    int r, p;
+
+    if(snap == NULL) {
+        return NULL;
+    }
+
+    for(r = APPRAISER; r <= ATTESTER; r++) {
+        for(p = INITL; p <= SPAWN; p++) {
+            snap->rules[r][p] = g_ptr_array_new_with_free_func((GDestroyNotify)free_snapshot_rule);
+        }
+    }
+    snap->collections = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                        (GDestroyNotify)g_hash_table_destroy);
+    snap->refs = 1;
+    return snap;
+}
+
+/* Take a reference to snap for a phrase handed out from it */
+static void snapshot_hold(mongo_selectordb *selector, struct selector_snapshot *snap,
+                          copland_phrase *phrase)
+{
+    g_hash_table_insert(selector->owners, phrase, snap);
+    snap->refs++;
+}
+
+/* Drop a reference to snap, freeing it with the last one */
+static void snapshot_release(mongo_selectordb *selector, struct selector_snapshot *snap)
+{
+    GList *l;
+    guint i;
+    int r, p;
+
+    if(--snap->refs > 0) {
+        return;
+    }
+
+    for(r = APPRAISER; r <= ATTESTER; r++) {
+        for(p = INITL; p <= SPAWN; p++) {
+            for(i = 0; i < snap->rules[r][p]->len; i++) {
+                struct snapshot_rule *rule = g_ptr_array_index(snap->rules[r][p], i);
+                for(l = rule->conditions; l != NULL; l = l->next) {
+                    g_hash_table_remove(selector->owners, l->data);
+                }
+            }
+        }
+    }
+    selector->retired = g_list_remove(selector->retired, snap);
+    dlog(4, "Freeing selection policy version %s\n", snap->version ? snap->version : "(none)");
+    free_snapshot(snap);
+}
+
+/* The UTF-8 string under key in the document iter points at, or NULL */
+static const char *doc_utf8(const bson_iter_t *iter, const char *key)
+{
+    bson_iter_t child;
+
+    if(BSON_ITER_HOLDS_DOCUMENT(iter) &&
+            bson_iter_recurse(iter, &child) &&
+            bson_iter_find(&child, key) &&
+            BSON_ITER_HOLDS_UTF8(&child)) {
+        return bson_iter_utf8(&child, NULL);
+    }
+    return NULL;
+}
+
+/* A version field of any of the types mongo tools write, as a string */
+static char *version_string(const bson_iter_t *iter)
+{
+    char oid[25];
+
+    if(BSON_ITER_HOLDS_UTF8(iter)) {
+        return strdup(bson_iter_utf8(iter, NULL));
+    } else if(BSON_ITER_HOLDS_NUMBER(iter)) {
+        return g_strdup_printf("%"PRId64, bson_iter_as_int64(iter));
+    } else if(BSON_ITER_HOLDS_DATE_TIME(iter)) {
+        return g_strdup_printf("%"PRId64, bson_iter_date_time(iter));
+    } else if(BSON_ITER_HOLDS_OID(iter)) {
+        bson_oid_to_string(bson_iter_oid(iter), oid);
+        return strdup(oid);
+    }
+    return NULL;
+}
+
+static enum snapshot_attr get_snapshot_attr(const char *attr)
+{
+    if(strcasecmp(attr, "partner_fingerprint") == 0) {
+        return ATTR_FINGERPRINT;
+    } else if(strcasecmp(attr, "client") == 0) {
+        return ATTR_CLIENT;
+    } else if(strcasecmp(attr, "resource") == 0) {
+        return ATTR_RESOURCE;
+    } else if(strcasecmp(attr, "options") == 0 || strcasecmp(attr, "option") == 0) {
+        return ATTR_OPTIONS;
+    }
+    return ATTR_UNKNOWN;
+}
+
+static int snapshot_load_match(const bson_iter_t *iter, GList *apbs, struct snapshot_match **out)
+{
+    const char *attr = doc_utf8(iter, "attr");
+    const char *operator = doc_utf8(iter, "operator");
+    const char *value = doc_utf8(iter, "value");
+    struct snapshot_match *m;
+
+    *out = NULL;
+    if(attr == NULL || operator == NULL || value == NULL) {
+        dlog(0, "Error: match condition needs an attr, an operator and a value\n");
+        return -EINVAL;
+    }
+
+    if((m = calloc(1, sizeof(struct snapshot_match))) == NULL) {
+        return -ENOMEM;
+    }
+
+    m->attr = get_snapshot_attr(attr);
+    if(m->attr == ATTR_UNKNOWN) {
+        /* like a query of the database, the rule never matches */
+        dlog(2, "Warning: match condition on unsupported attribute %s\n", attr);
+    }
+
+    m->operator = get_operator(operator);
+    if(m->operator == OP_ERR) {
+        dlog(0, "Error: '%s' is not a valid operator\n", operator);
+        free(m);
+        return -EINVAL;
+    }
+
+    if((m->value = strdup(value)) == NULL) {
+        free(m);
+        return -ENOMEM;
+    }
+
+    if(m->attr == ATTR_OPTIONS &&
+            parse_copland_from_apb_list(value, apbs, &m->phrase) < 0) {
+        dlog(0, "Unable to parse phrase %s given as match condition\n", value);
+        free_snapshot_match(m);
+        return -EINVAL;
+    }
+
+    *out = m;
+    return 0;
+}
+
+static int snapshot_load_rule(const bson_t *doc, GList *apbs, struct snapshot_rule **out)
+{
+    struct snapshot_rule *rule;
+    struct snapshot_match *m;
+    bson_iter_t iter, child, action;
+    const char *phrase;
+    copland_phrase *parsed;
+    int ret;
+
+    *out = NULL;
+    if((rule = calloc(1, sizeof(struct snapshot_rule))) == NULL) {
+        return -ENOMEM;
+    }
+    rule->matches = g_ptr_array_new_with_free_func((GDestroyNotify)free_snapshot_match);
+
+    if(bson_iter_init_find(&iter, doc, "match_conditions") &&
+            BSON_ITER_HOLDS_ARRAY(&iter) &&
+            bson_iter_recurse(&iter, &child)) {
+        while(bson_iter_next(&child)) {
+            if((ret = snapshot_load_match(&child, apbs, &m)) < 0) {
+                goto error;
+            }
+            g_ptr_array_add(rule->matches, m);
+        }
+    }
+
+    rule->action = ACT_ERR;
+    if(bson_iter_init_find(&iter, doc, "action") &&
+            BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+        if((phrase = doc_utf8(&iter, "selector_action")) != NULL) {
+            rule->action = get_selector_action(phrase);
+        }
+
+        if(bson_iter_recurse(&iter, &action) &&
+                bson_iter_find(&action, "conditions") &&
+                BSON_ITER_HOLDS_ARRAY(&action) &&
+                bson_iter_recurse(&action, &child)) {
+            while(bson_iter_next(&child)) {
+                if((phrase = doc_utf8(&child, "apb_phrase")) == NULL) {
+                    continue;
+                }
+                if(parse_copland_from_apb_list(phrase, apbs, &parsed) < 0) {
+                    dlog(0, "Error: Unable to find APB to execute Copland Phrase %s in selection policy\n",
+                         phrase);
+                    ret = -EINVAL;
+                    goto error;
+                }
+                rule->conditions = g_list_append(rule->conditions, parsed);
+            }
+        }
+    }
+
+    *out = rule;
+    return 0;
+
+error:
+    free_snapshot_rule(rule);
+    return ret;
+}
+
+static void snapshot_load_collection(struct selector_snapshot *snap, const bson_t *doc)
+{
+    bson_iter_t iter, items;
+    GHashTable *set;
+    const char *name;
+
+    if(!bson_iter_init_find(&iter, doc, "name") || !BSON_ITER_HOLDS_UTF8(&iter)) {
+        dlog(2, "Warning: collection without a name (ignoring)\n");
+        return;
+    }
+    name = bson_iter_utf8(&iter, NULL);
+
+    /* collections sharing a name are searched together by the database, so merge them */
+    if((set = g_hash_table_lookup(snap->collections, name)) == NULL) {
+        set = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+        g_hash_table_insert(snap->collections, strdup(name), set);
+    }
+
+    if(bson_iter_init_find(&iter, doc, "items") &&
+            BSON_ITER_HOLDS_ARRAY(&iter) &&
+            bson_iter_recurse(&iter, &items)) {
+        while(bson_iter_next(&items)) {
+            if(BSON_ITER_HOLDS_UTF8(&items)) {
+                g_hash_table_add(set, strdup(bson_iter_utf8(&items, NULL)));
+            }
+        }
+    }
+}
+
+/*
+ * Add one document of the selector collection to a snapshot: a rule
+ * (anything with a role and a phase, which is what the database is
+ * queried by), a collection or the version document.
+ */
+static int snapshot_add_doc(struct selector_snapshot *snap, const bson_t *doc, GList *apbs)
+{
+    struct snapshot_rule *rule;
+    bson_iter_t iter;
+    const char *type = NULL;
+    role_t r = ROLE_ERR;
+    enum phase p = PHASE_ERR;
+    int ret;
+
+    if(bson_iter_init_find(&iter, doc, "type") && BSON_ITER_HOLDS_UTF8(&iter)) {
+        type = bson_iter_utf8(&iter, NULL);
+    }
+
+    if(bson_iter_init_find(&iter, doc, "role") && BSON_ITER_HOLDS_UTF8(&iter)) {
+        r = get_role(bson_iter_utf8(&iter, NULL));
+    }
+    if(bson_iter_init_find(&iter, doc, "phase") && BSON_ITER_HOLDS_UTF8(&iter)) {
+        p = get_phase(bson_iter_utf8(&iter, NULL));
+    }
+
+    if(r != ROLE_ERR && p != PHASE_ERR) {
+        if((ret = snapshot_load_rule(doc, apbs, &rule)) < 0) {
+            return ret;
+        }
+        g_ptr_array_add(snap->rules[r][p], rule);
+    } else if(type != NULL && strcasecmp(type, "collection") == 0) {
+        snapshot_load_collection(snap, doc);
+    } else if(type != NULL && strcasecmp(type, "version") == 0) {
+        if(bson_iter_init_find(&iter, doc, "version")) {
+            free(snap->version);
+            snap->version = version_string(&iter);
+        }
+    } else if(type != NULL && strcasecmp(type, "rule") == 0) {
+        dlog(2, "Warning: selector rule without a valid role and phase (ignoring)\n");
+    }
+    return 0;
+}
+
+/* Read every document of the selector collection into a new snapshot */
+static int snapshot_load_mongo(mongoc_client_pool_t *pool, GList *apbs,
+                               struct selector_snapshot **out)
+{
+    struct selector_snapshot *snap;
+    mongoc_client_t *client;
+    mongoc_collection_t *collection;
+    mongoc_cursor_t *cursor;
+    const bson_t *doc;
+    bson_t *query;
+    bson_error_t error;
+    int ret = 0;
+
+    *out = NULL;
+    if((snap = new_snapshot()) == NULL) {
+        return -ENOMEM;
+    }
+
+    client = mongoc_client_pool_pop(pool);
+    if(client == NULL) {
+        dlog(0, "Unable to get client from mongo client pool\n");
+        free_snapshot(snap);
+        return -EIO;
+    }
+    collection = mongoc_client_get_collection(client, "maat", "selector");
+    query = bson_new();
+    cursor = mongoc_collection_find_with_opts(collection, query, NULL, NULL);
+
+    while(ret == 0 && mongoc_cursor_next(cursor, &doc)) {
+        ret = snapshot_add_doc(snap, doc, apbs);
+    }
+    if(ret == 0 && mongoc_cursor_error(cursor, &error)) {
+        dlog(0, "Error reading the selection policy: %s\n", error.message);
+        ret = -EIO;
+    }
+
+    mongoc_cursor_destroy(cursor);
+    bson_destroy(query);
+    mongoc_collection_destroy(collection);
+    mongoc_client_pool_push(pool, client);
+
+    if(ret < 0) {
+        free_snapshot(snap);
+        return ret;
+    }
+    *out = snap;
+    return 0;
+}
+
+/*
+ * Read the version document alone, which is all a poll costs. Returns
+ * 0 with *version set (NULL if there is no version document), or < 0
+ * if the database could not be read.
+ */
+static int mongo_read_version(mongoc_client_pool_t *pool, char **version)
+{
+    mongoc_client_t *client;
+    mongoc_collection_t *collection;
+    mongoc_cursor_t *cursor;
+    const bson_t *doc;
+    bson_t *query, *opts;
+    bson_error_t error;
+    bson_iter_t iter;
+    int ret = 0;
+
+    *version = NULL;
+    client = mongoc_client_pool_pop(pool);
+    if(client == NULL) {
+        return -EIO;
+    }
+    collection = mongoc_client_get_collection(client, "maat", "selector");
+    query = BCON_NEW("type", BCON_UTF8("version"));
+    opts = BCON_NEW("limit", BCON_INT64(1), "projection", "{", "version", BCON_BOOL(true), "}");
+    cursor = mongoc_collection_find_with_opts(collection, query, opts, NULL);
+
+    if(mongoc_cursor_next(cursor, &doc)) {
+        if(bson_iter_init_find(&iter, doc, "version")) {
+            *version = version_string(&iter);
+        }
+    } else if(mongoc_cursor_error(cursor, &error)) {
+        dlog(1, "Unable to read the selection policy version: %s\n", error.message);
+        ret = -EIO;
+    }
+
+    mongoc_cursor_destroy(cursor);
+    bson_destroy(opts);
+    bson_destroy(query);
+    mongoc_collection_destroy(collection);
+    mongoc_client_pool_push(pool, client);
+    return ret;
+}
+
+/* Read a mongoexport dump of the selector collection into a new snapshot */
+static int snapshot_load_json(const char *path, GList *apbs, struct selector_snapshot **out)
+{
+    struct selector_snapshot *snap;
+    bson_json_reader_t *reader;
+    bson_error_t error;
+    bson_t *doc;
+    int ret = 0;
+    int rc;
+
+    *out = NULL;
+    if((reader = bson_json_reader_new_from_file(path, &error)) == NULL) {
+        dlog(0, "Unable to open selection policy %s: %s\n", path, error.message);
+        return -ENOENT;
+    }
+    if((snap = new_snapshot()) == NULL) {
+        bson_json_reader_destroy(reader);
+        return -ENOMEM;
+    }
+    doc = bson_new();
+
+    while(ret == 0 && (rc = bson_json_reader_read(reader, doc, &error)) != 0) {
+        if(rc < 0) {
+            dlog(0, "Unable to parse selection policy %s: %s\n", path, error.message);
+            ret = -EINVAL;
+            break;
+        }
+        ret = snapshot_add_doc(snap, doc, apbs);
+        bson_reinit(doc);
+    }
+
+    bson_destroy(doc);
+    bson_json_reader_destroy(reader);
+    if(ret < 0) {
+        free_snapshot(snap);
+        return ret;
+    }
+    *out = snap;
+    return 0;
+}
+
+/*
+ * Returns 1 if the json: file changed since it was last read, recording
+ * its new modification time and size, or 0 if not.
+ */
+static int json_changed(mongo_selectordb *selector)
+{
+    struct stat st;
+
+    if(stat(selector->json_path, &st) != 0) {
+        return 0;
+    }
+    if(st.st_mtim.tv_sec == selector->json_mtime.tv_sec &&
+            st.st_mtim.tv_nsec == selector->json_mtime.tv_nsec &&
+            st.st_size == selector->json_size) {
+        return 0;
+    }
+    selector->json_mtime = st.st_mtim;
+    selector->json_size = st.st_size;
+    return 1;
+}
+
+/*
+ * Replace the snapshot if its version document changed, checking at
+ * most once per poll interval. On any error the current snapshot is
+ * kept.
+ */
+static void snapshot_poll(mongo_selectordb *selector)
+{
+    struct selector_snapshot *fresh = NULL;
+    char *version = NULL;
+    gint64 now = g_get_monotonic_time();
+
+    if(now < selector->next_poll) {
+        return;
+    }
+    selector->next_poll = now + selector->poll_usecs;
+
+    if(selector->json_path != NULL) {
+        if(!json_changed(selector) ||
+                snapshot_load_json(selector->json_path, selector->apbs, &fresh) < 0) {
+            return;
+        }
+    } else {
+        if(mongo_read_version(selector->client_pool, &version) < 0 ||
+                g_strcmp0(version, selector->snapshot->version) == 0 ||
+                snapshot_load_mongo(selector->client_pool, selector->apbs, &fresh) < 0) {
+            free(version);
+            return;
+        }
+        free(version);
+    }
+
+    if(g_strcmp0(fresh->version, selector->snapshot->version) == 0) {
+        free_snapshot(fresh);
+        return;
+    }
+
+    dlog(3, "Selection policy changed from version %s to %s\n",
+         selector->snapshot->version ? selector->snapshot->version : "(none)",
+         fresh->version ? fresh->version : "(none)");
+    selector->retired = g_list_prepend(selector->retired, selector->snapshot);
+    snapshot_release(selector, selector->snapshot);
+    selector->snapshot = fresh;
+}
+
+/*
+ * Load the selector in snapshot mode from a mongodb URI or, if json_path
+ * is set, from a dump of the selector collection.
+ */
+static int load_selector_snapshot(mongo_selectordb *selector, const char *json_path, GList *apbs)
+{
+    const char *poll_secs = getenv(ENV_MAAT_SELECTOR_POLL_SECS);
+    unsigned int secs = SNAPSHOT_POLL_SECS;
+    int ret;
+
+    if(poll_secs != NULL && sscanf(poll_secs, "%u", &secs) != 1) {
+        dlog(2, "Warning: invalid %s \"%s\" (ignoring)\n", ENV_MAAT_SELECTOR_POLL_SECS, poll_secs);
+        secs = SNAPSHOT_POLL_SECS;
+    }
+    selector->poll_usecs = (gint64)secs * G_USEC_PER_SEC;
+    selector->apbs = apbs;
+    selector->owners = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    if(json_path != NULL) {
+        if((selector->json_path = strdup(json_path)) == NULL) {
+            return -ENOMEM;
+        }
+        json_changed(selector);
+        ret = snapshot_load_json(json_path, apbs, &selector->snapshot);
+    } else {
+        ret = snapshot_load_mongo(selector->client_pool, apbs, &selector->snapshot);
+    }
+    if(ret < 0) {
+        return ret;
+    }
+
+    if(selector->snapshot->version == NULL) {
+        dlog(2, "Warning: selection policy has no version document, "
+             "it will not be refreshed\n");
+    }
+    selector->next_poll = g_get_monotonic_time() + selector->poll_usecs;
+    return 0;
+}
+
 /* Check that all phrases in the selection policy are handled by an APB */
 static int check_all_phrases_valid(mongoc_client_pool_t *pool, GList *apbs)
 {
@@ -104,12 +763,15 @@ static int check_all_phrases_valid(mongoc_client_pool_t *pool, GList *apbs)
                 bson_iter_find_descendant(&iter, "action.conditions.apb_phrase", &match_cond_iter) &&
                 BSON_ITER_HOLDS_UTF8(&match_cond_iter)) {
 
+            copland_phrase *parsed = NULL;
+
             phrase = bson_iter_utf8(&match_cond_iter, NULL);
 
-            if(check_phrase_validity(phrase, apbs) == 0) {
+            if(parse_copland_from_apb_list(phrase, apbs, &parsed) < 0) {
                 dlog(3, "Found phrase %s that cannot be found in any APB\n", phrase);
                 goto unknown_err;
             }
+            free_copland_phrase(parsed);
 
         } else {
             dlog(2, "No phrase field available for record\n");
@@ -138,6 +800,7 @@ client_err:
 static int load_selector_mongo_internal(const char* db_uri, GList *apbs, selectordb_t **out)
 {
     mongoc_uri_t *uri;
+    bool snapshot = false;
     *out = NULL;
 
     selectordb_t *user_selector = malloc(sizeof(selectordb_t));
@@ -158,9 +821,25 @@ static int load_selector_mongo_internal(const char* db_uri, GList *apbs, selecto
     }
 
     bzero(selector, sizeof(mongo_selectordb));
+    user_selector->specific_selector_db = selector;
+
+    if(db_uri && strncmp(db_uri, JSON_PREFIX, strlen(JSON_PREFIX)) == 0) {
+        populate_snapshot_api_ptrs(user_selector);
+        if(load_selector_snapshot(selector, db_uri + strlen(JSON_PREFIX), apbs) < 0) {
+            goto error;
+        }
+        *out = user_selector;
+        return 0;
+    }
+
+    if(db_uri && strncmp(db_uri, SNAPSHOT_PREFIX, strlen(SNAPSHOT_PREFIX)) == 0) {
+        populate_snapshot_api_ptrs(user_selector);
+        db_uri += strlen(SNAPSHOT_PREFIX);
+        snapshot = true;
+    }
 
     mongoc_init();
-    if(!db_uri) {
+    if(!db_uri || *db_uri == '\0') {
         uri = mongoc_uri_new("mongodb://localhost:27017/");
     } else {
         uri = mongoc_uri_new(db_uri);
@@ -173,21 +852,19 @@ static int load_selector_mongo_internal(const char* db_uri, GList *apbs, selecto
     selector->client_pool = mongoc_client_pool_new(uri);
     mongoc_uri_destroy(uri);
 
-    if(check_all_phrases_valid(selector->client_pool, apbs)) {
-        mongoc_client_pool_destroy(selector->client_pool);
-        free(selector);
-        free(user_selector);
-        return -1;
+    if(snapshot) {
+        if(load_selector_snapshot(selector, NULL, apbs) < 0) {
+            goto error;
+        }
+    } else if(check_all_phrases_valid(selector->client_pool, apbs)) {
+        goto error;
     }
 
-    user_selector->specific_selector_db = selector;
-
     *out = user_selector;
     return 0;
 
 error:
-    free(selector);
-    free(user_selector);
+    api_free_selector(user_selector);
     return -1;
 
 }
@@ -419,6 +1096,7 @@ static int check_match_conditions(bson_iter_t *match_iter, mongoc_collection_t *
 {
     GList *attr_pairs = NULL;
     bson_iter_t match_cond_iter;
+    int err = 0;
     const char* match_cond_attr;
     const char* match_cond_operator;
     const char* match_cond_value;
@@ -498,6 +1176,15 @@ static void api_free_selector(selectordb_t *user_selector)
     if(user_selector) {
         struct mongo_selectordb* selector = (struct mongo_selectordb*) user_selector->specific_selector_db;
 
+        if(selector->client_pool) {
+            mongoc_client_pool_destroy(selector->client_pool);
+        }
+        free_snapshot(selector->snapshot);
+        g_list_free_full(selector->retired, (GDestroyNotify)free_snapshot);
+        if(selector->owners) {
+            g_hash_table_destroy(selector->owners);
+        }
+        free(selector->json_path);
         free(selector);
         free(user_selector);
     }
@@ -807,3 +1494,251 @@ static void api_selector_free_condition_list(selectordb_t *user_selector, GList
     UNUSED_VAR(user_selector);
     g_list_free_full(conditions, (GDestroyNotify)free);
 }
+
+/*
+ * Selector calls in snapshot mode, answered from the in-memory copy of
+ * the selection policy. Returned phrases are owned by the snapshot, as
+ * with the Copland selector, and each holds a reference to it until it
+ * is released with selector_free_condition(), so a replaced snapshot
+ * lives only as long as phrases handed out from it are in use.
+ */
+
+struct snapshot_query {
+    struct scenario *scen;
+    role_t role;
+    GList *options;
+    /* fingerprint of the partner certificate, computed on first use */
+    char *fingerprint;
+};
+
+static const char *snapshot_query_attr(struct snapshot_query *q, enum snapshot_attr attr)
+{
+    switch(attr) {
+    case ATTR_FINGERPRINT:
+        if(q->fingerprint == NULL && q->scen->partner_cert != NULL) {
+            q->fingerprint = get_fingerprint(q->scen->partner_cert, NULL);
+        }
+        return q->fingerprint;
+    case ATTR_CLIENT:
+        return q->role == APPRAISER ? q->scen->attester_hostname : NULL;
+    case ATTR_RESOURCE:
+        return q->role == APPRAISER ? q->scen->resource : NULL;
+    default:
+        return NULL;
+    }
+}
+
+/* Returns 1 if the scenario meets the match condition, 0 if not */
+static int snapshot_check_match(struct selector_snapshot *snap, struct snapshot_match *m,
+                                struct snapshot_query *q)
+{
+    GHashTable *items;
+    const char *value;
+    GList *l;
+
+    if(m->attr == ATTR_OPTIONS) {
+        /* "is" looks at the first option only, "include" at all of them */
+        for(l = q->options; l != NULL && m->operator != IN; l = l->next) {
+            if(l->data != NULL && eval_bounds_of_args(m->phrase, l->data) == 0) {
+                return 1;
+            }
+            if(m->operator == IS) {
+                break;
+            }
+        }
+        return 0;
+    }
+
+    if((value = snapshot_query_attr(q, m->attr)) == NULL) {
+        return 0;
+    }
+
+    switch(m->operator) {
+    case(IS):
+    case(INCLUDE):
+        return strcasecmp(m->value, value) == 0;
+    case(IN):
+        items = g_hash_table_lookup(snap->collections, m->value);
+        return items != NULL && g_hash_table_contains(items, value);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Finds the next rule for the query's role and phase, starting at index
+ * *pos, whose match conditions all hold and, unless s_action is
+ * ACT_ERR, whose action is s_action. Returns the rule and sets *pos past
+ * it, or returns NULL.
+ */
+static struct snapshot_rule *snapshot_next_rule(struct selector_snapshot *snap, enum phase p,
+        enum selector_action s_action,
+        struct snapshot_query *q, guint *pos)
+{
+    GPtrArray *rules;
+    guint i;
+
+    if(q->role < APPRAISER || q->role > ATTESTER || p < INITL || p > SPAWN) {
+        return NULL;
+    }
+    rules = snap->rules[q->role][p];
+
+    while(*pos < rules->len) {
+        struct snapshot_rule *rule = g_ptr_array_index(rules, (*pos)++);
+
+        if(s_action != ACT_ERR && rule->action != s_action) {
+            continue;
+        }
+        for(i = 0; i < rule->matches->len; i++) {
+            if(!snapshot_check_match(snap, g_ptr_array_index(rule->matches, i), q)) {
+                break;
+            }
+        }
+        if(i == rule->matches->len) {
+            return rule;
+        }
+    }
+    return NULL;
+}
+
+/* The current snapshot, refreshed first if the policy version changed */
+static struct selector_snapshot *snapshot_current(selectordb_t *user_selector)
+{
+    struct mongo_selectordb* selector = (struct mongo_selectordb*) user_selector->specific_selector_db;
+
+    snapshot_poll(selector);
+    return selector->snapshot;
+}
+
+/* Hand out each phrase of conditions, found in snap */
+static void snapshot_hand_out(selectordb_t *user_selector, struct selector_snapshot *snap,
+                              GList *conditions)
+{
+    struct mongo_selectordb* selector = (struct mongo_selectordb*) user_selector->specific_selector_db;
+    GList *l;
+
+    for(l = conditions; l != NULL; l = l->next) {
+        snapshot_hold(selector, snap, l->data);
+    }
+}
+
+static enum selector_action api_snapshot_get_first_condition(selectordb_t *user_selector, role_t r,
+        enum phase p,
+        struct scenario *scen,
+        GList *options,
+        copland_phrase **condition)
+{
+    struct selector_snapshot *snap = snapshot_current(user_selector);
+    struct snapshot_query q = {scen, r, options, NULL};
+    struct snapshot_rule *rule;
+    guint pos = 0;
+
+    *condition = NULL;
+    rule = snapshot_next_rule(snap, p, ACT_ERR, &q, &pos);
+    free(q.fingerprint);
+
+    if(rule == NULL || rule->conditions == NULL) {
+        return ACT_ERR;
+    }
+    *condition = rule->conditions->data;
+    snapshot_hold(user_selector->specific_selector_db, snap, *condition);
+    return rule->action;
+}
+
+static int api_snapshot_get_first_action(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, copland_phrase **condition)
+{
+    struct selector_snapshot *snap = snapshot_current(user_selector);
+    struct snapshot_query q = {scen, r, options, NULL};
+    struct snapshot_rule *rule;
+    guint pos = 0;
+
+    *condition = NULL;
+    while((rule = snapshot_next_rule(snap, p, s_action, &q, &pos)) != NULL) {
+        if(rule->conditions != NULL) {
+            *condition = rule->conditions->data;
+            break;
+        }
+    }
+    free(q.fingerprint);
+
+    if(*condition == NULL) {
+        return -1;
+    }
+    snapshot_hold(user_selector->specific_selector_db, snap, *condition);
+    return AM_OK;
+}
+
+static int api_snapshot_get_first_conditions(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, GList **conditions)
+{
+    struct selector_snapshot *snap = snapshot_current(user_selector);
+    struct snapshot_query q = {scen, r, options, NULL};
+    struct snapshot_rule *rule;
+    guint pos = 0;
+    guint count;
+
+    rule = snapshot_next_rule(snap, p, s_action, &q, &pos);
+    free(q.fingerprint);
+
+    if(rule == NULL) {
+        *conditions = NULL;
+        dlog(0, "ERROR: no matching rule found\n");
+        return -1;
+    }
+
+    *conditions = g_list_copy(rule->conditions);
+    snapshot_hand_out(user_selector, snap, *conditions);
+    count = g_list_length(*conditions);
+    if(count > INT_MAX) {
+        return INT_MAX;
+    }
+    return (int)count;
+}
+
+static int api_snapshot_get_all_conditions(selectordb_t *user_selector, role_t r, enum phase p,
+        enum selector_action s_action, struct scenario *scen,
+        GList *options, GList **conditions)
+{
+    struct selector_snapshot *snap = snapshot_current(user_selector);
+    struct snapshot_query q = {scen, r, options, NULL};
+    struct snapshot_rule *rule;
+    guint pos = 0;
+    guint count;
+
+    *conditions = NULL;
+    while((rule = snapshot_next_rule(snap, p, s_action, &q, &pos)) != NULL) {
+        *conditions = g_list_concat(*conditions, g_list_copy(rule->conditions));
+    }
+    free(q.fingerprint);
+    snapshot_hand_out(user_selector, snap, *conditions);
+
+    count = g_list_length(*conditions);
+    if(count > INT_MAX) {
+        count = INT_MAX;
+    }
+    return (int)count;
+}
+
+static void api_snapshot_free_condition(selectordb_t *user_selector, copland_phrase *phrase)
+{
+    struct mongo_selectordb* selector = (struct mongo_selectordb*) user_selector->specific_selector_db;
+    struct selector_snapshot *snap = g_hash_table_lookup(selector->owners, phrase);
+
+    /* the phrase belongs to the snapshot, only the reference is dropped */
+    if(snap != NULL) {
+        snapshot_release(selector, snap);
+    }
+}
+
+static void api_snapshot_free_condition_list(selectordb_t *user_selector, GList *conditions)
+{
+    GList *l;
+
+    for(l = conditions; l != NULL; l = l->next) {
+        api_snapshot_free_condition(user_selector, l->data);
+    }
+    g_list_free(conditions);
+}
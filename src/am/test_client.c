@@ -46,7 +46,7 @@
 
 void print_usage(char *progname)
 {
-    fprintf(stderr, "%s -l <appraiser-address> -t <target-address> [-a <appraiser-port>] [-p <target-port>] [-f <target-cert-fingerprint>] [-r <resource>]\n",
+    fprintf(stderr, "%s -l <appraiser-address> -t <target-address> [-a <appraiser-port>] [-p <target-port>] [-f <target-cert-fingerprint>] [-r <resource>[,<resource>...]]\n",
             progname);
     exit(1);
 }
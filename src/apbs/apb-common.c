@@ -15,7 +15,10 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <util/util.h>
+#include <util/keyvalue.h>
 #include <measurement_spec/measurement_spec.h>
 #include <graph/graph-core.h>
 #include "apb-common.h"
@@ -136,3 +139,58 @@ int check_predicate(void *ctxt, measurement_variable *var,
     free_measurement_data(&d->meas_data);
     return rc;
 }
+
+static void free_evidence_section(struct evidence_section *section)
+{
+    free(section->resource);
+    free(section);
+}
+
+void free_evidence_sections(GList *sections)
+{
+    g_list_free_full(sections, (GDestroyNotify)free_evidence_section);
+}
+
+int evidence_sections_from_args(struct key_value **arg_list, int argc,
+                                GList **sections)
+{
+    struct evidence_section *section;
+    GList *out = NULL;
+    char *sep;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        char *value = arg_list[i]->value;
+
+        if(strcmp(arg_list[i]->key, "section") != 0) {
+            continue;
+        }
+
+        /* resources may contain ':', uuids do not */
+        if(value == NULL || (sep = strrchr(value, ':')) == NULL || sep == value) {
+            dlog(0, "Malformed section argument %s\n", value ? value : "(null)");
+            goto error;
+        }
+
+        if((section = calloc(1, sizeof(*section))) == NULL ||
+                (section->resource = strndup(value, (size_t)(sep - value))) == NULL) {
+            dlog(0, "Failed to allocate evidence section\n");
+            free(section);
+            goto error;
+        }
+        if(uuid_parse(sep + 1, section->spec_uuid) != 0) {
+            dlog(0, "Invalid measurement spec %s for resource %s\n", sep + 1,
+                 section->resource);
+            free_evidence_section(section);
+            goto error;
+        }
+        out = g_list_append(out, section);
+    }
+
+    *sections = out;
+    return 0;
+
+error:
+    free_evidence_sections(out);
+    return -EINVAL;
+}
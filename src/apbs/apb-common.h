@@ -37,11 +37,18 @@
  * + check_predicate() retrieves the data of the given type from the
  * identified node and returns the result of calling check_predicate()
  * on it with the given quantifier, feature, operator and value.
+ *
+ * It also parses the section arguments the AM passes to the APBs on
+ * both sides of a multi-resource attestation.
  */
 
 #ifndef _MAAT_APB_COMMON_H_
 #define _MAAT_APB_COMMON_H_
 
+#include <glib.h>
+#include <uuid/uuid.h>
+#include <util/keyvalue.h>
+
 /**
  * Creates an edge with the given @label between source and
  * destination nodes identified by the variables @src and @dst in the
@@ -76,4 +83,26 @@ int check_predicate(void *ctxt, measurement_variable *var,
                     measurement_type *mtype, predicate_quantifier quant,
                     char *feature, char *operator, char *value);
 
+/**
+ * One resource of a multi-resource request. The AM passes a
+ * section=<resource>:<measurement spec uuid> argument per resource;
+ * the attester measures every resource into one graph and sends a
+ * section of it per resource, which the appraiser appraises
+ * separately.
+ */
+struct evidence_section {
+    char *resource;
+    uuid_t spec_uuid;
+};
+
+/**
+ * Set *@sections to a list of struct evidence_section for the section
+ * arguments in @arg_list, in order (NULL if there are none). Returns
+ * 0 on success or -EINVAL if one is malformed.
+ */
+int evidence_sections_from_args(struct key_value **arg_list, int argc,
+                                GList **sections);
+
+void free_evidence_sections(GList *sections);
+
 #endif
@@ -16,6 +16,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -27,6 +28,9 @@
 /*! \file
  * This APB is an initial implementation of an appraiser APB. It
  * currently just calls dummy_appraisal ASP on all nodes of the graph.
+ * If the measurement specification samples file hashes (see
+ * file_sampling.h), it also checks that every file the sample drawn
+ * from its nonce selects was hashed.
  */
 
 #include <stdio.h>
@@ -52,6 +56,8 @@
 #include <graph/graph-core.h>
 #include <common/asp.h>
 
+#include "file_sampling.h"
+
 int debug_level = 3;
 
 uuid_t appraisal_policy_spec_uuid;
@@ -193,6 +199,88 @@ static inline void dump_measurement(struct scenario *scen, void *msmt, size_t ms
     buffer_to_file(path, (unsigned char*)msmt, msmtsize);
 }
 
+/*
+ * Returns the file sampling summary in @mg, or NULL if there is none.
+ */
+static file_sampling_data *find_sampling_summary(measurement_graph *mg)
+{
+    node_iterator *it;
+    measurement_data *d = NULL;
+
+    for(it = measurement_graph_iterate_nodes(mg); it != NULL;
+            it = node_iterator_next(it)) {
+        if(measurement_node_get_rawdata(mg, node_iterator_get(it),
+                                        &file_sampling_measurement_type, &d) == 0) {
+            destroy_node_iterator(it);
+            return container_of(d, file_sampling_data, d);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * If the measurement specification samples file hashes, check that
+ * the sample was drawn at its rate with the key derived from our
+ * nonce, and that every file the sample selects was hashed. The rate
+ * is the specification's, not the one the attester reports. Returns
+ * the number of failures.
+ */
+static int check_sampling(struct scenario *scen, measurement_graph *mg)
+{
+    unsigned char key[FILE_SAMPLING_KEY_SIZE];
+    unsigned char key_id[FILE_SAMPLING_KEY_ID_SIZE];
+    struct meas_spec *mspec = NULL;
+    file_sampling_data *fsd = NULL;
+    GList *missing = NULL;
+    GList *l;
+    uint32_t rate_ppm;
+    int nr_missing;
+    int failed = 0;
+
+    if(get_target_meas_spec(appraisal_policy_spec_uuid, &mspec) != 0) {
+        dlog(4, "No measurement specification to check file sampling against\n");
+        return 0;
+    }
+    rate_ppm = mspec->sampling.rate_ppm;
+    free_meas_spec(mspec);
+    if(rate_ppm == 0) {
+        return 0;
+    }
+
+    if((fsd = find_sampling_summary(mg)) == NULL) {
+        dlog(1, "Sampled evidence has no file sampling summary\n");
+        failed = 1;
+        goto out;
+    }
+    if(file_sampling_derive_key(scen->nonce, key) != 0) {
+        dlog(0, "Failed to derive the file sampling key from the nonce\n");
+        failed = 1;
+        goto out;
+    }
+    SHA256(key, sizeof(key), key_id);
+    if(memcmp(key_id, fsd->key_id, sizeof(key_id)) != 0 || fsd->rate_ppm != rate_ppm) {
+        dlog(1, "File sample was not drawn with our nonce at %"PRIu32" ppm\n", rate_ppm);
+        failed = 1;
+        goto out;
+    }
+
+    nr_missing = file_sampling_check_graph(mg, key, rate_ppm,
+                                           &sha1hash_measurement_type, &missing);
+    if(nr_missing != 0) {
+        dlog(1, "Sampled evidence lacks %d selected file hashes\n", nr_missing);
+        for(l = missing; l != NULL; l = l->next) {
+            dlog(3, "Sampled file not hashed: %s\n", (char *)l->data);
+        }
+        failed = 1;
+    }
+    g_list_free_full(missing, free);
+
+out:
+    memset(key, 0, sizeof(key));
+    free_measurement_data(fsd ? &fsd->d : NULL);
+    return failed;
+}
+
 static int appraise(struct scenario *scen, GList *values,
                     void *msmt, size_t msmtsize)
 {
@@ -249,6 +337,8 @@ static int appraise(struct scenario *scen, GList *values,
     }
     free(graph_path);
 
+    ret += check_sampling(scen, mg);
+
     gather_report_data(mg, &report_data_list);
 cleanup:
     destroy_measurement_graph(mg);
@@ -81,11 +81,13 @@ static measurement_spec_callbacks callbacks = {
  * @lport local port the local AM is listening on
  * @scen is the current scenario
  * @peerchan is where to send the measurement
+ * @arg_list and @argc are the APB arguments, for the export filter
  * Returns 0 on success, < 0 on error
  */
 static int execute_measurement_and_asp_pipeline(measurement_graph *graph, struct meas_spec *mspec, const char *rhost,
         const char *rport, const char *lhost, const char *lport,
-        struct scenario *scen, const int peerchan)
+        struct scenario *scen, const int peerchan,
+        struct key_value **arg_list, int argc)
 {
     int ret_val                  = -1;
     int fb_fd                    = -1;
@@ -95,7 +97,8 @@ static int execute_measurement_and_asp_pipeline(measurement_graph *graph, struct
     char *partner_cert           = NULL;
     char *kim_fd_str             = NULL;
     char *req_args[6];
-    char *serialize_args[1];
+    char **serialize_args        = NULL;
+    int nr_serialize_args;
     char *encrypt_args[1];
     char *create_con_args[10];
     char *merge_args[2];
@@ -198,9 +201,14 @@ static int execute_measurement_and_asp_pipeline(measurement_graph *graph, struct
             exit(-1);
         }
 
-        serialize_args[0] = graph_path;
+        serialize_args = serialize_graph_args(graph_path, mspec, arg_list, argc,
+                                              &nr_serialize_args);
+        if(serialize_args == NULL) {
+            exit(-1);
+        }
 
-        ret_val = fork_and_buffer_async_asp(serialize, 1, serialize_args, STDIN_FILENO, &fb_fd);
+        ret_val = fork_and_buffer_async_asp(serialize, nr_serialize_args, serialize_args,
+                                            STDIN_FILENO, &fb_fd);
         if(ret_val == -2) {
             dlog(0, "Failed to execute fork and buffer for %s ASP\n", serialize->name);
             exit(-1);
@@ -326,8 +334,8 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
         return ret_val;
     }
 
-    if(argc != 2) {
-        dlog(1, "USAGE: APB_NAME <@_1> <@_2>\n");
+    if(argc < 2) {
+        dlog(1, "USAGE: APB_NAME <@_1> <@_2> [export=<filter rule> ...]\n");
         return -1;
     }
 
@@ -361,7 +369,7 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
                      arg_list[i]->value);
                 goto place_arg_err;
             }
-        } else {
+        } else if(strcmp(arg_list[i]->key, "export") != 0) {
             dlog(2, "Received unknown argument with key %s\n",
                  arg_list[i]->key);
         }
@@ -402,7 +410,7 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
        measurements to the appraiser */
     ret_val = execute_measurement_and_asp_pipeline(graph, mspec, place2_info->addr,
               place2_info->port, place1_info->addr, place1_info->port, scen,
-              peerchan);
+              peerchan, arg_list, argc);
 
 str_alloc_err:
     destroy_measurement_graph(graph);
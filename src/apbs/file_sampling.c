@@ -0,0 +1,311 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <util/util.h>
+#include <address_space/file_address_space.h>
+
+#include "file_sampling.h"
+
+#define FILE_SAMPLING_KEY_LABEL "maat file sampling key"
+#define FILE_SAMPLING_STATE_MAGIC "maat-file-sampling"
+#define FILE_SAMPLING_STATE_VERSION 1
+
+struct file_sampling_entry {
+    uint32_t last;		/* round last hashed, or first listed */
+    bool seen;			/* listed this round */
+    file_sampling_decision decision;
+};
+
+int file_sampling_derive_key(const char *nonce,
+                             unsigned char key[FILE_SAMPLING_KEY_SIZE])
+{
+    unsigned int len = FILE_SAMPLING_KEY_SIZE;
+
+    if(nonce == NULL || nonce[0] == '\0') {
+        return -EINVAL;
+    }
+    if(HMAC(EVP_sha256(), nonce, (int)strlen(nonce),
+            (const unsigned char *)FILE_SAMPLING_KEY_LABEL,
+            strlen(FILE_SAMPLING_KEY_LABEL), key, &len) == NULL) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * The first 64 bits of HMAC-SHA256(key, path) are compared against the
+ * rate scaled to the whole 64 bit range.
+ */
+bool file_sampling_selects(const unsigned char key[FILE_SAMPLING_KEY_SIZE],
+                           uint32_t rate_ppm, const char *path)
+{
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    uint64_t score = 0;
+    int i;
+
+    if(rate_ppm >= MEASUREMENT_SAMPLING_SCALE) {
+        return true;
+    }
+    if(HMAC(EVP_sha256(), key, FILE_SAMPLING_KEY_SIZE,
+            (const unsigned char *)path, strlen(path), mac, &len) == NULL) {
+        /* never skip a file because of an error */
+        return true;
+    }
+    for(i = 0; i < 8; i++) {
+        score = (score << 8) | mac[i];
+    }
+    return score < (UINT64_MAX / MEASUREMENT_SAMPLING_SCALE) * rate_ppm;
+}
+
+int file_sampling_init(file_sampling *fs, const char *nonce,
+                       const measurement_sampling *cfg)
+{
+    memset(fs, 0, sizeof(*fs));
+
+    if(file_sampling_derive_key(nonce, fs->key) != 0) {
+        dlog(0, "Error: unable to derive the sampling key from the nonce\n");
+        return -EINVAL;
+    }
+    fs->rate_ppm = cfg->rate_ppm;
+    fs->rounds   = cfg->rounds;
+    fs->round    = 1;
+    fs->paths    = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    if(fs->paths == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+file_sampling_decision file_sampling_decide(file_sampling *fs, const char *path)
+{
+    struct file_sampling_entry *e = g_hash_table_lookup(fs->paths, path);
+
+    if(e == NULL) {
+        e = g_new0(struct file_sampling_entry, 1);
+        e->last = fs->round;
+        g_hash_table_insert(fs->paths, g_strdup(path), e);
+    } else if(e->seen) {
+        return e->decision;
+    }
+    e->seen = true;
+    fs->files++;
+
+    if(file_sampling_selects(fs->key, fs->rate_ppm, path)) {
+        e->decision = FILE_SAMPLING_SAMPLED;
+        fs->sampled++;
+    } else if(fs->rounds > 0 && fs->round - e->last + 1 >= fs->rounds) {
+        e->decision = FILE_SAMPLING_OVERDUE;
+        fs->overdue++;
+    } else {
+        e->decision = FILE_SAMPLING_SKIP;
+    }
+
+    if(e->decision != FILE_SAMPLING_SKIP) {
+        e->last = fs->round;
+    }
+    return e->decision;
+}
+
+void file_sampling_summarize(file_sampling *fs, file_sampling_data *fsd)
+{
+    GHashTableIter iter;
+    gpointer value;
+    uint32_t oldest = 0;
+
+    g_hash_table_iter_init(&iter, fs->paths);
+    while(g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct file_sampling_entry *e = value;
+        if(e->seen && fs->round - e->last > oldest) {
+            oldest = fs->round - e->last;
+        }
+    }
+
+    fsd->rate_ppm = fs->rate_ppm;
+    fsd->rounds   = fs->rounds;
+    fsd->round    = fs->round;
+    fsd->files    = fs->files;
+    fsd->sampled  = fs->sampled;
+    fsd->overdue  = fs->overdue;
+    fsd->oldest   = oldest;
+    SHA256(fs->key, FILE_SAMPLING_KEY_SIZE, fsd->key_id);
+}
+
+/*
+ * The state file is a header line "maat-file-sampling <version>
+ * <round>" followed by one "<last round> <escaped path>" line per
+ * path.
+ */
+int file_sampling_load(file_sampling *fs, const char *path)
+{
+    GHashTable *paths;
+    gchar *contents = NULL;
+    gchar **lines = NULL;
+    unsigned int version;
+    uint32_t round;
+    int consumed = 0;
+    int ret = -EINVAL;
+    size_t i;
+
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        dlog(3, "No sampling state in %s, starting at round 1\n", path);
+        return 0;
+    }
+
+    if(sscanf(contents, FILE_SAMPLING_STATE_MAGIC" %u %"SCNu32"%n",
+              &version, &round, &consumed) != 2 || consumed == 0 ||
+            version != FILE_SAMPLING_STATE_VERSION || round == UINT32_MAX) {
+        dlog(1, "Warning: ignoring unrecognized sampling state %s\n", path);
+        g_free(contents);
+        return -EINVAL;
+    }
+
+    paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    lines = g_strsplit(contents + consumed, "\n", -1);
+    for(i = 0; lines[i] != NULL; i++) {
+        struct file_sampling_entry *e;
+        char *sep;
+        unsigned long last;
+
+        if(lines[i][0] == '\0') {
+            continue;
+        }
+        errno = 0;
+        last = strtoul(lines[i], &sep, 10);
+        if(errno != 0 || sep == lines[i] || *sep != ' ' || last > round) {
+            dlog(1, "Warning: malformed line %zu of sampling state %s\n", i + 2, path);
+            goto out;
+        }
+        e = g_new0(struct file_sampling_entry, 1);
+        e->last = (uint32_t)last;
+        g_hash_table_replace(paths, g_strcompress(sep + 1), e);
+    }
+
+    g_hash_table_destroy(fs->paths);
+    fs->paths = paths;
+    paths = NULL;
+    fs->round = round + 1;
+    ret = 0;
+
+out:
+    if(paths != NULL) {
+        g_hash_table_destroy(paths);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    return ret;
+}
+
+int file_sampling_save(file_sampling *fs, const char *path)
+{
+    GString *out;
+    GHashTableIter iter;
+    gpointer key, value;
+    GError *err = NULL;
+    int ret = 0;
+
+    out = g_string_new(NULL);
+    g_string_append_printf(out, FILE_SAMPLING_STATE_MAGIC" %d %"PRIu32"\n",
+                           FILE_SAMPLING_STATE_VERSION, fs->round);
+
+    g_hash_table_iter_init(&iter, fs->paths);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        struct file_sampling_entry *e = value;
+        gchar *escaped;
+
+        if(!e->seen) {
+            continue;
+        }
+        escaped = g_strescape(key, NULL);
+        g_string_append_printf(out, "%"PRIu32" %s\n", e->last, escaped);
+        g_free(escaped);
+    }
+
+    /* g_file_set_contents() writes a temporary file and renames it */
+    if(!g_file_set_contents(path, out->str, (gssize)out->len, &err)) {
+        dlog(1, "Warning: failed to save sampling state to %s: %s\n", path,
+             err ? err->message : "unknown error");
+        g_clear_error(&err);
+        ret = -EIO;
+    }
+    g_string_free(out, TRUE);
+    return ret;
+}
+
+void file_sampling_free(file_sampling *fs)
+{
+    if(fs->paths != NULL) {
+        g_hash_table_destroy(fs->paths);
+        fs->paths = NULL;
+    }
+    memset(fs->key, 0, sizeof(fs->key));
+}
+
+int file_sampling_check_graph(measurement_graph *g,
+                              const unsigned char key[FILE_SAMPLING_KEY_SIZE],
+                              uint32_t rate_ppm, measurement_type *hash_type,
+                              GList **missing)
+{
+    edge_iterator *it;
+    int nr_missing = 0;
+
+    for(it = measurement_graph_iterate_edges(g); it != NULL;
+            it = edge_iterator_next(it)) {
+        edge_id_t e = edge_iterator_get(it);
+        char *label = measurement_edge_get_label(g, e);
+        node_id_t n;
+        address *a;
+        file_addr *fa;
+
+        if(label == NULL || strcmp(label, "path_list.files") != 0) {
+            free(label);
+            continue;
+        }
+        free(label);
+
+        n = measurement_edge_get_destination(g, e);
+        if((a = measurement_node_get_address(g, n)) == NULL) {
+            destroy_edge_iterator(it);
+            return -EINVAL;
+        }
+        if(a->space != &file_addr_space) {
+            free_address(a);
+            continue;
+        }
+
+        fa = container_of(a, file_addr, address);
+        if(file_sampling_selects(key, rate_ppm, fa->fullpath_file_name) &&
+                measurement_node_has_data(g, n, hash_type) != 1) {
+            *missing = g_list_append(*missing, strdup(fa->fullpath_file_name));
+            nr_missing++;
+        }
+        free_address(a);
+    }
+    return nr_missing;
+}
+
+/* Local Variables:	*/
+/* c-basic-offset: 4	*/
+/* End:			*/
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Rolling coverage sampling of file hashes.
+ *
+ * Each attestation (round) hashes the files selected by a keyed
+ * pseudorandom function of their path, with the key derived from the
+ * appraiser's nonce so that the attester can not tell in advance
+ * which files will be checked. The appraiser recomputes the selection
+ * from its nonce and the file list in the evidence with
+ * file_sampling_check_graph().
+ *
+ * The round in which each path was last hashed is kept in a state
+ * file between rounds. A path not hashed for @rounds - 1 rounds is
+ * hashed regardless of the sample, so every file is hashed at least
+ * once in any @rounds consecutive rounds. Paths are counted from the
+ * round in which they are first listed; losing the state file
+ * restarts the window for every path.
+ */
+
+#ifndef _MAAT_FILE_SAMPLING_H_
+#define _MAAT_FILE_SAMPLING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <openssl/sha.h>
+
+#include <graph/graph-core.h>
+#include <measurement_spec/measurement_spec.h>
+#include <measurement/file_sampling_measurement_type.h>
+
+#define FILE_SAMPLING_KEY_SIZE SHA256_DIGEST_LENGTH
+
+typedef enum {
+    FILE_SAMPLING_SKIP = 0,
+    FILE_SAMPLING_SAMPLED,	/** selected by the keyed sample */
+    FILE_SAMPLING_OVERDUE	/** not selected, but due for coverage */
+} file_sampling_decision;
+
+typedef struct file_sampling {
+    unsigned char key[FILE_SAMPLING_KEY_SIZE];
+    uint32_t rate_ppm;
+    uint32_t rounds;
+    uint32_t round;		/* current round, the first is 1 */
+    GHashTable *paths;		/* path -> struct file_sampling_entry */
+    uint32_t files;
+    uint32_t sampled;
+    uint32_t overdue;
+} file_sampling;
+
+/**
+ * Derive the sampling key from the appraiser's @nonce.
+ */
+int file_sampling_derive_key(const char *nonce,
+                             unsigned char key[FILE_SAMPLING_KEY_SIZE]);
+
+/**
+ * Return true if the sample drawn with @key at @rate_ppm parts per
+ * million selects @path.
+ */
+bool file_sampling_selects(const unsigned char key[FILE_SAMPLING_KEY_SIZE],
+                           uint32_t rate_ppm, const char *path);
+
+/**
+ * Start round 1 of sampling as configured by @cfg, keyed from
+ * @nonce. Use file_sampling_load() to continue from a previous round.
+ */
+int file_sampling_init(file_sampling *fs, const char *nonce,
+                       const measurement_sampling *cfg);
+
+/**
+ * Decide whether @path is hashed this round and record the decision.
+ * Deciding the same path again in a round returns the first decision
+ * and is not counted twice.
+ */
+file_sampling_decision file_sampling_decide(file_sampling *fs, const char *path);
+
+/**
+ * Fill @fsd with the summary of the decisions made this round.
+ */
+void file_sampling_summarize(file_sampling *fs, file_sampling_data *fsd);
+
+/**
+ * Load the per path coverage saved by a previous round from @path and
+ * make this round the one following it. A missing file is not an
+ * error. Returns 0 on success or < 0 if the file can not be parsed,
+ * in which case @fs is left as it was.
+ */
+int file_sampling_load(file_sampling *fs, const char *path);
+
+/**
+ * Save the coverage of the paths decided this round to @path,
+ * replacing it atomically. Paths that were not listed this round are
+ * dropped.
+ */
+int file_sampling_save(file_sampling *fs, const char *path);
+
+void file_sampling_free(file_sampling *fs);
+
+/**
+ * Appraiser side check of sampled evidence: recompute the sample for
+ * every file linked from a directory node of @g by a
+ * "path_list.files" edge and append the paths of selected files that
+ * lack @hash_type data to @missing. Returns the number of such files
+ * or < 0 on error.
+ */
+int file_sampling_check_graph(measurement_graph *g,
+                              const unsigned char key[FILE_SAMPLING_KEY_SIZE],
+                              uint32_t rate_ppm, measurement_type *hash_type,
+                              GList **missing);
+
+#endif
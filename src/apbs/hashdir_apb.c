@@ -17,12 +17,22 @@
 
 /*! \file
  * This APB walks a directory and hashes all files found within the directory
+ *
+ * If the measurement specification has a <sampling> node, only a
+ * sample of the listed files keyed from the appraiser's nonce is
+ * hashed, with per path coverage kept in a state file (see
+ * file_sampling.h). The state directory is set with the
+ * "sampling_state_dir" option in the config element of the APB's
+ * metadata file. The appraiser APB checks the sample.
  */
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <uuid/uuid.h>
 
 #include <util/util.h>
+#include <util/keyvalue.h>
 
 #include <common/apb_info.h>
 #include <graph/graph-core.h>
@@ -36,9 +46,15 @@
 
 #include <maat-basetypes.h>
 #include "apb-common.h"
+#include "file_sampling.h"
+
+#ifndef DEFAULT_SAMPLING_STATE_DIR
+#define DEFAULT_SAMPLING_STATE_DIR "/var/lib/maat"
+#endif
 
 static struct asp *listdir = NULL;
 static struct asp *hashserv = NULL;
+static file_sampling *sampling = NULL;
 
 static GQueue *enumerate_variables(void *ctxt UNUSED, target_type *ttype, address_space *space,
                                    char *op, char *val)
@@ -77,6 +93,15 @@ static int measure_variable(void *ctxt, measurement_variable *var, measurement_t
         return 0;
     }
 
+    if(sampling != NULL && mtype == &sha1hash_measurement_type &&
+            var->address->space == &file_addr_space) {
+        file_addr *fa = container_of(var->address, file_addr, address);
+        if(file_sampling_decide(sampling, fa->fullpath_file_name) == FILE_SAMPLING_SKIP) {
+            dlog(6, "Not sampled this round: %s\n", fa->fullpath_file_name);
+            return 0;
+        }
+    }
+
     char *gpath      = measurement_graph_get_path(g);
     char *asp_argv[] = {gpath, n_str};
 
@@ -97,6 +122,69 @@ static int measure_variable(void *ctxt, measurement_variable *var, measurement_t
 }
 
 
+/*
+ * Attach the summary of this round's sample to the system node, where
+ * the appraiser finds the key id and coverage counters.
+ */
+static int record_sampling(measurement_graph *g, file_sampling *fs)
+{
+    measurement_variable var = {.type = &system_target_type, .address = NULL};
+    file_sampling_data *fsd = NULL;
+    node_id_t n = INVALID_NODE_ID;
+    int rc = -ENOMEM;
+
+    if((var.address = alloc_address(&unit_address_space)) == NULL) {
+        goto out;
+    }
+    if((rc = measurement_graph_add_node(g, &var, NULL, &n)) < 0) {
+        dlog(0, "Error: failed to add node for file sampling summary\n");
+        goto out;
+    }
+    fsd = (file_sampling_data *)alloc_measurement_data(&file_sampling_measurement_type);
+    if(fsd == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    file_sampling_summarize(fs, fsd);
+    dlog(2, "Sampling round %"PRIu32": hashed %"PRIu32" sampled and %"PRIu32
+         " overdue of %"PRIu32" files\n", fsd->round, fsd->sampled,
+         fsd->overdue, fsd->files);
+
+    if((rc = measurement_node_add_rawdata(g, n, &fsd->d)) < 0) {
+        dlog(0, "Error: failed to add file sampling summary to graph\n");
+    }
+
+out:
+    free_measurement_data(fsd ? &fsd->d : NULL);
+    free_address(var.address);
+    return rc < 0 ? rc : 0;
+}
+
+/*
+ * The state file names a local path, so its directory comes from the
+ * APB's own configuration and never from the peer's arguments.
+ */
+static char *sampling_state_path(meas_spec *mspec, GList *config,
+                                 struct key_value **arg_list, int argc)
+{
+    struct key_value *kv = find_key(config, "sampling_state_dir");
+    const char *dir = DEFAULT_SAMPLING_STATE_DIR;
+    char uuid_str[37];
+    int i;
+
+    if(kv != NULL && kv->value != NULL) {
+        dir = kv->value;
+    }
+    for(i = 0; i < argc; i++) {
+        if(strcmp(arg_list[i]->key, "sampling_state_dir") == 0) {
+            dlog(1, "Warning: ignoring sampling_state_dir argument, "
+                 "it is set in the APB configuration\n");
+        }
+    }
+    uuid_unparse(mspec->uuid, uuid_str);
+    return g_strdup_printf("%s/hashdir-%s.sampling", dir, uuid_str);
+}
+
 static measurement_spec_callbacks callbacks = {
     .enumerate_variables	= enumerate_variables,
     .measure_variable		= measure_variable,
@@ -107,12 +195,14 @@ static measurement_spec_callbacks callbacks = {
 int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
                 int peerchan, int resultchan UNUSED, char *target UNUSED,
                 char *target_type UNUSED, char *resource UNUSED,
-                struct key_value **arg_list UNUSED, int argc UNUSED)
+                struct key_value **arg_list, int argc)
 {
     dlog(2, "Hello from HASHDIR\n");
     int ret_val = 0;
     unsigned char *evidence;
     size_t evidence_size;
+    file_sampling fs;
+    char *state_path = NULL;
 
     if((ret_val = register_types()) < 0) {
         dlog(0, "Register types failed with status %d. Hashdir APB Bailing out\n", ret_val);
@@ -149,9 +239,27 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
         return -1;
     }
 
+    if(mspec->sampling.rate_ppm > 0) {
+        if(file_sampling_init(&fs, scen->nonce, &mspec->sampling) != 0) {
+            dlog(1, "Warning: sampling requires a nonce, hashing all files\n");
+        } else {
+            state_path = sampling_state_path(mspec, apb->config, arg_list, argc);
+            file_sampling_load(&fs, state_path);
+            sampling = &fs;
+        }
+    }
+
     dlog(6, "Evaluating measurement spec\n");
     evaluate_measurement_spec(mspec, &callbacks, graph);
 
+    if(sampling != NULL) {
+        record_sampling(graph, sampling);
+        file_sampling_save(sampling, state_path);
+        file_sampling_free(sampling);
+        sampling = NULL;
+        g_free(state_path);
+    }
+
     free_meas_spec(mspec);
     // pack and send the measurement graph
     serialize_measurement_graph(graph, &evidence_size, &evidence);
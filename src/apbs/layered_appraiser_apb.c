@@ -430,7 +430,7 @@ int apb_execute(struct apb *apb, struct scenario *scen,
     }
 
     /* Read the measurement contract */
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    doc = read_contract_xml(scen->contract, scen->size);
     if (doc == NULL) {
         dlog(1, "Failed to parse contract XML.\n");
         return ret;
@@ -442,7 +442,7 @@ int apb_execute(struct apb *apb, struct scenario *scen,
     xmlFreeDoc(doc);
 
     /* Process the measurement contract */
-    if(scen->contract == NULL || scen->size > INT_MAX) {
+    if(scen->contract == NULL) {
         dlog(0, "No valid measurement contract received by appraiser APB\n");
         ret = -1;
     } else {
@@ -325,14 +325,16 @@ static measurement_spec_callbacks callbacks = {
 };
 
 static int execute_sign_send_pipeline(measurement_graph *graph, struct scenario *scen,
-                                      const int peerchan)
+                                      const int peerchan, struct meas_spec *mspec,
+                                      struct key_value **arg_list, int argc)
 {
     int ret_val                  = -1;
     int fb_fd                    = -1;
     char *graph_path             = NULL;
     char *workdir                = NULL;
     char *partner_cert           = NULL;
-    char *serialize_args[1];
+    char **serialize_args        = NULL;
+    int nr_serialize_args;
     char *encrypt_args[1];
     char *create_con_args[8];
     struct asp *serialize        = NULL;
@@ -389,9 +391,15 @@ static int execute_sign_send_pipeline(measurement_graph *graph, struct scenario
         goto graph_path_err;
     }
 
-    serialize_args[0] = graph_path;
+    serialize_args = serialize_graph_args(graph_path, mspec, arg_list, argc,
+                                          &nr_serialize_args);
+    if(serialize_args == NULL) {
+        ret_val = -1;
+        goto serialize_args_err;
+    }
 
-    ret_val = fork_and_buffer_async_asp(serialize, 1, serialize_args, STDIN_FILENO, &fb_fd);
+    ret_val = fork_and_buffer_async_asp(serialize, nr_serialize_args, serialize_args,
+                                        STDIN_FILENO, &fb_fd);
     if(ret_val == -2) {
         dlog(0, "Failed to execute fork and buffer for %s ASP\n", serialize->name);
     } else if(ret_val == -1) {
@@ -465,6 +473,8 @@ static int execute_sign_send_pipeline(measurement_graph *graph, struct scenario
         }// End of compress child
     }// End of serialize child
 
+    g_free(serialize_args);
+serialize_args_err:
     free(graph_path);
 graph_path_err:
 find_asp_err:
@@ -484,8 +494,8 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
     struct meas_spec *mspec  = NULL;
     measurement_graph *graph = NULL;
 
-    if(argc != 2) {
-        dlog(1, "USAGE: APB_NAME <@_0> <@_T>\n");
+    if(argc < 2) {
+        dlog(1, "USAGE: APB_NAME <@_0> <@_T> [export=<filter rule> ...]\n");
         return -1;
     }
 
@@ -523,7 +533,7 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
                      arg_list[i]->value);
                 goto place_arg_err;
             }
-        } else {
+        } else if(strcmp(arg_list[i]->key, "export") != 0) {
             dlog(2, "Received unknown argument with key %s\n",
                  arg_list[i]->key);
         }
@@ -604,7 +614,7 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
     dlog(4, "Entering execute_measurement_and_asp_pipeline\n");
     /* Execute the measurement ASPs and the ASPs to combine, sign, and send the
        measurements to the appraiser */
-    ret_val = execute_sign_send_pipeline(graph, scen, peerchan);
+    ret_val = execute_sign_send_pipeline(graph, scen, peerchan, mspec, arg_list, argc);
 
 str_alloc_err:
     free(g_certfile);
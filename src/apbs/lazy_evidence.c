@@ -0,0 +1,595 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <util/util.h>
+#include <util/xml_util.h>
+#include <util/base64.h>
+#include <util/maat-io.h>
+#include <util/sign.h>
+#include <util/signfile.h>
+#include <apb/contracts.h>
+#include <measurement_spec/find_types.h>
+
+#include "lazy_evidence.h"
+
+#define LAZY_EVIDENCE_WRITE_TIMEOUT 5
+#define LAZY_EVIDENCE_REQUEST "evidence_request"
+#define LAZY_EVIDENCE_RESPONSE "evidence_response"
+
+struct lazy_evidence {
+    struct scenario *scen;
+    int chan;
+    graph_index *idx;
+    char *fingerprint;		/* of the appraiser's signing certificate */
+    uint64_t seq;		/* of the last request sent */
+    int broken;			/* the exchange failed, stop asking */
+};
+
+/*
+ * Node ids and type magics are written the way the serialized graph
+ * writes them.
+ */
+static int get_datum_id(xmlNode *datum, node_id_t *node, magic_t *type)
+{
+    char *tmp;
+    char *end;
+    unsigned long m;
+
+    if((tmp = xmlGetPropASCII(datum, "node")) == NULL) {
+        return -1;
+    }
+    *node = node_id_of_str(tmp);
+    xmlFree(tmp);
+    if(*node == INVALID_NODE_ID) {
+        return -1;
+    }
+
+    if((tmp = xmlGetPropASCII(datum, "type")) == NULL) {
+        return -1;
+    }
+    errno = 0;
+    m = strtoul(tmp, &end, 16);
+    if(errno != 0 || *end != '\0' || end == tmp || m > MAGIC_MAX) {
+        xmlFree(tmp);
+        return -1;
+    }
+    xmlFree(tmp);
+    *type = (magic_t)m;
+    return 0;
+}
+
+static xmlNode *add_datum(xmlNode *parent, node_id_t node, magic_t type,
+                          const char *content)
+{
+    node_id_str nodestr;
+    char typestr[MAGIC_STR_LEN+1];
+    xmlNode *datum;
+
+    str_of_node_id(node, nodestr);
+    snprintf(typestr, sizeof(typestr), MAGIC_FMT, type);
+
+    if((datum = xmlNewTextChild(parent, NULL, (xmlChar*)"datum",
+                                (xmlChar*)content)) == NULL) {
+        return NULL;
+    }
+    xmlNewProp(datum, (xmlChar*)"node", (xmlChar*)nodestr);
+    xmlNewProp(datum, (xmlChar*)"type", (xmlChar*)typestr);
+    return datum;
+}
+
+static int send_document(int chan, xmlDoc *doc)
+{
+    xmlChar *buf = NULL;
+    int size = 0;
+    size_t written = 0;
+    int ret;
+
+    xmlDocDumpMemory(doc, &buf, &size);
+    if(buf == NULL || size <= 0) {
+        dlog(1, "Failed to serialize evidence message\n");
+        xmlFree(buf);
+        return -1;
+    }
+
+    ret = maat_write_sz_buf(chan, buf, (size_t)size, &written,
+                            LAZY_EVIDENCE_WRITE_TIMEOUT);
+    xmlFree(buf);
+    if(ret != 0 || written != (size_t)size + sizeof(uint32_t)) {
+        dlog(1, "Failed to send evidence message: %s\n",
+             strerror(ret < 0 ? -ret : ret));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads one message and checks that it is a contract of type @type
+ * for sequence number @seq. Returns 1 and sets *@out on success, 0 on
+ * end of file or timeout, and < 0 if the message is malformed.
+ */
+static int receive_document(int chan, const char *type, uint64_t seq,
+                            time_t timeout, size_t max_size, xmlDoc **out)
+{
+    unsigned char *buf = NULL;
+    size_t size = 0;
+    size_t bytes_read = 0;
+    int eof = 0;
+    xmlDoc *doc;
+    xmlNode *root;
+    char *rootname;
+    char *tmp;
+    char *end;
+    int ret;
+
+    ret = maat_read_sz_buf(chan, &buf, &size, &bytes_read, &eof,
+                           timeout, max_size);
+    if(ret != 0 || eof != 0 || bytes_read != size) {
+        free(buf);
+        return ret == -EMSGSIZE ? -EMSGSIZE : 0;
+    }
+
+    if(size > INT_MAX ||
+            (doc = xmlReadMemory((char*)buf, (int)size, NULL, NULL, XML_PARSE_NONET)) == NULL) {
+        dlog(1, "Failed to parse evidence message\n");
+        free(buf);
+        return -EINVAL;
+    }
+    free(buf);
+
+    root = xmlDocGetRootElement(doc);
+    rootname = root ? validate_cstring_ascii(root->name, SIZE_MAX) : NULL;
+    tmp = root ? xmlGetPropASCII(root, "type") : NULL;
+    if(rootname == NULL || strcmp(rootname, "contract") != 0 ||
+            tmp == NULL || strcmp(tmp, type) != 0) {
+        dlog(1, "Expected a %s contract\n", type);
+        xmlFree(tmp);
+        goto error;
+    }
+    xmlFree(tmp);
+
+    if((tmp = xmlGetPropASCII(root, "seq")) == NULL) {
+        dlog(1, "Evidence message has no sequence number\n");
+        goto error;
+    }
+    errno = 0;
+    if(strtoull(tmp, &end, 10) != seq || errno != 0 || *end != '\0') {
+        dlog(1, "Evidence message is out of sequence (got %s, expected %"PRIu64")\n",
+             tmp, seq);
+        xmlFree(tmp);
+        goto error;
+    }
+    xmlFree(tmp);
+
+    *out = doc;
+    return 1;
+
+error:
+    xmlFreeDoc(doc);
+    return -EINVAL;
+}
+
+int lazy_evidence_offer(measurement_graph *g, struct scenario *scen,
+                        int peerchan)
+{
+    unsigned char *index = NULL;
+    size_t size = 0;
+    int ret;
+
+    if(serialize_measurement_graph_index(g, &size, &index) != 0) {
+        dlog(0, "Failed to serialize measurement graph index\n");
+        return -1;
+    }
+
+    dlog(4, "Sending measurement graph index of %zu bytes\n", size);
+    ret = generate_and_send_back_measurement_contract(peerchan, scen, index, size);
+    free(index);
+    return ret;
+}
+
+/*
+ * Answers the verified request @root. Returns 1 if it was answered,
+ * 0 if the appraiser is done, and < 0 on error.
+ */
+static int answer_request(measurement_graph *g, int chan, xmlNode *root,
+                          uint64_t seq)
+{
+    char seqstr[32];
+    xmlDoc *resp;
+    xmlNode *resp_root;
+    xmlNode *datum;
+    char *done;
+    int nr_data = 0;
+    int nr_missing = 0;
+    int ret;
+
+    done = xmlGetPropASCII(root, "done");
+    if(done != NULL && strcmp(done, "true") == 0) {
+        xmlFree(done);
+        return 0;
+    }
+    xmlFree(done);
+
+    if((resp = xmlNewDoc((xmlChar*)"1.0")) == NULL ||
+            (resp_root = xmlNewNode(NULL, (xmlChar*)"contract")) == NULL) {
+        xmlFreeDoc(resp);
+        return -ENOMEM;
+    }
+    xmlDocSetRootElement(resp, resp_root);
+    xmlNewProp(resp_root, (xmlChar*)"type", (xmlChar*)LAZY_EVIDENCE_RESPONSE);
+    snprintf(seqstr, sizeof(seqstr), "%"PRIu64, seq);
+    xmlNewProp(resp_root, (xmlChar*)"seq", (xmlChar*)seqstr);
+
+    for(datum = root->children; datum != NULL; datum = datum->next) {
+        char *name = validate_cstring_ascii(datum->name, SIZE_MAX);
+        measurement_type *mtype;
+        marshalled_data *md = NULL;
+        node_id_t node;
+        magic_t type;
+        char *b64 = NULL;
+        xmlNode *out;
+
+        if(datum->type != XML_ELEMENT_NODE || name == NULL ||
+                strcmp(name, "datum") != 0) {
+            continue;
+        }
+        if(get_datum_id(datum, &node, &type) != 0) {
+            dlog(1, "Malformed datum in evidence request\n");
+            xmlFreeDoc(resp);
+            return -EINVAL;
+        }
+
+        nr_data++;
+        if((mtype = find_measurement_type(type)) == NULL ||
+                measurement_node_get_data(g, node, mtype, &md) != 0 ||
+                (b64 = b64_encode((unsigned char*)md->marshalled_data,
+                                  md->marshalled_data_length)) == NULL) {
+            dlog(3, "No data of type "MAGIC_FMT" on node "ID_FMT"\n", type, node);
+            out = add_datum(resp_root, node, type, NULL);
+            if(out != NULL) {
+                xmlNewProp(out, (xmlChar*)"missing", (xmlChar*)"true");
+            }
+            nr_missing++;
+        } else {
+            out = add_datum(resp_root, node, type, b64);
+        }
+        b64_free(b64);
+        if(md != NULL) {
+            free_measurement_data(&md->meas_data);
+        }
+        if(out == NULL) {
+            xmlFreeDoc(resp);
+            return -ENOMEM;
+        }
+    }
+
+    dlog(5, "Answering evidence request %"PRIu64" for %d data (%d missing)\n",
+         seq, nr_data, nr_missing);
+    ret = send_document(chan, resp);
+    xmlFreeDoc(resp);
+    return ret == 0 ? 1 : ret;
+}
+
+int lazy_evidence_serve(measurement_graph *g, struct scenario *scen,
+                        int peerchan, time_t hold_secs)
+{
+    X509 *cert = NULL;
+    X509 *cacert = NULL;
+    time_t deadline = time(NULL) + hold_secs;
+    uint64_t seq = 0;
+    int flags = scen->verify_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL;
+    int served = 0;
+    int ret = -1;
+
+    if(!scen->verify_tpm &&
+            (scen->partner_cert == NULL || scen->cacert == NULL ||
+             (cert = load_cert(scen->partner_cert)) == NULL ||
+             (cacert = load_cert(scen->cacert)) == NULL)) {
+        dlog(0, "Lazy evidence needs the appraiser and CA certificates\n");
+        goto out;
+    }
+
+    while(1) {
+        time_t now = time(NULL);
+        xmlDoc *doc = NULL;
+        xmlNode *root;
+        int rc;
+
+        if(now >= deadline) {
+            dlog(3, "Releasing measurement graph after %ld seconds\n",
+                 (long)hold_secs);
+            break;
+        }
+
+        rc = receive_document(peerchan, LAZY_EVIDENCE_REQUEST, seq + 1,
+                              deadline - now, LAZY_EVIDENCE_MAX_REQUEST, &doc);
+        if(rc == 0) {
+            dlog(4, "Appraiser stopped requesting evidence\n");
+            break;
+        } else if(rc < 0) {
+            ret = rc;
+            goto out;
+        }
+        seq++;
+
+        root = xmlDocGetRootElement(doc);
+        if(verify_xml_x509(doc, root, cert, cacert, scen->nonce,
+                           scen->akpubkey, flags) != 1) {
+            dlog(0, "Evidence request %"PRIu64" has a bad signature\n", seq);
+            xmlFreeDoc(doc);
+            ret = -EPERM;
+            goto out;
+        }
+
+        rc = answer_request(g, peerchan, root, seq);
+        xmlFreeDoc(doc);
+        if(rc < 0) {
+            ret = rc;
+            goto out;
+        } else if(rc == 0) {
+            break;
+        }
+        served++;
+    }
+
+    dlog(4, "Answered %d evidence requests\n", served);
+    ret = served;
+
+out:
+    X509_free(cert);
+    X509_free(cacert);
+    return ret;
+}
+
+lazy_evidence *lazy_evidence_open(struct scenario *scen, int peerchan,
+                                  graph_index *idx)
+{
+    lazy_evidence *ev;
+
+    if(scen->certfile == NULL || scen->keyfile == NULL) {
+        dlog(0, "Lazy evidence needs a certificate and key to sign requests\n");
+        return NULL;
+    }
+
+    if((ev = calloc(1, sizeof(*ev))) == NULL) {
+        return NULL;
+    }
+    ev->scen = scen;
+    ev->chan = peerchan;
+    ev->idx  = idx;
+    if((ev->fingerprint = get_fingerprint(scen->certfile, NULL)) == NULL) {
+        dlog(0, "Failed to get fingerprint of %s\n", scen->certfile);
+        free(ev);
+        return NULL;
+    }
+    return ev;
+}
+
+/*
+ * Builds the next request. The datum elements are added by the
+ * caller, which then sends it with send_request(). The nonce is where
+ * verify_xml() looks for it, and is covered by the signature of the
+ * whole request.
+ */
+static xmlDoc *new_request(lazy_evidence *ev, xmlNode **root)
+{
+    char seqstr[32];
+    xmlDoc *doc;
+
+    if((doc = xmlNewDoc((xmlChar*)"1.0")) == NULL ||
+            (*root = xmlNewNode(NULL, (xmlChar*)"contract")) == NULL) {
+        xmlFreeDoc(doc);
+        return NULL;
+    }
+    xmlDocSetRootElement(doc, *root);
+    xmlNewProp(*root, (xmlChar*)"type", (xmlChar*)LAZY_EVIDENCE_REQUEST);
+    snprintf(seqstr, sizeof(seqstr), "%"PRIu64, ev->seq + 1);
+    xmlNewProp(*root, (xmlChar*)"seq", (xmlChar*)seqstr);
+    if(xmlNewTextChild(*root, NULL, (xmlChar*)"nonce",
+                       (xmlChar*)ev->scen->nonce) == NULL) {
+        xmlFreeDoc(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+static int send_request(lazy_evidence *ev, xmlDoc *doc, xmlNode *root)
+{
+    struct scenario *scen = ev->scen;
+
+    if(sign_xml(doc, root, ev->fingerprint, scen->keyfile, scen->keypass,
+                scen->nonce, scen->tpmpass, scen->akctx,
+                scen->sign_tpm ? SIGNATURE_TPM : SIGNATURE_OPENSSL) != 0) {
+        dlog(0, "Failed to sign evidence request\n");
+        return -1;
+    }
+    if(send_document(ev->chan, doc) != 0) {
+        return -1;
+    }
+    ev->seq++;
+    return 0;
+}
+
+/*
+ * Checks the datum @datum of a response against the index and adds
+ * it to @node of @g. Returns 1 if it was added, 0 if not.
+ */
+static int add_fetched_datum(lazy_evidence *ev, measurement_graph *g,
+                             node_id_t node, xmlNode *datum)
+{
+    graph_index_entry *e;
+    measurement_type *mtype;
+    marshalled_data *md;
+    node_id_t source;
+    magic_t type;
+    char *tmp;
+    unsigned char *data;
+    size_t size = 0;
+
+    if(get_datum_id(datum, &source, &type) != 0 ||
+            (e = graph_index_find(ev->idx, node, type)) == NULL ||
+            e->source_node != source) {
+        dlog(1, "Evidence response has an unexpected datum\n");
+        return 0;
+    }
+
+    /* each datum counts once */
+    if((mtype = find_measurement_type(type)) == NULL ||
+            measurement_node_has_data(g, node, mtype) != 0) {
+        return 0;
+    }
+
+    tmp = xmlGetPropASCII(datum, "missing");
+    if(tmp != NULL) {
+        dlog(1, "Attester has no data of type "MAGIC_FMT" for node "ID_FMT"\n",
+             type, source);
+        xmlFree(tmp);
+        return 0;
+    }
+
+    if((tmp = xmlNodeGetContentASCII(datum)) == NULL) {
+        return 0;
+    }
+    data = b64_decode(tmp, &size);
+    xmlFree(tmp);
+    if(data == NULL) {
+        dlog(1, "Failed to decode datum of type "MAGIC_FMT"\n", type);
+        return 0;
+    }
+
+    if(graph_index_check(e, (char*)data, size) != 1) {
+        dlog(0, "Datum of type "MAGIC_FMT" for node "ID_FMT" does not match the index\n",
+             type, source);
+        b64_free(data);
+        return 0;
+    }
+
+    md = (marshalled_data *)alloc_measurement_data(&marshalled_data_measurement_type);
+    if(md == NULL || (md->marshalled_data = malloc(size)) == NULL) {
+        if(md != NULL) {
+            free_measurement_data(&md->meas_data);
+        }
+        b64_free(data);
+        return 0;
+    }
+    memcpy(md->marshalled_data, data, size);
+    md->marshalled_data_length = size;
+    md->unmarshalled_type = type;
+    b64_free(data);
+
+    if(measurement_node_add_data(g, node, md) != 0) {
+        dlog(1, "Failed to add fetched datum to node\n");
+        free_measurement_data(&md->meas_data);
+        return 0;
+    }
+    free_measurement_data(&md->meas_data);
+    return 1;
+}
+
+int lazy_evidence_fetch(lazy_evidence *ev, measurement_graph *g,
+                        node_id_t node, GList *types)
+{
+    xmlDoc *doc;
+    xmlNode *root;
+    xmlNode *datum;
+    GList *l;
+    int nr_requested = 0;
+    int nr_added = 0;
+    int nr_unknown = 0;
+    int rc;
+
+    if(ev->broken) {
+        return -1;
+    }
+
+    if((doc = new_request(ev, &root)) == NULL) {
+        return -ENOMEM;
+    }
+    for(l = types; l != NULL; l = l->next) {
+        magic_t type = (magic_t)GPOINTER_TO_UINT(l->data);
+        graph_index_entry *e = graph_index_find(ev->idx, node, type);
+
+        if(e == NULL) {
+            nr_unknown++;
+        } else if(add_datum(root, e->source_node, type, NULL) == NULL) {
+            xmlFreeDoc(doc);
+            return -ENOMEM;
+        } else {
+            nr_requested++;
+        }
+    }
+
+    if(nr_requested == 0) {
+        xmlFreeDoc(doc);
+        return nr_unknown;
+    }
+
+    if(send_request(ev, doc, root) != 0) {
+        xmlFreeDoc(doc);
+        ev->broken = 1;
+        return -EIO;
+    }
+    xmlFreeDoc(doc);
+
+    rc = receive_document(ev->chan, LAZY_EVIDENCE_RESPONSE, ev->seq,
+                          MAAT_APB_PEER_TIMEOUT, LAZY_EVIDENCE_MAX_RESPONSE, &doc);
+    if(rc <= 0) {
+        dlog(0, "Failed to receive evidence from attester\n");
+        ev->broken = 1;
+        return rc < 0 ? rc : -EIO;
+    }
+
+    root = xmlDocGetRootElement(doc);
+    for(datum = root->children; datum != NULL; datum = datum->next) {
+        char *name = validate_cstring_ascii(datum->name, SIZE_MAX);
+        if(datum->type == XML_ELEMENT_NODE && name != NULL &&
+                strcmp(name, "datum") == 0 && nr_added < nr_requested) {
+            nr_added += add_fetched_datum(ev, g, node, datum);
+        }
+    }
+    xmlFreeDoc(doc);
+
+    dlog(5, "Fetched %d of %d data for node "ID_FMT"\n", nr_added,
+         nr_requested + nr_unknown, node);
+    return nr_unknown + nr_requested - nr_added;
+}
+
+void lazy_evidence_close(lazy_evidence *ev)
+{
+    xmlDoc *doc;
+    xmlNode *root;
+
+    if(ev == NULL) {
+        return;
+    }
+
+    if(!ev->broken && (doc = new_request(ev, &root)) != NULL) {
+        xmlNewProp(root, (xmlChar*)"done", (xmlChar*)"true");
+        if(send_request(ev, doc, root) != 0) {
+            dlog(2, "Failed to tell the attester that appraisal is done\n");
+        }
+        xmlFreeDoc(doc);
+    }
+
+    free(ev->fingerprint);
+    free(ev);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Lazy, appraiser driven retrieval of measurement evidence.
+ *
+ * Instead of the whole measurement graph, the attester sends an index
+ * of it (see serialize_measurement_graph_index()) in its signed
+ * measurement contract and keeps the graph for a bounded time. The
+ * appraiser then fetches the data it actually appraises over the same
+ * peer channel.
+ *
+ * Every message is a maat-io sized buffer holding a contract.
+ * Requests carry the attestation nonce and a sequence number and are
+ * signed by the appraiser, so the attester only answers its own peer
+ * and a request can not be replayed. Responses are not signed: each
+ * datum is checked against the digest in the signed index before it
+ * is added to the appraiser's graph.
+ *
+ *   <contract type="evidence_request" seq="1">
+ *     <nonce>...</nonce>
+ *     <datum node="..." type="..."/>
+ *     <signature>...</signature>
+ *   </contract>
+ *
+ *   <contract type="evidence_response" seq="1">
+ *     <datum node="..." type="...">base64 marshalled data</datum>
+ *     <datum node="..." type="..." missing="true"/>
+ *   </contract>
+ *
+ * The appraiser ends the exchange with a request whose done attribute
+ * is "true", which is not answered.
+ */
+
+#ifndef _MAAT_LAZY_EVIDENCE_H_
+#define _MAAT_LAZY_EVIDENCE_H_
+
+#include <time.h>
+#include <glib.h>
+
+#include <common/scenario.h>
+#include <graph/graph-core.h>
+
+/* how long the attester keeps the graph by default, in seconds */
+#define LAZY_EVIDENCE_DEFAULT_HOLD	60
+#define LAZY_EVIDENCE_MAX_REQUEST	(1024 * 1024)
+#define LAZY_EVIDENCE_MAX_RESPONSE	(64 * 1024 * 1024)
+
+/**
+ * Attester side: send the index of @g to the appraiser on @peerchan
+ * as the measurement of a measurement contract generated for @scen.
+ * Returns 0 on success, < 0 on error.
+ */
+int lazy_evidence_offer(measurement_graph *g, struct scenario *scen,
+                        int peerchan);
+
+/**
+ * Attester side: answer requests for the data of @g arriving on
+ * @peerchan until the appraiser is done, closes the channel, or
+ * @hold_secs seconds have passed. Requests that are not signed by
+ * @scen->partner_cert over @scen->nonce end the exchange.
+ * Returns the number of requests answered, or < 0 on error.
+ */
+int lazy_evidence_serve(measurement_graph *g, struct scenario *scen,
+                        int peerchan, time_t hold_secs);
+
+typedef struct lazy_evidence lazy_evidence;
+
+/**
+ * Appraiser side: start fetching the data described by @idx from the
+ * attester on @peerchan. @idx must outlive the returned handle.
+ */
+lazy_evidence *lazy_evidence_open(struct scenario *scen, int peerchan,
+                                  graph_index *idx);
+
+/**
+ * Appraiser side: fetch the data of types @types (a list of magic_t
+ * stored with GUINT_TO_POINTER()) of @node of @g, the graph parsed
+ * with the index, in a single request, and add it to @node.
+ * Returns 0 if all of it was fetched and matched the index, > 0 if
+ * some datum was missing or did not match (nothing is added for it),
+ * and < 0 on error, after which no further fetches are possible.
+ */
+int lazy_evidence_fetch(lazy_evidence *ev, measurement_graph *g,
+                        node_id_t node, GList *types);
+
+/**
+ * Appraiser side: tell the attester that no more data is needed and
+ * free @ev.
+ */
+void lazy_evidence_close(lazy_evidence *ev);
+
+#endif
@@ -0,0 +1,577 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include <util/util.h>
+#include <util/keyvalue.h>
+#include <maat-basetypes.h>
+
+#include "premeasure.h"
+
+#ifndef DEFAULT_PREMEASURE_DIR
+#define DEFAULT_PREMEASURE_DIR "/var/lib/maat"
+#endif
+
+#define PREMEASURE_WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+                                 IN_DELETE | IN_DELETE_SELF | IN_MOVE | IN_MOVE_SELF)
+
+static const char *arg_value(struct key_value **arg_list, int argc,
+                             const char *key)
+{
+    const char *value = NULL;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(strcmp(arg_list[i]->key, key) == 0 && arg_list[i]->value != NULL) {
+            value = arg_list[i]->value;
+        }
+    }
+    return value;
+}
+
+static int parse_seconds(const char *arg, const char *name, time_t *out)
+{
+    char *end;
+    long secs;
+
+    errno = 0;
+    secs = strtol(arg, &end, 10);
+    if(errno != 0 || end == arg || *end != '\0' || secs < 0) {
+        dlog(0, "Invalid %s \"%s\"\n", name, arg);
+        return -EINVAL;
+    }
+    *out = (time_t)secs;
+    return 0;
+}
+
+static const char *config_value(GList *config, const char *key)
+{
+    struct key_value *kv = find_key(config, (char *)key);
+
+    return kv != NULL ? kv->value : NULL;
+}
+
+int premeasure_init(premeasure *pm, const char *apb_name, GList *config,
+                    meas_spec *mspec, struct key_value **arg_list, int argc)
+{
+    const char *interval_arg = arg_value(arg_list, argc, "premeasure");
+    const char *age_arg = arg_value(arg_list, argc, "premeasure_max_age");
+    const char *idle_arg = arg_value(arg_list, argc, "premeasure_idle");
+    const char *dir_conf = config_value(config, "premeasure_dir");
+    const char *watch_conf = config_value(config, "premeasure_watch");
+    const char *age_conf = config_value(config, "premeasure_max_age");
+    time_t age_limit = PREMEASURE_DEFAULT_MAX_AGE;
+    char uuid_str[37];
+
+    memset(pm, 0, sizeof(*pm));
+    pm->graphfd  = -1;
+    pm->max_age  = PREMEASURE_DEFAULT_MAX_AGE;
+    pm->idle     = PREMEASURE_DEFAULT_IDLE;
+
+    if(interval_arg == NULL || mspec == NULL) {
+        return 0;
+    }
+    if(arg_value(arg_list, argc, "premeasure_dir") != NULL ||
+            arg_value(arg_list, argc, "premeasure_watch") != NULL) {
+        dlog(1, "Warning: ignoring premeasure_dir and premeasure_watch arguments, "
+             "they are set in the APB configuration\n");
+    }
+    if(parse_seconds(interval_arg, "premeasure interval", &pm->interval) < 0 ||
+            pm->interval == 0 ||
+            (age_conf != NULL &&
+             parse_seconds(age_conf, "configured premeasure_max_age", &age_limit) < 0) ||
+            (age_arg != NULL &&
+             parse_seconds(age_arg, "premeasure_max_age", &pm->max_age) < 0) ||
+            (idle_arg != NULL &&
+             parse_seconds(idle_arg, "premeasure_idle", &pm->idle) < 0)) {
+        return -EINVAL;
+    }
+    /* the request may only ask for fresher evidence than configured */
+    if(age_arg == NULL || pm->max_age > age_limit) {
+        pm->max_age = age_limit;
+    }
+    if(pm->max_age > UINT32_MAX) {
+        dlog(0, "premeasure_max_age is too large\n");
+        return -EINVAL;
+    }
+
+    uuid_unparse(mspec->uuid, uuid_str);
+    pm->dir		   = strdup(dir_conf ? dir_conf : DEFAULT_PREMEASURE_DIR);
+    pm->latest	   = g_strdup_printf("%s/%s-%s.latest", pm->dir, apb_name, uuid_str);
+    pm->graph_template = g_strdup_printf("%s/%s-%s.graph.XXXXXX", pm->dir,
+                                         apb_name, uuid_str);
+    pm->lockpath	   = g_strdup_printf("%s/%s-%s.premeasure", pm->dir, apb_name,
+                                         uuid_str);
+    pm->watch	   = watch_conf ? strdup(watch_conf) : NULL;
+    if(pm->dir == NULL || pm->latest == NULL || pm->graph_template == NULL ||
+            pm->lockpath == NULL || (watch_conf != NULL && pm->watch == NULL)) {
+        premeasure_release(pm);
+        return -ENOMEM;
+    }
+
+    if(mkdir_p(pm->dir, S_IRWXU | S_IRWXG) != 0) {
+        dlog(0, "Failed to create pre-measurement directory %s\n", pm->dir);
+        premeasure_release(pm);
+        return -EIO;
+    }
+    return 1;
+}
+
+/*
+ * The freshness record lives on the system node, next to the coverage
+ * record of a budgeted measurement.
+ */
+static int record_freshness(measurement_graph *g, time_t measured_at, time_t max_age)
+{
+    measurement_variable var = {.type = &system_target_type, .address = NULL};
+    freshness_data *fd = NULL;
+    node_id_t n = INVALID_NODE_ID;
+    int rc = -ENOMEM;
+
+    if((var.address = alloc_address(&unit_address_space)) == NULL) {
+        goto out;
+    }
+    if((rc = measurement_graph_add_node(g, &var, NULL, &n)) < 0) {
+        dlog(0, "Error: failed to add node for measurement freshness\n");
+        goto out;
+    }
+    if((fd = (freshness_data *)alloc_measurement_data(&freshness_measurement_type)) == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    fd->measured_at = (uint64_t)measured_at;
+    fd->max_age     = (uint32_t)max_age;
+    if((rc = measurement_node_add_rawdata(g, n, &fd->d)) < 0) {
+        dlog(0, "Error: failed to add measurement freshness to graph\n");
+    }
+
+out:
+    free_measurement_data(fd ? &fd->d : NULL);
+    free_address(var.address);
+    return rc < 0 ? rc : 0;
+}
+
+static int read_freshness(measurement_graph *g, time_t *measured_at, time_t *max_age)
+{
+    measurement_variable var = {.type = &system_target_type, .address = NULL};
+    measurement_data *data = NULL;
+    freshness_data *fd;
+    node_id_t n;
+
+    if((var.address = alloc_address(&unit_address_space)) == NULL) {
+        return -ENOMEM;
+    }
+    n = measurement_graph_get_node(g, &var);
+    free_address(var.address);
+    if(n == INVALID_NODE_ID ||
+            measurement_node_get_rawdata(g, n, &freshness_measurement_type, &data) != 0) {
+        return -ENOENT;
+    }
+    fd = container_of(data, freshness_data, d);
+    *measured_at = (time_t)fd->measured_at;
+    *max_age     = (time_t)fd->max_age;
+    free_measurement_data(data);
+    return 0;
+}
+
+static char *read_latest(premeasure *pm)
+{
+    char buf[PATH_MAX];
+    size_t prefix_len = strlen(pm->graph_template) - strlen("XXXXXX");
+    ssize_t len = readlink(pm->latest, buf, sizeof(buf) - 1);
+
+    if(len < 0) {
+        return NULL;
+    }
+    buf[len] = '\0';
+    /* only graphs this APB measured for this spec */
+    if(strncmp(buf, pm->graph_template, prefix_len) != 0 ||
+            strchr(buf + prefix_len, '/') != NULL) {
+        dlog(1, "Warning: %s does not point to a pre-measured graph\n", pm->latest);
+        return NULL;
+    }
+    return strdup(buf);
+}
+
+measurement_graph *premeasure_take(premeasure *pm)
+{
+    measurement_graph *g = NULL;
+    char *path = NULL;
+    char *again;
+    time_t now, measured_at, max_age;
+    int fd = -1;
+    int tries;
+
+    /* The graph may be superseded and removed between reading the
+       link and locking it; it is safe once it is locked and still the
+       latest, since only superseded graphs are removed. */
+    for(tries = 0; tries < 3 && fd < 0; tries++) {
+        if((path = read_latest(pm)) == NULL) {
+            return NULL;
+        }
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd >= 0 && flock(fd, LOCK_SH | LOCK_NB) == 0 &&
+                (again = read_latest(pm)) != NULL) {
+            if(strcmp(again, path) != 0) {
+                close(fd);
+                fd = -1;
+            }
+            free(again);
+        } else if(fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        if(fd < 0) {
+            free(path);
+            path = NULL;
+        }
+    }
+    if(fd < 0) {
+        dlog(2, "No pre-measured graph could be locked\n");
+        return NULL;
+    }
+
+    if(map_measurement_graph(path, &g) != 0) {
+        dlog(1, "Warning: failed to map pre-measured graph %s\n", path);
+        g = NULL;
+        goto out;
+    }
+    if(read_freshness(g, &measured_at, &max_age) < 0) {
+        dlog(1, "Warning: pre-measured graph %s has no freshness record\n", path);
+        goto stale;
+    }
+
+    /* the attester's own bound and the one recorded in the evidence */
+    if(pm->max_age < max_age) {
+        max_age = pm->max_age;
+    }
+    now = time(NULL);
+    if(measured_at > now || now - measured_at > max_age) {
+        dlog(2, "Pre-measured graph %s is %ld seconds old, max age is %ld\n",
+             path, (long)(now - measured_at), (long)max_age);
+        goto stale;
+    }
+    dlog(3, "Answering from pre-measured graph %s, %ld seconds old\n", path,
+         (long)(now - measured_at));
+    pm->graphfd = fd;
+    fd = -1;
+    goto out;
+
+stale:
+    unmap_measurement_graph(g);
+    g = NULL;
+out:
+    if(fd >= 0) {
+        close(fd);
+    }
+    free(path);
+    return g;
+}
+
+static int publish_graph(premeasure *pm, const char *path)
+{
+    char *tmp = g_strdup_printf("%s.tmp", pm->latest);
+    int ret = 0;
+
+    if(tmp == NULL) {
+        return -ENOMEM;
+    }
+    if((unlink(tmp) != 0 && errno != ENOENT) ||
+            symlink(path, tmp) != 0 || rename(tmp, pm->latest) != 0) {
+        ret = -errno;
+        dlog(0, "Failed to publish pre-measured graph %s: %s\n", path,
+             strerror(errno));
+        unlink(tmp);
+    }
+    g_free(tmp);
+    return ret;
+}
+
+/*
+ * Remove every graph of this APB and spec but @keep that no request
+ * holds, including graphs left behind by a measurer that died.
+ */
+static void reclaim_graphs(premeasure *pm, const char *keep)
+{
+    char *base = g_path_get_basename(pm->graph_template);
+    size_t prefix_len = strlen(base) - strlen("XXXXXX");
+    struct dirent *de;
+    DIR *dir;
+
+    if((dir = opendir(pm->dir)) == NULL) {
+        g_free(base);
+        return;
+    }
+    while((de = readdir(dir)) != NULL) {
+        char *path;
+        int fd;
+
+        if(strncmp(de->d_name, base, prefix_len) != 0 ||
+                strlen(de->d_name) != strlen(base)) {
+            continue;
+        }
+        path = g_strdup_printf("%s/%s", pm->dir, de->d_name);
+        if(path == NULL || strcmp(path, keep) == 0) {
+            g_free(path);
+            continue;
+        }
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            dlog(4, "Removing superseded graph %s\n", path);
+            rmrf(path);
+        }
+        if(fd >= 0) {
+            close(fd);
+        }
+        g_free(path);
+    }
+    closedir(dir);
+    g_free(base);
+}
+
+/* 1 if the watched paths changed since the last call, 0 if not */
+static int drain_changes(int wfd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+
+    while(read(wfd, buf, sizeof(buf)) > 0) {
+        changed = 1;
+    }
+    return changed;
+}
+
+/*
+ * Measure into a new graph and publish it. If @wfd is a watch on the
+ * premeasure_watch paths and they change during measurement, the
+ * graph is discarded and -EAGAIN returned.
+ */
+static int measure_and_publish(premeasure *pm, premeasure_fn measure, void *ctxt,
+                               int wfd)
+{
+    time_t started = time(NULL);
+    measurement_graph *g;
+    char *path = NULL;
+    int ret;
+
+    if((g = create_measurement_graph(pm->graph_template)) == NULL) {
+        dlog(0, "Failed to create graph in %s\n", pm->dir);
+        return -EIO;
+    }
+    ret = measure(g, ctxt);
+    if(ret == 0) {
+        ret = record_freshness(g, started, pm->max_age);
+    }
+    if(ret == 0 && wfd >= 0 && drain_changes(wfd)) {
+        dlog(3, "Watched paths changed during pre-measurement\n");
+        ret = -EAGAIN;
+    }
+    if(ret < 0 || (path = measurement_graph_get_path(g)) == NULL) {
+        destroy_measurement_graph(g);
+        return ret < 0 ? ret : -ENOMEM;
+    }
+    unmap_measurement_graph(g);
+
+    if((ret = publish_graph(pm, path)) < 0) {
+        rmrf(path);
+    } else {
+        dlog(3, "Published pre-measured graph %s\n", path);
+        reclaim_graphs(pm, path);
+    }
+    free(path);
+    return ret;
+}
+
+int premeasure_once(premeasure *pm, premeasure_fn measure, void *ctxt)
+{
+    return measure_and_publish(pm, measure, ctxt, -1);
+}
+
+static int watch_paths(const char *watch)
+{
+    gchar **paths;
+    int wfd, i;
+
+    if(watch == NULL) {
+        return -1;
+    }
+    if((wfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        dlog(1, "Warning: failed to watch %s: %s\n", watch, strerror(errno));
+        return -1;
+    }
+    paths = g_strsplit(watch, ":", -1);
+    for(i = 0; paths != NULL && paths[i] != NULL; i++) {
+        if(paths[i][0] != '\0' &&
+                inotify_add_watch(wfd, paths[i], PREMEASURE_WATCH_EVENTS) < 0) {
+            dlog(1, "Warning: failed to watch %s: %s\n", paths[i], strerror(errno));
+        }
+    }
+    g_strfreev(paths);
+    return wfd;
+}
+
+/* whether no request has used pre-measurement for premeasure_idle seconds */
+static int is_idle(premeasure *pm)
+{
+    struct stat st;
+
+    if(pm->idle == 0) {
+        return 0;
+    }
+    return stat(pm->lockpath, &st) != 0 || time(NULL) - st.st_mtime > pm->idle;
+}
+
+static void premeasure_loop(premeasure *pm, premeasure_fn measure, void *ctxt)
+{
+    struct pollfd pfd;
+    int ret;
+
+    dlog(3, "Pre-measuring into %s every %ld seconds\n", pm->dir, (long)pm->interval);
+    while(!is_idle(pm)) {
+        /* watches are set up again each time, since watched files
+           may have been replaced */
+        pfd.fd = watch_paths(pm->watch);
+        pfd.events = POLLIN;
+
+        ret = measure_and_publish(pm, measure, ctxt, pfd.fd);
+        if(ret == -EPERM) {
+            dlog(1, "Warning: %s cannot be pre-measured\n", pm->latest);
+            unlink(pm->latest);
+            if(pfd.fd >= 0) {
+                close(pfd.fd);
+            }
+            break;
+        } else if(ret == -EAGAIN) {
+            unlink(pm->latest);
+        } else {
+            if(ret < 0) {
+                dlog(1, "Warning: pre-measurement failed: %s\n", strerror(-ret));
+            }
+            if(poll(&pfd, pfd.fd >= 0 ? 1 : 0, (int)(pm->interval * 1000)) > 0) {
+                dlog(3, "Watched paths changed, withdrawing pre-measured graph\n");
+                unlink(pm->latest);
+            }
+        }
+        if(pfd.fd >= 0) {
+            close(pfd.fd);
+        }
+    }
+    dlog(3, "Pre-measurement of %s exiting\n", pm->latest);
+}
+
+/* Close everything the APB had open but the lock @keep. */
+static void close_inherited_fds(int keep)
+{
+    struct dirent *de;
+    DIR *dir;
+
+    if((dir = opendir("/proc/self/fd")) == NULL) {
+        return;
+    }
+    while((de = readdir(dir)) != NULL) {
+        int fd = atoi(de->d_name);
+        if(fd > STDERR_FILENO && fd != keep && fd != dirfd(dir)) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+pid_t premeasure_start(premeasure *pm, premeasure_fn measure, void *ctxt)
+{
+    pid_t pid;
+    int lockfd;
+    int ret;
+
+    lockfd = open(pm->lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(lockfd < 0) {
+        ret = -errno;
+        dlog(0, "Failed to open %s: %s\n", pm->lockpath, strerror(errno));
+        return ret;
+    }
+    /* the measurer keeps running while requests touch its lock */
+    if(futimens(lockfd, NULL) != 0) {
+        dlog(1, "Warning: failed to touch %s: %s\n", pm->lockpath, strerror(errno));
+    }
+    if(flock(lockfd, LOCK_EX | LOCK_NB) != 0) {
+        ret = errno == EWOULDBLOCK ? 0 : -errno;
+        close(lockfd);
+        return ret;
+    }
+
+    pid = fork();
+    if(pid < 0) {
+        ret = -errno;
+        close(lockfd);
+        return ret;
+    }
+    if(pid == 0) {
+        /* detach, so the measurer outlives the APB and the AM does not
+           wait for it */
+        if(setsid() < 0 || (pid = fork()) < 0) {
+            _exit(1);
+        }
+        if(pid > 0) {
+            _exit(0);
+        }
+        close_inherited_fds(lockfd);
+        premeasure_loop(pm, measure, ctxt);
+        _exit(0);
+    }
+
+    /* the lock stays with the measurer */
+    close(lockfd);
+    if(waitpid(pid, NULL, 0) < 0) {
+        dlog(1, "Warning: failed to reap pre-measurement launcher: %s\n",
+             strerror(errno));
+    }
+    dlog(3, "Started background pre-measurement of %s\n", pm->latest);
+    return pid;
+}
+
+void premeasure_release(premeasure *pm)
+{
+    if(pm->graphfd >= 0) {
+        close(pm->graphfd);
+    }
+    free(pm->dir);
+    g_free(pm->latest);
+    g_free(pm->graph_template);
+    g_free(pm->lockpath);
+    free(pm->watch);
+    memset(pm, 0, sizeof(*pm));
+    pm->graphfd = -1;
+}
+
+/* Local Variables:	*/
+/* c-basic-offset: 4	*/
+/* End:			*/
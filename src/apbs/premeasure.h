@@ -0,0 +1,125 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Background pre-measurement.
+ *
+ * With the argument premeasure=N an attester APB keeps a complete
+ * measurement graph of its spec ready before requests arrive. The
+ * first request starts a background measurer which measures the spec
+ * into a new graph every N seconds, and whenever one of the paths in
+ * premeasure_watch changes, and publishes each complete graph as the
+ * latest one. Later requests sign and send the latest graph, bound to
+ * their nonce only then, as long as it is no older than
+ * premeasure_max_age seconds; otherwise they measure as usual.
+ *
+ * The published graph carries a freshness record (see
+ * freshness_measurement_type.h) on its system node giving the time
+ * measurement started and the max age, so appraisers see how old the
+ * evidence is. A change to a watched path withdraws the latest graph
+ * until it has been measured again. The measurer exits once no
+ * request has used it for premeasure_idle seconds.
+ *
+ * Graphs are kept in premeasure_dir, DEFAULT_PREMEASURE_DIR by
+ * default. Requests hold a shared lock on the graph they answer from,
+ * and the measurer only removes superseded graphs it can lock
+ * exclusively.
+ *
+ * premeasure_dir and premeasure_watch are only read from the <config>
+ * element of the APB's metadata, never from the request. A
+ * premeasure_max_age configured there bounds the one a request asks
+ * for (PREMEASURE_DEFAULT_MAX_AGE if not configured).
+ *
+ * The measurer answers no request, so it has no nonce to bind
+ * measurements to. A measure function that needs one returns -EPERM,
+ * and the measurer publishes nothing and exits.
+ */
+
+#ifndef _MAAT_PREMEASURE_H_
+#define _MAAT_PREMEASURE_H_
+
+#include <time.h>
+#include <sys/types.h>
+
+#include <graph/graph-core.h>
+#include <measurement_spec/measurement_spec.h>
+#include <util/keyvalue.h>
+
+#define PREMEASURE_DEFAULT_MAX_AGE	600
+#define PREMEASURE_DEFAULT_IDLE		3600
+
+typedef struct premeasure {
+    char *dir;
+    char *latest;		/* symlink to the latest complete graph */
+    char *graph_template;	/* mkdtemp() template for new graphs */
+    char *lockpath;		/* locked by the measurer, touched by requests */
+    char *watch;		/* ':' separated paths, or NULL */
+    time_t interval;
+    time_t max_age;
+    time_t idle;
+    int graphfd;		/* shared lock on the graph taken */
+} premeasure;
+
+/**
+ * Measures into @g. Returns 0 on success, -EPERM if @g can only be
+ * measured for a request, or < 0 on error.
+ */
+typedef int (*premeasure_fn)(measurement_graph *g, void *ctxt);
+
+/**
+ * Set up @pm for pre-measuring @mspec in @apb_name as requested by the
+ * premeasure arguments in @arg_list, within the settings in @config
+ * (the APB's struct key_value configuration). Returns 1 if
+ * pre-measurement is enabled, 0 if it was not requested and < 0 on
+ * error.
+ */
+int premeasure_init(premeasure *pm, const char *apb_name, GList *config,
+                    meas_spec *mspec, struct key_value **arg_list, int argc);
+
+/**
+ * Return the latest pre-measured graph if it is fresh enough, NULL
+ * otherwise. The graph is mapped, not copied: the caller must not
+ * modify it, and must unmap it with unmap_measurement_graph() before
+ * calling premeasure_release().
+ */
+measurement_graph *premeasure_take(premeasure *pm);
+
+/**
+ * Measure into a new graph with @measure, record its freshness and
+ * publish it as the latest graph, then remove superseded graphs that
+ * are not in use. Returns 0 on success or < 0 on error.
+ */
+int premeasure_once(premeasure *pm, premeasure_fn measure, void *ctxt);
+
+/**
+ * Note that a request used pre-measurement and start the background
+ * measurer, running premeasure_once() with @measure and @ctxt, unless
+ * it is already running. The measurer runs in its own session with no
+ * file descriptors but the standard ones.
+ *
+ * Returns the pid of the process that started the measurer, which has
+ * already been reaped, 0 if it was running, or < 0 on error.
+ */
+pid_t premeasure_start(premeasure *pm, premeasure_fn measure, void *ctxt);
+
+/**
+ * Release the resources of @pm, including the lock on a graph
+ * returned by premeasure_take().
+ */
+void premeasure_release(premeasure *pm);
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <glib.h>
+
+#include <util/util.h>
+#include <util/keyvalue.h>
+
+#include "spec_checkpoint.h"
+
+#define SPEC_CHECKPOINT_KEY_LABEL "maat measurement spec checkpoint"
+
+static const char *arg_value(struct key_value **arg_list, int argc,
+                             const char *key)
+{
+    const char *value = NULL;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(strcmp(arg_list[i]->key, key) == 0 && arg_list[i]->value != NULL) {
+            value = arg_list[i]->value;
+        }
+    }
+    return value;
+}
+
+static const char *config_value(GList *config, const char *key)
+{
+    struct key_value *kv = find_key(config, (char *)key);
+
+    return kv != NULL ? kv->value : NULL;
+}
+
+/*
+ * The checkpoint key is derived from the APB's private key file, which
+ * only the APB's user can read; anyone who can write the checkpoint
+ * directory but not read the key can not forge a checkpoint.
+ */
+static int derive_key(spec_checkpoint *sc, const char *keyfile)
+{
+    unsigned char *secret;
+    size_t size = 0;
+    unsigned int len = sizeof(sc->key);
+
+    if(keyfile == NULL || (secret = file_to_buffer(keyfile, &size)) == NULL) {
+        return -ENOENT;
+    }
+    if(HMAC(EVP_sha256(), secret, (int)size,
+            (const unsigned char *)SPEC_CHECKPOINT_KEY_LABEL,
+            strlen(SPEC_CHECKPOINT_KEY_LABEL), sc->key, &len) == NULL) {
+        memset(secret, 0, size);
+        free(secret);
+        return -EIO;
+    }
+    memset(secret, 0, size);
+    free(secret);
+    return 0;
+}
+
+/*
+ * The client progress saved with each checkpoint is the path of the
+ * graph, its marks and its digest up to them,
+ * "<path>\n<next node> <next edge> <digest>". The checkpoint is MACed,
+ * so a graph changed behind the checkpoint's back is never resumed.
+ */
+static char *graph_progress(void *ctxt)
+{
+    measurement_graph *graph = (measurement_graph *)ctxt;
+    measurement_graph_marks marks;
+    unsigned char digest[MEASUREMENT_GRAPH_DIGEST_LEN];
+    char *path;
+    char *hex;
+    char *progress;
+
+    if(measurement_graph_get_marks(graph, &marks) < 0 ||
+            measurement_graph_digest(graph, &marks, digest) < 0) {
+        return NULL;
+    }
+    if((path = measurement_graph_get_path(graph)) == NULL) {
+        return NULL;
+    }
+    if((hex = bin_to_hexstr(digest, sizeof(digest))) == NULL) {
+        free(path);
+        return NULL;
+    }
+    progress = g_strdup_printf("%s\n"ID_FMT" "ID_FMT" %s", path,
+                               marks.next_node, marks.next_edge, hex);
+    free(hex);
+    free(path);
+    return progress;
+}
+
+static int parse_progress(const char *progress, char **path,
+                          measurement_graph_marks *marks,
+                          char hex[MEASUREMENT_GRAPH_DIGEST_LEN * 2 + 1])
+{
+    const char *nl = strchr(progress, '\n');
+
+    if(nl == NULL || nl == progress ||
+            sscanf(nl + 1, ID_FMT" "ID_FMT" %64[0-9a-fA-F]", &marks->next_node,
+                   &marks->next_edge, hex) != 3 ||
+            strlen(hex) != MEASUREMENT_GRAPH_DIGEST_LEN * 2) {
+        return -EINVAL;
+    }
+    *path = g_strndup(progress, (gsize)(nl - progress));
+    return *path == NULL ? -ENOMEM : 0;
+}
+
+/* Whether @graph, rolled back to @marks, is the graph that was saved. */
+static int graph_matches(measurement_graph *graph, measurement_graph_marks *marks,
+                         const char *saved_hex)
+{
+    unsigned char digest[MEASUREMENT_GRAPH_DIGEST_LEN];
+    char *hex;
+    int match;
+
+    if(measurement_graph_digest(graph, marks, digest) < 0 ||
+            (hex = bin_to_hexstr(digest, sizeof(digest))) == NULL) {
+        return 0;
+    }
+    match = strcasecmp(hex, saved_hex) == 0;
+    free(hex);
+    return match;
+}
+
+int spec_checkpoint_init(spec_checkpoint *sc, const char *apb_name,
+                         GList *config, struct scenario *scen, meas_spec *mspec,
+                         struct key_value **arg_list, int argc)
+{
+    const char *interval_arg = arg_value(arg_list, argc, "checkpoint");
+    const char *dir_conf = config_value(config, "checkpoint_dir");
+    const char *age_arg = arg_value(arg_list, argc, "checkpoint_max_age");
+    char *workdir = NULL;
+    char *lockpath = NULL;
+    const char *dir;
+    char uuid_str[37];
+    char *end;
+    unsigned long interval;
+    long max_age = SPEC_CHECKPOINT_DEFAULT_MAX_AGE;
+    int ret;
+
+    memset(sc, 0, sizeof(*sc));
+    sc->lockfd = -1;
+
+    if(interval_arg == NULL || mspec == NULL) {
+        return 0;
+    }
+
+    errno = 0;
+    interval = strtoul(interval_arg, &end, 10);
+    if(errno != 0 || *end != '\0' || interval > UINT32_MAX) {
+        dlog(0, "Invalid checkpoint interval \"%s\"\n", interval_arg);
+        return -EINVAL;
+    }
+    if(age_arg != NULL) {
+        errno = 0;
+        max_age = strtol(age_arg, &end, 10);
+        if(errno != 0 || *end != '\0' || max_age < 0) {
+            dlog(0, "Invalid checkpoint_max_age \"%s\"\n", age_arg);
+            return -EINVAL;
+        }
+    }
+    if(arg_value(arg_list, argc, "checkpoint_dir") != NULL) {
+        dlog(1, "Warning: ignoring checkpoint_dir argument, "
+             "it is set in the APB configuration\n");
+    }
+
+    /* An unauthenticated checkpoint could be forged to resume any
+       graph, so none is kept without a key. */
+    if(derive_key(sc, scen ? scen->keyfile : NULL) != 0) {
+        dlog(1, "Warning: failed to derive a checkpoint key from %s, "
+             "evaluating without a checkpoint\n",
+             scen && scen->keyfile ? scen->keyfile : "(none)");
+        memset(sc->key, 0, sizeof(sc->key));
+        return 0;
+    }
+
+    /* The scenario's work directory is removed with it, the AM's (its
+       parent) is kept across sessions. */
+    if(dir_conf != NULL) {
+        dir = dir_conf;
+    } else if(scen != NULL && scen->workdir != NULL &&
+              (workdir = strdup(scen->workdir)) != NULL) {
+        dir = dirname(workdir);
+    } else {
+        dlog(0, "No directory for the checkpoint of %s\n", apb_name);
+        ret = -EINVAL;
+        goto error;
+    }
+
+    uuid_unparse(mspec->uuid, uuid_str);
+    sc->path = g_strdup_printf("%s/%s-%s.checkpoint", dir, apb_name, uuid_str);
+    sc->graph_template = g_strdup_printf("%s/%s-%s.graph.XXXXXX", dir,
+                                         apb_name, uuid_str);
+    lockpath = g_strdup_printf("%s.lock", sc->path);
+    free(workdir);
+    if(sc->path == NULL || sc->graph_template == NULL || lockpath == NULL) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    sc->lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(sc->lockfd < 0) {
+        ret = -errno;
+        dlog(0, "Failed to open checkpoint lock %s: %s\n", lockpath,
+             strerror(errno));
+        goto error;
+    }
+    if(flock(sc->lockfd, LOCK_EX | LOCK_NB) != 0) {
+        if(errno == EWOULDBLOCK) {
+            dlog(2, "Checkpoint %s is in use, evaluating without one\n",
+                 sc->path);
+            ret = 0;
+        } else {
+            ret = -errno;
+        }
+        goto error;
+    }
+    g_free(lockpath);
+
+    sc->ckpt.path	= sc->path;
+    sc->ckpt.interval	= (uint32_t)interval;
+    sc->ckpt.max_age	= (time_t)max_age;
+    sc->ckpt.progress	= graph_progress;
+    sc->ckpt.key	= sc->key;
+    sc->ckpt.keylen	= sizeof(sc->key);
+    return 1;
+
+error:
+    g_free(lockpath);
+    spec_checkpoint_release(sc);
+    return ret;
+}
+
+measurement_graph *spec_checkpoint_open_graph(spec_checkpoint *sc, meas_spec *mspec)
+{
+    measurement_graph *graph = NULL;
+    measurement_graph_marks marks;
+    char hex[MEASUREMENT_GRAPH_DIGEST_LEN * 2 + 1];
+    char *progress = NULL;
+    char *path = NULL;
+    size_t prefix_len = strlen(sc->graph_template) - strlen("XXXXXX");
+    int ret;
+
+    ret = read_measurement_checkpoint(mspec, &sc->ckpt, &progress);
+    if(ret == -ENOENT) {
+        goto fresh;
+    }
+    if(ret < 0) {
+        dlog(1, "Warning: can not resume checkpoint %s: %s\n", sc->path,
+             strerror(-ret));
+        goto discard;
+    }
+
+    /* Only ever map a graph we created, whatever the checkpoint says. */
+    if(progress == NULL || parse_progress(progress, &path, &marks, hex) < 0 ||
+            strncmp(path, sc->graph_template, prefix_len) != 0 ||
+            strchr(path + prefix_len, '/') != NULL) {
+        dlog(1, "Warning: checkpoint %s has no usable graph\n", sc->path);
+        goto discard;
+    }
+    if(map_measurement_graph(path, &graph) != 0 || graph == NULL) {
+        dlog(1, "Warning: failed to map graph %s of checkpoint %s\n",
+             path, sc->path);
+        graph = NULL;
+        goto discard;
+    }
+    if((ret = measurement_graph_truncate(graph, &marks)) < 0) {
+        dlog(1, "Warning: failed to roll graph %s back to checkpoint: %s\n",
+             path, strerror(-ret));
+        destroy_measurement_graph(graph);
+        graph = NULL;
+        goto discard;
+    }
+    if(!graph_matches(graph, &marks, hex)) {
+        dlog(1, "Warning: graph %s was changed since checkpoint %s\n",
+             path, sc->path);
+        destroy_measurement_graph(graph);
+        graph = NULL;
+        goto discard;
+    }
+    dlog(2, "Resuming from checkpoint %s\n", sc->path);
+    goto out;
+
+discard:
+    if(unlink(sc->path) != 0 && errno != ENOENT) {
+        dlog(0, "Failed to remove checkpoint %s: %s\n", sc->path,
+             strerror(errno));
+        goto out;
+    }
+fresh:
+    if((graph = create_measurement_graph(sc->graph_template)) == NULL) {
+        dlog(0, "Failed to create measurement graph in %s\n",
+             sc->graph_template);
+    }
+
+out:
+    g_free(path);
+    free(progress);
+    return graph;
+}
+
+void spec_checkpoint_release(spec_checkpoint *sc)
+{
+    if(sc->lockfd >= 0) {
+        close(sc->lockfd);
+    }
+    g_free(sc->path);
+    g_free(sc->graph_template);
+    memset(sc, 0, sizeof(*sc));
+    sc->lockfd = -1;
+}
+
+/* Local Variables:	*/
+/* c-basic-offset: 4	*/
+/* End:			*/
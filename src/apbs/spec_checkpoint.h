@@ -0,0 +1,85 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Resumable evaluation of measurement specifications.
+ *
+ * With the argument checkpoint=N an APB builds its measurement graph
+ * in a checkpoint directory rather than in /tmp, and the evaluator
+ * saves its state there every N obligations (see
+ * evaluate_measurement_spec_checkpointed()) along with the high-water
+ * marks of the graph. If the APB or one of its ASPs dies, the next
+ * run of the APB for the same spec rolls the graph back to the last
+ * checkpoint and continues from it.
+ *
+ * The checkpoint directory is given by the checkpoint_dir option of
+ * the APB's configuration and defaults to the attestation manager's
+ * work directory, which outlives the scenario's. Checkpoints are
+ * authenticated with a key derived from the APB's private key, which
+ * covers a digest of the graph as of the checkpoint, and are not
+ * resumed after checkpoint_max_age seconds
+ * (SPEC_CHECKPOINT_DEFAULT_MAX_AGE by default). Without a key, or
+ * while another run of the same spec holds the checkpoint, the APB
+ * evaluates without one.
+ */
+
+#ifndef _MAAT_SPEC_CHECKPOINT_H_
+#define _MAAT_SPEC_CHECKPOINT_H_
+
+#include <openssl/sha.h>
+
+#include <common/scenario.h>
+#include <graph/graph-core.h>
+#include <measurement_spec/measurement_spec.h>
+#include <util/keyvalue.h>
+
+#define SPEC_CHECKPOINT_DEFAULT_MAX_AGE	3600
+
+typedef struct spec_checkpoint {
+    measurement_checkpoint ckpt;
+    char *path;			/* the checkpoint file */
+    char *graph_template;	/* mkdtemp() template for new graphs */
+    int lockfd;
+    unsigned char key[SHA256_DIGEST_LENGTH];
+} spec_checkpoint;
+
+/**
+ * Set up @sc for evaluating @mspec in @apb_name as requested by the
+ * checkpoint arguments in @arg_list, with the checkpoint directory
+ * taken from the APB's @config. Returns 1 if checkpointing is
+ * enabled, 0 if it was not requested, no key can be derived or
+ * another run holds the checkpoint, and < 0 on error.
+ */
+int spec_checkpoint_init(spec_checkpoint *sc, const char *apb_name,
+                         GList *config, struct scenario *scen, meas_spec *mspec,
+                         struct key_value **arg_list, int argc);
+
+/**
+ * Return the graph to evaluate @mspec into: the graph of the
+ * checkpoint, rolled back to it, if there is one that can be resumed,
+ * and a new graph in the checkpoint directory otherwise. A checkpoint
+ * that can not be resumed is removed. Returns NULL on error.
+ */
+measurement_graph *spec_checkpoint_open_graph(spec_checkpoint *sc, meas_spec *mspec);
+
+/**
+ * Release the resources of @sc. The checkpoint file itself is left in
+ * place.
+ */
+void spec_checkpoint_release(spec_checkpoint *sc);
+
+#endif
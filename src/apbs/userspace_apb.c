@@ -37,11 +37,15 @@
 #include <common/asp.h>
 #include <maat-envvars.h>
 #include <apb/contracts.h>
+#include <util/maat-io.h>
 
 #include <maat-basetypes.h>
 
 #include "apb-common.h"
 #include "userspace_common_funcs.h"
+#include "lazy_evidence.h"
+#include "spec_checkpoint.h"
+#include "premeasure.h"
 
 GList *apb_asps = NULL;
 int mcount = 0;
@@ -55,20 +59,38 @@ char *tpmpass = NULL;
 char  *akctx = NULL;
 char *sign_tpm_str = NULL;
 
+/* nodes measured for the current section of a multi-resource request */
+static GArray *section_roots = NULL;
+
+/* set when a measurement was refused for want of a request's nonce */
+static int needs_request = 0;
+
 static int measure_variable_shim(void *ctxt, measurement_variable *var,
                                  measurement_type *mtype)
 {
-    return measure_variable_internal(ctxt, var, mtype, certfile,
-                                     keyfile, keypass, nonce,
-                                     tpmpass, akctx, sign_tpm_str,
-                                     &mcount, apb_asps);
+    int ret = measure_variable_internal(ctxt, var, mtype, certfile,
+                                        keyfile, keypass, nonce,
+                                        tpmpass, akctx, sign_tpm_str,
+                                        &mcount, apb_asps);
+    if(ret == -EPERM && nonce == NULL) {
+        needs_request = 1;
+    }
+    if(section_roots != NULL) {
+        node_id_t n = measurement_graph_get_node(ctxt, var);
+        if(n != INVALID_NODE_ID) {
+            g_array_append_val(section_roots, n);
+        }
+    }
+    return ret;
 }
 
 static measurement_spec_callbacks callbacks = {
     .enumerate_variables	= enumerate_variables,
     .measure_variable		= measure_variable_shim,
     .get_related_variables      = get_related_variables,
-    .check_predicate		= check_predicate
+    .check_predicate		= check_predicate,
+    .measurement_cost		= measurement_cost,
+    .record_coverage		= record_coverage
 };
 
 /**
@@ -169,14 +191,191 @@ find_asp_error:
     return ret_val;
 }
 
+/**
+ * Serializes the part of @graph reachable from @roots into @out.
+ * Returns 0 on success, < 0 on error.
+ */
+static int serialize_section(measurement_graph *graph, GArray *roots,
+                             unsigned char **out, size_t *outsize)
+{
+    measurement_graph_filter *f;
+    char rule[sizeof("root=") + ID_STR_LEN];
+    node_id_str nstr;
+    guint i;
+    int ret = 0;
+
+    if((f = new_measurement_graph_filter()) == NULL) {
+        return -ENOMEM;
+    }
+    for(i = 0; i < roots->len && ret == 0; i++) {
+        str_of_node_id(g_array_index(roots, node_id_t, i), nstr);
+        snprintf(rule, sizeof(rule), "root=%s", nstr);
+        ret = measurement_graph_filter_add_rule(f, rule);
+    }
+    if(ret == 0) {
+        ret = serialize_measurement_graph_filtered(graph, f, outsize, out, NULL);
+    }
+    free_measurement_graph_filter(f);
+    return ret;
+}
+
+static void free_measurement_section(struct measurement_section *msmt)
+{
+    free(msmt->msmt);
+    free(msmt);
+}
+
+/**
+ * Measures every resource of a multi-resource request into @graph and
+ * sends them back in one signed measurement contract with a section
+ * per resource.
+ *
+ * The measurement specs are evaluated one after the other into the
+ * same graph, and measure_variable_internal() does not measure again
+ * what an earlier spec already has, so collection the resources have
+ * in common is done once. The section of a resource holds everything
+ * reachable from the variables its spec measured.
+ * Returns 0 on success, < 0 on error.
+ */
+static int measure_sections(GList *sections, measurement_graph *graph,
+                            struct scenario *scen, int peerchan)
+{
+    GList *roots = NULL, *msmts = NULL;
+    GList *l, *r;
+    struct meas_spec *mspec;
+    unsigned char *contract = NULL;
+    size_t contract_size    = 0;
+    size_t written          = 0;
+    int ret                 = 0;
+
+    for(l = sections; l != NULL && ret == 0; l = l->next) {
+        struct evidence_section *section = l->data;
+
+        if((ret = get_target_meas_spec(section->spec_uuid, &mspec)) != 0) {
+            dlog(0, "No measurement spec for resource %s\n", section->resource);
+            break;
+        }
+
+        dlog(6, "Evaluating measurement spec for resource %s\n", section->resource);
+        section_roots = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+        set_memory_hash_mode(mspec->memory_hash);
+        evaluate_measurement_spec(mspec, &callbacks, graph);
+        roots = g_list_append(roots, section_roots);
+        section_roots = NULL;
+        free_meas_spec(mspec);
+    }
+
+    graph_print_stats(graph, 1);
+
+    for(l = sections, r = roots; r != NULL && ret == 0; l = l->next, r = r->next) {
+        struct evidence_section *section = l->data;
+        struct measurement_section *msmt;
+
+        if((msmt = calloc(1, sizeof(*msmt))) == NULL) {
+            ret = -ENOMEM;
+            break;
+        }
+        msmt->resource = section->resource;
+        msmts = g_list_append(msmts, msmt);
+
+        if((ret = serialize_section(graph, r->data, &msmt->msmt, &msmt->msmtsize)) < 0) {
+            dlog(0, "Failed to serialize the section of resource %s\n", section->resource);
+        } else {
+            dlog(4, "Section of resource %s is %zu bytes\n", section->resource,
+                 msmt->msmtsize);
+        }
+    }
+
+    if(ret == 0) {
+        if(generate_sectioned_measurement_contract(scen, msmts, &contract,
+                &contract_size) == NULL) {
+            dlog(0, "Failed to generate measurement contract\n");
+            ret = -1;
+        } else if((ret = write_measurement_contract(peerchan, contract, contract_size,
+                         &written, MAAT_APB_ASP_TIMEOUT)) != 0 ||
+                  written != contract_size + sizeof(uint32_t)) {
+            dlog(0, "Failed to send measurement contract\n");
+            ret = -EIO;
+        }
+    }
+
+    free(contract);
+    g_list_free_full(msmts, (GDestroyNotify)free_measurement_section);
+    for(r = roots; r != NULL; r = r->next) {
+        g_array_free(r->data, TRUE);
+    }
+    g_list_free(roots);
+    return ret;
+}
+
+/**
+ * Evaluates the measurement spec @ctxt into @g for the background
+ * pre-measurement (see premeasure.h). The measurer runs after the
+ * request that started it, so the nonce and credentials of that
+ * request are dropped; a spec with measurements that need them (the
+ * send_execute ASP) cannot be pre-measured.
+ */
+static int premeasure_spec(measurement_graph *g, void *ctxt)
+{
+    int ret;
+
+    keyfile	= NULL;
+    keypass	= NULL;
+    nonce	= NULL;
+    tpmpass	= NULL;
+    akctx	= NULL;
+    needs_request = 0;
+
+    ret = evaluate_measurement_spec((struct meas_spec *)ctxt, &callbacks, g);
+    if(needs_request) {
+        dlog(1, "Measurement spec needs a request's nonce, not pre-measuring it\n");
+        return -EPERM;
+    }
+    return ret;
+}
+
+/**
+ * With the argument evidence=lazy only an index of the graph is sent,
+ * and the graph is kept for the appraiser to fetch data from for
+ * evidence_hold seconds (LAZY_EVIDENCE_DEFAULT_HOLD by default).
+ * Returns the hold time, or 0 to send the whole graph.
+ */
+static time_t lazy_evidence_hold(struct key_value **arg_list, int argc)
+{
+    time_t hold = 0;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(strcmp(arg_list[i]->key, "evidence") == 0 &&
+                arg_list[i]->value != NULL &&
+                strcmp(arg_list[i]->value, "lazy") == 0 && hold == 0) {
+            hold = LAZY_EVIDENCE_DEFAULT_HOLD;
+        }
+    }
+    for(i = 0; hold != 0 && i < argc; i++) {
+        if(strcmp(arg_list[i]->key, "evidence_hold") == 0 &&
+                arg_list[i]->value != NULL) {
+            char *end;
+            long secs = strtol(arg_list[i]->value, &end, 10);
+            if(*end != '\0' || secs <= 0) {
+                dlog(1, "Ignoring invalid evidence_hold %s\n", arg_list[i]->value);
+            } else {
+                hold = (time_t)secs;
+            }
+        }
+    }
+    return hold;
+}
+
 int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
                 int peerchan, int resultchan UNUSED, char *target UNUSED,
                 char *target_type UNUSED, char *resource UNUSED,
-                struct key_value **arg_list UNUSED, int argc UNUSED)
+                struct key_value **arg_list, int argc)
 {
     dlog(6, "Hello from the USERSPACE_APB\n");
     int ret_val = 0;
     time_t start, end;
+    GList *sections = NULL;
 
     start = time(NULL);
 
@@ -186,16 +385,49 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
 
     apb_asps = apb->asps;
 
-    struct meas_spec *mspec = NULL;
-    ret_val = get_target_meas_spec(meas_spec_uuid, &mspec);
-    if(ret_val != 0) {
+    if((ret_val = evidence_sections_from_args(arg_list, argc, &sections)) < 0) {
         return ret_val;
     }
 
-    measurement_graph *graph = create_measurement_graph(NULL);
+    struct meas_spec *mspec = NULL;
+    if(sections == NULL) {
+        ret_val = get_target_meas_spec(meas_spec_uuid, &mspec);
+        if(ret_val != 0) {
+            return ret_val;
+        }
+        set_memory_hash_mode(mspec->memory_hash);
+    }
+
+    premeasure pm;
+    int premeasuring = premeasure_init(&pm, apb->name, apb->config, mspec,
+                                      arg_list, argc);
+    if(premeasuring < 0) {
+        free_meas_spec(mspec);
+        return premeasuring;
+    }
+
+    measurement_graph *graph = premeasuring ? premeasure_take(&pm) : NULL;
+    int premeasured = graph != NULL;
+
+    spec_checkpoint sc;
+    int checkpointing = premeasured ? 0 : spec_checkpoint_init(&sc, apb->name,
+                        apb->config, scen, mspec, arg_list, argc);
+    if(checkpointing < 0) {
+        premeasure_release(&pm);
+        free_meas_spec(mspec);
+        return checkpointing;
+    }
+
+    if(!graph) {
+        graph = checkpointing ? spec_checkpoint_open_graph(&sc, mspec) :
+                create_measurement_graph(NULL);
+    }
     if(!graph) {
         dlog(0, "Failed to create measurement graph\n");
+        spec_checkpoint_release(&sc);
+        premeasure_release(&pm);
         free_meas_spec(mspec);
+        free_evidence_sections(sections);
         return -EIO;
     }
 
@@ -239,18 +471,62 @@ int apb_execute(struct apb *apb, struct scenario *scen, uuid_t meas_spec_uuid,
         sign_tpm_str = "";
     }
 
-    dlog(6, "Evaluating measurement spec\n");
-    evaluate_measurement_spec(mspec, &callbacks, graph);
+    if(sections != NULL) {
+        dlog(6, "Measuring %u resources\n", g_list_length(sections));
+        ret_val = measure_sections(sections, graph, scen, peerchan);
+        free_evidence_sections(sections);
+        goto done;
+    }
 
-    free_meas_spec(mspec);
+    if(premeasured) {
+        dlog(6, "Answering from the pre-measured graph\n");
+    } else if(checkpointing) {
+        dlog(6, "Evaluating measurement spec\n");
+        ret_val = evaluate_measurement_spec_checkpointed(mspec, &callbacks, graph,
+                  &sc.ckpt, NULL);
+        spec_checkpoint_release(&sc);
+        if(ret_val < 0) {
+            /* Keep the graph for the run that resumes the checkpoint */
+            dlog(0, "Measurement spec evaluation failed: %s\n",
+                 strerror(-ret_val));
+            unmap_measurement_graph(graph);
+            premeasure_release(&pm);
+            free_meas_spec(mspec);
+            return ret_val;
+        }
+    } else {
+        dlog(6, "Evaluating measurement spec\n");
+        evaluate_measurement_spec(mspec, &callbacks, graph);
+    }
 
     graph_print_stats(graph, 1);
 
-    ret_val = execute_sign_send_pipeline(graph, scen, peerchan);
+    time_t hold = lazy_evidence_hold(arg_list, argc);
+    if(hold > 0) {
+        ret_val = lazy_evidence_offer(graph, scen, peerchan);
+        if(ret_val == 0) {
+            int served = lazy_evidence_serve(graph, scen, peerchan, hold);
+            ret_val = served < 0 ? served : 0;
+        }
+    } else {
+        ret_val = execute_sign_send_pipeline(graph, scen, peerchan);
+    }
 
-    destroy_measurement_graph(graph);
+done:
+    if(premeasured) {
+        unmap_measurement_graph(graph);
+    } else {
+        destroy_measurement_graph(graph);
+    }
     graph = NULL;
 
+    /* The response is on its way; keep the next one ready */
+    if(premeasuring && premeasure_start(&pm, premeasure_spec, mspec) < 0) {
+        dlog(1, "Warning: failed to start background pre-measurement\n");
+    }
+    premeasure_release(&pm);
+    free_meas_spec(mspec);
+
     end = time(NULL);
 
     dlog(2, "Total time: %ld seconds\n", end-start);
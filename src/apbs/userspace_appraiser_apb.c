@@ -55,6 +55,7 @@
 #include <common/asp.h>
 
 #include "userspace_appraiser_common_funcs.h"
+#include "apb-common.h"
 
 /**
  * Controls which key/value pairs are added to the final report.
@@ -77,10 +78,133 @@ static GList *report_data_list = NULL; /* GList of XML key/value pairs for
 			      * <data identifier="[key]">[value]</data>
 			      */
 
+/* sections of a multi-resource request, and those appraised so far */
+static GList *sections           = NULL;
+static GList *appraised_sections = NULL;
+
+/**
+ * Adds the result of appraising the section of @resource to the report.
+ */
+static void report_section(const char *resource, int result)
+{
+    struct key_value *kv;
+    char *text;
+
+    if((kv = calloc(1, sizeof(*kv))) == NULL) {
+        return;
+    }
+    text      = g_strdup_printf("[0] %s", result == 0 ? "PASS" : "FAIL");
+    kv->key   = g_strdup_printf("resource:%s", resource);
+    kv->value = text ? b64_encode((unsigned char *)text, strlen(text)) : NULL;
+    g_free(text);
+    if(kv->key == NULL || kv->value == NULL) {
+        free_key_value(kv);
+        return;
+    }
+    report_data_list = g_list_append(report_data_list, kv);
+}
+
+/**
+ * appraise_fn for the measurement contract of a multi-resource
+ * request: looks up the section of the resource named by the
+ * MEASUREMENT_SECTION_VALUE value and appraises its graph.
+ * < 0 indicates error, 0 success, > 0 failed appraisal.
+ */
+static int appraise_section(struct scenario *scen, GList *values,
+                            void *msmt, size_t msmtsize)
+{
+    struct evidence_section *section = NULL;
+    char *resource = NULL;
+    GList *l;
+    int ret;
+
+    for(l = values; l != NULL; l = l->next) {
+        struct key_value *kv = l->data;
+        if(strcmp(kv->key, MEASUREMENT_SECTION_VALUE) == 0) {
+            resource = kv->value;
+        }
+    }
+    for(l = sections; l != NULL && resource != NULL && section == NULL; l = l->next) {
+        if(strcmp(((struct evidence_section *)l->data)->resource, resource) == 0) {
+            section = l->data;
+        }
+    }
+
+    if(section == NULL) {
+        dlog(1, "Measurement contract has a section for unrequested resource %s\n",
+             resource ? resource : "(none)");
+        return -1;
+    }
+    if(g_list_find(appraised_sections, section) != NULL) {
+        dlog(1, "Measurement contract has more than one section for resource %s\n",
+             resource);
+        return -1;
+    }
+    appraised_sections = g_list_append(appraised_sections, section);
+
+    dlog(4, "Appraising section of resource %s\n", resource);
+    if(is_measurement_graph_index(msmt, msmtsize)) {
+        /* the attester only holds evidence for the whole graph */
+        dlog(1, "Lazy evidence is not supported for resource sections\n");
+        ret = -1;
+    } else {
+        ret = userspace_appraise(scen, values, msmt, msmtsize, report_data_list,
+                                 default_report_level, apb_asps, all_apbs);
+    }
+    report_section(resource, ret);
+    return ret;
+}
+
+/**
+ * Appraises the measurement contract of a multi-resource request.
+ * The contract's one signature covers every section; each is then
+ * appraised on its own, and a resource without one fails.
+ * Returns 0 if every section passed, non-zero otherwise.
+ */
+static int appraise_sections(struct scenario *scen)
+{
+    int failed = 0;
+    GList *l;
+
+    if(handle_measurement_contract(scen, appraise_section, &failed) != 0) {
+        dlog(0, "Failed to handle the measurement contract\n");
+        return -1;
+    }
+
+    for(l = sections; l != NULL; l = l->next) {
+        struct evidence_section *section = l->data;
+        if(g_list_find(appraised_sections, section) == NULL) {
+            dlog(1, "Measurement contract has no section for resource %s\n",
+                 section->resource);
+            report_section(section->resource, -1);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+/**
+ * The resources of a multi-resource request, as given to the
+ * requester: separated by commas.
+ */
+static char *sections_resource(void)
+{
+    GString *res = g_string_new(NULL);
+    GList *l;
+
+    for(l = sections; l != NULL; l = l->next) {
+        if(res->len > 0) {
+            g_string_append_c(res, ',');
+        }
+        g_string_append(res, ((struct evidence_section *)l->data)->resource);
+    }
+    return g_string_free(res, FALSE);
+}
+
 int apb_execute(struct apb *apb, struct scenario *scen,
                 uuid_t meas_spec_uuid UNUSED, int peerchan, int resultchan,
                 char *target, char *target_type, char *resource,
-                struct key_value **arg_list UNUSED, int argc UNUSED)
+                struct key_value **arg_list, int argc)
 {
     int ret;
     int failed                  = 0;
@@ -130,6 +254,10 @@ int apb_execute(struct apb *apb, struct scenario *scen,
         return ret;
     }
 
+    if((ret = evidence_sections_from_args(arg_list, argc, &sections)) < 0) {
+        return ret;
+    }
+
     /* Receive measurement contract from attester APB. Setting max size as 10MB. */
     ret = receive_measurement_contract_asp(apb_asps, peerchan, scen);
     if(ret < 0) {
@@ -137,7 +265,7 @@ int apb_execute(struct apb *apb, struct scenario *scen,
         return ret;
     }
 
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    doc = read_contract_xml(scen->contract, scen->size);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         return ret;
@@ -150,9 +278,11 @@ int apb_execute(struct apb *apb, struct scenario *scen,
 
     dlog(6, "Received Measurement Contract in appraiser APB\n");
 
-    if(scen->contract == NULL || scen->size > INT_MAX) {
+    if(scen->contract == NULL) {
         dlog(0, "No valid measurement contract received by appraiser APB\n");
         failed = -1;
+    } else if(sections != NULL) {
+        failed = appraise_sections(scen);
     } else {
         failed = process_contract(apb_asps, scen,
                                   (void **)&msmt, &msmt_sz);
@@ -163,8 +293,15 @@ int apb_execute(struct apb *apb, struct scenario *scen,
                    userspace appraiser does not use the values
                    list, so we will not execute what is effectively
                    a no-op */
-            failed = userspace_appraise(scen, NULL, msmt, msmt_sz, report_data_list,
-                                        default_report_level, apb_asps, all_apbs);
+            if(is_measurement_graph_index(msmt, msmt_sz)) {
+                failed = userspace_appraise_index(scen, msmt, msmt_sz, peerchan,
+                                                  report_data_list,
+                                                  default_report_level,
+                                                  apb_asps, all_apbs);
+            } else {
+                failed = userspace_appraise(scen, NULL, msmt, msmt_sz, report_data_list,
+                                            default_report_level, apb_asps, all_apbs);
+            }
             free(msmt);
         }
     }
@@ -175,9 +312,14 @@ int apb_execute(struct apb *apb, struct scenario *scen,
         evaluation = (xmlChar*)"FAIL";
     }
 
-    ret = adjust_measurement_contract_to_access_contract(scen);
-    if (ret < 0) {
-        dlog(1, "Unable to properly create and save access measurement, but continuing...\n");
+    /* handle_measurement_contract() has already made the access contract */
+    if(sections == NULL) {
+        ret = adjust_measurement_contract_to_access_contract(scen);
+        if (ret < 0) {
+            dlog(1, "Unable to properly create and save access measurement, but continuing...\n");
+        }
+    } else if((resource = sections_resource()) == NULL) {
+        return -ENOMEM;
     }
 
     /* Generate and send integrity check response */
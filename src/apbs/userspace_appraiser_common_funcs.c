@@ -16,6 +16,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -55,6 +56,7 @@
 #include <common/asp.h>
 
 #include "userspace_appraiser_common_funcs.h"
+#include "lazy_evidence.h"
 
 #define TIMEOUT (MAAT_APB_PEER_TIMEOUT * 20)
 
@@ -70,8 +72,37 @@
 
 #define RSA_KEYSIZE 16
 
+/* slack, in seconds, allowed around the age of pre-measured evidence */
+#define FRESHNESS_CLOCK_SKEW 300
+
+/* oldest pre-measured evidence accepted, whatever the evidence claims */
+#ifndef FRESHNESS_MAX_AGE
+#define FRESHNESS_MAX_AGE 600
+#endif
+
 #define MAX_ENC_KEY_SZ 512
 
+xmlDoc *read_contract_xml(void *cont_buf, size_t cont_size)
+{
+    const unsigned char *payload = NULL;
+    size_t payload_size          = 0;
+    size_t xml_size              = 0;
+
+    if (split_detached_payload(cont_buf, cont_size, &xml_size, &payload,
+                               &payload_size) < 0) {
+        dlog(0, "Malformed measurement contract framing\n");
+        return NULL;
+    }
+
+    if (SIZE_MAX > INT_MAX && xml_size > INT_MAX) {
+        dlog(0, "Given contract size greater than XML library can represent\n");
+        return NULL;
+    }
+
+    // Cast is justified because of the prior bounds check
+    return xmlReadMemory(cont_buf, (int)xml_size, NULL, NULL, 0);
+}
+
 /**
  * This function parses the measurement contract to identify whether the measurement
  * included has been transformed. The contract buffer is provided in the cont_buf
@@ -96,12 +127,7 @@ static int parse_contract_transformations(void *cont_buf, size_t cont_size)
     xmlXPathObject *obj  = NULL;
     xmlNode *tmp         = NULL;
 
-    if (SIZE_MAX > INT_MAX && cont_size > INT_MAX) {
-        dlog(0, "Given contract size greater than XML library can represent\n");
-        goto xml_err;
-    }
-
-    doc = xmlReadMemory(cont_buf, (int)cont_size, NULL, NULL, 0);
+    doc = read_contract_xml(cont_buf, cont_size);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         goto xml_err;
@@ -231,14 +257,7 @@ static int extract_key(struct scenario *scen, char **key)
     xmlXPathObject *obj  = NULL;
     xmlNode *tmp         = NULL;
 
-    if (SIZE_MAX > INT_MAX && scen->size > INT_MAX) {
-        dlog(0, "Contract size greater than XML library can represent\n");
-        goto xml_err;
-    }
-
-    //Previous bounds check ensures this cast is safe
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL,
-                        0);
+    doc = read_contract_xml(scen->contract, scen->size);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         goto xml_err;
@@ -284,51 +303,92 @@ xml_err:
  * This function will extract the contents of the measurement from
  * a measurement contract. The resultant measurement is placed into
  * the msmt parameter and its size is placed into the msmtsize buffer.
+ * A detached measurement is taken from after the contract XML; its
+ * digest has already been checked by the verify_measurement_contract ASP.
  * Returns 0 on success and -1 otherwise.
  */
 static int extract_measurement(struct scenario *scen, void **msmt,
                                size_t *msmtsize)
 {
     int ret            = -1;
+    int i;
     size_t dec_sz      = SIZE_MAX;
     char *enc          = NULL;
     unsigned char *dec = NULL;
     xmlDoc *doc        = NULL;
+    xmlXPathObject *obj  = NULL;
+    xmlNode *tmp         = NULL;
+    const unsigned char *payload = NULL;
+    size_t payload_size  = 0;
+    size_t xml_size      = 0;
 
     if (scen == NULL || msmt == NULL || msmtsize == NULL) {
         dlog(0, "Given null parameters\n");
         goto arg_err;
     }
 
-    if (SIZE_MAX > INT_MAX && scen->size > INT_MAX) {
-        dlog(0, "Size given in scenario structure for measurement contract size %zu cannot be represented to XML API\n",
-             scen->size);
+    if (split_detached_payload((unsigned char *)scen->contract, scen->size,
+                               &xml_size, &payload, &payload_size) < 0) {
+        dlog(0, "Malformed measurement contract framing\n");
         goto xml_err;
     }
 
-    // Cast is justified because of the prior bounds check
-    // TODO: we may want to change the secnario struct to use an int size
-    // in order to be compatible with libxml2
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    doc = read_contract_xml(scen->contract, scen->size);
     if (doc == NULL) {
         dlog(1, "Failed to parse contract XML.\n");
         goto xml_err;
     }
 
-    enc = xpath_get_content(doc, "/contract/subcontract/option/measurement");
-    if (enc == NULL) {
-        dlog(1, "Unable to get measurement content from contract");
+    obj = xpath(doc, "/contract/subcontract/option/measurement");
+    if (obj == NULL || obj->nodesetval == NULL) {
+        dlog(1, "Unable to get the measurement xpath\n");
         goto xpath_err;
     }
 
-    dec = b64_decode(enc, &dec_sz);
-    xmlFree(enc);
+    for(i = 0; i < obj->nodesetval->nodeNr; i++) {
+        if(obj->nodesetval->nodeTab[i]->type == XML_ELEMENT_NODE) {
+            tmp = obj->nodesetval->nodeTab[i];
+            break;
+        }
+    }
+
+    if (tmp == NULL) {
+        dlog(1, "Unable to find measurement XML node\n");
+        goto node_err;
+    }
+
+    if (is_detached_payload(tmp)) {
+        if (payload == NULL) {
+            dlog(1, "Contract references a detached measurement but none was attached\n");
+            goto node_err;
+        }
+
+        // Callers release the measurement with b64_free()
+        dec = g_try_malloc(payload_size);
+        if (dec == NULL) {
+            dlog(0, "Unable to allocate buffer for detached measurement\n");
+            goto node_err;
+        }
+        memcpy(dec, payload, payload_size);
+        dec_sz = payload_size;
+    } else {
+        enc = xmlNodeGetContentASCII(tmp);
+        if (enc == NULL) {
+            dlog(1, "Unable to get measurement content from contract");
+            goto node_err;
+        }
+
+        dec = b64_decode(enc, &dec_sz);
+        xmlFree(enc);
+    }
 
     *msmt = dec;
     *msmtsize = dec_sz;
     ret = 0;
 
+node_err:
 xpath_err:
+    xmlXPathFreeObject(obj);
     xmlFreeDoc(doc);
 xml_err:
 arg_err:
@@ -475,7 +535,7 @@ int adjust_measurement_contract_to_access_contract(struct scenario *scen)
     xmlNode *root         = NULL;
     char tmpstr[200]      = {0};
 
-    doc = xmlReadMemory(scen->contract, (int)scen->size, NULL, NULL, 0);
+    doc = read_contract_xml(scen->contract, scen->size);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         goto xml_err;
@@ -1006,6 +1066,75 @@ blob_error:
     return result;
 }
 
+/**
+ * Evidence gathered under a measurement budget carries a coverage
+ * record. Evidence that is explicitly partial fails appraisal: the
+ * obligations that were skipped could have hidden anything.
+ * Returns 0 if the measurement was complete.
+ */
+static int appraise_coverage(measurement_graph *mg, node_id_t node)
+{
+    measurement_data *data = NULL;
+    coverage_data *cd;
+    int ret;
+
+    if(measurement_node_get_rawdata(mg, node, &coverage_measurement_type, &data) != 0) {
+        dlog(1, "Failed to read coverage data from node\n");
+        return -1;
+    }
+    cd = container_of(data, coverage_data, d);
+
+    if(coverage_is_complete(cd)) {
+        dlog(4, "Measurement is complete (%"PRIu32" obligations)\n", cd->evaluated);
+        ret = 0;
+    } else {
+        dlog(1, "Measurement is partial: %"PRIu32" obligations evaluated, "
+             "%"PRIu32" skipped\n", cd->evaluated, cd->skipped);
+        ret = 1;
+    }
+
+    free_measurement_data(data);
+    return ret;
+}
+
+/**
+ * Evidence answered from a graph measured in the background carries a
+ * freshness record. The attester only answers from graphs younger than
+ * the max age recorded, but the record is the attester's word: the
+ * appraiser holds evidence to the lesser of that and
+ * FRESHNESS_MAX_AGE. Evidence older than that, or measured in the
+ * future, fails appraisal. FRESHNESS_CLOCK_SKEW allows for the
+ * attester's clock and the time taken to send the evidence.
+ * Returns 0 if the measurement is fresh enough.
+ */
+static int appraise_freshness(measurement_graph *mg, node_id_t node)
+{
+    measurement_data *data = NULL;
+    freshness_data *fd;
+    int64_t age, max_age;
+    int ret;
+
+    if(measurement_node_get_rawdata(mg, node, &freshness_measurement_type, &data) != 0) {
+        dlog(1, "Failed to read freshness data from node\n");
+        return -1;
+    }
+    fd = container_of(data, freshness_data, d);
+    age = (int64_t)time(NULL) - (int64_t)fd->measured_at;
+    max_age = fd->max_age < FRESHNESS_MAX_AGE ? fd->max_age : FRESHNESS_MAX_AGE;
+
+    if(age < -FRESHNESS_CLOCK_SKEW || age > max_age + FRESHNESS_CLOCK_SKEW) {
+        dlog(1, "Pre-measured evidence is %"PRId64" seconds old, max age is "
+             "%"PRId64"\n", age, max_age);
+        ret = 1;
+    } else {
+        dlog(4, "Pre-measured evidence is %"PRId64" seconds old\n", age);
+        ret = 0;
+    }
+
+    free_measurement_data(data);
+    return ret;
+}
+
 /**
  * Appraises all of the data in the passed node
  * Returns 0 if all appraisals pass successfully.
@@ -1047,6 +1176,14 @@ static int appraise_node(measurement_graph *mg, char *graph_path, node_id_t node
                 dlog(4, "Result from subordinate APB %d\n", ret);
             }
 
+            // Coverage of a budgeted measurement is checked in place
+        } else if(data_type == COVERAGE_TYPE_MAGIC) {
+            ret = appraise_coverage(mg, node);
+
+            // So is the age of a pre-measured one
+        } else if(data_type == FRESHNESS_TYPE_MAGIC) {
+            ret = appraise_freshness(mg, node);
+
             // Everything else goes to an ASP
         } else {
             struct asp *appraiser_asp = NULL;
@@ -1161,6 +1298,108 @@ cleanup:
     }
 }
 
+/**
+ * Fetches the data of @node that appraise_node() will look at: data
+ * with an appraisal ASP or subordinate APB, coverage records, and
+ * report data for the response. Anything else stays with the
+ * attester.
+ * Returns 0 if it was all fetched, > 0 if some of it was missing or
+ * did not match the index, < 0 on error.
+ */
+static int fetch_node_evidence(measurement_graph *mg, node_id_t node,
+                               graph_index *idx, lazy_evidence *ev,
+                               GList *apb_asps)
+{
+    GList *types = NULL;
+    GList *l;
+    int ret;
+
+    for(l = graph_index_entries(idx, node); l != NULL; l = l->next) {
+        graph_index_entry *e = l->data;
+        if(e->type == BLOB_MEASUREMENT_TYPE_MAGIC ||
+                e->type == COVERAGE_TYPE_MAGIC ||
+                e->type == FRESHNESS_TYPE_MAGIC ||
+                e->type == REPORT_MEASUREMENT_TYPE_MAGIC ||
+                select_appraisal_asp(node, e->type, apb_asps) != NULL) {
+            types = g_list_append(types, GUINT_TO_POINTER(e->type));
+        }
+    }
+
+    if(types == NULL) {
+        return 0;
+    }
+    ret = lazy_evidence_fetch(ev, mg, node, types);
+    g_list_free(types);
+    return ret;
+}
+
+int userspace_appraise_index(struct scenario *scen, void *msmt, size_t msmtsize,
+                             int peerchan, GList *report_data_list,
+                             enum report_levels default_report_level,
+                             GList *apb_asps, GList *all_apbs)
+{
+    int ret                     = 0;
+    int appraisal_stat          = 0;
+    measurement_graph *mg       = NULL;
+    graph_index *idx            = NULL;
+    lazy_evidence *ev           = NULL;
+    node_iterator *it           = NULL;
+    char *graph_path;
+
+    mg = parse_measurement_graph_index(msmt, msmtsize, &idx);
+    if(!mg) {
+        dlog(0, "Error parsing measurement graph index.\n");
+        return -1;
+    }
+
+    ev = lazy_evidence_open(scen, peerchan, idx);
+    if(ev == NULL) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    graph_print_stats(mg, 1);
+
+    graph_path = measurement_graph_get_path(mg);
+
+    for(it = measurement_graph_iterate_nodes(mg); it != NULL;
+            it = node_iterator_next(it)) {
+        node_id_t node = node_iterator_get(it);
+        int fetched = fetch_node_evidence(mg, node, idx, ev, apb_asps);
+
+        if(fetched < 0) {
+            dlog(0, "Failed to fetch evidence from the attester\n");
+            ret = -1;
+        } else if(fetched > 0) {
+            dlog(1, "Evidence for node "ID_FMT" is missing or does not match the index\n",
+                 node);
+            appraisal_stat++;
+        } else {
+            appraisal_stat += appraise_node(mg, graph_path, node, scen, apb_asps,
+                                            all_apbs);
+        }
+
+        /* the verdict is settled, so fetch nothing more */
+        if(ret != 0 || appraisal_stat != 0) {
+            destroy_node_iterator(it);
+            break;
+        }
+    }
+    free(graph_path);
+
+    gather_report_data(mg, default_report_level, &report_data_list);
+
+cleanup:
+    lazy_evidence_close(ev);
+    free_graph_index(idx);
+    destroy_measurement_graph(mg);
+    if(ret == 0) {
+        return appraisal_stat;
+    } else {
+        return ret;
+    }
+}
+
 /* Local Variables:	*/
 /* c-basic-offset: 4	*/
 /* End:			*/
@@ -21,6 +21,14 @@
 
 #include <common/scenario.h>
 #include <maat-basetypes.h>
+#include <util/xml_util.h>
+
+/**
+ * Parses the XML portion of the measurement contract in cont_buf, skipping
+ * any detached measurement payload that follows it. Returns the parsed
+ * document or NULL on error.
+ */
+xmlDoc *read_contract_xml(void *cont_buf, size_t cont_size);
 
 /**
  * This function will ingest a measurement contract and will do the following:
@@ -103,6 +111,17 @@ int userspace_appraise(struct scenario *scen, GList *values UNUSED,
                        void *msmt, size_t msmtsize, GList *report_data_list,
                        enum report_levels default_report_level,
                        GList *apb_asps, GList *all_apbs);
+
+/**
+ * Like userspace_appraise(), for a measurement that is a graph index
+ * (see is_measurement_graph_index()). The data that is appraised is
+ * fetched from the attester on @peerchan as it is needed, and the
+ * appraisal stops at the first node that fails.
+ */
+int userspace_appraise_index(struct scenario *scen, void *msmt, size_t msmtsize,
+                             int peerchan, GList *report_data_list,
+                             enum report_levels default_report_level,
+                             GList *apb_asps, GList *all_apbs);
 #endif
 
 /* Local Variables:	*/
@@ -23,7 +23,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <util/util.h>
 
@@ -323,6 +325,127 @@ struct asp *select_asp(measurement_graph *g, measurement_type *mtype,
     return NULL;
 }
 
+/*
+ * Some measurements are asked for once per file, typically for every
+ * file a process has open or a directory lists. An ASP whose metadata
+ * sets a <batch> takes several nodes in one run, as a comma separated
+ * list of ids. Rather than running such an ASP once per node, the
+ * first obligation hands it every sibling node (the other
+ * destinations of the same edge label out of the same parents, in
+ * the same address space) still without data of the measurement
+ * type. The ASP adds the data to each node it measures, so the
+ * obligations of those siblings are already satisfied when the
+ * measurement spec gets to them, and those it fails on are retried by
+ * their own obligations.
+ */
+
+static memory_hash_mode memory_hash = MEMORY_HASH_FLAT;
+
+void set_memory_hash_mode(memory_hash_mode mode)
+{
+    memory_hash = mode;
+}
+
+/*
+ * Add the unmeasured siblings of @n reached by @label from @parent to
+ * @batch, up to @max nodes in all.
+ */
+static void batch_add_siblings(measurement_graph *g, node_id_t n, node_id_t parent,
+                               const char *label, address_space *space,
+                               measurement_type *mtype, GHashTable *batch, guint max)
+{
+    edge_iterator *eit;
+
+    for(eit = measurement_node_iterate_outbound_edges(g, parent); eit != NULL;
+            eit = edge_iterator_next(eit)) {
+        edge_id_t eid = edge_iterator_get(eit);
+        node_id_t dst;
+        char *l;
+        node_id_str dstr;
+
+        if(g_hash_table_size(batch) >= max) {
+            destroy_edge_iterator(eit);
+            return;
+        }
+        if((dst = measurement_edge_get_destination(g, eid)) == INVALID_NODE_ID || dst == n) {
+            continue;
+        }
+        l = measurement_edge_get_label(g, eid);
+        if(l == NULL || strcmp(l, label) != 0) {
+            free(l);
+            continue;
+        }
+        free(l);
+
+        str_of_node_id(dst, dstr);
+        if(measurement_node_get_address_space(g, dst) != space ||
+                measurement_node_has_data(g, dst, mtype)) {
+            continue;
+        }
+        g_hash_table_add(batch, g_strdup(dstr));
+    }
+}
+
+/*
+ * Ids of @n and its siblings to measure with @mtype in one run of an
+ * ASP taking up to @max nodes, as a set and as the comma separated
+ * list passed to the ASP (@n first).
+ */
+static GHashTable *measurement_batch(measurement_graph *g, node_id_t n, const char *nstr,
+                                     address_space *space, measurement_type *mtype,
+                                     guint max, char **ids)
+{
+    GHashTable *batch = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GString *list = g_string_new(nstr);
+    GHashTableIter iter;
+    gpointer id;
+    edge_iterator *eit;
+
+    g_hash_table_add(batch, g_strdup(nstr));
+    for(eit = measurement_node_iterate_inbound_edges(g, n); eit != NULL;
+            eit = edge_iterator_next(eit)) {
+        edge_id_t eid = edge_iterator_get(eit);
+        node_id_t parent = measurement_edge_get_source(g, eid);
+        char *label = measurement_edge_get_label(g, eid);
+
+        if(parent != INVALID_NODE_ID && label != NULL) {
+            batch_add_siblings(g, n, parent, label, space, mtype, batch, max);
+        }
+        free(label);
+        if(g_hash_table_size(batch) >= max) {
+            destroy_edge_iterator(eit);
+            break;
+        }
+    }
+
+    g_hash_table_iter_init(&iter, batch);
+    while(g_hash_table_iter_next(&iter, &id, NULL)) {
+        if(strcmp(id, nstr) != 0) {
+            g_string_append_c(list, ',');
+            g_string_append(list, id);
+        }
+    }
+    *ids = g_string_free(list, FALSE);
+    return batch;
+}
+
+/* The number of nodes of @batch the ASP added @mtype data to */
+static guint batch_measured(measurement_graph *g, GHashTable *batch, measurement_type *mtype)
+{
+    GHashTableIter iter;
+    gpointer id;
+    guint count = 0;
+
+    g_hash_table_iter_init(&iter, batch);
+    while(g_hash_table_iter_next(&iter, &id, NULL)) {
+        node_id_t b = node_id_of_str(id);
+        if(b != INVALID_NODE_ID && measurement_node_has_data(g, b, mtype) > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
 int measure_variable_internal(void *ctxt, measurement_variable *var,
                               measurement_type *mtype, char *certfile,
                               char *keyfile, char *keypass, char *nonce,
@@ -333,9 +456,13 @@ int measure_variable_internal(void *ctxt, measurement_variable *var,
     char *asp_argv[2];
     char *rq_asp_argv[9];
     char *pmreloc_argv[3];
+    char *pagehash_argv[3];
     char *graph_path = measurement_graph_get_path(g);
     node_id_t n = INVALID_NODE_ID;
     node_id_str nstr;
+    GHashTable *batch = NULL;
+    char *batch_ids = NULL;
+    guint measured;
     int rc;
 
     char *addr_str = address_human_readable(var->address);
@@ -369,8 +496,21 @@ int measure_variable_internal(void *ctxt, measurement_variable *var,
         goto error;
     }
 
+    if(asp->batch > 1) {
+        batch = measurement_batch(g, n, nstr, var->address->space, mtype,
+                                  asp->batch, &batch_ids);
+        asp_argv[1] = batch_ids;
+        dlog(5, "Measuring %u nodes with %s at once\n", g_hash_table_size(batch), asp->name);
+    }
+
     /* Send execute ASP also needs cert and keyfile */
     if(strcmp(asp->name, "send_execute_asp") == 0) {
+        /* its evidence is bound to the nonce of the request measured */
+        if(nonce == NULL) {
+            dlog(1, "Not running %s without a request's nonce\n", asp->name);
+            rc = -EPERM;
+            goto error;
+        }
         rq_asp_argv[0] = graph_path;
         rq_asp_argv[1] = nstr;
         rq_asp_argv[2] = certfile;
@@ -389,15 +529,141 @@ int measure_variable_internal(void *ctxt, measurement_variable *var,
         pmreloc_argv[1] = nstr;
         pmreloc_argv[2] = "nohash";
         rc = run_asp(asp, -1, -1, false, 3, pmreloc_argv, -1);
+    } else if (strcmp(asp->name, "procmem") == 0 && memory_hash == MEMORY_HASH_PAGETREE) {
+        pagehash_argv[0] = graph_path;
+        pagehash_argv[1] = nstr;
+        pagehash_argv[2] = "pagehash";
+        rc = run_asp(asp, -1, -1, false, 3, pagehash_argv, -1);
     } else {
         rc = run_asp(asp, -1, -1, false, 2, asp_argv, -1);
     }
 
+    /*
+     * The siblings the ASP failed on are left without data, to be
+     * retried by their own obligations; only this node's decides.
+     */
+    if(batch != NULL) {
+        measured = batch_measured(g, batch, mtype);
+        if(measured < g_hash_table_size(batch)) {
+            dlog(2, "%s measured %u of %u nodes\n", asp->name, measured,
+                 g_hash_table_size(batch));
+        }
+        if(rc != 0 && measurement_node_has_data(g, n, mtype) > 0) {
+            rc = 0;
+        }
+    }
+
 error:
+    if(batch != NULL) {
+        g_hash_table_destroy(batch);
+    }
+    g_free(batch_ids);
     free(graph_path);
     return rc;
 }
 
+uint64_t measurement_cost(void *ctxt UNUSED, measurement_variable *var,
+                          measurement_type *mtype)
+{
+    if(var->address->space == &simple_file_address_space &&
+            (mtype == &md5hash_measurement_type ||
+             mtype == &sha1hash_measurement_type ||
+             mtype == &sha256_measurement_type)) {
+        simple_file_address *sfa = container_of(var->address, simple_file_address, a);
+        struct stat st;
+        if(stat(sfa->filename, &st) == 0) {
+            return (uint64_t)st.st_size;
+        }
+    } else if(var->address->space == &pid_mem_range_space) {
+        pid_mem_range *range = container_of(var->address, pid_mem_range, a);
+        return range->size;
+    }
+    return 0;
+}
+
+int record_coverage(void *ctxt, measurement_coverage *coverage)
+{
+    measurement_graph *g = (measurement_graph *)ctxt;
+    measurement_variable var = {.type = &system_target_type, .address = NULL};
+    coverage_data *cd = NULL;
+    node_id_t n = INVALID_NODE_ID;
+    int rc = -ENOMEM;
+
+    if((var.address = alloc_address(&unit_address_space)) == NULL) {
+        goto out;
+    }
+    if((rc = measurement_graph_add_node(g, &var, NULL, &n)) < 0) {
+        dlog(0, "Error: failed to add node for measurement coverage\n");
+        goto out;
+    }
+
+    if((cd = (coverage_data *)alloc_measurement_data(&coverage_measurement_type)) == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    cd->evaluated    = coverage->evaluated;
+    cd->skipped      = coverage->skipped;
+    cd->measurements = coverage->measurements;
+    cd->bytes        = coverage->bytes;
+    cd->elapsed      = (uint32_t)coverage->elapsed;
+    cd->exhausted    = (uint32_t)coverage->exhausted;
+
+    if((rc = measurement_node_add_rawdata(g, n, &cd->d)) < 0) {
+        dlog(0, "Error: failed to add measurement coverage to graph\n");
+        goto out;
+    }
+
+    if(!coverage_is_complete(cd)) {
+        char *msg = g_strdup_printf("Partial measurement: budget exhausted (%s), "
+                                    "%"PRIu32" obligations evaluated, %"PRIu32" skipped",
+                                    measurement_budget_limit_name(coverage->exhausted),
+                                    coverage->evaluated, coverage->skipped);
+        report_data *rmd;
+        if(msg != NULL &&
+                (rmd = report_data_with_level_and_text(REPORT_WARNING, strdup(msg),
+                        strlen(msg) + 1)) != NULL) {
+            measurement_node_add_rawdata(g, n, &rmd->d);
+            free_measurement_data(&rmd->d);
+        }
+        g_free(msg);
+    }
+
+out:
+    free_measurement_data(cd ? &cd->d : NULL);
+    free_address(var.address);
+    return rc < 0 ? rc : 0;
+}
+
+char **serialize_graph_args(char *graph_path, struct meas_spec *mspec,
+                            struct key_value **arg_list, int argc, int *nargs)
+{
+    char **args;
+    GList *l;
+    int i, n = 0;
+
+    args = g_try_new(char *, 1 + g_list_length(mspec ? mspec->export_rules : NULL) +
+                     (size_t)(argc > 0 ? argc : 0));
+    if(args == NULL) {
+        dlog(0, "Failed to allocate serialize ASP arguments\n");
+        return NULL;
+    }
+
+    args[n++] = graph_path;
+    for(l = mspec ? mspec->export_rules : NULL; l != NULL; l = l->next) {
+        args[n++] = (char *)l->data;
+    }
+    for(i = 0; i < argc; i++) {
+        if(strcmp(arg_list[i]->key, "export") == 0 && arg_list[i]->value != NULL) {
+            args[n++] = arg_list[i]->value;
+        }
+    }
+    if(n > 1) {
+        dlog(4, "Serializing the graph with %d export filter rules\n", n - 1);
+    }
+    *nargs = n;
+    return args;
+}
+
 /* Local Variables:	*/
 /* c-basic-offset: 4	*/
 /* End:			*/
@@ -27,6 +27,7 @@
 #include <glib/glist.h>
 
 #include <measurement_spec/measurement_spec.h>
+#include <util/keyvalue.h>
 #include <maat-basetypes.h>
 
 GQueue *enumerate_variables(void *ctxt UNUSED, target_type *ttype,
@@ -38,9 +39,38 @@ int measure_variable_internal(void *ctxt, measurement_variable *var,
                               char *tpmpass, char *akctx, char *sign_tpm_str,
                               int *mcount_ptr, GList *apb_asps);
 
+/**
+ * Hash process memory ranges measured with sha256 as @mode asks, as
+ * declared by the memory_hash element of the specification being
+ * evaluated.
+ */
+void set_memory_hash_mode(memory_hash_mode mode);
+
 struct asp *select_asp(measurement_graph *g, measurement_type *mtype,
                        measurement_variable *var, GList *apb_asps,
                        int *mcount_ptr);
+
+/**
+ * Estimate the number of bytes hashed to measure @var with @mtype,
+ * for charging against a measurement budget.
+ */
+uint64_t measurement_cost(void *ctxt UNUSED, measurement_variable *var,
+                          measurement_type *mtype);
+
+/**
+ * Attach @coverage to the system node of the measurement graph @ctxt,
+ * with a report entry if the measurement is partial.
+ */
+int record_coverage(void *ctxt, measurement_coverage *coverage);
+
+/**
+ * Build the arguments of serialize_graph_asp for the graph at
+ * @graph_path: the path, then the export rules of @mspec, then the
+ * value of each "export" argument in @arg_list. Returns a g_malloc()ed
+ * array of *@nargs borrowed strings, or NULL on error.
+ */
+char **serialize_graph_args(char *graph_path, struct meas_spec *mspec,
+                            struct key_value **arg_list, int argc, int *nargs);
 #endif
 /* Local Variables:	*/
 /* c-basic-offset: 4	*/
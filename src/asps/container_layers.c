@@ -0,0 +1,341 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+/*! \file
+ * overlayfs layer discovery and layer digests for container_layers_asp.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+
+#include <util/util.h>
+
+#include "container_layers.h"
+
+#define READ_CHUNK (64 * 1024)
+
+/*
+ * Undo the octal escapes (\040 etc.) the kernel uses for whitespace and
+ * separators in mountinfo fields.
+ */
+static char *unescape_octal(const char *s)
+{
+    char *out = g_malloc(strlen(s) + 1);
+    char *o = out;
+
+    while(*s != '\0') {
+        if(s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+                s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+            *o++ = (char)(((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+            s += 4;
+        } else {
+            *o++ = *s++;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+/*
+ * Split a lowerdir value on ':'. A colon that is part of a path is
+ * written as "\:"; an empty element (the "::" before data-only layers)
+ * is skipped.
+ */
+static GList *split_lowerdirs(const char *value, GList *dirs)
+{
+    GString *cur = g_string_new(NULL);
+    const char *p;
+
+    for(p = value; ; p++) {
+        if(*p == '\\' && p[1] == ':') {
+            g_string_append_c(cur, ':');
+            p++;
+        } else if(*p == ':' || *p == '\0') {
+            if(cur->len > 0) {
+                dirs = g_list_prepend(dirs, g_strdup(cur->str));
+            }
+            g_string_truncate(cur, 0);
+            if(*p == '\0') {
+                break;
+            }
+        } else {
+            g_string_append_c(cur, *p);
+        }
+    }
+    g_string_free(cur, TRUE);
+    return dirs;
+}
+
+static int parse_overlay_options(const char *superopts, container_overlay *out)
+{
+    gchar **opts = g_strsplit(superopts, ",", -1);
+    GList *lower = NULL;
+    int i;
+
+    for(i = 0; opts[i] != NULL; i++) {
+        char *value;
+
+        if(g_str_has_prefix(opts[i], "lowerdir=")) {
+            value = unescape_octal(opts[i] + strlen("lowerdir="));
+            lower = split_lowerdirs(value, lower);
+            g_free(value);
+        } else if(g_str_has_prefix(opts[i], "lowerdir+=")) {
+            lower = g_list_prepend(lower, unescape_octal(opts[i] + strlen("lowerdir+=")));
+        } else if(g_str_has_prefix(opts[i], "upperdir=")) {
+            g_free(out->upperdir);
+            out->upperdir = unescape_octal(opts[i] + strlen("upperdir="));
+        }
+    }
+    g_strfreev(opts);
+
+    out->lowerdirs = g_list_reverse(lower);
+    return out->lowerdirs != NULL ? 0 : -EINVAL;
+}
+
+int container_overlay_parse_mountinfo(const char *mountinfo, container_overlay *out)
+{
+    gchar **lines;
+    gchar *root_fstype = NULL;
+    gchar *root_superopts = NULL;
+    int ret = -ENOENT;
+    int i;
+
+    memset(out, 0, sizeof(*out));
+    if(mountinfo == NULL) {
+        return -EINVAL;
+    }
+
+    lines = g_strsplit(mountinfo, "\n", -1);
+    for(i = 0; lines[i] != NULL; i++) {
+        gchar **f;
+        int sep;
+
+        if(lines[i][0] == '\0') {
+            continue;
+        }
+
+        /*
+         * id parent maj:min root mountpoint options [optional...] -
+         *     fstype source superoptions
+         */
+        f = g_strsplit(lines[i], " ", -1);
+        if(g_strv_length(f) < 10) {
+            g_strfreev(f);
+            ret = -EINVAL;
+            goto out;
+        }
+        for(sep = 6; f[sep] != NULL && strcmp(f[sep], "-") != 0; sep++);
+        if(f[sep] == NULL || f[sep + 1] == NULL || f[sep + 2] == NULL || f[sep + 3] == NULL) {
+            g_strfreev(f);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if(strcmp(f[4], "/") == 0) {
+            g_free(root_fstype);
+            g_free(root_superopts);
+            root_fstype    = g_strdup(f[sep + 1]);
+            root_superopts = g_strdup(f[sep + 3]);
+        }
+        g_strfreev(f);
+    }
+
+    if(root_fstype != NULL && strcmp(root_fstype, "overlay") == 0) {
+        ret = parse_overlay_options(root_superopts, out);
+        if(ret != 0) {
+            container_overlay_clear(out);
+        }
+    }
+
+out:
+    g_free(root_fstype);
+    g_free(root_superopts);
+    g_strfreev(lines);
+    return ret;
+}
+
+void container_overlay_clear(container_overlay *ov)
+{
+    g_list_free_full(ov->lowerdirs, g_free);
+    g_free(ov->upperdir);
+    memset(ov, 0, sizeof(*ov));
+}
+
+struct digest_ctx {
+    GChecksum *tree;
+    unsigned char *buf;
+};
+
+static int digest_file(struct digest_ctx *ctx, const char *path,
+                       uint8_t digest[CONTAINER_LAYER_DIGEST_LEN])
+{
+    GChecksum *csum;
+    gsize len = CONTAINER_LAYER_DIGEST_LEN;
+    ssize_t rd;
+    int fd;
+
+    if((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+        dlog(2, "Failed to open %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+
+    csum = g_checksum_new(G_CHECKSUM_SHA256);
+    while((rd = read(fd, ctx->buf, READ_CHUNK)) != 0) {
+        if(rd < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            dlog(2, "Failed to read %s: %s\n", path, strerror(errno));
+            g_checksum_free(csum);
+            close(fd);
+            return -EIO;
+        }
+        g_checksum_update(csum, ctx->buf, rd);
+    }
+    close(fd);
+
+    g_checksum_get_digest(csum, digest, &len);
+    g_checksum_free(csum);
+    return 0;
+}
+
+static int is_opaque_dir(const char *path)
+{
+    char v;
+
+    return (lgetxattr(path, "trusted.overlay.opaque", &v, 1) == 1 && v == 'y') ||
+           (lgetxattr(path, "user.overlay.opaque", &v, 1) == 1 && v == 'y');
+}
+
+static int compare_names(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * Add one record per entry under @base/@rel to the tree digest, in
+ * sorted depth first order so the result does not depend on readdir
+ * order. Every string in a record is hashed with its terminating NUL,
+ * so no record can run into the next one.
+ */
+static int digest_dir(struct digest_ctx *ctx, const char *base, const char *rel)
+{
+    char *dirpath = rel[0] == '\0' ? g_strdup(base) : g_build_filename(base, rel, NULL);
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    struct dirent *de;
+    DIR *d;
+    guint i;
+    int ret = 0;
+
+    if((d = opendir(dirpath)) == NULL) {
+        dlog(2, "Failed to open directory %s: %s\n", dirpath, strerror(errno));
+        ret = -errno;
+        goto out;
+    }
+    while((de = readdir(d)) != NULL) {
+        if(strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            g_ptr_array_add(names, g_strdup(de->d_name));
+        }
+    }
+    closedir(d);
+    g_ptr_array_sort(names, compare_names);
+
+    for(i = 0; i < names->len && ret == 0; i++) {
+        char *entry_rel = rel[0] == '\0' ? g_strdup(names->pdata[i]) :
+                          g_build_filename(rel, names->pdata[i], NULL);
+        char *path = g_build_filename(base, entry_rel, NULL);
+        uint8_t digest[CONTAINER_LAYER_DIGEST_LEN];
+        char header[64];
+        struct stat st;
+
+        if(lstat(path, &st) != 0) {
+            dlog(2, "Failed to stat %s: %s\n", path, strerror(errno));
+            ret = -errno;
+            goto next;
+        }
+
+        g_checksum_update(ctx->tree, (const guchar *)entry_rel, (gssize)strlen(entry_rel) + 1);
+        snprintf(header, sizeof(header), "%o %u %u", (unsigned)st.st_mode,
+                 (unsigned)st.st_uid, (unsigned)st.st_gid);
+        g_checksum_update(ctx->tree, (const guchar *)header, (gssize)strlen(header) + 1);
+
+        if(S_ISREG(st.st_mode)) {
+            if((ret = digest_file(ctx, path, digest)) == 0) {
+                g_checksum_update(ctx->tree, digest, sizeof(digest));
+            }
+        } else if(S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t len = readlink(path, target, sizeof(target));
+            if(len < 0) {
+                ret = -errno;
+            } else if((size_t)len >= sizeof(target)) {
+                dlog(2, "Target of symlink %s is too long\n", path);
+                ret = -ENAMETOOLONG;
+            } else {
+                target[len] = '\0';
+                g_checksum_update(ctx->tree, (const guchar *)target, len + 1);
+            }
+        } else if(S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+            /* a 0:0 character device is an overlayfs whiteout */
+            snprintf(header, sizeof(header), "%u:%u", major(st.st_rdev), minor(st.st_rdev));
+            g_checksum_update(ctx->tree, (const guchar *)header, (gssize)strlen(header) + 1);
+        } else if(S_ISDIR(st.st_mode)) {
+            if(is_opaque_dir(path)) {
+                g_checksum_update(ctx->tree, (const guchar *)"opaque", 7);
+            }
+            ret = digest_dir(ctx, base, entry_rel);
+        }
+
+next:
+        g_free(path);
+        g_free(entry_rel);
+    }
+
+out:
+    g_ptr_array_free(names, TRUE);
+    g_free(dirpath);
+    return ret;
+}
+
+int container_layer_digest(const char *dir, uint8_t digest[CONTAINER_LAYER_DIGEST_LEN])
+{
+    struct digest_ctx ctx;
+    gsize len = CONTAINER_LAYER_DIGEST_LEN;
+    int ret;
+
+    if((ctx.buf = malloc(READ_CHUNK)) == NULL) {
+        return -ENOMEM;
+    }
+    ctx.tree = g_checksum_new(G_CHECKSUM_SHA256);
+
+    ret = digest_dir(&ctx, dir, "");
+    if(ret == 0) {
+        g_checksum_get_digest(ctx.tree, digest, &len);
+    }
+
+    g_checksum_free(ctx.tree);
+    free(ctx.buf);
+    return ret;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __CONTAINER_LAYERS_H__
+#define __CONTAINER_LAYERS_H__
+
+/*! \file
+ * Helpers for measuring the overlayfs root filesystems of containers:
+ * finding the layers of a mount namespace's root in its mountinfo, and
+ * computing a digest of the contents of a layer directory.
+ */
+
+#include <stdint.h>
+#include <glib.h>
+
+#define CONTAINER_LAYER_DIGEST_LEN 32
+
+/**
+ * The directories making up an overlayfs root. Lower directories are
+ * listed from the top of the stack down, as in the lowerdir option.
+ */
+typedef struct container_overlay {
+    GList *lowerdirs;	/* char * */
+    char *upperdir;	/* NULL for a read-only overlay */
+} container_overlay;
+
+/**
+ * Find the mount of "/" in @mountinfo, the contents of a
+ * /proc/PID/mountinfo file, and if it is an overlayfs fill in @out with
+ * its layers. Where "/" is mounted more than once the last (visible)
+ * mount is used.
+ *
+ * Returns 0 on success, -ENOENT if "/" is not an overlayfs mount and
+ * -EINVAL if @mountinfo is malformed.
+ */
+int container_overlay_parse_mountinfo(const char *mountinfo, container_overlay *out);
+
+void container_overlay_clear(container_overlay *ov);
+
+/**
+ * Compute a digest of the tree rooted at @dir. The digest covers the
+ * relative path, type, mode and ownership of every entry, the contents
+ * of regular files, the targets of symbolic links, overlayfs whiteouts
+ * and opaque directory markers, so two directories with the same
+ * contents have the same digest wherever they are. Symbolic links are
+ * not followed.
+ *
+ * Returns 0 on success or a negative errno value.
+ */
+int container_layer_digest(const char *dir, uint8_t digest[CONTAINER_LAYER_DIGEST_LEN]);
+
+#endif /* __CONTAINER_LAYERS_H__ */
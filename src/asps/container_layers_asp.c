@@ -0,0 +1,363 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+/*! \file
+ * This ASP discovers the containers running on the host and measures
+ * their overlayfs root filesystems.
+ *
+ * Processes are grouped into containers by mount namespace and root.
+ * Each container gets a process node (addressed by its lowest pid)
+ * attached to the input node by a "containers" edge. The container
+ * node has an enumeration listing its upper directory and layers in
+ * stack order, and "container.layers" and "container.upper" edges to
+ * one node per directory, carrying a sha256 tree digest of it.
+ *
+ * Read-only image layers are usually shared by many containers. Each
+ * distinct layer directory is digested once and has one node, which
+ * all containers using it reference. Upper directories are private
+ * to a container and always get their own node.
+ *
+ * This ASP must be run as root to inspect other processes' namespaces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <util/util.h>
+
+#include <asp/asp-api.h>
+#include <graph/graph-core.h>
+#include <common/asp-errno.h>
+#include <maat-basetypes.h>
+#include <address_space/pid_as.h>
+#include <address_space/simple_file.h>
+#include <target/file_target_type.h>
+#include <target/process.h>
+#include <measurement/sha256_type.h>
+#include <measurement/enumeration_measurement_type.h>
+
+#include "container_layers.h"
+
+#define ASP_NAME "container_layers"
+
+typedef struct container_group {
+    pid_t pid;			/* lowest pid in the group */
+    unsigned int nr_pids;
+} container_group;
+
+int asp_init(int argc UNUSED, char *argv[] UNUSED)
+{
+    asp_loginfo("Initializing "ASP_NAME" ASP\n");
+    return register_types();
+}
+
+int asp_exit(int status UNUSED)
+{
+    asp_loginfo("Exiting "ASP_NAME" ASP\n");
+    return ASP_APB_SUCCESS;
+}
+
+static char *read_proc_link(pid_t pid, const char *name)
+{
+    char path[64];
+    char *target;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    target = g_file_read_link(path, NULL);
+    return target;
+}
+
+/*
+ * Group the processes outside the ASP's own mount namespace by mount
+ * namespace and root. Returns a table of "<mnt ns> <root>" ->
+ * container_group.
+ */
+static GHashTable *find_containers(void)
+{
+    GHashTable *groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    char *self_ns = read_proc_link(getpid(), "ns/mnt");
+    struct dirent *de;
+    DIR *proc;
+
+    if(self_ns == NULL || (proc = opendir("/proc")) == NULL) {
+        asp_logerror("Failed to inspect /proc: %s\n", strerror(errno));
+        g_free(self_ns);
+        g_hash_table_destroy(groups);
+        return NULL;
+    }
+
+    while((de = readdir(proc)) != NULL) {
+        container_group *grp;
+        char *endptr;
+        char *ns, *root, *key;
+        long pid;
+
+        errno = 0;
+        pid = strtol(de->d_name, &endptr, 10);
+        if(de->d_name[0] == '\0' || *endptr != '\0' || errno != 0 ||
+                pid <= 0 || pid != (pid_t)pid) {
+            continue;
+        }
+
+        /* processes may exit while we look */
+        if((ns = read_proc_link((pid_t)pid, "ns/mnt")) == NULL) {
+            continue;
+        }
+        if(strcmp(ns, self_ns) == 0 ||
+                (root = read_proc_link((pid_t)pid, "root")) == NULL) {
+            g_free(ns);
+            continue;
+        }
+
+        key = g_strdup_printf("%s %s", ns, root);
+        g_free(ns);
+        g_free(root);
+
+        if((grp = g_hash_table_lookup(groups, key)) == NULL) {
+            grp = g_malloc0(sizeof(*grp));
+            grp->pid = (pid_t)pid;
+            g_hash_table_insert(groups, key, grp);
+        } else {
+            g_free(key);
+            if(pid < grp->pid) {
+                grp->pid = (pid_t)pid;
+            }
+        }
+        grp->nr_pids++;
+    }
+    closedir(proc);
+    g_free(self_ns);
+
+    return groups;
+}
+
+/*
+ * Add a node for @dir carrying its tree digest. *@out is set once the
+ * node exists, even if digesting fails.
+ */
+static int add_dir_node(measurement_graph *graph, const char *dir, node_id_t *out)
+{
+    measurement_variable v;
+    sha256_measurement_data *hash;
+    int ret;
+
+    v.type = &file_target_type;
+    if((v.address = alloc_address(&simple_file_address_space)) == NULL) {
+        return -ENOMEM;
+    }
+    container_of(v.address, simple_file_address, a)->filename = strdup(dir);
+
+    ret = measurement_graph_add_node(graph, &v, NULL, out);
+    free_address(v.address);
+    if(ret < 0) {
+        asp_logerror("Failed to add node for %s\n", dir);
+        return ret;
+    }
+    announce_node(*out);
+
+    hash = container_of(alloc_measurement_data(&sha256_measurement_type),
+                        sha256_measurement_data, meas_data);
+    if(hash == NULL) {
+        return -ENOMEM;
+    }
+    if((ret = container_layer_digest(dir, hash->sha256_hash)) != 0) {
+        asp_logwarn("Failed to digest %s: %s\n", dir, strerror(-ret));
+    } else if((ret = measurement_node_add_rawdata(graph, *out, &hash->meas_data)) != 0) {
+        asp_logerror("Failed to add digest of %s to its node\n", dir);
+    }
+    free_measurement_data(&hash->meas_data);
+    return ret;
+}
+
+/*
+ * Return the node of the lower directory @dir, creating and measuring
+ * it on first use. Layers are identified by device and inode so the
+ * different symlinked names runtimes use for a layer share a node.
+ */
+static node_id_t get_layer_node(measurement_graph *graph, GHashTable *layers,
+                                const char *dir)
+{
+    struct stat st;
+    node_id_t *n;
+    char *key;
+
+    if(stat(dir, &st) != 0) {
+        asp_logwarn("Failed to stat layer %s: %s\n", dir, strerror(errno));
+        return INVALID_NODE_ID;
+    }
+
+    key = g_strdup_printf("%ju:%ju", (uintmax_t)st.st_dev, (uintmax_t)st.st_ino);
+    if((n = g_hash_table_lookup(layers, key)) != NULL) {
+        g_free(key);
+        return *n;
+    }
+
+    /*
+     * A layer that could not be digested keeps its (data less) node,
+     * and is not retried for the next container that uses it.
+     */
+    n = g_malloc(sizeof(*n));
+    *n = INVALID_NODE_ID;
+    add_dir_node(graph, dir, n);
+    g_hash_table_insert(layers, key, n);
+    return *n;
+}
+
+static void add_edge(measurement_graph *graph, node_id_t from, const char *label,
+                     node_id_t to)
+{
+    edge_id_t e;
+
+    if(to == INVALID_NODE_ID) {
+        return;
+    }
+    if(measurement_graph_add_edge(graph, from, label, to, &e) < 0) {
+        asp_logwarn("Failed to add %s edge\n", label);
+    } else {
+        announce_edge(e);
+    }
+}
+
+static int measure_container(measurement_graph *graph, node_id_t parent,
+                             container_group *grp, GHashTable *layers)
+{
+    measurement_variable v;
+    container_overlay ov;
+    enumeration_data *stack;
+    node_id_t cnode, n;
+    char path[64];
+    gchar *mountinfo = NULL;
+    GList *l;
+    int ret;
+
+    snprintf(path, sizeof(path), "/proc/%d/mountinfo", grp->pid);
+    if(!g_file_get_contents(path, &mountinfo, NULL, NULL)) {
+        asp_logwarn("Failed to read %s\n", path);
+        return -EIO;
+    }
+    ret = container_overlay_parse_mountinfo(mountinfo, &ov);
+    g_free(mountinfo);
+    if(ret == -ENOENT) {
+        asp_loginfo("Root of pid %d is not an overlay, not a container\n", grp->pid);
+        return 0;
+    } else if(ret != 0) {
+        asp_logwarn("Failed to parse %s\n", path);
+        return ret;
+    }
+
+    v.type = &process_target_type;
+    if((v.address = alloc_address(&pid_address_space)) == NULL) {
+        container_overlay_clear(&ov);
+        return -ENOMEM;
+    }
+    container_of(v.address, pid_address, a)->pid = (uint32_t)grp->pid;
+    ret = measurement_graph_add_node(graph, &v, NULL, &cnode);
+    free_address(v.address);
+    if(ret < 0) {
+        asp_logerror("Failed to add container node for pid %d\n", grp->pid);
+        container_overlay_clear(&ov);
+        return ret;
+    }
+    announce_node(cnode);
+    add_edge(graph, parent, "containers", cnode);
+
+    asp_loginfo("Container of pid %d (%u processes): %u layers%s\n", grp->pid,
+                grp->nr_pids, g_list_length(ov.lowerdirs),
+                ov.upperdir != NULL ? " and an upper directory" : "");
+
+    stack = container_of(alloc_measurement_data(&enumeration_measurement_type),
+                         enumeration_data, meas_data);
+
+    if(ov.upperdir != NULL) {
+        n = INVALID_NODE_ID;
+        add_dir_node(graph, ov.upperdir, &n);
+        add_edge(graph, cnode, "container.upper", n);
+        if(stack != NULL) {
+            enumeration_data_add_entry(stack, g_strdup_printf("upper=%s", ov.upperdir));
+        }
+    }
+
+    for(l = ov.lowerdirs; l != NULL; l = l->next) {
+        n = get_layer_node(graph, layers, l->data);
+        add_edge(graph, cnode, "container.layers", n);
+        if(stack != NULL) {
+            enumeration_data_add_entry(stack, g_strdup_printf("lower=%s", (char *)l->data));
+        }
+    }
+
+    if(stack != NULL) {
+        if(measurement_node_add_rawdata(graph, cnode, &stack->meas_data) != 0) {
+            asp_logwarn("Failed to add layer list to container node\n");
+        }
+        free_measurement_data(&stack->meas_data);
+    }
+
+    container_overlay_clear(&ov);
+    return 0;
+}
+
+static gint compare_groups(gconstpointer a, gconstpointer b)
+{
+    const container_group *ga = a, *gb = b;
+    return (ga->pid > gb->pid) - (ga->pid < gb->pid);
+}
+
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph = NULL;
+    node_id_t node_id;
+    GHashTable *groups;
+    GHashTable *layers;
+    GList *sorted, *l;
+    int nr_containers = 0;
+
+    if((argc < 3) ||
+            ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id>\n");
+        return -EINVAL;
+    }
+
+    if((groups = find_containers()) == NULL) {
+        unmap_measurement_graph(graph);
+        return -EIO;
+    }
+    layers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    /* measure in pid order so the graph does not depend on hash order */
+    sorted = g_list_sort(g_hash_table_get_values(groups), compare_groups);
+    for(l = sorted; l != NULL; l = l->next) {
+        if(measure_container(graph, node_id, l->data, layers) == 0) {
+            nr_containers++;
+        }
+    }
+    g_list_free(sorted);
+
+    asp_loginfo("Measured %d mount namespaces sharing %u distinct layers\n",
+                nr_containers, g_hash_table_size(layers));
+
+    g_hash_table_destroy(layers);
+    g_hash_table_destroy(groups);
+    unmap_measurement_graph(graph);
+    return ASP_APB_SUCCESS;
+}
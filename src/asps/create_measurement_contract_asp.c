@@ -55,9 +55,11 @@
  * @workdir is the working directory for the AM
  * @out_nonce will be set to the value of the nonce found in the execute contract.
  * @out_nonce should be freed by the caller
+ * @out_detached is set to 1 if the appraiser accepts a detached measurement payload
  * Helper function to future_create_msmt_contract_asp()
  */
-static int retrieve_values_from_execon(char *workdir, char **out_nonce)
+static int retrieve_values_from_execon(char *workdir, char **out_nonce,
+                                       int *out_detached)
 {
     xmlDoc *doc       = NULL;
     xmlNode *root     = NULL;
@@ -88,6 +90,7 @@ static int retrieve_values_from_execon(char *workdir, char **out_nonce)
     nonce = get_nonce_xml(root);
 
     *out_nonce = nonce;
+    *out_detached = is_detached_payload(root);
 
 get_root_failed:
     xmlFreeDoc(doc);
@@ -219,6 +222,9 @@ static int sign_contract(xmlDoc *doc, xmlNode *subcontract_node, char *certfile,
  * @key is the key to decrypt the buffer if encrypted @keysize is its size and should be non-null
  * @compressed should be 1 if @buf is compressed. @encrypted should be 1 if it is encrypted, and
  * Contract is only signed if @certfile is provided
+ * If the appraiser advertised support for it in the execute contract,
+ * @buf is sent as a detached payload following the XML rather than
+ * base64 encoded inside the measurement node.
  * Returns 0 on success, < 0 on error. On success, @out is set to the resultant contract, with
  * size @out_size
  */
@@ -242,9 +248,10 @@ static int create_msmt_contract(char *workdir, char *certfile,
     size_t response_size;
     char * nonce     = NULL;
     char * tmpstr    = NULL;
+    int detached     = 0;
     int ret = 0;
 
-    ret = retrieve_values_from_execon(workdir, &nonce);
+    ret = retrieve_values_from_execon(workdir, &nonce, &detached);
     if(ret != 0) {
         dlog(0, "Error: failed to parse values from execon\n");
         ret = -1;
@@ -258,8 +265,8 @@ static int create_msmt_contract(char *workdir, char *certfile,
         goto create_measurement_contract_failed;
     }
 
-    // Encode
-    if(( b64 = b64_encode(buf, buf_size)) == NULL) {
+    // Encode, unless the buffer is going to follow the XML as is
+    if(!detached && (b64 = b64_encode(buf, buf_size)) == NULL) {
         dlog(0, "Failed to base64 encode encrypted buffer\n");
         ret = -1;
         goto b64_encode_failed;
@@ -272,6 +279,13 @@ static int create_msmt_contract(char *workdir, char *certfile,
         goto create_msmt_node_failed;
     }
 
+    // The signature covers the digest of a detached buffer
+    if(detached && bind_detached_payload(msmt_node, buf, buf_size) != 0) {
+        dlog(0, "Failed to bind detached measurement to contract\n");
+        ret = -1;
+        goto create_msmt_node_failed;
+    }
+
     if(compressed) {
         xmlSetProp(msmt_node, (xmlChar *)"compressed", (xmlChar *)"true");
     }
@@ -309,7 +323,19 @@ static int create_msmt_contract(char *workdir, char *certfile,
 
     xmlDocDumpMemory(doc, &response, &response_int);
 
-    if(response_int > 0) {
+    if(response_int > 0 && detached) {
+        unsigned char *framed = NULL;
+
+        ret = frame_detached_payload(response, (size_t)response_int, buf, buf_size,
+                                     &framed, &response_size);
+        xmlFree(response);
+        response = framed;
+        if(ret < 0) {
+            dlog(0, "Failed to attach measurement to contract\n");
+            response_size = 0;
+            ret = -1;
+        }
+    } else if(response_int > 0) {
         response_size = (size_t)(response_int + 1); // include the null terminator
         ret = 0;
     } else {
@@ -20,7 +20,9 @@
  *   In the default behavior, this ASP takes inventory of all packages installed on the
  *      system, by querying dpkg-query.
  *   If the address type is a file, this ASP will find the corresponding package on the
- *      system and add it to the graph.
+ *      system and add it to the graph. Several comma separated file nodes may be passed
+ *      at once; their owners are all found in one index of the dpkg database (see
+ *      pkg_owner_index.h) rather than by a dpkg-query -S per file.
  *   Otherwise, if a char * wildcard pattern argument is passed to the ASP, this ASP will
  *      use it to pattern match and inventory all of the matching packages installed on
  *      the system.
@@ -47,6 +49,8 @@
 #include <address_space/file_address_space.h>
 #include <common/asp-errno.h>
 
+#include "pkg_owner_index.h"
+
 #include <sys/types.h>
 
 #define ASP_NAME "dpkg_inv"
@@ -241,15 +245,150 @@ error_alloc_address:
     return ret_val;
 }
 
+/**
+ * Returns the path of a file address, or NULL if @address is not one.
+ */
+static char *file_of_address(address *address)
+{
+    if(address == NULL) {
+        return NULL;
+    } else if (address->space == &simple_file_address_space) {
+        return (container_of(address, simple_file_address, a))->filename;
+    } else if (address->space == &file_addr_space) {
+        return (container_of(address, file_addr, address))->fullpath_file_name;
+    }
+    return NULL;
+}
+
+static int build_dpkg_index(pkg_owner_index **out)
+{
+    return pkg_owner_index_build_dpkg(PKG_OWNER_DPKG_ADMINDIR, out);
+}
+
+/**
+ * Adds the package owning the file at @node_id, found in @idx or, if
+ * there is no index, with dpkg-query. Files not owned by any package
+ * get pkginv data without a package, as with rpm_inv.
+ */
+static int measure_file_node(measurement_graph *graph, node_id_t node_id,
+                             pkg_owner_index *idx)
+{
+    address *address           = measurement_node_get_address(graph, node_id);
+    measurement_data *inv_data = NULL;
+    const char *owner          = NULL;
+    char *filename             = NULL;
+    char *package              = NULL;
+    char *line                 = NULL;
+    size_t len                 = 0;
+    FILE *fp                   = NULL;
+    int ret_val                = 0;
+
+    if((filename = file_of_address(address)) == NULL) {
+        dlog(0, "Error: could not find file to evaluate for node "ID_FMT"\n", node_id);
+        ret_val = -EINVAL;
+        goto out;
+    }
+    dlog(3, "\t with file: %s\n", filename);
+
+    if(idx != NULL) {
+        if((owner = pkg_owner_index_lookup(idx, filename)) == NULL) {
+            dlog(4, "File %s not managed by DPKG\n", filename);
+        } else if((line = strdup(owner)) == NULL) {
+            ret_val = -ENOMEM;
+            goto out;
+        } else {
+            add_package_node(graph, node_id, line);
+        }
+    } else {
+        ret_val = filename_get_package(filename, &package);
+        if(ret_val == -ENOENT) {
+            dlog(4, "File %s not managed by DPKG\n", filename);
+            ret_val = 0;
+        } else if(ret_val != 0) {
+            dlog(2, "Error finding package for file\n");
+            goto out;
+        } else {
+            fp = exec_list_pkgs(package);
+            free(package);
+            if(!fp) {
+                dlog(0, "Error exec'ing\n");
+                ret_val = -EIO;
+                goto out;
+            }
+            while(getline(&line, &len, fp) != -1) {
+                add_package_node(graph, node_id, line);
+            }
+            fclose(fp);
+        }
+    }
+
+    inv_data = alloc_measurement_data(&pkginv_measurement_type);
+    if(inv_data == NULL) {
+        dlog(0, "pkg inv measurement type alloc error\n");
+        ret_val = -ENOMEM;
+        goto out;
+    }
+
+    if((ret_val = measurement_node_add_rawdata(graph, node_id, inv_data)) < 0) {
+        dlog(0, "Error while adding data to node : %d\n", ret_val);
+        ret_val = ASP_APB_ERROR_GRAPHOPERATION;
+    }
+    free_measurement_data(inv_data);
+
+out:
+    free(line);
+    free_address(address);
+    return ret_val;
+}
+
+/**
+ * Finds the packages owning the files at each of the comma separated
+ * @node_ids. The owners all come from one package owner index, which
+ * is built on first use and cached with the graph for the rest of
+ * the attestation.
+ */
+static int measure_file_nodes(measurement_graph *graph, const char *graph_path,
+                              const char *node_ids)
+{
+    pkg_owner_index *idx = NULL;
+    char **ids           = g_strsplit(node_ids, ",", -1);
+    node_id_t node_id;
+    int ret_val = 0;
+    int rc;
+    int i;
+
+    if(pkg_owner_index_open_cached(graph_path, build_dpkg_index, &idx) != 0) {
+        dlog(2, "Failed to index package files, falling back to dpkg-query\n");
+        idx = NULL;
+    }
+
+    /* a file that fails is left without pkginv data, the others are still measured */
+    for(i = 0; ids[i] != NULL; i++) {
+        if((node_id = node_id_of_str(ids[i])) == INVALID_NODE_ID) {
+            dlog(0, "Error: invalid node id %s\n", ids[i]);
+            rc = -EINVAL;
+        } else {
+            rc = measure_file_node(graph, node_id, idx);
+        }
+        if(rc != 0 && ret_val == 0) {
+            ret_val = rc;
+        }
+    }
+
+    pkg_owner_index_free(idx);
+    g_strfreev(ids);
+    return ret_val;
+}
+
 int asp_measure(int argc, char *argv[])
 {
     dlog(5, "IN dpkg_inv ASP MEASURE\n");
     measurement_graph *graph  = NULL;
     address *address          = NULL;
-    char *filename            = NULL;
     char *package             = NULL;
     measurement_data *inv_data = NULL;
     node_id_t node_id  = INVALID_NODE_ID;
+    int is_file;
     int ret_val = 0;
 
     FILE *fp = NULL;
@@ -259,52 +398,33 @@ int asp_measure(int argc, char *argv[])
     if((argc < 3) ||
             ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
             (map_measurement_graph(argv[1], &graph) != 0)) {
-        asp_logerror("Usage: "ASP_NAME" <graph path> <node id>\n");
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id>[,<node id>...] [pattern]\n");
         return -EINVAL;
     }
 
-    asp_loginfo("Measuring node "ID_FMT" of graph @ %s\n", node_id, argv[1]);
+    asp_loginfo("Measuring node(s) %s of graph @ %s\n", argv[2], argv[1]);
 
     address = measurement_node_get_address(graph, node_id);
-
-    dlog(2, "Looking for all packages on the system\n");
+    is_file = file_of_address(address) != NULL;
+    free_address(address);
 
     /*
-     * If the address space is a filename, find the package owning the file.
+     * If the address space is a filename, find the package owning the file
+     * (or each file, if several nodes were passed).
      * Else, take inventory of all packages on the system
      * (or pattern match if argument passed)
      */
-    if(address && (address->space == &simple_file_address_space ||
-                   address->space == &file_addr_space)) {
-        if (address->space == &simple_file_address_space) {
-            filename =
-                (container_of(address, simple_file_address, a))->filename;
-        } else if (address->space == &file_addr_space) {
-            filename =
-                (container_of(address, file_addr, address))->fullpath_file_name;
-        }
-
-        if(!filename) {
-            dlog(0, "Error: could not find file to evaluate\n");
-            ret_val = -1;
-            free_address(address);
-            goto error;
-        }
-        dlog(3, "\t with file: %s\n", filename);
-
-        ret_val = filename_get_package(filename, &package);
+    if(is_file) {
+        ret_val = measure_file_nodes(graph, argv[1], argv[2]);
         if(ret_val != 0) {
-            if (ret_val == -ENOENT) {
-                goto out_good;
-            }
-            dlog(2, "Error finding package for file\n");
-            free_address(address);
             goto error;
         }
+        goto out_good;
     }
-    free_address(address);
 
-    if((package == NULL) && argc == 4) {
+    dlog(2, "Looking for all packages on the system\n");
+
+    if(argc == 4) {
         package = strdup(argv[3]);
         if (package == NULL) {
             dlog(0, "Error allocating package name, exiting\n");
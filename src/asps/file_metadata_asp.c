@@ -0,0 +1,244 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * This ASP collects the file_metadata of every entry in the tree under
+ * a directory in a single run.
+ *
+ * Each entry gets a file_target_type node, carrying its file_metadata
+ * and connected to the input node by a "file_metadata.files" edge. The
+ * statx(2) calls for the entries are issued in batches, through
+ * io_uring where possible (see file_metadata_collect.h), instead of
+ * one ASP run and one synchronous stat per file.
+ *
+ * Options may follow the node id:
+ *   xattrs           also read the SELinux label, IMA and ACL xattrs
+ *   xdev             stay on the filesystem of the input directory
+ *   queue_depth=<n>  statx calls per batch (default 256)
+ *   threads=<n>      threads used without io_uring (default one per CPU)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <util/util.h>
+#include <measurement_spec/find_types.h>
+#include <asp/asp-api.h>
+#include <graph/graph-core.h>
+#include <common/asp-errno.h>
+#include <address_space/file_address_space.h>
+#include <address_space/simple_file.h>
+#include <target/file_target_type.h>
+#include <measurement/file_metadata_measurement_type.h>
+
+#include "file_metadata_collect.h"
+
+struct collect_ctx {
+    measurement_graph *graph;
+    node_id_t dir_node;
+    unsigned long failed;
+};
+
+int asp_init(int argc UNUSED, char *argv[] UNUSED)
+{
+    int ret_val = 0;
+    asp_logdebug("Initializing "ASP_NAME" ASP\n");
+
+    if((ret_val = register_measurement_type(&file_metadata_measurement_type)) != 0) {
+        asp_logerror("Failed to register file metadata measurement type\n");
+        return ret_val;
+    }
+    if((ret_val = register_target_type(&file_target_type)) != 0) {
+        asp_logerror("Failed to register file target type\n");
+        return ret_val;
+    }
+    if((ret_val = register_address_space(&file_addr_space)) != 0) {
+        asp_logerror("Failed to register file address space\n");
+        return ret_val;
+    }
+    if((ret_val = register_address_space(&simple_file_address_space)) != 0) {
+        asp_logerror("Failed to register simple file address space\n");
+        return ret_val;
+    }
+
+    asp_logdebug("Done initializing "ASP_NAME" ASP\n");
+    return ASP_APB_SUCCESS;
+}
+
+int asp_exit(int status UNUSED)
+{
+    asp_logdebug("Exiting "ASP_NAME" ASP\n");
+    return ASP_APB_SUCCESS;
+}
+
+/*
+ * Adds the node for one entry. Failures are counted rather than
+ * stopping the walk, so one bad entry does not lose the others.
+ */
+static int add_entry(const char *path, const struct statx *stx,
+                     const struct file_metadata_struct *md, void *arg)
+{
+    struct collect_ctx *ctx = arg;
+    struct file_metadata_measurement_data *data = NULL;
+    measurement_variable *var = NULL;
+    file_addr *fa;
+    node_id_t node = INVALID_NODE_ID;
+    edge_id_t edge = INVALID_EDGE_ID;
+
+    if((fa = (file_addr *)alloc_address(&file_addr_space)) == NULL) {
+        goto error;
+    }
+    fa->device_major       = stx->stx_dev_major;
+    fa->device_minor       = stx->stx_dev_minor;
+    fa->file_size          = (unsigned long)stx->stx_size;
+    fa->node               = (unsigned long)stx->stx_ino;
+    if((fa->fullpath_file_name = strdup(path)) == NULL) {
+        free_address(&fa->address);
+        goto error;
+    }
+    if((var = new_measurement_variable(&file_target_type, &fa->address)) == NULL) {
+        free_address(&fa->address);
+        goto error;
+    }
+    if(measurement_graph_add_node(ctx->graph, var, NULL, &node) < 0 ||
+            measurement_graph_add_edge(ctx->graph, ctx->dir_node, "file_metadata.files",
+                                       node, &edge) < 0) {
+        goto error;
+    }
+
+    data = (struct file_metadata_measurement_data *)
+           alloc_measurement_data(&file_metadata_measurement_type);
+    if(data == NULL) {
+        goto error;
+    }
+    data->file_metadata = *md;
+    if(measurement_node_add_rawdata(ctx->graph, node, &data->meas_data) != 0) {
+        goto error;
+    }
+
+    free_measurement_data(&data->meas_data);
+    free_measurement_variable(var);
+    return 0;
+
+error:
+    asp_logwarn("Failed to record metadata of %s\n", path);
+    if(data != NULL) {
+        free_measurement_data(&data->meas_data);
+    }
+    free_measurement_variable(var);
+    ctx->failed++;
+    return 0;
+}
+
+static int parse_option(const char *arg, struct fmc_options *opts)
+{
+    unsigned long val;
+    char *end;
+
+    if(strcmp(arg, "xattrs") == 0) {
+        opts->flags |= FMC_XATTRS;
+    } else if(strcmp(arg, "xdev") == 0) {
+        opts->flags |= FMC_XDEV;
+    } else if(strncmp(arg, "queue_depth=", 12) == 0) {
+        errno = 0;
+        val = strtoul(arg + 12, &end, 10);
+        if(errno || *end != '\0' || val == 0 || val > FMC_MAX_QUEUE_DEPTH) {
+            return -EINVAL;
+        }
+        opts->queue_depth = (unsigned int)val;
+    } else if(strncmp(arg, "threads=", 8) == 0) {
+        errno = 0;
+        val = strtoul(arg + 8, &end, 10);
+        if(errno || *end != '\0' || val == 0 || val > INT_MAX) {
+            return -EINVAL;
+        }
+        opts->threads = (unsigned int)val;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph = NULL;
+    node_id_t node_id = INVALID_NODE_ID;
+    struct fmc_options opts = { 0, 0, 0 };
+    struct fmc_stats stats;
+    struct collect_ctx ctx;
+    address *addr = NULL;
+    char *dir = NULL;
+    int rc = 0;
+    int i;
+
+    if((argc < 3) ||
+            ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> [xattrs] [xdev] "
+                     "[queue_depth=<n>] [threads=<n>]\n");
+        return -EINVAL;
+    }
+    for(i = 3; i < argc; i++) {
+        if(parse_option(argv[i], &opts) != 0) {
+            asp_logerror("Invalid option \"%s\"\n", argv[i]);
+            rc = -EINVAL;
+            goto bad_option;
+        }
+    }
+
+    if((addr = measurement_node_get_address(graph, node_id)) == NULL) {
+        asp_logerror("Failed to get address of node "ID_FMT"\n", node_id);
+        rc = -EINVAL;
+        goto get_address_failed;
+    }
+    if(addr->space == &file_addr_space) {
+        dir = ((file_addr *)addr)->fullpath_file_name;
+    } else if(addr->space == &simple_file_address_space) {
+        dir = ((simple_file_address *)addr)->filename;
+    } else {
+        asp_logerror("Input node address must be either a file_addr or simple_file_address.\n");
+        rc = -EINVAL;
+        goto bad_address_space;
+    }
+
+    ctx.graph    = graph;
+    ctx.dir_node = node_id;
+    ctx.failed   = 0;
+    asp_loginfo("Collecting file metadata under %s\n", dir);
+    if((rc = file_metadata_collect(dir, &opts, add_entry, &ctx, &stats)) != 0) {
+        asp_logerror("Failed to read directory %s: %s\n", dir, strerror(-rc));
+        goto collect_failed;
+    }
+    asp_loginfo("Collected metadata of %lu entries under %s (%lu unreadable, %lu not recorded%s)\n",
+                stats.entries, dir, stats.errors, ctx.failed,
+                stats.used_uring ? ", io_uring" : "");
+    if(ctx.failed > 0) {
+        rc = -EIO;
+    }
+
+collect_failed:
+bad_address_space:
+    free_address(addr);
+get_address_failed:
+bad_option:
+    unmap_measurement_graph(graph);
+    return rc;
+}
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Batched statx(2) and xattr collection for the file_metadata ASP.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <util/util.h>
+
+#include "file_metadata_collect.h"
+
+#ifndef STATX_MNT_ID
+#define STATX_MNT_ID	0x00001000U
+#endif
+
+#define FMC_STATX_MASK	(STATX_BASIC_STATS | STATX_MNT_ID)
+#define FMC_STATX_FLAGS	(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT)
+
+#if defined(HAVE_LIBURING) && defined(HAVE_DECL_IO_URING_PREP_GETXATTR) && \
+        HAVE_DECL_IO_URING_PREP_GETXATTR
+#define FMC_URING_XATTRS
+#endif
+
+/* the operations issued for each entry, statx first */
+enum fmc_op {
+    FMC_OP_STATX,
+    FMC_OP_SELINUX,
+    FMC_OP_IMA,
+    FMC_OP_ACL,
+    FMC_NR_OPS
+};
+
+static const char *fmc_xattr_names[FMC_NR_OPS] = {
+    [FMC_OP_SELINUX]	= "security.selinux",
+    [FMC_OP_IMA]	= "security.ima",
+    [FMC_OP_ACL]	= "system.posix_acl_access",
+};
+
+struct fmc_entry {
+    char *path;
+    int err;		/* 0 or the negative errno of the statx */
+    int has_ima;
+    int has_acl;
+    struct statx stx;
+    char label[64];
+};
+
+struct fmc_chunk {
+    struct fmc_walk *walk;
+    size_t start;
+    size_t end;
+    unsigned int first_op;
+};
+
+struct fmc_walk {
+    unsigned int flags;
+    unsigned int depth;
+    struct fmc_entry *ents;
+    size_t nr;
+    GQueue dirs;		/* char *, directories left to read */
+    uint32_t root_dev_major;
+    uint32_t root_dev_minor;
+    fmc_callback cb;
+    void *ctx;
+    struct fmc_stats *stats;
+
+    /* thread pool, created on first use */
+    unsigned int threads;
+    GThreadPool *pool;
+    struct fmc_chunk *chunks;
+    GMutex lock;
+    GCond cond;
+    unsigned int pending;
+
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    int have_ring;
+    int ring_xattrs;		/* the kernel has IORING_OP_GETXATTR */
+#endif
+};
+
+static int is_symlink(const struct fmc_entry *e)
+{
+    return S_ISLNK(e->stx.stx_mode);
+}
+
+/*
+ * The xattr reads are only issued for entries whose statx succeeded.
+ * io_uring's getxattr always follows symbolic links, so to get the
+ * same results from both backends the xattrs of links are never read.
+ */
+static int want_op(const struct fmc_walk *w, const struct fmc_entry *e, unsigned int op)
+{
+    if(op == FMC_OP_STATX) {
+        return 1;
+    }
+    return (w->flags & FMC_XATTRS) && e->err == 0 && !is_symlink(e);
+}
+
+static void complete_op(struct fmc_entry *e, unsigned int op, long res)
+{
+    switch(op) {
+    case FMC_OP_STATX:
+        e->err = res < 0 ? (int)res : 0;
+        break;
+    case FMC_OP_SELINUX:
+        if(res > 0 && (size_t)res < sizeof(e->label)) {
+            e->label[res] = '\0';
+        } else {
+            e->label[0] = '\0';
+        }
+        break;
+    case FMC_OP_IMA:
+        e->has_ima = res >= 0;
+        break;
+    case FMC_OP_ACL:
+        e->has_acl = res >= 0;
+        break;
+    }
+}
+
+static void sync_op(struct fmc_entry *e, unsigned int op)
+{
+    ssize_t res;
+
+    if(op == FMC_OP_STATX) {
+        res = statx(AT_FDCWD, e->path, FMC_STATX_FLAGS, FMC_STATX_MASK, &e->stx);
+    } else if(op == FMC_OP_SELINUX) {
+        res = lgetxattr(e->path, fmc_xattr_names[op], e->label, sizeof(e->label) - 1);
+    } else {
+        res = lgetxattr(e->path, fmc_xattr_names[op], NULL, 0);
+    }
+    complete_op(e, op, res < 0 ? -errno : (long)res);
+}
+
+static void pool_worker(gpointer data, gpointer user_data UNUSED)
+{
+    struct fmc_chunk *chunk = data;
+    struct fmc_walk *w = chunk->walk;
+    size_t i;
+    unsigned int op;
+
+    for(i = chunk->start; i < chunk->end; i++) {
+        for(op = chunk->first_op; op < FMC_NR_OPS; op++) {
+            if(want_op(w, &w->ents[i], op)) {
+                sync_op(&w->ents[i], op);
+            }
+        }
+    }
+
+    g_mutex_lock(&w->lock);
+    if(--w->pending == 0) {
+        g_cond_signal(&w->cond);
+    }
+    g_mutex_unlock(&w->lock);
+}
+
+/*
+ * Run the operations from @first_op on for the current batch on the
+ * thread pool, one contiguous chunk of entries per thread. Falls back
+ * to the calling thread if the pool cannot be created.
+ */
+static void pool_run(struct fmc_walk *w, unsigned int first_op)
+{
+    size_t per, start, i;
+    unsigned int n;
+
+    if(w->pool == NULL && w->threads > 1) {
+        w->chunks = calloc(w->threads, sizeof(*w->chunks));
+        if(w->chunks != NULL) {
+            w->pool = g_thread_pool_new(pool_worker, NULL, (gint)w->threads, TRUE, NULL);
+        }
+        if(w->pool == NULL) {
+            dlog(2, "Failed to create the file metadata thread pool\n");
+            w->threads = 1;
+        }
+    }
+    if(w->pool == NULL) {
+        struct fmc_chunk chunk = { w, 0, w->nr, first_op };
+        w->pending = 1;
+        pool_worker(&chunk, NULL);
+        return;
+    }
+
+    n   = (unsigned int)MIN((size_t)w->threads, w->nr);
+    per = (w->nr + n - 1) / n;
+    w->pending = n;
+    for(i = 0, start = 0; i < n; i++, start += per) {
+        w->chunks[i].walk     = w;
+        w->chunks[i].start    = start;
+        w->chunks[i].end      = MIN(start + per, w->nr);
+        w->chunks[i].first_op = first_op;
+        if(!g_thread_pool_push(w->pool, &w->chunks[i], NULL)) {
+            pool_worker(&w->chunks[i], NULL);
+        }
+    }
+
+    g_mutex_lock(&w->lock);
+    while(w->pending > 0) {
+        g_cond_wait(&w->cond, &w->lock);
+    }
+    g_mutex_unlock(&w->lock);
+}
+
+#ifdef HAVE_LIBURING
+static void uring_prep(struct io_uring_sqe *sqe, struct fmc_entry *e, unsigned int op)
+{
+    if(op == FMC_OP_STATX) {
+        io_uring_prep_statx(sqe, AT_FDCWD, e->path, FMC_STATX_FLAGS,
+                            FMC_STATX_MASK, &e->stx);
+    }
+#ifdef FMC_URING_XATTRS
+    else if(op == FMC_OP_SELINUX) {
+        io_uring_prep_getxattr(sqe, fmc_xattr_names[op], e->label, e->path,
+                               sizeof(e->label) - 1);
+    } else {
+        io_uring_prep_getxattr(sqe, fmc_xattr_names[op], NULL, e->path, 0);
+    }
+#endif
+}
+
+/*
+ * Run the operations first_op..last_op for every entry of the batch
+ * through the ring, keeping up to depth of them in flight. The sqe
+ * user data is the entry index and operation.
+ */
+static int uring_run(struct fmc_walk *w, unsigned int first_op, unsigned int last_op)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    unsigned int op = first_op;
+    size_t i = 0;
+    size_t inflight = 0;
+    int ret = 0;
+
+    for(;;) {
+        while(ret == 0 && i < w->nr && inflight < w->depth) {
+            struct io_uring_sqe *sqe;
+
+            if(!want_op(w, &w->ents[i], op)) {
+                goto next;
+            }
+            if((sqe = io_uring_get_sqe(&w->ring)) == NULL) {
+                break;
+            }
+            uring_prep(sqe, &w->ents[i], op);
+            io_uring_sqe_set_data(sqe, (void *)(uintptr_t)(i * FMC_NR_OPS + op));
+            inflight++;
+next:
+            if(++op > last_op) {
+                op = first_op;
+                i++;
+            }
+        }
+        if(inflight == 0) {
+            break;
+        }
+
+        if(ret == 0) {
+            ret = io_uring_submit_and_wait(&w->ring, 1);
+            if(ret == -EINTR || ret == -EAGAIN || ret == -EBUSY || ret >= 0) {
+                ret = 0;
+            } else {
+                /* the queued operations still use the batch buffers */
+                dlog(2, "io_uring submission failed: %s\n", strerror(-ret));
+            }
+        }
+        if(ret != 0 && io_uring_wait_cqe(&w->ring, &cqe) != 0) {
+            return ret;
+        }
+
+        unsigned int seen = 0;
+        io_uring_for_each_cqe(&w->ring, head, cqe) {
+            uintptr_t tag = (uintptr_t)io_uring_cqe_get_data(cqe);
+            complete_op(&w->ents[tag / FMC_NR_OPS], (unsigned int)(tag % FMC_NR_OPS), cqe->res);
+            seen++;
+        }
+        io_uring_cq_advance(&w->ring, seen);
+        inflight -= seen;
+    }
+    return ret;
+}
+
+static void uring_setup(struct fmc_walk *w)
+{
+    struct io_uring_probe *probe;
+    int ret;
+
+    if((ret = io_uring_queue_init(w->depth, &w->ring, 0)) != 0) {
+        dlog(3, "io_uring is unavailable (%s), using a thread pool\n", strerror(-ret));
+        return;
+    }
+    if((probe = io_uring_get_probe_ring(&w->ring)) == NULL ||
+            !io_uring_opcode_supported(probe, IORING_OP_STATX)) {
+        dlog(3, "io_uring does not support statx, using a thread pool\n");
+        io_uring_free_probe(probe);
+        io_uring_queue_exit(&w->ring);
+        return;
+    }
+#ifdef FMC_URING_XATTRS
+    w->ring_xattrs = io_uring_opcode_supported(probe, IORING_OP_GETXATTR);
+#endif
+    io_uring_free_probe(probe);
+    w->have_ring = 1;
+}
+#endif
+
+static int batch_run(struct fmc_walk *w)
+{
+#ifdef HAVE_LIBURING
+    if(w->have_ring) {
+        int ret;
+
+        if(w->ring_xattrs) {
+            /* the xattr ops depend on the statx result */
+            if((ret = uring_run(w, FMC_OP_STATX, FMC_OP_STATX)) == 0) {
+                ret = uring_run(w, FMC_OP_SELINUX, FMC_NR_OPS - 1);
+            }
+            return ret;
+        }
+        if((ret = uring_run(w, FMC_OP_STATX, FMC_OP_STATX)) != 0) {
+            return ret;
+        }
+        if(w->flags & FMC_XATTRS) {
+            pool_run(w, FMC_OP_SELINUX);
+        }
+        return 0;
+    }
+#endif
+    pool_run(w, FMC_OP_STATX);
+    return 0;
+}
+
+static int same_dev(const struct fmc_walk *w, const struct statx *stx)
+{
+    return stx->stx_dev_major == w->root_dev_major &&
+           stx->stx_dev_minor == w->root_dev_minor;
+}
+
+/*
+ * Issue the batch, pass each entry to the callback and queue the
+ * subdirectories found. Empties the batch.
+ */
+static int batch_flush(struct fmc_walk *w)
+{
+    struct file_metadata_struct md;
+    size_t i;
+    int ret;
+
+    if(w->nr == 0) {
+        return 0;
+    }
+    if((ret = batch_run(w)) != 0) {
+        goto out;
+    }
+
+    for(i = 0; i < w->nr; i++) {
+        struct fmc_entry *e = &w->ents[i];
+
+        if(e->err != 0) {
+            dlog(4, "Failed to stat %s: %s\n", e->path, strerror(-e->err));
+            w->stats->errors++;
+            continue;
+        }
+        file_metadata_from_statx(e->path, &e->stx, &md);
+        if(w->flags & FMC_XATTRS) {
+            memcpy(md.selinux_label, e->label, MIN(sizeof(md.selinux_label), sizeof(e->label)));
+            md.has_ima          = e->has_ima;
+            md.has_extended_acl = e->has_acl;
+        }
+        if((ret = w->cb(e->path, &e->stx, &md, w->ctx)) != 0) {
+            break;
+        }
+        w->stats->entries++;
+        if(S_ISDIR(e->stx.stx_mode) &&
+                (!(w->flags & FMC_XDEV) || same_dev(w, &e->stx))) {
+            g_queue_push_tail(&w->dirs, e->path);
+            e->path = NULL;
+        }
+    }
+
+out:
+    for(i = 0; i < w->nr; i++) {
+        free(w->ents[i].path);
+    }
+    w->nr = 0;
+    return ret;
+}
+
+static int batch_add(struct fmc_walk *w, const char *dir, const char *name)
+{
+    struct fmc_entry *e = &w->ents[w->nr];
+    size_t dirlen = strlen(dir);
+    int slash = dirlen == 0 || dir[dirlen - 1] != '/';
+
+    memset(e, 0, sizeof(*e));
+    if(asprintf(&e->path, "%s%s%s", dir, slash ? "/" : "", name) < 0) {
+        e->path = NULL;
+        return -ENOMEM;
+    }
+    if(++w->nr == w->depth) {
+        return batch_flush(w);
+    }
+    return 0;
+}
+
+static int read_dir(struct fmc_walk *w, const char *dir)
+{
+    struct dirent *dent;
+    DIR *d;
+    int ret = 0;
+
+    if((d = opendir(dir)) == NULL) {
+        dlog(4, "Failed to open directory %s: %s\n", dir, strerror(errno));
+        w->stats->errors++;
+        return 0;
+    }
+    while(ret == 0 && (dent = readdir(d)) != NULL) {
+        if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+            continue;
+        }
+        ret = batch_add(w, dir, dent->d_name);
+    }
+    closedir(d);
+    return ret;
+}
+
+int file_metadata_collect(const char *root, const struct fmc_options *opts,
+                          fmc_callback cb, void *ctx, struct fmc_stats *stats)
+{
+    struct fmc_walk w;
+    struct fmc_stats local_stats;
+    struct statx stx;
+    char *dir;
+    int ret = 0;
+
+    memset(&w, 0, sizeof(w));
+    memset(&local_stats, 0, sizeof(local_stats));
+    w.stats = stats ? stats : &local_stats;
+    memset(w.stats, 0, sizeof(*w.stats));
+    w.cb    = cb;
+    w.ctx   = ctx;
+    w.flags = opts ? opts->flags : 0;
+    w.depth = opts && opts->queue_depth ? opts->queue_depth : FMC_DEFAULT_QUEUE_DEPTH;
+    w.depth = MIN(w.depth, FMC_MAX_QUEUE_DEPTH);
+    w.threads = opts && opts->threads ? opts->threads : (unsigned int)g_get_num_processors();
+
+    if(statx(AT_FDCWD, root, AT_NO_AUTOMOUNT, STATX_TYPE, &stx) != 0) {
+        return -errno;
+    }
+    if(!S_ISDIR(stx.stx_mode)) {
+        return -ENOTDIR;
+    }
+    w.root_dev_major = stx.stx_dev_major;
+    w.root_dev_minor = stx.stx_dev_minor;
+
+    if((w.ents = calloc(w.depth, sizeof(*w.ents))) == NULL) {
+        return -ENOMEM;
+    }
+    g_queue_init(&w.dirs);
+    g_mutex_init(&w.lock);
+    g_cond_init(&w.cond);
+
+#ifdef HAVE_LIBURING
+    if(!(w.flags & FMC_NO_URING)) {
+        uring_setup(&w);
+    }
+    w.stats->used_uring = w.have_ring;
+#endif
+
+    if((dir = strdup(root)) == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    do {
+        ret = read_dir(&w, dir);
+        free(dir);
+        if(ret == 0 && g_queue_is_empty(&w.dirs)) {
+            /* the last batch may hold more directories */
+            ret = batch_flush(&w);
+        }
+    } while(ret == 0 && (dir = g_queue_pop_head(&w.dirs)) != NULL);
+
+out:
+    /* on error the batch may still hold entries */
+    while(w.nr > 0) {
+        free(w.ents[--w.nr].path);
+    }
+    while((dir = g_queue_pop_head(&w.dirs)) != NULL) {
+        free(dir);
+    }
+#ifdef HAVE_LIBURING
+    if(w.have_ring) {
+        io_uring_queue_exit(&w.ring);
+    }
+#endif
+    if(w.pool != NULL) {
+        g_thread_pool_free(w.pool, FALSE, TRUE);
+    }
+    free(w.chunks);
+    g_mutex_clear(&w.lock);
+    g_cond_clear(&w.cond);
+    free(w.ents);
+    return ret;
+}
+
+static const char *file_type_name(mode_t mode)
+{
+    /* the OVAL file_state type names */
+    switch(mode & S_IFMT) {
+    case S_IFREG:
+        return "regular";
+    case S_IFDIR:
+        return "directory";
+    case S_IFLNK:
+        return "symbolic link";
+    case S_IFIFO:
+        return "named pipe";
+    case S_IFSOCK:
+        return "socket";
+    case S_IFBLK:
+        return "block special";
+    case S_IFCHR:
+        return "character special";
+    default:
+        return "unknown";
+    }
+}
+
+static void copy_field(char *dst, size_t size, const char *src, size_t len)
+{
+    len = MIN(len, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+void file_metadata_from_statx(const char *path, const struct statx *stx,
+                              struct file_metadata_struct *md)
+{
+    const char *base = strrchr(path, '/');
+    mode_t mode = stx->stx_mode;
+
+    memset(md, 0, sizeof(*md));
+    base = base ? base + 1 : path;
+    copy_field(md->filepath, sizeof(md->filepath), path, strlen(path));
+    copy_field(md->path, sizeof(md->path), path,
+               base > path + 1 ? (size_t)(base - path - 1) : (size_t)(base - path));
+    copy_field(md->filename, sizeof(md->filename), base, strlen(base));
+    copy_field(md->type, sizeof(md->type), file_type_name(mode),
+               strlen(file_type_name(mode)));
+
+    md->user_id  = (int32_t)stx->stx_uid;
+    md->group_id = (int32_t)stx->stx_gid;
+    md->a_time   = (int32_t)stx->stx_atime.tv_sec;
+    md->c_time   = (int32_t)stx->stx_ctime.tv_sec;
+    md->m_time   = (int32_t)stx->stx_mtime.tv_sec;
+    md->size     = stx->stx_size > INT32_MAX ? INT32_MAX : (int32_t)stx->stx_size;
+
+    md->suid   = (mode & S_ISUID) != 0;
+    md->sgid   = (mode & S_ISGID) != 0;
+    md->sticky = (mode & S_ISVTX) != 0;
+    md->uread  = (mode & S_IRUSR) != 0;
+    md->uwrite = (mode & S_IWUSR) != 0;
+    md->uexec  = (mode & S_IXUSR) != 0;
+    md->gread  = (mode & S_IRGRP) != 0;
+    md->gwrite = (mode & S_IWGRP) != 0;
+    md->gexec  = (mode & S_IXGRP) != 0;
+    md->oread  = (mode & S_IROTH) != 0;
+    md->owrite = (mode & S_IWOTH) != 0;
+    md->oexec  = (mode & S_IXOTH) != 0;
+
+    md->mode       = mode;
+    md->nlink      = stx->stx_nlink;
+    md->inode      = stx->stx_ino;
+#ifdef HAVE_STRUCT_STATX_STX_MNT_ID
+    md->mount_id   = (stx->stx_mask & STATX_MNT_ID) ? stx->stx_mnt_id : 0;
+#endif
+    md->attributes = stx->stx_attributes & stx->stx_attributes_mask;
+}
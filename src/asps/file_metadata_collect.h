@@ -0,0 +1,87 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __FILE_METADATA_COLLECT_H__
+#define __FILE_METADATA_COLLECT_H__
+
+/*! \file
+ * Bulk collection of file metadata for the file_metadata ASP.
+ *
+ * The tree under a directory is walked breadth first. The entries
+ * read from the directories are gathered into batches of up to
+ * queue_depth, and the statx(2) calls (and optional xattr reads) for
+ * a whole batch are issued together: through io_uring when liburing
+ * is available and the kernel allows it, or else spread over a pool
+ * of threads. Symbolic links are not followed.
+ */
+
+#include <sys/stat.h>
+#include <measurement/file_metadata_measurement_type.h>
+
+/** Read the SELinux label, IMA and POSIX ACL xattrs of each entry. */
+#define FMC_XATTRS	(1 << 0)
+/** Do not descend into directories on other filesystems. */
+#define FMC_XDEV	(1 << 1)
+/** Use the thread pool even when io_uring is available. */
+#define FMC_NO_URING	(1 << 2)
+
+#define FMC_DEFAULT_QUEUE_DEPTH	256
+#define FMC_MAX_QUEUE_DEPTH	4096
+
+struct fmc_options {
+    unsigned int queue_depth;	/* entries per batch, 0 for the default */
+    unsigned int threads;	/* pool threads, 0 for one per CPU */
+    unsigned int flags;		/* FMC_* */
+};
+
+struct fmc_stats {
+    unsigned long entries;	/* entries passed to the callback */
+    unsigned long errors;	/* entries or directories that could not be read */
+    int used_uring;		/* statx was issued through io_uring */
+};
+
+/**
+ * Called once for every entry found, from the calling thread. @stx is
+ * the raw statx result and @md the file_metadata built from it.
+ * Returning non-zero stops the walk, and file_metadata_collect()
+ * returns that value.
+ */
+typedef int (*fmc_callback)(const char *path, const struct statx *stx,
+                            const struct file_metadata_struct *md, void *ctx);
+
+/**
+ * Collect the metadata of every entry under the directory @root (but
+ * not of @root itself), calling @cb for each. @opts may be NULL for
+ * the defaults and @stats may be NULL.
+ *
+ * Entries that vanish or cannot be read while walking are counted in
+ * @stats->errors and skipped. Returns 0 on success, the value returned
+ * by @cb if it stopped the walk, or a negative errno value if @root
+ * cannot be read.
+ */
+int file_metadata_collect(const char *root, const struct fmc_options *opts,
+                          fmc_callback cb, void *ctx, struct fmc_stats *stats);
+
+/**
+ * Fill in @md from the statx result @stx for @path. Path components
+ * longer than the fields of struct file_metadata_struct are truncated.
+ * The xattr derived fields are left zeroed.
+ */
+void file_metadata_from_statx(const char *path, const struct statx *stx,
+                              struct file_metadata_struct *md);
+
+#endif /* __FILE_METADATA_COLLECT_H__ */
@@ -314,6 +314,14 @@ int asp_measure(int argc, char *argv[])
         printf("\nIoT_UART: IoTA Deserialize Returned Error...\n");
         return -1;
     }
+    // resp points into the received bytes; free them along with it
+    resp->buf = iota_meas;
+
+    if (resp->data_len < 32) {
+        printf("\nIoT_UART: IoTA Response Too Short...\n");
+        iota_msg_deinit(&resp);
+        return -1;
+    }
 
     /* process payload. Make it a measurement. */
     blob_data *blob = NULL;
@@ -338,6 +346,7 @@ int asp_measure(int argc, char *argv[])
     }
 
     /* Cleanup */
+    iota_msg_deinit(&resp);
     free_measurement_data(&blob->d);
     unmap_measurement_graph(graph);
 
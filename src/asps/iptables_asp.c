@@ -0,0 +1,1338 @@
+#define ASP_NAME "iptables"
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+  Implementation of a firewall ruleset measurement ASP. Expects the
+  input node to be an iptables_target_type node in the
+  iptables_address_space whose name identifies an nf_tables table as
+  "[family] table" (e.g., "ip filter", "inet fw" or just "filter",
+  which defaults to the ip family).
+
+  Rather than invoking iptables-save(8) and parsing its output, the
+  ASP speaks NETLINK_NETFILTER directly. The chains and rules of the
+  table are each retrieved with a single dump request covering the
+  whole table, so the number of round trips is constant in the size
+  of the ruleset. The ruleset generation ID is read before and after
+  the dumps; if it changed (or the kernel flags a dump as
+  interrupted) the dump is retried.
+
+  Each chain is added to the graph as an iptables_chain_target_type
+  node in the iptables_chain_address_space connected to the input
+  node by an "iptables.chains" edge, and carries an
+  iptables_chain_measurement_type datum listing its rules. The input
+  node is tagged with the iptables_measurement_type sigil.
+
+  If a cache directory is passed as an optional third argument, the
+  chain measurements are saved there keyed by boot, network namespace
+  cookie and table. A subsequent measurement whose ruleset generation ID
+  matches the cached one reuses the cached data instead of dumping
+  the ruleset again.
+
+  Reading the ruleset requires CAP_NET_ADMIN in the network namespace
+  being measured. An unprivileged user can therefore measure the
+  ruleset of a network namespace owned by its own user namespace.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_tables_compat.h>
+
+#include <util/util.h>
+#include <util/base64.h>
+#include <measurement_spec/find_types.h>
+#include <common/asp-errno.h>
+#include <asp/asp-api.h>
+#include <graph/graph-core.h>
+#include <address_space/iptables_address_space.h>
+#include <address_space/iptables_chain_address_space.h>
+#include <target/iptables_target_type.h>
+#include <target/iptables_chain_target_type.h>
+#include <measurement/iptables_measurement_type.h>
+#include <measurement/iptables_chain_measurement_type.h>
+
+#define NFT_RECV_BUFFER_SIZE	(1 << 20)
+#define NFT_REQUEST_BUFFER_SIZE	(1 << 12)
+#define NFT_DUMP_RETRIES	8
+#define NFT_TRACKED_REGS		(NFT_REG32_15 + 1)
+#define IPTABLES_CHAINS_LABEL	"iptables.chains"
+#define BOOT_ID_PATH		"/proc/sys/kernel/random/boot_id"
+
+#ifndef SO_NETNS_COOKIE
+#define SO_NETNS_COOKIE		71
+#endif
+
+/**
+ * A netlink socket bound to the nf_tables subsystem, with the receive
+ * buffer reused for every reply.
+ */
+struct nft_sock {
+    int fd;
+    uint32_t seq;
+    unsigned char *buf;
+};
+
+/**
+ * Accumulates one chain of the measured table. Rules are prepended
+ * as they arrive and reversed once the dump completes.
+ */
+struct nft_chain {
+    char *name;
+    GList *rules;
+};
+
+/**
+ * State of a single ruleset dump.
+ */
+struct nft_dump {
+    uint8_t family;
+    const char *table;
+    uint32_t genid;
+    int interrupted;
+    GList *chains;		//!< struct nft_chain, in dump order
+    GHashTable *by_name;	//!< chain name -> struct nft_chain
+};
+
+/**
+ * What a register was last loaded with, used to recognize the
+ * protocol, source and destination matches of a rule.
+ */
+struct nft_reg {
+    enum {REG_NONE = 0, REG_PAYLOAD, REG_META} kind;
+    uint32_t base;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t key;
+    int masked;
+    unsigned char mask[16];
+};
+
+static const struct {
+    const char *name;
+    uint8_t family;
+} nft_families[] = {
+    {"ip", NFPROTO_IPV4},
+    {"ip6", NFPROTO_IPV6},
+    {"inet", NFPROTO_INET},
+    {"arp", NFPROTO_ARP},
+    {"bridge", NFPROTO_BRIDGE},
+    {"netdev", NFPROTO_NETDEV},
+};
+
+static const struct {
+    uint8_t num;
+    const char *name;
+} ip_protocols[] = {
+    {IPPROTO_ICMP, "icmp"},
+    {IPPROTO_IGMP, "igmp"},
+    {IPPROTO_TCP, "tcp"},
+    {IPPROTO_UDP, "udp"},
+    {IPPROTO_GRE, "gre"},
+    {IPPROTO_ESP, "esp"},
+    {IPPROTO_AH, "ah"},
+    {IPPROTO_ICMPV6, "ipv6-icmp"},
+    {IPPROTO_SCTP, "sctp"},
+    {IPPROTO_UDPLITE, "udplite"},
+};
+
+int asp_init(int argc UNUSED, char *argv[] UNUSED)
+{
+    int ret_val = 0;
+    asp_logdebug("Initializing "ASP_NAME" ASP\n");
+
+    if((ret_val = register_address_space(&iptables_addr_space)) != 0) {
+        asp_logerror("Failed to register iptables address space\n");
+        return ret_val;
+    }
+
+    if((ret_val = register_address_space(&iptables_chain_addr_space)) != 0) {
+        asp_logerror("Failed to register iptables chain address space\n");
+        return ret_val;
+    }
+
+    if((ret_val = register_target_type(&iptables_target_type)) != 0) {
+        asp_logerror("Failed to register iptables target type\n");
+        return ret_val;
+    }
+
+    if((ret_val = register_target_type(&iptables_chain_target_type)) != 0) {
+        asp_logerror("Failed to register iptables chain target type\n");
+        return ret_val;
+    }
+
+    if((ret_val = register_measurement_type(&iptables_measurement_type)) != 0) {
+        asp_logerror("Failed to register iptables measurement type\n");
+        return ret_val;
+    }
+
+    if((ret_val = register_measurement_type(&iptables_chain_measurement_type)) != 0) {
+        asp_logerror("Failed to register iptables chain measurement type\n");
+        return ret_val;
+    }
+
+    asp_logdebug("Done initializing "ASP_NAME" ASP\n");
+    return ASP_APB_SUCCESS;
+}
+
+int asp_exit(int status UNUSED)
+{
+    asp_logdebug("Exiting "ASP_NAME" ASP\n");
+    return ASP_APB_SUCCESS;
+}
+
+/*
+ * Split an iptables address name of the form "[family] table" into
+ * its nf_tables family and table name. Returns 0 on success.
+ */
+static int parse_table_name(const char *name, uint8_t *family, const char **table)
+{
+    const char *sp = strchr(name, ' ');
+    size_t i;
+
+    if(sp == NULL) {
+        *family = NFPROTO_IPV4;
+        *table  = name;
+        return *name == '\0' ? -EINVAL : 0;
+    }
+
+    for(i = 0; i < sizeof(nft_families) / sizeof(nft_families[0]); i++) {
+        if(strlen(nft_families[i].name) == (size_t)(sp - name) &&
+                strncmp(nft_families[i].name, name, (size_t)(sp - name)) == 0) {
+            *family = nft_families[i].family;
+            *table  = sp + 1;
+            return *table[0] == '\0' ? -EINVAL : 0;
+        }
+    }
+    return -EINVAL;
+}
+
+/******************************************************************************/
+/*                           Netlink message helpers                          */
+/******************************************************************************/
+
+static int nft_sock_open(struct nft_sock *s)
+{
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+    int bufsz = NFT_RECV_BUFFER_SIZE;
+
+    s->seq = (uint32_t)time(NULL);
+    s->buf = malloc(NFT_RECV_BUFFER_SIZE);
+    if(s->buf == NULL) {
+        return -ENOMEM;
+    }
+
+    s->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if(s->fd < 0) {
+        int err = -errno;
+        free(s->buf);
+        return err;
+    }
+
+    /*
+     * Large dumps arrive faster than we parse them; ask for a receive
+     * buffer big enough that the kernel does not have to throttle.
+     */
+    if(setsockopt(s->fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufsz, sizeof(bufsz)) != 0) {
+        setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+    }
+
+    if(bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int err = -errno;
+        close(s->fd);
+        free(s->buf);
+        return err;
+    }
+    return 0;
+}
+
+static void nft_sock_close(struct nft_sock *s)
+{
+    close(s->fd);
+    free(s->buf);
+}
+
+/*
+ * Append a nf_tables request header to the buffer @buf at offset
+ * *@off. Returns the new message or NULL if the buffer is full.
+ */
+static struct nlmsghdr *nft_put_msg(unsigned char *buf, size_t *off,
+                                    uint16_t type, uint16_t flags,
+                                    uint8_t family, uint32_t seq)
+{
+    size_t len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfg;
+
+    if(*off + NLMSG_ALIGN(len) > NFT_REQUEST_BUFFER_SIZE) {
+        return NULL;
+    }
+    nlh = (struct nlmsghdr *)(buf + *off);
+    memset(nlh, 0, NLMSG_ALIGN(len));
+    nlh->nlmsg_len   = (uint32_t)len;
+    nlh->nlmsg_type  = (uint16_t)((NFNL_SUBSYS_NFTABLES << 8) | type);
+    nlh->nlmsg_flags = (uint16_t)(NLM_F_REQUEST | flags);
+    nlh->nlmsg_seq   = seq;
+
+    nfg = NLMSG_DATA(nlh);
+    nfg->nfgen_family = family;
+    nfg->version      = NFNETLINK_V0;
+    nfg->res_id       = 0;
+
+    *off += NLMSG_ALIGN(len);
+    return nlh;
+}
+
+static int nft_put_strz(unsigned char *buf, size_t *off, struct nlmsghdr *nlh,
+                        uint16_t type, const char *str)
+{
+    size_t payload = strlen(str) + 1;
+    size_t len = NLA_HDRLEN + payload;
+    struct nlattr *nla;
+
+    if(*off + NLA_ALIGN(len) > NFT_REQUEST_BUFFER_SIZE || payload > UINT16_MAX - NLA_HDRLEN) {
+        return -ENOSPC;
+    }
+    nla = (struct nlattr *)(buf + *off);
+    memset(nla, 0, NLA_ALIGN(len));
+    nla->nla_len  = (uint16_t)len;
+    nla->nla_type = type;
+    memcpy((unsigned char *)nla + NLA_HDRLEN, str, payload);
+
+    *off += NLA_ALIGN(len);
+    nlh->nlmsg_len = (uint32_t)((buf + *off) - (unsigned char *)nlh);
+    return 0;
+}
+
+static int nft_send(struct nft_sock *s, const unsigned char *buf, size_t len)
+{
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    ssize_t rc;
+
+    do {
+        rc = sendto(s->fd, buf, len, 0, (struct sockaddr *)&kernel, sizeof(kernel));
+    } while(rc < 0 && errno == EINTR);
+
+    if(rc < 0) {
+        return -errno;
+    }
+    return (size_t)rc == len ? 0 : -EIO;
+}
+
+/*
+ * Index the attributes in [@head, @head + @len) by type into @tb,
+ * which must have room for @max + 1 entries.
+ */
+static void nft_parse_attrs(struct nlattr **tb, int max, const void *head, size_t len)
+{
+    const struct nlattr *nla = head;
+
+    memset(tb, 0, sizeof(*tb) * (size_t)(max + 1));
+    while(len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        int type = nla->nla_type & NLA_TYPE_MASK;
+        if(type <= max) {
+            tb[type] = (struct nlattr *)nla;
+        }
+        if(NLA_ALIGN(nla->nla_len) >= len) {
+            break;
+        }
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (const struct nlattr *)((const unsigned char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+}
+
+static inline void *nla_data(const struct nlattr *nla)
+{
+    return (unsigned char *)nla + NLA_HDRLEN;
+}
+
+static inline size_t nla_payload(const struct nlattr *nla)
+{
+    return (size_t)nla->nla_len - NLA_HDRLEN;
+}
+
+static inline void nft_parse_nested(struct nlattr **tb, int max, const struct nlattr *nla)
+{
+    nft_parse_attrs(tb, max, nla_data(nla), nla_payload(nla));
+}
+
+static uint32_t nla_get_be32(const struct nlattr *nla)
+{
+    uint32_t v = 0;
+    if(nla != NULL && nla_payload(nla) >= sizeof(v)) {
+        memcpy(&v, nla_data(nla), sizeof(v));
+    }
+    return ntohl(v);
+}
+
+/*
+ * Copy a NUL-terminated string attribute. Returns NULL if the
+ * attribute is missing or malformed.
+ */
+static char *nla_strdup(const struct nlattr *nla)
+{
+    if(nla == NULL || nla_payload(nla) == 0) {
+        return NULL;
+    }
+    return strndup(nla_data(nla), nla_payload(nla));
+}
+
+static int nla_streq(const struct nlattr *nla, const char *str)
+{
+    size_t len = strlen(str);
+    return nla != NULL && nla_payload(nla) >= len + 1 &&
+           memcmp(nla_data(nla), str, len + 1) == 0;
+}
+
+/*
+ * Read replies for the requests numbered @first_seq through @last_seq
+ * until @last_seq has been answered, either by the end of its dump
+ * (NLMSG_DONE) or by a non-multipart reply. Each data message is
+ * passed to @cb. Leftovers from an abandoned earlier dump are
+ * discarded.
+ */
+static int nft_recv(struct nft_sock *s, uint32_t first_seq, uint32_t last_seq,
+                    int last_is_dump,
+                    int (*cb)(const struct nlmsghdr *, struct nft_dump *),
+                    struct nft_dump *dump)
+{
+    int rc;
+
+    while(1) {
+        ssize_t n;
+        struct nlmsghdr *nlh;
+
+        do {
+            n = recv(s->fd, s->buf, NFT_RECV_BUFFER_SIZE, 0);
+        } while(n < 0 && errno == EINTR);
+
+        if(n < 0) {
+            return errno == ENOBUFS ? -EAGAIN : -errno;
+        }
+        if(n == 0) {
+            return -EIO;
+        }
+
+        for(nlh = (struct nlmsghdr *)s->buf; NLMSG_OK(nlh, (size_t)n);
+                nlh = NLMSG_NEXT(nlh, n)) {
+            if(nlh->nlmsg_seq < first_seq || nlh->nlmsg_seq > last_seq) {
+                continue;
+            }
+            if(nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
+                dump->interrupted = 1;
+            }
+
+            if(nlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(nlh);
+                if(nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                    return -EIO;
+                }
+                if(err->error != 0) {
+                    return err->error;
+                }
+                if(nlh->nlmsg_seq == last_seq) {
+                    return 0;
+                }
+                continue;
+            }
+
+            if(nlh->nlmsg_type == NLMSG_DONE) {
+                if(nlh->nlmsg_seq == last_seq) {
+                    return 0;
+                }
+                continue;
+            }
+
+            if((rc = cb(nlh, dump)) != 0) {
+                return rc;
+            }
+
+            if(!last_is_dump && nlh->nlmsg_seq == last_seq) {
+                return 0;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+/*                           Ruleset dump handling                            */
+/******************************************************************************/
+
+static void free_nft_chain(void *p)
+{
+    struct nft_chain *c = p;
+    if(c != NULL) {
+        g_list_free_full(c->rules, free_iptables_rule);
+        free(c->name);
+        free(c);
+    }
+}
+
+static void nft_dump_init(struct nft_dump *dump, uint8_t family, const char *table)
+{
+    dump->family      = family;
+    dump->table       = table;
+    dump->genid       = 0;
+    dump->interrupted = 0;
+    dump->chains      = NULL;
+    dump->by_name     = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void nft_dump_clear(struct nft_dump *dump)
+{
+    if(dump->by_name != NULL) {
+        g_hash_table_destroy(dump->by_name);
+        dump->by_name = NULL;
+    }
+    g_list_free_full(dump->chains, free_nft_chain);
+    dump->chains = NULL;
+}
+
+static struct nft_chain *nft_dump_add_chain(struct nft_dump *dump, const char *name)
+{
+    struct nft_chain *c = g_hash_table_lookup(dump->by_name, name);
+    if(c != NULL) {
+        return c;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if(c == NULL) {
+        return NULL;
+    }
+    c->name = strdup(name);
+    if(c->name == NULL) {
+        free(c);
+        return NULL;
+    }
+    dump->chains = g_list_prepend(dump->chains, c);
+    g_hash_table_insert(dump->by_name, c->name, c);
+    return c;
+}
+
+/*
+ * Returns non-zero if the message belongs to the table being measured.
+ */
+static int nft_msg_in_table(const struct nlmsghdr *nlh, const struct nlattr *table_attr,
+                            const struct nft_dump *dump)
+{
+    const struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    return nfg->nfgen_family == dump->family && nla_streq(table_attr, dump->table);
+}
+
+static const char *nft_protocol_name(uint8_t proto, char *buf, size_t sz)
+{
+    size_t i;
+    for(i = 0; i < sizeof(ip_protocols) / sizeof(ip_protocols[0]); i++) {
+        if(ip_protocols[i].num == proto) {
+            return ip_protocols[i].name;
+        }
+    }
+    snprintf(buf, sz, "%u", proto);
+    return buf;
+}
+
+static unsigned int mask_prefix_len(const unsigned char *mask, size_t len)
+{
+    unsigned int bits = 0;
+    size_t i;
+    for(i = 0; i < len; i++) {
+        unsigned char b = mask[i];
+        while(b & 0x80) {
+            bits++;
+            b = (unsigned char)(b << 1);
+        }
+        if(mask[i] != 0xff) {
+            break;
+        }
+    }
+    return bits;
+}
+
+/*
+ * Format an address match as "[!]addr/prefix".
+ */
+static char *nft_format_addr(const struct nft_reg *r, const unsigned char *val,
+                             size_t len, int negate)
+{
+    char addrstr[INET6_ADDRSTRLEN];
+    unsigned int prefix;
+    int af = len == 4 ? AF_INET : AF_INET6;
+
+    if((len != 4 && len != 16) || inet_ntop(af, val, addrstr, sizeof(addrstr)) == NULL) {
+        return NULL;
+    }
+    prefix = r->masked ? mask_prefix_len(r->mask, len) : (unsigned int)(len * 8);
+    return g_strdup_printf("%s%s/%u", negate ? "!" : "", addrstr, prefix);
+}
+
+static void nft_replace_field(char **field, char *value)
+{
+    if(value != NULL) {
+        free(*field);
+        *field = value;
+    }
+}
+
+/*
+ * Work out which layer 3 protocol a network header match of an inet
+ * table is for. nft precedes such matches with a "meta nfproto"
+ * compare, recorded in @l3; without one the offset and length of the
+ * match decide, since the ip and ip6 header fields that are recognized
+ * do not overlap.
+ */
+static uint8_t nft_network_family(uint8_t l3, const struct nft_reg *r, size_t len)
+{
+    if(l3 != NFPROTO_INET) {
+        return l3;
+    }
+    if((r->offset == 9 && len == 1) ||
+            ((r->offset == 12 || r->offset == 16) && len == 4)) {
+        return NFPROTO_IPV4;
+    }
+    if((r->offset == 6 && len == 1) ||
+            ((r->offset == 8 || r->offset == 24) && len == 16)) {
+        return NFPROTO_IPV6;
+    }
+    return NFPROTO_INET;
+}
+
+/*
+ * Interpret a comparison of register @r against @val. Recognizes the
+ * layer 4 protocol, source address and destination address matches
+ * that iptables-nft and nft generate for the ip, ip6 and inet
+ * families. For an inet table, *@l3 tracks the protocol selected by a
+ * preceding "meta nfproto" match.
+ */
+static void nft_rule_apply_cmp(iptables_rule *rule, uint8_t *l3,
+                               const struct nft_reg *r, const unsigned char *val,
+                               size_t len, uint32_t op)
+{
+    int negate = op == NFT_CMP_NEQ;
+    uint8_t family;
+    char num[4];
+
+    if(op != NFT_CMP_EQ && op != NFT_CMP_NEQ) {
+        return;
+    }
+
+    if(r->kind == REG_META && r->key == NFT_META_L4PROTO && len == 1) {
+        nft_replace_field(&rule->protocol,
+                          g_strdup_printf("%s%s", negate ? "!" : "",
+                                          nft_protocol_name(val[0], num, sizeof(num))));
+        return;
+    }
+
+    if(r->kind == REG_META && r->key == NFT_META_NFPROTO && len == 1) {
+        if(*l3 == NFPROTO_INET && !negate &&
+                (val[0] == NFPROTO_IPV4 || val[0] == NFPROTO_IPV6)) {
+            *l3 = val[0];
+        }
+        return;
+    }
+
+    if(r->kind != REG_PAYLOAD || r->base != NFT_PAYLOAD_NETWORK_HEADER) {
+        return;
+    }
+
+    family = nft_network_family(*l3, r, len);
+    if(family != NFPROTO_INET) {
+        *l3 = family;
+    }
+    if(family == NFPROTO_IPV4) {
+        if(r->offset == 9 && len == 1) {
+            nft_replace_field(&rule->protocol,
+                              g_strdup_printf("%s%s", negate ? "!" : "",
+                                              nft_protocol_name(val[0], num, sizeof(num))));
+        } else if(r->offset == 12 && len == 4) {
+            nft_replace_field(&rule->src, nft_format_addr(r, val, len, negate));
+        } else if(r->offset == 16 && len == 4) {
+            nft_replace_field(&rule->dst, nft_format_addr(r, val, len, negate));
+        }
+    } else if(family == NFPROTO_IPV6) {
+        if(r->offset == 6 && len == 1) {
+            nft_replace_field(&rule->protocol,
+                              g_strdup_printf("%s%s", negate ? "!" : "",
+                                              nft_protocol_name(val[0], num, sizeof(num))));
+        } else if(r->offset == 8 && len == 16) {
+            nft_replace_field(&rule->src, nft_format_addr(r, val, len, negate));
+        } else if(r->offset == 24 && len == 16) {
+            nft_replace_field(&rule->dst, nft_format_addr(r, val, len, negate));
+        }
+    }
+}
+
+static void nft_rule_apply_verdict(iptables_rule *rule, const struct nlattr *data)
+{
+    struct nlattr *dtb[NFTA_DATA_MAX + 1];
+    struct nlattr *vtb[NFTA_VERDICT_MAX + 1];
+    char *chain = NULL;
+    char *target = NULL;
+
+    nft_parse_nested(dtb, NFTA_DATA_MAX, data);
+    if(dtb[NFTA_DATA_VERDICT] == NULL) {
+        return;
+    }
+    nft_parse_nested(vtb, NFTA_VERDICT_MAX, dtb[NFTA_DATA_VERDICT]);
+    chain = nla_strdup(vtb[NFTA_VERDICT_CHAIN]);
+
+    switch((int32_t)nla_get_be32(vtb[NFTA_VERDICT_CODE])) {
+    case NF_ACCEPT:
+        target = strdup("ACCEPT");
+        break;
+    case NF_DROP:
+        target = strdup("DROP");
+        break;
+    case NF_QUEUE:
+        target = strdup("QUEUE");
+        break;
+    case NFT_RETURN:
+        target = strdup("RETURN");
+        break;
+    case NFT_JUMP:
+        target = chain ? strdup(chain) : NULL;
+        break;
+    case NFT_GOTO:
+        target = chain ? g_strdup_printf("goto %s", chain) : NULL;
+        break;
+    default:
+        break;
+    }
+    free(chain);
+    nft_replace_field(&rule->target, target);
+}
+
+static void nft_rule_apply_expr(iptables_rule *rule, uint8_t *l3,
+                                struct nft_reg *regs, const struct nlattr *expr)
+{
+    struct nlattr *etb[NFTA_EXPR_MAX + 1];
+    const struct nlattr *data;
+
+    nft_parse_nested(etb, NFTA_EXPR_MAX, expr);
+    if(etb[NFTA_EXPR_NAME] == NULL || (data = etb[NFTA_EXPR_DATA]) == NULL) {
+        return;
+    }
+
+    if(nla_streq(etb[NFTA_EXPR_NAME], "payload")) {
+        struct nlattr *tb[NFTA_PAYLOAD_MAX + 1];
+        uint32_t dreg;
+
+        nft_parse_nested(tb, NFTA_PAYLOAD_MAX, data);
+        dreg = nla_get_be32(tb[NFTA_PAYLOAD_DREG]);
+        if(tb[NFTA_PAYLOAD_DREG] != NULL && dreg < NFT_TRACKED_REGS) {
+            memset(&regs[dreg], 0, sizeof(regs[dreg]));
+            regs[dreg].kind   = REG_PAYLOAD;
+            regs[dreg].base   = nla_get_be32(tb[NFTA_PAYLOAD_BASE]);
+            regs[dreg].offset = nla_get_be32(tb[NFTA_PAYLOAD_OFFSET]);
+            regs[dreg].len    = nla_get_be32(tb[NFTA_PAYLOAD_LEN]);
+        }
+    } else if(nla_streq(etb[NFTA_EXPR_NAME], "meta")) {
+        struct nlattr *tb[NFTA_META_MAX + 1];
+        uint32_t dreg;
+
+        nft_parse_nested(tb, NFTA_META_MAX, data);
+        dreg = nla_get_be32(tb[NFTA_META_DREG]);
+        if(tb[NFTA_META_DREG] != NULL && dreg < NFT_TRACKED_REGS) {
+            memset(&regs[dreg], 0, sizeof(regs[dreg]));
+            regs[dreg].kind = REG_META;
+            regs[dreg].key  = nla_get_be32(tb[NFTA_META_KEY]);
+        }
+    } else if(nla_streq(etb[NFTA_EXPR_NAME], "bitwise")) {
+        struct nlattr *tb[NFTA_BITWISE_MAX + 1];
+        struct nlattr *mtb[NFTA_DATA_MAX + 1];
+        uint32_t sreg, dreg;
+
+        nft_parse_nested(tb, NFTA_BITWISE_MAX, data);
+        sreg = nla_get_be32(tb[NFTA_BITWISE_SREG]);
+        dreg = nla_get_be32(tb[NFTA_BITWISE_DREG]);
+        if(sreg >= NFT_TRACKED_REGS || dreg >= NFT_TRACKED_REGS || tb[NFTA_BITWISE_MASK] == NULL) {
+            return;
+        }
+        regs[dreg] = regs[sreg];
+        nft_parse_nested(mtb, NFTA_DATA_MAX, tb[NFTA_BITWISE_MASK]);
+        if(mtb[NFTA_DATA_VALUE] != NULL &&
+                nla_payload(mtb[NFTA_DATA_VALUE]) <= sizeof(regs[dreg].mask)) {
+            regs[dreg].masked = 1;
+            memcpy(regs[dreg].mask, nla_data(mtb[NFTA_DATA_VALUE]),
+                   nla_payload(mtb[NFTA_DATA_VALUE]));
+        }
+    } else if(nla_streq(etb[NFTA_EXPR_NAME], "cmp")) {
+        struct nlattr *tb[NFTA_CMP_MAX + 1];
+        struct nlattr *dtb[NFTA_DATA_MAX + 1];
+        uint32_t sreg;
+
+        nft_parse_nested(tb, NFTA_CMP_MAX, data);
+        sreg = nla_get_be32(tb[NFTA_CMP_SREG]);
+        if(sreg >= NFT_TRACKED_REGS || tb[NFTA_CMP_DATA] == NULL) {
+            return;
+        }
+        nft_parse_nested(dtb, NFTA_DATA_MAX, tb[NFTA_CMP_DATA]);
+        if(dtb[NFTA_DATA_VALUE] != NULL) {
+            nft_rule_apply_cmp(rule, l3, &regs[sreg], nla_data(dtb[NFTA_DATA_VALUE]),
+                               nla_payload(dtb[NFTA_DATA_VALUE]),
+                               nla_get_be32(tb[NFTA_CMP_OP]));
+        }
+    } else if(nla_streq(etb[NFTA_EXPR_NAME], "immediate")) {
+        struct nlattr *tb[NFTA_IMMEDIATE_MAX + 1];
+
+        nft_parse_nested(tb, NFTA_IMMEDIATE_MAX, data);
+        if(tb[NFTA_IMMEDIATE_DATA] != NULL &&
+                nla_get_be32(tb[NFTA_IMMEDIATE_DREG]) == NFT_REG_VERDICT) {
+            nft_rule_apply_verdict(rule, tb[NFTA_IMMEDIATE_DATA]);
+        }
+    } else if(nla_streq(etb[NFTA_EXPR_NAME], "target")) {
+        /* xtables target used by iptables-nft, e.g. REJECT or MASQUERADE */
+        struct nlattr *tb[NFTA_TARGET_MAX + 1];
+
+        nft_parse_nested(tb, NFTA_TARGET_MAX, data);
+        nft_replace_field(&rule->target, nla_strdup(tb[NFTA_TARGET_NAME]));
+    }
+}
+
+static iptables_rule *nft_parse_rule(const struct nlattr *exprs, uint8_t family)
+{
+    struct nft_reg regs[NFT_TRACKED_REGS];
+    const struct nlattr *nla;
+    size_t len;
+    const char *any = family == NFPROTO_IPV6 ? "::/0" : "0.0.0.0/0";
+    uint8_t l3 = family;
+    iptables_rule *rule = allocate_iptables_rule();
+
+    if(rule == NULL) {
+        return NULL;
+    }
+    rule->protocol = strdup("all");
+    rule->src      = strdup(any);
+    rule->dst      = strdup(any);
+    rule->target   = strdup("");
+    if(!rule->protocol || !rule->src || !rule->dst || !rule->target) {
+        free_iptables_rule(rule);
+        return NULL;
+    }
+
+    if(exprs == NULL) {
+        return rule;
+    }
+
+    memset(regs, 0, sizeof(regs));
+    nla = nla_data(exprs);
+    len = nla_payload(exprs);
+    while(len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        if((nla->nla_type & NLA_TYPE_MASK) == NFTA_LIST_ELEM) {
+            nft_rule_apply_expr(rule, &l3, regs, nla);
+        }
+        if(NLA_ALIGN(nla->nla_len) >= len) {
+            break;
+        }
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (const struct nlattr *)((const unsigned char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+
+    /* an inet rule that only matches ip6 traffic reports ip6 wildcards */
+    if(family == NFPROTO_INET && l3 == NFPROTO_IPV6) {
+        if(strcmp(rule->src, any) == 0) {
+            nft_replace_field(&rule->src, strdup("::/0"));
+        }
+        if(strcmp(rule->dst, any) == 0) {
+            nft_replace_field(&rule->dst, strdup("::/0"));
+        }
+    }
+    return rule;
+}
+
+static int nft_handle_msg(const struct nlmsghdr *nlh, struct nft_dump *dump)
+{
+    size_t hdrlen = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    const unsigned char *attrs = (const unsigned char *)nlh + NLMSG_ALIGN(hdrlen);
+    size_t attrlen;
+    uint16_t type;
+
+    if(NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_NFTABLES || nlh->nlmsg_len < hdrlen) {
+        return 0;
+    }
+    attrlen = nlh->nlmsg_len - NLMSG_ALIGN(hdrlen);
+    type    = NFNL_MSG_TYPE(nlh->nlmsg_type);
+
+    if(type == NFT_MSG_NEWGEN) {
+        struct nlattr *tb[NFTA_GEN_MAX + 1];
+        nft_parse_attrs(tb, NFTA_GEN_MAX, attrs, attrlen);
+        if(tb[NFTA_GEN_ID] == NULL) {
+            return -EIO;
+        }
+        dump->genid = nla_get_be32(tb[NFTA_GEN_ID]);
+    } else if(type == NFT_MSG_NEWCHAIN) {
+        struct nlattr *tb[NFTA_CHAIN_MAX + 1];
+        char *name;
+
+        nft_parse_attrs(tb, NFTA_CHAIN_MAX, attrs, attrlen);
+        if(!nft_msg_in_table(nlh, tb[NFTA_CHAIN_TABLE], dump)) {
+            return 0;
+        }
+        if((name = nla_strdup(tb[NFTA_CHAIN_NAME])) == NULL) {
+            return -EIO;
+        }
+        if(nft_dump_add_chain(dump, name) == NULL) {
+            free(name);
+            return -ENOMEM;
+        }
+        free(name);
+    } else if(type == NFT_MSG_NEWRULE) {
+        struct nlattr *tb[NFTA_RULE_MAX + 1];
+        struct nft_chain *c;
+        iptables_rule *rule;
+        char *name;
+
+        nft_parse_attrs(tb, NFTA_RULE_MAX, attrs, attrlen);
+        if(!nft_msg_in_table(nlh, tb[NFTA_RULE_TABLE], dump)) {
+            return 0;
+        }
+        if((name = nla_strdup(tb[NFTA_RULE_CHAIN])) == NULL) {
+            return -EIO;
+        }
+        c = nft_dump_add_chain(dump, name);
+        free(name);
+        if(c == NULL) {
+            return -ENOMEM;
+        }
+        if((rule = nft_parse_rule(tb[NFTA_RULE_EXPRESSIONS], dump->family)) == NULL) {
+            return -ENOMEM;
+        }
+        c->rules = g_list_prepend(c->rules, rule);
+    }
+    return 0;
+}
+
+/*
+ * Request the current ruleset generation ID.
+ */
+static int nft_get_genid(struct nft_sock *s, struct nft_dump *dump)
+{
+    unsigned char req[NFT_REQUEST_BUFFER_SIZE];
+    size_t off = 0;
+    uint32_t seq = ++s->seq;
+    int rc;
+
+    if(nft_put_msg(req, &off, NFT_MSG_GETGEN, 0, AF_UNSPEC, seq) == NULL) {
+        return -ENOSPC;
+    }
+    if((rc = nft_send(s, req, off)) != 0) {
+        return rc;
+    }
+    return nft_recv(s, seq, seq, 0, nft_handle_msg, dump);
+}
+
+/*
+ * Dump all objects of type @msg_type belonging to the measured
+ * table. If @with_genid is set, a generation ID request is batched
+ * ahead of the dump in the same send.
+ */
+static int nft_dump_objects(struct nft_sock *s, struct nft_dump *dump,
+                            uint16_t msg_type, uint16_t table_attr, int with_genid)
+{
+    unsigned char req[NFT_REQUEST_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    size_t off = 0;
+    uint32_t first_seq = s->seq + 1;
+    uint32_t seq;
+    int rc;
+
+    if(with_genid &&
+            nft_put_msg(req, &off, NFT_MSG_GETGEN, 0, AF_UNSPEC, ++s->seq) == NULL) {
+        return -ENOSPC;
+    }
+    seq = ++s->seq;
+    nlh = nft_put_msg(req, &off, msg_type, NLM_F_DUMP, dump->family, seq);
+    if(nlh == NULL || nft_put_strz(req, &off, nlh, table_attr, dump->table) != 0) {
+        return -ENOSPC;
+    }
+    if((rc = nft_send(s, req, off)) != 0) {
+        return rc;
+    }
+    return nft_recv(s, first_seq, seq, 1, nft_handle_msg, dump);
+}
+
+/*
+ * Dump the chains and rules of the measured table, retrying until a
+ * consistent snapshot is obtained.
+ */
+static int nft_dump_table(struct nft_sock *s, struct nft_dump *dump)
+{
+    int attempt;
+    int rc = -EAGAIN;
+
+    for(attempt = 0; attempt < NFT_DUMP_RETRIES; attempt++) {
+        uint32_t genid;
+        GList *iter;
+
+        nft_dump_clear(dump);
+        dump->by_name     = g_hash_table_new(g_str_hash, g_str_equal);
+        dump->interrupted = 0;
+
+        if((rc = nft_dump_objects(s, dump, NFT_MSG_GETCHAIN, NFTA_CHAIN_TABLE, 1)) != 0 &&
+                rc != -EAGAIN) {
+            return rc;
+        }
+        genid = dump->genid;
+        if(rc == 0 &&
+                (rc = nft_dump_objects(s, dump, NFT_MSG_GETRULE, NFTA_RULE_TABLE, 0)) != 0 &&
+                rc != -EAGAIN) {
+            return rc;
+        }
+        if(rc == 0 && (rc = nft_get_genid(s, dump)) != 0) {
+            return rc;
+        }
+
+        if(rc == 0 && !dump->interrupted && genid == dump->genid) {
+            dump->chains = g_list_reverse(dump->chains);
+            for(iter = dump->chains; iter != NULL; iter = g_list_next(iter)) {
+                struct nft_chain *c = iter->data;
+                c->rules = g_list_reverse(c->rules);
+            }
+            return 0;
+        }
+        asp_logdebug("Ruleset changed during dump (generation %u -> %u), retrying\n",
+                     genid, dump->genid);
+        rc = -EAGAIN;
+    }
+    return rc;
+}
+
+/******************************************************************************/
+/*                          Generation-keyed caching                          */
+/******************************************************************************/
+
+/*
+ * The cookie of the network namespace the socket belongs to. Unlike
+ * the namespace's inode number, it is never reused by another
+ * namespace until reboot. Needs Linux 5.14 or later.
+ */
+static int nft_netns_cookie(struct nft_sock *s, uint64_t *cookie)
+{
+    socklen_t len = sizeof(*cookie);
+
+    if(getsockopt(s->fd, SOL_SOCKET, SO_NETNS_COOKIE, cookie, &len) != 0) {
+        return -errno;
+    }
+    return len == sizeof(*cookie) ? 0 : -EINVAL;
+}
+
+/*
+ * The cache file for a table is named after the boot, the network
+ * namespace cookie and the table so that generation IDs, which are
+ * only meaningful within a single namespace instance, are never
+ * compared across namespaces or reboots.
+ */
+static char *cache_file_path(const char *cache_dir, const char *addr_name, uint64_t netns_cookie)
+{
+    char *boot_id = file_one_line_to_str(BOOT_ID_PATH);
+    char *hex_name = bin_to_hexstr((const unsigned char *)addr_name, strlen(addr_name));
+    char *path = NULL;
+
+    if(boot_id != NULL && hex_name != NULL) {
+        g_strstrip(boot_id);
+        path = g_strdup_printf("%s/iptables-%s-%"PRIx64"-%s.cache", cache_dir, boot_id,
+                               netns_cookie, hex_name);
+    }
+    free(boot_id);
+    free(hex_name);
+    return path;
+}
+
+/*
+ * Load the chain measurements saved for generation @genid. Returns 0
+ * and fills dump->chains with (struct nft_chain *) entries whose
+ * rules are taken from the cached data, or < 0 if the cache is
+ * missing, stale or unreadable.
+ */
+static int cache_load(const char *path, uint32_t genid, struct nft_dump *dump)
+{
+    char *contents = file_to_string(path);
+    char *line, *saveptr = NULL;
+    unsigned long cached_genid;
+    char *end;
+    int rc = 0;
+
+    if(contents == NULL) {
+        return -ENOENT;
+    }
+
+    line = strtok_r(contents, "\n", &saveptr);
+    if(line == NULL || (errno = 0, cached_genid = strtoul(line, &end, 10), errno != 0) ||
+            *end != '\0' || cached_genid != genid) {
+        free(contents);
+        return -ESTALE;
+    }
+
+    while((line = strtok_r(NULL, "\n", &saveptr)) != NULL) {
+        char *sep = strchr(line, ' ');
+        unsigned char *name;
+        size_t namelen;
+        measurement_data *d = NULL;
+        struct nft_chain *c;
+        char *name_str;
+
+        if(sep == NULL) {
+            rc = -EINVAL;
+            break;
+        }
+        *sep = '\0';
+        if((name = b64_decode(line, &namelen)) == NULL) {
+            rc = -EINVAL;
+            break;
+        }
+        name_str = strndup((char *)name, namelen);
+        b64_free(name);
+        if(name_str == NULL) {
+            rc = -ENOMEM;
+            break;
+        }
+        if(iptables_chain_measurement_type.unserialize_data(sep + 1, strlen(sep + 1) + 1, &d) < 0 ||
+                d == NULL) {
+            free(name_str);
+            rc = -EINVAL;
+            break;
+        }
+        c = nft_dump_add_chain(dump, name_str);
+        free(name_str);
+        if(c == NULL) {
+            free_measurement_data(d);
+            rc = -ENOMEM;
+            break;
+        }
+        iptables_chain_data *cd = container_of(d, iptables_chain_data, meas_data);
+        c->rules  = cd->rules;
+        cd->rules = NULL;
+        free_measurement_data(d);
+    }
+
+    free(contents);
+    if(rc == 0) {
+        dump->chains = g_list_reverse(dump->chains);
+    }
+    return rc;
+}
+
+static void cache_store(const char *path, const struct nft_dump *dump)
+{
+    GString *out = g_string_new(NULL);
+    char *tmp_path = g_strdup_printf("%s.tmp", path);
+    GList *iter;
+
+    g_string_append_printf(out, "%u\n", dump->genid);
+    for(iter = dump->chains; iter != NULL; iter = g_list_next(iter)) {
+        struct nft_chain *c = iter->data;
+        iptables_chain_data cd = {.meas_data = {.type = &iptables_chain_measurement_type},
+                                  .rules = c->rules
+                                 };
+        char *name = b64_encode((unsigned char *)c->name, strlen(c->name));
+        char *serial = NULL;
+        size_t serial_sz = 0;
+
+        if(name == NULL ||
+                iptables_chain_measurement_type.serialize_data(&cd.meas_data, &serial,
+                        &serial_sz) != 0) {
+            asp_logwarn("Failed to serialize chain %s for the cache\n", c->name);
+            free(name);
+            goto out;
+        }
+        g_string_append_printf(out, "%s %s\n", name, serial);
+        free(name);
+        free(serial);
+    }
+
+    /* write and rename so that a concurrent reader never sees a partial cache */
+    if(buffer_to_file_perm(tmp_path, (unsigned char *)out->str, out->len, 0600) < 0 ||
+            rename(tmp_path, path) != 0) {
+        asp_logwarn("Failed to write ruleset cache %s\n", path);
+        unlink(tmp_path);
+    }
+
+out:
+    g_free(tmp_path);
+    g_string_free(out, TRUE);
+}
+
+/******************************************************************************/
+/*                             Graph population                               */
+/******************************************************************************/
+
+static int add_chain_node(measurement_graph *graph, node_id_t table_node,
+                          address *table_addr, struct nft_chain *c)
+{
+    iptables_chain_addr *caddr;
+    iptables_chain_data *cdata;
+    measurement_variable var = {.type = &iptables_chain_target_type};
+    node_id_t chain_node = INVALID_NODE_ID;
+    edge_id_t edge = INVALID_EDGE_ID;
+    int rc = -ENOMEM;
+
+    caddr = (iptables_chain_addr *)alloc_address(&iptables_chain_addr_space);
+    if(caddr == NULL) {
+        return -ENOMEM;
+    }
+    caddr->table_addr = copy_address(table_addr);
+    caddr->chain      = strdup(c->name);
+    if(caddr->table_addr == NULL || caddr->chain == NULL) {
+        goto out_addr;
+    }
+    var.address = &caddr->addr;
+
+    if(measurement_graph_add_node(graph, &var, NULL, &chain_node) < 0) {
+        asp_logerror("Failed to add node for chain %s\n", c->name);
+        rc = -EIO;
+        goto out_addr;
+    }
+
+    if(measurement_graph_add_edge(graph, table_node, IPTABLES_CHAINS_LABEL,
+                                  chain_node, &edge) < 0) {
+        asp_logerror("Failed to add edge to chain %s\n", c->name);
+        rc = -EIO;
+        goto out_addr;
+    }
+
+    cdata = (iptables_chain_data *)alloc_measurement_data(&iptables_chain_measurement_type);
+    if(cdata == NULL) {
+        goto out_addr;
+    }
+    cdata->rules = c->rules;
+    rc = measurement_node_add_rawdata(graph, chain_node, &cdata->meas_data);
+    cdata->rules = NULL;
+    free_measurement_data(&cdata->meas_data);
+    if(rc != 0) {
+        asp_logerror("Failed to add rule data to chain %s\n", c->name);
+    }
+
+out_addr:
+    free_address(&caddr->addr);
+    return rc;
+}
+
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph = NULL;
+    node_id_t node_id = INVALID_NODE_ID;
+    address *addr = NULL;
+    measurement_data *sigil = NULL;
+    const char *table = NULL;
+    char *cache_path = NULL;
+    uint64_t netns_cookie = 0;
+    uint8_t family;
+    struct nft_sock sock;
+    struct nft_dump dump;
+    int from_cache = 0;
+    GList *iter;
+    int rc;
+
+    if((argc < 3) || (argc > 4) ||
+            ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> [cache dir]\n");
+        return -EINVAL;
+    }
+
+    if((addr = measurement_node_get_address(graph, node_id)) == NULL) {
+        asp_logerror("Failed to get address of node "ID_FMT"\n", node_id);
+        rc = -EINVAL;
+        goto get_address_failed;
+    }
+
+    if(addr->space != &iptables_addr_space ||
+            ((iptables_addr *)addr)->name == NULL ||
+            parse_table_name(((iptables_addr *)addr)->name, &family, &table) != 0) {
+        asp_logerror("Node address must be an iptables address naming \"[family] table\"\n");
+        rc = -EINVAL;
+        goto bad_address;
+    }
+
+    if((rc = nft_sock_open(&sock)) != 0) {
+        asp_logerror("Failed to open nf_tables netlink socket: %s\n", strerror(-rc));
+        goto socket_failed;
+    }
+
+    nft_dump_init(&dump, family, table);
+
+    if(argc == 4) {
+        if((rc = nft_netns_cookie(&sock, &netns_cookie)) != 0) {
+            asp_logwarn("Unable to identify the network namespace (%s), caching disabled\n",
+                        strerror(-rc));
+        } else if((cache_path = cache_file_path(argv[3], ((iptables_addr *)addr)->name,
+                                                netns_cookie)) == NULL) {
+            asp_logwarn("Unable to determine ruleset cache path, caching disabled\n");
+        }
+    }
+
+    if(cache_path != NULL) {
+        if((rc = nft_get_genid(&sock, &dump)) != 0) {
+            asp_logerror("Failed to read ruleset generation: %s\n", strerror(-rc));
+            goto dump_failed;
+        }
+        if(cache_load(cache_path, dump.genid, &dump) == 0) {
+            asp_loginfo("Ruleset generation %u unchanged, reusing cached measurement\n",
+                        dump.genid);
+            from_cache = 1;
+        } else {
+            nft_dump_clear(&dump);
+            dump.by_name = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+    }
+
+    if(!from_cache && (rc = nft_dump_table(&sock, &dump)) != 0) {
+        asp_logerror("Failed to dump table %s: %s\n", ((iptables_addr *)addr)->name,
+                     strerror(-rc));
+        goto dump_failed;
+    }
+
+    for(iter = dump.chains; iter != NULL; iter = g_list_next(iter)) {
+        if((rc = add_chain_node(graph, node_id, addr, iter->data)) != 0) {
+            goto add_failed;
+        }
+    }
+
+    if((sigil = alloc_measurement_data(&iptables_measurement_type)) == NULL) {
+        rc = -ENOMEM;
+        goto add_failed;
+    }
+    if((rc = measurement_node_add_rawdata(graph, node_id, sigil)) != 0) {
+        asp_logerror("Failed to add iptables data to node\n");
+    }
+    free_measurement_data(sigil);
+
+    if(rc == 0 && cache_path != NULL && !from_cache) {
+        cache_store(cache_path, &dump);
+    }
+
+add_failed:
+dump_failed:
+    g_free(cache_path);
+    nft_dump_clear(&dump);
+    nft_sock_close(&sock);
+socket_failed:
+bad_address:
+    free_address(addr);
+get_address_failed:
+    unmap_measurement_graph(graph);
+    return rc;
+}
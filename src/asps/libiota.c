@@ -20,10 +20,18 @@
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <../asps/libiota.h>
 
+// on some ARM architectures, we must write on word boundaries (4 bytes).
+#define ROUNDUP(x) (((x+3)/4)*4)
+
+/*
+ * The variable-length fields share a single allocation, msg->buf, and
+ * dest_cert2 is the same copy as dest_cert.
+ */
 static iota_ret iota_msg_init(iota *iota_inst, iota_msg **msg,
                               void *data, uint32_t data_len,
                               uint8_t type, uint32_t flags,
@@ -32,75 +40,45 @@ static iota_ret iota_msg_init(iota *iota_inst, iota_msg **msg,
                               uint8_t *nonce, uint32_t nonce_len,
                               uint8_t *dest_cert, uint32_t dest_cert_len)
 {
-    iota_ret ret = IOTA_OK;
+    uint32_t cert_len = iota_inst->cert != NULL ? iota_inst->cert_len : 0;
+    size_t buf_len = (size_t)ROUNDUP(data_len) + ROUNDUP(nonce_len) +
+                     ROUNDUP(cert_len) + ROUNDUP(dest_cert_len);
+    uint8_t *q;
 
     if (!((*msg) = iota_malloc(sizeof(iota_msg)))) {
         return IOTA_ERR_MALLOC_FAIL;
     }
 
-    (*msg)->data = NULL;
-    (*msg)->data_len = 0;
-    if (data_len > 0) {
-        if (!((*msg)->data = iota_malloc(data_len))) {
-            iota_free(*msg);
-            return IOTA_ERR_MALLOC_FAIL;
-        }
-    }
-    iota_memcpy((*msg)->data, data, data_len);
-    (*msg)->data_len = data_len;
-
-    (*msg)->nonce = NULL;
-    (*msg)->nonce_len = 0;
-    if (nonce_len > 0) {
-        if (!((*msg)->nonce = iota_malloc(nonce_len))) {
-            iota_free((*msg)->data);
+    (*msg)->buf = NULL;
+    if (buf_len > 0) {
+        if (!((*msg)->buf = iota_malloc(buf_len))) {
             iota_free(*msg);
+            *msg = NULL;
             return IOTA_ERR_MALLOC_FAIL;
         }
-        iota_memcpy((*msg)->nonce, nonce, nonce_len);
-        (*msg)->nonce_len = nonce_len;
     }
-
-    (*msg)->cert = NULL;
-    (*msg)->cert_len = 0;
-    if (iota_inst->cert != NULL) {
-        if (!((*msg)->cert = iota_malloc(iota_inst->cert_len))) {
-            iota_free((*msg)->nonce);
-            iota_free((*msg)->data);
-            iota_free(*msg);
-            return IOTA_ERR_MALLOC_FAIL;
-        }
-        iota_memcpy((*msg)->cert, iota_inst->cert, iota_inst->cert_len);
-        (*msg)->cert_len = iota_inst->cert_len;
+    q = (*msg)->buf;
+
+#define TAKE(field, src, len)                   \
+    (*msg)->field = NULL;                       \
+    (*msg)->field##_len = len;                  \
+    if (len > 0) {                              \
+        iota_memcpy(q, src, len);               \
+        (*msg)->field = q;                      \
+        q += ROUNDUP(len);                      \
     }
 
-    (*msg)->dest_cert  = NULL;
-    (*msg)->dest_cert_len = 0;
-    (*msg)->dest_cert2 = NULL;
-    (*msg)->dest_cert2_len = 0;
-    if (dest_cert_len != 0) {
-        if ((!((*msg)->dest_cert =  iota_malloc(dest_cert_len)))
-                ||
-                (!((*msg)->dest_cert2 = iota_malloc(dest_cert_len)))) {
-            iota_free((*msg)->cert);
-            iota_free((*msg)->nonce);
-            iota_free((*msg)->data);
-            if ((*msg)->dest_cert != NULL)
-                iota_free((*msg)->dest_cert);
-            iota_free(*msg);
-            return IOTA_ERR_MALLOC_FAIL;
-        }
-        iota_memcpy((*msg)->dest_cert,  dest_cert, dest_cert_len);
-        iota_memcpy((*msg)->dest_cert2, dest_cert, dest_cert_len);
-        (*msg)->dest_cert_len = dest_cert_len;
-        (*msg)->dest_cert2_len = dest_cert_len;
-    }
+    TAKE(data, data, data_len);
+    TAKE(nonce, nonce, nonce_len);
+    TAKE(cert, iota_inst->cert, cert_len);
+    TAKE(dest_cert, dest_cert, dest_cert_len);
+#undef TAKE
+    (*msg)->dest_cert2 = (*msg)->dest_cert;
+    (*msg)->dest_cert2_len = (*msg)->dest_cert_len;
 
     (*msg)->hdr.version = IOTA_VERSION;
     (*msg)->hdr.len = 0;
     (*msg)->flags = flags;
-    (*msg)->sig_len = 0;
-    (*msg)->sig = NULL;
     (*msg)->type = type;
     (*msg)->action = action;
     (*msg)->id = id;
@@ -110,7 +88,7 @@ static iota_ret iota_msg_init(iota *iota_inst, iota_msg **msg,
     (*msg)->sig_len = 0;
     (*msg)->sig = NULL;
 
-    return ret;
+    return IOTA_OK;
 }
 
 iota_ret iota_req_init(iota *iota_inst, iota_msg **msg, uint32_t flags,
@@ -124,18 +102,8 @@ iota_ret iota_req_init(iota *iota_inst, iota_msg **msg, uint32_t flags,
 
 void iota_msg_deinit(iota_msg **msg)
 {
-    if ((*msg)->cert != NULL)
-        iota_free((*msg)->cert);
-    if ((*msg)->dest_cert != NULL)
-        iota_free((*msg)->dest_cert);
-    if ((*msg)->nonce != NULL)
-        iota_free((*msg)->nonce);
-    if ((*msg)->dest_cert2 != NULL)
-        iota_free((*msg)->dest_cert2);
-    if ((*msg)->data != NULL)
-        iota_free((*msg)->data);
-    if ((*msg)->sig != NULL)
-        iota_free((*msg)->sig);
+    if ((*msg)->buf != NULL)
+        iota_free((*msg)->buf);
     iota_free(*msg);
     *msg = NULL;
 }
@@ -290,10 +258,12 @@ iota_ret iota_do(iota *iota_inst, const iota_msg *req, iota_msg **resp)
     return ret;
 }
 
-// on some ARM architectures, we must write on word boundaries (4 bytes).
 #define SER4(x) *p = (uint32_t)x; p++;
-#define ROUNDUP(x) (((x+3)/4)*4)
-#define SERN(buf,len) SER4(len); iota_memcpy(p, buf, len); p += ROUNDUP(len)/4;
+// zero the last word first, so the padding after buf goes out as zeros
+#define SERN(buf,len) SER4(len);                                 \
+    if ((len) % 4) { p[(len)/4] = 0; }                           \
+    if ((len) > 0) { iota_memcpy(p, buf, len); }                 \
+    p += ROUNDUP(len)/4;
 
 // we don't use iota_inst in this function, but for consistency of interface, request it anyway.
 #pragma GCC diagnostic push
@@ -302,16 +272,33 @@ iota_ret iota_serialize(iota *iota_inst, iota_msg* msg,
                         uint8_t** outbuf, uint32_t *outbuf_len)
 {
     iota_inst;
-    msg->hdr.len = 14*4 +
-                   ROUNDUP(msg->cert_len) + ROUNDUP(msg->nonce_len) +
-                   ROUNDUP(msg->dest_cert_len) + ROUNDUP(msg->dest_cert2_len) + ROUNDUP(msg->data_len);
-    *outbuf = malloc(msg->hdr.len);
-    if (*outbuf == NULL) return IOTA_ERR_MALLOC_FAIL;
-    memset(*outbuf, 0, msg->hdr.len);
-    uint32_t* p = (uint32_t*)*outbuf;
+    iota_ret ret;
+    uint32_t unencrypted_len = 5*4 + ROUNDUP(msg->dest_cert_len) + ROUNDUP(msg->cert_len);
+    uint32_t encrypted_len = 9*4 + ROUNDUP(msg->nonce_len) +
+                             ROUNDUP(msg->dest_cert2_len) + ROUNDUP(msg->data_len);
+    // room left ahead of the message for the wrapped key
+    uint32_t key_room = 0;
+    size_t buf_len;
+
+    if (msg->flags & IOTA_SIGNED_FLAG) {
+        encrypted_len += IOTA_SIG_MAX_LEN;
+    }
+    buf_len = (size_t)unencrypted_len + encrypted_len;
+    if (msg->flags & IOTA_ENCRYPTED_FLAG) {
+        key_room = IOTA_ENC_HDR_LEN;
+        buf_len += IOTA_ENC_HDR_LEN + IOTA_ENC_PAD_LEN;
+    }
+
+    *outbuf_len = 0;
+    if ((*outbuf = iota_malloc(buf_len)) == NULL) {
+        return IOTA_ERR_MALLOC_FAIL;
+    }
+    // serialize behind the key room, so the signed region is contiguous
+    uint8_t *msg_start = *outbuf + key_room;
+    uint32_t* p = (uint32_t*)msg_start;
 
     SER4(msg->hdr.version);
-    SER4(msg->hdr.len);
+    SER4(0);
     SER4(msg->flags);
 
     SERN(msg->dest_cert, msg->dest_cert_len);
@@ -319,7 +306,6 @@ iota_ret iota_serialize(iota *iota_inst, iota_msg* msg,
     SERN(msg->cert, msg->cert_len);
 
     // the above stays unencrypted, the rest is encrypted (if encryption enabled)
-    uint32_t unencrypted_len = (uint8_t*)p - *outbuf;
     SER4(msg->type);
     SER4(msg->action);
     SER4(msg->id);
@@ -331,90 +317,68 @@ iota_ret iota_serialize(iota *iota_inst, iota_msg* msg,
     SERN(msg->dest_cert2, msg->dest_cert2_len);
 
     SERN(msg->data, msg->data_len);
-    uint32_t* ser_msg_end = p;
 
     if (msg->flags & IOTA_SIGNED_FLAG) {
-        iota_ret ret;
-        uint8_t *sig = NULL;
         uint32_t sig_len = 0;
         // don't sign the header; the length field is too unstable
-        uint8_t *sign_region_start = *outbuf + sizeof(uint32_t)*2;
-        if (((ret = iota_sign(sign_region_start,
-                              (uint32_t)((uint8_t*)ser_msg_end - sign_region_start),
-                              &sig, &sig_len)) != IOTA_OK)
-                || (sig == NULL)) {
-            iota_free(*outbuf);
-            *outbuf_len = 0;
-            return ret;
+        uint8_t *sign_region_start = msg_start + sizeof(uint32_t)*2;
+        // sign straight into the buffer, after its length word
+        if ((ret = iota_sign(sign_region_start,
+                             (uint32_t)((uint8_t*)p - sign_region_start),
+                             (uint8_t*)(p + 1), &sig_len)) != IOTA_OK) {
+            goto error;
         }
-        // if not already on a 4-byte boundary, pad out to one.
-        // this should never actually happen in practice.
-        unsigned int pad;
-        for (pad = 0; pad < sig_len % 4; pad++) {
-            *p = 0;
-            p++;
+        if (sig_len == 0 || sig_len > IOTA_SIG_MAX_LEN) {
+            ret = IOTA_ERR_SIGN_FAIL;
+            goto error;
         }
-        *(uint32_t*)p = sig_len;
-        p ++;
-        // we need to allocate more space for the signature.
-        uint8_t* new_outbuf = malloc(msg->hdr.len + sig_len);
-        if (new_outbuf == NULL) {
-            *outbuf_len = 0;
-            iota_free(*outbuf);
-            return IOTA_ERR_MALLOC_FAIL;
+        *p = sig_len;
+        p++;
+        if (sig_len % 4) {
+            iota_memset((uint8_t*)p + sig_len, 0, ROUNDUP(sig_len) - sig_len);
         }
-        iota_memcpy(new_outbuf, *outbuf, msg->hdr.len);
-        iota_free(*outbuf);
-        *outbuf = new_outbuf;
-        p = (uint32_t*)(*outbuf + msg->hdr.len);
-        msg->hdr.len += sig_len;
-        // update length field in serialized buffer
-        ((uint32_t*)*outbuf)[1] = msg->hdr.len;
-        iota_memcpy(p, sig, sig_len);
         p += ROUNDUP(sig_len)/4;
-        iota_free(sig);
     } else {
-        *(uint32_t*)p = 0;
-        p ++;
+        SER4(0);
     }
+    msg->hdr.len = (uint32_t)((uint8_t*)p - msg_start);
+
     if (msg->flags & IOTA_ENCRYPTED_FLAG) {
-        uint8_t* enc;
         uint32_t enc_len;
-        iota_ret rv;
-        // length of section to be encrypted, before padding
-        uint32_t cleartext_len = (uint8_t*)p - *outbuf - unencrypted_len;
-        if ((rv = iota_encrypt(*outbuf + unencrypted_len, cleartext_len,
-                               msg->dest_cert, msg->dest_cert_len,
-                               &enc, &enc_len)) != 0) {
-            iota_free(*outbuf);
-            return rv;
+        // move the cleartext header down to the front, leaving the key
+        // room right before the section to be encrypted
+        memmove(*outbuf, msg_start, unencrypted_len);
+        if ((ret = iota_encrypt(*outbuf + unencrypted_len,
+                                msg->hdr.len - unencrypted_len,
+                                msg->dest_cert, msg->dest_cert_len,
+                                &enc_len)) != IOTA_OK) {
+            goto error;
         }
-        if (unencrypted_len + enc_len > msg->hdr.len) {
-            uint8_t* new_outbuf = NULL;
-            new_outbuf = iota_malloc((size_t)(unencrypted_len + enc_len));
-            if (new_outbuf == NULL) {
-                *outbuf_len = 0;
-                iota_free(*outbuf);
-                return IOTA_ERR_MALLOC_FAIL;
-            }
-            iota_memcpy(new_outbuf, *outbuf, unencrypted_len);
-            iota_free(*outbuf);
-            *outbuf = new_outbuf;
-        }
-        msg->hdr.len = (uint32_t)(unencrypted_len + enc_len);
-        (*(uint32_t**)outbuf)[1] = msg->hdr.len; // update already-serialized buffer
-        iota_memcpy(*outbuf + unencrypted_len, enc, enc_len);
-        iota_free(enc);
+        msg->hdr.len = unencrypted_len + enc_len;
     }
+    ((uint32_t*)*outbuf)[1] = msg->hdr.len;
+
     *outbuf_len = msg->hdr.len;
     return IOTA_OK;
+
+error:
+    iota_free(*outbuf);
+    *outbuf = NULL;
+    return ret;
 }
 #pragma GCC diagnostic pop // Stop ignoring -Wunused-parameter
 
-#define DES4(x) x = *p; p++;
-#define DES4_T(x,type) x = (type)*p; p++;
-#define DESN(buf, len) len = *p; p++; buf = iota_malloc(len);    \
-    if (buf) { iota_memcpy(buf, p, len); p += ROUNDUP(len)/4; }
+/*
+ * Readers for iota_deserialize. Every length read from the message is
+ * checked against what is left of it (end) before it is used.
+ */
+#define DES4(x) if (p >= end) goto malformed; x = *p; p++;
+#define DES4_T(x,type) if (p >= end) goto malformed; x = (type)*p; p++;
+#define DESN(buf, len) DES4(len);                                       \
+    if ((len) > (uint32_t)((uint8_t*)end - (uint8_t*)p) ||              \
+            ROUNDUP(len) > (uint32_t)((uint8_t*)end - (uint8_t*)p))     \
+        goto malformed;                                                 \
+    buf = (len) > 0 ? (uint8_t*)p : NULL; p += ROUNDUP(len)/4;
 
 iota_ret iota_deserialize(iota *iota_inst,
                           uint8_t* msg_bytes, uint32_t msg_bytes_sz,
@@ -422,67 +386,52 @@ iota_ret iota_deserialize(iota *iota_inst,
 {
     iota_ret ret;
     iota_msg tmp;
-    if (msg_bytes_sz < sizeof(iota_msg_hdr))
+    if (msg_bytes_sz < sizeof(iota_msg_hdr) + sizeof(uint32_t) ||
+            ((uintptr_t)msg_bytes % sizeof(uint32_t)) != 0)
         return IOTA_ERR_MALFORMAT;
-    uint8_t* msg_bytes_cp = malloc(msg_bytes_sz);
-    if (msg_bytes_cp == NULL) return IOTA_ERR_MALLOC_FAIL;
-    memcpy(msg_bytes_cp, msg_bytes, msg_bytes_sz);
 
-    uint32_t *p = (uint32_t*)msg_bytes_cp;
+    uint8_t *msg_start = msg_bytes;
+    uint32_t *p = (uint32_t*)msg_bytes;
+    uint32_t *end = p + 2;
     uint32_t version;
     uint32_t len;
 
     DES4(version);
     DES4(len);
-    if (len < msg_bytes_sz) {
-        iota_free(msg_bytes_cp);
+    // the message must be completely downloaded
+    if (len > msg_bytes_sz) {
         return IOTA_ERR_MALFORMAT;
     }
+    end = (uint32_t*)(msg_bytes + len - len % 4);
     tmp.hdr.version = version;
     tmp.hdr.len = len;
 
     DES4(tmp.flags);
 
     DESN(tmp.dest_cert, tmp.dest_cert_len);
-    if (tmp.dest_cert == NULL) {
-        iota_free(msg_bytes_cp);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
     DESN(tmp.cert, tmp.cert_len);
-    if (tmp.cert == NULL) {
-        iota_free(msg_bytes_cp);
-        iota_free(tmp.dest_cert);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
-    uint32_t unencrypted_len = (uint8_t*)p - msg_bytes_cp;
-    uint8_t *decrypted = NULL;
-    uint32_t decrypted_len;
+    uint32_t unencrypted_len = (uint32_t)((uint8_t*)p - msg_bytes);
     if (tmp.flags & IOTA_ENCRYPTED_FLAG) {
-        // Invoke decryption function on encrypted part of msg
-        if ((ret = iota_decrypt((uint8_t*)p, (uint32_t)(len - ((uint8_t*)p - msg_bytes_cp)),
+        uint32_t decrypted_len;
+        // Invoke decryption function on encrypted part of msg; the
+        // cleartext lands after the wrapped key
+        if ((ret = iota_decrypt((uint8_t*)p, len - unencrypted_len,
                                 iota_inst->cert, iota_inst->cert_len,
-                                &decrypted,
                                 &decrypted_len)) != IOTA_OK) {
-            iota_free(msg_bytes_cp);
-            iota_free(tmp.dest_cert);
-            iota_free(tmp.cert);
             return ret;
         }
-        uint8_t* new_msg_bytes = iota_malloc(unencrypted_len + decrypted_len);
-        if (new_msg_bytes == NULL) {
-            iota_free(tmp.dest_cert);
-            iota_free(tmp.cert);
-            iota_free(msg_bytes_cp);
-            return IOTA_ERR_MALLOC_FAIL;
-        }
-        iota_memcpy(new_msg_bytes, msg_bytes_cp, unencrypted_len);
-        iota_free(msg_bytes_cp);
-        iota_memcpy(new_msg_bytes + unencrypted_len, decrypted, decrypted_len);
-        msg_bytes_cp = new_msg_bytes;
-        p = (uint32_t*)(msg_bytes_cp + unencrypted_len);
-        iota_free(decrypted);
+        // move the cleartext header up against it, over the wrapped
+        // key, so the signed region is contiguous again
+        memmove(msg_bytes + IOTA_ENC_HDR_LEN, msg_bytes, unencrypted_len);
+        msg_start = msg_bytes + IOTA_ENC_HDR_LEN;
+        if (tmp.dest_cert != NULL)
+            tmp.dest_cert += IOTA_ENC_HDR_LEN;
+        if (tmp.cert != NULL)
+            tmp.cert += IOTA_ENC_HDR_LEN;
+        p = (uint32_t*)(msg_start + unencrypted_len);
+        end = p + decrypted_len/4;
     }
 
     DES4_T(tmp.type, uint8_t);
@@ -491,66 +440,33 @@ iota_ret iota_deserialize(iota *iota_inst,
     DES4_T(tmp.meas_type, uint8_t);
     DES4(tmp.ret);
     DESN(tmp.nonce, tmp.nonce_len);
-    if (tmp.nonce == NULL) {
-        iota_free(tmp.dest_cert);
-        iota_free(tmp.cert);
-        iota_free(msg_bytes_cp);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
     DESN(tmp.dest_cert2, tmp.dest_cert2_len);
-    if (tmp.dest_cert2 == NULL) {
-        iota_free(tmp.dest_cert);
-        iota_free(tmp.cert);
-        iota_free(tmp.nonce);
-        iota_free(msg_bytes_cp);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
     DESN(tmp.data, tmp.data_len);
-    if (tmp.data == NULL) {
-        iota_free(tmp.dest_cert);
-        iota_free(tmp.cert);
-        iota_free(tmp.nonce);
-        iota_free(tmp.dest_cert2);
-        iota_free(msg_bytes_cp);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
     uint8_t* signed_region_end = (uint8_t*)p;
     DESN(tmp.sig, tmp.sig_len);
-    if (tmp.sig == NULL) {
-        iota_free(tmp.dest_cert);
-        iota_free(tmp.sig);
-        iota_free(tmp.cert);
-        iota_free(tmp.nonce);
-        iota_free(tmp.dest_cert2);
-        iota_free(tmp.data);
-        iota_free(msg_bytes_cp);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
 
     if ((tmp.flags & IOTA_SIGNED_FLAG) != 0) {
-        uint8_t* signed_region_start = msg_bytes_cp + sizeof(uint32_t)*2;
+        uint8_t* signed_region_start = msg_start + sizeof(uint32_t)*2;
+        if (tmp.sig == NULL || tmp.cert == NULL)
+            return IOTA_ERR_VERIFY_FAIL;
         if ((ret = iota_signature_verify(signed_region_start,
                                          (uint32_t)(signed_region_end - signed_region_start),
                                          tmp.cert, tmp.cert_len,
                                          tmp.sig, tmp.sig_len))
                 != IOTA_OK) {
-            iota_free(tmp.dest_cert);
-            iota_free(tmp.cert);
-            iota_free(tmp.nonce);
-            iota_free(tmp.dest_cert2);
-            iota_free(tmp.data);
-            iota_free(tmp.sig);
-            iota_free(msg_bytes_cp);
             return ret;
         }
     }
 
+    tmp.buf = NULL;
     iota_memcpy(out, &tmp, sizeof(iota_msg));
-    iota_free(msg_bytes_cp);
     return IOTA_OK;
+
+malformed:
+    return IOTA_ERR_MALFORMAT;
 }
 
 char *iota_strerror(iota_ret err)
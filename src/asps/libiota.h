@@ -41,6 +41,19 @@
  */
 #define IOTA_SIGNED_FLAG 1 << 1
 
+/*! Largest signature iota_sign may produce, in bytes
+ */
+#define IOTA_SIG_MAX_LEN 256
+
+/*! Bytes iota_encrypt writes ahead of the ciphertext (the wrapped
+ *  symmetric key, IV and cleartext size)
+ */
+#define IOTA_ENC_HDR_LEN 256
+
+/*! Most bytes of padding iota_encrypt may add after the ciphertext
+ */
+#define IOTA_ENC_PAD_LEN 16
+
 /*! Malloc function to use for dynamic allocation in libiota
  */
 #define iota_malloc malloc
@@ -143,6 +156,9 @@ typedef struct iota_msg {
     uint8_t *sig; /*!< Signature */
     /* End of encrypted fields */
 
+    uint8_t *buf; /*!< Storage the variable-length fields point into,
+                       freed by iota_msg_deinit; NULL if they are views
+                       into a buffer owned by the caller */
 } iota_msg;
 
 /*! libiota measurement function signature.
@@ -253,7 +269,7 @@ iota_ret iota_req_init(iota* iota, iota_msg **msg, uint32_t flags,
 
 /*! Deinitialize an IOTA message.
  *
- * \param msg Pointer to pointer to message to deinitialize. Its children will be freed, then the iota_msg itself.
+ * \param msg Pointer to pointer to message to deinitialize. Its buf will be freed, then the iota_msg itself.
  */
 void iota_msg_deinit(iota_msg **msg);
 
@@ -267,6 +283,10 @@ void iota_msg_deinit(iota_msg **msg);
 char *iota_strerror(iota_ret err);
 
 /*! Serialize an iota_msg into a flat buffer.
+ *
+ * The buffer is allocated once at its final size; the signature is
+ * written into it and the encrypted fields are encrypted in place.
+ *
  * \param iota_inst The current IoTA instance
  * \param msg An iota_msg instance, assumed to contain valid pointers to data fields
  * \param outbuf Will point to a newly-malloced buffer containing the serialized IOTA message on success, or set to NULL on failure.
@@ -287,11 +307,15 @@ iota_ret  iota_serialize(iota *iota_inst, iota_msg* msg,
  * \param msg_bytes A stream of bytes containing the IoTA
  * message. Should be completely downloaded before this function is
  * called (use the header bytes, which are unencrypted, to determine
- * message length.)
+ * message length.) Must be 4-byte aligned. Encrypted messages are
+ * decrypted in place, so its contents are changed.
  * \param msg_bytes_sz The size of the msg_bytes.
- * \param out Must be allocated already. Fields will be populated with newly-malloced memory.
+ * \param out Must be allocated already. Its variable-length fields
+ * will point into msg_bytes, which must outlive it; out->buf is set to
+ * NULL, so set it to msg_bytes to have iota_msg_deinit free both.
  *
- * \return IOTA_OK if no errors.
+ * \return IOTA_OK if no errors, IOTA_ERR_MALFORMAT if a length runs
+ * past the end of the message.
  */
 iota_ret iota_deserialize(iota *iota_inst,
                           uint8_t* msg_bytes, uint32_t msg_bytes_sz,
@@ -307,13 +331,14 @@ iota_ret iota_deserialize(iota *iota_inst,
  *
  * \param buf_in Buffer of data to sign
  * \param buf_sz Length of buf_in in bytes
- * \param sig Output buffer for signature (must be allocated).
+ * \param sig Output buffer for the signature, with room for
+ * IOTA_SIG_MAX_LEN bytes.
  * \param sig_len Must be set to sig length.
  *
  * \return IOTA_OK if no errors.
  */
 iota_ret iota_sign(uint8_t *buf_in, uint32_t buf_sz,
-                   uint8_t **sig, uint32_t *sig_len);
+                   uint8_t *sig, uint32_t *sig_len);
 
 /*! Stub for signature verification.
  *
@@ -333,42 +358,43 @@ iota_ret iota_signature_verify(uint8_t *buf, uint32_t buf_sz,
                                uint8_t *cert, uint32_t cert_sz,
                                uint8_t *sig, uint32_t sig_sz);
 
-/*! Function used to encrypt data
+/*! Function used to encrypt data in place.
  *
- * Must set output pointer to encrypted buffer and out_len to length of
- * encrypted buffer. Encrypted buffer length must be equal to input buffer
- * length.
+ * buf holds IOTA_ENC_HDR_LEN bytes of room for the wrapped key,
+ * followed by in_len bytes of cleartext, followed by IOTA_ENC_PAD_LEN
+ * bytes of room for padding. The key goes into the room at the start
+ * and the cleartext is replaced by its cyphertext.
  *
- * \param in Input buffer to encrypt.
- * \param in_len Length of in.
+ * \param buf Buffer laid out as above.
+ * \param in_len Length of the cleartext.
  * \param cert Certificate to use for encrypting the data.
  * \param cert_len Length of certificate.
- * \param out Output buffer for cyphertext of in.
- * \param out_len Output pointer to length of out (must equal in_len).
+ * \param out_len Output pointer to the length of the encrypted data
+ * from the start of buf, at most IOTA_ENC_HDR_LEN + in_len +
+ * IOTA_ENC_PAD_LEN.
  *
  * \return IOTA_OK if no errors.
  */
-iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
+iota_ret iota_encrypt(uint8_t *buf, uint32_t in_len,
                       uint8_t const* cert, uint32_t cert_len,
-                      uint8_t **out, uint32_t *out_len);
+                      uint32_t *out_len);
 
-/*! Function used to decrypt data.
+/*! Function used to decrypt data in place.
  *
- * Must set output pointer to decrypted buffer and out_len to length of
- * decrypted buffer. Decrypted buffer length must be equal to input buffer
- * length.
+ * Reverses iota_encrypt: the cleartext replaces the cyphertext, which
+ * starts IOTA_ENC_HDR_LEN bytes into buf.
  *
- * \param in Input cyphertext buffer to decrypt.
- * \param in_len Length of in.
+ * \param buf Buffer containing the output of iota_encrypt.
+ * \param in_len Length of buf.
  * \param cert Certificate to use for encrypting the data.
  * \param cert_len Length of certificate.
- * \param out Output buffer for decrypted plaintext of in.
- * \param out_len Output pointer to length of out (must equal in_len).
+ * \param out_len Output pointer to the length of the cleartext, which
+ * must be at most in_len - IOTA_ENC_HDR_LEN.
  *
  * \return IOTA_OK if no errors.
  */
-iota_ret iota_decrypt(uint8_t *in, uint32_t in_len,
+iota_ret iota_decrypt(uint8_t *buf, uint32_t in_len,
                       uint8_t const* cert, uint32_t cert_len,
-                      uint8_t **out, uint32_t *out_len);
+                      uint32_t *out_len);
 
 #endif //_IOTA_H
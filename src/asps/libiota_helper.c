@@ -37,46 +37,54 @@
 #include <openssl/bio.h>
 
 iota_ret iota_sign(uint8_t *buf_in, uint32_t buf_sz,
-                   uint8_t **sig, uint32_t *sig_len)
+                   uint8_t *sig, uint32_t *sig_len)
 {
     uint8_t hash[32];
+    iota_ret ret = IOTA_OK;
 
-    RSA *p_key = pvt_key_from_PEM(tz_privkey_pem, tz_privkey_pem_sz);
-
-    *sig = iota_malloc((size_t)RSA_size(p_key));
-    if (*sig == NULL) {
-        return IOTA_ERR_MALLOC_FAIL;
+    RSA *p_key = pvt_key_from_PEM((uint8_t*)tz_privkey_pem, tz_privkey_pem_sz);
+    if (p_key == NULL) {
+        return IOTA_ERR_SIGN_FAIL;
+    }
+    if (RSA_size(p_key) > IOTA_SIG_MAX_LEN) {
+        RSA_free(p_key);
+        return IOTA_ERR_SIGN_FAIL;
     }
+
     SHA256((unsigned char*)buf_in, buf_sz, hash);
     if (RSA_sign(NID_sha256, (unsigned char*)hash, sizeof(hash),
-                 *sig, sig_len, p_key) != 1) {
-        return IOTA_ERR_SIGN_FAIL;
+                 sig, sig_len, p_key) != 1) {
+        ret = IOTA_ERR_SIGN_FAIL;
     }
-    return IOTA_OK;
+    RSA_free(p_key);
+    return ret;
 }
 
-iota_ret iota_decrypt(uint8_t *in, uint32_t in_len,
+iota_ret iota_decrypt(uint8_t *buf, uint32_t in_len,
                       uint8_t const* cert, uint32_t cert_len,
-                      uint8_t **out, uint32_t *out_len)
+                      uint32_t *out_len)
 {
     cert;
     cert_len;
 
     ERR_clear_error();
 
-    RSA *p_key = pvt_key_from_PEM(tz_privkey_pem, tz_privkey_pem_sz);
-
     // first bytes are encrypted with our public key
-    uint32_t rsa_size = 256;
+    uint32_t rsa_size = IOTA_ENC_HDR_LEN;
     if (in_len < rsa_size) {
         return IOTA_ERR_DECRYPT_FAIL;
     }
 
+    RSA *p_key = pvt_key_from_PEM((uint8_t*)tz_privkey_pem, tz_privkey_pem_sz);
+    if (p_key == NULL) {
+        return IOTA_ERR_DECRYPT_FAIL;
+    }
+
     uint8_t key_iv[52] = {0}; //32-byte key + 16-byte iv + 4-byte size
-    uint32_t key_iv_sz = 0;
-    if ((key_iv_sz = RSA_private_decrypt(rsa_size, in, key_iv, p_key,
-                                         RSA_PKCS1_PADDING))
-            != 52) {
+    int key_iv_sz = RSA_private_decrypt((int)rsa_size, buf, key_iv, p_key,
+                                        RSA_PKCS1_PADDING);
+    RSA_free(p_key);
+    if (key_iv_sz != 52) {
         fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
         return IOTA_ERR_DECRYPT_FAIL;
     }
@@ -89,39 +97,34 @@ iota_ret iota_decrypt(uint8_t *in, uint32_t in_len,
     decrypted_size = (decrypted_size << 8) + key_iv[50];
     decrypted_size = (decrypted_size << 8) + key_iv[49];
     decrypted_size = (decrypted_size << 8) + key_iv[48];
-
-    // decrypt the rest
-    if (!((*out) = iota_malloc(in_len - rsa_size))) {
-        return IOTA_ERR_MALLOC_FAIL;
+    if (decrypted_size > in_len - rsa_size) {
+        return IOTA_ERR_DECRYPT_FAIL;
     }
 
+    // decrypt the rest where it is
+    uint8_t *data = buf + rsa_size;
     EVP_CIPHER_CTX *ctx;
     int tmp, total_len;
 
     if (!(ctx = EVP_CIPHER_CTX_new())) {
-        fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
         goto err_decrypt;
     }
 
     if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)
             != 1) {
-        fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
         goto err_decrypt;
     }
 
     EVP_CIPHER_CTX_set_padding(ctx, 0);
 
-    if (EVP_DecryptUpdate(ctx, *out, &tmp, in + rsa_size, (int)(in_len - rsa_size)) != 1) {
-        fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    if (EVP_DecryptUpdate(ctx, data, &tmp, data, (int)(in_len - rsa_size)) != 1) {
         goto err_decrypt;
     }
 
     total_len = tmp;
 
-    int ret;
     int f_len = 0;
-    if ((ret = EVP_DecryptFinal_ex(ctx, *out + total_len, &f_len)) != 1) {
-        fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    if (EVP_DecryptFinal_ex(ctx, data + total_len, &f_len) != 1) {
         goto err_decrypt;
     }
 
@@ -131,14 +134,14 @@ iota_ret iota_decrypt(uint8_t *in, uint32_t in_len,
     return IOTA_OK;
 
 err_decrypt:
-    iota_free(*out);
+    EVP_CIPHER_CTX_free(ctx);
     fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
     return IOTA_ERR_DECRYPT_FAIL;
 }
 
-iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
+iota_ret iota_encrypt(uint8_t *buf, uint32_t in_len,
                       uint8_t const* cert, uint32_t cert_len,
-                      uint8_t **out, uint32_t *out_len)
+                      uint32_t *out_len)
 {
     iota_ret ret = IOTA_ERR_ENCRYPT_FAIL;
 
@@ -148,6 +151,13 @@ iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
         return ret;
     }
 
+    // the wrapped key must exactly fill the room left for it
+    int rsa_size = RSA_size(rsa_pub);
+    if (rsa_size != IOTA_ENC_HDR_LEN) {
+        RSA_free(rsa_pub);
+        return ret;
+    }
+
     // generate random symmetric key and IV
     uint8_t key_iv[52]; // 32-byte key, 16-byte iv + 4-byte size
     if (RAND_bytes(key_iv, sizeof(uint8_t)*52) != 1) {
@@ -162,35 +172,19 @@ iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
     key_iv[50] = (uint8_t) (in_len >> 16);
     key_iv[51] = (uint8_t) (in_len >> 24);
 
-    // encrypt symmetric key and IV using public key  //add size
-    int rsa_size = RSA_size(rsa_pub);
-    uint8_t* ep_key_iv = iota_malloc((size_t)rsa_size);
-    if (ep_key_iv == NULL) {
+    // encrypt symmetric key, IV and size using public key, straight
+    // into the room ahead of the cleartext
+    if (RSA_public_encrypt(52, key_iv, buf, rsa_pub,
+                           RSA_PKCS1_PADDING) != rsa_size) {
         RSA_free(rsa_pub);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
-    uint32_t ep_key_iv_sz = 0;
-    if ((ep_key_iv_sz = RSA_public_encrypt(52, key_iv, ep_key_iv, rsa_pub,
-                                           RSA_PKCS1_PADDING)) != rsa_size) {
-        RSA_free(rsa_pub);
-        iota_free(ep_key_iv);
         return IOTA_ERR_ENCRYPT_FAIL;
     }
 
     RSA_free(rsa_pub);
 
-    // write out encrypted symmetric key, IV, and size
-    *out = iota_malloc(in_len + rsa_size + 16);
-    if (*out == NULL) {
-        iota_free(ep_key_iv);
-        return IOTA_ERR_MALLOC_FAIL;
-    }
-    iota_memcpy(*out, ep_key_iv, (size_t)rsa_size);
-    iota_free(ep_key_iv);
-
-    uint8_t* out_data = *out + rsa_size;
+    uint8_t* out_data = buf + rsa_size;
 
-    // encrypt user data with symmetric key and IV and append to out
+    // encrypt user data with symmetric key and IV where it is
     EVP_CIPHER_CTX *ctx;
     int tmp = 0;
     int total_len = 0;
@@ -204,7 +198,7 @@ iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
         goto err_encrypt;
     }
 
-    if (EVP_EncryptUpdate(ctx, out_data, &tmp, in, (int)in_len) != 1) {
+    if (EVP_EncryptUpdate(ctx, out_data, &tmp, out_data, (int)in_len) != 1) {
         goto err_encrypt;
     }
 
@@ -216,14 +210,12 @@ iota_ret iota_encrypt(uint8_t *in, uint32_t in_len,
 
     total_len += tmp;
 
-    *out_len = (uint32_t)total_len + rsa_size;
+    *out_len = (uint32_t)total_len + (uint32_t)rsa_size;
 
     EVP_CIPHER_CTX_free(ctx);
     return IOTA_OK;
 
 err_encrypt:
-    iota_free(*out);
-    *out = NULL;
     EVP_CIPHER_CTX_free(ctx);
     return IOTA_ERR_ENCRYPT_FAIL;
 }
@@ -233,8 +225,6 @@ iota_ret iota_signature_verify(uint8_t *buf, uint32_t buf_sz,
                                uint8_t *cert, uint32_t cert_sz,
                                unsigned char *sig, uint32_t sig_sz)
 {
-    sig_sz;
-
     RSA *rsa_pub = pub_key_from_cert(cert, cert_sz);
 
     uint8_t hash[32];
@@ -243,10 +233,12 @@ iota_ret iota_signature_verify(uint8_t *buf, uint32_t buf_sz,
 
     SHA256((unsigned char*)buf, buf_sz, hash);
 
-    if (RSA_verify(NID_sha256, hash, 32, sig, 256, rsa_pub) == 1) {
+    if (RSA_verify(NID_sha256, hash, 32, sig, sig_sz, rsa_pub) == 1) {
+        RSA_free(rsa_pub);
         return IOTA_OK;
     }
 
+    RSA_free(rsa_pub);
     fprintf(stderr, "ERROR: %s\n", ERR_error_string(ERR_get_error(), NULL));
     return IOTA_ERR_VERIFY_FAIL;
 }
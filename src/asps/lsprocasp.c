@@ -44,6 +44,10 @@
 #include <linux/sched.h>
 #include <string.h>
 
+#ifdef USE_BPF_PROCMON
+#include <procmon/procmon.h>
+#endif
+
 /* Apparently SCHED_DEADLINE isn't in some recent distro kernels */
 #ifndef SCHED_DEADLINE
 #define SCHED_DEADLINE  6
@@ -384,25 +388,103 @@ int test_only_read_process_metadata(long p, process_metadata_measurement **out)
 #endif
 
 
-int asp_measure(int argc, char *argv[])
+/*
+ * Adds a node for process @pid, linked from @root_node, and its
+ * metadata read from /proc. Failures for one process are only logged,
+ * it may have exited meanwhile.
+ */
+static void measure_process(measurement_graph *graph, node_id_t root_node, long pid)
+{
+    int is_root = 0;
+    process_metadata_measurement *m = NULL;
+    marshalled_data *md = NULL;
+    measurement_variable mvar;
+    node_id_t new_node;
+    edge_id_t new_edge;
+
+    if((mvar.address = alloc_address(&pid_address_space)) == NULL) {
+        asp_logwarn("Warning failed to allocate address for process "
+                    "metadata measurement\n");
+        goto alloc_address_failed;
+    }
+
+    if(LONG_MAX > UINT32_MAX && pid > UINT32_MAX) {
+        asp_logwarn("Unable to represent PID %ld in measurement\n", pid);
+        goto pid_rep_failed;
+    }
+
+    pid_address *paddr      = container_of(mvar.address, pid_address, a);
+    // Cast is justified because of previous check
+    paddr->pid    	    = (uint32_t)pid;
+    mvar.type		    = &process_target_type;
+
+    if(measurement_graph_add_node(graph, &mvar, NULL, &new_node) < 0) {
+        asp_logwarn("Warning: failed to add graph node for process %ld\n",
+                    pid);
+        goto add_node_failed;
+    }
+
+    announce_node(new_node);
+
+
+    if(measurement_graph_add_edge(graph, root_node, "process_metadata.pids", new_node, &new_edge) < 0) {
+        asp_logwarn("Warning: failed to add graph edge for process %ld\n",
+                    pid);
+    } else {
+        announce_edge(new_edge);
+    }
+
+    if(read_process_metadata((pid_t)pid, &m, &is_root) != 0) {
+        asp_logwarn("Warning: failed to read metadata for process %ld\n",
+                    pid);
+        goto read_metadata_failed;
+    }
+
+    if (is_root) {
+        if(measurement_graph_add_edge(graph, root_node, "process_metadata.root_pids", new_node, &new_edge) < 0) {
+            asp_logwarn("Warning: failed to add root_pids edge for process %ld\n",
+                        pid);
+        } else {
+            announce_edge(new_edge);
+        }
+    }
+
+    if((md = marshall_measurement_data(&m->d)) == NULL) {
+        asp_logwarn("Warning: failed to marshall metadata measurement for "
+                    "process %ld\n", pid);
+        goto marshall_data_failed;
+    }
+
+    if(measurement_node_add_data(graph, new_node, md) != 0) {
+        asp_logwarn("Warning: failed to add metadata measurement to node for "
+                    "process %ld\n", pid);
+        goto add_data_failed;
+    }
+
+add_data_failed:
+    free_measurement_data(&md->meas_data);
+marshall_data_failed:
+    free_measurement_data(&m->d);
+read_metadata_failed:
+add_node_failed:
+pid_rep_failed:
+    free_address(mvar.address);
+alloc_address_failed:
+    return;
+}
+
+/*
+ * Measures every process found by walking /proc.
+ */
+static int measure_proc_processes(measurement_graph *graph, node_id_t root_node)
 {
-    measurement_graph *graph;
     DIR *d = NULL;
     struct dirent *dent;
     int rc = 0;
-    node_id_t root_node = INVALID_NODE_ID;
-
-    if((argc < 3) ||
-            ((root_node = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
-            (map_measurement_graph(argv[1], &graph) != 0)) {
-        asp_logerror("Usage "ASP_NAME" <graph path> <node id>\n");
-        return -EINVAL;
-    }
 
     errno = 0;
     if((d = opendir("/proc")) == NULL) {
         asp_logerror("Failed to open /proc filesystem");
-        unmap_measurement_graph(graph);
         if(errno != 0) {
             return -errno;
         }
@@ -413,15 +495,9 @@ int asp_measure(int argc, char *argv[])
     while((dent = readdir(d)) != NULL) {
         long pid = LONG_MAX;
         char *endptr;
-        int is_root = 0;
-        process_metadata_measurement *m = NULL;
-        marshalled_data *md = NULL;
-        measurement_variable mvar;
-        node_id_t new_node;
-        edge_id_t new_edge;
 
         if(dent->d_type != DT_DIR) {
-            goto not_a_dir;
+            goto next;
         }
 
         errno = 0;
@@ -434,89 +510,159 @@ int asp_measure(int argc, char *argv[])
                 (*endptr != '\0')) {
             asp_loginfo("/proc directory entry \"%s\" is not a pid\n",
                         dent->d_name);
-            goto not_a_pid;
+            goto next;
         }
 
-        if((mvar.address = alloc_address(&pid_address_space)) == NULL) {
-            asp_logwarn("Warning failed to allocate address for process "
-                        "metadata measurement\n");
-            goto alloc_address_failed;
-        }
+        measure_process(graph, root_node, pid);
+next:
+        errno = 0;
+        continue;
+    }
 
-        if(LONG_MAX > UINT32_MAX && pid > UINT32_MAX) {
-            asp_logwarn("Unable to represent PID %ld in measurement\n", pid);
-            goto pid_rep_failed;
-        }
+    if(errno != 0) {
+        asp_logerror("Failed to read directory entries from /proc");
+        rc = -errno;
+    }
 
-        pid_address *paddr      = container_of(mvar.address, pid_address, a);
-        // Cast is justified because of previous check
-        paddr->pid    	        = (uint32_t)pid;
-        mvar.type		= &process_target_type;
+    closedir(d);
+    return rc;
+}
 
-        if(measurement_graph_add_node(graph, &mvar, NULL, &new_node) < 0) {
-            asp_logwarn("Warning: failed to add graph node for process %ld\n",
-                        pid);
-            goto add_node_failed;
-        }
+#ifdef USE_BPF_PROCMON
+static int compare_procs(const void *a, const void *b)
+{
+    const struct procmon_proc *pa = a;
+    const struct procmon_proc *pb = b;
+    return pa->pid < pb->pid ? -1 : pa->pid > pb->pid;
+}
 
-        announce_node(new_node);
+/*
+ * Adds a node for a process in the exec history that is no longer
+ * running, with the little that is known about it.
+ */
+static void measure_exec(measurement_graph *graph, node_id_t root_node,
+                         struct procmon_exec *ev)
+{
+    measurement_data *data;
+    process_metadata_measurement *m;
+    marshalled_data *md = NULL;
+    measurement_variable mvar = {.type = &process_target_type};
+    node_id_t new_node;
+    edge_id_t new_edge;
+
+    if((data = alloc_measurement_data(&process_metadata_measurement_type)) == NULL) {
+        return;
+    }
+    m = container_of(data, process_metadata_measurement, d);
+    m->pid  = ev->proc.pid;
+    m->ppid = ev->proc.ppid;
+    m->user_ids.real = m->user_ids.effective = (int)ev->uid;
+    m->user_ids.saved_set = m->user_ids.filesystem = (int)ev->uid;
+    m->group_ids.real = m->group_ids.effective = (int)ev->gid;
+    m->group_ids.saved_set = m->group_ids.filesystem = (int)ev->gid;
+    snprintf(m->executable, sizeof(m->executable), "%s", ev->proc.exe);
+    strcpy(m->command_line, "UNKNOWN");
+
+    if((mvar.address = alloc_address(&pid_address_space)) == NULL) {
+        goto out;
+    }
+    container_of(mvar.address, pid_address, a)->pid = ev->proc.pid;
 
+    if(measurement_graph_add_node(graph, &mvar, NULL, &new_node) < 0) {
+        asp_logwarn("Warning: failed to add graph node for exited process %"PRIu32"\n",
+                    ev->proc.pid);
+        goto out;
+    }
+    announce_node(new_node);
+    if(measurement_graph_add_edge(graph, root_node, "process_metadata.exec_history",
+                                  new_node, &new_edge) == 0) {
+        announce_edge(new_edge);
+    }
 
-        if(measurement_graph_add_edge(graph, root_node, "process_metadata.pids", new_node, &new_edge) < 0) {
-            asp_logwarn("Warning: failed to add graph edge for process %ld\n",
-                        pid);
-        } else {
-            announce_edge(new_edge);
-        }
+    if((md = marshall_measurement_data(&m->d)) == NULL ||
+            measurement_node_add_data(graph, new_node, md) != 0) {
+        asp_logwarn("Warning: failed to add metadata measurement for exited "
+                    "process %"PRIu32"\n", ev->proc.pid);
+    }
 
-        if(read_process_metadata((pid_t)pid, &m, &is_root) != 0) {
-            asp_logwarn("Warning: failed to read metadata for process %ld\n",
-                        pid);
-            goto read_metadata_failed;
-        }
+out:
+    if(md != NULL) {
+        free_measurement_data(&md->meas_data);
+    }
+    free_address(mvar.address);
+    free_measurement_data(data);
+}
 
-        if (is_root) {
-            if(measurement_graph_add_edge(graph, root_node, "process_metadata.root_pids", new_node, &new_edge) < 0) {
-                asp_logwarn("Warning: failed to add root_pids edge for process %ld\n",
-                            pid);
-            } else {
-                announce_edge(new_edge);
+/*
+ * Measures the processes in the eBPF process inventory and the ones
+ * in its exec history that are no longer running. The inventory only
+ * replaces the walk of /proc that finds the processes: their metadata
+ * is still read from /proc/<pid> by measure_process(). Returns < 0 if
+ * the inventory can not be read or has missed updates, so /proc must
+ * be walked instead.
+ */
+static int measure_inventory_processes(measurement_graph *graph, node_id_t root_node)
+{
+    struct procmon_proc *procs;
+    struct procmon_exec *execs;
+    size_t nr_procs, nr_execs, i;
+    __u64 drops;
+    int rc;
+
+    if((rc = procmon_read_drops(&drops)) != 0) {
+        return rc;
+    }
+    if(drops != 0) {
+        asp_logwarn("Process inventory missed %"PRIu64" updates, restart maat-procmon\n",
+                    (uint64_t)drops);
+        return -ESTALE;
+    }
+    if((rc = procmon_read_procs(&procs, &nr_procs)) != 0) {
+        return rc;
+    }
+    asp_loginfo("Read %zu processes from the process inventory\n", nr_procs);
+
+    for(i = 0; i < nr_procs; i++) {
+        measure_process(graph, root_node, (long)procs[i].pid);
+    }
+
+    if(procmon_read_history(&execs, &nr_execs) == 0) {
+        qsort(procs, nr_procs, sizeof(*procs), compare_procs);
+        for(i = 0; i < nr_execs; i++) {
+            if(bsearch(&execs[i].proc, procs, nr_procs, sizeof(*procs),
+                       compare_procs) == NULL) {
+                measure_exec(graph, root_node, &execs[i]);
             }
         }
+        free(execs);
+    }
 
-        if((md = marshall_measurement_data(&m->d)) == NULL) {
-            asp_logwarn("Warning: failed to marshall metadata measurement for "
-                        "process %ld\n", pid);
-            goto marshall_data_failed;
-        }
+    free(procs);
+    return 0;
+}
+#endif
 
-        if(measurement_node_add_data(graph, new_node, md) != 0) {
-            asp_logwarn("Warning: failed to add metadata measurement to node for "
-                        "process %ld\n", pid);
-            goto add_data_failed;
-        }
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph;
+    int rc = 0;
+    node_id_t root_node = INVALID_NODE_ID;
 
-add_data_failed:
-        free_measurement_data(&md->meas_data);
-marshall_data_failed:
-        free_measurement_data(&m->d);
-read_metadata_failed:
-add_node_failed:
-        free_address(mvar.address);
-pid_rep_failed:
-alloc_address_failed:
-not_a_pid:
-not_a_dir:
-        errno = 0;
-        continue;
+    if((argc < 3) ||
+            ((root_node = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage "ASP_NAME" <graph path> <node id>\n");
+        return -EINVAL;
     }
 
-    if(errno != 0) {
-        asp_logerror("Failed to read directory entries from /proc");
-        rc = -errno;
+#ifdef USE_BPF_PROCMON
+    if(measure_inventory_processes(graph, root_node) == 0) {
+        unmap_measurement_graph(graph);
+        return 0;
     }
-
-    closedir(d);
+    asp_loginfo("Process inventory unavailable, walking /proc\n");
+#endif
+    rc = measure_proc_processes(graph, root_node);
 
     unmap_measurement_graph(graph);
     return rc;
@@ -0,0 +1,733 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Reverse index from file paths to the packages owning them. See
+ * pkg_owner_index.h.
+ *
+ * While it is built the index is a hash table from path to package
+ * line. It is then flattened into one buffer:
+ *
+ *   header | entries[count] | strings
+ *
+ * where each entry holds the offsets of a NUL terminated path and
+ * package line in the strings, and entries are sorted by path so
+ * lookups are a binary search. Package lines are stored once. The
+ * same buffer is what gets written to and mapped back from disk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include <util/util.h>
+
+#include "pkg_owner_index.h"
+
+#define PKG_OWNER_INDEX_MAGIC	"MAATPKGI"
+#define PKG_OWNER_INDEX_VERSION	1
+
+#define RPM_QUERY_FORMAT	"[%{FILENAMES}\t%{NAME}\t%{VERSION}-%{RELEASE}\t%{ARCH}\n]"
+
+struct pkg_owner_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct pkg_owner_entry {
+    uint32_t path;
+    uint32_t line;
+};
+
+struct pkg_owner_index {
+    char *base;
+    size_t size;
+    uint32_t count;
+    const struct pkg_owner_entry *entries;
+    int mapped;
+};
+
+/*
+ * Paths and package lines while the index is being built. Strings
+ * live in @strings and are freed with it.
+ */
+struct index_builder {
+    GHashTable *owners;		/* path => package line */
+    GHashTable *canon_dirs;	/* directory => canonical directory, "" if the same */
+    GStringChunk *strings;
+};
+
+static void builder_init(struct index_builder *b)
+{
+    b->owners     = g_hash_table_new(g_str_hash, g_str_equal);
+    b->canon_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    b->strings    = g_string_chunk_new(1 << 16);
+}
+
+static void builder_clear(struct index_builder *b)
+{
+    g_hash_table_destroy(b->owners);
+    g_hash_table_destroy(b->canon_dirs);
+    g_string_chunk_free(b->strings);
+}
+
+/* the canonical form of @dir if it differs, else NULL */
+static const char *canonical_dir(struct index_builder *b, const char *dir)
+{
+    char *canon = g_hash_table_lookup(b->canon_dirs, dir);
+    char resolved[PATH_MAX];
+
+    if(canon == NULL) {
+        if(realpath(dir, resolved) != NULL && strcmp(resolved, dir) != 0) {
+            canon = g_strdup(resolved);
+        } else {
+            canon = g_strdup("");
+        }
+        g_hash_table_insert(b->canon_dirs, g_strdup(dir), canon);
+    }
+    return canon[0] != '\0' ? canon : NULL;
+}
+
+/*
+ * Record @line as the owner of @path, and of the path reached through
+ * its canonical directory. A path listed by several packages, which
+ * only directories should be, keeps its first owner.
+ */
+static void builder_add(struct index_builder *b, const char *path, const char *line)
+{
+    const char *slash = strrchr(path, '/');
+    const char *canon;
+
+    if(path[0] != '/' || g_hash_table_contains(b->owners, path)) {
+        return;
+    }
+    g_hash_table_insert(b->owners, g_string_chunk_insert(b->strings, path), (char *)line);
+
+    if(slash != NULL && slash != path) {
+        char *dir = g_strndup(path, (gsize)(slash - path));
+        if((canon = canonical_dir(b, dir)) != NULL) {
+            char *alias = g_strconcat(canon, slash, NULL);
+            if(!g_hash_table_contains(b->owners, alias)) {
+                g_hash_table_insert(b->owners, g_string_chunk_insert(b->strings, alias),
+                                    (char *)line);
+            }
+            g_free(alias);
+        }
+        g_free(dir);
+    }
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* flatten the owners of @b into a new index */
+static int builder_finish(struct index_builder *b, pkg_owner_index **out)
+{
+    guint count = g_hash_table_size(b->owners);
+    GHashTable *line_offsets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    struct pkg_owner_index_header *hdr;
+    struct pkg_owner_entry *entries;
+    pkg_owner_index *idx = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+    char **paths = NULL;
+    size_t size, off;
+    guint i = 0;
+    int ret = -ENOMEM;
+
+    /* sizes first, counting every distinct line once */
+    size = sizeof(*hdr) + (size_t)count * sizeof(*entries);
+    paths = g_try_new(char *, count + 1);
+    if(paths == NULL) {
+        goto out;
+    }
+    g_hash_table_iter_init(&iter, b->owners);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        paths[i++] = key;
+        size += strlen(key) + 1;
+        if(!g_hash_table_contains(line_offsets, value)) {
+            g_hash_table_insert(line_offsets, value, GSIZE_TO_POINTER(0));
+            size += strlen(value) + 1;
+        }
+    }
+    if(size > UINT32_MAX) {
+        ret = -EFBIG;
+        goto out;
+    }
+    qsort(paths, count, sizeof(char *), compare_paths);
+
+    if((idx = calloc(1, sizeof(*idx))) == NULL ||
+            (idx->base = malloc(size)) == NULL) {
+        goto out;
+    }
+    idx->size  = size;
+    idx->count = count;
+    hdr = (struct pkg_owner_index_header *)idx->base;
+    memcpy(hdr->magic, PKG_OWNER_INDEX_MAGIC, sizeof(hdr->magic));
+    hdr->version = PKG_OWNER_INDEX_VERSION;
+    hdr->count   = count;
+    entries = (struct pkg_owner_entry *)(idx->base + sizeof(*hdr));
+    idx->entries = entries;
+
+    off = sizeof(*hdr) + (size_t)count * sizeof(*entries);
+    for(i = 0; i < count; i++) {
+        const char *line = g_hash_table_lookup(b->owners, paths[i]);
+        gsize line_off = GPOINTER_TO_SIZE(g_hash_table_lookup(line_offsets, line));
+        size_t len = strlen(paths[i]) + 1;
+
+        entries[i].path = (uint32_t)off;
+        memcpy(idx->base + off, paths[i], len);
+        off += len;
+        if(line_off == 0) {
+            len = strlen(line) + 1;
+            line_off = off;
+            memcpy(idx->base + off, line, len);
+            off += len;
+            g_hash_table_insert(line_offsets, (char *)line, GSIZE_TO_POINTER(line_off));
+        }
+        entries[i].line = (uint32_t)line_off;
+    }
+
+    *out = idx;
+    idx = NULL;
+    ret = 0;
+
+out:
+    pkg_owner_index_free(idx);
+    g_free(paths);
+    g_hash_table_destroy(line_offsets);
+    return ret;
+}
+
+/* dpkg-query --list's two letter abbreviation of a Status field */
+static int dpkg_status_abbrev(const char *status, char abbrev[4])
+{
+    static const char *wants[]    = {"unknown", "install", "hold", "deinstall", "purge"};
+    static const char want_abbr[] = "uihrp";
+    static const char *states[]   = {"not-installed", "config-files", "half-installed",
+                                     "unpacked", "half-configured", "triggers-awaited",
+                                     "triggers-pending", "installed"
+                                    };
+    static const char state_abbr[] = "ncHUFWti";
+    char want[32], eflag[32], state[32];
+    size_t i;
+
+    if(sscanf(status, "%31s %31s %31s", want, eflag, state) != 3) {
+        return -EINVAL;
+    }
+    abbrev[0] = abbrev[1] = '?';
+    for(i = 0; i < sizeof(wants) / sizeof(wants[0]); i++) {
+        if(strcmp(want, wants[i]) == 0) {
+            abbrev[0] = want_abbr[i];
+        }
+    }
+    for(i = 0; i < sizeof(states) / sizeof(states[0]); i++) {
+        if(strcmp(state, states[i]) == 0) {
+            abbrev[1] = state_abbr[i];
+        }
+    }
+    abbrev[2] = strcmp(eflag, "reinstreq") == 0 ? 'R' : '\0';
+    abbrev[3] = '\0';
+    return 0;
+}
+
+struct dpkg_package {
+    char *name;
+    char *arch;
+    char *version;
+    char *status;
+    int multiarch_same;
+};
+
+static void dpkg_package_clear(struct dpkg_package *p)
+{
+    g_free(p->name);
+    g_free(p->arch);
+    g_free(p->version);
+    g_free(p->status);
+    memset(p, 0, sizeof(*p));
+}
+
+/*
+ * Packages are keyed as their info/<key>.list files are named:
+ * "name:arch" for Multi-Arch: same packages, else "name". The line
+ * names them as dpkg-query --list does, qualified by architecture
+ * when that is needed to tell them apart.
+ */
+static void dpkg_package_add(struct index_builder *b, GHashTable *packages,
+                             struct dpkg_package *p, const char *native_arch)
+{
+    char abbrev[4];
+    char *key, *line;
+    int qualify;
+
+    if(p->name == NULL || p->status == NULL ||
+            dpkg_status_abbrev(p->status, abbrev) != 0) {
+        return;
+    }
+    qualify = p->arch != NULL && (p->multiarch_same ||
+                                  (strcmp(p->arch, "all") != 0 && native_arch != NULL &&
+                                   strcmp(p->arch, native_arch) != 0));
+    key  = p->multiarch_same && p->arch ? g_strdup_printf("%s:%s", p->name, p->arch) :
+           g_strdup(p->name);
+    line = g_strdup_printf("%s %s%s%s %s %s", abbrev, p->name, qualify ? ":" : "",
+                           qualify ? p->arch : "", p->version ? p->version : "(none)",
+                           p->arch ? p->arch : "(none)");
+    g_hash_table_insert(packages, key, g_string_chunk_insert(b->strings, line));
+    g_free(line);
+}
+
+/* the Architecture of the dpkg package itself, which is the native one */
+static char *dpkg_native_arch(FILE *status)
+{
+    char *line = NULL, *arch = NULL;
+    size_t len = 0;
+    int in_dpkg = 0;
+
+    while(getline(&line, &len, status) != -1) {
+        g_strchomp(line);
+        if(line[0] == '\0') {
+            in_dpkg = 0;
+        } else if(strncmp(line, "Package: ", 9) == 0) {
+            in_dpkg = strcmp(line + 9, "dpkg") == 0;
+        } else if(in_dpkg && strncmp(line, "Architecture: ", 14) == 0) {
+            arch = g_strdup(line + 14);
+            break;
+        }
+    }
+    free(line);
+    rewind(status);
+    return arch;
+}
+
+/* info/<key>.list key => package line, for every package in status */
+static int dpkg_read_status(struct index_builder *b, const char *admindir,
+                            GHashTable **out)
+{
+    char *path = g_build_filename(admindir, "status", NULL);
+    GHashTable *packages;
+    struct dpkg_package p;
+    char *line = NULL, *native_arch;
+    size_t len = 0;
+    FILE *fp;
+
+    if((fp = fopen(path, "r")) == NULL) {
+        int err = errno;
+        dlog(1, "Failed to open %s: %s\n", path, strerror(err));
+        g_free(path);
+        return -err;
+    }
+    g_free(path);
+
+    packages = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    native_arch = dpkg_native_arch(fp);
+    memset(&p, 0, sizeof(p));
+    while(getline(&line, &len, fp) != -1) {
+        g_strchomp(line);
+        if(line[0] == '\0') {
+            dpkg_package_add(b, packages, &p, native_arch);
+            dpkg_package_clear(&p);
+        } else if(line[0] == ' ' || line[0] == '\t') {
+            continue;
+        } else if(strncmp(line, "Package: ", 9) == 0) {
+            g_free(p.name);
+            p.name = g_strdup(line + 9);
+        } else if(strncmp(line, "Status: ", 8) == 0) {
+            g_free(p.status);
+            p.status = g_strdup(line + 8);
+        } else if(strncmp(line, "Version: ", 9) == 0) {
+            g_free(p.version);
+            p.version = g_strdup(line + 9);
+        } else if(strncmp(line, "Architecture: ", 14) == 0) {
+            g_free(p.arch);
+            p.arch = g_strdup(line + 14);
+        } else if(strcmp(line, "Multi-Arch: same") == 0) {
+            p.multiarch_same = 1;
+        }
+    }
+    dpkg_package_add(b, packages, &p, native_arch);
+    dpkg_package_clear(&p);
+    g_free(native_arch);
+    free(line);
+    fclose(fp);
+
+    *out = packages;
+    return 0;
+}
+
+/*
+ * diverted path => "<diverted to>\n<diverting package>", from the
+ * diversions file's triples of lines. A missing file means there are
+ * no diversions.
+ */
+static GHashTable *dpkg_read_diversions(const char *admindir)
+{
+    char *path = g_build_filename(admindir, "diversions", NULL);
+    GHashTable *diversions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    char *from = NULL, *to = NULL, *by = NULL;
+    size_t from_len = 0, to_len = 0, by_len = 0;
+    FILE *fp;
+
+    if((fp = fopen(path, "r")) != NULL) {
+        while(getline(&from, &from_len, fp) != -1 &&
+                getline(&to, &to_len, fp) != -1 &&
+                getline(&by, &by_len, fp) != -1) {
+            g_strchomp(from);
+            g_strchomp(to);
+            g_strchomp(by);
+            g_hash_table_insert(diversions, g_strdup(from), g_strdup_printf("%s\n%s", to, by));
+        }
+        fclose(fp);
+    }
+    free(from);
+    free(to);
+    free(by);
+    g_free(path);
+    return diversions;
+}
+
+/*
+ * A file diverted by another package (or locally, by ":") is on disk
+ * at the diverted-to path; the diverting package, if any, lists the
+ * original path itself.
+ */
+static void dpkg_add_path(struct index_builder *b, GHashTable *diversions,
+                          const char *key, const char *path, const char *line)
+{
+    const char *div = g_hash_table_lookup(diversions, path);
+
+    if(div != NULL) {
+        const char *by = strchr(div, '\n') + 1;
+        size_t name_len = strcspn(key, ":");
+
+        if(strlen(by) != name_len || strncmp(by, key, name_len) != 0) {
+            char *to = g_strndup(div, (gsize)(by - 1 - div));
+            builder_add(b, to, line);
+            g_free(to);
+            return;
+        }
+    }
+    builder_add(b, path, line);
+}
+
+int pkg_owner_index_build_dpkg(const char *admindir, pkg_owner_index **out)
+{
+    struct index_builder b;
+    GHashTable *packages = NULL, *diversions = NULL;
+    char *infodir = g_build_filename(admindir, "info", NULL);
+    char *line = NULL;
+    size_t len = 0;
+    struct dirent *dent;
+    DIR *dir = NULL;
+    int ret;
+
+    builder_init(&b);
+    if((ret = dpkg_read_status(&b, admindir, &packages)) != 0) {
+        goto out;
+    }
+    diversions = dpkg_read_diversions(admindir);
+
+    if((dir = opendir(infodir)) == NULL) {
+        ret = -errno;
+        dlog(1, "Failed to open %s: %s\n", infodir, strerror(-ret));
+        goto out;
+    }
+    while((dent = readdir(dir)) != NULL) {
+        size_t name_len = strlen(dent->d_name);
+        const char *pkg_line;
+        char *key, *path;
+        FILE *fp;
+
+        if(name_len <= 5 || strcmp(dent->d_name + name_len - 5, ".list") != 0) {
+            continue;
+        }
+        key = g_strndup(dent->d_name, name_len - 5);
+        if((pkg_line = g_hash_table_lookup(packages, key)) == NULL) {
+            dlog(4, "No status for package %s, skipping its files\n", key);
+            g_free(key);
+            continue;
+        }
+        path = g_build_filename(infodir, dent->d_name, NULL);
+        if((fp = fopen(path, "r")) != NULL) {
+            while(getline(&line, &len, fp) != -1) {
+                g_strchomp(line);
+                dpkg_add_path(&b, diversions, key, line, pkg_line);
+            }
+            fclose(fp);
+        } else {
+            dlog(2, "Failed to open %s: %s\n", path, strerror(errno));
+        }
+        g_free(path);
+        g_free(key);
+    }
+
+    ret = builder_finish(&b, out);
+
+out:
+    if(dir != NULL) {
+        closedir(dir);
+    }
+    if(packages != NULL) {
+        g_hash_table_destroy(packages);
+    }
+    if(diversions != NULL) {
+        g_hash_table_destroy(diversions);
+    }
+    free(line);
+    g_free(infodir);
+    builder_clear(&b);
+    return ret;
+}
+
+int pkg_owner_index_build_rpm(pkg_owner_index **out)
+{
+    struct index_builder b;
+    char *line = NULL;
+    size_t len = 0;
+    int fds[2];
+    int status;
+    FILE *fp;
+    pid_t p;
+    int ret;
+
+    if(pipe(fds) < 0) {
+        return -errno;
+    }
+    if((p = fork()) < 0) {
+        ret = -errno;
+        close(fds[0]);
+        close(fds[1]);
+        return ret;
+    } else if(p == 0) {
+        close(fds[0]);
+        if(dup2(fds[1], STDOUT_FILENO) >= 0) {
+            execl("/usr/bin/rpm", "/usr/bin/rpm", "-qa", "--qf", RPM_QUERY_FORMAT, NULL);
+        }
+        _exit(127);
+    }
+    close(fds[1]);
+    if((fp = fdopen(fds[0], "r")) == NULL) {
+        ret = -errno;
+        close(fds[0]);
+        waitpid(p, NULL, 0);
+        return ret;
+    }
+
+    /* <path>\t<name>\t<version>-<release>\t<arch>; packages without files list "(none)" */
+    builder_init(&b);
+    while(getline(&line, &len, fp) != -1) {
+        char *tab = strchr(g_strchomp(line), '\t');
+        if(tab == NULL) {
+            continue;
+        }
+        *tab = '\0';
+        builder_add(&b, line, g_string_chunk_insert_const(b.strings, tab + 1));
+    }
+    free(line);
+    fclose(fp);
+
+    if(waitpid(p, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        dlog(1, "rpm query of all package files failed\n");
+        ret = -EIO;
+    } else {
+        ret = builder_finish(&b, out);
+    }
+    builder_clear(&b);
+    return ret;
+}
+
+int pkg_owner_index_save(const pkg_owner_index *idx, const char *path)
+{
+    char *tmp = g_strdup_printf("%s.XXXXXX", path);
+    size_t done = 0;
+    ssize_t n;
+    int fd, ret = 0;
+
+    if((fd = mkstemp(tmp)) < 0) {
+        ret = -errno;
+        g_free(tmp);
+        return ret;
+    }
+    while(done < idx->size) {
+        if((n = write(fd, idx->base + done, idx->size - done)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            ret = -errno;
+            break;
+        }
+        done += (size_t)n;
+    }
+    if(close(fd) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    if(ret == 0 && rename(tmp, path) != 0) {
+        ret = -errno;
+    }
+    if(ret != 0) {
+        unlink(tmp);
+    }
+    g_free(tmp);
+    return ret;
+}
+
+int pkg_owner_index_load(const char *path, pkg_owner_index **out)
+{
+    const struct pkg_owner_index_header *hdr;
+    const struct pkg_owner_entry *entries;
+    pkg_owner_index *idx;
+    struct stat st;
+    void *base;
+    uint32_t i;
+    int fd, ret;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -errno;
+    }
+    if(fstat(fd, &st) != 0) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    if((size_t)st.st_size < sizeof(*hdr) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return -EINVAL;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        return -errno;
+    }
+
+    hdr = base;
+    if(memcmp(hdr->magic, PKG_OWNER_INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != PKG_OWNER_INDEX_VERSION ||
+            hdr->count > ((size_t)st.st_size - sizeof(*hdr)) / sizeof(struct pkg_owner_entry) ||
+            ((char *)base)[st.st_size - 1] != '\0') {
+        goto invalid;
+    }
+    /* the last byte is a NUL, so in-bounds offsets are terminated strings */
+    entries = (const struct pkg_owner_entry *)((char *)base + sizeof(*hdr));
+    for(i = 0; i < hdr->count; i++) {
+        if(entries[i].path >= st.st_size || entries[i].line >= st.st_size) {
+            goto invalid;
+        }
+    }
+
+    if((idx = calloc(1, sizeof(*idx))) == NULL) {
+        munmap(base, (size_t)st.st_size);
+        return -ENOMEM;
+    }
+    idx->base    = base;
+    idx->size    = (size_t)st.st_size;
+    idx->count   = hdr->count;
+    idx->entries = entries;
+    idx->mapped  = 1;
+    *out = idx;
+    return 0;
+
+invalid:
+    dlog(1, "%s is not a package owner index\n", path);
+    munmap(base, (size_t)st.st_size);
+    return -EINVAL;
+}
+
+int pkg_owner_index_open_cached(const char *graph_path,
+                                int (*build)(pkg_owner_index **out),
+                                pkg_owner_index **out)
+{
+    char *path = g_build_filename(graph_path, PKG_OWNER_INDEX_FILE, NULL);
+    int ret;
+
+    if((ret = pkg_owner_index_load(path, out)) == 0) {
+        dlog(5, "Using package owner index %s\n", path);
+        g_free(path);
+        return 0;
+    }
+    if((ret = build(out)) == 0) {
+        dlog(4, "Built package owner index of %u paths\n", (*out)->count);
+        if(pkg_owner_index_save(*out, path) != 0) {
+            dlog(2, "Failed to cache package owner index at %s\n", path);
+        }
+    }
+    g_free(path);
+    return ret;
+}
+
+static const char *index_find(const pkg_owner_index *idx, const char *path)
+{
+    uint32_t lo = 0, hi = idx->count;
+
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(path, idx->base + idx->entries[mid].path);
+        if(cmp == 0) {
+            return idx->base + idx->entries[mid].line;
+        } else if(cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+const char *pkg_owner_index_lookup(const pkg_owner_index *idx, const char *path)
+{
+    char resolved[PATH_MAX];
+    const char *line;
+
+    if((line = index_find(idx, path)) != NULL) {
+        return line;
+    }
+    if(realpath(path, resolved) != NULL && strcmp(resolved, path) != 0) {
+        return index_find(idx, resolved);
+    }
+    return NULL;
+}
+
+size_t pkg_owner_index_size(const pkg_owner_index *idx)
+{
+    return idx->count;
+}
+
+void pkg_owner_index_free(pkg_owner_index *idx)
+{
+    if(idx == NULL) {
+        return;
+    }
+    if(idx->mapped) {
+        munmap(idx->base, idx->size);
+    } else {
+        free(idx->base);
+    }
+    free(idx);
+}
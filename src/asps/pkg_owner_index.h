@@ -0,0 +1,108 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __PKG_OWNER_INDEX_H__
+#define __PKG_OWNER_INDEX_H__
+
+/*! \file
+ * A reverse index from file paths to the installed packages owning
+ * them, read once from the package database instead of asking the
+ * package manager about each file.
+ *
+ * Each path maps to the line describing its package in the format the
+ * inventory ASP already parses: "<status> <name> <version> <arch>" as
+ * printed by dpkg-query --list for dpkg, and
+ * "<name>\t<version>-<release>\t<arch>" for rpm.
+ *
+ * An index is flattened into one sorted buffer, which can be written
+ * next to a measurement graph and mapped back in by later ASPs of the
+ * same attestation, so the database is only read once.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PKG_OWNER_DPKG_ADMINDIR	"/var/lib/dpkg"
+
+/*! Name of the cached index in a measurement graph's directory */
+#define PKG_OWNER_INDEX_FILE	"pkg_owner.index"
+
+typedef struct pkg_owner_index pkg_owner_index;
+
+/**
+ * Build an index from the dpkg database in @admindir (normally
+ * PKG_OWNER_DPKG_ADMINDIR): the owners from info/<package>.list, the
+ * package lines from status, with the diversions file applied so a
+ * diverted file maps to the package that actually put it on disk.
+ * Paths are also indexed under their canonical directory, so files
+ * listed under /lib or /bin are found on merged-/usr systems.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int pkg_owner_index_build_dpkg(const char *admindir, pkg_owner_index **out);
+
+/**
+ * Build an index from a single query of the rpm database listing
+ * every file of every installed package.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int pkg_owner_index_build_rpm(pkg_owner_index **out);
+
+/**
+ * Write @idx to @path, replacing any file already there atomically.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int pkg_owner_index_save(const pkg_owner_index *idx, const char *path);
+
+/**
+ * Map an index written by pkg_owner_index_save().
+ *
+ * Returns 0 on success, -ENOENT if there is no such file or -EINVAL if
+ * it is not an index.
+ */
+int pkg_owner_index_load(const char *path, pkg_owner_index **out);
+
+/**
+ * Load the index cached in the directory of the measurement graph at
+ * @graph_path, or build one with @build and cache it there for the
+ * next ASP of the attestation. Failing to write the cache is not an
+ * error.
+ *
+ * Returns 0 on success or a negative errno from @build.
+ */
+int pkg_owner_index_open_cached(const char *graph_path,
+                                int (*build)(pkg_owner_index **out),
+                                pkg_owner_index **out);
+
+/**
+ * Find the package line for @path. If @path itself is not owned by a
+ * package but resolves through symbolic links to a path that is, as
+ * the links managed by update-alternatives do, the owner of that path
+ * is returned.
+ *
+ * Returns a string owned by @idx, or NULL if no package owns @path.
+ */
+const char *pkg_owner_index_lookup(const pkg_owner_index *idx, const char *path);
+
+/** Number of paths in @idx */
+size_t pkg_owner_index_size(const pkg_owner_index *idx);
+
+void pkg_owner_index_free(pkg_owner_index *idx);
+
+#endif /* __PKG_OWNER_INDEX_H__ */
@@ -18,6 +18,14 @@
 /*! \file
  * This ASP reads a range of memory from a running process and produces a sha1
  * hash of its contents
+ *
+ * In "pagehash" mode the range is split on page boundaries and the
+ * result is the sha256 of the concatenated sha256 digests of the
+ * pieces. Pages of read-only file mappings that /proc/PID/pagemap
+ * shows to be unmodified page cache pages are looked up by file
+ * (device, inode and mtime) and offset in a cache kept in the
+ * measurement graph, so a shared library page is read and hashed once
+ * per attestation however many processes map it.
  */
 
 #include <stdio.h>
@@ -33,6 +41,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 
 #include <inttypes.h>
 #include <glib.h>
@@ -51,6 +60,54 @@
 #define ASP_NAME "procmem"
 #define MSMT "PASS"
 
+/* /proc/PID/pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst */
+#define PAGEMAP_PRESENT		(1ULL << 63)
+#define PAGEMAP_SWAPPED		(1ULL << 62)
+#define PAGEMAP_FILE		(1ULL << 61)
+
+/* pagemap entries read at a time */
+#define PAGEMAP_BATCH		512
+
+/* kept in the graph directory, so it goes away with the graph */
+#define PAGE_CACHE_FILE		"procmem-page.cache"
+
+/*
+ * A page of a file as of its last modification. Writing to a file
+ * updates its mtime, so a key never names two different contents.
+ */
+typedef struct page_key {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t offset;		/* in pages */
+} page_key;
+
+/*
+ * Digests of file pages hashed during this attestation. The cache
+ * file is a sequence of these records, appended to by each procmem
+ * run.
+ */
+typedef struct page_record {
+    page_key key;
+    uint8_t digest[SHA256_TYPE_LEN];
+} page_record;
+
+typedef struct page_cache {
+    GHashTable *records;	/* &page_record.key -> page_record */
+    GArray *added;		/* page_records to append to the file */
+    char *path;
+    uint64_t hits;
+} page_cache;
+
+/* a read-only file mapping of the measured process */
+typedef struct file_mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;		/* in pages */
+    page_key file;		/* offset unused */
+} file_mapping;
+
 int asp_init(int argc UNUSED, char *argv[] UNUSED)
 {
     asp_loginfo("Initialized "ASP_NAME" ASP\n");
@@ -243,6 +300,406 @@ proc_pid_path_error:
     return 0;
 }
 
+static guint page_key_hash(gconstpointer p)
+{
+    const page_key *k = p;
+    return g_int64_hash(&k->ino) ^ g_int64_hash(&k->offset) ^
+           g_int64_hash(&k->mtime_nsec);
+}
+
+static gboolean page_key_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(page_key)) == 0;
+}
+
+static void page_cache_free(page_cache *cache)
+{
+    if(cache->records != NULL) {
+        g_hash_table_destroy(cache->records);
+    }
+    if(cache->added != NULL) {
+        g_array_free(cache->added, TRUE);
+    }
+    g_free(cache->path);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void page_cache_insert(page_cache *cache, const page_key *key,
+                              const uint8_t digest[SHA256_TYPE_LEN])
+{
+    page_record *rec = g_malloc(sizeof(*rec));
+
+    rec->key = *key;
+    memcpy(rec->digest, digest, SHA256_TYPE_LEN);
+    g_hash_table_replace(cache->records, &rec->key, rec);
+}
+
+/*
+ * Load the records saved in the graph at @graph_path by earlier runs.
+ * A missing file is an empty cache.
+ */
+static int page_cache_init(page_cache *cache, const char *graph_path)
+{
+    unsigned char *buf;
+    size_t size = 0;
+    size_t off;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->records = g_hash_table_new_full(page_key_hash, page_key_equal, NULL, g_free);
+    cache->added   = g_array_new(FALSE, FALSE, sizeof(page_record));
+    cache->path    = g_strdup_printf("%s/"PAGE_CACHE_FILE, graph_path);
+
+    if(!file_exists(cache->path)) {
+        return 0;
+    }
+
+    if((buf = file_to_buffer(cache->path, &size)) == NULL) {
+        asp_logwarn("Failed to read page digest cache %s\n", cache->path);
+        return -1;
+    }
+    /* a record cut short by a concurrent writer is ignored */
+    for(off = 0; off + sizeof(page_record) <= size; off += sizeof(page_record)) {
+        page_record *rec = (page_record *)(buf + off);
+        page_cache_insert(cache, &rec->key, rec->digest);
+    }
+    free(buf);
+
+    asp_logdebug("Loaded %u page digests from %s\n",
+                 g_hash_table_size(cache->records), cache->path);
+    return 0;
+}
+
+/*
+ * Append the digests computed by this run to the cache file. Other
+ * procmem instances may be appending at the same time, so the file is
+ * locked and the records written with a single write().
+ */
+static int page_cache_save(page_cache *cache)
+{
+    size_t len = cache->added->len * sizeof(page_record);
+    int fd;
+    int rc = 0;
+
+    if(len == 0) {
+        return 0;
+    }
+
+    if((fd = open(cache->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+        asp_logwarn("Failed to open page digest cache %s: %s\n", cache->path,
+                    strerror(errno));
+        return -1;
+    }
+    if(flock(fd, LOCK_EX) != 0 ||
+            write(fd, cache->added->data, len) != (ssize_t)len) {
+        asp_logwarn("Failed to update page digest cache %s: %s\n", cache->path,
+                    strerror(errno));
+        rc = -1;
+    }
+    close(fd);
+    return rc;
+}
+
+/*
+ * Identify the file behind a mapping. map_files gives the mapped file
+ * itself; where it cannot be read the mapped path is used, as long as
+ * it still names the same inode.
+ */
+static int stat_mapped_file(pid_t pid, uint64_t start, uint64_t end,
+                            const char *path, dev_t dev, ino_t ino, page_key *file)
+{
+    char link[PATH_MAX];
+    struct stat st;
+
+    snprintf(link, sizeof(link), "/proc/%d/map_files/%"PRIx64"-%"PRIx64,
+             pid, start, end);
+    if(stat(link, &st) != 0 &&
+            (stat(path, &st) != 0 || st.st_dev != dev || st.st_ino != ino)) {
+        return -1;
+    }
+
+    memset(file, 0, sizeof(*file));
+    file->dev        = (uint64_t)st.st_dev;
+    file->ino        = (uint64_t)st.st_ino;
+    file->mtime_sec  = (int64_t)st.st_mtim.tv_sec;
+    file->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/*
+ * Collect the read-only file mappings of @pid that overlap
+ * [address, end). Writable mappings are left out: a MAP_SHARED one
+ * may change the file without changing its mtime.
+ */
+static GArray *read_file_mappings(pid_t pid, uint64_t address, uint64_t end)
+{
+    char path[PATH_MAX];
+    char *line = NULL;
+    size_t n = 0;
+    GArray *maps = g_array_new(FALSE, FALSE, sizeof(file_mapping));
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    if((fp = fopen(path, "re")) == NULL) {
+        asp_logwarn("Failed to open %s: %s\n", path, strerror(errno));
+        return maps;
+    }
+
+    while(getline(&line, &n, fp) > 0) {
+        uint64_t start, stop, offset, ino;
+        unsigned int dmajor, dminor;
+        char perms[5];
+        int name = 0;
+        file_mapping m;
+
+        if(sscanf(line, "%"SCNx64"-%"SCNx64" %4s %"SCNx64" %x:%x %"SCNu64" %n",
+                  &start, &stop, perms, &offset, &dmajor, &dminor, &ino, &name) < 7 ||
+                name == 0 || stop <= address || start >= end) {
+            continue;
+        }
+        g_strchomp(line + name);
+        if(perms[1] != '-' || ino == 0 || line[name] != '/') {
+            continue;
+        }
+        if(stat_mapped_file(pid, start, stop, line + name,
+                            makedev(dmajor, dminor), (ino_t)ino, &m.file) != 0) {
+            continue;
+        }
+        m.start  = start;
+        m.end    = stop;
+        m.offset = offset / (uint64_t)sysconf(_SC_PAGESIZE);
+        g_array_append_val(maps, m);
+    }
+
+    free(line);
+    fclose(fp);
+    return maps;
+}
+
+/*
+ * Find the file page mapped at @addr, if it is one that can be
+ * cached. Only page cache pages are: a private mapping's page that
+ * was ever written to is an anonymous copy.
+ */
+static int file_page_key(GArray *maps, uint64_t addr, uint64_t entry,
+                         uint64_t page_size, page_key *key)
+{
+    guint i;
+
+    if(!(entry & PAGEMAP_PRESENT) || (entry & PAGEMAP_SWAPPED) ||
+            !(entry & PAGEMAP_FILE)) {
+        return 0;
+    }
+    for(i = 0; i < maps->len; i++) {
+        file_mapping *m = &g_array_index(maps, file_mapping, i);
+        if(addr >= m->start && addr < m->end) {
+            *key = m->file;
+            key->offset = m->offset + (addr - m->start) / page_size;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int read_pagemap(int fd, uint64_t first_page, uint64_t *entries, size_t count)
+{
+    size_t want = count * sizeof(uint64_t);
+    ssize_t rd;
+
+    if(fd < 0) {
+        return -1;
+    }
+    rd = pread(fd, entries, want, (off_t)(first_page * sizeof(uint64_t)));
+    if(rd < 0) {
+        return -1;
+    }
+    /* entries past the end of the address space read as not present */
+    if((size_t)rd < want) {
+        memset((char *)entries + rd, 0, want - (size_t)rd);
+    }
+    return 0;
+}
+
+static int hash_piece(int memfd, uint64_t address, size_t len, unsigned char *page,
+                      uint8_t digest[SHA256_TYPE_LEN])
+{
+    GChecksum *csum;
+    gsize dlen = SHA256_TYPE_LEN;
+    ssize_t rd;
+
+    /*
+     * Non-present pages are read as well: the kernel faults them in
+     * (or supplies the zero page) just as a plain read of the range
+     * would.
+     */
+    rd = pread(memfd, page, len, (off_t)address);
+    if(rd != (ssize_t)len) {
+        asp_logerror("Failed to read %zu bytes at %016"PRIx64": %s\n", len, address,
+                     rd < 0 ? strerror(errno) : "short read");
+        return -1;
+    }
+
+    csum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(csum, page, len);
+    g_checksum_get_digest(csum, digest, &dlen);
+    g_checksum_free(csum);
+    return 0;
+}
+
+/*
+ * Compute the page tree digest of [address, address + length) of
+ * @pid, which must already be stopped. Whole file pages found in
+ * @cache are not read; digests of newly hashed file pages are added to
+ * it.
+ */
+static int pagehash_process_memory(pid_t pid, uint64_t address, uint64_t length,
+                                   page_cache *cache, sha256_measurement_data *hashdata)
+{
+    char path[PATH_MAX];
+    uint64_t entries[PAGEMAP_BATCH];
+    uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t end = address + length;
+    uint64_t batch_start = 0;
+    uint64_t batch_len = 0;
+    uint64_t addr;
+    unsigned char *page = NULL;
+    GArray *maps = NULL;
+    GChecksum *root = NULL;
+    gsize dlen = SHA256_TYPE_LEN;
+    int memfd = -1;
+    int pmfd = -1;
+    int rc = -1;
+
+    if(length == 0 || end < address) {
+        asp_logerror("Invalid memory range\n");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+    if((memfd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        asp_logerror("failed to open file %s for hashing : %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    if((pmfd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        asp_logwarn("Failed to open %s (%s), hashing every page\n", path, strerror(errno));
+    } else {
+        maps = read_file_mappings(pid, address, end);
+    }
+
+    if((page = malloc(page_size)) == NULL) {
+        asp_logerror("Failed to allocate page buffer\n");
+        goto out;
+    }
+    root = g_checksum_new(G_CHECKSUM_SHA256);
+
+    for(addr = address; addr < end; ) {
+        uint64_t page_index = addr / page_size;
+        uint64_t next = (page_index + 1) * page_size;
+        size_t len = (size_t)((next < end ? next : end) - addr);
+        uint8_t digest[SHA256_TYPE_LEN];
+        page_record *rec = NULL;
+        page_key key;
+        int cacheable = 0;
+
+        if(page_index >= batch_start + batch_len) {
+            uint64_t last_page = (end - 1) / page_size;
+            batch_start = page_index;
+            batch_len = MIN(last_page - page_index + 1, PAGEMAP_BATCH);
+            if(read_pagemap(pmfd, batch_start, entries, batch_len) != 0) {
+                if(pmfd >= 0) {
+                    asp_logwarn("Failed to read pagemap (%s), hashing every page\n",
+                                strerror(errno));
+                    close(pmfd);
+                    pmfd = -1;
+                }
+                memset(entries, 0, sizeof(entries));
+            }
+        }
+
+        /* partial pages at either end of the range are never cached */
+        if(len == page_size && maps != NULL) {
+            cacheable = file_page_key(maps, addr, entries[page_index - batch_start],
+                                      page_size, &key);
+            if(cacheable) {
+                rec = g_hash_table_lookup(cache->records, &key);
+            }
+        }
+
+        if(rec != NULL) {
+            memcpy(digest, rec->digest, SHA256_TYPE_LEN);
+            cache->hits++;
+        } else {
+            if(hash_piece(memfd, addr, len, page, digest) != 0) {
+                goto out;
+            }
+            if(cacheable) {
+                page_record new_rec = {.key = key};
+                memcpy(new_rec.digest, digest, SHA256_TYPE_LEN);
+                g_array_append_val(cache->added, new_rec);
+                page_cache_insert(cache, &key, digest);
+            }
+        }
+        g_checksum_update(root, digest, SHA256_TYPE_LEN);
+        addr += len;
+    }
+
+    g_checksum_get_digest(root, hashdata->sha256_hash, &dlen);
+    rc = 0;
+
+out:
+    if(root != NULL) {
+        g_checksum_free(root);
+    }
+    free(page);
+    if(maps != NULL) {
+        g_array_free(maps, TRUE);
+    }
+    if(pmfd >= 0) {
+        close(pmfd);
+    }
+    close(memfd);
+    return rc;
+}
+
+static int attachAndPagehashProcessMemory(measurement_graph *graph, node_id_t node_id,
+        const char *graph_path, sha256_measurement_data *hashdata)
+{
+    char filename[PATH_MAX + 1] =       {0};
+    uint64_t address =                  0;
+    uint64_t length =                   0;
+    pid_t traced_process =              0;
+    page_cache cache;
+    int rc = -1;
+
+    if (build_procpidpath(graph, node_id, filename, &traced_process, &address, &length) != 0) {
+        return -1;
+    }
+
+    page_cache_init(&cache, graph_path);
+
+    if (ptrace_attach_and_wait(traced_process) != 0) {
+        goto out;
+    }
+
+    rc = pagehash_process_memory(traced_process, address, length, &cache, hashdata);
+
+    if (ptrace(PTRACE_DETACH, traced_process, NULL, NULL) != 0) {
+        asp_logerror("Detach %s\n", strerror(errno));
+        rc = -1;
+    }
+
+    if (rc == 0) {
+        asp_loginfo("Hashed %"PRIu64" bytes, %"PRIu64" pages from the page digest cache\n",
+                    length, cache.hits);
+        page_cache_save(&cache);
+    }
+
+out:
+    page_cache_free(&cache);
+    return rc;
+}
+
 static int performHash(unsigned char * buffer, uint64_t length, sha256_measurement_data * hashdata)
 {
 
@@ -299,23 +756,40 @@ int asp_measure(int argc, char *argv[])
     unsigned char * buffer			= NULL;
     uint64_t length			= 0;
     int nohash                          = 0;
+    int pagehash                        = 0;
     marshalled_data *md                 = NULL;
 
     if((argc < 3) ||
             ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
             (map_measurement_graph(argv[1], &graph) != 0)) {
-        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> [<nohash>]\n");
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> [<nohash> | <pagehash>]\n");
         goto err;
     }
 
-    if (argc == 4) {
+    if (argc >= 4) {
         if (strcmp(argv[3], "nohash") == 0) {
             nohash = 1;
+        } else if (strcmp(argv[3], "pagehash") == 0) {
+            pagehash = 1;
         }
     }
 
     dlog(2,"Reading from node_id 0x%lx\n", node_id);
 
+    if (pagehash) {
+        hashdata = createHashMeasurement();
+        if (hashdata == NULL) {
+            asp_logerror(""ASP_NAME": Could Not Allocate SHA 256 Measurement Type\n");
+            goto err;
+        }
+        if (attachAndPagehashProcessMemory(graph, node_id, argv[1], hashdata) != 0) {
+            asp_logerror(""ASP_NAME": Could Not Attach or Hash Memory From Process\n");
+            goto err;
+        }
+        md = marshall_measurement_data(&hashdata->meas_data);
+        goto add_data;
+    }
+
     length = attachAndReadProcessMemory(graph, node_id, &buffer);
     if (length == 0) {
         asp_logerror(""ASP_NAME": Could Not Attach or Read Memory From Process\n");
@@ -363,6 +837,7 @@ int asp_measure(int argc, char *argv[])
     free(buffer);
     buffer = NULL;
 
+add_data:
     if (md == NULL) {
         asp_logerror(""ASP_NAME": Could Not Serialize Data\n");
         goto err;
@@ -20,7 +20,9 @@
  *   In the default behavior, this ASP takes inventory of all packages installed on the
  *      system, by querying rpm.
  *   If the address type is a file, this ASP will find the corresponding package on the
- *      system and add it to the graph.
+ *      system and add it to the graph. Several comma separated file nodes may be passed
+ *      at once; their owners are all found in one index of the rpm database (see
+ *      pkg_owner_index.h) rather than by an rpm -qf per file.
  *   Otherwise, if a char * string is passed to the ASP, this ASP will use it to
  *      inventory all of the matching packages installed on the system.
  *      NOTE: Unlike the dpkg_inv ASP, this ASP does not support wildcard characters
@@ -49,6 +51,8 @@
 #include <address_space/simple_file.h>
 #include <common/asp-errno.h>
 
+#include "pkg_owner_index.h"
+
 #include <sys/types.h>
 
 #define ASP_NAME "rpm_inv"
@@ -145,6 +149,119 @@ error_pipe:
 }
 
 
+static int build_rpm_index(pkg_owner_index **out)
+{
+    return pkg_owner_index_build_rpm(out);
+}
+
+/**
+ * Adds the package owning the file at @node_id, found in @idx or, if
+ * there is no index, with rpm -qf.
+ */
+static int measure_file_node(measurement_graph *graph, node_id_t node_id,
+                             pkg_owner_index *idx)
+{
+    address *address           = measurement_node_get_address(graph, node_id);
+    measurement_data *inv_data = NULL;
+    const char *owner          = NULL;
+    char *filename             = NULL;
+    char *line                 = NULL;
+    size_t len                 = 0;
+    FILE *fp                   = NULL;
+    int ret_val                = 0;
+
+    if(address == NULL || address->space != &simple_file_address_space ||
+            (filename = (container_of(address, simple_file_address, a))->filename) == NULL) {
+        dlog(0, "Error: Could not find file to evaluate for node "ID_FMT"\n", node_id);
+        ret_val = -EINVAL;
+        goto out;
+    }
+    dlog(6, "\t with file: %s\n", filename);
+
+    if(idx != NULL) {
+        if((owner = pkg_owner_index_lookup(idx, filename)) != NULL) {
+            dlog(5, "Found package: %s\n", owner);
+            if((line = strdup(owner)) == NULL) {
+                ret_val = -ENOMEM;
+                goto out;
+            }
+            add_package_node(graph, node_id, line);
+        }
+    } else {
+        if((fp = exec_list_pkgs("-qf", filename)) == NULL) {
+            dlog(0, "Error exec'ing\n");
+            ret_val = -EIO;
+            goto out;
+        }
+        while(getline(&line, &len, fp) != -1) {
+            //rpm error message when file is not owned by package is
+            //'file <file> is not owned by any package'
+            if(strstr(line, "is not owned by any package")) {
+                break;
+            }
+            dlog(5, "Found package: %s", line);
+            add_package_node(graph, node_id, line);
+        }
+        fclose(fp);
+    }
+
+    inv_data = alloc_measurement_data(&pkginv_measurement_type);
+    if(!inv_data) {
+        dlog(0, "pkg inv measurement type alloc error\n");
+        ret_val = -ENOMEM;
+        goto out;
+    }
+    if((ret_val = measurement_node_add_rawdata(graph, node_id, inv_data)) < 0) {
+        dlog(0, "Error while adding data to node : %d\n", ret_val);
+        ret_val = ASP_APB_ERROR_GRAPHOPERATION;
+    }
+    free_measurement_data(inv_data);
+
+out:
+    free(line);
+    free_address(address);
+    return ret_val;
+}
+
+/**
+ * Finds the packages owning the files at each of the comma separated
+ * @node_ids from one package owner index, built by a single rpm query
+ * on first use and cached with the graph for the rest of the
+ * attestation.
+ */
+static int measure_file_nodes(measurement_graph *graph, const char *graph_path,
+                              const char *node_ids)
+{
+    pkg_owner_index *idx = NULL;
+    char **ids           = g_strsplit(node_ids, ",", -1);
+    node_id_t node_id;
+    int ret_val = 0;
+    int rc;
+    int i;
+
+    if(pkg_owner_index_open_cached(graph_path, build_rpm_index, &idx) != 0) {
+        dlog(2, "Failed to index package files, falling back to rpm -qf\n");
+        idx = NULL;
+    }
+
+    /* a file that fails is left without pkginv data, the others are still measured */
+    for(i = 0; ids[i] != NULL; i++) {
+        if((node_id = node_id_of_str(ids[i])) == INVALID_NODE_ID) {
+            dlog(0, "Error: invalid node id %s\n", ids[i]);
+            rc = -EINVAL;
+        } else {
+            rc = measure_file_node(graph, node_id, idx);
+        }
+        if(rc != 0 && ret_val == 0) {
+            ret_val = rc;
+        }
+    }
+
+    pkg_owner_index_free(idx);
+    g_strfreev(ids);
+    return ret_val;
+}
+
 int asp_measure(int argc, char *argv[])
 {
     dlog(6, "IN rpm_inv ASP MEASURE\n");
@@ -162,11 +279,24 @@ int asp_measure(int argc, char *argv[])
     if((argc < 3) ||
             ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
             (map_measurement_graph(argv[1], &graph) != 0)) {
-        asp_logerror("Usage: "ASP_NAME" <graph path> <node id>\n");
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id>[,<node id>...] [pattern]\n");
         return -EINVAL;
     }
 
-    dlog(6, "Measuring node "ID_FMT" of graph @ %s\n", node_id, argv[1]);
+    dlog(6, "Measuring node(s) %s of graph @ %s\n", argv[2], argv[1]);
+
+    /*
+     * If the address space is a filename, find the package owning the
+     * file (or each file, if several nodes were passed).
+     */
+    address = measurement_node_get_address(graph, node_id);
+    if(address && address->space == &simple_file_address_space) {
+        free_address(address);
+        ret_val = measure_file_nodes(graph, argv[1], argv[2]);
+        unmap_measurement_graph(graph);
+        return ret_val == 0 ? ASP_APB_SUCCESS : ret_val;
+    }
+    free_address(address);
 
     inv_data = alloc_measurement_data(&pkginv_measurement_type);
     if(!inv_data) {
@@ -178,22 +308,9 @@ int asp_measure(int argc, char *argv[])
     dlog(6, "Looking for all packages on the system\n");
 
     /*
-     * If the address space is a filename, find the package owning the file.
-     * Else, take inventory of all packages on the system
+     * Take inventory of all packages on the system
      */
-    address = measurement_node_get_address(graph, node_id);
-    if(address && address->space == &simple_file_address_space) {
-        char *filename = (container_of(address, simple_file_address, a))->filename;
-        if(!filename) {
-            dlog(0, "Error: Could not find file to evaluate\n");
-            ret_val = -1;
-            goto error_argument;
-        }
-
-        dlog(6, "\t with file: %s\n", filename);
-
-        fp = exec_list_pkgs("-qf", filename);
-    } else if (argc == 4) {
+    if (argc == 4) {
         /* Note: RPM doesn't support wildcards or partial matches. */
         dlog(0, "\t matching pattern: %s\n", argv[3]);
         fp = exec_list_pkgs("-q", argv[3]);
@@ -201,7 +318,6 @@ int asp_measure(int argc, char *argv[])
         fp = exec_list_pkgs("-qa", NULL);
     }
 
-    free_address(address);
     if(!fp) {
         dlog(0, "Error exec'ing\n");
         ret_val = -EIO;
@@ -241,8 +357,6 @@ cleanup:
     dlog(6, "rpm_inv ASP returning with success\n");
     return ASP_APB_SUCCESS;
 
-error_argument:
-    free_address(address);
 error_add_data:
 error_exec:
     free_measurement_data(inv_data);
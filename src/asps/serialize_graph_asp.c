@@ -18,7 +18,10 @@
 /*! \file
  * This ASP serializes a measurement graph passed and writes it to fd_out
  *
- * Usage: "ASP_NAME" <fd_in (unused)> <fd_out> <graph path>
+ * Usage: "ASP_NAME" <fd_in (unused)> <fd_out> <graph path> [filter rule ...]
+ *
+ * The optional filter rules select the part of the graph that is
+ * written, see serialize_measurement_graph_filtered().
  */
 
 #include <stdio.h>
@@ -64,11 +67,50 @@ int asp_exit(int status)
     return status;
 }
 
+/**
+ * Builds the export filter from the rules in @argv, or sets *@out to
+ * NULL if there are none.
+ */
+static int parse_filter(int argc, char *argv[], measurement_graph_filter **out)
+{
+    measurement_graph_filter *f;
+    int i, ret;
+
+    *out = NULL;
+    if(argc == 0) {
+        return 0;
+    }
+    if((f = new_measurement_graph_filter()) == NULL) {
+        return -ENOMEM;
+    }
+    for(i = 0; i < argc; i++) {
+        if((ret = measurement_graph_filter_add_rule(f, argv[i])) != 0) {
+            asp_logerror("Invalid export filter rule %s\n", argv[i]);
+            free_measurement_graph_filter(f);
+            return ret;
+        }
+    }
+    *out = f;
+    return 0;
+}
+
+static void log_export_stats(measurement_graph_export_stats *stats)
+{
+    asp_loginfo("Export filter kept %zu of %zu nodes, %zu of %zu edges and "
+                "%zu of %zu data (%"PRIu64" of %"PRIu64" bytes)\n",
+                stats->nodes_written, stats->nr_nodes,
+                stats->edges_written, stats->nr_edges,
+                stats->data_written, stats->nr_data,
+                stats->data_bytes_written, stats->data_bytes);
+}
+
 int asp_measure(int argc, char *argv[])
 {
     dlog(6, "IN serialize_graph ASP MEASURE\n");
 
     measurement_graph *graph = NULL;
+    measurement_graph_filter *filter = NULL;
+    measurement_graph_export_stats stats;
     unsigned char *evidence  = NULL;
     size_t evidence_size     = 0;
     size_t bytes_written;
@@ -78,12 +120,25 @@ int asp_measure(int argc, char *argv[])
     if((argc < 4)
             || ((fd_out = atoi(argv[2])) < 0)
             || (map_measurement_graph(argv[3], &graph) != 0)) {
-        asp_logerror("Usage: "ASP_NAME" <fd_in (UNUSED)> <fd_out> <graph path>\n");
+        asp_logerror("Usage: "ASP_NAME" <fd_in (UNUSED)> <fd_out> <graph path> [filter rule ...]\n");
         ret_val = -EINVAL;
         goto parse_args_failed;
     }
 
-    ret_val = serialize_measurement_graph(graph, &evidence_size, &evidence);
+    if((ret_val = parse_filter(argc - 4, argv + 4, &filter)) != 0) {
+        goto filter_failed;
+    }
+
+    if(filter == NULL) {
+        ret_val = serialize_measurement_graph(graph, &evidence_size, &evidence);
+    } else {
+        ret_val = serialize_measurement_graph_filtered(graph, filter, &evidence_size,
+                  &evidence, &stats);
+        if(ret_val == 0) {
+            log_export_stats(&stats);
+        }
+        free_measurement_graph_filter(filter);
+    }
     if(ret_val < 0) {
         asp_logerror("Error: Failed to serialize measurement graph\n");
         ret_val = -1;
@@ -114,6 +169,7 @@ write_failed:
 io_chan_failed:
     free(evidence);
 serialize_failed:
+filter_failed:
     destroy_measurement_graph(graph);
     close(fd_out);
 parse_args_failed:
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * This ASP appraises a TPM event log measurement: the log is replayed
+ * per PCR bank and the result must match the PCRs attested by the TPM
+ * quote in the measurement, which must be signed by the attester's AK
+ * and made over the nonce of this attestation. Every measured event
+ * must also carry a digest listed in the reference file. A reference
+ * file without digests fails every appraisal unless it says
+ * "replay-only".
+ *
+ * If a cache directory is passed as an optional sixth argument, the
+ * replay state of each log is saved there and a later appraisal of
+ * the same (or a grown) log only replays the events added since.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <openssl/evp.h>
+
+#include <util/util.h>
+#include <graph/graph-core.h>
+#include <common/asp-errno.h>
+#include <asp/asp-api.h>
+#include <maat-basetypes.h>
+#include <include/maat-envvars.h>
+#include <measurement/report_measurement_type.h>
+#include <measurement/tpm_eventlog_measurement_type.h>
+#include <measurement_spec/find_types.h>
+
+#include "tpm_eventlog_replay.h"
+
+#define ASP_NAME "tpm_eventlog_appraise_asp"
+
+#ifndef DEFAULT_ASP_DIR
+#define DEFAULT_ASP_DIR "."
+#endif
+
+#define REFERENCE_FN "tpm_eventlog.reference"
+
+static tpm_eventlog_refs refs;
+
+static char *get_aspinfo_dir(void)
+{
+    char *aspdir = getenv(ENV_MAAT_ASP_DIR);
+    if(aspdir == NULL) {
+        dlog(5, "Warning: environment variable ENV_MAAT_ASP_DIR not set. "
+             " Using default path %s\n", DEFAULT_ASP_DIR);
+        aspdir = DEFAULT_ASP_DIR;
+    }
+
+    return aspdir;
+}
+
+int asp_init(int argc UNUSED, char *argv[] UNUSED)
+{
+    char *path;
+    int count;
+
+    asp_loginfo("Initializing "ASP_NAME"\n");
+
+    register_types();
+
+    if(tpm_eventlog_refs_init(&refs) != 0) {
+        return -ENOMEM;
+    }
+
+    path = g_strdup_printf("%s/%s", get_aspinfo_dir(), REFERENCE_FN);
+    if(path == NULL) {
+        return -ENOMEM;
+    }
+    count = tpm_eventlog_refs_load(&refs, path);
+    if(count <= 0 && refs.replay_only) {
+        asp_loginfo("No reference digests in %s, events will not be checked\n", path);
+    } else if(count <= 0) {
+        asp_logwarn("No reference digests loaded from %s, event logs will fail appraisal\n",
+                    path);
+    } else {
+        asp_loginfo("Loaded %d reference digests from %s\n", count, path);
+    }
+    g_free(path);
+
+    return ASP_APB_SUCCESS;
+}
+
+int asp_exit(int status UNUSED)
+{
+    asp_loginfo("Exiting "ASP_NAME"\n");
+    tpm_eventlog_refs_free(&refs);
+    return ASP_APB_SUCCESS;
+}
+
+/*
+ * Saved replays are named after the digest of the log's Spec ID
+ * event. Logs from different machines may share a name; the replay
+ * code notices that the saved state is not a prefix of the log and
+ * starts over, so this only costs a cache miss.
+ */
+static char *cache_file_path(const char *cache_dir, const unsigned char *log,
+                             size_t size)
+{
+    tpm_eventlog_parser p;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    char *hex;
+    char *path;
+
+    if(tpm_eventlog_parser_init(&p, log, size) != 0 ||
+            EVP_Digest(log, p.header_size, digest, &len, EVP_sha256(), NULL) != 1 ||
+            (hex = bin_to_hexstr(digest, len)) == NULL) {
+        return NULL;
+    }
+    path = g_strdup_printf("%s/tpm_eventlog-%s.replay", cache_dir, hex);
+    free(hex);
+    return path;
+}
+
+static int appraise(tpm_eventlog_data *ted, const char *nonce, const char *akpubkey,
+                    const char *cache_dir, char **msg)
+{
+    tpm_eventlog_replay st;
+    char *cache_path = NULL;
+    int nr_new;
+    int mismatches;
+    int rc;
+    int ret = -1;
+
+    tpm_eventlog_replay_init(&st);
+
+    if(g_hash_table_size(refs.digests) == 0 && !refs.replay_only) {
+        *msg = g_strdup("No reference digests to check the TPM event log against");
+        goto out;
+    }
+
+    if(cache_dir != NULL) {
+        cache_path = cache_file_path(cache_dir, ted->log, ted->log_size);
+        if(cache_path == NULL) {
+            asp_logwarn("Unable to determine replay cache path, caching disabled\n");
+        } else if(tpm_eventlog_replay_load(&st, cache_path) == 0) {
+            asp_logdebug("Loaded saved replay of %"PRIu64" bytes\n", st.offset);
+        }
+    }
+
+    nr_new = tpm_eventlog_replay_log(&st, ted->log, ted->log_size, &refs);
+    if(nr_new < 0) {
+        *msg = g_strdup_printf("Failed to replay TPM event log: %s", strerror(-nr_new));
+        goto out;
+    }
+    asp_loginfo("Replayed %d new events (%"PRIu32" measured events in total)\n",
+                nr_new, st.nr_events);
+
+    if(cache_path != NULL) {
+        tpm_eventlog_replay_save(&st, cache_path);
+    }
+
+    if(ted->quote == NULL || ted->quote_sig == NULL) {
+        *msg = g_strdup("No TPM quote to check the TPM event log against");
+        goto out;
+    }
+
+    rc = tpm_eventlog_replay_check_quote(&st, ted->quote, ted->quote_size,
+                                         ted->quote_sig, ted->quote_sig_size,
+                                         nonce, akpubkey);
+    if(rc == -EPERM) {
+        /* the unauthenticated sysfs values can only say which PCRs differ */
+        mismatches = tpm_eventlog_replay_check_pcrs(&st, ted->pcrs);
+        *msg = g_strdup_printf("TPM event log does not replay to the quoted PCR values "
+                               "(%d of %u reported values differ)", mismatches,
+                               g_list_length(ted->pcrs));
+        goto out;
+    } else if(rc < 0) {
+        *msg = g_strdup("TPM quote of the event log PCRs could not be verified");
+        goto out;
+    }
+
+    if(st.nr_unmatched > 0) {
+        *msg = g_strdup_printf("%"PRIu32" of %"PRIu32" TPM events have no reference digest",
+                               st.nr_unmatched, st.nr_events);
+        goto out;
+    }
+
+    *msg = g_strdup_printf("TPM event log verified (%"PRIu32" events)", st.nr_events);
+    ret = 0;
+
+out:
+    tpm_eventlog_replay_release(&st);
+    g_free(cache_path);
+    return ret;
+}
+
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph;
+    node_id_t node_id;
+    magic_t data_type;
+    measurement_data *data = NULL;
+    report_data *rmd;
+    char *msg = NULL;
+    int ret;
+
+    if((argc < 6) ||
+            ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            ((sscanf(argv[3], MAGIC_FMT, &data_type)) != 1) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> <data type magic> "
+                     "<nonce> <akpubkey> [cache dir]\n");
+        return -EINVAL;
+    }
+
+    if(data_type != TPM_EVENTLOG_TYPE_MAGIC) {
+        unmap_measurement_graph(graph);
+        return -EINVAL;
+    }
+
+    ret = measurement_node_get_rawdata(graph, node_id,
+                                       &tpm_eventlog_measurement_type, &data);
+    if(ret < 0) {
+        asp_logerror("get data failed\n");
+        unmap_measurement_graph(graph);
+        return -EINVAL;
+    }
+
+    if(appraise(container_of(data, tpm_eventlog_data, d), argv[4], argv[5],
+                argc > 6 ? argv[6] : NULL, &msg) == 0) {
+        ret = ASP_APB_SUCCESS;
+        rmd = report_data_with_level_and_text(REPORT_INFO, strdup(msg), strlen(msg)+1);
+    } else {
+        asp_logwarn("%s\n", msg);
+        ret = ASP_APB_ERROR_GENERIC;
+        rmd = report_data_with_level_and_text(REPORT_ERROR, strdup(msg), strlen(msg)+1);
+    }
+
+    if(rmd != NULL) {
+        measurement_node_add_rawdata(graph, node_id, &rmd->d);
+        free_measurement_data(&rmd->d);
+    }
+
+    g_free(msg);
+    free_measurement_data(data);
+    unmap_measurement_graph(graph);
+    return ret;
+}
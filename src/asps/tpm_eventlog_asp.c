@@ -0,0 +1,287 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file tpm_eventlog_asp.c
+ * ASP to collect the TCG2 measured boot event log and the current PCR
+ * values from the kernel, along with a TPM quote of the SHA-256 PCRs
+ * the log extends made over the requester's nonce. The quote is what
+ * lets an appraiser trust the log; the sysfs PCR values are only
+ * there to help explain a mismatch.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <util/util.h>
+#ifdef USE_TPM
+#include <util/tpm2/tools/sign.h>
+#endif
+
+#include <asp/asp-api.h>
+#include <graph/graph-core.h>
+#include <common/asp-errno.h>
+#include <measurement/tpm_eventlog_measurement_type.h>
+#include <measurement_spec/find_types.h>
+#include <maat-basetypes.h>
+
+#ifndef ASP_NAME
+#define ASP_NAME "tpm_eventlog_asp"
+#endif
+
+#define EVENTLOG_PATH "/sys/kernel/security/tpm0/binary_bios_measurements"
+#define PCR_SYSFS_DIR "/sys/class/tpm/tpm0"
+
+/* firmware logs are typically tens of KiB; refuse anything absurd */
+#define EVENTLOG_MAX_SIZE (16 * 1024 * 1024)
+#define EVENTLOG_READ_CHUNK (64 * 1024)
+
+int asp_init(int argc UNUSED, char *argv[] UNUSED)
+{
+    asp_loginfo("Initializing "ASP_NAME"\n");
+
+    register_types();
+
+    if(!file_exists(EVENTLOG_PATH)) {
+        asp_logerror("TPM event log not available: %s does not exist\n",
+                     EVENTLOG_PATH);
+        return ASP_APB_ERROR_NOTIMPLEMENTED;
+    }
+
+    return ASP_APB_SUCCESS;
+}
+
+int asp_exit(int status UNUSED)
+{
+    asp_loginfo("Exiting "ASP_NAME"\n");
+    return ASP_APB_SUCCESS;
+}
+
+/*
+ * securityfs reports a size of 0 for the log, so it is read in chunks
+ * until EOF rather than with file_to_buffer().
+ */
+static unsigned char *read_eventlog(const char *path, size_t *size)
+{
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    size_t len = 0;
+    ssize_t rd;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) {
+        asp_logerror("Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    do {
+        if(cap - len < EVENTLOG_READ_CHUNK) {
+            unsigned char *tmp;
+            if(cap + EVENTLOG_READ_CHUNK > EVENTLOG_MAX_SIZE) {
+                asp_logerror("Event log is larger than %d bytes\n", EVENTLOG_MAX_SIZE);
+                goto error;
+            }
+            if((tmp = realloc(buf, cap + EVENTLOG_READ_CHUNK)) == NULL) {
+                asp_logerror("Failed to allocate event log buffer\n");
+                goto error;
+            }
+            buf  = tmp;
+            cap += EVENTLOG_READ_CHUNK;
+        }
+        rd = read(fd, buf + len, cap - len);
+        if(rd < 0 && errno != EINTR) {
+            asp_logerror("Failed to read %s: %s\n", path, strerror(errno));
+            goto error;
+        }
+        if(rd > 0) {
+            len += (size_t)rd;
+        }
+    } while(rd != 0);
+
+    close(fd);
+    *size = len;
+    return buf;
+
+error:
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Read PCRs 0-23 of every bank declared in the log from sysfs
+ * (available since Linux 5.12). Missing banks are skipped.
+ */
+static GList *read_pcrs(tpm_eventlog_parser *p)
+{
+    GList *pcrs = NULL;
+    uint32_t a, i;
+
+    for(a = 0; a < p->nr_algs; a++) {
+        const char *name = tpm_eventlog_alg_name(p->algs[a].alg_id);
+        if(name == NULL) {
+            continue;
+        }
+
+        for(i = 0; i < TPM_EVENTLOG_NR_PCRS; i++) {
+            char path[64];
+            char *line;
+            unsigned char *digest;
+            size_t len;
+            tpm_eventlog_pcr *pcr;
+
+            snprintf(path, sizeof(path), PCR_SYSFS_DIR"/pcr-%s/%"PRIu32, name, i);
+            if((line = file_one_line_to_str(path)) == NULL) {
+                if(i == 0) {
+                    asp_loginfo("No PCR values for bank %s in sysfs\n", name);
+                }
+                break;
+            }
+            g_strstrip(line);
+            len = strlen(line);
+            if(len != 2 * (size_t)p->algs[a].digest_size ||
+                    (digest = hexstr_to_bin(line, len)) == NULL) {
+                asp_logwarn("Ignoring malformed value of %s PCR %"PRIu32"\n", name, i);
+                free(line);
+                continue;
+            }
+            free(line);
+
+            if((pcr = malloc(sizeof(*pcr))) == NULL) {
+                free(digest);
+                g_list_free_full(pcrs, free);
+                return NULL;
+            }
+            pcr->alg_id = p->algs[a].alg_id;
+            pcr->index  = i;
+            pcr->size   = p->algs[a].digest_size;
+            memcpy(pcr->digest, digest, pcr->size);
+            free(digest);
+            pcrs = g_list_append(pcrs, pcr);
+        }
+    }
+    return pcrs;
+}
+
+/*
+ * Quote the SHA-256 PCRs in @mask over @nonce and attach the quote to
+ * @ted.
+ */
+static int quote_pcrs(tpm_eventlog_data *ted, uint32_t mask, const char *nonce,
+                      const char *tpmpass, const char *akctx)
+{
+#ifdef USE_TPM
+    struct tpm_sig_quote *sq;
+
+    if((sq = tpm2_quote(mask, tpmpass, nonce, akctx)) == NULL ||
+            sq->quote == NULL || sq->signature == NULL) {
+        asp_logerror("Failed to quote PCRs 0x%06"PRIx32"\n", mask);
+        if(sq != NULL) {
+            free(sq->quote);
+            free(sq->signature);
+        }
+        return -EIO;
+    }
+    ted->quote		= sq->quote;
+    ted->quote_size	= (uint32_t)sq->quote_size;
+    ted->quote_sig	= sq->signature;
+    ted->quote_sig_size = (uint32_t)sq->sig_size;
+    sq->quote = sq->signature = NULL;
+    return 0;
+#else
+    asp_logerror("TPM support disabled at compile time, cannot quote the event log\n");
+    return -ENOTSUP;
+#endif
+}
+
+int asp_measure(int argc, char *argv[])
+{
+    measurement_graph *graph = NULL;
+    node_id_t node_id;
+    tpm_eventlog_data *ted = NULL;
+    tpm_eventlog_parser parser;
+    tpm_eventlog_event ev;
+    unsigned char *log;
+    size_t size;
+    uint32_t mask = 0;
+    int nr_events = 0;
+    int rc;
+
+    if((argc < 6) ||
+            ((node_id = node_id_of_str(argv[2])) == INVALID_NODE_ID) ||
+            (map_measurement_graph(argv[1], &graph) != 0)) {
+        asp_logerror("Usage: "ASP_NAME" <graph path> <node id> <nonce> <tpmpass> <akctx>\n");
+        return -EINVAL;
+    }
+
+    if((log = read_eventlog(EVENTLOG_PATH, &size)) == NULL) {
+        rc = -EIO;
+        goto out;
+    }
+
+    /* validate the whole log before it is sent anywhere */
+    if((rc = tpm_eventlog_parser_init(&parser, log, size)) != 0) {
+        asp_logerror("%s is not a crypto agile event log\n", EVENTLOG_PATH);
+        free(log);
+        goto out;
+    }
+    while((rc = tpm_eventlog_next(&parser, &ev)) == 1) {
+        if(ev.event_type != TPM_EVENTLOG_EV_NO_ACTION &&
+                ev.pcr_index < TPM_EVENTLOG_NR_PCRS) {
+            mask |= (uint32_t)1 << ev.pcr_index;
+        }
+        nr_events++;
+    }
+    if(rc < 0) {
+        asp_logerror("Event log is malformed after %d events\n", nr_events);
+        free(log);
+        goto out;
+    }
+
+    ted = (tpm_eventlog_data *)alloc_measurement_data(&tpm_eventlog_measurement_type);
+    if(ted == NULL) {
+        asp_logerror("Failed to allocate measurement data\n");
+        free(log);
+        rc = -ENOMEM;
+        goto out;
+    }
+    ted->log      = log;
+    ted->log_size = (uint32_t)size;
+    ted->pcrs     = read_pcrs(&parser);
+
+    if((rc = quote_pcrs(ted, mask, argv[3], argv[4], argv[5])) != 0) {
+        free_measurement_data(&ted->d);
+        goto out;
+    }
+
+    asp_loginfo("Collected event log of %d events (%zu bytes) and %u PCR values\n",
+                nr_events, size, g_list_length(ted->pcrs));
+
+    if((rc = measurement_node_add_rawdata(graph, node_id, &ted->d)) != 0) {
+        asp_logerror("Failed to add event log to node\n");
+    }
+    free_measurement_data(&ted->d);
+
+out:
+    unmap_measurement_graph(graph);
+    return rc == 0 ? ASP_APB_SUCCESS : rc;
+}
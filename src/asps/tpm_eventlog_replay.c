@@ -0,0 +1,604 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Replay of TCG2 event logs, shared by the TPM event log appraiser ASP
+ * and its tests.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <openssl/evp.h>
+
+#include <tpl.h>
+#include <util/util.h>
+#ifdef USE_TPM
+#include <util/tpm2/tools/sign.h>
+#endif
+
+#include "tpm_eventlog_replay.h"
+
+#define STARTUP_LOCALITY_SIGNATURE "StartupLocality"
+#define STARTUP_LOCALITY_SIZE (sizeof(STARTUP_LOCALITY_SIGNATURE) + 1)
+
+/* prefix, extended, nr_events, nr_unmatched, refs_digest, then per
+   bank its algorithm, digest size and PCR values */
+#define REPLAY_TPL_FMT "BuuuBA(vvB)"
+
+static const EVP_MD *alg_md(uint16_t alg_id)
+{
+    switch(alg_id) {
+    case TPM_EVENTLOG_ALG_SHA1:
+        return EVP_sha1();
+    case TPM_EVENTLOG_ALG_SHA256:
+        return EVP_sha256();
+    case TPM_EVENTLOG_ALG_SHA384:
+        return EVP_sha384();
+    case TPM_EVENTLOG_ALG_SHA512:
+        return EVP_sha512();
+    case TPM_EVENTLOG_ALG_SM3_256:
+        return EVP_get_digestbyname("SM3");
+    default:
+        return NULL;
+    }
+}
+
+static char *ref_key(uint16_t alg_id, const unsigned char *digest, size_t size)
+{
+    char *hex = bin_to_hexstr(digest, size);
+    char *key;
+
+    if(hex == NULL) {
+        return NULL;
+    }
+    key = g_strdup_printf("%04"PRIx16":%s", alg_id, hex);
+    free(hex);
+    return key;
+}
+
+int tpm_eventlog_refs_init(tpm_eventlog_refs *refs)
+{
+    refs->digests = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    refs->replay_only = 0;
+    return refs->digests == NULL ? -ENOMEM : 0;
+}
+
+void tpm_eventlog_refs_free(tpm_eventlog_refs *refs)
+{
+    if(refs->digests != NULL) {
+        g_hash_table_destroy(refs->digests);
+        refs->digests = NULL;
+    }
+}
+
+int tpm_eventlog_refs_add(tpm_eventlog_refs *refs, uint16_t alg_id,
+                          const unsigned char *digest, size_t size)
+{
+    char *key = ref_key(alg_id, digest, size);
+
+    if(key == NULL) {
+        return -ENOMEM;
+    }
+    g_hash_table_add(refs->digests, key);
+    return 0;
+}
+
+int tpm_eventlog_refs_load(tpm_eventlog_refs *refs, const char *path)
+{
+    char *contents = file_to_string(path);
+    char *line, *saveptr = NULL;
+    int count = 0;
+
+    if(contents == NULL) {
+        return -ENOENT;
+    }
+
+    for(line = strtok_r(contents, "\n", &saveptr); line != NULL;
+            line = strtok_r(NULL, "\n", &saveptr)) {
+        char *hex;
+        uint16_t alg_id;
+        unsigned char *digest;
+        size_t len;
+
+        g_strstrip(line);
+        if(line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+
+        if(strcasecmp(line, "replay-only") == 0) {
+            refs->replay_only = 1;
+            continue;
+        }
+
+        if((hex = strchr(line, ':')) == NULL) {
+            dlog(2, "Ignoring malformed reference \"%s\"\n", line);
+            continue;
+        }
+        *hex++ = '\0';
+        len = strlen(hex);
+
+        if((alg_id = tpm_eventlog_alg_id(line)) == 0 ||
+                len == 0 || len % 2 != 0 || len / 2 > TPM_EVENTLOG_MAX_DIGEST_SIZE ||
+                (digest = hexstr_to_bin(hex, len)) == NULL) {
+            dlog(2, "Ignoring malformed reference \"%s:%s\"\n", line, hex);
+            continue;
+        }
+
+        if(tpm_eventlog_refs_add(refs, alg_id, digest, len / 2) == 0) {
+            count++;
+        }
+        free(digest);
+    }
+
+    free(contents);
+    return count;
+}
+
+void tpm_eventlog_refs_fingerprint(tpm_eventlog_refs *refs,
+                                   unsigned char out[SHA256_DIGEST_LENGTH])
+{
+    GList *keys = g_list_sort(g_hash_table_get_keys(refs->digests),
+                              (GCompareFunc)strcmp);
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    GList *iter;
+
+    memset(out, 0, SHA256_DIGEST_LENGTH);
+    if(ctx != NULL && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1) {
+        for(iter = keys; iter != NULL; iter = g_list_next(iter)) {
+            EVP_DigestUpdate(ctx, iter->data, strlen(iter->data) + 1);
+        }
+        EVP_DigestFinal_ex(ctx, out, NULL);
+    }
+    EVP_MD_CTX_free(ctx);
+    g_list_free(keys);
+}
+
+void tpm_eventlog_replay_init(tpm_eventlog_replay *st)
+{
+    memset(st, 0, sizeof(*st));
+}
+
+void tpm_eventlog_replay_release(tpm_eventlog_replay *st)
+{
+    free(st->prefix);
+    tpm_eventlog_replay_init(st);
+}
+
+static int same_banks(tpm_eventlog_replay *st, tpm_eventlog_parser *p)
+{
+    uint32_t i;
+
+    if(st->nr_banks != p->nr_algs) {
+        return 0;
+    }
+    for(i = 0; i < st->nr_banks; i++) {
+        if(st->banks[i].alg_id != p->algs[i].alg_id ||
+                st->banks[i].digest_size != p->algs[i].digest_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int event_has_reference(tpm_eventlog_refs *refs, tpm_eventlog_event *ev)
+{
+    uint32_t i;
+
+    for(i = 0; i < ev->nr_digests; i++) {
+        char *key = ref_key(ev->digests[i].alg_id, ev->digests[i].digest,
+                            ev->digests[i].size);
+        int found = key != NULL && g_hash_table_contains(refs->digests, key);
+        g_free(key);
+        if(found) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int extend(tpm_eventlog_replay *st, const EVP_MD **mds,
+                  tpm_eventlog_event *ev)
+{
+    unsigned char buf[2 * TPM_EVENTLOG_MAX_DIGEST_SIZE];
+    uint32_t i, b;
+
+    for(i = 0; i < ev->nr_digests; i++) {
+        tpm_eventlog_bank *bank = NULL;
+        unsigned int len;
+
+        for(b = 0; b < st->nr_banks; b++) {
+            if(st->banks[b].alg_id == ev->digests[i].alg_id) {
+                bank = &st->banks[b];
+                break;
+            }
+        }
+        if(bank == NULL) {
+            return -EINVAL;
+        }
+
+        memcpy(buf, bank->pcrs[ev->pcr_index], bank->digest_size);
+        memcpy(buf + bank->digest_size, ev->digests[i].digest, bank->digest_size);
+        if(EVP_Digest(buf, 2 * (size_t)bank->digest_size,
+                      bank->pcrs[ev->pcr_index], &len, mds[b], NULL) != 1 ||
+                len != bank->digest_size) {
+            return -EINVAL;
+        }
+    }
+    st->extended |= (uint32_t)1 << ev->pcr_index;
+    return 0;
+}
+
+int tpm_eventlog_replay_log(tpm_eventlog_replay *st,
+                            const unsigned char *log, size_t size,
+                            tpm_eventlog_refs *refs)
+{
+    tpm_eventlog_parser p;
+    tpm_eventlog_event ev;
+    unsigned char refs_digest[SHA256_DIGEST_LENGTH];
+    const EVP_MD *mds[TPM_EVENTLOG_MAX_ALGS];
+    unsigned char *prefix;
+    int check_refs = refs != NULL && g_hash_table_size(refs->digests) > 0;
+    size_t start;
+    int nr_new = 0;
+    int rc;
+    uint32_t i;
+
+    if((rc = tpm_eventlog_parser_init(&p, log, size)) != 0) {
+        goto reset;
+    }
+
+    if(refs != NULL) {
+        tpm_eventlog_refs_fingerprint(refs, refs_digest);
+    } else {
+        memset(refs_digest, 0, sizeof(refs_digest));
+    }
+
+    /* a plain comparison of the part already replayed is far cheaper
+       than replaying or hashing it again */
+    if(st->offset > 0 &&
+            (memcmp(st->refs_digest, refs_digest, sizeof(refs_digest)) != 0 ||
+             !same_banks(st, &p) || st->offset > size ||
+             memcmp(st->prefix, log, (size_t)st->offset) != 0)) {
+        dlog(4, "Saved replay does not match the event log, replaying from the start\n");
+        tpm_eventlog_replay_release(st);
+    }
+
+    if(st->offset == 0) {
+        st->nr_banks = p.nr_algs;
+        for(i = 0; i < p.nr_algs; i++) {
+            st->banks[i].alg_id	     = p.algs[i].alg_id;
+            st->banks[i].digest_size = p.algs[i].digest_size;
+        }
+        memcpy(st->refs_digest, refs_digest, sizeof(refs_digest));
+        start = 0;
+        st->offset = p.header_size;
+    } else {
+        start = (size_t)st->offset;
+    }
+
+    for(i = 0; i < st->nr_banks; i++) {
+        if((mds[i] = alg_md(st->banks[i].alg_id)) == NULL) {
+            dlog(1, "Event log uses unsupported digest algorithm 0x%04"PRIx16"\n",
+                 st->banks[i].alg_id);
+            rc = -ENOTSUP;
+            goto reset;
+        }
+    }
+
+    if((rc = tpm_eventlog_parser_seek(&p, (size_t)st->offset)) != 0) {
+        goto reset;
+    }
+
+    while((rc = tpm_eventlog_next(&p, &ev)) == 1) {
+        if(ev.pcr_index >= TPM_EVENTLOG_NR_PCRS) {
+            dlog(1, "Event at offset %zu extends invalid PCR %"PRIu32"\n",
+                 ev.offset, ev.pcr_index);
+            rc = -EINVAL;
+            goto reset;
+        }
+
+        if(ev.event_type == TPM_EVENTLOG_EV_NO_ACTION) {
+            /* only the startup locality affects the PCRs (PFP 10.4.5.3) */
+            if(ev.pcr_index == 0 && ev.data_size == STARTUP_LOCALITY_SIZE &&
+                    memcmp(ev.data, STARTUP_LOCALITY_SIGNATURE,
+                           sizeof(STARTUP_LOCALITY_SIGNATURE)) == 0 &&
+                    !(st->extended & 1)) {
+                for(i = 0; i < st->nr_banks; i++) {
+                    st->banks[i].pcrs[0][st->banks[i].digest_size - 1] =
+                        ev.data[STARTUP_LOCALITY_SIZE - 1];
+                }
+            }
+        } else {
+            if((rc = extend(st, mds, &ev)) != 0) {
+                goto reset;
+            }
+            st->nr_events++;
+            if(check_refs && !event_has_reference(refs, &ev)) {
+                dlog(3, "Event of type 0x%08"PRIx32" extending PCR %"PRIu32
+                     " at offset %zu has no reference digest\n",
+                     ev.event_type, ev.pcr_index, ev.offset);
+                st->nr_unmatched++;
+            }
+        }
+        nr_new++;
+    }
+    if(rc < 0) {
+        goto reset;
+    }
+
+    if((prefix = realloc(st->prefix, size)) == NULL) {
+        rc = -ENOMEM;
+        goto reset;
+    }
+    memcpy(prefix + start, log + start, size - start);
+    st->prefix = prefix;
+    st->offset = size;
+
+    return nr_new;
+
+reset:
+    tpm_eventlog_replay_release(st);
+    return rc;
+}
+
+const unsigned char *tpm_eventlog_replay_pcr(tpm_eventlog_replay *st,
+        uint16_t alg_id, uint32_t index,
+        size_t *size)
+{
+    uint32_t b;
+
+    if(index >= TPM_EVENTLOG_NR_PCRS) {
+        return NULL;
+    }
+    for(b = 0; b < st->nr_banks; b++) {
+        if(st->banks[b].alg_id == alg_id) {
+            *size = st->banks[b].digest_size;
+            return st->banks[b].pcrs[index];
+        }
+    }
+    return NULL;
+}
+
+int tpm_eventlog_replay_check_pcrs(tpm_eventlog_replay *st, GList *pcrs)
+{
+    GList *iter;
+    int mismatches = 0;
+
+    for(iter = pcrs; iter != NULL; iter = g_list_next(iter)) {
+        tpm_eventlog_pcr *pcr = iter->data;
+        const unsigned char *replayed;
+        size_t size;
+
+        replayed = tpm_eventlog_replay_pcr(st, pcr->alg_id, pcr->index, &size);
+        if(replayed == NULL || size != pcr->size ||
+                memcmp(replayed, pcr->digest, size) != 0) {
+            dlog(3, "Replayed %s PCR %"PRIu32" does not match the TPM\n",
+                 tpm_eventlog_alg_name(pcr->alg_id) ? : "unknown", pcr->index);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+int tpm_eventlog_replay_pcr_digest(tpm_eventlog_replay *st, uint16_t alg_id,
+                                   uint32_t pcr_mask, uint16_t hash_alg_id,
+                                   unsigned char out[TPM_EVENTLOG_MAX_DIGEST_SIZE],
+                                   size_t *size)
+{
+    const EVP_MD *md = alg_md(hash_alg_id);
+    EVP_MD_CTX *ctx;
+    unsigned int len = 0;
+    uint32_t i;
+    int rc = -EINVAL;
+
+    if(md == NULL || (ctx = EVP_MD_CTX_new()) == NULL) {
+        return -EINVAL;
+    }
+    if(EVP_DigestInit_ex(ctx, md, NULL) != 1) {
+        goto out;
+    }
+
+    for(i = 0; i < TPM_EVENTLOG_NR_PCRS; i++) {
+        const unsigned char *pcr;
+        size_t pcr_size;
+
+        if(!(pcr_mask & ((uint32_t)1 << i))) {
+            continue;
+        }
+        if((pcr = tpm_eventlog_replay_pcr(st, alg_id, i, &pcr_size)) == NULL ||
+                EVP_DigestUpdate(ctx, pcr, pcr_size) != 1) {
+            goto out;
+        }
+    }
+
+    if(EVP_DigestFinal_ex(ctx, out, &len) == 1) {
+        *size = len;
+        rc = 0;
+    }
+
+out:
+    EVP_MD_CTX_free(ctx);
+    return rc;
+}
+
+int tpm_eventlog_replay_check_quote(tpm_eventlog_replay *st,
+                                    unsigned char *quote, size_t quote_size,
+                                    unsigned char *sig, size_t sig_size,
+                                    const char *nonce, const char *akpubkey)
+{
+    unsigned char attested[TPM_EVENTLOG_MAX_DIGEST_SIZE];
+    unsigned char replayed[TPM_EVENTLOG_MAX_DIGEST_SIZE];
+    int attested_size;
+    size_t replayed_size;
+    uint16_t alg_id;
+    uint32_t mask;
+
+    if(quote == NULL || sig == NULL || quote_size > INT_MAX || sig_size > INT_MAX) {
+        return -EINVAL;
+    }
+
+#ifdef USE_TPM
+    if(checkquote_pcrs(sig, (int)sig_size, nonce, akpubkey, quote, (int)quote_size,
+                       &alg_id, &mask, attested, &attested_size) != 0) {
+        dlog(2, "TPM quote of the event log PCRs could not be verified\n");
+        return -EINVAL;
+    }
+#else
+    dlog(2, "Built without TPM support, cannot verify the event log quote\n");
+    return -EINVAL;
+#endif
+
+    /* events extending PCRs outside the quote would go unchecked */
+    if((st->extended & ~mask) != 0) {
+        dlog(2, "TPM quote does not cover PCRs 0x%06"PRIx32" extended by the event log\n",
+             st->extended & ~mask);
+        return -EPERM;
+    }
+
+    /* the composite is hashed with the AK's signing scheme, SHA-256 */
+    if(tpm_eventlog_replay_pcr_digest(st, alg_id, mask, TPM_EVENTLOG_ALG_SHA256,
+                                      replayed, &replayed_size) != 0 ||
+            replayed_size != (size_t)attested_size ||
+            memcmp(replayed, attested, replayed_size) != 0) {
+        dlog(2, "Replayed %s PCRs 0x%06"PRIx32" do not match the TPM quote\n",
+             tpm_eventlog_alg_name(alg_id) ? : "unknown", mask);
+        return -EPERM;
+    }
+    return 0;
+}
+
+int tpm_eventlog_replay_save(tpm_eventlog_replay *st, const char *path)
+{
+    tpl_node *tn;
+    tpl_bin tb_prefix, tb_refs, tb_pcrs;
+    uint16_t alg_id, digest_size;
+    void *buf = NULL;
+    size_t size;
+    char *tmp_path;
+    uint32_t b;
+    int rc = -EIO;
+
+    tn = tpl_map(REPLAY_TPL_FMT, &tb_prefix, &st->extended, &st->nr_events,
+                 &st->nr_unmatched, &tb_refs, &alg_id, &digest_size, &tb_pcrs);
+    if(tn == NULL) {
+        return -ENOMEM;
+    }
+
+    tb_prefix.addr = st->prefix;
+    tb_prefix.sz   = (uint32_t)st->offset;
+    tb_refs.addr   = st->refs_digest;
+    tb_refs.sz	   = sizeof(st->refs_digest);
+    tpl_pack(tn, 0);
+    for(b = 0; b < st->nr_banks; b++) {
+        alg_id	    = st->banks[b].alg_id;
+        digest_size = st->banks[b].digest_size;
+        tb_pcrs.addr = st->banks[b].pcrs;
+        tb_pcrs.sz   = sizeof(st->banks[b].pcrs);
+        tpl_pack(tn, 1);
+    }
+    if(tpl_dump(tn, TPL_MEM, &buf, &size) < 0 || buf == NULL) {
+        tpl_free(tn);
+        return -ENOMEM;
+    }
+    tpl_free(tn);
+
+    if((tmp_path = g_strdup_printf("%s.tmp", path)) == NULL) {
+        free(buf);
+        return -ENOMEM;
+    }
+
+    /* write and rename so that a concurrent reader never sees a partial state */
+    if(buffer_to_file_perm(tmp_path, buf, size, 0600) != (ssize_t)size ||
+            rename(tmp_path, path) != 0) {
+        dlog(2, "Failed to save event log replay to %s\n", path);
+        unlink(tmp_path);
+    } else {
+        rc = 0;
+    }
+    g_free(tmp_path);
+    free(buf);
+    return rc;
+}
+
+int tpm_eventlog_replay_load(tpm_eventlog_replay *st, const char *path)
+{
+    tpl_node *tn;
+    tpl_bin tb_prefix, tb_refs, tb_pcrs;
+    uint16_t alg_id, digest_size;
+    unsigned char *buf;
+    size_t size;
+    int rc = -EINVAL;
+
+    tpm_eventlog_replay_release(st);
+
+    if((buf = file_to_buffer(path, &size)) == NULL) {
+        return -ENOENT;
+    }
+
+    tn = tpl_map(REPLAY_TPL_FMT, &tb_prefix, &st->extended, &st->nr_events,
+                 &st->nr_unmatched, &tb_refs, &alg_id, &digest_size, &tb_pcrs);
+    if(tn == NULL) {
+        free(buf);
+        return -ENOMEM;
+    }
+    if(tpl_load(tn, TPL_MEM, buf, size) != 0) {
+        goto out;
+    }
+
+    tpl_unpack(tn, 0);
+    st->prefix = tb_prefix.addr;
+    st->offset = tb_prefix.sz;
+    if(tb_refs.sz != sizeof(st->refs_digest)) {
+        free(tb_refs.addr);
+        goto out;
+    }
+    memcpy(st->refs_digest, tb_refs.addr, sizeof(st->refs_digest));
+    free(tb_refs.addr);
+
+    while(tpl_unpack(tn, 1) > 0) {
+        tpm_eventlog_bank *bank = &st->banks[st->nr_banks];
+
+        if(st->nr_banks == TPM_EVENTLOG_MAX_ALGS || digest_size == 0 ||
+                digest_size > TPM_EVENTLOG_MAX_DIGEST_SIZE ||
+                tb_pcrs.sz != sizeof(bank->pcrs)) {
+            free(tb_pcrs.addr);
+            goto out;
+        }
+        bank->alg_id	  = alg_id;
+        bank->digest_size = digest_size;
+        memcpy(bank->pcrs, tb_pcrs.addr, sizeof(bank->pcrs));
+        free(tb_pcrs.addr);
+        st->nr_banks++;
+    }
+    rc = 0;
+
+out:
+    tpl_free(tn);
+    free(buf);
+    if(rc != 0) {
+        tpm_eventlog_replay_release(st);
+    }
+    return rc;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __TPM_EVENTLOG_REPLAY_H__
+#define __TPM_EVENTLOG_REPLAY_H__
+
+/*! \file
+ * Replay of a TCG2 event log into per bank PCR values, and checking of
+ * the logged events against a set of reference digests.
+ *
+ * A replay state keeps a copy of the part of the log it has consumed.
+ * Replaying a log that starts with those bytes only processes the new
+ * events, so a state saved with tpm_eventlog_replay_save() lets an
+ * unchanged (or grown) log be verified with a comparison of the old
+ * part rather than a replay of it.
+ *
+ * The replayed PCRs are only trusted once they are found in a TPM
+ * quote made over the requester's nonce, see
+ * tpm_eventlog_replay_check_quote().
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <glib.h>
+#include <openssl/sha.h>
+#include <measurement/tpm_eventlog_measurement_type.h>
+
+/**
+ * Set of reference event digests. Keys are "<alg id>:<hex digest>".
+ */
+typedef struct tpm_eventlog_refs {
+    GHashTable *digests;
+    int replay_only;		/* an empty set accepts every event */
+} tpm_eventlog_refs;
+
+typedef struct tpm_eventlog_bank {
+    uint16_t alg_id;
+    uint16_t digest_size;
+    unsigned char pcrs[TPM_EVENTLOG_NR_PCRS][TPM_EVENTLOG_MAX_DIGEST_SIZE];
+} tpm_eventlog_bank;
+
+typedef struct tpm_eventlog_replay {
+    uint32_t nr_banks;
+    tpm_eventlog_bank banks[TPM_EVENTLOG_MAX_ALGS];
+    uint32_t extended;		/* bitmask of PCRs extended so far */
+    uint64_t offset;		/* bytes of the log replayed so far */
+    unsigned char *prefix;	/* copy of those bytes */
+    unsigned char refs_digest[SHA256_DIGEST_LENGTH];
+    uint32_t nr_events;		/* measured events replayed */
+    uint32_t nr_unmatched;	/* of those, events without a reference */
+} tpm_eventlog_replay;
+
+/**
+ * Initialize @refs to the empty set.
+ */
+int tpm_eventlog_refs_init(tpm_eventlog_refs *refs);
+
+/**
+ * Add the digest @digest of algorithm @alg_id to @refs.
+ */
+int tpm_eventlog_refs_add(tpm_eventlog_refs *refs, uint16_t alg_id,
+                          const unsigned char *digest, size_t size);
+
+/**
+ * Add the references listed in @path to @refs. Each line holds an
+ * algorithm name and a hex digest separated by a colon, e.g.
+ * "sha256:9f86d0...", or the word "replay-only", which sets
+ * @refs->replay_only. Blank lines and lines starting with '#' are
+ * ignored. Returns the number of references added or < 0 on error.
+ */
+int tpm_eventlog_refs_load(tpm_eventlog_refs *refs, const char *path);
+
+/**
+ * Compute an order independent digest of the contents of @refs, used
+ * to tell whether a saved replay was checked against the same set.
+ */
+void tpm_eventlog_refs_fingerprint(tpm_eventlog_refs *refs,
+                                   unsigned char out[SHA256_DIGEST_LENGTH]);
+
+void tpm_eventlog_refs_free(tpm_eventlog_refs *refs);
+
+/**
+ * Initialize @st to the empty replay.
+ */
+void tpm_eventlog_replay_init(tpm_eventlog_replay *st);
+
+/**
+ * Free the resources held by @st and reset it to the empty replay.
+ */
+void tpm_eventlog_replay_release(tpm_eventlog_replay *st);
+
+/**
+ * Replay @log into @st, checking each measured event against @refs.
+ * An event matches if any of its digests is in @refs; if @refs is
+ * empty no event is checked.
+ *
+ * If @st already holds the replay of a prefix of @log checked against
+ * the same reference set, only the remainder of @log is processed;
+ * otherwise @st is reset first.
+ *
+ * Returns the number of events processed by this call, or < 0 if the
+ * log is malformed or uses a digest algorithm that can not be
+ * computed, in which case @st is left reset.
+ */
+int tpm_eventlog_replay_log(tpm_eventlog_replay *st,
+                            const unsigned char *log, size_t size,
+                            tpm_eventlog_refs *refs);
+
+/**
+ * Return the replayed value of PCR @index in bank @alg_id, or NULL if
+ * the log has no such bank.
+ */
+const unsigned char *tpm_eventlog_replay_pcr(tpm_eventlog_replay *st,
+        uint16_t alg_id, uint32_t index,
+        size_t *size);
+
+/**
+ * Compare the replayed PCR values with @pcrs, a list of
+ * (tpm_eventlog_pcr *). Returns the number of PCRs that differ.
+ * PCRs of banks missing from the log count as differences. The values
+ * collected from sysfs are not authenticated, so this only helps to
+ * explain a failed tpm_eventlog_replay_check_quote().
+ */
+int tpm_eventlog_replay_check_pcrs(tpm_eventlog_replay *st, GList *pcrs);
+
+/**
+ * Compute the composite digest a TPM2 quote reports for the PCRs in
+ * @pcr_mask of bank @alg_id, hashed with @hash_alg_id. Returns 0 on
+ * success and sets *@size to the digest length.
+ */
+int tpm_eventlog_replay_pcr_digest(tpm_eventlog_replay *st, uint16_t alg_id,
+                                   uint32_t pcr_mask, uint16_t hash_alg_id,
+                                   unsigned char out[TPM_EVENTLOG_MAX_DIGEST_SIZE],
+                                   size_t *size);
+
+/**
+ * Check that @quote, a marshalled TPMS_ATTEST signed with @sig by the
+ * attestation key in the file @akpubkey, was made over @nonce and
+ * attests the replayed values of every PCR the log extends. Returns 0
+ * if it does, -EPERM if the quote does not match the replay and
+ * -EINVAL if it can not be verified.
+ */
+int tpm_eventlog_replay_check_quote(tpm_eventlog_replay *st,
+                                    unsigned char *quote, size_t quote_size,
+                                    unsigned char *sig, size_t sig_size,
+                                    const char *nonce, const char *akpubkey);
+
+/**
+ * Save @st to / load it from the file @path. Returns 0 on success or
+ * < 0 on error; loading a missing or unrecognized file fails and
+ * leaves @st reset. @st must have been initialized.
+ */
+int tpm_eventlog_replay_save(tpm_eventlog_replay *st, const char *path);
+int tpm_eventlog_replay_load(tpm_eventlog_replay *st, const char *path);
+
+#endif /* __TPM_EVENTLOG_REPLAY_H__ */
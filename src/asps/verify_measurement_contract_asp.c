@@ -57,6 +57,9 @@
  * @akpubkey the AK public key generated by the TPM
  * @verify_tpm 1 or a 0 to indicate if TPM-based signature verification should be employed or not (respectively)
  * @buf contains the contract XML @buf_size is its size
+ * If the contract carries a detached measurement payload after the
+ * XML, the payload must also match the digest recorded in the signed
+ * measurement node.
  * Returns 0 on success, < 0 on error
  */
 static int verify_contract(char *workdir, char *nonce, char *cacert,
@@ -72,7 +75,22 @@ static int verify_contract(char *workdir, char *nonce, char *cacert,
     char tmpstr[200]        = {0};
     char *contract_type     = NULL;
 
-    doc = xmlReadMemory(buf, (int)buf_size, NULL, NULL, 0);
+    xmlXPathObject *msmtobj = NULL;
+    const unsigned char *payload = NULL;
+    size_t payload_size     = 0;
+    size_t xml_size         = 0;
+
+    if(split_detached_payload(buf, buf_size, &xml_size, &payload, &payload_size) < 0) {
+        dlog(0, "Malformed measurement contract framing\n");
+        goto xml_err;
+    }
+
+    if(xml_size > INT_MAX) {
+        dlog(0, "Contract XML too large\n");
+        goto xml_err;
+    }
+
+    doc = xmlReadMemory(buf, (int)xml_size, NULL, NULL, 0);
     if (doc == NULL) {
         dlog(0, "Failed to parse contract XML.\n");
         goto xml_err;
@@ -127,8 +145,24 @@ static int verify_contract(char *workdir, char *nonce, char *cacert,
         }
     }
 
+    /* The signatures only cover the digests of detached measurements */
+    msmtobj = xpath(doc, "/contract/subcontract/option/measurement");
+    if(msmtobj != NULL && msmtobj->nodesetval != NULL) {
+        for (i=0; i<msmtobj->nodesetval->nodeNr; i++) {
+            xmlNode *msmt = msmtobj->nodesetval->nodeTab[i];
+            if (msmt->type == XML_ELEMENT_NODE && is_detached_payload(msmt) &&
+                    check_detached_payload(msmt, payload, payload_size) != 1) {
+                dlog(0, "Detached measurement does not match its contract\n");
+                ret = -1;
+                goto payload_err;
+            }
+        }
+    }
+
     ret = 0;
 
+payload_err:
+    xmlXPathFreeObject(msmtobj);
 subcontract_sig_err:
 subcontract_err:
 subcontract_read_err:
@@ -23,7 +23,9 @@
 #define ENV_MAAT_MEAS_SPEC_DIR "MAAT_MEAS_SPEC_DIR"
 #define ENV_MAAT_SELECTOR_PATH "MAAT_SELECTOR_PATH"
 #define ENV_MAAT_SELECTOR_METHOD "MAAT_SELECTOR_METHOD"
+#define ENV_MAAT_SELECTOR_POLL_SECS "MAAT_SELECTOR_POLL_SECS"
 #define ENV_MAAT_IGNORE_DESIRED_CONTEXTS "MAAT_IGNORE_DESIRED_CONTEXTS"
 #define ENV_MAAT_USE_DEFAULT_CATEGORIES "MAAT_USE_DEFAULT_CATEGORIES"
+#define ENV_MAAT_FILTER_STATS "MAAT_FILTER_STATS"
 
 #endif
@@ -16,8 +16,14 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <util/util.h>
 #include <util/keyvalue.h>
@@ -119,6 +125,145 @@ error_alloc_spec:
 
 }
 
+static int parse_budget_limit(xmlNode *node, const char *attr, uint64_t max,
+                              uint64_t *out)
+{
+    char *str = xmlGetPropASCII(node, attr);
+    char *end;
+    unsigned long long val;
+
+    *out = 0;
+    if(str == NULL) {
+        return 0;
+    }
+
+    errno = 0;
+    val = strtoull(str, &end, 0);
+    if(errno != 0 || end == str || *end != '\0' || str[0] == '-' || val > max) {
+        dlog(0, "Error: invalid budget %s \"%s\"\n", attr, str);
+        free(str);
+        return -1;
+    }
+    free(str);
+    *out = (uint64_t)val;
+    return 0;
+}
+
+/**
+ * Parse the <budget seconds="..." bytes="..." measurements="..."/>
+ * node of a measurement specification into @budget.
+ */
+static int parse_meas_budget(xmlNode *node, measurement_budget *budget)
+{
+    uint64_t seconds, bytes, measurements;
+
+    if(parse_budget_limit(node, "seconds", INT32_MAX, &seconds) != 0 ||
+            parse_budget_limit(node, "bytes", UINT64_MAX, &bytes) != 0 ||
+            parse_budget_limit(node, "measurements", UINT32_MAX, &measurements) != 0) {
+        return -1;
+    }
+
+    budget->max_seconds      = (time_t)seconds;
+    budget->max_bytes        = bytes;
+    budget->max_measurements = (uint32_t)measurements;
+    return 0;
+}
+
+/**
+ * Parse the <sampling rate="..." rounds="..."/> node of a measurement
+ * specification into @sampling. The rate is rounded to the nearest
+ * part per million, but never down to 0.
+ */
+static int parse_meas_sampling(xmlNode *node, measurement_sampling *sampling)
+{
+    char *str = xmlGetPropASCII(node, "rate");
+    char *end;
+    double rate;
+    uint64_t rounds;
+
+    if(str == NULL) {
+        dlog(0, "Error: sampling node has no rate\n");
+        return -1;
+    }
+    rate = g_ascii_strtod(str, &end);
+    if(end == str || *end != '\0' || !(rate > 0.0 && rate <= 1.0)) {
+        dlog(0, "Error: invalid sampling rate \"%s\"\n", str);
+        free(str);
+        return -1;
+    }
+    free(str);
+
+    if(parse_budget_limit(node, "rounds", UINT32_MAX, &rounds) != 0) {
+        return -1;
+    }
+
+    sampling->rate_ppm = (uint32_t)(rate * MEASUREMENT_SAMPLING_SCALE + 0.5);
+    if(sampling->rate_ppm == 0) {
+        sampling->rate_ppm = 1;
+    }
+    sampling->rounds = (uint32_t)rounds;
+    return 0;
+}
+
+/**
+ * Parse the <memory_hash mode="..."/> node of a measurement
+ * specification into @mode.
+ */
+static int parse_meas_memory_hash(xmlNode *node, memory_hash_mode *mode)
+{
+    char *str = xmlGetPropASCII(node, "mode");
+    int ret = 0;
+
+    if(str == NULL) {
+        dlog(0, "Error: memory_hash node has no mode\n");
+        return -1;
+    }
+    if(strcasecmp(str, "flat") == 0) {
+        *mode = MEMORY_HASH_FLAT;
+    } else if(strcasecmp(str, "pagetree") == 0) {
+        *mode = MEMORY_HASH_PAGETREE;
+    } else {
+        dlog(0, "Error: invalid memory_hash mode \"%s\"\n", str);
+        ret = -1;
+    }
+    free(str);
+    return ret;
+}
+
+/**
+ * Append the rules of the <export><rule>...</rule></export> node of a
+ * measurement specification to @rules. The rules are checked when
+ * they are applied, since the types they name are only known to the
+ * APB.
+ */
+static int parse_meas_export(xmlNode *node, GList **rules)
+{
+    xmlNode *child;
+
+    for(child = node->children; child != NULL; child = child->next) {
+        char *child_name;
+        char *rule;
+
+        if(child->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        child_name = validate_cstring_ascii(child->name, SIZE_MAX);
+        if(child_name == NULL || strcasecmp(child_name, "rule") != 0) {
+            dlog(1, "Warning: ignoring unexpected export node %s\n",
+                 child_name ? child_name : "(invalid)");
+            continue;
+        }
+        rule = xmlNodeGetContentASCII(child);
+        if(rule == NULL || strchr(rule, '=') == NULL) {
+            dlog(0, "Error: invalid export rule \"%s\"\n", rule ? rule : "");
+            free(rule);
+            return -1;
+        }
+        *rules = g_list_append(*rules, rule);
+    }
+    return 0;
+}
+
 /**
  * Parse the <instructions> and <variables> descendants of the
  * <measurement_specification> node referenved by @meas_specs_node
@@ -144,6 +289,10 @@ int parse_meas_spec(struct meas_spec *mspec, xmlNode *meas_specs_node)
     xmlNode *meas_spec;
     mspec->instruction_list = NULL;
     mspec->variable_list = NULL;
+    memset(&mspec->budget, 0, sizeof(mspec->budget));
+    memset(&mspec->sampling, 0, sizeof(mspec->sampling));
+    mspec->memory_hash = MEMORY_HASH_FLAT;
+    mspec->export_rules = NULL;
 
     for (meas_spec = meas_specs_node->children; meas_spec; meas_spec=meas_spec->next) {
         char *child_name;
@@ -171,6 +320,22 @@ int parse_meas_spec(struct meas_spec *mspec, xmlNode *meas_specs_node)
             }
             dlog(3, "Parsing measurement variables...\n");
             mspec->variable_list = parse_meas_variables(mspec, meas_spec);
+        } else if (strcasecmp(child_name, "budget") == 0) {
+            if(parse_meas_budget(meas_spec, &mspec->budget) != 0) {
+                goto error;
+            }
+        } else if (strcasecmp(child_name, "sampling") == 0) {
+            if(parse_meas_sampling(meas_spec, &mspec->sampling) != 0) {
+                goto error;
+            }
+        } else if (strcasecmp(child_name, "memory_hash") == 0) {
+            if(parse_meas_memory_hash(meas_spec, &mspec->memory_hash) != 0) {
+                goto error;
+            }
+        } else if (strcasecmp(child_name, "export") == 0) {
+            if(parse_meas_export(meas_spec, &mspec->export_rules) != 0) {
+                goto error;
+            }
         }
     }
 
@@ -450,6 +615,7 @@ void free_meas_spec(struct meas_spec *aspec)
             free_instruction_list(aspec->instruction_list);
         if(aspec->variable_list)
             free_variable_list(aspec->variable_list);
+        g_list_free_full(aspec->export_rules, free);
         free(aspec);
     }
 }
@@ -1106,63 +1272,453 @@ static int instruction_filter_to_str(instruction_filter *f, char *buf, size_t bu
     return -1;
 }
 
-static int evaluate_filter(instruction_filter *filter, measurement_variable *v,
-                           measurement_spec_callbacks *callbacks, void *ctxt)
+/*
+ * Filter predicates are not evaluated strictly left to right. The
+ * evaluator keeps the cost (time spent measuring the variable and
+ * checking the predicate) and selectivity (fraction of evaluations
+ * in which the predicate held) of every (measurement type, feature)
+ * predicate it evaluates, and evaluates the operand of an <and> or
+ * <or> that is cheapest per evaluation it decides first. Until every
+ * predicate under both operands has been evaluated at least once the
+ * operands are evaluated in the order they are written.
+ *
+ * Predicate results are also remembered per (variable, predicate) for
+ * the rest of the evaluation, so a variable that reaches several
+ * filters testing the same predicate is measured and checked once.
+ *
+ * If the environment variable MAAT_FILTER_STATS names a file, the
+ * statistics are loaded from it before evaluation and saved back
+ * afterwards so later evaluations start from them.
+ */
+typedef struct {
+    magic_t mtype;
+    char *feature;
+    uint64_t evaluations;	/* times the predicate was evaluated */
+    uint64_t satisfied;		/* times it held */
+    uint64_t nsec;		/* total time spent evaluating it */
+} filter_predicate_stats;
+
+typedef struct {
+    measurement_variable *var;
+    instruction_filter *predicate;
+    int result;
+} filter_memo_entry;
+
+typedef struct {
+    measurement_spec_callbacks *callbacks;
+    void *ctxt;
+    GHashTable *stats;		/* "magic feature" -> filter_predicate_stats */
+    GHashTable *memo;		/* filter_memo_entry set */
+} filter_evaluation;
+
+/* estimated cost and probability of holding of a filter expression */
+typedef struct {
+    double cost;
+    double prob;
+} filter_estimate;
+
+static void free_filter_predicate_stats(filter_predicate_stats *s)
+{
+    if(s != NULL) {
+        free(s->feature);
+        free(s);
+    }
+}
+
+static char *filter_stats_key(magic_t mtype, const char *feature)
 {
-    int rc = -1;
-    switch(filter->type) {
-    case BASE_FILTER:
-        rc = callbacks->measure_variable(ctxt, v, filter->u.b.mtype);
-        if(rc == 0) {
-            rc = callbacks->check_predicate(ctxt, v, filter->u.b.mtype,
-                                            filter->u.b.quantifier,
-                                            filter->u.b.feature,
-                                            filter->u.b.operator,
-                                            filter->u.b.value);
-        } else if(rc > 0) {
-            rc = -1;
-        } else {
-            if(callbacks->handle_error) {
-                rc = callbacks->handle_error(ctxt, rc, v, filter->u.b.mtype);
-                rc = -1; /* FIXME: this makes all errors in filter
-			    predicates fatal because it'll be bubbled
-			    out to the main evaluator as a -1. We'd
-			    rather be able to signal that we aborted
-			    the filtering because we hit an error, but
-			    the error was handled so we can keep
-			    evaluating the measurement spec.
-			 */
-            }
+    return g_strdup_printf("%08"PRIx32" %s", mtype, feature);
+}
+
+static filter_predicate_stats *get_filter_stats(GHashTable *stats, magic_t mtype,
+        const char *feature, bool create)
+{
+    filter_predicate_stats *s;
+    char *key = filter_stats_key(mtype, feature);
+
+    s = g_hash_table_lookup(stats, key);
+    if(s != NULL || !create) {
+        g_free(key);
+        return s;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if(s == NULL || (s->feature = strdup(feature)) == NULL) {
+        dlog(1, "Warning: failed to allocate filter statistics\n");
+        free(s);
+        g_free(key);
+        return NULL;
+    }
+    s->mtype = mtype;
+    g_hash_table_insert(stats, key, s);
+    return s;
+}
+
+/*
+ * Load the statistics saved in @path into @stats. A missing file is
+ * not an error.
+ */
+static int load_filter_stats(GHashTable *stats, const char *path)
+{
+    char line[1024];
+    FILE *fp = fopen(path, "r");
+
+    if(fp == NULL) {
+        if(errno == ENOENT) {
+            return 0;
         }
-        break;
-    case LOGICAL_OP_FILTER:
-        switch(filter->u.o.op) {
-        case FILTER_NOT_OP:
-            rc = evaluate_filter(filter->u.o.e1, v, callbacks, ctxt);
-            if(rc == 0) {
-                rc = 1;
-            } else if(rc == 1) {
-                rc = 0;
-            }
-            break;
-        case FILTER_AND_OP:
-            rc = evaluate_filter(filter->u.o.e1, v, callbacks, ctxt);
-            if(rc > 0) {
-                rc = evaluate_filter(filter->u.o.e2, v, callbacks, ctxt);
-            }
-            break;
-        case FILTER_OR_OP:
-            rc = evaluate_filter(filter->u.o.e1, v, callbacks, ctxt);
-            if(rc == 0) {
-                rc = evaluate_filter(filter->u.o.e2, v, callbacks, ctxt);
-            }
-            break;
+        dlog(1, "Warning: failed to open filter statistics %s: %s\n",
+             path, strerror(errno));
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        filter_predicate_stats *s;
+        uint64_t evaluations, satisfied, nsec;
+        magic_t mtype;
+        int feature = 0;
+
+        line[strcspn(line, "\n")] = '\0';
+        if(sscanf(line, "%"SCNx32" %"SCNu64" %"SCNu64" %"SCNu64" %n",
+                  &mtype, &evaluations, &satisfied, &nsec, &feature) != 4 ||
+                feature == 0 || line[feature] == '\0' || satisfied > evaluations) {
+            dlog(2, "Ignoring malformed filter statistics \"%s\" in %s\n", line, path);
+            continue;
+        }
+        s = get_filter_stats(stats, mtype, line + feature, true);
+        if(s != NULL) {
+            s->evaluations += evaluations;
+            s->satisfied   += satisfied;
+            s->nsec        += nsec;
         }
-        break;
     }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Save @stats to @path, replacing the file atomically so concurrent
+ * evaluations never see it half written.
+ */
+static int save_filter_stats(GHashTable *stats, const char *path)
+{
+    char *tmp = g_strdup_printf("%s.%ld", path, (long)getpid());
+    GHashTableIter iter;
+    filter_predicate_stats *s;
+    FILE *fp;
+    int ret = -1;
+
+    fp = fopen(tmp, "w");
+    if(fp == NULL) {
+        dlog(1, "Warning: failed to save filter statistics to %s: %s\n",
+             tmp, strerror(errno));
+        goto out;
+    }
+
+    g_hash_table_iter_init(&iter, stats);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&s)) {
+        fprintf(fp, "%08"PRIx32" %"PRIu64" %"PRIu64" %"PRIu64" %s\n",
+                s->mtype, s->evaluations, s->satisfied, s->nsec, s->feature);
+    }
+
+    if(fclose(fp) != 0 || rename(tmp, path) != 0) {
+        dlog(1, "Warning: failed to save filter statistics to %s: %s\n",
+             path, strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    g_free(tmp);
+    return ret;
+}
+
+static guint filter_memo_hash(gconstpointer p)
+{
+    const filter_memo_entry *e = (const filter_memo_entry *)p;
+    const address *addr = e->var->address;
+    guint h = e->predicate->u.b.mtype->magic ^ g_str_hash(e->predicate->u.b.feature);
+
+    h ^= g_str_hash(e->predicate->u.b.value) * 31;
+    if(addr != NULL && addr->space->address_hash != NULL) {
+        h ^= addr->space->address_hash(addr);
+    }
+    return h;
+}
+
+static gboolean same_predicate(const instruction_filter *a, const instruction_filter *b)
+{
+    return a == b ||
+           (a->u.b.mtype == b->u.b.mtype &&
+            a->u.b.quantifier == b->u.b.quantifier &&
+            strcmp(a->u.b.feature, b->u.b.feature) == 0 &&
+            strcmp(a->u.b.operator, b->u.b.operator) == 0 &&
+            strcmp(a->u.b.value, b->u.b.value) == 0);
+}
+
+static gboolean filter_memo_equal(gconstpointer pa, gconstpointer pb)
+{
+    const filter_memo_entry *a = (const filter_memo_entry *)pa;
+    const filter_memo_entry *b = (const filter_memo_entry *)pb;
+
+    return same_predicate(a->predicate, b->predicate) &&
+           compare_measurement_variable(a->var, b->var) == 0;
+}
+
+static void free_filter_memo_entry(filter_memo_entry *e)
+{
+    if(e != NULL) {
+        free_measurement_variable(e->var);
+        free(e);
+    }
+}
+
+/*
+ * Return the remembered result of the BASE_FILTER @predicate on @v, or
+ * -1 if it has not been evaluated.
+ */
+static int filter_memo_lookup(filter_evaluation *fe, instruction_filter *predicate,
+                              measurement_variable *v)
+{
+    filter_memo_entry key = {.var = v, .predicate = predicate};
+    filter_memo_entry *e = g_hash_table_lookup(fe->memo, &key);
+
+    return e == NULL ? -1 : e->result;
+}
+
+static void filter_memo_insert(filter_evaluation *fe, instruction_filter *predicate,
+                               measurement_variable *v, int result)
+{
+    filter_memo_entry *e = malloc(sizeof(*e));
+
+    if(e == NULL || (e->var = copy_measurement_variable(v)) == NULL) {
+        free(e);
+        return;
+    }
+    e->predicate = predicate;
+    e->result    = result;
+    g_hash_table_add(fe->memo, e);
+}
+
+static uint64_t monotonic_nsec(void)
+{
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Estimate the cost and selectivity of evaluating @filter on @v with
+ * the operand order evaluate_filter() would choose. Returns false if a
+ * predicate under @filter has never been evaluated.
+ */
+static bool estimate_filter(filter_evaluation *fe, instruction_filter *filter,
+                            measurement_variable *v, filter_estimate *est)
+{
+    filter_estimate e1, e2, first, second;
+
+    if(filter->type == BASE_FILTER) {
+        filter_predicate_stats *s;
+        int memo = filter_memo_lookup(fe, filter, v);
+
+        if(memo >= 0) {
+            est->cost = 0;
+            est->prob = memo;
+            return true;
+        }
+        s = get_filter_stats(fe->stats, filter->u.b.mtype->magic,
+                             filter->u.b.feature, false);
+        if(s == NULL || s->evaluations == 0) {
+            return false;
+        }
+        est->cost = (double)s->nsec / (double)s->evaluations;
+        est->prob = (double)s->satisfied / (double)s->evaluations;
+        return true;
+    }
+
+    if(!estimate_filter(fe, filter->u.o.e1, v, &e1)) {
+        return false;
+    }
+    if(filter->u.o.op == FILTER_NOT_OP) {
+        est->cost = e1.cost;
+        est->prob = 1.0 - e1.prob;
+        return true;
+    }
+    if(!estimate_filter(fe, filter->u.o.e2, v, &e2)) {
+        return false;
+    }
+
+    /*
+     * The second operand of an <and> runs only if the first holds,
+     * so the operand with the lower cost / P(false) goes first; for
+     * an <or>, the lower cost / P(true).
+     */
+    if(filter->u.o.op == FILTER_AND_OP) {
+        bool swap = e2.cost * (1.0 - e1.prob) < e1.cost * (1.0 - e2.prob);
+        first  = swap ? e2 : e1;
+        second = swap ? e1 : e2;
+        est->cost = first.cost + first.prob * second.cost;
+        est->prob = e1.prob * e2.prob;
+    } else {
+        bool swap = e2.cost * e1.prob < e1.cost * e2.prob;
+        first  = swap ? e2 : e1;
+        second = swap ? e1 : e2;
+        est->cost = first.cost + (1.0 - first.prob) * second.cost;
+        est->prob = 1.0 - (1.0 - e1.prob) * (1.0 - e2.prob);
+    }
+    return true;
+}
+
+/*
+ * Return true if the second operand of the <and> or <or> @filter
+ * should be evaluated on @v before the first.
+ */
+static bool evaluate_second_first(filter_evaluation *fe, instruction_filter *filter,
+                                  measurement_variable *v)
+{
+    filter_estimate e1, e2;
+
+    if(!estimate_filter(fe, filter->u.o.e1, v, &e1) ||
+            !estimate_filter(fe, filter->u.o.e2, v, &e2)) {
+        return false;
+    }
+    if(filter->u.o.op == FILTER_AND_OP) {
+        return e2.cost * (1.0 - e1.prob) < e1.cost * (1.0 - e2.prob);
+    }
+    return e2.cost * e1.prob < e1.cost * e2.prob;
+}
+
+static int evaluate_predicate(filter_evaluation *fe, instruction_filter *filter,
+                              measurement_variable *v)
+{
+    measurement_spec_callbacks *callbacks = fe->callbacks;
+    filter_predicate_stats *s;
+    uint64_t start;
+    int rc;
+
+    rc = filter_memo_lookup(fe, filter, v);
+    if(rc >= 0) {
+        return rc;
+    }
+
+    start = monotonic_nsec();
+    rc = callbacks->measure_variable(fe->ctxt, v, filter->u.b.mtype);
+    if(rc == 0) {
+        rc = callbacks->check_predicate(fe->ctxt, v, filter->u.b.mtype,
+                                        filter->u.b.quantifier,
+                                        filter->u.b.feature,
+                                        filter->u.b.operator,
+                                        filter->u.b.value);
+    } else if(rc > 0) {
+        rc = -1;
+    } else {
+        if(callbacks->handle_error) {
+            rc = callbacks->handle_error(fe->ctxt, rc, v, filter->u.b.mtype);
+            rc = -1; /* FIXME: this makes all errors in filter
+			predicates fatal because it'll be bubbled
+			out to the main evaluator as a -1. We'd
+			rather be able to signal that we aborted
+			the filtering because we hit an error, but
+			the error was handled so we can keep
+			evaluating the measurement spec.
+		     */
+        }
+    }
+    if(rc < 0) {
+        return rc;
+    }
+
+    rc = rc > 0 ? 1 : 0;
+    s = get_filter_stats(fe->stats, filter->u.b.mtype->magic, filter->u.b.feature, true);
+    if(s != NULL) {
+        s->evaluations++;
+        s->satisfied += (uint64_t)rc;
+        s->nsec      += monotonic_nsec() - start;
+    }
+    filter_memo_insert(fe, filter, v, rc);
     return rc;
 }
 
+static int evaluate_filter(filter_evaluation *fe, instruction_filter *filter,
+                           measurement_variable *v)
+{
+    instruction_filter *first, *second;
+    int decisive; /* result of one operand that decides the operator */
+    bool swapped;
+    int rc;
+
+    if(filter->type == BASE_FILTER) {
+        return evaluate_predicate(fe, filter, v);
+    }
+
+    if(filter->u.o.op == FILTER_NOT_OP) {
+        rc = evaluate_filter(fe, filter->u.o.e1, v);
+        return rc < 0 ? rc : !rc;
+    }
+
+    decisive = filter->u.o.op == FILTER_AND_OP ? 0 : 1;
+    swapped  = evaluate_second_first(fe, filter, v);
+    first    = swapped ? filter->u.o.e2 : filter->u.o.e1;
+    second   = swapped ? filter->u.o.e1 : filter->u.o.e2;
+
+    rc = evaluate_filter(fe, first, v);
+    if(rc < 0 && swapped) {
+        /* Left to right evaluation would not have reached this error
+           if the first operand decides the operator on its own. */
+        rc = evaluate_filter(fe, second, v);
+        return rc == decisive ? rc : -1;
+    }
+    if(rc < 0 || rc == decisive) {
+        return rc;
+    }
+    return evaluate_filter(fe, second, v);
+}
+
+static int init_filter_evaluation(filter_evaluation *fe,
+                                  measurement_spec_callbacks *callbacks,
+                                  void *ctxt)
+{
+    char *path = getenv(ENV_MAAT_FILTER_STATS);
+
+    fe->callbacks = callbacks;
+    fe->ctxt      = ctxt;
+    fe->stats     = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify)free_filter_predicate_stats);
+    fe->memo      = g_hash_table_new_full(filter_memo_hash, filter_memo_equal,
+                                          (GDestroyNotify)free_filter_memo_entry, NULL);
+    if(fe->stats == NULL || fe->memo == NULL) {
+        dlog(0, "Error: failed to allocate filter evaluation state\n");
+        return -1;
+    }
+
+    if(path != NULL && *path != '\0') {
+        load_filter_stats(fe->stats, path);
+    }
+    return 0;
+}
+
+static void finish_filter_evaluation(filter_evaluation *fe, bool save)
+{
+    char *path = getenv(ENV_MAAT_FILTER_STATS);
+
+    if(save && fe->stats != NULL && g_hash_table_size(fe->stats) > 0 &&
+            path != NULL && *path != '\0') {
+        save_filter_stats(fe->stats, path);
+    }
+    if(fe->memo != NULL) {
+        g_hash_table_destroy(fe->memo);
+        fe->memo = NULL;
+    }
+    if(fe->stats != NULL) {
+        g_hash_table_destroy(fe->stats);
+        fe->stats = NULL;
+    }
+}
+
 static void free_filter_instruction_spec(instruction_spec *spec)
 {
     filter_instruction_spec *fspec = (filter_instruction_spec *)spec;
@@ -1326,6 +1882,34 @@ int instruction_spec_to_str(instruction_spec *spec, char *buf, size_t buflen)
     return instruction_spec_vtables[spec->instr_type].to_str(spec, buf, buflen);
 }
 
+/**
+ * Parse the optional weight="..." attribute of an <instruction>
+ * node. Instructions without a weight have weight 0.
+ */
+static int parse_instruction_weight(xmlNode *node, int *weight)
+{
+    char *str = xmlGetPropASCII(node, "weight");
+    char *end;
+    long val;
+
+    *weight = 0;
+    if(str == NULL) {
+        return 0;
+    }
+
+    errno = 0;
+    val = strtol(str, &end, 0);
+    if(errno != 0 || end == str || *end != '\0' ||
+            val < INT_MIN || val > INT_MAX) {
+        dlog(0, "Error: invalid instruction weight \"%s\"\n", str);
+        free(str);
+        return -1;
+    }
+    free(str);
+    *weight = (int)val;
+    return 0;
+}
+
 instruction_spec *parse_instruction_spec(xmlNode *node)
 {
     char *type = xmlGetPropASCII(node, "type");
@@ -1342,6 +1926,11 @@ instruction_spec *parse_instruction_spec(xmlNode *node)
         dlog(0, "Error: unknown instruction spec type: %s\n", type);
     }
     xmlFree(type);
+
+    if(res != NULL && parse_instruction_weight(node, &res->weight) < 0) {
+        free_instruction_spec(res);
+        res = NULL;
+    }
     return res;
 }
 
@@ -1398,6 +1987,90 @@ static inline void free_measurement_obligation(measurement_obligation *o)
     }
 }
 
+/*
+ * Pending obligations are kept in one FIFO per distinct instruction
+ * weight, heaviest first. Specs only use a handful of weights, so
+ * finding the right FIFO is cheap and a spec that declares no
+ * weights is evaluated in plain FIFO order as before.
+ */
+typedef struct {
+    int weight;
+    GQueue obligations;
+} obligation_level;
+
+typedef struct {
+    GList *levels;
+    guint length;
+} obligation_queue;
+
+/**
+ * Add @o to @q. The queue takes ownership of @o; if it can not be
+ * added it is freed and -1 is returned.
+ */
+static int obligation_queue_push(obligation_queue *q, measurement_obligation *o)
+{
+    obligation_level *level = NULL;
+    GList *iter;
+
+    for(iter = q->levels; iter != NULL; iter = g_list_next(iter)) {
+        obligation_level *l = (obligation_level *)iter->data;
+        if(l->weight == o->instr->weight) {
+            level = l;
+            break;
+        }
+        if(l->weight < o->instr->weight) {
+            break;
+        }
+    }
+
+    if(level == NULL) {
+        level = malloc(sizeof(*level));
+        if(level == NULL) {
+            dlog(0, "Error: failed to allocate measurement obligation queue\n");
+            free_measurement_obligation(o);
+            return -1;
+        }
+        level->weight = o->instr->weight;
+        g_queue_init(&level->obligations);
+        q->levels = g_list_insert_before(q->levels, iter, level);
+    }
+
+    g_queue_push_tail(&level->obligations, o);
+    q->length++;
+    return 0;
+}
+
+static measurement_obligation *obligation_queue_pop(obligation_queue *q)
+{
+    GList *iter;
+
+    for(iter = q->levels; iter != NULL; iter = g_list_next(iter)) {
+        obligation_level *level = (obligation_level *)iter->data;
+        if(!g_queue_is_empty(&level->obligations)) {
+            q->length--;
+            return g_queue_pop_head(&level->obligations);
+        }
+    }
+    return NULL;
+}
+
+static void obligation_queue_clear(obligation_queue *q)
+{
+    GList *iter;
+
+    for(iter = q->levels; iter != NULL; iter = g_list_next(iter)) {
+        obligation_level *level = (obligation_level *)iter->data;
+        measurement_obligation *o;
+        while((o = g_queue_pop_head(&level->obligations)) != NULL) {
+            free_measurement_obligation(o);
+        }
+        free(level);
+    }
+    g_list_free(q->levels);
+    q->levels = NULL;
+    q->length = 0;
+}
+
 instruction_spec *get_instruction_spec(struct meas_spec *mspec, xmlChar *name)
 {
     GList *iter;
@@ -1413,7 +2086,7 @@ instruction_spec *get_instruction_spec(struct meas_spec *mspec, xmlChar *name)
 }
 
 static int enqueue_measurement_roots(struct meas_spec *mspec,
-                                     GQueue *queue,
+                                     obligation_queue *queue,
                                      measurement_spec_callbacks *callbacks,
                                      void *ctxt)
 {
@@ -1453,7 +2126,10 @@ static int enqueue_measurement_roots(struct meas_spec *mspec,
                 }
                 o->var		= tmpvar;
                 o->instr	= instr;
-                g_queue_push_tail(queue, o);
+                tmpvar		= NULL;
+                if(obligation_queue_push(queue, o) < 0) {
+                    goto error_adding_obligations;
+                }
             }
             g_queue_free(vars);
             tmpvar = NULL;
@@ -1463,10 +2139,11 @@ static int enqueue_measurement_roots(struct meas_spec *mspec,
     return 0;
 
 error_adding_obligations:
+    /* the caller owns @queue and frees whatever was added to it */
     free_measurement_variable(tmpvar);
-    g_queue_free_full(vars, (GDestroyNotify)free_measurement_variable);
-    g_queue_free_full(queue, (GDestroyNotify)free_measurement_obligation);
-    queue = NULL;
+    if(vars != NULL) {
+        g_queue_free_full(vars, (GDestroyNotify)free_measurement_variable);
+    }
     return -1;
 }
 
@@ -1474,7 +2151,8 @@ error_adding_obligations:
 static int enqueue_obligations_by_feature(measurement_spec_callbacks *callbacks,
         void *ctxt, measurement_variable *var,
         measurement_type *mtype, char *feature,
-        instruction_spec *target_instr, GQueue *measure_q)
+        instruction_spec *target_instr,
+        obligation_queue *measure_q)
 {
     GList *value_iter;
     address *child_addr;
@@ -1525,7 +2203,7 @@ static int enqueue_obligations_by_feature(measurement_spec_callbacks *callbacks,
         }
         obl->var	= child_var;
         obl->instr	= target_instr;
-        g_queue_push_tail(measure_q, obl);
+        obligation_queue_push(measure_q, obl);
     }
     g_list_free_full(attr_values, free);
     return 0;
@@ -1535,7 +2213,7 @@ static int enqueue_obligations_by_relationship(measurement_spec_callbacks *callb
         void *ctxt, measurement_variable *var,
         measurement_type *type, char *feature,
         instruction_spec *target_instr,
-        GQueue *measure_q)
+        obligation_queue *measure_q)
 {
     GList *childvars = NULL;
     GList *variter;
@@ -1547,6 +2225,7 @@ static int enqueue_obligations_by_relationship(measurement_spec_callbacks *callb
         measurement_variable *child_var = (measurement_variable *)variter->data;
         if(child_var->type != target_instr->target_type) {
             free_measurement_variable(child_var);
+            continue;
         }
         measurement_obligation *child_obligation = calloc(1, sizeof(*child_obligation));
         if(child_obligation == NULL) {
@@ -1556,66 +2235,620 @@ static int enqueue_obligations_by_relationship(measurement_spec_callbacks *callb
         }
         child_obligation->var = child_var;
         child_obligation->instr = target_instr;
-        g_queue_push_tail(measure_q, child_obligation);
+        obligation_queue_push(measure_q, child_obligation);
     }
     g_list_free(childvars);
     return 0;
 }
 
+const char *measurement_budget_limit_name(measurement_budget_limit limit)
+{
+    switch(limit) {
+    case MEASUREMENT_BUDGET_NONE:
+        return "none";
+    case MEASUREMENT_BUDGET_SECONDS:
+        return "seconds";
+    case MEASUREMENT_BUDGET_BYTES:
+        return "bytes";
+    case MEASUREMENT_BUDGET_MEASUREMENTS:
+        return "measurements";
+    }
+    return "unknown";
+}
+
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return time(NULL);
+    }
+    return ts.tv_sec;
+}
+
+static measurement_budget_limit check_budget(const measurement_budget *budget,
+        measurement_coverage *coverage,
+        time_t start)
+{
+    if(budget == NULL) {
+        return MEASUREMENT_BUDGET_NONE;
+    }
+    if(budget->max_measurements > 0 &&
+            coverage->measurements >= budget->max_measurements) {
+        return MEASUREMENT_BUDGET_MEASUREMENTS;
+    }
+    if(budget->max_bytes > 0 && coverage->bytes >= budget->max_bytes) {
+        return MEASUREMENT_BUDGET_BYTES;
+    }
+    if(budget->max_seconds > 0 &&
+            monotonic_seconds() - start >= budget->max_seconds) {
+        return MEASUREMENT_BUDGET_SECONDS;
+    }
+    return MEASUREMENT_BUDGET_NONE;
+}
+
+/**
+ * Measure the variable of obligation @o with @mtype and charge it to
+ * @coverage. Returns < 0 if the error handler declared a failure
+ * fatal.
+ */
+static int measure_obligation(measurement_spec_callbacks *callbacks, void *ctxt,
+                              measurement_obligation *o, measurement_type *mtype,
+                              measurement_coverage *coverage, char *instr_str)
+{
+    int rc = callbacks->measure_variable(ctxt, o->var, mtype);
+
+    coverage->measurements++;
+    if(rc < 0) {
+        if(callbacks->handle_error) {
+            rc = callbacks->handle_error(ctxt, rc, o->var, mtype);
+            if(rc < 0) {
+                return rc;
+            }
+        } else {
+            dlog(1, "WARNING: Error evaluating instruction %s...muddling on\n", instr_str);
+        }
+        return 0;
+    }
+
+    if(callbacks->measurement_cost != NULL) {
+        coverage->bytes += callbacks->measurement_cost(ctxt, o->var, mtype);
+    }
+    return 0;
+}
+
+/*
+ * Checkpoints are a header line holding the MAC of the rest of the
+ * file, followed by an XML document:
+ *
+ *   maat-checkpoint 1 <hex HMAC-SHA256>
+ *   <checkpoint spec="..." created="...">
+ *     <coverage evaluated="..." measurements="..." bytes="..." elapsed="..."/>
+ *     <progress>client progress</progress>
+ *     <obligation instruction="..." target_type="..." address_space="...">
+ *       serialized address
+ *     </obligation>
+ *     ...
+ *   </checkpoint>
+ *
+ * Obligations are listed in the order they would be evaluated.
+ */
+#define CHECKPOINT_MAGIC	"maat-checkpoint"
+#define CHECKPOINT_VERSION	1
+
+static inline bool checkpoint_has_key(const measurement_checkpoint *ckpt)
+{
+    return ckpt->key != NULL && ckpt->keylen > 0;
+}
+
+static char *checkpoint_mac(const measurement_checkpoint *ckpt,
+                            const char *data, size_t size)
+{
+    if(!checkpoint_has_key(ckpt)) {
+        return NULL;
+    }
+    return g_compute_hmac_for_data(G_CHECKSUM_SHA256, ckpt->key, ckpt->keylen,
+                                   (const guchar *)data, size);
+}
+
+static int add_checkpoint_obligation(xmlNode *root, measurement_obligation *o)
+{
+    char *addr = serialize_address(o->var->address);
+    char magic[9];
+    xmlNode *node;
+
+    if(addr == NULL) {
+        dlog(1, "Warning: failed to serialize address of pending obligation\n");
+        return -1;
+    }
+    node = xmlNewTextChild(root, NULL, (xmlChar *)"obligation", (xmlChar *)addr);
+    free(addr);
+    if(node == NULL) {
+        return -1;
+    }
+    xmlNewProp(node, (xmlChar *)"instruction", o->instr->name);
+    snprintf(magic, sizeof(magic), "%08"PRIx32, o->var->type->magic);
+    xmlNewProp(node, (xmlChar *)"target_type", (xmlChar *)magic);
+    snprintf(magic, sizeof(magic), "%08"PRIx32, o->var->address->space->magic);
+    xmlNewProp(node, (xmlChar *)"address_space", (xmlChar *)magic);
+    return 0;
+}
+
+/*
+ * Save the state of the evaluation of @mspec: the obligations pending
+ * in @q and the coverage so far. The previous checkpoint is replaced
+ * atomically, so a crash while saving leaves it intact.
+ */
+static int save_checkpoint(struct meas_spec *mspec, const measurement_checkpoint *ckpt,
+                           obligation_queue *q, const measurement_coverage *cov,
+                           void *ctxt)
+{
+    char uuid_str[37], buf[32];
+    char *progress = NULL, *mac = NULL, *tmp = NULL;
+    xmlChar *xml = NULL;
+    xmlNode *root, *node;
+    xmlDoc *doc;
+    GList *iter;
+    GString *contents = NULL;
+    int size = 0;
+    int ret = -1;
+
+    doc  = xmlNewDoc((xmlChar *)"1.0");
+    root = xmlNewNode(NULL, (xmlChar *)"checkpoint");
+    if(doc == NULL || root == NULL) {
+        xmlFreeNode(root);
+        goto out;
+    }
+    xmlDocSetRootElement(doc, root);
+
+    uuid_unparse(mspec->uuid, uuid_str);
+    xmlNewProp(root, (xmlChar *)"spec", (xmlChar *)uuid_str);
+    snprintf(buf, sizeof(buf), "%lld", (long long)time(NULL));
+    xmlNewProp(root, (xmlChar *)"created", (xmlChar *)buf);
+
+    node = xmlNewChild(root, NULL, (xmlChar *)"coverage", NULL);
+    snprintf(buf, sizeof(buf), "%"PRIu32, cov->evaluated);
+    xmlNewProp(node, (xmlChar *)"evaluated", (xmlChar *)buf);
+    snprintf(buf, sizeof(buf), "%"PRIu32, cov->measurements);
+    xmlNewProp(node, (xmlChar *)"measurements", (xmlChar *)buf);
+    snprintf(buf, sizeof(buf), "%"PRIu64, cov->bytes);
+    xmlNewProp(node, (xmlChar *)"bytes", (xmlChar *)buf);
+    snprintf(buf, sizeof(buf), "%lld", (long long)cov->elapsed);
+    xmlNewProp(node, (xmlChar *)"elapsed", (xmlChar *)buf);
+
+    if(ckpt->progress != NULL) {
+        progress = ckpt->progress(ctxt);
+        if(progress == NULL) {
+            dlog(1, "Warning: failed to get progress for checkpoint\n");
+            goto out;
+        }
+        xmlNewTextChild(root, NULL, (xmlChar *)"progress", (xmlChar *)progress);
+    }
+
+    for(iter = q->levels; iter != NULL; iter = g_list_next(iter)) {
+        obligation_level *level = (obligation_level *)iter->data;
+        GList *o;
+        for(o = level->obligations.head; o != NULL; o = g_list_next(o)) {
+            if(add_checkpoint_obligation(root, o->data) < 0) {
+                goto out;
+            }
+        }
+    }
+
+    xmlDocDumpMemory(doc, &xml, &size);
+    if(xml == NULL || size <= 0) {
+        goto out;
+    }
+
+    mac = checkpoint_mac(ckpt, (char *)xml, (size_t)size);
+    if(mac == NULL) {
+        goto out;
+    }
+    contents = g_string_new(NULL);
+    g_string_append_printf(contents, CHECKPOINT_MAGIC" %d %s\n", CHECKPOINT_VERSION, mac);
+    g_string_append_len(contents, (char *)xml, size);
+
+    tmp = g_strdup_printf("%s.tmp", ckpt->path);
+    if(buffer_to_file_perm(tmp, (unsigned char *)contents->str, contents->len,
+                           S_IRUSR | S_IWUSR) != (ssize_t)contents->len ||
+            rename(tmp, ckpt->path) != 0) {
+        dlog(1, "Warning: failed to save checkpoint %s\n", ckpt->path);
+        unlink(tmp);
+        goto out;
+    }
+    dlog(4, "Saved checkpoint %s with %u pending obligations\n", ckpt->path, q->length);
+    ret = 0;
+
+out:
+    if(contents != NULL) {
+        g_string_free(contents, TRUE);
+    }
+    g_free(tmp);
+    g_free(mac);
+    xmlFree(xml);
+    xmlFreeDoc(doc);
+    free(progress);
+    return ret;
+}
+
+static int checkpoint_prop_u64(xmlNode *node, const char *name, uint64_t *out)
+{
+    char *val = xmlGetPropASCII(node, name);
+    char *end;
+    int ret = -1;
+
+    if(val != NULL) {
+        errno = 0;
+        *out = strtoull(val, &end, 10);
+        ret = (errno == 0 && end != val && *end == '\0' && val[0] != '-') ? 0 : -1;
+    }
+    free(val);
+    return ret;
+}
+
+static int checkpoint_prop_magic(xmlNode *node, const char *name, magic_t *out)
+{
+    char *val = xmlGetPropASCII(node, name);
+    char *end;
+    unsigned long m;
+    int ret = -1;
+
+    if(val != NULL) {
+        m = strtoul(val, &end, 16);
+        if(end != val && *end == '\0' && m <= UINT32_MAX) {
+            *out = (magic_t)m;
+            ret = 0;
+        }
+    }
+    free(val);
+    return ret;
+}
+
+/*
+ * Rebuild the obligation saved in @node, checking that it is one
+ * @mspec could have produced.
+ */
+static measurement_obligation *load_checkpoint_obligation(struct meas_spec *mspec,
+        xmlNode *node)
+{
+    measurement_obligation *o = NULL;
+    instruction_spec *instr = NULL;
+    target_type *ttype;
+    address_space *space;
+    address *addr = NULL;
+    magic_t tmagic, smagic;
+    char *name, *serialized;
+
+    name = xmlGetPropASCII(node, "instruction");
+    if(name != NULL) {
+        instr = get_instruction_spec(mspec, (xmlChar *)name);
+    }
+    free(name);
+    if(instr == NULL ||
+            checkpoint_prop_magic(node, "target_type", &tmagic) < 0 ||
+            checkpoint_prop_magic(node, "address_space", &smagic) < 0) {
+        return NULL;
+    }
+
+    ttype = find_target_type(tmagic);
+    space = find_address_space(smagic);
+    if(ttype == NULL || space == NULL ||
+            ttype != instr->target_type || space != instr->address_space) {
+        dlog(1, "Obligation of instruction %s has the wrong type\n", instr->name);
+        return NULL;
+    }
+
+    serialized = xmlNodeGetContentASCII(node);
+    if(serialized != NULL) {
+        addr = parse_address(space, serialized, strlen(serialized) + 1);
+    }
+    free(serialized);
+    if(addr == NULL) {
+        return NULL;
+    }
+
+    o = malloc(sizeof(*o));
+    if(o == NULL || (o->var = new_measurement_variable(ttype, addr)) == NULL) {
+        free_address(addr);
+        free(o);
+        return NULL;
+    }
+    o->instr = instr;
+    return o;
+}
+
+/*
+ * Load the checkpoint of @mspec. If @q is not NULL the pending
+ * obligations are added to it and the saved coverage is written to
+ * @cov. See read_measurement_checkpoint() for the return values.
+ */
+static int load_checkpoint(struct meas_spec *mspec, const measurement_checkpoint *ckpt,
+                           obligation_queue *q, measurement_coverage *cov,
+                           char **progress)
+{
+    char uuid_str[37];
+    char *contents = NULL, *body, *mac = NULL, *spec = NULL;
+    char saved_mac[65];
+    uint64_t created = 0, evaluated = 0, measurements = 0, bytes = 0, elapsed = 0;
+    xmlDoc *doc = NULL;
+    xmlNode *root, *node;
+    gsize size = 0;
+    int version = 0;
+    int ret = -EBADMSG;
+
+    if(access(ckpt->path, F_OK) != 0) {
+        return errno == ENOENT ? -ENOENT : -errno;
+    }
+    if(!g_file_get_contents(ckpt->path, &contents, &size, NULL)) {
+        dlog(1, "Failed to read checkpoint %s\n", ckpt->path);
+        return -EIO;
+    }
+
+    body = memchr(contents, '\n', size);
+    if(body == NULL ||
+            sscanf(contents, CHECKPOINT_MAGIC" %d %64[0-9a-f]\n", &version, saved_mac) != 2 ||
+            version != CHECKPOINT_VERSION) {
+        dlog(1, "Checkpoint %s is malformed\n", ckpt->path);
+        goto out;
+    }
+    body++;
+
+    mac = checkpoint_mac(ckpt, body, size - (size_t)(body - contents));
+    if(mac == NULL || strcmp(mac, saved_mac) != 0) {
+        dlog(1, "Checkpoint %s failed its integrity check\n", ckpt->path);
+        goto out;
+    }
+
+    doc = xmlReadMemory(body, (int)(size - (size_t)(body - contents)), NULL, NULL,
+                        XML_PARSE_NONET);
+    root = doc ? xmlDocGetRootElement(doc) : NULL;
+    if(root == NULL || xmlStrcmp(root->name, (xmlChar *)"checkpoint") != 0) {
+        dlog(1, "Checkpoint %s is malformed\n", ckpt->path);
+        goto out;
+    }
+
+    uuid_unparse(mspec->uuid, uuid_str);
+    spec = xmlGetPropASCII(root, "spec");
+    if(spec == NULL || strcasecmp(spec, uuid_str) != 0) {
+        dlog(1, "Checkpoint %s is for another measurement specification\n", ckpt->path);
+        goto out;
+    }
+
+    if(checkpoint_prop_u64(root, "created", &created) < 0) {
+        dlog(1, "Checkpoint %s is malformed\n", ckpt->path);
+        goto out;
+    }
+    if(ckpt->max_age > 0 && (uint64_t)time(NULL) > created + (uint64_t)ckpt->max_age) {
+        dlog(1, "Checkpoint %s is too old to resume\n", ckpt->path);
+        ret = -ESTALE;
+        goto out;
+    }
+
+    for(node = root->children; node != NULL; node = node->next) {
+        if(node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        if(xmlStrcmp(node->name, (xmlChar *)"coverage") == 0) {
+            if(checkpoint_prop_u64(node, "evaluated", &evaluated) < 0 ||
+                    checkpoint_prop_u64(node, "measurements", &measurements) < 0 ||
+                    checkpoint_prop_u64(node, "bytes", &bytes) < 0 ||
+                    checkpoint_prop_u64(node, "elapsed", &elapsed) < 0 ||
+                    evaluated > UINT32_MAX || measurements > UINT32_MAX) {
+                dlog(1, "Checkpoint %s has malformed coverage\n", ckpt->path);
+                goto out;
+            }
+        } else if(xmlStrcmp(node->name, (xmlChar *)"progress") == 0) {
+            if(progress != NULL && *progress == NULL) {
+                *progress = xmlNodeGetContentASCII(node);
+            }
+        } else if(xmlStrcmp(node->name, (xmlChar *)"obligation") == 0) {
+            measurement_obligation *o = load_checkpoint_obligation(mspec, node);
+            if(o == NULL) {
+                dlog(1, "Checkpoint %s has an obligation the spec can not have\n",
+                     ckpt->path);
+                goto out;
+            }
+            if(q == NULL) {
+                free_measurement_obligation(o);
+            } else if(obligation_queue_push(q, o) < 0) {
+                ret = -ENOMEM;
+                goto out;
+            }
+        } else {
+            dlog(1, "Checkpoint %s is malformed\n", ckpt->path);
+            goto out;
+        }
+    }
+
+    if(cov != NULL) {
+        memset(cov, 0, sizeof(*cov));
+        cov->evaluated    = (uint32_t)evaluated;
+        cov->measurements = (uint32_t)measurements;
+        cov->bytes        = bytes;
+        cov->elapsed      = (time_t)elapsed;
+    }
+    ret = 0;
+
+out:
+    if(ret < 0 && progress != NULL) {
+        free(*progress);
+        *progress = NULL;
+    }
+    free(spec);
+    g_free(mac);
+    xmlFreeDoc(doc);
+    g_free(contents);
+    return ret;
+}
+
+int read_measurement_checkpoint(struct meas_spec *mspec,
+                                const measurement_checkpoint *ckpt,
+                                char **progress)
+{
+    if(mspec == NULL || ckpt == NULL || ckpt->path == NULL || progress == NULL ||
+            !checkpoint_has_key(ckpt)) {
+        return -EINVAL;
+    }
+    *progress = NULL;
+    return load_checkpoint(mspec, ckpt, NULL, NULL, progress);
+}
+
+static int evaluate_spec(struct meas_spec *mspec,
+                         measurement_spec_callbacks *callbacks,
+                         void *ctxt,
+                         const measurement_budget *budget,
+                         measurement_coverage *coverage,
+                         const measurement_checkpoint *ckpt);
+
+/*
+ * Evidence gathered under the budget declared by @mspec may be
+ * partial, so the budget is only honored if the coverage can be
+ * recorded with it.
+ */
+static int check_spec_budget(struct meas_spec *mspec,
+                             measurement_spec_callbacks *callbacks)
+{
+    if(measurement_budget_is_limited(&mspec->budget) &&
+            callbacks->record_coverage == NULL) {
+        dlog(0, "Error: measurement spec declares a budget, but the evaluator "
+             "cannot record coverage\n");
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
 int evaluate_measurement_spec(struct meas_spec *mspec,
                               measurement_spec_callbacks *callbacks,
                               void *ctxt)
 {
-    GQueue *measure_q = g_queue_new();
-    measurement_obligation *o = NULL;
     int rc;
 
-    if(!measure_q || mspec == NULL) {
+    if(mspec == NULL) {
         return -1;
     }
+    if((rc = check_spec_budget(mspec, callbacks)) < 0) {
+        return rc;
+    }
+    return evaluate_measurement_spec_with_budget(mspec, callbacks, ctxt,
+            &mspec->budget, NULL);
+}
 
-    rc = enqueue_measurement_roots(mspec, measure_q, callbacks, ctxt);
-    if(rc < 0) {
+int evaluate_measurement_spec_with_budget(struct meas_spec *mspec,
+        measurement_spec_callbacks *callbacks,
+        void *ctxt,
+        const measurement_budget *budget,
+        measurement_coverage *coverage)
+{
+    return evaluate_spec(mspec, callbacks, ctxt, budget, coverage, NULL);
+}
+
+int evaluate_measurement_spec_checkpointed(struct meas_spec *mspec,
+        measurement_spec_callbacks *callbacks,
+        void *ctxt,
+        const measurement_checkpoint *ckpt,
+        measurement_coverage *coverage)
+{
+    int rc;
+
+    if(mspec == NULL || ckpt == NULL || ckpt->path == NULL ||
+            !checkpoint_has_key(ckpt)) {
+        return -EINVAL;
+    }
+    if((rc = check_spec_budget(mspec, callbacks)) < 0) {
+        return rc;
+    }
+    return evaluate_spec(mspec, callbacks, ctxt, &mspec->budget, coverage, ckpt);
+}
+
+static int evaluate_spec(struct meas_spec *mspec,
+                         measurement_spec_callbacks *callbacks,
+                         void *ctxt,
+                         const measurement_budget *budget,
+                         measurement_coverage *coverage,
+                         const measurement_checkpoint *ckpt)
+{
+    obligation_queue measure_q = {NULL, 0};
+    measurement_obligation *o = NULL;
+    filter_evaluation fe = {0};
+    measurement_coverage cov;
+    uint32_t interval = 0, since_checkpoint = 0;
+    time_t start;
+    int rc = -ENOENT;
+
+    if(mspec == NULL) {
+        return -1;
+    }
+
+    if(!measurement_budget_is_limited(budget)) {
+        budget = NULL;
+    }
+    memset(&cov, 0, sizeof(cov));
+    start = monotonic_seconds();
+
+    if(init_filter_evaluation(&fe, callbacks, ctxt) < 0) {
         goto error;
     }
 
-    while((o = g_queue_pop_head(measure_q)) != NULL) {
+    if(ckpt != NULL) {
+        interval = ckpt->interval ? ckpt->interval : MEASUREMENT_CHECKPOINT_DEFAULT_INTERVAL;
+        rc = load_checkpoint(mspec, ckpt, &measure_q, &cov, NULL);
+        if(rc == 0) {
+            dlog(2, "Resuming evaluation from checkpoint %s: %"PRIu32" obligations "
+                 "evaluated, %u pending\n", ckpt->path, cov.evaluated, measure_q.length);
+            start -= cov.elapsed;
+        } else if(rc != -ENOENT) {
+            obligation_queue_clear(&measure_q);
+            finish_filter_evaluation(&fe, false);
+            return rc;
+        }
+    }
+
+    if(rc == -ENOENT) {
+        rc = enqueue_measurement_roots(mspec, &measure_q, callbacks, ctxt);
+        if(rc < 0) {
+            goto error;
+        }
+        if(ckpt != NULL) {
+            save_checkpoint(mspec, ckpt, &measure_q, &cov, ctxt);
+        }
+    }
+
+    while(measure_q.length > 0) {
         char instr_str[1024];
+
+        if(ckpt != NULL && since_checkpoint >= interval) {
+            cov.elapsed = monotonic_seconds() - start;
+            save_checkpoint(mspec, ckpt, &measure_q, &cov, ctxt);
+            since_checkpoint = 0;
+        }
+
+        cov.exhausted = check_budget(budget, &cov, start);
+        if(cov.exhausted != MEASUREMENT_BUDGET_NONE) {
+            break;
+        }
+
+        o = obligation_queue_pop(&measure_q);
+        cov.evaluated++;
+        since_checkpoint++;
+
         instruction_spec_to_str(o->instr, instr_str, 1024);
         dlog(3, "Evaluating instruction %s\n", instr_str);
         switch(o->instr->instr_type) {
         case SIMPLE_INSTR: {
             simple_instruction_spec *spec = (simple_instruction_spec*)o->instr;
             dlog(4, "Evaluating simple measurement instruction\n");
-            rc = callbacks->measure_variable(ctxt, o->var, spec->mtype);
-            if(rc < 0) {
-                if(callbacks->handle_error) {
-                    rc = callbacks->handle_error(ctxt, rc, o->var, spec->mtype);
-                    if(rc < 0) {
-                        goto error;
-                    }
-                } else {
-                    dlog(1, "WARNING: Error evaluating instruction %s...muddling on\n", instr_str);
-                }
+            if(measure_obligation(callbacks, ctxt, o, spec->mtype, &cov, instr_str) < 0) {
+                goto error;
             }
             free_measurement_obligation(o);
+            o = NULL;
             break;
         }
         case SUBMEASURE_INSTR: {
             submeasure_instruction_spec *spec = (submeasure_instruction_spec*)o->instr;
             GList *action_iter;
 
-
-            rc = callbacks->measure_variable(ctxt, o->var, spec->mtype);
-            if(rc < 0) {
-                if(callbacks->handle_error) {
-                    rc = callbacks->handle_error(ctxt, rc, o->var, spec->mtype);
-                    if(rc < 0) {
-                        goto error;
-                    }
-                } else {
-                    dlog(1, "WARNING: Error evaluating instruction %s...muddling on\n", instr_str);
-                }
+            if(measure_obligation(callbacks, ctxt, o, spec->mtype, &cov, instr_str) < 0) {
+                goto error;
             }
 
             for(action_iter = g_list_first(spec->actions) ; action_iter != NULL; action_iter = g_list_next(action_iter)) {
@@ -1630,20 +2863,21 @@ int evaluate_measurement_spec(struct meas_spec *mspec,
                 if(callbacks->get_related_variables == NULL) {
                     enqueue_obligations_by_feature(callbacks,
                                                    ctxt, o->var, spec->mtype, action->feature,
-                                                   target_instr, measure_q);
+                                                   target_instr, &measure_q);
                 } else {
                     enqueue_obligations_by_relationship(callbacks,
                                                         ctxt, o->var, spec->mtype, action->feature,
-                                                        target_instr, measure_q);
+                                                        target_instr, &measure_q);
                 }
             }
             free_measurement_obligation(o);
+            o = NULL;
             break;
         }
 
         case FILTER_INSTR: {
             filter_instruction_spec *spec = (filter_instruction_spec *)o->instr;
-            rc = evaluate_filter(spec->filter, o->var, callbacks, ctxt);
+            rc = evaluate_filter(&fe, spec->filter, o->var);
             if(rc < 0) {
                 goto error;
             }
@@ -1657,9 +2891,14 @@ int evaluate_measurement_spec(struct meas_spec *mspec,
                     goto error;
                 }
                 o->instr = target_instr;
-                g_queue_push_tail(measure_q, o);
+                rc = obligation_queue_push(&measure_q, o);
+                o = NULL;
+                if(rc < 0) {
+                    goto error;
+                }
             } else {
                 free_measurement_obligation(o);
+                o = NULL;
             }
             break;
         }
@@ -1671,11 +2910,34 @@ int evaluate_measurement_spec(struct meas_spec *mspec,
         }
     }
 
-    g_queue_free(measure_q);
+    cov.skipped = measure_q.length;
+    cov.elapsed = monotonic_seconds() - start;
+    obligation_queue_clear(&measure_q);
+    finish_filter_evaluation(&fe, true);
 
+    if(cov.exhausted != MEASUREMENT_BUDGET_NONE) {
+        dlog(1, "Warning: measurement budget exhausted (%s): %"PRIu32" obligations "
+             "evaluated, %"PRIu32" skipped\n",
+             measurement_budget_limit_name(cov.exhausted),
+             cov.evaluated, cov.skipped);
+    }
+
+    if(budget != NULL && callbacks->record_coverage != NULL &&
+            callbacks->record_coverage(ctxt, &cov) < 0) {
+        dlog(1, "Warning: failed to record measurement coverage\n");
+    }
+
+    if(coverage != NULL) {
+        *coverage = cov;
+    }
+    if(ckpt != NULL && unlink(ckpt->path) != 0 && errno != ENOENT) {
+        dlog(1, "Warning: failed to remove checkpoint %s\n", ckpt->path);
+    }
     return 0;
+
 error:
-    g_queue_free_full(measure_q, (GDestroyNotify)free_measurement_obligation);
+    obligation_queue_clear(&measure_q);
+    finish_filter_evaluation(&fe, false);
     free_measurement_obligation(o);
     return -1;
 }
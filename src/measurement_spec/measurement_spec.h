@@ -23,6 +23,8 @@
 #define __MEASUREMENT_SPEC_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <uuid/uuid.h>
 #include <libxml/tree.h>
 #include <measurement_spec/meas_spec-api.h>
@@ -49,6 +51,98 @@
  * using the parse_measurement_spec() and evaluate_measurement_spec()
  * and free_measurement_spec() functions declared below.
  */
+/**
+ * Limits on the work done while evaluating a measurement
+ * specification. A limit of zero means unlimited; a budget with all
+ * limits zero is the unlimited budget.
+ *
+ * Specifications declare a budget with an optional
+ *
+ *     <budget seconds="60" bytes="1073741824" measurements="500"/>
+ *
+ * element. Each attribute is optional.
+ */
+typedef struct measurement_budget {
+    time_t max_seconds;        /** wall clock time */
+    uint64_t max_bytes;        /** bytes hashed, as reported by
+				   the ->measurement_cost() callback */
+    uint32_t max_measurements; /** calls to ->measure_variable() */
+} measurement_budget;
+
+typedef enum {
+    MEASUREMENT_BUDGET_NONE = 0,	/** evaluation completed */
+    MEASUREMENT_BUDGET_SECONDS,
+    MEASUREMENT_BUDGET_BYTES,
+    MEASUREMENT_BUDGET_MEASUREMENTS
+} measurement_budget_limit;
+
+/**
+ * Record of how much of a specification an evaluation covered. If
+ * ->exhausted is MEASUREMENT_BUDGET_NONE every obligation was
+ * evaluated; otherwise evaluation stopped when the named limit was
+ * reached and ->skipped obligations were dropped.
+ */
+typedef struct measurement_coverage {
+    uint32_t evaluated;
+    uint32_t skipped;
+    uint32_t measurements;
+    uint64_t bytes;
+    time_t elapsed;
+    measurement_budget_limit exhausted;
+} measurement_coverage;
+
+/**
+ * Rolling coverage sampling of file hashes. Instead of hashing every
+ * file it lists, an APB that supports sampling hashes a pseudorandom
+ * subset chosen with a key derived from the appraiser's nonce, plus
+ * any file that was not hashed in the last @rounds - 1 rounds.
+ * Specifications request it with an optional
+ *
+ *     <sampling rate="0.05" rounds="30"/>
+ *
+ * element. rate is the fraction of files sampled each round, in
+ * (0, 1]; rounds is optional and 0 (the default) gives no coverage
+ * guarantee. Without the element every file is hashed.
+ */
+#define MEASUREMENT_SAMPLING_SCALE 1000000
+
+typedef struct measurement_sampling {
+    uint32_t rate_ppm;		/** parts per MEASUREMENT_SAMPLING_SCALE,
+				    0 if sampling is disabled */
+    uint32_t rounds;		/** coverage window in rounds */
+} measurement_sampling;
+
+/*
+ * How APBs hash ranges of process memory for sha256 measurements.
+ * Specifications choose with an optional
+ *
+ *     <memory_hash mode="pagetree"/>
+ *
+ * element. "flat" (the default) is the sha256 of the range. "pagetree"
+ * is the sha256 of the sha256 digests of the range split on page
+ * boundaries, which lets the digests of pages of files mapped by many
+ * processes be computed once per attestation. The two are not
+ * comparable, so an appraiser must know which the specification asked
+ * for.
+ */
+typedef enum memory_hash_mode {
+    MEMORY_HASH_FLAT = 0,
+    MEMORY_HASH_PAGETREE,
+} memory_hash_mode;
+
+/*
+ * Export filter rules, in the form taken by
+ * measurement_graph_filter_add_rule(), for APBs that serialize the
+ * graph with serialize_graph_asp. Specifications give them with an
+ * optional
+ *
+ *     <export>
+ *       <rule>drop-target=directory</rule>
+ *       <rule>project=blob</rule>
+ *     </export>
+ *
+ * element. Without it the whole graph is sent.
+ */
 typedef struct meas_spec {
     char *filename;
     xmlChar *name;
@@ -57,8 +151,18 @@ typedef struct meas_spec {
     xmlChar *desc;
     GList *instruction_list;
     GList *variable_list;
+    measurement_budget budget;
+    measurement_sampling sampling;
+    memory_hash_mode memory_hash;
+    GList *export_rules;	/** char * export filter rules */
 } meas_spec;
 
+static inline bool measurement_budget_is_limited(const measurement_budget *b)
+{
+    return b != NULL && (b->max_seconds > 0 || b->max_bytes > 0 ||
+                         b->max_measurements > 0);
+}
+
 
 /**
  * Table of callbacks that should be passed to
@@ -203,6 +307,22 @@ typedef struct {
      */
     int (*handle_error)(void *ctxt, int rc, measurement_variable *var,
                         measurement_type *mtype);
+
+    /**
+     * Return the number of bytes hashed to measure @var with
+     * @mtype, counted against the max_bytes budget. Called after each
+     * successful ->measure_variable(). Optional; if undefined the
+     * byte budget is never exhausted.
+     */
+    uint64_t (*measurement_cost)(void *ctxt, measurement_variable *var,
+                                 measurement_type *mtype);
+
+    /**
+     * Record the coverage of an evaluation that ran under a budget,
+     * so consumers of the evidence can tell whether it is complete.
+     * Called once when evaluation finishes without error. Optional.
+     */
+    int (*record_coverage)(void *ctxt, measurement_coverage *coverage);
 } measurement_spec_callbacks;
 
 /**
@@ -218,10 +338,108 @@ typedef struct {
  * Obligations are then discharged by calling measure_variable() and
  * possibly enqueueing subsequent obligations (for submeasure or
  * filter instruction types).
+ *
+ * The operands of <and> and <or> filters may be evaluated in either
+ * order: the evaluator measures the cost and selectivity of each
+ * predicate and tries the cheapest, most decisive operand first. A
+ * predicate is measured and checked at most once per variable. Set
+ * MAAT_FILTER_STATS to a file to keep the statistics across
+ * evaluations.
  */
 int evaluate_measurement_spec(meas_spec *spec,
                               measurement_spec_callbacks *callbacks,
                               void *ctxt);
+
+/**
+ * Evaluate @spec as evaluate_measurement_spec() does, but stop once
+ * any limit of @budget is reached (@budget may be NULL for no
+ * limit). evaluate_measurement_spec() uses the budget declared by the
+ * spec itself, and fails with -ENOTSUP without evaluating anything if
+ * the spec declares one but @callbacks has no ->record_coverage():
+ * evidence that may be partial must say so.
+ *
+ * Pending obligations are evaluated in order of decreasing weight of
+ * their instruction (the weight="..." attribute of <instruction>,
+ * default 0) and in FIFO order among equal weights, so the most
+ * important evidence is gathered before the budget runs out.
+ *
+ * Running out of budget is not an error: the function returns 0 and
+ * the coverage achieved is written to @coverage (if not NULL) and,
+ * when a budget is in effect, passed to ->record_coverage().
+ */
+int evaluate_measurement_spec_with_budget(meas_spec *spec,
+        measurement_spec_callbacks *callbacks,
+        void *ctxt,
+        const measurement_budget *budget,
+        measurement_coverage *coverage);
+
+/**
+ * Return a short name ("seconds", "bytes", ...) for @limit.
+ */
+const char *measurement_budget_limit_name(measurement_budget_limit limit);
+
+/**
+ * Checkpointing of long evaluations. Every @interval obligations the
+ * evaluator saves its state to @path: the pending obligations, the
+ * coverage of the completed ones and a string from the client's
+ * ->progress() callback recording its own state, such as the
+ * high-water marks of the measurement graph being built. A later
+ * evaluation of the same spec with the same @path continues from
+ * there instead of starting over.
+ *
+ * The file is authenticated with an HMAC-SHA256 under @key, which is
+ * required, and bound to the spec's UUID. A
+ * checkpoint that fails these checks, names instructions or types the
+ * spec does not have, or is older than @max_age seconds (if not 0) is
+ * never resumed.
+ */
+#define MEASUREMENT_CHECKPOINT_DEFAULT_INTERVAL 100
+
+typedef struct measurement_checkpoint {
+    const char *path;
+    uint32_t interval;		/** obligations between checkpoints,
+				    0 for the default */
+    time_t max_age;
+    const unsigned char *key;
+    size_t keylen;
+    /**
+     * Return a malloc()ed string recording the client's progress to
+     * be saved with the checkpoint. @ctxt is the context passed to
+     * evaluate_measurement_spec_checkpointed(). Optional.
+     */
+    char *(*progress)(void *ctxt);
+} measurement_checkpoint;
+
+/**
+ * Verify the checkpoint of @spec at @ckpt->path and return the client
+ * progress saved in it in *@progress (NULL if there is none), which
+ * the caller must free(). Clients use this to restore their own state
+ * before resuming.
+ *
+ * Returns 0 if the checkpoint can be resumed, -ENOENT if there is
+ * none, -EBADMSG if it is tampered with or does not match @spec,
+ * -ESTALE if it is too old and < 0 on other errors.
+ */
+int read_measurement_checkpoint(meas_spec *spec,
+                                const measurement_checkpoint *ckpt,
+                                char **progress);
+
+/**
+ * Evaluate @spec under its budget as evaluate_measurement_spec() does,
+ * saving checkpoints as described by @ckpt. If a checkpoint exists the
+ * evaluation continues from it; the coverage reported includes the
+ * work done before it was saved.
+ *
+ * The checkpoint is removed when evaluation finishes and kept if it
+ * fails. Returns 0 on success, the error read_measurement_checkpoint()
+ * would return if there is a checkpoint that can not be resumed, or
+ * < 0 on other errors.
+ */
+int evaluate_measurement_spec_checkpointed(meas_spec *spec,
+        measurement_spec_callbacks *callbacks,
+        void *ctxt,
+        const measurement_checkpoint *ckpt,
+        measurement_coverage *coverage);
 /**
  * Parse a measurement specification file into a struct meas_spec
  * according to the schema measurement_spec.xsd. This is the global
@@ -284,6 +502,11 @@ int evaluate_measurement_spec(meas_spec *spec,
  *    variable. Filter instructions define an additional measurement
  *    that must be performed for variables satisfying a given predicate.
  *
+ *  + An <instruction> node may have an integer weight="..."
+ *    attribute. Obligations of heavier instructions are evaluated
+ *    first, which matters when the optional <budget> node limits
+ *    how much of the spec is evaluated (see measurement_budget).
+ *
  *  + The name and magic fields of target_type, address_type, and
  *    measurement_type nodes should match the names and magic numbers
  *    declared for their respective types (for more detail see
@@ -63,6 +63,9 @@ typedef struct {
     address_space *address_space; /** the space for addresses of
 				      variable that this instruction
 				      applies to. */
+    int weight;                   /** priority of obligations using
+				      this instruction, higher weights
+				      are evaluated first. */
 } instruction_spec;
 
 /**
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * maat-procmon: starts, stops or reports on the eBPF process inventory
+ * read by the lsproc ASP.
+ *
+ * usage: maat-procmon start|stop|status
+ *
+ * start loads and attaches the programs, pins them and their maps
+ * under PROCMON_PIN_DIR and seeds the inventory from /proc with the
+ * processes that already exist. The pinned programs stay attached
+ * after maat-procmon exits, until stop removes the pins. Once the
+ * inventory has missed an update, lsproc no longer uses it; stop and
+ * start it again to reseed it.
+ */
+
+#include <config.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <grp.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include <util/util.h>
+#include "procmon.h"
+#include "procmon.skel.h"
+
+#define CGROUP2_MOUNT "/sys/fs/cgroup"
+
+static const char *link_pins[] = {
+    PROCMON_PIN_DIR"/fork",
+    PROCMON_PIN_DIR"/exec",
+    PROCMON_PIN_DIR"/exit",
+};
+
+/*
+ * Fills in @p for process @pid from /proc. The cgroup id of a cgroup
+ * v2 cgroup is the inode number of its directory.
+ */
+static int read_proc_entry(long pid, struct procmon_proc *p)
+{
+    char path[PATH_MAX];
+    char buf[1024];
+    char *s;
+    unsigned long long start;
+    int ppid;
+    ssize_t len;
+    FILE *f;
+    struct stat st;
+
+    memset(p, 0, sizeof(*p));
+    p->pid = (__u32)pid;
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    if((f = fopen(path, "r")) == NULL) {
+        return -errno;
+    }
+    s = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    /* comm may contain spaces and parentheses */
+    if(s == NULL || (s = strrchr(buf, ')')) == NULL ||
+            sscanf(s + 1, " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u "
+                   "%*d %*d %*d %*d %*d %*d %llu", &ppid, &start) != 2) {
+        return -EINVAL;
+    }
+    p->ppid          = (__u32)ppid;
+    p->start_time_ns = start * (1000000000ULL / (unsigned long long)sysconf(_SC_CLK_TCK));
+
+    snprintf(path, sizeof(path), "/proc/%ld/exe", pid);
+    if((len = readlink(path, p->exe, sizeof(p->exe) - 1)) > 0) {
+        p->exe[len] = '\0';
+    }
+
+    snprintf(path, sizeof(path), "/proc/%ld/cgroup", pid);
+    if((f = fopen(path, "r")) != NULL) {
+        while(fgets(buf, sizeof(buf), f) != NULL) {
+            if(strncmp(buf, "0::", 3) == 0) {
+                buf[strcspn(buf, "\n")] = '\0';
+                snprintf(path, sizeof(path), CGROUP2_MOUNT"%s", buf + 3);
+                if(stat(path, &st) == 0) {
+                    p->cgroup_id = st.st_ino;
+                }
+                break;
+            }
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+/*
+ * Adds the processes that existed before the programs were attached.
+ * Entries the programs made meanwhile are newer and are kept. Fails if
+ * any process could not be added, as the inventory would miss it.
+ */
+static int seed_procs(int map_fd)
+{
+    struct dirent *dent;
+    DIR *d;
+    int nr = 0;
+
+    if((d = opendir("/proc")) == NULL) {
+        return -errno;
+    }
+    while((dent = readdir(d)) != NULL) {
+        struct procmon_proc p;
+        char *end;
+        long pid = strtol(dent->d_name, &end, 10);
+
+        if(dent->d_name[0] == '\0' || *end != '\0' || pid <= 0 || pid > INT_MAX) {
+            continue;
+        }
+        if(read_proc_entry(pid, &p) != 0) {
+            continue;
+        }
+        if(bpf_map_update_elem(map_fd, &p.pid, &p, BPF_NOEXIST) == 0) {
+            nr++;
+        } else if(errno != EEXIST) {
+            int err = errno;
+            closedir(d);
+            return -err;
+        }
+    }
+    closedir(d);
+    return nr;
+}
+
+/* lets the maat group read the inventory where unprivileged BPF is allowed */
+static void share_pin(const char *path)
+{
+    struct group *grp = getgrnam(MAAT_GROUP);
+
+    if(grp != NULL && chown(path, (uid_t)-1, grp->gr_gid) == 0) {
+        chmod(path, S_IRUSR | S_IWUSR | S_IRGRP);
+    }
+}
+
+static int procmon_stop(void)
+{
+    size_t i;
+    int ret = 0;
+
+    for(i = 0; i < sizeof(link_pins)/sizeof(link_pins[0]); i++) {
+        if(unlink(link_pins[i]) != 0 && errno != ENOENT) {
+            ret = -errno;
+        }
+    }
+    if((unlink(PROCMON_PROCS_PIN) != 0 && errno != ENOENT) ||
+            (unlink(PROCMON_HISTORY_PIN) != 0 && errno != ENOENT) ||
+            (unlink(PROCMON_HEAD_PIN) != 0 && errno != ENOENT) ||
+            (unlink(PROCMON_DROPS_PIN) != 0 && errno != ENOENT) ||
+            (rmdir(PROCMON_PIN_DIR) != 0 && errno != ENOENT)) {
+        ret = -errno;
+    }
+    return ret;
+}
+
+static int procmon_start(void)
+{
+    struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+    struct procmon_bpf *skel;
+    struct bpf_link *links[3];
+    size_t i;
+    int ret;
+
+    /* BPF memory is charged to RLIMIT_MEMLOCK before 5.11 */
+    setrlimit(RLIMIT_MEMLOCK, &rl);
+
+    if(mkdir(PROCMON_PIN_DIR, S_IRWXU | S_IRGRP | S_IXGRP) != 0) {
+        if(errno == EEXIST) {
+            fprintf(stderr, "The process inventory is already running\n");
+            return -EEXIST;
+        }
+        ret = -errno;
+        fprintf(stderr, "Failed to create %s: %s\n", PROCMON_PIN_DIR, strerror(-ret));
+        return ret;
+    }
+    share_pin(PROCMON_PIN_DIR);
+
+    if((skel = procmon_bpf__open_and_load()) == NULL) {
+        ret = errno ? -errno : -EINVAL;
+        fprintf(stderr, "Failed to load the process inventory programs\n");
+        goto error;
+    }
+    if((ret = procmon_bpf__attach(skel)) != 0) {
+        fprintf(stderr, "Failed to attach the process inventory programs\n");
+        goto error;
+    }
+
+    links[0] = skel->links.handle_fork;
+    links[1] = skel->links.handle_exec;
+    links[2] = skel->links.handle_exit;
+    for(i = 0; i < sizeof(links)/sizeof(links[0]); i++) {
+        if((ret = bpf_link__pin(links[i], link_pins[i])) != 0) {
+            goto pin_error;
+        }
+    }
+    if((ret = bpf_map__pin(skel->maps.procs, PROCMON_PROCS_PIN)) != 0 ||
+            (ret = bpf_map__pin(skel->maps.exec_history, PROCMON_HISTORY_PIN)) != 0 ||
+            (ret = bpf_map__pin(skel->maps.history_head, PROCMON_HEAD_PIN)) != 0 ||
+            (ret = bpf_map__pin(skel->maps.drops, PROCMON_DROPS_PIN)) != 0) {
+        goto pin_error;
+    }
+    share_pin(PROCMON_PROCS_PIN);
+    share_pin(PROCMON_HISTORY_PIN);
+    share_pin(PROCMON_HEAD_PIN);
+    share_pin(PROCMON_DROPS_PIN);
+
+    if((ret = seed_procs(bpf_map__fd(skel->maps.procs))) < 0) {
+        fprintf(stderr, "Failed to seed the process inventory: %s\n", strerror(-ret));
+        goto error;
+    }
+    printf("Process inventory started with %d existing processes\n", ret);
+
+    /* the pins keep the programs and maps alive */
+    procmon_bpf__destroy(skel);
+    return 0;
+
+pin_error:
+    fprintf(stderr, "Failed to pin the process inventory: %s\n", strerror(-ret));
+error:
+    procmon_bpf__destroy(skel);
+    procmon_stop();
+    return ret;
+}
+
+static int procmon_status(void)
+{
+    struct procmon_proc *procs;
+    size_t nr;
+    __u64 drops;
+    int ret;
+
+    if((ret = procmon_read_procs(&procs, &nr)) != 0) {
+        printf("The process inventory is not running: %s\n", strerror(-ret));
+        return ret;
+    }
+    free(procs);
+    printf("The process inventory holds %zu processes\n", nr);
+    if(procmon_read_drops(&drops) == 0 && drops != 0) {
+        printf("The process inventory missed %"PRIu64" updates and is not used; "
+               "restart it\n", (uint64_t)drops);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    libmaat_init(0, 2);
+
+    if(argc != 2) {
+        goto usage;
+    }
+    if(strcmp(argv[1], "start") == 0) {
+        ret = procmon_start();
+    } else if(strcmp(argv[1], "stop") == 0) {
+        if((ret = procmon_stop()) != 0) {
+            fprintf(stderr, "Failed to remove the process inventory: %s\n", strerror(-ret));
+        }
+    } else if(strcmp(argv[1], "status") == 0) {
+        ret = procmon_status();
+    } else {
+        goto usage;
+    }
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+usage:
+    fprintf(stderr, "usage: %s start|stop|status\n", argv[0]);
+    return EXIT_FAILURE;
+}
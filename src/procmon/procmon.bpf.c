@@ -0,0 +1,170 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * eBPF programs of the process inventory. They keep the procs map in
+ * step with the processes on the system and record every exec in the
+ * exec_history ring, overwriting the oldest one. Readers only read
+ * the ring, so every measurement sees the same history. An update of
+ * procs that fails (e.g., because the map is full) is counted in
+ * drops: the inventory is then incomplete and readers must walk /proc
+ * instead. Built with clang -target bpf against the kernel's BTF, see
+ * Makefile.am.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#include "procmon_bpf.h"
+
+/* bpf_probe_read_kernel_str() is only available to GPL compatible programs */
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, PROCMON_MAX_PROCS);
+    __type(key, __u32);
+    __type(value, struct procmon_proc);
+} procs SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, PROCMON_MAX_HISTORY);
+    __type(key, __u32);
+    __type(value, struct procmon_exec);
+} exec_history SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} history_head SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} drops SEC(".maps");
+
+/* the records do not fit on the BPF stack */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct procmon_exec);
+} scratch SEC(".maps");
+
+static struct procmon_exec *get_scratch(void)
+{
+    __u32 zero = 0;
+    return bpf_map_lookup_elem(&scratch, &zero);
+}
+
+static void update_proc(__u32 pid, struct procmon_proc *p)
+{
+    __u32 zero = 0;
+    __u64 *count;
+
+    if(bpf_map_update_elem(&procs, &pid, p, BPF_ANY) != 0 &&
+            (count = bpf_map_lookup_elem(&drops, &zero)) != NULL) {
+        (*count)++;
+    }
+}
+
+static void record_exec(struct procmon_exec *ev)
+{
+    __u32 zero = 0;
+    __u32 slot;
+    __u64 *head;
+
+    if((head = bpf_map_lookup_elem(&history_head, &zero)) == NULL) {
+        return;
+    }
+    ev->seq = __sync_fetch_and_add(head, 1) + 1;
+    slot    = (__u32)(ev->seq % PROCMON_MAX_HISTORY);
+    bpf_map_update_elem(&exec_history, &slot, ev, BPF_ANY);
+}
+
+SEC("tp_btf/sched_process_fork")
+int BPF_PROG(handle_fork, struct task_struct *parent, struct task_struct *child)
+{
+    struct procmon_exec *tmp;
+    struct procmon_proc *pp;
+    __u32 pid = BPF_CORE_READ(child, tgid);
+    __u32 ppid = BPF_CORE_READ(parent, tgid);
+
+    /* a new thread is not a new process */
+    if((__u32)BPF_CORE_READ(child, pid) != pid || (tmp = get_scratch()) == NULL) {
+        return 0;
+    }
+
+    tmp->proc.pid           = pid;
+    tmp->proc.ppid          = ppid;
+    tmp->proc.start_time_ns = BPF_CORE_READ(child, start_boottime);
+    tmp->proc.cgroup_id     = bpf_get_current_cgroup_id();
+    if((pp = bpf_map_lookup_elem(&procs, &ppid)) != NULL) {
+        __builtin_memcpy(tmp->proc.exe, pp->exe, sizeof(tmp->proc.exe));
+    } else {
+        tmp->proc.exe[0] = '\0';
+    }
+    update_proc(pid, &tmp->proc);
+    return 0;
+}
+
+SEC("tp_btf/sched_process_exec")
+int BPF_PROG(handle_exec, struct task_struct *p, pid_t old_pid,
+             struct linux_binprm *bprm)
+{
+    struct procmon_exec *tmp;
+    __u64 uid_gid;
+
+    if((tmp = get_scratch()) == NULL) {
+        return 0;
+    }
+
+    tmp->proc.pid           = BPF_CORE_READ(p, tgid);
+    tmp->proc.ppid          = BPF_CORE_READ(p, real_parent, tgid);
+    tmp->proc.start_time_ns = BPF_CORE_READ(p, start_boottime);
+    tmp->proc.cgroup_id     = bpf_get_current_cgroup_id();
+    if(bpf_probe_read_kernel_str(tmp->proc.exe, sizeof(tmp->proc.exe),
+                                 BPF_CORE_READ(bprm, filename)) < 0) {
+        tmp->proc.exe[0] = '\0';
+    }
+    uid_gid      = bpf_get_current_uid_gid();
+    tmp->uid     = (__u32)uid_gid;
+    tmp->gid     = (__u32)(uid_gid >> 32);
+    tmp->time_ns = bpf_ktime_get_boot_ns();
+
+    update_proc(tmp->proc.pid, &tmp->proc);
+    record_exec(tmp);
+    return 0;
+}
+
+SEC("tp_btf/sched_process_exit")
+int BPF_PROG(handle_exit, struct task_struct *p)
+{
+    __u32 pid = BPF_CORE_READ(p, tgid);
+
+    if((__u32)BPF_CORE_READ(p, pid) == pid) {
+        bpf_map_delete_elem(&procs, &pid);
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include <util/util.h>
+#include "procmon.h"
+
+/* old libbpf returns -1 and sets errno, new libbpf returns -errno */
+static inline int bpf_err(int rc)
+{
+    return rc < 0 ? -errno : 0;
+}
+
+static int open_pinned(const char *path)
+{
+    int fd = bpf_obj_get(path);
+    if(fd < 0) {
+        int err = errno;
+        if(err == ENOENT) {
+            dlog(4, "Process inventory is not running (no %s)\n", path);
+        } else {
+            dlog(2, "Failed to open process inventory map %s: %s\n",
+                 path, strerror(err));
+        }
+        return -err;
+    }
+    return fd;
+}
+
+/*
+ * One element at a time, for kernels without BPF_MAP_LOOKUP_BATCH
+ * (before 5.6). Keys are at most 8 bytes.
+ */
+static int read_map_iter(int fd, size_t value_size, size_t max,
+                         unsigned char *vals, size_t *nr)
+{
+    __u64 key = 0, next = 0;
+    __u64 *prev = NULL;
+    size_t count = 0;
+
+    while(count < max && bpf_map_get_next_key(fd, prev, &next) == 0) {
+        if(bpf_map_lookup_elem(fd, &next, vals + count * value_size) == 0) {
+            count++;
+        } else if(errno != ENOENT) {
+            return -errno;
+        }
+        key  = next;
+        prev = &key;
+    }
+    if(count < max && errno != ENOENT) {
+        return -errno;
+    }
+    *nr = count;
+    return 0;
+}
+
+/*
+ * Reads every element of the map @fd into a malloc()ed array *@vals of
+ * *@nr values of @value_size bytes, in batches where the kernel
+ * supports it.
+ */
+static int read_map(int fd, __u32 key_size, __u32 value_size,
+                    void **vals, size_t *nr)
+{
+    struct bpf_map_info info;
+    __u32 info_len = sizeof(info);
+    unsigned char *keys = NULL;
+    unsigned char *values = NULL;
+    __u32 batch;
+    void *in_batch = NULL;
+    size_t count = 0;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    if((ret = bpf_err(bpf_obj_get_info_by_fd(fd, &info, &info_len))) != 0) {
+        return ret;
+    }
+    if(info.value_size != value_size || info.key_size != key_size ||
+            key_size > sizeof(__u64)) {
+        dlog(1, "Process inventory map has an unexpected layout\n");
+        return -EINVAL;
+    }
+
+    keys   = calloc(info.max_entries, key_size);
+    values = calloc(info.max_entries, value_size);
+    if(keys == NULL || values == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for(;;) {
+        __u32 n = info.max_entries - (__u32)count;
+
+        ret = bpf_err(bpf_map_lookup_batch(fd, in_batch, &batch, keys + count * key_size,
+                                           values + count * value_size, &n, NULL));
+        count += n;
+        if(ret == -ENOENT) {
+            /* the whole map has been read */
+            ret = 0;
+            break;
+        } else if(ret == -EINVAL || ret == -ENOTSUP || ret == -EOPNOTSUPP) {
+            ret = read_map_iter(fd, value_size, info.max_entries, values, &count);
+            break;
+        } else if(ret != 0 || count >= info.max_entries) {
+            break;
+        }
+        in_batch = &batch;
+    }
+
+out:
+    free(keys);
+    if(ret != 0) {
+        free(values);
+        return ret;
+    }
+    *vals = values;
+    *nr   = count;
+    return 0;
+}
+
+int procmon_read_procs(struct procmon_proc **procs, size_t *nr)
+{
+    void *vals;
+    int fd;
+    int ret;
+
+    if((fd = open_pinned(PROCMON_PROCS_PIN)) < 0) {
+        return fd;
+    }
+    ret = read_map(fd, sizeof(__u32), sizeof(struct procmon_proc), &vals, nr);
+    close(fd);
+    if(ret == 0) {
+        *procs = vals;
+    }
+    return ret;
+}
+
+int procmon_read_drops(__u64 *drops)
+{
+    __u64 *vals;
+    __u32 zero = 0;
+    int nr_cpus = libbpf_num_possible_cpus();
+    int fd;
+    int i;
+    int ret;
+
+    if(nr_cpus <= 0) {
+        return nr_cpus < 0 ? nr_cpus : -EINVAL;
+    }
+    if((fd = open_pinned(PROCMON_DROPS_PIN)) < 0) {
+        return fd;
+    }
+    /* one value per possible CPU */
+    if((vals = calloc((size_t)nr_cpus, sizeof(*vals))) == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+    if((ret = bpf_err(bpf_map_lookup_elem(fd, &zero, vals))) == 0) {
+        *drops = 0;
+        for(i = 0; i < nr_cpus; i++) {
+            *drops += vals[i];
+        }
+    }
+    free(vals);
+    close(fd);
+    return ret;
+}
+
+static int read_head(int fd, __u64 *head)
+{
+    __u32 zero = 0;
+    return bpf_err(bpf_map_lookup_elem(fd, &zero, head));
+}
+
+static int compare_execs(const void *a, const void *b)
+{
+    const struct procmon_exec *ea = a;
+    const struct procmon_exec *eb = b;
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+int procmon_read_history(struct procmon_exec **execs, size_t *nr)
+{
+    struct procmon_exec *vals = NULL;
+    void *buf;
+    __u64 before, after;
+    size_t count, i, kept = 0;
+    int head_fd, fd;
+    int ret;
+
+    if((head_fd = open_pinned(PROCMON_HEAD_PIN)) < 0) {
+        return head_fd;
+    }
+    if((fd = open_pinned(PROCMON_HISTORY_PIN)) < 0) {
+        close(head_fd);
+        return fd;
+    }
+
+    if((ret = read_head(head_fd, &before)) != 0 ||
+            (ret = read_map(fd, sizeof(__u32), sizeof(struct procmon_exec),
+                            &buf, &count)) != 0) {
+        goto out;
+    }
+    vals = buf;
+    if((ret = read_head(head_fd, &after)) != 0) {
+        goto out;
+    }
+
+    /*
+     * The slots of the execs numbered (before, after] were written
+     * while the ring was read, so what was read of them may be torn.
+     * Keep only the execs that were complete before the read and whose
+     * slot was not written since.
+     */
+    for(i = 0; i < count; i++) {
+        if(vals[i].seq != 0 && vals[i].seq <= before &&
+                vals[i].seq + PROCMON_MAX_HISTORY > after) {
+            vals[kept++] = vals[i];
+        }
+    }
+    qsort(vals, kept, sizeof(*vals), compare_execs);
+
+out:
+    close(fd);
+    close(head_fd);
+    if(ret != 0) {
+        free(vals);
+        return ret;
+    }
+    *execs = vals;
+    *nr    = kept;
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Readers of the eBPF process inventory.
+ *
+ * maat-procmon attaches the programs in procmon.bpf.c to the
+ * sched_process_fork, sched_process_exec and sched_process_exit
+ * tracepoints and pins them, with their maps, under PROCMON_PIN_DIR,
+ * so the inventory is kept up to date without a process of its own.
+ * Opening the pinned maps needs CAP_BPF (or unprivileged BPF), so
+ * callers must fall back to /proc when these functions fail.
+ */
+
+#ifndef __MAAT_PROCMON_H__
+#define __MAAT_PROCMON_H__
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#include "procmon_bpf.h"
+
+#define PROCMON_PIN_DIR		"/sys/fs/bpf/maat_procmon"
+#define PROCMON_PROCS_PIN	PROCMON_PIN_DIR"/procs"
+#define PROCMON_HISTORY_PIN	PROCMON_PIN_DIR"/exec_history"
+#define PROCMON_HEAD_PIN	PROCMON_PIN_DIR"/history_head"
+#define PROCMON_DROPS_PIN	PROCMON_PIN_DIR"/drops"
+
+/**
+ * Read every process in the inventory into a malloc()ed array *@procs
+ * of *@nr entries, in batches where the kernel supports it.
+ * Returns 0 on success, -ENOENT if the inventory is not running and
+ * < 0 on other errors.
+ */
+int procmon_read_procs(struct procmon_proc **procs, size_t *nr);
+
+/**
+ * Read the number of updates of the inventory that failed into
+ * *@drops. The inventory misses processes if it is not 0. Returns
+ * like procmon_read_procs().
+ */
+int procmon_read_drops(__u64 *drops);
+
+/**
+ * Read the last (up to PROCMON_MAX_HISTORY) execs in the history,
+ * oldest first, into a malloc()ed array *@execs of *@nr entries. The
+ * history is left as it is, so concurrent readers all see it; execs
+ * recorded while it is read may be left out. Returns like
+ * procmon_read_procs().
+ */
+int procmon_read_history(struct procmon_exec **execs, size_t *nr);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file
+ * Layout of the maps shared by the process inventory eBPF programs
+ * (procmon.bpf.c) and their readers. Included by both, so it may only
+ * use the __u* types.
+ */
+
+#ifndef __MAAT_PROCMON_BPF_H__
+#define __MAAT_PROCMON_BPF_H__
+
+#define PROCMON_EXE_LEN		256
+#define PROCMON_MAX_PROCS	32768
+#define PROCMON_MAX_HISTORY	4096
+
+/* value of the procs map, keyed by the (__u32) pid */
+struct procmon_proc {
+    __u32 pid;
+    __u32 ppid;
+    __u64 start_time_ns;	/* CLOCK_BOOTTIME */
+    __u64 cgroup_id;		/* 0 if unknown */
+    char exe[PROCMON_EXE_LEN];	/* empty if unknown */
+};
+
+/*
+ * value of the exec_history ring, an array whose slot seq %
+ * PROCMON_MAX_HISTORY holds the exec numbered seq (from 1, so an
+ * empty slot has seq 0). The number of the latest exec is in
+ * history_head.
+ */
+struct procmon_exec {
+    struct procmon_proc proc;
+    __u64 seq;
+    __u64 time_ns;		/* CLOCK_BOOTTIME of the exec */
+    __u32 uid;
+    __u32 gid;
+};
+
+#endif
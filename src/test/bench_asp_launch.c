@@ -0,0 +1,144 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_asp_launch.c: times launching and waiting on an ASP from an
+ * APB of growing size, with run_asp() against the fork(), execv(),
+ * waitpid() sequence it used before. /bin/true stands in for the ASP,
+ * so the times are almost entirely launch overhead. Not run by 'make
+ * check'; build it with 'make bench_asp_launch'.
+ *
+ * usage: bench_asp_launch [max_rss_mb] [launches]   (default 4096, 200)
+ *
+ * The APB's resident set is grown by doubling from 16MB up to
+ * max_rss_mb, touching every page so it is really mapped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <util/util.h>
+#include <common/asp_info.h>
+#include <common/apb_info.h>
+#include <apb/apb.h>
+
+#define DEFAULT_MAX_RSS_MB	4096UL
+#define DEFAULT_LAUNCHES	200UL
+
+int apb_execute(struct apb *apb UNUSED, struct scenario *scen UNUSED,
+                uuid_t meas_spec UNUSED, int peerchan UNUSED,
+                int resultchan UNUSED, char *target UNUSED,
+                char *target_type UNUSED, char *resource UNUSED,
+                char **arg_list UNUSED, int argc UNUSED)
+{
+    return -1;
+}
+
+extern respect_desired_execcon_t libmaat_apbmain_asps_respect_desired_execcon;
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int fork_exec_wait(char *path)
+{
+    char *argv[] = { path, NULL };
+    int status;
+    pid_t pid = fork();
+
+    if(pid < 0) {
+        return -1;
+    } else if(pid == 0) {
+        execv(path, argv);
+        _exit(127);
+    }
+    if(waitpid(pid, &status, 0) < 0) {
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long max_mb = DEFAULT_MAX_RSS_MB;
+    unsigned long launches = DEFAULT_LAUNCHES;
+    struct xml_file_info file = { NULL, "/bin/true" };
+    struct asp asp;
+    struct timespec start;
+    char *ballast = NULL;
+    unsigned long mb, i;
+    double t_fork, t_spawn;
+
+    if(argc > 1) {
+        max_mb = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2) {
+        launches = strtoul(argv[2], NULL, 10);
+    }
+
+    libmaat_init(0, 0);
+    libmaat_apbmain_asps_respect_desired_execcon = EXECCON_IGNORE_DESIRED;
+    memset(&asp, 0, sizeof(asp));
+    asp.name  = "true";
+    asp.file  = &file;
+    asp.pidfd = -1;
+    asp.category_slot = -1;
+
+    printf("%8s %16s %16s %8s\n", "RSS(MB)", "fork+exec(us)", "run_asp(us)", "speedup");
+    for(mb = 16; mb <= max_mb; mb *= 2) {
+        char *grown = realloc(ballast, mb << 20);
+        if(grown == NULL) {
+            fprintf(stderr, "Failed to allocate %luMB\n", mb);
+            break;
+        }
+        ballast = grown;
+        memset(ballast, 1, mb << 20);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i = 0; i < launches; i++) {
+            if(fork_exec_wait(file.full_filename) != 0) {
+                fprintf(stderr, "fork and exec failed\n");
+                goto out;
+            }
+        }
+        t_fork = elapsed(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i = 0; i < launches; i++) {
+            if(run_asp(&asp, -1, -1, false, 0, NULL, -1) != 0) {
+                fprintf(stderr, "run_asp failed\n");
+                goto out;
+            }
+        }
+        t_spawn = elapsed(&start);
+
+        printf("%8lu %16.1f %16.1f %7.1fx\n", mb, t_fork * 1e6 / (double)launches,
+               t_spawn * 1e6 / (double)launches, t_fork / t_spawn);
+    }
+
+out:
+    free(ballast);
+    libmaat_exit();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_file_metadata.c: times collecting the metadata of every file
+ * in a large tree with the file_metadata ASP's collector, through
+ * io_uring and the thread pool, against a walk doing one lstat per
+ * file as listdirectoryserviceasp does. Not run by 'make check'; build
+ * it with 'make bench_file_metadata'.
+ *
+ * usage: bench_file_metadata [nr_files] [dir]   (default 1000000)
+ *
+ * Without dir a tree of nr_files empty files, 1000 per directory, is
+ * created under /tmp and removed afterwards. The tree is walked once
+ * before timing so every run sees a warm dentry cache; to time cold
+ * lookups, pass an existing dir and drop the caches between runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../asps/file_metadata_collect.h>
+
+#define DEFAULT_NR_FILES	1000000UL
+#define FILES_PER_DIR		1000UL
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int make_tree(const char *root, unsigned long n)
+{
+    char path[PATH_MAX];
+    unsigned long i;
+    int fd;
+
+    for(i = 0; i < n; i++) {
+        if(i % FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "%s/d%lu", root, i / FILES_PER_DIR);
+            if(mkdir(path, 0755) != 0) {
+                return -errno;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/d%lu/f%lu", root, i / FILES_PER_DIR, i);
+        if((fd = open(path, O_CREAT | O_WRONLY | O_EXCL, 0644)) < 0) {
+            return -errno;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st UNUSED,
+                        int flag UNUSED, struct FTW *ftw UNUSED)
+{
+    return remove(path);
+}
+
+/* one lstat per entry, in readdir order */
+static unsigned long lstat_walk(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *dent;
+    struct stat st;
+    unsigned long n = 0;
+    DIR *d;
+
+    if((d = opendir(dir)) == NULL) {
+        return 0;
+    }
+    while((dent = readdir(d)) != NULL) {
+        if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, dent->d_name);
+        if(lstat(path, &st) != 0) {
+            continue;
+        }
+        n++;
+        if(S_ISDIR(st.st_mode)) {
+            n += lstat_walk(path);
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+static int count(const char *path UNUSED, const struct statx *stx UNUSED,
+                 const struct file_metadata_struct *md UNUSED, void *ctx UNUSED)
+{
+    return 0;
+}
+
+static void run_collect(const char *name, const char *dir, unsigned int flags)
+{
+    struct fmc_options opts = { 0, 0, flags };
+    struct fmc_stats stats;
+    struct timespec start;
+    double t;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = file_metadata_collect(dir, &opts, count, NULL, &stats);
+    t = elapsed(&start);
+    if(ret != 0) {
+        printf("%-24s failed: %s\n", name, strerror(-ret));
+        return;
+    }
+    if(!(flags & FMC_NO_URING) && !stats.used_uring) {
+        printf("%-24s io_uring unavailable\n", name);
+        return;
+    }
+    printf("%-24s %10lu entries %8.3fs %12.0f entries/s\n", name, stats.entries, t,
+           (double)stats.entries / t);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n = DEFAULT_NR_FILES;
+    char tmpdir[] = "/tmp/bench_file_metadataXXXXXX";
+    const char *dir = tmpdir;
+    struct timespec start;
+    unsigned long found;
+    double t;
+    int ret;
+
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2) {
+        dir = argv[2];
+    } else {
+        if(mkdtemp(tmpdir) == NULL) {
+            fprintf(stderr, "Failed to create temporary directory\n");
+            return EXIT_FAILURE;
+        }
+        printf("Creating %lu files under %s\n", n, tmpdir);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if((ret = make_tree(tmpdir, n)) != 0) {
+            fprintf(stderr, "Failed to create the tree: %s\n", strerror(-ret));
+            goto out;
+        }
+        printf("Created in %.3fs\n", elapsed(&start));
+    }
+
+    /* warm the caches */
+    lstat_walk(dir);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    found = lstat_walk(dir);
+    t = elapsed(&start);
+    printf("%-24s %10lu entries %8.3fs %12.0f entries/s\n", "lstat walk", found, t,
+           (double)found / t);
+
+    run_collect("thread pool", dir, FMC_NO_URING);
+    run_collect("thread pool + xattrs", dir, FMC_NO_URING | FMC_XATTRS);
+#ifdef HAVE_LIBURING
+    run_collect("io_uring", dir, 0);
+    run_collect("io_uring + xattrs", dir, FMC_XATTRS);
+#else
+    printf("io_uring                 not built (no liburing)\n");
+#endif
+
+out:
+    if(dir == tmpdir) {
+        nftw(tmpdir, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+    }
+    return EXIT_SUCCESS;
+}
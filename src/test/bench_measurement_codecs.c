@@ -0,0 +1,253 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_measurement_codecs.c: times serialization and unserialization
+ * of the list valued measurement types with many entries. Not run by
+ * 'make check'; build it with 'make bench_measurement_codecs'.
+ *
+ * usage: bench_measurement_codecs [nr_entries]   (default 100000)
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <util/util.h>
+#include <measurement_spec/find_types.h>
+#include <maat-basetypes.h>
+#include <measurement/pkg_details_measurement_type.h>
+#include <measurement/ima_measurement_type.h>
+#include <measurement/elfheader_measurement_type.h>
+#include <measurement/process_environment_measurement_type.h>
+#include <measurement/enumeration_measurement_type.h>
+
+#define DEFAULT_NR_ENTRIES 100000UL
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static measurement_data *build_pkg_details(unsigned long n)
+{
+    pkg_details *pd;
+    GList *l = NULL;
+    unsigned long i;
+
+    pd = container_of(alloc_measurement_data(&pkg_details_measurement_type),
+                      pkg_details, meas_data);
+    for(i = 0; i < n; i++) {
+        struct file_hash *fh = malloc(sizeof(*fh));
+        fh->md5          = g_strdup_printf("%032lx", i);
+        fh->md5_len      = strlen(fh->md5);
+        fh->filename     = g_strdup_printf("/usr/share/doc/pkg/file%lu", i);
+        fh->filename_len = strlen(fh->filename);
+        l = g_list_prepend(l, fh);
+    }
+    pd->filehashs = g_list_reverse(l);
+    pd->filehashs_len = n;
+    return &pd->meas_data;
+}
+
+static size_t count_pkg_details(measurement_data *d)
+{
+    return g_list_length(container_of(d, pkg_details, meas_data)->filehashs);
+}
+
+static measurement_data *build_ima(unsigned long n)
+{
+    ima_measurement_data *imd;
+    GList *l = NULL;
+    unsigned long i;
+
+    imd = (ima_measurement_data *)alloc_measurement_data(&ima_measurement_type);
+    for(i = 0; i < n; i++) {
+        l = g_list_prepend(l, g_strdup_printf("10 %040lx ima-ng sha256:%064lx /usr/bin/prog%lu",
+                                              i, i, i));
+    }
+    imd->msmts = g_list_reverse(l);
+    return &imd->meas_data;
+}
+
+static size_t count_ima(measurement_data *d)
+{
+    return g_list_length(((ima_measurement_data *)d)->msmts);
+}
+
+static measurement_data *build_elfheader(unsigned long n)
+{
+    elfheader_meas_data *ed;
+    GList *secs = NULL, *syms = NULL, *deps = NULL;
+    unsigned long i;
+
+    ed = (elfheader_meas_data *)alloc_measurement_data(&elfheader_measurement_type);
+    ed->filename = strdup("/usr/lib/libbench.so");
+    for(i = 0; i < n; i++) {
+        elf_sct_hdr *sh = calloc(1, sizeof(*sh));
+        elf_symbol *sym = calloc(1, sizeof(*sym));
+
+        sh->section_name = g_strdup_printf(".section%lu", i);
+        secs = g_list_prepend(secs, sh);
+
+        sym->symbol_name = g_strdup_printf("symbol%lu", i);
+        sym->file_name   = strdup("libbench.so");
+        sym->ref_name    = strdup("");
+        sym->symbol.st_value = i;
+        syms = g_list_prepend(syms, sym);
+
+        deps = g_list_prepend(deps, g_strdup_printf("libdep%lu.so", i));
+    }
+    ed->section_headers = g_list_reverse(secs);
+    ed->symbols         = g_list_reverse(syms);
+    ed->dependencies    = g_list_reverse(deps);
+    return &ed->d;
+}
+
+static size_t count_elfheader(measurement_data *d)
+{
+    return g_list_length(((elfheader_meas_data *)d)->symbols);
+}
+
+static measurement_data *build_proc_env(unsigned long n)
+{
+    proc_env_meas_data *pe;
+    GList *l = NULL;
+    unsigned long i;
+
+    pe = container_of(alloc_measurement_data(&proc_env_measurement_type),
+                      proc_env_meas_data, meas_data);
+    for(i = 0; i < n; i++) {
+        env_kv_entry *kv = malloc(sizeof(*kv));
+        kv->key   = g_strdup_printf("VAR%lu", i);
+        kv->value = g_strdup_printf("/opt/value%lu:/usr/value%lu", i, i);
+        l = g_list_prepend(l, kv);
+    }
+    pe->envpairs = g_list_reverse(l);
+    return &pe->meas_data;
+}
+
+static size_t count_proc_env(measurement_data *d)
+{
+    return g_list_length(container_of(d, proc_env_meas_data, meas_data)->envpairs);
+}
+
+static measurement_data *build_enumeration(unsigned long n)
+{
+    enumeration_data *ed;
+    GList *l = NULL;
+    unsigned long i;
+
+    ed = container_of(alloc_measurement_data(&enumeration_measurement_type),
+                      enumeration_data, meas_data);
+    for(i = 0; i < n; i++) {
+        l = g_list_prepend(l, g_strdup_printf("entry%lu", i));
+    }
+    enumeration_data_add_entries(ed, g_list_reverse(l));
+    return &ed->meas_data;
+}
+
+static size_t count_enumeration(measurement_data *d)
+{
+    return g_list_length(container_of(d, enumeration_data, meas_data)->entries);
+}
+
+static struct codec_bench {
+    measurement_type *type;
+    measurement_data *(*build)(unsigned long n);
+    size_t (*count)(measurement_data *d);
+} benches[] = {
+    {&pkg_details_measurement_type,	build_pkg_details,	count_pkg_details},
+    {&ima_measurement_type,		build_ima,		count_ima},
+    {&elfheader_measurement_type,	build_elfheader,	count_elfheader},
+    {&proc_env_measurement_type,	build_proc_env,		count_proc_env},
+    {&enumeration_measurement_type,	build_enumeration,	count_enumeration},
+};
+
+static int run_bench(struct codec_bench *b, unsigned long n)
+{
+    measurement_data *d, *out = NULL;
+    struct timespec start;
+    char *serial = NULL;
+    size_t size = 0;
+    double ser, unser;
+    int ret = -1;
+
+    if((d = b->build(n)) == NULL) {
+        fprintf(stderr, "%s: failed to build data\n", b->type->name);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(b->type->serialize_data(d, &serial, &size) != 0) {
+        fprintf(stderr, "%s: serialize failed\n", b->type->name);
+        goto out;
+    }
+    ser = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(b->type->unserialize_data(serial, size, &out) != 0 || out == NULL) {
+        fprintf(stderr, "%s: unserialize failed\n", b->type->name);
+        goto out;
+    }
+    unser = elapsed(&start);
+
+    if(b->count(out) != n) {
+        fprintf(stderr, "%s: unserialized %zu of %lu entries\n", b->type->name,
+                b->count(out), n);
+        goto out;
+    }
+
+    printf("%-24s %lu entries, %zu bytes: serialize %.3fs, unserialize %.3fs\n",
+           b->type->name, n, size, ser, unser);
+    ret = 0;
+
+out:
+    free_measurement_data(out);
+    free(serial);
+    free_measurement_data(d);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long nr_entries = DEFAULT_NR_ENTRIES;
+    size_t i;
+    int ret = EXIT_SUCCESS;
+
+    if(argc > 1) {
+        char *end;
+        nr_entries = strtoul(argv[1], &end, 10);
+        if(*end != '\0' || nr_entries == 0 || nr_entries > UINT32_MAX) {
+            fprintf(stderr, "usage: %s [nr_entries]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    libmaat_init(0, 0);
+
+    for(i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if(run_bench(&benches[i], nr_entries) != 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * bench_pkg_owner.c: times finding the packages owning a set of files
+ * with one dpkg-query -S per file, as dpkg_inv_asp did, against
+ * building a package owner index and looking them all up, and against
+ * looking them up in an index cached by an earlier ASP. The owners
+ * found both ways are compared. Not run by 'make check'; build it with
+ * 'make bench_pkg_owner'. Needs dpkg.
+ *
+ * usage: bench_pkg_owner [nr_files] [admindir]   (default 200, /var/lib/dpkg)
+ *
+ * The files are the first nr_files regular files found in the
+ * packages' file lists.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../asps/pkg_owner_index.h>
+
+#define DEFAULT_NR_FILES	200UL
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static GPtrArray *pick_files(const char *admindir, unsigned long n)
+{
+    GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+    char *infodir = g_build_filename(admindir, "info", NULL);
+    char *line = NULL;
+    size_t len = 0;
+    struct dirent *dent;
+    struct stat st;
+    DIR *d;
+
+    if((d = opendir(infodir)) == NULL) {
+        g_free(infodir);
+        return files;
+    }
+    while(files->len < n && (dent = readdir(d)) != NULL) {
+        char *path;
+        FILE *fp;
+
+        if(!g_str_has_suffix(dent->d_name, ".list")) {
+            continue;
+        }
+        path = g_build_filename(infodir, dent->d_name, NULL);
+        if((fp = fopen(path, "r")) != NULL) {
+            while(files->len < n && getline(&line, &len, fp) != -1) {
+                g_strchomp(line);
+                if(lstat(line, &st) == 0 && S_ISREG(st.st_mode)) {
+                    g_ptr_array_add(files, g_strdup(line));
+                }
+            }
+            fclose(fp);
+        }
+        g_free(path);
+    }
+    closedir(d);
+    free(line);
+    g_free(infodir);
+    return files;
+}
+
+/* package name, without architecture, from dpkg-query -S */
+static char *query_owner(const char *admindir, const char *file)
+{
+    char *quoted = g_shell_quote(file);
+    char *cmd = g_strdup_printf("/usr/bin/dpkg-query --admindir=%s -S %s 2>/dev/null",
+                                admindir, quoted);
+    char *line = NULL, *owner = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    if((fp = popen(cmd, "r")) != NULL) {
+        if(getline(&line, &len, fp) != -1) {
+            owner = g_strndup(line, strcspn(line, ":,"));
+        }
+        pclose(fp);
+    }
+    free(line);
+    g_free(cmd);
+    g_free(quoted);
+    return owner;
+}
+
+/* package name, without architecture, from an index line */
+static char *line_owner(const char *line)
+{
+    const char *name;
+
+    if(line == NULL || (name = strchr(line, ' ')) == NULL) {
+        return NULL;
+    }
+    name++;
+    return g_strndup(name, strcspn(name, ": "));
+}
+
+static unsigned long lookup_all(pkg_owner_index *idx, GPtrArray *files)
+{
+    unsigned long found = 0;
+    guint i;
+
+    for(i = 0; i < files->len; i++) {
+        if(pkg_owner_index_lookup(idx, g_ptr_array_index(files, i)) != NULL) {
+            found++;
+        }
+    }
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n = DEFAULT_NR_FILES;
+    const char *admindir = PKG_OWNER_DPKG_ADMINDIR;
+    char tmpdir[] = "/tmp/bench_pkg_ownerXXXXXX";
+    char *cache = NULL;
+    char **query_owners;
+    pkg_owner_index *idx = NULL, *loaded = NULL;
+    GPtrArray *files;
+    struct timespec start;
+    unsigned long found, mismatches = 0;
+    double t;
+    guint i;
+    int ret;
+
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2) {
+        admindir = argv[2];
+    }
+
+    files = pick_files(admindir, n);
+    if(files->len == 0) {
+        fprintf(stderr, "No packaged files found under %s\n", admindir);
+        g_ptr_array_free(files, TRUE);
+        return EXIT_FAILURE;
+    }
+    printf("Finding the owners of %u files\n", files->len);
+
+    query_owners = g_new0(char *, files->len);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < files->len; i++) {
+        query_owners[i] = query_owner(admindir, g_ptr_array_index(files, i));
+    }
+    t = elapsed(&start);
+    printf("%-24s %8.3fs %10.1f files/s\n", "dpkg-query -S per file", t,
+           (double)files->len / t);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((ret = pkg_owner_index_build_dpkg(admindir, &idx)) != 0) {
+        fprintf(stderr, "Failed to build the index: %s\n", strerror(-ret));
+        goto out;
+    }
+    found = lookup_all(idx, files);
+    t = elapsed(&start);
+    printf("%-24s %8.3fs %10.1f files/s (%zu paths indexed, %lu owned)\n",
+           "index build + lookup", t, (double)files->len / t,
+           pkg_owner_index_size(idx), found);
+
+    if(mkdtemp(tmpdir) == NULL) {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        goto out;
+    }
+    cache = g_build_filename(tmpdir, PKG_OWNER_INDEX_FILE, NULL);
+    if(pkg_owner_index_save(idx, cache) != 0) {
+        fprintf(stderr, "Failed to save the index\n");
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pkg_owner_index_load(cache, &loaded) != 0) {
+        fprintf(stderr, "Failed to load the index\n");
+        goto out;
+    }
+    found = lookup_all(loaded, files);
+    t = elapsed(&start);
+    printf("%-24s %8.3fs %10.1f files/s\n", "cached index + lookup", t,
+           (double)files->len / t);
+
+    for(i = 0; i < files->len; i++) {
+        char *owner = line_owner(pkg_owner_index_lookup(idx, g_ptr_array_index(files, i)));
+        if(g_strcmp0(owner, query_owners[i]) != 0) {
+            printf("  %s: dpkg-query says %s, index says %s\n",
+                   (char *)g_ptr_array_index(files, i),
+                   query_owners[i] ? query_owners[i] : "(none)", owner ? owner : "(none)");
+            mismatches++;
+        }
+        g_free(owner);
+    }
+    printf("%lu of %u owners differ\n", mismatches, files->len);
+
+out:
+    if(cache != NULL) {
+        unlink(cache);
+        rmdir(tmpdir);
+        g_free(cache);
+    }
+    pkg_owner_index_free(loaded);
+    pkg_owner_index_free(idx);
+    for(i = 0; i < files->len; i++) {
+        g_free(query_owners[i]);
+    }
+    g_free(query_owners);
+    g_ptr_array_free(files, TRUE);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for launching and waiting on ASPs from an APB, using /bin/sh
+ * in place of an ASP executable.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+#include <common/asp_info.h>
+#include <common/apb_info.h>
+#include <apb/apb.h>
+
+int apb_execute(struct apb *apb UNUSED, struct scenario *scen UNUSED,
+                uuid_t meas_spec UNUSED, int peerchan UNUSED,
+                int resultchan UNUSED, char *target UNUSED,
+                char *target_type UNUSED, char *resource UNUSED,
+                char **arg_list UNUSED, int argc UNUSED)
+{
+    return -1;
+}
+
+extern respect_desired_execcon_t libmaat_apbmain_asps_respect_desired_execcon;
+extern execcon_unique_categories_t libmaat_apbmain_asps_use_unique_categories;
+
+static struct xml_file_info sh_file = { NULL, "/bin/sh" };
+
+static void init_sh_asp(struct asp *asp, unsigned int timeout)
+{
+    memset(asp, 0, sizeof(*asp));
+    asp->name    = "sh";
+    asp->file    = &sh_file;
+    asp->pidfd   = -1;
+    asp->category_slot = -1;
+    asp->timeout = timeout;
+}
+
+/* run "sh -c script" as an ASP */
+static int run_sh(struct asp *asp, bool async, const char *script)
+{
+    char *argv[] = { "-c", (char *)script };
+    return run_asp(asp, -1, -1, async, 2, argv, -1);
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    libmaat_apbmain_asps_respect_desired_execcon = EXECCON_IGNORE_DESIRED;
+}
+
+static void teardown(void)
+{
+    libmaat_exit();
+}
+
+START_TEST(test_exit_status)
+{
+    struct asp asp;
+
+    init_sh_asp(&asp, 0);
+    fail_unless(run_sh(&asp, false, "exit 3") == 3, "Wrong exit status");
+    fail_unless(asp.pid == 0 && asp.pidfd == -1, "ASP not reaped");
+    fail_unless(run_sh(&asp, false, "kill -9 $$") == 0, "Killed ASP has an exit status");
+    fail_unless(wait_asp(&asp) == -EINVAL, "Waited on an ASP that is not running");
+}
+END_TEST
+
+START_TEST(test_arguments_and_fds)
+{
+    char path[] = "/tmp/test_asp_launchXXXXXX";
+    struct xml_file_info file = { NULL, path };
+    struct asp asp;
+    char *script;
+    char *argv[] = { "last" };
+    int keep[2], drop[2];
+    int fd;
+
+    fail_if(pipe(keep) != 0 || pipe(drop) != 0, "Failed to create pipes");
+
+    /* infd and outfd come first, then the arguments */
+    script = g_strdup_printf("#!/bin/sh\n"
+                             "[ \"$1\" = %d ] && [ \"$2\" = %d ] && [ \"$3\" = last ] &&\n"
+                             "[ -e /proc/self/fd/%d ] && [ ! -e /proc/self/fd/%d ]\n",
+                             keep[0], keep[1], keep[0], drop[0]);
+    fail_if((fd = mkstemp(path)) < 0, "Failed to create %s", path);
+    fail_unless(write(fd, script, strlen(script)) == (ssize_t)strlen(script),
+                "Failed to write %s", path);
+    fail_if(fchmod(fd, 0700) != 0, "Failed to chmod %s", path);
+    close(fd);
+
+    init_sh_asp(&asp, 0);
+    asp.file = &file;
+    fail_unless(run_asp(&asp, keep[0], keep[1], false, 1, argv, drop[0], drop[1], -1) == 0,
+                "Arguments or descriptors not passed as expected");
+
+    unlink(path);
+    g_free(script);
+    close(keep[0]);
+    close(keep[1]);
+    close(drop[0]);
+    close(drop[1]);
+}
+END_TEST
+
+START_TEST(test_missing_executable)
+{
+    struct xml_file_info file = { NULL, "/nonexistent/asp" };
+    struct asp asp;
+
+    init_sh_asp(&asp, 0);
+    asp.file = &file;
+    fail_unless(run_asp(&asp, -1, -1, true, 0, NULL, -1) == -1, "Spawned a missing ASP");
+    fail_unless(asp.pid == 0, "Missing ASP left a pid");
+}
+END_TEST
+
+START_TEST(test_timeout)
+{
+    struct timespec start;
+    struct asp asp;
+    double t;
+
+    init_sh_asp(&asp, 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fail_unless(run_sh(&asp, false, "exec sleep 30") == -ETIMEDOUT, "ASP did not time out");
+    t = elapsed(&start);
+    fail_unless(t >= 1.0 && t < 5.0, "Timed out after %.2fs", t);
+    fail_unless(asp.pid == 0, "Timed out ASP not reaped");
+
+    /* finishing in time is not a timeout */
+    fail_unless(run_sh(&asp, false, "exit 0") == 0, "Fast ASP timed out");
+}
+END_TEST
+
+static void on_alarm(int sig UNUSED)
+{
+}
+
+START_TEST(test_timeout_interrupted)
+{
+    struct itimerval tick = { { 0, 50000 }, { 0, 50000 } };
+    struct itimerval off = { { 0, 0 }, { 0, 0 } };
+    struct sigaction sa;
+    struct timespec start;
+    struct asp asp;
+    double t;
+
+    /* no SA_RESTART, so every tick interrupts the wait */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_alarm;
+    sigemptyset(&sa.sa_mask);
+    fail_if(sigaction(SIGALRM, &sa, NULL) != 0, "Failed to install SIGALRM handler");
+
+    init_sh_asp(&asp, 1);
+    fail_unless(run_sh(&asp, true, "exec sleep 30") == 0, "Failed to run ASP");
+    fail_if(setitimer(ITIMER_REAL, &tick, NULL) != 0, "Failed to start timer");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fail_unless(wait_asp(&asp) == -ETIMEDOUT, "Interrupted wait did not time out");
+    t = elapsed(&start);
+    setitimer(ITIMER_REAL, &off, NULL);
+    fail_unless(t < 5.0, "Timed out after %.2fs", t);
+    fail_unless(asp.pid == 0, "Timed out ASP not reaped");
+}
+END_TEST
+
+START_TEST(test_wait_together)
+{
+    struct timespec start;
+    struct asp asps[4];
+    struct asp *ptrs[5];
+    int statuses[5];
+    double t;
+    int i;
+
+    init_sh_asp(&asps[0], 0);
+    init_sh_asp(&asps[1], 0);
+    init_sh_asp(&asps[2], 1);
+    init_sh_asp(&asps[3], 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fail_unless(run_sh(&asps[0], true, "sleep 0.5; exit 1") == 0, "Failed to run ASP");
+    fail_unless(run_sh(&asps[1], true, "exit 2") == 0, "Failed to run ASP");
+    fail_unless(run_sh(&asps[2], true, "exec sleep 30") == 0, "Failed to run ASP");
+    fail_unless(run_sh(&asps[3], true, "sleep 0.5; exit 4") == 0, "Failed to run ASP");
+    for(i = 0; i < 4; i++) {
+        ptrs[i] = &asps[i];
+    }
+    ptrs[4] = NULL;
+
+    fail_unless(wait_asps(ptrs, 5, statuses) == 0, "Failed to wait on ASPs");
+    t = elapsed(&start);
+
+    fail_unless(statuses[0] == 1 && statuses[1] == 2 && statuses[3] == 4,
+                "Wrong statuses %d %d %d", statuses[0], statuses[1], statuses[3]);
+    fail_unless(statuses[2] == -ETIMEDOUT, "Slow ASP not timed out: %d", statuses[2]);
+    fail_unless(statuses[4] == -EINVAL, "NULL ASP not rejected");
+    /* waited on together, not one after another */
+    fail_unless(t < 2.0, "Waiting took %.2fs", t);
+    for(i = 0; i < 4; i++) {
+        fail_unless(asps[i].pid == 0, "ASP %d not reaped", i);
+    }
+}
+END_TEST
+
+START_TEST(test_stop)
+{
+    struct timespec start;
+    struct asp asp;
+    double t;
+
+    init_sh_asp(&asp, 0);
+    fail_unless(run_sh(&asp, true, "exec sleep 30") == 0, "Failed to run ASP");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fail_unless(stop_asp(&asp) == 0, "Failed to stop ASP");
+    t = elapsed(&start);
+    fail_unless(asp.pid == 0, "Stopped ASP not reaped");
+    /* sleep dies of SIGHUP straight away, so there is no grace period to sit out */
+    fail_unless(t < 1.0, "Stopping took %.2fs", t);
+
+    /* an ASP ignoring SIGHUP is killed after the grace period */
+    fail_unless(run_sh(&asp, true, "trap '' HUP; sleep 30") == 0, "Failed to run ASP");
+    usleep(100000);
+    fail_unless(stop_asp(&asp) == 0, "Failed to stop ASP");
+    fail_unless(asp.pid == 0, "Killed ASP not reaped");
+}
+END_TEST
+
+START_TEST(test_category_slots)
+{
+    struct asp asps[3];
+    int i;
+
+    libmaat_apbmain_asps_use_unique_categories = EXECCON_SET_UNIQUE_CATEGORIES;
+    for(i = 0; i < 3; i++) {
+        init_sh_asp(&asps[i], 0);
+    }
+
+    /* running ASPs never share a slot */
+    fail_unless(run_sh(&asps[0], true, "exec sleep 30") == 0, "Failed to run ASP");
+    fail_unless(run_sh(&asps[1], true, "exec sleep 30") == 0, "Failed to run ASP");
+    fail_unless(asps[0].category_slot >= 0 && asps[1].category_slot >= 0 &&
+                asps[0].category_slot != asps[1].category_slot,
+                "Slots %d and %d", asps[0].category_slot, asps[1].category_slot);
+
+    /* the slot is given back when the ASP is reaped, but not handed out again at once */
+    fail_unless(stop_asp(&asps[0]) == 0, "Failed to stop ASP");
+    fail_unless(asps[0].category_slot == -1, "Stopped ASP kept its slot");
+    fail_unless(run_sh(&asps[2], true, "exec sleep 30") == 0, "Failed to run ASP");
+    fail_unless(asps[2].category_slot >= 0 &&
+                asps[2].category_slot != asps[1].category_slot,
+                "Slot %d of a running ASP reused", asps[2].category_slot);
+
+    fail_unless(stop_asp(&asps[1]) == 0 && stop_asp(&asps[2]) == 0, "Failed to stop ASPs");
+    fail_unless(asps[1].category_slot == -1 && asps[2].category_slot == -1,
+                "Stopped ASPs kept their slots");
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("ASP launch");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_exit_status);
+    tcase_add_test(tcase, test_arguments_and_fds);
+    tcase_add_test(tcase, test_missing_executable);
+    tcase_add_test(tcase, test_timeout);
+    tcase_add_test(tcase, test_timeout_interrupted);
+    tcase_add_test(tcase, test_wait_together);
+    tcase_add_test(tcase, test_stop);
+    tcase_add_test(tcase, test_category_slots);
+    tcase_set_timeout(tcase, 30);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_asp_launch.log");
+    srunner_set_xml(sr, "test_asp_launch.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
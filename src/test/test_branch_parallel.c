@@ -0,0 +1,343 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for branch-parallel Copland phrases: splitting and parsing
+ * them, and the contracts the AM joins the branches' evidence and
+ * results with.
+ */
+
+#include <config.h>
+#include <check.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libxml/parser.h>
+#include <util/util.h>
+#include <util/xml_util.h>
+
+#include <am/branches.h>
+#include <am/contracts.h>
+
+#include <common/apb_info.h>
+#include <common/asp.h>
+#include <common/copland.h>
+#include <common/measurement_spec.h>
+
+#define ASP_DIR       SRCDIR "/xml/asp-info"
+#define SPEC_DIR      SRCDIR "/xml/meas-info"
+#define APB_DIR       SRCDIR "/xml/apb-info/"
+#define CA_CERT       SRCDIR "/credentials/ca.pem"
+#define PRIV_KEY      SRCDIR "/credentials/client.key"
+#define CERT_FILE     SRCDIR "/credentials/client.pem"
+
+#define NONCE "dd586e37ecc7a9fecd5cc00152031d7c18866aea"
+#define MTAB "((USM mtab) -> SIG)"
+#define FULL "((USM full) -> SIG)"
+#define BRANCHED MTAB " " COPLAND_BRANCH_OP " " FULL
+
+#define MTAB_EVIDENCE "evidence of the mtab branch"
+
+static GList *all_apbs;
+static GList *all_asps;
+static GList *all_specs;
+static char workdir[] = "/tmp/test_branch_parallelXXXXXX";
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    all_asps = load_all_asps_info(ASP_DIR);
+    all_specs = load_all_measurement_specifications_info(SPEC_DIR);
+    all_apbs = load_all_apbs_info(APB_DIR, all_asps, all_specs);
+}
+
+static void teardown(void)
+{
+    g_list_free_full(all_apbs, (GDestroyNotify)unload_apb);
+    g_list_free_full(all_asps, (GDestroyNotify)free_asp);
+    g_list_free_full(all_specs, (GDestroyNotify)free_measurement_specification_info);
+    libmaat_exit();
+}
+
+static copland_phrase *parse_phrase(const char *phrase)
+{
+    copland_phrase *parsed = NULL;
+
+    fail_if(parse_copland_from_apb_list(phrase, all_apbs, &parsed) < 0,
+            "Failed to parse %s", phrase);
+    return parsed;
+}
+
+static int nr_branches(const char *phrase, const char *first, const char *last)
+{
+    GList *branches = NULL;
+    int nr = split_copland_branches(phrase, &branches);
+
+    if(nr > 0) {
+        fail_unless(strcmp(g_list_first(branches)->data, first) == 0 &&
+                    strcmp(g_list_last(branches)->data, last) == 0,
+                    "Split %s into %s ... %s", phrase,
+                    (char *)g_list_first(branches)->data,
+                    (char *)g_list_last(branches)->data);
+    }
+    g_list_free_full(branches, free);
+    return nr;
+}
+
+START_TEST(test_split)
+{
+    fail_unless(nr_branches("(A) ~ (B)", "(A)", "(B)") == 2, "~ not split");
+    fail_unless(nr_branches("((A) -~- (B):x=1 +~+ C)", "(A)", "C") == 3,
+                "Parenthesized -~- and +~+ not split");
+    fail_unless(nr_branches("((A) ~ (B)) -> SIG", NULL, NULL) == 0,
+                "Nested branches split");
+    fail_unless(nr_branches(MTAB, NULL, NULL) == 0, "Single phrase split");
+    fail_unless(nr_branches("(A):path=~/x ~ (B)", "(A):path=~/x", "(B)") == 2,
+                "~ in an argument taken for an operator");
+    fail_unless(nr_branches("(A) ~  ~ (B)", NULL, NULL) < 0, "Empty branch accepted");
+    fail_unless(nr_branches("(A)) ~ ((B)", NULL, NULL) < 0, "Unbalanced phrase accepted");
+}
+END_TEST
+
+START_TEST(test_parse)
+{
+    copland_phrase *branched, *single;
+    GList *branches = NULL;
+
+    /* either operator, with or without parentheses, parses the same */
+    branched = parse_phrase("(" MTAB " -~- " FULL ")");
+    fail_unless(strcmp(branched->phrase, BRANCHED) == 0 && branched->num_args == 0,
+                "Parsed into %s", branched->phrase);
+    fail_unless(parse_copland_branches(branched, all_apbs, &branches) == 2,
+                "Branches not found");
+    fail_unless(strcmp(((copland_phrase *)branches->data)->phrase, MTAB) == 0 &&
+                strcmp(((copland_phrase *)branches->next->data)->phrase, FULL) == 0,
+                "Wrong branches");
+    g_list_free_full(branches, free_copland_phrase_glist);
+    free_copland_phrase(branched);
+
+    single = parse_phrase(MTAB);
+    branches = NULL;
+    fail_unless(parse_copland_branches(single, all_apbs, &branches) == 0 && branches == NULL,
+                "Single phrase has branches");
+    free_copland_phrase(single);
+
+    /* every branch must be carried out by some APB */
+    fail_if(parse_copland_from_apb_list(MTAB " ~ ((USM nothing) -> SIG)", all_apbs,
+                                        &branched) >= 0,
+            "Parsed a branch no APB carries out");
+}
+END_TEST
+
+static struct scenario *new_test_scenario(void)
+{
+    struct scenario *scen = calloc(1, sizeof(struct scenario));
+    xmlDoc *doc = xmlNewDoc((xmlChar *)"1.0");
+    xmlNode *root = xmlNewNode(NULL, (xmlChar *)"contract");
+    xmlNode *opt, *val;
+    char *creddir;
+    int size;
+
+    fail_if(scen == NULL || mkdtemp(workdir) == NULL, "Failed to set up scenario");
+
+    /* an execute contract for the branched phrase, carrying our own
+       credential as the attester's */
+    xmlDocSetRootElement(doc, root);
+    xmlNewProp(root, (xmlChar *)"version", (xmlChar *)MAAT_CONTRACT_VERSION);
+    xmlNewProp(root, (xmlChar *)"type", (xmlChar *)"execute");
+    opt = xmlNewChild(xmlNewChild(root, NULL, (xmlChar *)"subcontract", NULL),
+                      NULL, (xmlChar *)"option", NULL);
+    val = xmlNewTextChild(opt, NULL, (xmlChar *)"value", (xmlChar *)BRANCHED);
+    xmlNewProp(val, (xmlChar *)"name", (xmlChar *)"APB_phrase");
+    xmlAddChild(root, create_credential_node(CERT_FILE));
+    xmlNewTextChild(root, NULL, (xmlChar *)"nonce", (xmlChar *)NONCE);
+
+    creddir = g_strdup_printf("%s/cred", workdir);
+    fail_if(save_all_creds(doc, creddir) != 0, "Failed to save credentials");
+    g_free(creddir);
+
+    xmlDocDumpMemory(doc, (xmlChar **)&scen->contract, &size);
+    scen->size = (size_t)size;
+    xmlFreeDoc(doc);
+
+    scen->workdir  = strdup(workdir);
+    scen->cacert   = strdup(CA_CERT);
+    scen->keyfile  = strdup(PRIV_KEY);
+    scen->certfile = strdup(CERT_FILE);
+    scen->nonce    = strdup(NONCE);
+    scen->attester_hostname = strdup("localhost");
+    scen->target_type = strdup("host-port");
+    scen->resource = strdup("branches");
+    return scen;
+}
+
+static void free_test_scenario(struct scenario *scen)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", workdir);
+
+    fail_if(system(cmd) != 0, "Failed to remove %s", workdir);
+    g_free(cmd);
+    strcpy(workdir + strlen(workdir) - 6, "XXXXXX");
+    free_scenario(scen);
+}
+
+static struct am_branch *new_test_branches(void)
+{
+    struct am_branch *branches = new_am_branches(2);
+
+    fail_if(branches == NULL, "Failed to allocate branches");
+    branches[0].phrase = parse_phrase(MTAB);
+    branches[1].phrase = parse_phrase(FULL);
+    return branches;
+}
+
+START_TEST(test_join_evidence)
+{
+    struct scenario *scen = new_test_scenario();
+    struct am_branch *sent = new_test_branches();
+    struct am_branch *received = new_test_branches();
+    unsigned char *contract = NULL;
+    size_t size = 0;
+    char *evidence;
+
+    sent[0].evidence = (unsigned char *)strdup(MTAB_EVIDENCE);
+    sent[0].evidence_size = sizeof(MTAB_EVIDENCE);
+    sent[1].error = g_strdup("APB userspace exited with status 1");
+
+    fail_unless(create_branch_measurement_contract(scen, sent, 2, &contract, &size) == 0,
+                "Failed to join evidence");
+    fail_unless(read_branch_measurement_contract(scen, contract, size, received, 2) == 0,
+                "Failed to read joined evidence");
+    fail_unless(received[0].error == NULL &&
+                received[0].evidence_size == sizeof(MTAB_EVIDENCE) &&
+                memcmp(received[0].evidence, MTAB_EVIDENCE, sizeof(MTAB_EVIDENCE)) == 0,
+                "Evidence of the first branch lost");
+    fail_unless(received[1].evidence == NULL && received[1].error != NULL &&
+                strstr(received[1].error, "exited with status 1") != NULL,
+                "Failure of the second branch lost: %s",
+                received[1].error ? received[1].error : "(none)");
+    free_am_branches(received, 2);
+
+    /* the evidence is covered by the AM's signature */
+    evidence = strstr((char *)contract, "<evidence>");
+    fail_if(evidence == NULL, "No evidence in the joined contract");
+    evidence[strlen("<evidence>")] ^= 0x01;
+    received = new_test_branches();
+    fail_if(read_branch_measurement_contract(scen, contract, size, received, 2) == 0,
+            "Read tampered evidence");
+
+    free(contract);
+    free_am_branches(received, 2);
+    free_am_branches(sent, 2);
+    free_test_scenario(scen);
+}
+END_TEST
+
+/* the result of the joined response with the given branch results */
+static char *joined_result(struct scenario *scen, const char *first, const char *second)
+{
+    struct am_branch *branches = new_test_branches();
+    const char *results[] = { first, second };
+    unsigned char *response = NULL;
+    xmlXPathObject *obj;
+    xmlDoc *doc;
+    char *result;
+    size_t size = 0;
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if(results[i] == NULL) {
+            branches[i].error = g_strdup("APB userspace_appraiser sent nothing");
+        } else {
+            branches[i].result = strdup(results[i]);
+            branches[i].response = (unsigned char *)strdup("<contract type=\"response\"/>");
+            branches[i].response_size = strlen((char *)branches[i].response);
+        }
+    }
+
+    fail_unless(create_branch_response(scen, branches, 2, &response, &size) == 0,
+                "Failed to join results");
+    doc = xmlReadMemory((char *)response, (int)size, NULL, NULL, 0);
+    fail_if(doc == NULL, "Joined response is not XML");
+
+    obj = xpath(doc, "/contract/branch[@result]");
+    fail_unless(obj != NULL && obj->nodesetval != NULL && obj->nodesetval->nodeNr == 2,
+                "Joined response does not have a result per branch");
+    xmlXPathFreeObject(obj);
+
+    obj = xpath(doc, "/contract/result");
+    result = xmlNodeGetContentASCII(obj->nodesetval->nodeTab[0]);
+    xmlXPathFreeObject(obj);
+
+    xmlFreeDoc(doc);
+    free(response);
+    free_am_branches(branches, 2);
+    return result;
+}
+
+START_TEST(test_join_results)
+{
+    struct scenario *scen = new_test_scenario();
+    char *result;
+
+    result = joined_result(scen, "PASS", "PASS");
+    fail_unless(strcmp(result, "PASS") == 0, "Passing branches joined into %s", result);
+    free(result);
+
+    result = joined_result(scen, "PASS", "FAIL");
+    fail_unless(strcmp(result, "FAIL") == 0, "Failing branch joined into %s", result);
+    free(result);
+
+    result = joined_result(scen, "PASS", NULL);
+    fail_unless(strcmp(result, "ERROR") == 0, "Broken branch joined into %s", result);
+    free(result);
+
+    result = joined_result(scen, "FAIL", NULL);
+    fail_unless(strcmp(result, "FAIL") == 0, "Failing and broken branches joined into %s", result);
+    free(result);
+
+    free_test_scenario(scen);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("Branch-parallel phrases");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_split);
+    tcase_add_test(tcase, test_parse);
+    tcase_add_test(tcase, test_join_evidence);
+    tcase_add_test(tcase, test_join_results);
+    tcase_set_timeout(tcase, 30);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_branch_parallel.log");
+    srunner_set_xml(sr, "test_branch_parallel.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+/*
+ * Tests for the overlayfs mountinfo parser and layer digests used by
+ * container_layers_asp.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../asps/container_layers.h>
+
+#define HOST_ROOT \
+    "22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+
+#define CONTAINER_ROOT \
+    "598 520 0:52 / / rw,relatime master:1 - overlay overlay " \
+    "rw,lowerdir=/var/lib/docker/overlay2/l/TOP:/var/lib/docker/overlay2/l/BASE\\040IMG," \
+    "upperdir=/var/lib/docker/overlay2/abc/diff,workdir=/var/lib/docker/overlay2/abc/work\n" \
+    "599 598 0:53 / /proc rw,nosuid,nodev,noexec,relatime - proc proc rw\n"
+
+static char tmpdir[] = "/tmp/test_container_layersXXXXXX";
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    fail_if(mkdtemp(tmpdir) == NULL, "Failed to create temporary directory");
+}
+
+static void teardown(void)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", tmpdir);
+    fail_if(system(cmd) != 0, "Failed to remove %s", tmpdir);
+    g_free(cmd);
+    strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+    libmaat_exit();
+}
+
+static char *make_tree(const char *name, const char *content)
+{
+    char *dir = g_build_filename(tmpdir, name, NULL);
+    char *sub = g_build_filename(dir, "etc", NULL);
+    char *file = g_build_filename(sub, "os-release", NULL);
+    char *link = g_build_filename(dir, "os-release", NULL);
+
+    fail_if(mkdir(dir, 0755) != 0 || mkdir(sub, 0755) != 0, "Failed to create %s", dir);
+    fail_if(!g_file_set_contents(file, content, -1, NULL), "Failed to write %s", file);
+    fail_if(chmod(file, 0644) != 0, "Failed to chmod %s", file);
+    fail_if(symlink("etc/os-release", link) != 0, "Failed to create %s", link);
+
+    g_free(sub);
+    g_free(file);
+    g_free(link);
+    return dir;
+}
+
+START_TEST(test_parse_overlay)
+{
+    container_overlay ov;
+
+    fail_unless(container_overlay_parse_mountinfo(HOST_ROOT CONTAINER_ROOT, &ov) == 0,
+                "Failed to parse overlay root");
+    fail_unless(g_list_length(ov.lowerdirs) == 2, "Expected 2 lower directories");
+    fail_unless(strcmp(g_list_nth_data(ov.lowerdirs, 0),
+                       "/var/lib/docker/overlay2/l/TOP") == 0, "Wrong top layer");
+    fail_unless(strcmp(g_list_nth_data(ov.lowerdirs, 1),
+                       "/var/lib/docker/overlay2/l/BASE IMG") == 0,
+                "Escaped layer path not decoded");
+    fail_unless(ov.upperdir != NULL &&
+                strcmp(ov.upperdir, "/var/lib/docker/overlay2/abc/diff") == 0,
+                "Wrong upper directory");
+    container_overlay_clear(&ov);
+}
+END_TEST
+
+START_TEST(test_parse_not_overlay)
+{
+    container_overlay ov;
+
+    fail_unless(container_overlay_parse_mountinfo(HOST_ROOT, &ov) == -ENOENT,
+                "Parsed an ext4 root as an overlay");
+    fail_unless(ov.lowerdirs == NULL && ov.upperdir == NULL, "Overlay not left empty");
+
+    fail_unless(container_overlay_parse_mountinfo("22 1 8:1 /\n", &ov) == -EINVAL,
+                "Parsed a truncated mountinfo line");
+}
+END_TEST
+
+START_TEST(test_parse_read_only)
+{
+    container_overlay ov;
+    const char *mi = "40 1 0:40 / / ro - overlay overlay ro,lowerdir=/a::/b:/c\n";
+
+    fail_unless(container_overlay_parse_mountinfo(mi, &ov) == 0, "Failed to parse overlay root");
+    fail_unless(ov.upperdir == NULL, "Read only overlay has an upper directory");
+    fail_unless(g_list_length(ov.lowerdirs) == 3, "Data only layers not listed");
+    container_overlay_clear(&ov);
+}
+END_TEST
+
+START_TEST(test_layer_digest)
+{
+    uint8_t d1[CONTAINER_LAYER_DIGEST_LEN];
+    uint8_t d2[CONTAINER_LAYER_DIGEST_LEN];
+    uint8_t d3[CONTAINER_LAYER_DIGEST_LEN];
+    char *a = make_tree("a", "ID=maat\n");
+    char *b = make_tree("b", "ID=maat\n");
+    char *c = make_tree("c", "ID=other\n");
+    char *f;
+
+    fail_unless(container_layer_digest(a, d1) == 0, "Failed to digest %s", a);
+    fail_unless(container_layer_digest(b, d2) == 0, "Failed to digest %s", b);
+    fail_unless(container_layer_digest(c, d3) == 0, "Failed to digest %s", c);
+
+    fail_unless(memcmp(d1, d2, sizeof(d1)) == 0,
+                "Identical trees in different places have different digests");
+    fail_unless(memcmp(d1, d3, sizeof(d1)) != 0,
+                "Trees with different contents have the same digest");
+
+    /* metadata is covered too */
+    f = g_build_filename(b, "etc", "os-release", NULL);
+    fail_if(chmod(f, 04755) != 0, "Failed to chmod %s", f);
+    g_free(f);
+    fail_unless(container_layer_digest(b, d2) == 0, "Failed to digest %s", b);
+    fail_unless(memcmp(d1, d2, sizeof(d1)) != 0, "A mode change did not change the digest");
+
+    /* so is the target of a symbolic link */
+    f = g_build_filename(c, "os-release", NULL);
+    fail_if(unlink(f) != 0 || symlink("etc/os-releas", f) != 0, "Failed to retarget %s", f);
+    g_free(f);
+    fail_unless(container_layer_digest(c, d2) == 0, "Failed to digest %s", c);
+    fail_unless(memcmp(d3, d2, sizeof(d3)) != 0, "A symlink change did not change the digest");
+
+    fail_unless(container_layer_digest("/nonexistent/layer", d1) < 0,
+                "Digested a missing directory");
+
+    g_free(a);
+    g_free(b);
+    g_free(c);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("Container layers");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_parse_overlay);
+    tcase_add_test(tcase, test_parse_not_overlay);
+    tcase_add_test(tcase, test_parse_read_only);
+    tcase_add_test(tcase, test_layer_digest);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_container_layers.log");
+    srunner_set_xml(sr, "test_container_layers.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -25,6 +25,7 @@
 #include <util/util.h>
 #include <util/xml_util.h>
 #include <util/keyvalue.h>
+#include <util/signfile.h>
 
 #include <am/selector.h>
 #include <am/copland_selector.c>
@@ -141,6 +142,237 @@ int dumb_appraise(struct scenario *scen UNUSED,
     return 0;
 }
 
+#define DETACHED_MSMT "This is a detached measurement"
+#define DETACHED_EXE_CON "<?xml version=\"1.0\"?>\n"                \
+    "<contract version=\"2.0\" type=\"execute\" payload=\"detached\">" \
+    "<nonce>" CORR_NONCE "</nonce><subcontract>"                        \
+    "<option><value name=\"APB_phrase\">((USM mtab) -&gt; SIG)</value></option>" \
+    "</subcontract></contract>"
+
+static int detached_appraised = 0;
+
+int detached_appraise(struct scenario *scen UNUSED,
+                      GList *values UNUSED,
+                      void *msmt, size_t msmtsize)
+{
+    detached_appraised = 1;
+    if(msmtsize != sizeof(DETACHED_MSMT) ||
+            memcmp(msmt, DETACHED_MSMT, msmtsize) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Generate a measurement contract in response to an execute contract
+ * that accepts detached payloads, and hand it back to the appraiser
+ * side. If @tamper is set, a byte of the attached payload is flipped
+ * after signing.
+ */
+static void run_detached_measurement(int tamper)
+{
+    int err, ret;
+    struct scenario *scen;
+    unsigned char *out = NULL;
+    size_t outsize = 0;
+    size_t xmlsize = 0;
+    const unsigned char *payload = NULL;
+    size_t payload_size = 0;
+
+    scen = calloc(1, sizeof(struct scenario));
+    fail_if(scen == NULL, "Unable to allocate scenario\n");
+    scen->contract = strdup(DETACHED_EXE_CON);
+    scen->size = strlen(DETACHED_EXE_CON);
+    scen->workdir = strdup(WORK_DIR);
+    scen->cacert = strdup(CA_CERT);
+    scen->keyfile = strdup(PRIV_KEY);
+    scen->certfile = strdup(CERT_FILE);
+    scen->nonce = strdup(CORR_NONCE);
+#ifdef USE_TPM
+    scen->sign_tpm = 1;
+    scen->verify_tpm = 1;
+    scen->tpmpass = strdup(TPMPASS);
+    scen->akctx = strdup(AKCTX);
+    scen->akpubkey = strdup(AKPUB);
+#endif
+
+    generate_measurement_contract(scen, (unsigned char *)DETACHED_MSMT,
+                                  sizeof(DETACHED_MSMT), &out, &outsize);
+    fail_if(out == NULL, "Failed to generate measurement contract\n");
+
+    err = split_detached_payload(out, outsize, &xmlsize, &payload, &payload_size);
+    fail_if(err != 0 || payload == NULL, "Measurement was not detached\n");
+    /* the XML is NUL terminated ahead of the attachment */
+    fail_if(strstr((char *)out, DETACHED_MSMT) != NULL,
+            "Measurement should not appear in the contract XML\n");
+
+    if(tamper) {
+        out[outsize - 1] ^= 0xff;
+    }
+
+    free(scen->contract);
+    scen->contract = (char *)out;
+    scen->size = outsize;
+
+    detached_appraised = 0;
+    err = handle_measurement_contract(scen, detached_appraise, &ret);
+    fail_if(err != 0, "Failed to handle detached measurement contract\n");
+    if(tamper) {
+        fail_if(detached_appraised, "Tampered payload should not be appraised\n");
+        fail_if(ret == 0, "Tampered payload should fail the appraisal\n");
+    } else {
+        fail_if(!detached_appraised || ret != 0, "Detached payload was not appraised\n");
+    }
+
+    free_scenario(scen);
+}
+
+START_TEST (test_detached_measurement)
+{
+    run_detached_measurement(0);
+}
+END_TEST
+
+START_TEST (test_detached_measurement_tampered)
+{
+    run_detached_measurement(1);
+}
+END_TEST
+
+/*
+ * A measurement signed without the TPM is checked with openssl even
+ * when the appraiser would accept a quote, which takes the CA
+ * certificate.
+ */
+START_TEST (test_openssl_signed_with_verify_tpm)
+{
+    int err, ret;
+    struct scenario *scen;
+    unsigned char *out = NULL;
+    size_t outsize = 0;
+
+    scen = calloc(1, sizeof(struct scenario));
+    fail_if(scen == NULL, "Unable to allocate scenario\n");
+    scen->contract = strdup(DETACHED_EXE_CON);
+    scen->size = strlen(DETACHED_EXE_CON);
+    scen->workdir = strdup(WORK_DIR);
+    scen->cacert = strdup(CA_CERT);
+    scen->keyfile = strdup(PRIV_KEY);
+    scen->certfile = strdup(CERT_FILE);
+    scen->nonce = strdup(CORR_NONCE);
+
+    generate_measurement_contract(scen, (unsigned char *)DETACHED_MSMT,
+                                  sizeof(DETACHED_MSMT), &out, &outsize);
+    fail_if(out == NULL, "Failed to generate measurement contract\n");
+
+    free(scen->contract);
+    scen->contract = (char *)out;
+    scen->size = outsize;
+    scen->verify_tpm = 1;
+
+    detached_appraised = 0;
+    err = handle_measurement_contract(scen, detached_appraise, &ret);
+    fail_if(err != 0, "Failed to handle measurement contract\n");
+    fail_if(!detached_appraised || ret != 0,
+            "Openssl signed measurement was not appraised\n");
+
+    free_scenario(scen);
+}
+END_TEST
+
+#define SECTION_EXE_CON "<?xml version=\"1.0\"?>\n"                 \
+    "<contract version=\"2.0\" type=\"execute\">"                       \
+    "<nonce>" CORR_NONCE "</nonce><subcontract>"                        \
+    "<option resource=\"processes\"><value name=\"APB_phrase\">((USM processes) -&gt; SIG)</value></option>" \
+    "<option resource=\"mtab\"><value name=\"APB_phrase\">((USM mtab) -&gt; SIG)</value></option>" \
+    "</subcontract></contract>"
+
+static GList *appraised_resources = NULL;
+
+int section_appraise(struct scenario *scen UNUSED,
+                     GList *values, void *msmt, size_t msmtsize)
+{
+    char *resource = NULL;
+    GList *l;
+
+    for(l = values; l != NULL; l = l->next) {
+        struct key_value *kv = l->data;
+        if(strcmp(kv->key, MEASUREMENT_SECTION_VALUE) == 0) {
+            resource = kv->value;
+        }
+    }
+    if(resource == NULL || msmtsize != strlen(resource) + 1 ||
+            memcmp(msmt, resource, msmtsize) != 0) {
+        return -1;
+    }
+    appraised_resources = g_list_append(appraised_resources, strdup(resource));
+    return 0;
+}
+
+/*
+ * Generate one measurement contract for an execute contract with an
+ * option per resource, and check that the appraiser side gets each
+ * section with the resource it belongs to.
+ */
+START_TEST (test_sectioned_measurement)
+{
+    struct measurement_section procs = {"processes", (unsigned char *)"processes",
+               sizeof("processes")
+    };
+    struct measurement_section mtab = {"mtab", (unsigned char *)"mtab", sizeof("mtab")};
+    struct measurement_section other = {"other", (unsigned char *)"other", sizeof("other")};
+    GList *sections = NULL;
+    struct scenario *scen;
+    unsigned char *out = NULL;
+    size_t outsize = 0;
+    int err, ret;
+
+    scen = calloc(1, sizeof(struct scenario));
+    fail_if(scen == NULL, "Unable to allocate scenario\n");
+    scen->contract = strdup(SECTION_EXE_CON);
+    scen->size = strlen(SECTION_EXE_CON);
+    scen->workdir = strdup(WORK_DIR);
+    scen->cacert = strdup(CA_CERT);
+    scen->keyfile = strdup(PRIV_KEY);
+    scen->certfile = strdup(CERT_FILE);
+    scen->nonce = strdup(CORR_NONCE);
+#ifdef USE_TPM
+    scen->sign_tpm = 1;
+    scen->verify_tpm = 1;
+    scen->tpmpass = strdup(TPMPASS);
+    scen->akctx = strdup(AKCTX);
+    scen->akpubkey = strdup(AKPUB);
+#endif
+
+    /* a resource the execute contract does not have an option for */
+    sections = g_list_append(sections, &mtab);
+    sections = g_list_append(sections, &other);
+    fail_if(generate_sectioned_measurement_contract(scen, sections, &out, &outsize) != NULL,
+            "Contract generated for a resource without an option\n");
+
+    /* the sections need not be in the order of the options */
+    sections->next->data = &procs;
+    generate_sectioned_measurement_contract(scen, sections, &out, &outsize);
+    fail_if(out == NULL, "Failed to generate sectioned measurement contract\n");
+    g_list_free(sections);
+
+    free(scen->contract);
+    scen->contract = (char *)out;
+    scen->size = outsize;
+
+    err = handle_measurement_contract(scen, section_appraise, &ret);
+    fail_if(err != 0 || ret != 0, "Sectioned measurement contract did not pass\n");
+    fail_if(g_list_length(appraised_resources) != 2 ||
+            strcmp(appraised_resources->data, "processes") != 0 ||
+            strcmp(appraised_resources->next->data, "mtab") != 0,
+            "Sections were not appraised with their resources\n");
+
+    g_list_free_full(appraised_resources, free);
+    appraised_resources = NULL;
+    free_scenario(scen);
+}
+END_TEST
+
 START_TEST (test_good_nonce)
 {
     int err, ret;
@@ -211,6 +443,10 @@ Suite* sel_suite (void)
     tcase_add_test (tc_basic, test_good_nonce);
     tcase_add_test (tc_basic, test_bad_nonce);
     tcase_add_test (tc_basic, test_execute_bypass_negotiate);
+    tcase_add_test (tc_basic, test_detached_measurement);
+    tcase_add_test (tc_basic, test_detached_measurement_tampered);
+    tcase_add_test (tc_basic, test_openssl_signed_with_verify_tpm);
+    tcase_add_test (tc_basic, test_sectioned_measurement);
     suite_add_tcase (s, tc_basic);
     return s;
 }
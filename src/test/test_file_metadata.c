@@ -0,0 +1,269 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the batched file metadata collector used by
+ * file_metadata_asp.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../asps/file_metadata_collect.h>
+
+static char tmpdir[] = "/tmp/test_file_metadataXXXXXX";
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    fail_if(mkdtemp(tmpdir) == NULL, "Failed to create temporary directory");
+}
+
+static void teardown(void)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", tmpdir);
+    fail_if(system(cmd) != 0, "Failed to remove %s", tmpdir);
+    g_free(cmd);
+    strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+    libmaat_exit();
+}
+
+static void make_file(const char *dir, const char *name, mode_t mode)
+{
+    char *path = g_build_filename(tmpdir, dir, name, NULL);
+
+    fail_if(!g_file_set_contents(path, "maat\n", -1, NULL), "Failed to write %s", path);
+    fail_if(chmod(path, mode) != 0, "Failed to chmod %s", path);
+    g_free(path);
+}
+
+/*
+ * tmpdir/
+ *   top (0644), setuid (04755), fifo, link -> top
+ *   a/ mid, b/ bottom
+ *   c/ files 0..nr_many-1
+ */
+static void make_tree(int nr_many)
+{
+    char *a = g_build_filename(tmpdir, "a", NULL);
+    char *b = g_build_filename(tmpdir, "a", "b", NULL);
+    char *c = g_build_filename(tmpdir, "c", NULL);
+    char *fifo = g_build_filename(tmpdir, "fifo", NULL);
+    char *link = g_build_filename(tmpdir, "link", NULL);
+    int i;
+
+    fail_if(mkdir(a, 0755) != 0 || mkdir(b, 0700) != 0 || mkdir(c, 0755) != 0,
+            "Failed to create directories");
+    make_file("", "top", 0644);
+    make_file("", "setuid", 04755);
+    make_file("a", "mid", 0600);
+    make_file("a/b", "bottom", 0640);
+    for(i = 0; i < nr_many; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", i);
+        make_file("c", name, 0644);
+    }
+    fail_if(mkfifo(fifo, 0600) != 0, "Failed to create %s", fifo);
+    fail_if(symlink("top", link) != 0, "Failed to create %s", link);
+
+    g_free(a);
+    g_free(b);
+    g_free(c);
+    g_free(fifo);
+    g_free(link);
+}
+
+/* path => copy of the file_metadata */
+static int record(const char *path, const struct statx *stx UNUSED,
+                  const struct file_metadata_struct *md, void *ctx)
+{
+    GHashTable *seen = ctx;
+
+    fail_if(g_hash_table_contains(seen, path), "%s reported twice", path);
+    g_hash_table_insert(seen, g_strdup(path), g_memdup(md, sizeof(*md)));
+    return 0;
+}
+
+static GHashTable *collect(unsigned int queue_depth, unsigned int flags, struct fmc_stats *stats)
+{
+    struct fmc_options opts = { queue_depth, 0, flags };
+    GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    fail_unless(file_metadata_collect(tmpdir, &opts, record, seen, stats) == 0,
+                "Failed to collect metadata under %s", tmpdir);
+    return seen;
+}
+
+static struct file_metadata_struct *lookup(GHashTable *seen, const char *rel)
+{
+    char *path = g_build_filename(tmpdir, rel, NULL);
+    struct file_metadata_struct *md = g_hash_table_lookup(seen, path);
+
+    fail_if(md == NULL, "%s was not reported", path);
+    g_free(path);
+    return md;
+}
+
+START_TEST(test_collect_tree)
+{
+    struct fmc_stats stats;
+    struct file_metadata_struct *md;
+    struct stat st;
+    char *path;
+    GHashTable *seen;
+
+    make_tree(10);
+    /* a small queue spreads the tree over many batches */
+    seen = collect(3, FMC_NO_URING, &stats);
+
+    /* 4 in tmpdir, a, c, a/mid, a/b, a/b/bottom and c/0..9 */
+    fail_unless(g_hash_table_size(seen) == 19, "Expected 19 entries, got %u",
+                g_hash_table_size(seen));
+    fail_unless(stats.entries == 19 && stats.errors == 0, "Wrong stats");
+    fail_if(stats.used_uring, "io_uring used with FMC_NO_URING");
+
+    md = lookup(seen, "a/b/bottom");
+    path = g_build_filename(tmpdir, "a", "b", NULL);
+    fail_unless(strcmp(md->path, path) == 0, "Wrong path %s", md->path);
+    fail_unless(strcmp(md->filename, "bottom") == 0, "Wrong filename %s", md->filename);
+    fail_unless(strcmp(md->type, "regular") == 0, "Wrong type %s", md->type);
+    fail_unless(md->uread && md->uwrite && !md->uexec && md->gread && !md->gwrite &&
+                !md->oread, "Wrong permissions");
+    fail_unless(md->size == 5, "Wrong size %d", md->size);
+    g_free(path);
+
+    path = g_build_filename(tmpdir, "setuid", NULL);
+    fail_if(lstat(path, &st) != 0, "Failed to stat %s", path);
+    md = lookup(seen, "setuid");
+    fail_unless(md->suid && !md->sgid && md->oexec, "Wrong mode bits");
+    fail_unless(md->mode == st.st_mode, "Mode %o != %o", md->mode, st.st_mode);
+    fail_unless(md->inode == st.st_ino, "Wrong inode");
+    fail_unless(md->user_id == (int32_t)st.st_uid && md->group_id == (int32_t)st.st_gid,
+                "Wrong owner");
+    fail_unless(md->m_time == (int32_t)st.st_mtime, "Wrong mtime");
+    g_free(path);
+
+    fail_unless(strcmp(lookup(seen, "a/b")->type, "directory") == 0, "a/b is not a directory");
+    fail_unless(strcmp(lookup(seen, "fifo")->type, "named pipe") == 0, "fifo is not a pipe");
+    /* links are not followed */
+    md = lookup(seen, "link");
+    fail_unless(strcmp(md->type, "symbolic link") == 0, "link is not a symbolic link");
+    fail_unless(md->size == 3, "link size is not its target's length");
+
+    g_hash_table_destroy(seen);
+}
+END_TEST
+
+/*
+ * io_uring (where the kernel allows it) and the thread pool must
+ * produce the same metadata, xattrs included.
+ */
+START_TEST(test_backends_agree)
+{
+    GHashTable *pool, *ring;
+    GHashTableIter iter;
+    gpointer key, value;
+    struct fmc_stats stats;
+
+    make_tree(100);
+    pool = collect(0, FMC_NO_URING | FMC_XATTRS, NULL);
+    ring = collect(0, FMC_XATTRS, &stats);
+
+    fail_unless(g_hash_table_size(pool) == g_hash_table_size(ring),
+                "Backends found different entries");
+    g_hash_table_iter_init(&iter, pool);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        struct file_metadata_struct *a = value;
+        struct file_metadata_struct *b = g_hash_table_lookup(ring, key);
+
+        fail_if(b == NULL, "%s only found by the thread pool", (char *)key);
+        /* reading a directory may update its atime */
+        b->a_time = a->a_time;
+        fail_unless(memcmp(a, b, sizeof(*a)) == 0, "Metadata of %s differs%s",
+                    (char *)key, stats.used_uring ? " with io_uring" : "");
+    }
+
+    g_hash_table_destroy(pool);
+    g_hash_table_destroy(ring);
+}
+END_TEST
+
+static int stop_after_one(const char *path UNUSED, const struct statx *stx UNUSED,
+                          const struct file_metadata_struct *md UNUSED, void *ctx)
+{
+    (*(int *)ctx)++;
+    return 42;
+}
+
+START_TEST(test_callback_stops)
+{
+    int calls = 0;
+
+    make_tree(10);
+    fail_unless(file_metadata_collect(tmpdir, NULL, stop_after_one, &calls, NULL) == 42,
+                "Callback's return value not passed on");
+    fail_unless(calls == 1, "Callback called %d times after stopping", calls);
+}
+END_TEST
+
+START_TEST(test_bad_root)
+{
+    char *file = g_build_filename(tmpdir, "top", NULL);
+    int calls = 0;
+
+    make_file("", "top", 0644);
+    fail_unless(file_metadata_collect(file, NULL, stop_after_one, &calls, NULL) == -ENOTDIR,
+                "Collected under a regular file");
+    fail_unless(file_metadata_collect("/nonexistent/dir", NULL, stop_after_one, &calls,
+                                      NULL) == -ENOENT, "Collected under a missing directory");
+    fail_unless(calls == 0, "Callback called for a bad root");
+    g_free(file);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("File metadata");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_collect_tree);
+    tcase_add_test(tcase, test_backends_agree);
+    tcase_add_test(tcase, test_callback_stops);
+    tcase_add_test(tcase, test_bad_root);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_file_metadata.log");
+    srunner_set_xml(sr, "test_file_metadata.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the keyed file sample and the rolling coverage state used
+ * by hashdir_apb.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../apbs/file_sampling.h>
+
+#define NR_PATHS 2000
+
+static char tmpdir[] = "/tmp/test_file_samplingXXXXXX";
+static char *paths[NR_PATHS];
+
+static void setup(void)
+{
+    int i;
+
+    libmaat_init(0, 4);
+    fail_if(mkdtemp(tmpdir) == NULL, "Failed to create temporary directory");
+    for(i = 0; i < NR_PATHS; i++) {
+        paths[i] = g_strdup_printf("/usr/lib/file %d\n", i);
+    }
+}
+
+static void teardown(void)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", tmpdir);
+    int i;
+
+    fail_if(system(cmd) != 0, "Failed to remove %s", tmpdir);
+    g_free(cmd);
+    strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+    for(i = 0; i < NR_PATHS; i++) {
+        g_free(paths[i]);
+    }
+    libmaat_exit();
+}
+
+START_TEST(test_selection)
+{
+    unsigned char k1[FILE_SAMPLING_KEY_SIZE];
+    unsigned char k2[FILE_SAMPLING_KEY_SIZE];
+    int n1 = 0, n2 = 0, same = 0;
+    int i;
+
+    fail_unless(file_sampling_derive_key("", k1) < 0, "Derived a key from an empty nonce");
+    fail_unless(file_sampling_derive_key("0123abcd", k1) == 0, "Failed to derive key");
+    fail_unless(file_sampling_derive_key("0123abce", k2) == 0, "Failed to derive key");
+    fail_unless(memcmp(k1, k2, sizeof(k1)) != 0, "Different nonces gave the same key");
+
+    for(i = 0; i < NR_PATHS; i++) {
+        bool s1 = file_sampling_selects(k1, 100000, paths[i]);
+        bool s2 = file_sampling_selects(k2, 100000, paths[i]);
+
+        fail_unless(s1 == file_sampling_selects(k1, 100000, paths[i]),
+                    "Selection of %s is not deterministic", paths[i]);
+        fail_unless(file_sampling_selects(k1, MEASUREMENT_SAMPLING_SCALE, paths[i]),
+                    "A rate of 1 did not select %s", paths[i]);
+        n1 += s1;
+        n2 += s2;
+        same += s1 && s2;
+    }
+
+    /* 10% of 2000, with plenty of slack */
+    fail_unless(n1 > 120 && n1 < 280, "Sampled %d of %d paths at 10%%", n1, NR_PATHS);
+    fail_unless(n2 > 120 && n2 < 280, "Sampled %d of %d paths at 10%%", n2, NR_PATHS);
+    fail_unless(same < n1 / 2, "Samples for different nonces overlap in %d paths", same);
+}
+END_TEST
+
+/*
+ * Run @nr_rounds rounds with fresh nonces and check that no path goes
+ * unhashed for @rounds rounds.
+ */
+START_TEST(test_rolling_coverage)
+{
+    measurement_sampling cfg = {.rate_ppm = 20000, .rounds = 5};
+    char *state = g_strdup_printf("%s/state", tmpdir);
+    uint32_t last[NR_PATHS] = {0};
+    uint32_t round;
+    int i;
+
+    for(round = 1; round <= 12; round++) {
+        file_sampling fs;
+        file_sampling_data fsd;
+        char nonce[32];
+        uint32_t hashed = 0;
+
+        snprintf(nonce, sizeof(nonce), "nonce-%u", round);
+        fail_unless(file_sampling_init(&fs, nonce, &cfg) == 0, "Failed to init sampling");
+        fail_unless(file_sampling_load(&fs, state) == 0, "Failed to load state");
+        fail_unless(fs.round == round, "Expected round %u, got %u", round, fs.round);
+
+        for(i = 0; i < NR_PATHS; i++) {
+            file_sampling_decision d = file_sampling_decide(&fs, paths[i]);
+            fail_unless(file_sampling_decide(&fs, paths[i]) == d,
+                        "Second decision for %s differs", paths[i]);
+            if(d != FILE_SAMPLING_SKIP) {
+                last[i] = round;
+                hashed++;
+            } else if(last[i] == 0) {
+                last[i] = round;	/* first listed */
+            }
+            fail_unless(round - last[i] < cfg.rounds,
+                        "%s not hashed since round %u (round %u)", paths[i],
+                        last[i], round);
+        }
+
+        file_sampling_summarize(&fs, &fsd);
+        fail_unless(fsd.files == NR_PATHS, "Counted %u files", fsd.files);
+        fail_unless(fsd.sampled + fsd.overdue == hashed, "Summary does not add up");
+        fail_unless(fsd.oldest < cfg.rounds, "Oldest path is %u rounds old", fsd.oldest);
+        fail_unless(round < cfg.rounds || fsd.overdue > 0, "No overdue files in round %u", round);
+
+        fail_unless(file_sampling_save(&fs, state) == 0, "Failed to save state");
+        file_sampling_free(&fs);
+    }
+    g_free(state);
+}
+END_TEST
+
+START_TEST(test_state_file)
+{
+    measurement_sampling cfg = {.rate_ppm = 1, .rounds = 0};
+    char *state = g_strdup_printf("%s/state", tmpdir);
+    file_sampling fs;
+
+    fail_unless(file_sampling_init(&fs, "abcd", &cfg) == 0, "Failed to init sampling");
+    fail_unless(file_sampling_load(&fs, "/nonexistent/state") == 0,
+                "A missing state file is an error");
+    fail_unless(fs.round == 1, "Missing state did not start at round 1");
+
+    fail_unless(g_file_set_contents(state, "something else 1 3\n", -1, NULL),
+                "Failed to write %s", state);
+    fail_unless(file_sampling_load(&fs, state) < 0, "Loaded a foreign file");
+    fail_unless(g_file_set_contents(state, "maat-file-sampling 1 3\n9 /bin/ls\n", -1, NULL),
+                "Failed to write %s", state);
+    fail_unless(file_sampling_load(&fs, state) < 0, "Loaded a path from the future");
+    fail_unless(fs.round == 1, "A failed load changed the round");
+
+    fail_unless(g_file_set_contents(state, "maat-file-sampling 1 3\n2 /bin/a\\nb\n", -1, NULL),
+                "Failed to write %s", state);
+    fail_unless(file_sampling_load(&fs, state) == 0, "Failed to load state");
+    fail_unless(fs.round == 4, "Expected round 4, got %u", fs.round);
+    fail_unless(g_hash_table_contains(fs.paths, "/bin/a\nb"), "Escaped path not restored");
+
+    /* only paths listed this round are kept */
+    file_sampling_decide(&fs, "/bin/c");
+    fail_unless(file_sampling_save(&fs, state) == 0, "Failed to save state");
+    file_sampling_free(&fs);
+
+    fail_unless(file_sampling_init(&fs, "abcd", &cfg) == 0, "Failed to init sampling");
+    fail_unless(file_sampling_load(&fs, state) == 0, "Failed to reload state");
+    fail_unless(fs.round == 5, "Expected round 5, got %u", fs.round);
+    fail_unless(g_hash_table_size(fs.paths) == 1 &&
+                g_hash_table_contains(fs.paths, "/bin/c"), "Unexpected saved paths");
+    file_sampling_free(&fs);
+    g_free(state);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("File sampling");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_selection);
+    tcase_add_test(tcase, test_rolling_coverage);
+    tcase_add_test(tcase, test_state_file);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_file_sampling.log");
+    srunner_set_xml(sr, "test_file_sampling.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
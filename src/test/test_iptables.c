@@ -0,0 +1,655 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the iptables ASP. Each test moves into a fresh user and
+ * network namespace so that it can install a known nf_tables ruleset
+ * without privileges. Tests are skipped if user namespaces are not
+ * available.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <check.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <graph/graph-core.h>
+#include <common/asp_info.h>
+#include <common/asp.h>
+#include <measurement_spec/find_types.h>
+#include <util/util.h>
+#include <common/apb_info.h>
+
+#include <maat-basetypes.h>
+
+#define TEST_TABLE "maat_test"
+
+int apb_execute(struct apb *apb UNUSED, struct scenario *scen UNUSED,
+                uuid_t meas_spec UNUSED, int peerchan UNUSED,
+                int resultchan UNUSED, char *target UNUSED,
+                char *target_type UNUSED, char *resource UNUSED,
+                char **arg_list UNUSED, int argc UNUSED)
+{
+    return -1;
+}
+
+measurement_graph *graph;
+GList *asps;
+struct asp *iptables_asp;
+extern respect_desired_execcon_t libmaat_apbmain_asps_respect_desired_execcon;
+
+/*
+ * Minimal netlink message builder used to install the test ruleset.
+ */
+struct nlbuf {
+    unsigned char data[8192];
+    size_t len;
+};
+
+static struct nlmsghdr *put_msg(struct nlbuf *b, uint16_t type, uint16_t flags,
+                                uint8_t family, uint16_t res_id, uint32_t seq)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)(b->data + b->len);
+    struct nfgenmsg *nfg;
+
+    memset(nlh, 0, NLMSG_SPACE(sizeof(*nfg)));
+    nlh->nlmsg_len   = NLMSG_LENGTH(sizeof(*nfg));
+    nlh->nlmsg_type  = type;
+    nlh->nlmsg_flags = (uint16_t)(NLM_F_REQUEST | flags);
+    nlh->nlmsg_seq   = seq;
+    nfg = NLMSG_DATA(nlh);
+    nfg->nfgen_family = family;
+    nfg->version      = NFNETLINK_V0;
+    nfg->res_id       = htons(res_id);
+    b->len += NLMSG_ALIGN(nlh->nlmsg_len);
+    return nlh;
+}
+
+static struct nlattr *put_attr(struct nlbuf *b, struct nlmsghdr *nlh, uint16_t type,
+                               const void *data, size_t len)
+{
+    struct nlattr *nla = (struct nlattr *)(b->data + b->len);
+
+    memset(nla, 0, NLA_ALIGN(NLA_HDRLEN + len));
+    nla->nla_len  = (uint16_t)(NLA_HDRLEN + len);
+    nla->nla_type = type;
+    if(len > 0) {
+        memcpy((unsigned char *)nla + NLA_HDRLEN, data, len);
+    }
+    b->len += NLA_ALIGN(nla->nla_len);
+    nlh->nlmsg_len = (uint32_t)((b->data + b->len) - (unsigned char *)nlh);
+    return nla;
+}
+
+static void put_str(struct nlbuf *b, struct nlmsghdr *nlh, uint16_t type, const char *s)
+{
+    put_attr(b, nlh, type, s, strlen(s) + 1);
+}
+
+static void put_u32(struct nlbuf *b, struct nlmsghdr *nlh, uint16_t type, uint32_t v)
+{
+    uint32_t be = htonl(v);
+    put_attr(b, nlh, type, &be, sizeof(be));
+}
+
+static struct nlattr *nest_start(struct nlbuf *b, struct nlmsghdr *nlh, uint16_t type)
+{
+    return put_attr(b, nlh, (uint16_t)(type | NLA_F_NESTED), NULL, 0);
+}
+
+static void nest_end(struct nlbuf *b, struct nlattr *nest)
+{
+    nest->nla_len = (uint16_t)((b->data + b->len) - (unsigned char *)nest);
+}
+
+static void put_data_value(struct nlbuf *b, struct nlmsghdr *nlh, uint16_t type,
+                           const void *val, size_t len)
+{
+    struct nlattr *n = nest_start(b, nlh, type);
+    put_attr(b, nlh, NFTA_DATA_VALUE, val, len);
+    nest_end(b, n);
+}
+
+static struct nlattr *expr_start(struct nlbuf *b, struct nlmsghdr *nlh, const char *name,
+                                 struct nlattr **data)
+{
+    struct nlattr *elem = nest_start(b, nlh, NFTA_LIST_ELEM);
+    put_str(b, nlh, NFTA_EXPR_NAME, name);
+    *data = nest_start(b, nlh, NFTA_EXPR_DATA);
+    return elem;
+}
+
+static void expr_end(struct nlbuf *b, struct nlattr *elem, struct nlattr *data)
+{
+    nest_end(b, data);
+    nest_end(b, elem);
+}
+
+static void put_payload(struct nlbuf *b, struct nlmsghdr *nlh, uint32_t offset, uint32_t len)
+{
+    struct nlattr *data, *elem = expr_start(b, nlh, "payload", &data);
+    put_u32(b, nlh, NFTA_PAYLOAD_DREG, NFT_REG_1);
+    put_u32(b, nlh, NFTA_PAYLOAD_BASE, NFT_PAYLOAD_NETWORK_HEADER);
+    put_u32(b, nlh, NFTA_PAYLOAD_OFFSET, offset);
+    put_u32(b, nlh, NFTA_PAYLOAD_LEN, len);
+    expr_end(b, elem, data);
+}
+
+static void put_meta(struct nlbuf *b, struct nlmsghdr *nlh, uint32_t key)
+{
+    struct nlattr *data, *elem = expr_start(b, nlh, "meta", &data);
+    put_u32(b, nlh, NFTA_META_DREG, NFT_REG_1);
+    put_u32(b, nlh, NFTA_META_KEY, key);
+    expr_end(b, elem, data);
+}
+
+static void put_cmp(struct nlbuf *b, struct nlmsghdr *nlh, const void *val, size_t len)
+{
+    struct nlattr *data, *elem = expr_start(b, nlh, "cmp", &data);
+    put_u32(b, nlh, NFTA_CMP_SREG, NFT_REG_1);
+    put_u32(b, nlh, NFTA_CMP_OP, NFT_CMP_EQ);
+    put_data_value(b, nlh, NFTA_CMP_DATA, val, len);
+    expr_end(b, elem, data);
+}
+
+static void put_bitwise(struct nlbuf *b, struct nlmsghdr *nlh, const void *mask, size_t len)
+{
+    unsigned char zero[16] = {0};
+    struct nlattr *data, *elem = expr_start(b, nlh, "bitwise", &data);
+    put_u32(b, nlh, NFTA_BITWISE_SREG, NFT_REG_1);
+    put_u32(b, nlh, NFTA_BITWISE_DREG, NFT_REG_1);
+    put_u32(b, nlh, NFTA_BITWISE_LEN, (uint32_t)len);
+    put_data_value(b, nlh, NFTA_BITWISE_MASK, mask, len);
+    put_data_value(b, nlh, NFTA_BITWISE_XOR, zero, len);
+    expr_end(b, elem, data);
+}
+
+static void put_verdict(struct nlbuf *b, struct nlmsghdr *nlh, int32_t code, const char *chain)
+{
+    struct nlattr *data, *elem = expr_start(b, nlh, "immediate", &data);
+    struct nlattr *idata, *verdict;
+
+    put_u32(b, nlh, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+    idata   = nest_start(b, nlh, NFTA_IMMEDIATE_DATA);
+    verdict = nest_start(b, nlh, NFTA_DATA_VERDICT);
+    put_u32(b, nlh, NFTA_VERDICT_CODE, (uint32_t)code);
+    if(chain != NULL) {
+        put_str(b, nlh, NFTA_VERDICT_CHAIN, chain);
+    }
+    nest_end(b, verdict);
+    nest_end(b, idata);
+    expr_end(b, elem, data);
+}
+
+static struct nlmsghdr *put_rule(struct nlbuf *b, uint8_t family, uint32_t seq,
+                                 const char *chain, struct nlattr **exprs)
+{
+    struct nlmsghdr *nlh = put_msg(b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWRULE,
+                                   NLM_F_CREATE | NLM_F_APPEND, family, 0, seq);
+    put_str(b, nlh, NFTA_RULE_TABLE, TEST_TABLE);
+    put_str(b, nlh, NFTA_RULE_CHAIN, chain);
+    *exprs = nest_start(b, nlh, NFTA_RULE_EXPRESSIONS);
+    return nlh;
+}
+
+/*
+ * Send @b as a single nf_tables transaction and wait for its
+ * acknowledgement. Returns 0 on success or a negative errno.
+ */
+static int send_batch(struct nlbuf *b, uint32_t last_seq)
+{
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+    unsigned char reply[8192];
+    int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+    int rc = -EIO;
+
+    if(fd < 0) {
+        return -errno;
+    }
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            sendto(fd, b->data, b->len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    while(1) {
+        ssize_t n = recv(fd, reply, sizeof(reply), 0);
+        struct nlmsghdr *nlh;
+        if(n <= 0) {
+            break;
+        }
+        for(nlh = (struct nlmsghdr *)reply; NLMSG_OK(nlh, (size_t)n); nlh = NLMSG_NEXT(nlh, n)) {
+            if(nlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(nlh);
+                if(err->error != 0 || nlh->nlmsg_seq == last_seq) {
+                    close(fd);
+                    return err->error;
+                }
+            }
+        }
+    }
+    close(fd);
+    return rc;
+}
+
+/*
+ * Install table maat_test with chains "input" and "maat_jump":
+ *     input: ip protocol tcp ip saddr 10.0.0.0/8 accept
+ *     input: jump maat_jump
+ * plus, if @extra is set, "maat_jump: ip daddr 192.168.1.1 drop".
+ */
+static int install_ruleset(int extra)
+{
+    struct nlbuf b = {.len = 0};
+    struct nlmsghdr *nlh;
+    struct nlattr *exprs;
+    uint32_t seq = 1;
+    uint8_t tcp = IPPROTO_TCP;
+    unsigned char net[4] = {10, 0, 0, 0};
+    unsigned char mask[4] = {255, 0, 0, 0};
+    unsigned char host[4] = {192, 168, 1, 1};
+
+    put_msg(&b, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES, seq++);
+
+    if(!extra) {
+        nlh = put_msg(&b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWTABLE,
+                      NLM_F_CREATE, NFPROTO_IPV4, 0, seq++);
+        put_str(&b, nlh, NFTA_TABLE_NAME, TEST_TABLE);
+
+        nlh = put_msg(&b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWCHAIN,
+                      NLM_F_CREATE, NFPROTO_IPV4, 0, seq++);
+        put_str(&b, nlh, NFTA_CHAIN_TABLE, TEST_TABLE);
+        put_str(&b, nlh, NFTA_CHAIN_NAME, "input");
+
+        nlh = put_msg(&b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWCHAIN,
+                      NLM_F_CREATE, NFPROTO_IPV4, 0, seq++);
+        put_str(&b, nlh, NFTA_CHAIN_TABLE, TEST_TABLE);
+        put_str(&b, nlh, NFTA_CHAIN_NAME, "maat_jump");
+
+        nlh = put_rule(&b, NFPROTO_IPV4, seq++, "input", &exprs);
+        put_payload(&b, nlh, 9, 1);
+        put_cmp(&b, nlh, &tcp, 1);
+        put_payload(&b, nlh, 12, 4);
+        put_bitwise(&b, nlh, mask, 4);
+        put_cmp(&b, nlh, net, 4);
+        put_verdict(&b, nlh, NF_ACCEPT, NULL);
+        nest_end(&b, exprs);
+
+        nlh = put_rule(&b, NFPROTO_IPV4, seq++, "input", &exprs);
+        put_verdict(&b, nlh, NFT_JUMP, "maat_jump");
+        nest_end(&b, exprs);
+    } else {
+        nlh = put_rule(&b, NFPROTO_IPV4, seq++, "maat_jump", &exprs);
+        put_payload(&b, nlh, 16, 4);
+        put_cmp(&b, nlh, host, 4);
+        put_verdict(&b, nlh, NF_DROP, NULL);
+        nest_end(&b, exprs);
+    }
+    nlh->nlmsg_flags |= NLM_F_ACK;
+
+    put_msg(&b, NFNL_MSG_BATCH_END, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES, seq);
+    return send_batch(&b, seq - 1);
+}
+
+/*
+ * Install inet table maat_test with chain "input":
+ *     input: meta nfproto ipv6 ip6 nexthdr udp accept
+ *     input: ip6 nexthdr tcp ip6 saddr fe80::/64 drop
+ * The second rule has no nfproto match, as in a table written by hand.
+ */
+static int install_inet_ruleset(void)
+{
+    struct nlbuf b = {.len = 0};
+    struct nlmsghdr *nlh;
+    struct nlattr *exprs;
+    uint32_t seq = 1;
+    uint8_t ipv6 = NFPROTO_IPV6;
+    uint8_t udp = IPPROTO_UDP;
+    uint8_t tcp = IPPROTO_TCP;
+    unsigned char net[16] = {0xfe, 0x80};
+    unsigned char mask[16] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+    put_msg(&b, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES, seq++);
+
+    nlh = put_msg(&b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWTABLE,
+                  NLM_F_CREATE, NFPROTO_INET, 0, seq++);
+    put_str(&b, nlh, NFTA_TABLE_NAME, TEST_TABLE);
+
+    nlh = put_msg(&b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWCHAIN,
+                  NLM_F_CREATE, NFPROTO_INET, 0, seq++);
+    put_str(&b, nlh, NFTA_CHAIN_TABLE, TEST_TABLE);
+    put_str(&b, nlh, NFTA_CHAIN_NAME, "input");
+
+    nlh = put_rule(&b, NFPROTO_INET, seq++, "input", &exprs);
+    put_meta(&b, nlh, NFT_META_NFPROTO);
+    put_cmp(&b, nlh, &ipv6, 1);
+    put_payload(&b, nlh, 6, 1);
+    put_cmp(&b, nlh, &udp, 1);
+    put_verdict(&b, nlh, NF_ACCEPT, NULL);
+    nest_end(&b, exprs);
+
+    nlh = put_rule(&b, NFPROTO_INET, seq++, "input", &exprs);
+    put_payload(&b, nlh, 6, 1);
+    put_cmp(&b, nlh, &tcp, 1);
+    put_payload(&b, nlh, 8, 16);
+    put_bitwise(&b, nlh, mask, 16);
+    put_cmp(&b, nlh, net, 16);
+    put_verdict(&b, nlh, NF_DROP, NULL);
+    nest_end(&b, exprs);
+    nlh->nlmsg_flags |= NLM_F_ACK;
+
+    put_msg(&b, NFNL_MSG_BATCH_END, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES, seq);
+    return send_batch(&b, seq - 1);
+}
+
+static int write_proc_file(const char *path, const char *contents)
+{
+    int fd = open(path, O_WRONLY);
+    ssize_t len = (ssize_t)strlen(contents);
+    int rc = -1;
+    if(fd >= 0) {
+        rc = write(fd, contents, (size_t)len) == len ? 0 : -1;
+        close(fd);
+    }
+    return rc;
+}
+
+/*
+ * Move into a new user and network namespace in which we are root.
+ * Returns 0 on success, or -1 if namespaces are unavailable.
+ */
+static int enter_namespaces(void)
+{
+    char map[64];
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if(unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0) {
+        return -1;
+    }
+    snprintf(map, sizeof(map), "0 %u 1", uid);
+    if(write_proc_file("/proc/self/uid_map", map) != 0) {
+        return -1;
+    }
+    write_proc_file("/proc/self/setgroups", "deny");
+    snprintf(map, sizeof(map), "0 %u 1", gid);
+    if(write_proc_file("/proc/self/gid_map", map) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static node_id_t add_table_node(const char *name)
+{
+    address *addr = alloc_address(&iptables_addr_space);
+    node_id_t n = INVALID_NODE_ID;
+
+    fail_if(addr == NULL, "Failed to allocate iptables address");
+    ((iptables_addr *)addr)->name = strdup(name);
+    measurement_variable v = {.address = addr, .type = &iptables_target_type};
+    fail_if(measurement_graph_add_node(graph, &v, NULL, &n) < 0,
+            "Failed to add table node to measurement graph");
+    free_address(addr);
+    return n;
+}
+
+static int count_cache_files(const char *dir)
+{
+    DIR *dirp = opendir(dir);
+    struct dirent *dent;
+    int count = 0;
+
+    fail_if(dirp == NULL, "Failed to open %s", dir);
+    while((dent = readdir(dirp)) != NULL) {
+        if(strncmp(dent->d_name, "iptables-", strlen("iptables-")) == 0) {
+            count++;
+        }
+    }
+    closedir(dirp);
+    return count;
+}
+
+static int run_iptables_asp(node_id_t n, char *cache_dir)
+{
+    char *graph_path = measurement_graph_get_path(graph);
+    node_id_str node_str;
+    char *asp_argv[] = {graph_path, node_str, cache_dir};
+    int rc;
+
+    str_of_node_id(n, node_str);
+    rc = run_asp(iptables_asp, -1, -1, false, cache_dir ? 3 : 2, asp_argv, -1);
+    free(graph_path);
+    return rc;
+}
+
+/*
+ * Look up the rules measured for @chain below table node @n.
+ */
+static iptables_chain_data *get_chain_data(node_id_t n, const char *chain, int *nchains)
+{
+    iptables_chain_data *ret = NULL;
+    edge_iterator *it;
+
+    *nchains = 0;
+    for(it = measurement_node_iterate_outbound_edges(graph, n); it != NULL;
+            it = edge_iterator_next(it)) {
+        edge_id_t e = edge_iterator_get(it);
+        char *label = measurement_edge_get_label(graph, e);
+        node_id_t dst = measurement_edge_get_destination(graph, e);
+        address *addr;
+
+        fail_if(label == NULL || strcmp(label, "iptables.chains") != 0,
+                "Unexpected edge label \"%s\"", label);
+        free(label);
+        (*nchains)++;
+
+        addr = measurement_node_get_address(graph, dst);
+        fail_if(addr == NULL || addr->space != &iptables_chain_addr_space,
+                "Chain node has wrong address space");
+        if(strcmp(((iptables_chain_addr *)addr)->chain, chain) == 0) {
+            measurement_data *d = NULL;
+            fail_if(measurement_node_get_rawdata(graph, dst, &iptables_chain_measurement_type,
+                                                 &d) != 0,
+                    "Chain node %s has no rule data", chain);
+            ret = container_of(d, iptables_chain_data, meas_data);
+        }
+        free_address(addr);
+    }
+    return ret;
+}
+
+static void check_rule(iptables_rule *r, const char *proto, const char *src,
+                       const char *dst, const char *target)
+{
+    fail_unless(strcmp(r->protocol, proto) == 0, "protocol: expected %s got %s", proto, r->protocol);
+    fail_unless(strcmp(r->src, src) == 0, "source: expected %s got %s", src, r->src);
+    fail_unless(strcmp(r->dst, dst) == 0, "destination: expected %s got %s", dst, r->dst);
+    fail_unless(strcmp(r->target, target) == 0, "target: expected %s got %s", target, r->target);
+}
+
+void setup(void)
+{
+    libmaat_init(0, 4);
+    graph = create_measurement_graph(NULL);
+    fail_if(graph == NULL, "Failed to create measurement graph");
+
+    libmaat_apbmain_asps_respect_desired_execcon = EXECCON_IGNORE_DESIRED;
+    asps = load_all_asps_info(ASP_PATH);
+    fail_if(asps == NULL, "Failed to load ASPS");
+
+    iptables_asp = find_asp(asps, "iptables");
+    fail_if(iptables_asp == NULL, "Couldn't find ASP: \"iptables\"");
+    fail_if(register_types() != 0, "Failed to register types");
+}
+
+void teardown(void)
+{
+    destroy_measurement_graph(graph);
+    unload_all_asps(asps);
+    libmaat_exit();
+}
+
+START_TEST(test_iptables_asp_table)
+{
+    iptables_chain_data *input, *jump;
+    node_id_t n;
+    int nchains;
+
+    if(enter_namespaces() != 0) {
+        fprintf(stderr, "User namespaces unavailable, skipping test\n");
+        return;
+    }
+    fail_if(install_ruleset(0) != 0, "Failed to install test ruleset");
+
+    n = add_table_node("ip " TEST_TABLE);
+    fail_if(run_iptables_asp(n, NULL) != 0, "Running ASP failed");
+    fail_unless(measurement_node_has_data(graph, n, &iptables_measurement_type) > 0,
+                "Table node has no iptables data");
+
+    input = get_chain_data(n, "input", &nchains);
+    fail_unless(nchains == 2, "Expected 2 chains, found %d", nchains);
+    fail_if(input == NULL, "No data for chain input");
+    fail_unless(g_list_length(input->rules) == 2, "Expected 2 rules in input");
+    check_rule(g_list_nth_data(input->rules, 0), "tcp", "10.0.0.0/8", "0.0.0.0/0", "ACCEPT");
+    check_rule(g_list_nth_data(input->rules, 1), "all", "0.0.0.0/0", "0.0.0.0/0", "maat_jump");
+    free_measurement_data(&input->meas_data);
+
+    jump = get_chain_data(n, "maat_jump", &nchains);
+    fail_if(jump == NULL, "No data for chain maat_jump");
+    fail_unless(jump->rules == NULL, "Expected chain maat_jump to be empty");
+    free_measurement_data(&jump->meas_data);
+}
+END_TEST
+
+START_TEST(test_iptables_asp_inet_table)
+{
+    iptables_chain_data *input;
+    node_id_t n;
+    int nchains;
+
+    if(enter_namespaces() != 0) {
+        fprintf(stderr, "User namespaces unavailable, skipping test\n");
+        return;
+    }
+    fail_if(install_inet_ruleset() != 0, "Failed to install inet test ruleset");
+
+    n = add_table_node("inet " TEST_TABLE);
+    fail_if(run_iptables_asp(n, NULL) != 0, "Running ASP failed");
+
+    input = get_chain_data(n, "input", &nchains);
+    fail_unless(nchains == 1, "Expected 1 chain, found %d", nchains);
+    fail_if(input == NULL, "No data for chain input");
+    fail_unless(g_list_length(input->rules) == 2, "Expected 2 rules in input");
+    check_rule(g_list_nth_data(input->rules, 0), "udp", "::/0", "::/0", "ACCEPT");
+    check_rule(g_list_nth_data(input->rules, 1), "tcp", "fe80::/64", "::/0", "DROP");
+    free_measurement_data(&input->meas_data);
+}
+END_TEST
+
+START_TEST(test_iptables_asp_generation_cache)
+{
+    char cache_dir[] = "/tmp/maat_iptables_cacheXXXXXX";
+    iptables_chain_data *jump;
+    node_id_t n;
+    int nchains;
+
+    if(enter_namespaces() != 0) {
+        fprintf(stderr, "User namespaces unavailable, skipping test\n");
+        return;
+    }
+    fail_if(install_ruleset(0) != 0, "Failed to install test ruleset");
+    fail_if(mkdtemp(cache_dir) == NULL, "Failed to create cache directory");
+
+    /* First measurement populates the cache, second one is served from it */
+    n = add_table_node("ip " TEST_TABLE);
+    fail_if(run_iptables_asp(n, cache_dir) != 0, "Running ASP failed");
+    fail_if(find_file_in_dir(cache_dir, "iptables-") == NULL, "No cache file written");
+    fail_if(run_iptables_asp(n, cache_dir) != 0, "Running ASP from cache failed");
+    get_chain_data(n, "input", &nchains);
+    fail_unless(nchains == 2, "Expected 2 chains after cached run, found %d", nchains);
+
+    /* Changing the ruleset must invalidate the cache */
+    fail_if(install_ruleset(1) != 0, "Failed to extend test ruleset");
+    fail_if(run_iptables_asp(n, cache_dir) != 0, "Running ASP after change failed");
+    jump = get_chain_data(n, "maat_jump", &nchains);
+    fail_if(jump == NULL, "No data for chain maat_jump");
+    fail_unless(g_list_length(jump->rules) == 1, "Expected new rule in maat_jump");
+    check_rule(jump->rules->data, "all", "0.0.0.0/0", "192.168.1.1/32", "DROP");
+    free_measurement_data(&jump->meas_data);
+
+    /* Another network namespace never shares a cache file, whatever its generation */
+    fail_if(unshare(CLONE_NEWNET) != 0, "Failed to enter a second network namespace");
+    fail_if(install_ruleset(0) != 0, "Failed to install test ruleset");
+    fail_if(run_iptables_asp(n, cache_dir) != 0, "Running ASP in second namespace failed");
+    fail_unless(count_cache_files(cache_dir) == 2, "Expected a cache file per namespace, found %d",
+                count_cache_files(cache_dir));
+
+    rmrf(cache_dir);
+}
+END_TEST
+
+START_TEST(test_iptables_asp_wrong_address_type)
+{
+    address *addr = alloc_address(&unit_address_space);
+    node_id_t n;
+
+    fail_if(addr == NULL, "Failed to create UNIT address");
+    measurement_variable v = {.address = addr, .type = &iptables_target_type};
+    fail_if(measurement_graph_add_node(graph, &v, NULL, &n) < 0,
+            "Failed to add node to measurement graph");
+    fail_if(run_iptables_asp(n, NULL) == 0, "Running ASP succeeded (expected failure)!");
+    free_address(addr);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("iptables ASP");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_iptables_asp_table);
+    tcase_add_test(tcase, test_iptables_asp_inet_table);
+    tcase_add_test(tcase, test_iptables_asp_generation_cache);
+    tcase_add_test(tcase, test_iptables_asp_wrong_address_type);
+    tcase_set_timeout(tcase, 20);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_iptables.log");
+    srunner_set_xml(sr, "test_iptables.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -136,12 +136,239 @@ START_TEST(test_uart_request)
 }
 END_TEST
 
+static uint8_t test_data[] = "some measurement arguments";
+
+static iota_msg *make_req(iota *inst, uint32_t flags)
+{
+    iota_msg *msg = NULL;
+    int c;
+
+    for (c = 0; c < sizeof(nonce); c++) {
+        nonce[c] = c;
+    }
+    fail_unless(iota_init(inst, meas_funcs, flags, (uint8_t*)tz_pubcert_pem,
+                          tz_pubcert_pem_sz) == IOTA_OK, "Failed to initialize iota instance");
+    fail_unless(iota_req_init(inst, &msg, flags, IOTA_ACTION_MEAS, 3,
+                              test_data, sizeof(test_data), nonce, sizeof(nonce),
+                              (uint8_t*)tz_pubcert_pem, tz_pubcert_pem_sz) == IOTA_OK,
+                "Failed to initialize request");
+    return msg;
+}
+
+/* a malloced copy, since deserializing may decrypt in place */
+static uint8_t *copy_of(const uint8_t *buf, uint32_t len)
+{
+    uint8_t *copy = malloc(len > 0 ? len : 1);
+
+    fail_if(copy == NULL, "Failed to allocate %u bytes", len);
+    memcpy(copy, buf, len);
+    return copy;
+}
+
+static void check_in(const uint8_t *field, uint32_t field_len,
+                     const uint8_t *buf, uint32_t len)
+{
+    fail_unless(field_len == 0 ||
+                (field >= buf && field_len <= len && field - buf <= len - field_len),
+                "Field of %u bytes lies outside the message", field_len);
+}
+
+/*
+ * Deserializes a copy of buf, which must either fail or leave every
+ * field of the message inside the copy.
+ */
+static iota_ret deserialize_copy(iota *inst, const uint8_t *buf, uint32_t len)
+{
+    uint8_t *copy = copy_of(buf, len);
+    iota_msg msg;
+    iota_ret ret;
+
+    if ((ret = iota_deserialize(inst, copy, len, &msg)) == IOTA_OK) {
+        fail_unless(msg.buf == NULL, "Deserialized message owns a buffer");
+        check_in(msg.dest_cert, msg.dest_cert_len, copy, len);
+        check_in(msg.cert, msg.cert_len, copy, len);
+        check_in(msg.nonce, msg.nonce_len, copy, len);
+        check_in(msg.dest_cert2, msg.dest_cert2_len, copy, len);
+        check_in(msg.data, msg.data_len, copy, len);
+        check_in(msg.sig, msg.sig_len, copy, len);
+    }
+    free(copy);
+    return ret;
+}
+
+START_TEST(test_round_trip)
+{
+    uint32_t flag_sets[] = {0, IOTA_SIGNED_FLAG, IOTA_ENCRYPTED_FLAG,
+                            IOTA_SIGNED_FLAG | IOTA_ENCRYPTED_FLAG
+                           };
+    int i;
+
+    for (i = 0; i < sizeof(flag_sets)/sizeof(flag_sets[0]); i++) {
+        iota inst;
+        iota_msg *req = make_req(&inst, flag_sets[i]);
+        iota_msg out;
+        uint8_t *ser;
+        uint32_t ser_len;
+
+        fail_unless(req->dest_cert == req->dest_cert2,
+                    "dest_cert copied twice into the request");
+        fail_unless(iota_serialize(&inst, req, &ser, &ser_len) == IOTA_OK,
+                    "Failed to serialize with flags %u", flag_sets[i]);
+        fail_unless(((uint32_t*)ser)[1] == ser_len, "Length word is not the length");
+        fail_unless(iota_deserialize(&inst, ser, ser_len, &out) == IOTA_OK,
+                    "Failed to deserialize with flags %u", flag_sets[i]);
+
+        fail_unless(out.flags == flag_sets[i] && out.type == IOTA_REQUEST &&
+                    out.action == IOTA_ACTION_MEAS && out.id == 3, "Wrong header fields");
+        fail_unless(out.data_len == sizeof(test_data) &&
+                    memcmp(out.data, test_data, sizeof(test_data)) == 0, "Wrong data");
+        fail_unless(out.nonce_len == sizeof(nonce) &&
+                    memcmp(out.nonce, nonce, sizeof(nonce)) == 0, "Wrong nonce");
+        fail_unless(out.cert_len == tz_pubcert_pem_sz &&
+                    memcmp(out.cert, tz_pubcert_pem, tz_pubcert_pem_sz) == 0, "Wrong cert");
+        fail_unless(out.dest_cert2_len == tz_pubcert_pem_sz &&
+                    memcmp(out.dest_cert2, tz_pubcert_pem, tz_pubcert_pem_sz) == 0,
+                    "Wrong dest_cert2");
+        fail_unless((flag_sets[i] & IOTA_SIGNED_FLAG) ? out.sig_len == IOTA_SIG_MAX_LEN :
+                    out.sig_len == 0, "Wrong signature length %u", out.sig_len);
+        /* views, not copies */
+        fail_unless(out.data > ser && out.data < ser + ser_len, "Data is not in the buffer");
+
+        out.buf = ser;
+        iota_msg *outp = malloc(sizeof(iota_msg));
+        memcpy(outp, &out, sizeof(out));
+        iota_msg_deinit(&outp);
+        iota_msg_deinit(&req);
+        free(inst.cert);
+    }
+}
+END_TEST
+
+/* the layout every libiota peer expects, written out word by word */
+START_TEST(test_wire_format)
+{
+    iota inst;
+    iota_msg *req;
+    uint8_t data[5] = {1, 2, 3, 4, 5};
+    uint8_t n[3] = {9, 8, 7};
+    uint8_t cert[2] = {0xc1, 0xc2};
+    uint8_t dest[6] = {0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6};
+    uint32_t expected[] = {
+        IOTA_VERSION, 22*4, 0,
+        6, 0xd4d3d2d1, 0x0000d6d5,
+        2, 0x0000c2c1,
+        IOTA_REQUEST, IOTA_ACTION_LIST, 7, 0, 0,
+        3, 0x00070809,
+        6, 0xd4d3d2d1, 0x0000d6d5,
+        5, 0x04030201, 0x00000005,
+        0
+    };
+    uint8_t *ser;
+    uint32_t ser_len;
+
+    fail_unless(iota_init(&inst, meas_funcs, 0, cert, sizeof(cert)) == IOTA_OK,
+                "Failed to initialize iota instance");
+    fail_unless(iota_req_init(&inst, &req, 0, IOTA_ACTION_LIST, 7, data, sizeof(data),
+                              n, sizeof(n), dest, sizeof(dest)) == IOTA_OK,
+                "Failed to initialize request");
+    fail_unless(iota_serialize(&inst, req, &ser, &ser_len) == IOTA_OK, "Failed to serialize");
+    fail_unless(ser_len == sizeof(expected), "Serialized %u bytes, expected %zu",
+                ser_len, sizeof(expected));
+    fail_unless(memcmp(ser, expected, sizeof(expected)) == 0, "Wire format changed");
+
+    fail_unless(deserialize_copy(&inst, (uint8_t*)expected, sizeof(expected)) == IOTA_OK,
+                "Failed to deserialize the reference message");
+    /* trailing bytes past the length word are ignored */
+    uint8_t longer[sizeof(expected) + 8] = {0};
+    memcpy(longer, expected, sizeof(expected));
+    fail_unless(deserialize_copy(&inst, longer, sizeof(longer)) == IOTA_OK,
+                "Failed to deserialize with trailing bytes");
+
+    free(ser);
+    iota_msg_deinit(&req);
+    free(inst.cert);
+}
+END_TEST
+
+/* every truncated message, with its length word fixed up, is rejected */
+START_TEST(test_fuzz_truncate)
+{
+    uint32_t flag_sets[] = {0, IOTA_SIGNED_FLAG};
+    int i;
+
+    for (i = 0; i < sizeof(flag_sets)/sizeof(flag_sets[0]); i++) {
+        iota inst;
+        iota_msg *req = make_req(&inst, flag_sets[i]);
+        uint8_t *ser;
+        uint32_t ser_len, len;
+
+        fail_unless(iota_serialize(&inst, req, &ser, &ser_len) == IOTA_OK, "Failed to serialize");
+        for (len = 0; len < ser_len; len++) {
+            if (len >= 8) {
+                ((uint32_t*)ser)[1] = len;
+            }
+            fail_if(deserialize_copy(&inst, ser, len) == IOTA_OK,
+                    "Accepted a message truncated to %u of %u bytes", len, ser_len);
+        }
+        free(ser);
+        iota_msg_deinit(&req);
+        free(inst.cert);
+    }
+}
+END_TEST
+
+/*
+ * Random corruption must never be read past the end of the message:
+ * flip bytes, and set length words to values around the edges.
+ */
+START_TEST(test_fuzz_mutate)
+{
+    uint32_t flag_sets[] = {0, IOTA_SIGNED_FLAG, IOTA_SIGNED_FLAG | IOTA_ENCRYPTED_FLAG};
+    uint32_t edges[] = {0, 1, 3, 4, 255, 256, 0x7fffffff, 0xfffffffc, 0xfffffffd, 0xffffffff};
+    unsigned int seed = 0x107a;
+    int i, j, k;
+
+    for (i = 0; i < sizeof(flag_sets)/sizeof(flag_sets[0]); i++) {
+        iota inst;
+        iota_msg *req = make_req(&inst, flag_sets[i]);
+        uint8_t *ser;
+        uint32_t ser_len;
+        /* decrypting costs an RSA operation, so fewer rounds */
+        int rounds = (flag_sets[i] & IOTA_ENCRYPTED_FLAG) ? 200 : 5000;
+
+        fail_unless(iota_serialize(&inst, req, &ser, &ser_len) == IOTA_OK, "Failed to serialize");
+        uint8_t *mut = malloc(ser_len);
+        for (j = 0; j < rounds; j++) {
+            memcpy(mut, ser, ser_len);
+            for (k = 0; k <= rand_r(&seed) % 4; k++) {
+                mut[(uint32_t)rand_r(&seed) % ser_len] = (uint8_t)rand_r(&seed);
+            }
+            deserialize_copy(&inst, mut, ser_len);
+        }
+        /* every word in the cleartext part in turn */
+        uint32_t words = (flag_sets[i] & IOTA_ENCRYPTED_FLAG) ? 8 : ser_len / 4;
+        for (j = 0; j < words; j++) {
+            for (k = 0; k < sizeof(edges)/sizeof(edges[0]); k++) {
+                memcpy(mut, ser, ser_len);
+                ((uint32_t*)mut)[j] = edges[k];
+                deserialize_copy(&inst, mut, ser_len);
+            }
+        }
+        free(mut);
+        free(ser);
+        iota_msg_deinit(&req);
+        free(inst.cert);
+    }
+}
+END_TEST
+
 
 int main(void)
 {
     Suite *s;
     SRunner *r;
     TCase *iot_uart_request;
+    TCase *codec;
     int nfail;
 
     s = suite_create("iot_uart_request");
@@ -151,6 +378,14 @@ int main(void)
     tcase_set_timeout(iot_uart_request, 10);
     suite_add_tcase(s, iot_uart_request);
 
+    codec = tcase_create("codec");
+    tcase_add_test(codec, test_round_trip);
+    tcase_add_test(codec, test_wire_format);
+    tcase_add_test(codec, test_fuzz_truncate);
+    tcase_add_test(codec, test_fuzz_mutate);
+    tcase_set_timeout(codec, 60);
+    suite_add_tcase(s, codec);
+
     r = srunner_create(s);
     srunner_set_log(r, "iot_uart_request.log");
     srunner_set_xml(r, "iot_uart_request.xml");
@@ -18,6 +18,8 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <dlfcn.h>
 #include <sys/types.h>
@@ -42,6 +44,10 @@
 
 #include <maat-basetypes.h>
 
+#ifdef USE_BPF_PROCMON
+#include <procmon/procmon.h>
+#endif
+
 void setup(void)
 {
     libmaat_init(0,4);
@@ -178,6 +184,115 @@ next:
 }
 END_TEST
 
+#ifdef USE_BPF_PROCMON
+/*
+ * Runs lsproc on a new graph and returns whether it has a node for
+ * @pid running /bin/true.
+ */
+static int measure_finds_exec(pid_t pid)
+{
+    address *paddr = alloc_address(&unit_address_space);
+    measurement_variable var = {.type = &process_target_type, .address = paddr };
+    measurement_graph *g = create_measurement_graph(NULL);
+    node_id_t root_node = INVALID_NODE_ID;
+    node_id_str nstr;
+    int found = 0;
+
+    fail_if(paddr == NULL || g == NULL, "Failed to create measurement graph\n");
+    fail_if(measurement_graph_add_node(g, &var, NULL, &root_node) < 0,
+            "Failed to add lsproc root node to graph\n");
+    str_of_node_id(root_node, nstr);
+    char *aspargv[] = {"lsproc", measurement_graph_get_path(g), nstr};
+    fail_if(asp_measure(3, aspargv) != 0, "ASP Measure call failed.\n");
+
+    node_iterator *it;
+    for(it = measurement_graph_iterate_nodes(g); it != NULL; it = node_iterator_next(it)) {
+        node_id_t node = node_iterator_get(it);
+        measurement_data *msmt = NULL;
+        process_metadata_measurement *pmsmt;
+
+        if(node == root_node ||
+                measurement_node_get_rawdata(g, node, &process_metadata_measurement_type,
+                                             &msmt) != 0) {
+            continue;
+        }
+        pmsmt = container_of(msmt, process_metadata_measurement, d);
+        if(pmsmt->pid == pid && strcmp(pmsmt->executable, "/bin/true") == 0) {
+            found = 1;
+        }
+        free_measurement_data(msmt);
+    }
+
+    destroy_measurement_graph(g);
+    free_address(paddr);
+    return found;
+}
+
+/*
+ * Loading eBPF programs needs a privileged user, so this test only
+ * runs as root; the /proc fallback is covered by test_lsproc_asp when
+ * the inventory is not running or can not be read.
+ */
+START_TEST(test_lsproc_inventory)
+{
+    struct procmon_proc *procs = NULL;
+    size_t nr = 0, i;
+    __u64 drops;
+    int started = 0;
+    int found_self = 0;
+    int status;
+    pid_t child;
+
+    if(geteuid() != 0) {
+        dlog(1, "Skipping process inventory test: not running as root\n");
+        return;
+    }
+
+    if(procmon_read_procs(&procs, &nr) != 0) {
+        fail_if(system(PROCMON_PATH" start") != 0,
+                "Failed to start the process inventory");
+        started = 1;
+    } else {
+        free(procs);
+    }
+
+    /* a process that exits before the measurement */
+    child = fork();
+    fail_if(child < 0, "Failed to fork");
+    if(child == 0) {
+        execl("/bin/true", "true", (char*)NULL);
+        _exit(127);
+    }
+    fail_if(waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0, "Child failed to run /bin/true");
+
+    fail_if(procmon_read_drops(&drops) != 0 || drops != 0,
+            "Process inventory missed updates");
+    fail_if(procmon_read_procs(&procs, &nr) != 0,
+            "Failed to read the process inventory");
+    for(i = 0; i < nr; i++) {
+        if(procs[i].pid == (__u32)getpid()) {
+            found_self = 1;
+            fail_if(procs[i].ppid != (__u32)getppid(),
+                    "Inventory has ppid %"PRIu32" for self, expected %ld",
+                    procs[i].ppid, (long)getppid());
+        }
+        fail_if(procs[i].pid == (__u32)child, "Exited child is still in the inventory");
+    }
+    free(procs);
+    fail_if(found_self == 0, "Self is not in the process inventory");
+
+    /* reading the history does not consume it */
+    fail_if(measure_finds_exec(child) == 0, "Exited child is not in the exec history");
+    fail_if(measure_finds_exec(child) == 0,
+            "Exited child is not in the exec history of a second measurement");
+    if(started) {
+        fail_if(system(PROCMON_PATH" stop") != 0, "Failed to stop the process inventory");
+    }
+}
+END_TEST
+#endif
+
 int main(void)
 {
     Suite *s;
@@ -190,6 +305,9 @@ int main(void)
     tcase_add_checked_fixture(lsprocservice, setup, teardown);
     tcase_add_test(lsprocservice, test_read_process_metadata);
     tcase_add_test(lsprocservice, test_lsproc_asp);
+#ifdef USE_BPF_PROCMON
+    tcase_add_test(lsprocservice, test_lsproc_inventory);
+#endif
     tcase_set_timeout(lsprocservice, 1000);
     suite_add_tcase(s, lsprocservice);
 
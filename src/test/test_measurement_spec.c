@@ -23,8 +23,12 @@
 #include <measurement_spec/find_types.h>
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include <util/util.h>
+#include <maat-envvars.h>
 
 typedef struct simple_address {
     address a;
@@ -51,7 +55,7 @@ guint simple_address_hash(const address *a)
 }
 char *serialize_simple_address(const address *a)
 {
-    return strdup("{address}");
+    return g_strdup_printf("%"PRIu32, ((const simple_address *)a)->addr);
 }
 address *parse_simple_address(const char *str, size_t sz);
 
@@ -81,7 +85,12 @@ static address_space simple_address_space = {
 
 address *parse_simple_address(const char *str, size_t sz)
 {
-    return alloc_address(&simple_address_space);
+    simple_address *a = (simple_address *)alloc_address(&simple_address_space);
+
+    if(a != NULL && sscanf(str, "%"SCNu32, &a->addr) != 1) {
+        a->addr = 0;
+    }
+    return (address *)a;
 }
 
 address *simple_copy_address(const address *a)
@@ -194,8 +203,21 @@ START_TEST(test_parse_simple_instruction)
 
     fail_if((res = parse_instruction_spec(instr)) == NULL,
             "Failed to parse valid simple instruction spec");
+    fail_unless(res->weight == 0, "Instruction without weight has weight %d", res->weight);
+    free_instruction_spec(res);
 
+    fail_if(xmlSetProp(instr, (xmlChar *)"weight", (xmlChar *)"7") == NULL,
+            "Failed to create weight=\"7\" attribute for instruction");
+    fail_if((res = parse_instruction_spec(instr)) == NULL,
+            "Failed to parse simple instruction spec with weight");
+    fail_unless(res->weight == 7, "Expected weight 7, got %d", res->weight);
     free_instruction_spec(res);
+
+    fail_if(xmlSetProp(instr, (xmlChar *)"weight", (xmlChar *)"heavy") == NULL,
+            "Failed to set weight=\"heavy\" attribute for instruction");
+    fail_unless(parse_instruction_spec(instr) == NULL,
+                "Successfully parsed simple instruction spec with invalid weight");
+
     xmlFreeNode(instr);
 }
 END_TEST
@@ -535,6 +557,7 @@ START_TEST(test_evaluate_simple)
 
         instr->i.target_type  = &dummy_target_type;
         instr->i.address_space= &simple_address_space;
+        instr->i.weight       = 0;
         instr->mtype	      = &dummy_measurement_type;
 
         spec->instruction_list = g_list_append(NULL, instr);
@@ -585,6 +608,7 @@ START_TEST(test_evaluate_submeasure)
 
         instr->i.target_type  = &dummy_target_type;
         instr->i.address_space= &simple_address_space;
+        instr->i.weight       = 0;
         instr->mtype	      = &dummy_measurement_type;
 
         spec->instruction_list = g_list_append(NULL, instr);
@@ -603,6 +627,7 @@ START_TEST(test_evaluate_submeasure)
 
         instr->i.target_type  = &dummy_target_type;
         instr->i.address_space= &simple_address_space;
+        instr->i.weight       = 0;
         instr->mtype	      = &dummy_measurement_type;
 
         instr->actions        = NULL;
@@ -662,6 +687,7 @@ START_TEST(test_evaluate_filter)
 
         instr->i.target_type  = &dummy_target_type;
         instr->i.address_space= &simple_address_space;
+        instr->i.weight       = 0;
         instr->mtype	      = &dummy_measurement_type;
 
         spec->instruction_list = g_list_append(NULL, instr);
@@ -677,6 +703,7 @@ START_TEST(test_evaluate_filter)
 
         instr->i.target_type  = &dummy_target_type;
         instr->i.address_space= &simple_address_space;
+        instr->i.weight       = 0;
         instr->action         = strdup("simple");
         fail_if(instr->action == NULL, "Failed to allocate filter instruction action");
         instr->filter	       = malloc(sizeof(instruction_filter));
@@ -722,6 +749,646 @@ START_TEST(test_evaluate_filter)
 }
 END_TEST
 
+static measurement_type other_measurement_type = {
+    .name	= "other",
+    .magic	= 0xfeedface
+};
+
+struct budget_ctxt {
+    int measured;
+    measurement_type *first;
+    int recorded;
+    measurement_coverage coverage;
+};
+
+static int measure_variable_in_order(void *ctxt, measurement_variable *v,
+                                     measurement_type *t)
+{
+    struct budget_ctxt *b = (struct budget_ctxt *)ctxt;
+    if(b->measured++ == 0) {
+        b->first = t;
+    }
+    return 0;
+}
+
+static uint64_t measurement_cost(void *ctxt, measurement_variable *v,
+                                 measurement_type *t)
+{
+    return 4096;
+}
+
+static int record_coverage(void *ctxt, measurement_coverage *coverage)
+{
+    struct budget_ctxt *b = (struct budget_ctxt *)ctxt;
+    b->recorded++;
+    b->coverage = *coverage;
+    return 0;
+}
+
+static measurement_spec_callbacks budget_callbacks = {
+    .enumerate_variables	= enumerate_variables,
+    .measure_variable		= measure_variable_in_order,
+    .get_measurement_feature	= get_measurement_feature,
+    .check_predicate		= check_predicate,
+    .measurement_cost		= measurement_cost,
+    .record_coverage		= record_coverage
+};
+
+static void add_weighted_instruction(meas_spec *spec, char *name, int weight,
+                                     measurement_type *mtype)
+{
+    simple_instruction_spec *instr = malloc(sizeof(simple_instruction_spec));
+    variable_spec *var = malloc(sizeof(variable_spec));
+    address_spec *addr = malloc(sizeof(address_spec));
+
+    fail_if(instr == NULL, "Failed to allocate simple measurement instruction.");
+    fail_if(var == NULL,  "Failed to allocate variable spec");
+    fail_if(addr == NULL, "Failed to allocate address spec");
+
+    instr->i.instr_type   = SIMPLE_INSTR;
+    instr->i.name	  = (xmlChar *)strdup(name);
+    instr->i.target_type  = &dummy_target_type;
+    instr->i.address_space= &simple_address_space;
+    instr->i.weight       = weight;
+    instr->mtype	  = mtype;
+    spec->instruction_list = g_list_append(spec->instruction_list, instr);
+
+    var->instruction_name = (xmlChar *)strdup(name);
+    addr->operation       = strdup("ignore");
+    addr->value           = strdup("me");
+    var->address_list     = g_list_append(NULL, addr);
+    spec->variable_list   = g_list_append(spec->variable_list, var);
+}
+
+/*
+ * Two simple instructions, the lighter one listed first. Returns a
+ * spec in which the heavier one (measured with
+ * other_measurement_type) should be evaluated first.
+ */
+static meas_spec *mk_weighted_spec(void)
+{
+    meas_spec *spec = calloc(1, sizeof(meas_spec));
+    fail_if(spec == NULL, "Failed to allocate measurement specification");
+
+    add_weighted_instruction(spec, "light", 0, &dummy_measurement_type);
+    add_weighted_instruction(spec, "heavy", 5, &other_measurement_type);
+    return spec;
+}
+
+START_TEST(test_evaluate_weights)
+{
+    struct budget_ctxt b = {0};
+    measurement_coverage coverage;
+    meas_spec *spec = mk_weighted_spec();
+
+    fail_unless(evaluate_measurement_spec_with_budget(spec, &budget_callbacks, &b,
+                NULL, &coverage) == 0,
+                "Error while evaluating weighted measurement spec");
+
+    fail_unless(b.measured == 2, "Expected 2 measurements, got %d", b.measured);
+    fail_unless(b.first == &other_measurement_type,
+                "Heavier instruction was not evaluated first");
+    fail_unless(coverage.exhausted == MEASUREMENT_BUDGET_NONE &&
+                coverage.evaluated == 2 && coverage.skipped == 0,
+                "Unbudgeted evaluation reported partial coverage");
+    fail_unless(coverage.bytes == 8192, "Expected 8192 bytes, got %"PRIu64,
+                coverage.bytes);
+    fail_unless(b.recorded == 0, "Coverage recorded without a budget");
+
+    free_meas_spec(spec);
+}
+END_TEST
+
+START_TEST(test_evaluate_budget)
+{
+    struct budget_ctxt b = {0};
+    measurement_coverage coverage;
+    meas_spec *spec = mk_weighted_spec();
+
+    spec->budget.max_measurements = 1;
+    fail_unless(evaluate_measurement_spec(spec, &budget_callbacks, &b) == 0,
+                "Running out of budget should not be an error");
+
+    fail_unless(b.measured == 1, "Expected 1 measurement, got %d", b.measured);
+    fail_unless(b.first == &other_measurement_type,
+                "Budget was not spent on the heavier instruction");
+    fail_unless(b.recorded == 1, "Coverage recorded %d times", b.recorded);
+    fail_unless(b.coverage.exhausted == MEASUREMENT_BUDGET_MEASUREMENTS,
+                "Wrong limit reported: %s",
+                measurement_budget_limit_name(b.coverage.exhausted));
+    fail_unless(b.coverage.evaluated == 1 && b.coverage.skipped == 1,
+                "Expected 1 evaluated and 1 skipped, got %"PRIu32" and %"PRIu32,
+                b.coverage.evaluated, b.coverage.skipped);
+
+    /* a byte budget is checked after the measurement that exceeds it */
+    memset(&b, 0, sizeof(b));
+    memset(&spec->budget, 0, sizeof(spec->budget));
+    spec->budget.max_bytes = 100;
+    fail_unless(evaluate_measurement_spec_with_budget(spec, &budget_callbacks, &b,
+                &spec->budget, &coverage) == 0,
+                "Running out of budget should not be an error");
+    fail_unless(b.measured == 1 && coverage.exhausted == MEASUREMENT_BUDGET_BYTES,
+                "Byte budget was not enforced");
+
+    /* a budget that is not reached still records complete coverage */
+    memset(&b, 0, sizeof(b));
+    spec->budget.max_bytes = 1 << 20;
+    fail_unless(evaluate_measurement_spec(spec, &budget_callbacks, &b) == 0,
+                "Error while evaluating budgeted measurement spec");
+    fail_unless(b.measured == 2 && b.recorded == 1 &&
+                b.coverage.exhausted == MEASUREMENT_BUDGET_NONE &&
+                b.coverage.skipped == 0,
+                "Generous budget did not yield complete coverage");
+
+    free_meas_spec(spec);
+}
+END_TEST
+
+START_TEST(test_evaluate_budget_without_coverage)
+{
+    struct budget_ctxt b = {0};
+    meas_spec *spec = mk_weighted_spec();
+    measurement_spec_callbacks no_coverage = budget_callbacks;
+
+    no_coverage.record_coverage = NULL;
+    spec->budget.max_measurements = 1;
+    fail_unless(evaluate_measurement_spec(spec, &no_coverage, &b) == -ENOTSUP,
+                "Budget honored without a way to record coverage");
+    fail_unless(b.measured == 0, "Measured %d variables", b.measured);
+
+    /* without a budget nothing needs recording */
+    memset(&spec->budget, 0, sizeof(spec->budget));
+    fail_unless(evaluate_measurement_spec(spec, &no_coverage, &b) == 0,
+                "Error while evaluating unbudgeted measurement spec");
+    fail_unless(b.measured == 2, "Expected 2 measurements, got %d", b.measured);
+
+    free_meas_spec(spec);
+}
+END_TEST
+
+/*
+ * Filter evaluation order. Variables are numbered 0..NR_FILTER_VARS-1
+ * and the predicates' features name properties of that number.
+ */
+#define NR_FILTER_VARS 32
+
+static measurement_type slow_measurement_type = {
+    .name	= "slow",
+    .magic	= 0x510e510e
+};
+
+static measurement_type matched_measurement_type = {
+    .name	= "matched",
+    .magic	= 0x3a7c4ed0
+};
+
+struct filter_ctxt {
+    int slow;		/* measurements with slow_measurement_type */
+    uint64_t matched;	/* variables that passed the filter */
+};
+
+static uint32_t filter_var_number(measurement_variable *v)
+{
+    return ((simple_address *)v->address)->addr;
+}
+
+/* 1 if @feature holds for @i, 0 if not and -1 if it can't be checked */
+static int filter_feature(const char *feature, uint32_t i)
+{
+    if(strcmp(feature, "even") == 0) {
+        return i % 2 == 0;
+    } else if(strcmp(feature, "quarter") == 0) {
+        return i % 4 == 0;
+    } else if(strcmp(feature, "small") == 0) {
+        return i < 6;
+    } else if(strcmp(feature, "odd_error") == 0) {
+        return i % 2 ? -1 : i % 4 == 0;
+    }
+    return -1;
+}
+
+static GQueue *enumerate_filter_variables(void *ctxt, target_type *ttype,
+        address_space *aspace, char *op,
+        char *val)
+{
+    GQueue *q = g_queue_new();
+    uint32_t i;
+
+    fail_if(q == NULL, "Failed to allocate queue");
+    for(i = 0; i < NR_FILTER_VARS; i++) {
+        simple_address *addr = (simple_address *)alloc_address(aspace);
+        fail_if(addr == NULL, "Failed to allocate an address");
+        memset(&addr->addr, 0, sizeof(*addr) - offsetof(simple_address, addr));
+        addr->addr = i;
+        g_queue_push_tail(q, new_measurement_variable(ttype, &addr->a));
+    }
+    return q;
+}
+
+static int measure_filter_variable(void *ctxt, measurement_variable *v,
+                                   measurement_type *t)
+{
+    struct filter_ctxt *f = (struct filter_ctxt *)ctxt;
+
+    if(t == &slow_measurement_type) {
+        struct timespec start, now;
+
+        /* expensive enough to dominate the cost statistics */
+        f->slow++;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while((now.tv_sec - start.tv_sec) * 1000000000L +
+                (now.tv_nsec - start.tv_nsec) < 200000L);
+    } else if(t == &matched_measurement_type) {
+        f->matched |= 1ULL << filter_var_number(v);
+    }
+    return 0;
+}
+
+static int check_filter_predicate(void *ctxt, measurement_variable *var,
+                                  measurement_type *mtype,
+                                  predicate_quantifier quant, char *feature,
+                                  char *operator, char *value)
+{
+    return filter_feature(feature, filter_var_number(var));
+}
+
+static measurement_spec_callbacks filter_callbacks = {
+    .enumerate_variables	= enumerate_filter_variables,
+    .measure_variable		= measure_filter_variable,
+    .get_measurement_feature	= get_measurement_feature,
+    .check_predicate		= check_filter_predicate
+};
+
+static instruction_filter *mk_predicate(measurement_type *mtype, const char *feature)
+{
+    instruction_filter *f = calloc(1, sizeof(instruction_filter));
+
+    fail_if(f == NULL, "Failed to allocate filter predicate");
+    f->type		= BASE_FILTER;
+    f->u.b.mtype	= mtype;
+    f->u.b.quantifier	= ANY_VALUE;
+    f->u.b.feature	= strdup(feature);
+    f->u.b.operator	= strdup("equal");
+    f->u.b.value	= strdup("1");
+    return f;
+}
+
+static instruction_filter *mk_op(int op, instruction_filter *e1, instruction_filter *e2)
+{
+    instruction_filter *f = calloc(1, sizeof(instruction_filter));
+
+    fail_if(f == NULL, "Failed to allocate filter expression");
+    f->type	= LOGICAL_OP_FILTER;
+    f->u.o.op	= op;
+    f->u.o.e1	= e1;
+    f->u.o.e2	= e2;
+    return f;
+}
+
+/* left to right evaluation of @f on variable @i */
+static int naive_filter(instruction_filter *f, uint32_t i)
+{
+    int rc;
+
+    if(f->type == BASE_FILTER) {
+        return filter_feature(f->u.b.feature, i);
+    }
+    rc = naive_filter(f->u.o.e1, i);
+    switch(f->u.o.op) {
+    case FILTER_NOT_OP:
+        return rc < 0 ? rc : !rc;
+    case FILTER_AND_OP:
+        return rc == 1 ? naive_filter(f->u.o.e2, i) : rc;
+    default:
+        return rc == 0 ? naive_filter(f->u.o.e2, i) : rc;
+    }
+}
+
+static void add_filter_instruction(meas_spec *spec, char *name, instruction_filter *filter)
+{
+    filter_instruction_spec *instr = calloc(1, sizeof(filter_instruction_spec));
+    variable_spec *var = malloc(sizeof(variable_spec));
+    address_spec *addr = malloc(sizeof(address_spec));
+
+    fail_if(instr == NULL, "Failed to allocate filter measurement instruction.");
+    fail_if(var == NULL,  "Failed to allocate variable spec");
+    fail_if(addr == NULL, "Failed to allocate address spec");
+
+    instr->i.instr_type   = FILTER_INSTR;
+    instr->i.name	  = (xmlChar *)strdup(name);
+    instr->i.target_type  = &dummy_target_type;
+    instr->i.address_space= &simple_address_space;
+    instr->filter	  = filter;
+    instr->action	  = (xmlChar *)strdup("matched");
+    spec->instruction_list = g_list_append(spec->instruction_list, instr);
+
+    var->instruction_name = (xmlChar *)strdup(name);
+    addr->operation       = strdup("ignore");
+    addr->value           = strdup("me");
+    var->address_list     = g_list_append(NULL, addr);
+    spec->variable_list   = g_list_append(spec->variable_list, var);
+}
+
+/* A spec applying @filter to every variable. */
+static meas_spec *mk_filter_spec(instruction_filter *filter)
+{
+    meas_spec *spec = calloc(1, sizeof(meas_spec));
+    simple_instruction_spec *matched = malloc(sizeof(simple_instruction_spec));
+
+    fail_if(spec == NULL, "Failed to allocate measurement specification");
+    fail_if(matched == NULL, "Failed to allocate simple measurement instruction.");
+
+    matched->i.instr_type   = SIMPLE_INSTR;
+    matched->i.name	    = (xmlChar *)strdup("matched");
+    matched->i.target_type  = &dummy_target_type;
+    matched->i.address_space= &simple_address_space;
+    matched->i.weight       = 0;
+    matched->mtype	    = &matched_measurement_type;
+    spec->instruction_list  = g_list_append(NULL, matched);
+
+    add_filter_instruction(spec, "filter", filter);
+    return spec;
+}
+
+static uint64_t naive_matches(instruction_filter *filter)
+{
+    uint64_t matched = 0;
+    uint32_t i;
+
+    for(i = 0; i < NR_FILTER_VARS; i++) {
+        int rc = naive_filter(filter, i);
+        fail_if(rc < 0, "Left to right evaluation fails on variable %"PRIu32, i);
+        if(rc) {
+            matched |= 1ULL << i;
+        }
+    }
+    return matched;
+}
+
+START_TEST(test_evaluate_filter_order)
+{
+    instruction_filter *filters[] = {
+        /* a slow predicate written before a cheap, selective one */
+        mk_op(FILTER_AND_OP, mk_predicate(&slow_measurement_type, "even"),
+              mk_predicate(&dummy_measurement_type, "quarter")),
+        mk_op(FILTER_OR_OP, mk_predicate(&slow_measurement_type, "even"),
+              mk_predicate(&dummy_measurement_type, "quarter")),
+        mk_op(FILTER_AND_OP, mk_op(FILTER_NOT_OP, mk_predicate(&slow_measurement_type, "even"), NULL),
+              mk_op(FILTER_OR_OP, mk_predicate(&dummy_measurement_type, "small"),
+                    mk_predicate(&other_measurement_type, "quarter"))),
+        /* the cheap predicate fails on the variables the slow one rejects */
+        mk_op(FILTER_AND_OP, mk_predicate(&slow_measurement_type, "even"),
+              mk_predicate(&dummy_measurement_type, "odd_error")),
+    };
+    size_t i;
+
+    for(i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        struct filter_ctxt f = {0};
+        uint64_t expected = naive_matches(filters[i]);
+        meas_spec *spec = mk_filter_spec(filters[i]);
+
+        fail_unless(evaluate_measurement_spec(spec, &filter_callbacks, &f) == 0,
+                    "Error while evaluating filter %zu", i);
+        fail_unless(f.matched == expected,
+                    "Filter %zu matched 0x%"PRIx64" instead of 0x%"PRIx64,
+                    i, f.matched, expected);
+        if(i == 0) {
+            fail_unless(f.slow < NR_FILTER_VARS / 2,
+                        "Slow predicate evaluated %d times", f.slow);
+        }
+        free_meas_spec(spec);
+    }
+}
+END_TEST
+
+START_TEST(test_evaluate_filter_stats)
+{
+    char path[] = "/tmp/test_filter_statsXXXXXX";
+    struct filter_ctxt f = {0};
+    meas_spec *spec;
+    int fd;
+
+    fd = mkstemp(path);
+    fail_if(fd < 0, "Failed to create statistics file");
+    close(fd);
+    unlink(path);
+    setenv(ENV_MAAT_FILTER_STATS, path, 1);
+
+    spec = mk_filter_spec(mk_op(FILTER_AND_OP, mk_predicate(&slow_measurement_type, "even"),
+                                mk_predicate(&dummy_measurement_type, "quarter")));
+    fail_unless(evaluate_measurement_spec(spec, &filter_callbacks, &f) == 0,
+                "Error while evaluating filter");
+    fail_unless(access(path, R_OK) == 0, "Filter statistics were not saved");
+
+    /* starting from saved statistics, the slow predicate is only
+       evaluated where the cheap one holds */
+    memset(&f, 0, sizeof(f));
+    fail_unless(evaluate_measurement_spec(spec, &filter_callbacks, &f) == 0,
+                "Error while evaluating filter");
+    fail_unless(f.slow == NR_FILTER_VARS / 4,
+                "Slow predicate evaluated %d times with saved statistics", f.slow);
+    fail_unless(f.matched == naive_matches(((filter_instruction_spec *)
+                                            spec->instruction_list->next->data)->filter),
+                "Filter matched different variables with saved statistics");
+
+    unsetenv(ENV_MAAT_FILTER_STATS);
+    unlink(path);
+    free_meas_spec(spec);
+}
+END_TEST
+
+START_TEST(test_evaluate_filter_memo)
+{
+    struct filter_ctxt f = {0};
+    meas_spec *spec;
+
+    /* two filters testing the same predicate on the same variables */
+    spec = mk_filter_spec(mk_predicate(&slow_measurement_type, "even"));
+    add_filter_instruction(spec, "filter2",
+                           mk_op(FILTER_AND_OP, mk_predicate(&dummy_measurement_type, "small"),
+                                 mk_predicate(&slow_measurement_type, "even")));
+
+    fail_unless(evaluate_measurement_spec(spec, &filter_callbacks, &f) == 0,
+                "Error while evaluating filters");
+    fail_unless(f.slow == NR_FILTER_VARS,
+                "Slow predicate measured %d times for %d variables", f.slow, NR_FILTER_VARS);
+    fail_unless(f.matched == 0x55555555ULL, "Filters matched 0x%"PRIx64, f.matched);
+
+    free_meas_spec(spec);
+}
+END_TEST
+
+/*
+ * Checkpoints. The measurement callback fails fatally on its
+ * fail_at'th call, like an APB whose ASP died.
+ */
+struct checkpoint_ctxt {
+    int calls;
+    int fail_at;
+    uint64_t measured;
+};
+
+static int measure_until_failure(void *ctxt, measurement_variable *v,
+                                 measurement_type *t)
+{
+    struct checkpoint_ctxt *c = (struct checkpoint_ctxt *)ctxt;
+
+    if(++c->calls == c->fail_at) {
+        return -EIO;
+    }
+    c->measured |= 1ULL << filter_var_number(v);
+    return 0;
+}
+
+static int fail_fatally(void *ctxt, int rc, measurement_variable *var,
+                        measurement_type *mtype)
+{
+    return rc;
+}
+
+static char *checkpoint_progress(void *ctxt)
+{
+    return g_strdup_printf("%d", ((struct checkpoint_ctxt *)ctxt)->calls);
+}
+
+static measurement_spec_callbacks checkpoint_callbacks = {
+    .enumerate_variables	= enumerate_filter_variables,
+    .measure_variable		= measure_until_failure,
+    .get_measurement_feature	= get_measurement_feature,
+    .check_predicate		= check_filter_predicate,
+    .handle_error		= fail_fatally
+};
+
+static meas_spec *mk_checkpoint_spec(void)
+{
+    meas_spec *spec = calloc(1, sizeof(meas_spec));
+
+    fail_if(spec == NULL, "Failed to allocate measurement specification");
+    uuid_generate(spec->uuid);
+    add_weighted_instruction(spec, "each", 0, &dummy_measurement_type);
+    return spec;
+}
+
+static void mk_checkpoint_path(char *dir, measurement_checkpoint *ckpt)
+{
+    fail_if(mkdtemp(dir) == NULL, "Failed to create checkpoint directory");
+    memset(ckpt, 0, sizeof(*ckpt));
+    ckpt->path		= g_strdup_printf("%s/checkpoint", dir);
+    ckpt->key		= (const unsigned char *)"checkpoint key";
+    ckpt->keylen	= strlen("checkpoint key");
+    ckpt->progress	= checkpoint_progress;
+}
+
+START_TEST(test_checkpoint_resume)
+{
+    char dir[] = "/tmp/test_checkpointXXXXXX";
+    struct checkpoint_ctxt c = {0};
+    measurement_checkpoint ckpt;
+    uint64_t measured;
+    char *progress = NULL;
+    meas_spec *spec = mk_checkpoint_spec();
+
+    mk_checkpoint_path(dir, &ckpt);
+    ckpt.interval = 4;
+
+    /* the 10th measurement fails after the checkpoint taken after 8 */
+    c.fail_at = 10;
+    fail_unless(evaluate_measurement_spec_checkpointed(spec, &checkpoint_callbacks,
+                &c, &ckpt, NULL) < 0,
+                "Fatal measurement error did not fail the evaluation");
+    fail_unless(read_measurement_checkpoint(spec, &ckpt, &progress) == 0,
+                "Checkpoint was not kept after a failure");
+    fail_unless(progress != NULL && strcmp(progress, "8") == 0,
+                "Expected progress \"8\", got \"%s\"", progress);
+    free(progress);
+
+    measured = c.measured;
+    memset(&c, 0, sizeof(c));
+    fail_unless(evaluate_measurement_spec_checkpointed(spec, &checkpoint_callbacks,
+                &c, &ckpt, NULL) == 0,
+                "Error while resuming from checkpoint");
+    fail_unless(c.calls == NR_FILTER_VARS - 8,
+                "Resumed evaluation measured %d variables, expected %d",
+                c.calls, NR_FILTER_VARS - 8);
+    fail_unless((measured | c.measured) == (1ULL << NR_FILTER_VARS) - 1,
+                "Resumed evaluation missed variables: 0x%"PRIx64,
+                measured | c.measured);
+    fail_unless(access(ckpt.path, F_OK) != 0,
+                "Checkpoint was not removed after a complete evaluation");
+
+    rmdir(dir);
+    g_free((char *)ckpt.path);
+    free_meas_spec(spec);
+}
+END_TEST
+
+START_TEST(test_checkpoint_rejected)
+{
+    char dir[] = "/tmp/test_checkpointXXXXXX";
+    struct checkpoint_ctxt c = {0};
+    measurement_checkpoint ckpt, other;
+    char *progress = NULL;
+    char *contents = NULL;
+    gsize size = 0;
+    meas_spec *spec = mk_checkpoint_spec();
+    meas_spec *spec2 = mk_checkpoint_spec();
+
+    mk_checkpoint_path(dir, &ckpt);
+    ckpt.interval = 1;
+    c.fail_at = 3;
+    fail_unless(evaluate_measurement_spec_checkpointed(spec, &checkpoint_callbacks,
+                &c, &ckpt, NULL) < 0,
+                "Fatal measurement error did not fail the evaluation");
+    fail_unless(read_measurement_checkpoint(spec, &ckpt, &progress) == 0,
+                "Checkpoint was not kept after a failure");
+    free(progress);
+
+    /* no key */
+    other = ckpt;
+    other.key = NULL;
+    other.keylen = 0;
+    fail_unless(read_measurement_checkpoint(spec, &other, &progress) == -EINVAL,
+                "Checkpoint read without a key");
+    fail_unless(evaluate_measurement_spec_checkpointed(spec, &checkpoint_callbacks,
+                &c, &other, NULL) == -EINVAL,
+                "Evaluation checkpointed without a key");
+
+    /* another key */
+    other = ckpt;
+    other.key = (const unsigned char *)"another key";
+    other.keylen = strlen("another key");
+    fail_unless(read_measurement_checkpoint(spec, &other, &progress) == -EBADMSG,
+                "Checkpoint accepted with the wrong key");
+
+    /* another spec, and an evaluation of it refuses to start */
+    fail_unless(read_measurement_checkpoint(spec2, &ckpt, &progress) == -EBADMSG,
+                "Checkpoint accepted for another spec");
+    memset(&c, 0, sizeof(c));
+    fail_unless(evaluate_measurement_spec_checkpointed(spec2, &checkpoint_callbacks,
+                &c, &ckpt, NULL) == -EBADMSG && c.calls == 0,
+                "Evaluation started from the checkpoint of another spec");
+
+    /* a modified checkpoint */
+    fail_unless(g_file_get_contents(ckpt.path, &contents, &size, NULL),
+                "Failed to read checkpoint");
+    contents[size - 2] ^= 1;
+    fail_unless(g_file_set_contents(ckpt.path, contents, (gssize)size, NULL),
+                "Failed to write checkpoint");
+    g_free(contents);
+    fail_unless(read_measurement_checkpoint(spec, &ckpt, &progress) == -EBADMSG,
+                "Modified checkpoint accepted");
+    fail_unless(progress == NULL, "Progress returned from a rejected checkpoint");
+
+    unlink(ckpt.path);
+    rmdir(dir);
+    g_free((char *)ckpt.path);
+    free_meas_spec(spec);
+    free_meas_spec(spec2);
+}
+END_TEST
+
 int main(int argc, char *argv[])
 {
     Suite *s;
@@ -742,6 +1409,18 @@ int main(int argc, char *argv[])
     tcase_add_test(tcase, test_evaluate_simple);
     tcase_add_test(tcase, test_evaluate_submeasure);
     tcase_add_test(tcase, test_evaluate_filter);
+    tcase_add_test(tcase, test_evaluate_weights);
+    tcase_add_test(tcase, test_evaluate_budget);
+    tcase_add_test(tcase, test_evaluate_budget_without_coverage);
+    tcase_add_test(tcase, test_evaluate_filter_order);
+    tcase_add_test(tcase, test_evaluate_filter_stats);
+    tcase_add_test(tcase, test_evaluate_filter_memo);
+    suite_add_tcase(s, tcase);
+
+    tcase = tcase_create("Checkpoints");
+    tcase_add_checked_fixture(tcase, checked_setup, checked_teardown);
+    tcase_add_test(tcase, test_checkpoint_resume);
+    tcase_add_test(tcase, test_checkpoint_rejected);
     suite_add_tcase(s, tcase);
 
     sr = srunner_create(s);
@@ -432,6 +432,74 @@ START_TEST (test_file_pkg)
 }
 END_TEST
 
+START_TEST (test_file_pkg_batch)
+{
+    int rc;
+    char *graph_path = measurement_graph_get_path(graph);
+    node_id_str n;
+    char *ids;
+    char *asp_argv[] = {graph_path, n};
+    measurement_data *data    = NULL;
+    char *distribution        = NULL;
+    struct asp *inv           = NULL;
+    measurement_variable var = {.type = &file_target_type,
+                                .address = NULL
+                               };
+    char unowned[] = "/tmp/test_pkg_asps_XXXXXX";
+    node_id_t owned_node, unowned_node, unit_node = path_node;
+    node_id_str owned_str, unowned_str, unit_str;
+    int fd;
+
+    str_of_node_id(path_node, n);
+    rc = run_asp(sys_asp, -1, -1, false, 2, asp_argv, -1);
+    fail_unless(rc == 0, "System ASP failed with code %d\n", rc);
+    fail_if(measurement_node_get_rawdata(graph, path_node,
+                                         &system_measurement_type, &data) != 0,
+            "Failed to get system measurement data");
+    distribution = (container_of(data, system_data, meas_data))->distribution;
+    if((strcasecmp(distribution, "ubuntu") == 0) || (strcasecmp(distribution, "debian") == 0)) {
+        inv = dpkg_inv;
+    } else if ((strcasecmp(distribution, "fedora") == 0) || (strcasecmp(distribution, "\"centos\"") == 0) ||
+               (strcasecmp(distribution, "\"rhel\"") == 0)) {
+        inv = rpm_inv;
+    }
+    free_measurement_data(data);
+    fail_unless(inv != NULL, "distribution not supported\n");
+    fail_unless(inv->batch > 1, "%s does not take several nodes\n", inv->name);
+
+    fail_if((fd = mkstemp(unowned)) < 0, "Failed to create %s\n", unowned);
+    close(fd);
+
+    var.address = address_from_human_readable(&simple_file_address_space, "/usr/bin/make");
+    fail_if(var.address == NULL, "Failed to read simple_file_address");
+    measurement_graph_add_node(graph, &var, NULL, &owned_node);
+    free_address(var.address);
+    var.address = address_from_human_readable(&simple_file_address_space, unowned);
+    fail_if(var.address == NULL, "Failed to read simple_file_address");
+    measurement_graph_add_node(graph, &var, NULL, &unowned_node);
+    free_address(var.address);
+
+    /* the unit node is no file, so only it is left unmeasured */
+    str_of_node_id(owned_node, owned_str);
+    str_of_node_id(unowned_node, unowned_str);
+    str_of_node_id(unit_node, unit_str);
+    ids = g_strdup_printf("%s,%s,%s", owned_str, unit_str, unowned_str);
+    asp_argv[1] = ids;
+    rc = run_asp(inv, -1, -1, false, 2, asp_argv, -1);
+    fail_if(rc == 0, "Batch with a bad node succeeded\n");
+    fail_unless(measurement_node_has_data(graph, owned_node, &pkginv_measurement_type) > 0,
+                "Owned file not measured\n");
+    fail_unless(measurement_node_has_data(graph, unowned_node, &pkginv_measurement_type) > 0,
+                "File without a package not measured\n");
+    fail_if(measurement_node_has_data(graph, unit_node, &pkginv_measurement_type) > 0,
+            "Bad node measured\n");
+
+    unlink(unowned);
+    g_free(ids);
+    free(graph_path);
+}
+END_TEST
+
 int main(void)
 {
     Suite *s;
@@ -445,6 +513,7 @@ int main(void)
     tcase_add_test(pkginv, test_sys_asp);
     tcase_add_test(pkginv, test_pkg_inv);
     tcase_add_test(pkginv, test_file_pkg);
+    tcase_add_test(pkginv, test_file_pkg_batch);
     tcase_add_test(pkginv, test_pkg_pattern);
     tcase_add_test(pkginv, test_pkg_details);
     tcase_set_timeout(pkginv, 1000);
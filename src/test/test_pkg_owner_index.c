@@ -0,0 +1,316 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the file to package index used by the dpkg_inv and rpm_inv
+ * ASPs, built from a fake dpkg database.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+
+#include <../asps/pkg_owner_index.h>
+
+static char tmpdir[] = "/tmp/test_pkg_owner_indexXXXXXX";
+static char root[PATH_MAX];
+static pkg_owner_index *idx;
+
+static const char *status =
+    "Package: dpkg\n"
+    "Status: install ok installed\n"
+    "Architecture: amd64\n"
+    "Version: 1.21.1\n"
+    "\n"
+    "Package: coreutils\n"
+    "Status: install ok installed\n"
+    "Architecture: amd64\n"
+    "Version: 8.32-4\n"
+    "Description: GNU core utilities\n"
+    " Package: not-a-package\n"
+    "\n"
+    "Package: libc6\n"
+    "Status: install ok installed\n"
+    "Architecture: amd64\n"
+    "Multi-Arch: same\n"
+    "Version: 2.35-0\n"
+    "\n"
+    "Package: libc6\n"
+    "Status: install ok installed\n"
+    "Architecture: i386\n"
+    "Multi-Arch: same\n"
+    "Version: 2.35-0\n"
+    "\n"
+    "Package: foreign\n"
+    "Status: install ok installed\n"
+    "Architecture: arm64\n"
+    "Version: 2\n"
+    "\n"
+    "Package: removed\n"
+    "Status: deinstall ok config-files\n"
+    "Architecture: all\n"
+    "Version: 1.0\n"
+    "\n"
+    "Package: diverter\n"
+    "Status: install ok installed\n"
+    "Architecture: all\n"
+    "Version: 3\n";
+
+static const char *diversions =
+    "/usr/bin/cat\n/usr/bin/cat.distrib\ndiverter\n"
+    "/usr/bin/local\n/usr/bin/local.orig\n:\n";
+
+static void write_file(const char *rel, const char *contents)
+{
+    char *path = g_build_filename(tmpdir, rel, NULL);
+
+    fail_if(!g_file_set_contents(path, contents, -1, NULL), "Failed to write %s", path);
+    g_free(path);
+}
+
+static void setup(void)
+{
+    char *info, *real, *contents;
+
+    libmaat_init(0, 4);
+    fail_if(mkdtemp(tmpdir) == NULL, "Failed to create temporary directory");
+    fail_if(realpath(tmpdir, root) == NULL, "Failed to resolve %s", tmpdir);
+
+    info = g_build_filename(tmpdir, "info", NULL);
+    real = g_build_filename(tmpdir, "real", NULL);
+    fail_if(mkdir(info, 0755) != 0 || mkdir(real, 0755) != 0, "Failed to create directories");
+
+    write_file("diversions", diversions);
+    write_file("info/dpkg.list", "/usr/bin/dpkg\n");
+    write_file("info/coreutils.list",
+               "/.\n/usr\n/usr/bin\n/usr/bin/cat\n/usr/bin/local\n/bin/ls\n");
+    write_file("info/libc6:amd64.list",
+               "/usr/share/doc/libc6\n/lib/x86_64-linux-gnu/libc.so.6\n");
+    write_file("info/libc6:i386.list",
+               "/usr/share/doc/libc6\n/lib/i386-linux-gnu/libc.so.6\n");
+    write_file("info/foreign.list", "/usr/bin/foreign\n");
+    write_file("info/removed.list", "/etc/removed.conf\n");
+    write_file("info/diverter.list", "/usr/bin/cat\n");
+    write_file("info/orphan.list", "/usr/bin/orphan\n");
+    write_file("info/coreutils.md5sums", "0  /usr/bin/not-a-list\n");
+
+    /* <tmpdir>/link -> real, and a package file listed through the link */
+    contents = g_strdup_printf("%s/link/tool\n%s/real/target\n", root, root);
+    write_file("info/links.list", contents);
+    g_free(contents);
+    contents = g_strdup_printf("%s\nPackage: links\nStatus: install ok installed\n"
+                               "Architecture: amd64\nVersion: 4\n", status);
+    write_file("status", contents);
+    g_free(contents);
+    write_file("real/tool", "");
+    write_file("real/target", "");
+    contents = g_build_filename(tmpdir, "link", NULL);
+    fail_if(symlink("real", contents) != 0, "Failed to create %s", contents);
+    g_free(contents);
+    /* an alternative: <tmpdir>/alt -> real/target */
+    contents = g_build_filename(tmpdir, "alt", NULL);
+    fail_if(symlink("real/target", contents) != 0, "Failed to create %s", contents);
+    g_free(contents);
+
+    fail_unless(pkg_owner_index_build_dpkg(tmpdir, &idx) == 0, "Failed to build index");
+
+    g_free(info);
+    g_free(real);
+}
+
+static void teardown(void)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", tmpdir);
+
+    pkg_owner_index_free(idx);
+    idx = NULL;
+    fail_if(system(cmd) != 0, "Failed to remove %s", tmpdir);
+    g_free(cmd);
+    strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+    libmaat_exit();
+}
+
+static void check_owner(pkg_owner_index *i, const char *path, const char *expected)
+{
+    const char *line = pkg_owner_index_lookup(i, path);
+
+    if(expected == NULL) {
+        fail_unless(line == NULL, "%s owned by %s", path, line);
+    } else {
+        fail_if(line == NULL, "%s has no owner", path);
+        fail_unless(strcmp(line, expected) == 0, "%s owned by '%s', not '%s'",
+                    path, line, expected);
+    }
+}
+
+START_TEST(test_owners)
+{
+    check_owner(idx, "/bin/ls", "ii coreutils 8.32-4 amd64");
+    check_owner(idx, "/usr/bin/dpkg", "ii dpkg 1.21.1 amd64");
+    /* Multi-Arch: same packages are named with their architecture */
+    check_owner(idx, "/lib/x86_64-linux-gnu/libc.so.6", "ii libc6:amd64 2.35-0 amd64");
+    check_owner(idx, "/lib/i386-linux-gnu/libc.so.6", "ii libc6:i386 2.35-0 i386");
+    /* so are packages of a foreign architecture */
+    check_owner(idx, "/usr/bin/foreign", "ii foreign:arm64 2 arm64");
+    /* removed packages keep their state, so the ASP can skip them */
+    check_owner(idx, "/etc/removed.conf", "rc removed 1.0 all");
+    /* lists without a package and other info files are ignored */
+    check_owner(idx, "/usr/bin/orphan", NULL);
+    check_owner(idx, "/usr/bin/not-a-list", NULL);
+    check_owner(idx, "/usr/bin/missing", NULL);
+    check_owner(idx, "relative", NULL);
+}
+END_TEST
+
+START_TEST(test_shared_path)
+{
+    const char *line = pkg_owner_index_lookup(idx, "/usr/share/doc/libc6");
+
+    fail_if(line == NULL, "Shared path has no owner");
+    fail_unless(strncmp(line, "ii libc6:", 9) == 0, "Shared path owned by %s", line);
+}
+END_TEST
+
+START_TEST(test_diversions)
+{
+    /* diverted by another package: the original file moved aside */
+    check_owner(idx, "/usr/bin/cat.distrib", "ii coreutils 8.32-4 amd64");
+    check_owner(idx, "/usr/bin/cat", "ii diverter 3 all");
+    /* a local diversion leaves nothing at the original path */
+    check_owner(idx, "/usr/bin/local.orig", "ii coreutils 8.32-4 amd64");
+    check_owner(idx, "/usr/bin/local", NULL);
+}
+END_TEST
+
+START_TEST(test_symlinks)
+{
+    char *path;
+
+    /* listed through a symlinked directory, found under the real one */
+    path = g_strdup_printf("%s/real/tool", root);
+    check_owner(idx, path, "ii links 4 amd64");
+    g_free(path);
+    path = g_strdup_printf("%s/link/tool", root);
+    check_owner(idx, path, "ii links 4 amd64");
+    g_free(path);
+
+    /* an unowned link to an owned file, as with alternatives */
+    path = g_strdup_printf("%s/alt", root);
+    check_owner(idx, path, "ii links 4 amd64");
+    g_free(path);
+}
+END_TEST
+
+START_TEST(test_save_load)
+{
+    char *path = g_build_filename(tmpdir, "index", NULL);
+    pkg_owner_index *loaded = NULL;
+
+    fail_unless(pkg_owner_index_save(idx, path) == 0, "Failed to save index");
+    fail_unless(pkg_owner_index_load(path, &loaded) == 0, "Failed to load index");
+    fail_unless(pkg_owner_index_size(loaded) == pkg_owner_index_size(idx),
+                "Loaded %zu paths, saved %zu", pkg_owner_index_size(loaded),
+                pkg_owner_index_size(idx));
+    check_owner(loaded, "/bin/ls", "ii coreutils 8.32-4 amd64");
+    check_owner(loaded, "/usr/bin/cat", "ii diverter 3 all");
+    check_owner(loaded, "/usr/bin/orphan", NULL);
+    pkg_owner_index_free(loaded);
+
+    /* a truncated index is rejected */
+    fail_if(truncate(path, 20) != 0, "Failed to truncate %s", path);
+    fail_unless(pkg_owner_index_load(path, &loaded) == -EINVAL, "Loaded a truncated index");
+    write_file("index", "not an index, but long enough to hold a header\n");
+    fail_unless(pkg_owner_index_load(path, &loaded) == -EINVAL, "Loaded a text file");
+    fail_unless(pkg_owner_index_load("/nonexistent/index", &loaded) == -ENOENT,
+                "Loaded a missing file");
+    g_free(path);
+}
+END_TEST
+
+static int builds;
+
+static int build_fake(pkg_owner_index **out)
+{
+    builds++;
+    return pkg_owner_index_build_dpkg(tmpdir, out);
+}
+
+START_TEST(test_open_cached)
+{
+    pkg_owner_index *cached = NULL;
+    char *graph = g_build_filename(tmpdir, "graph", NULL);
+
+    fail_if(mkdir(graph, 0700) != 0, "Failed to create %s", graph);
+    builds = 0;
+    fail_unless(pkg_owner_index_open_cached(graph, build_fake, &cached) == 0,
+                "Failed to build cached index");
+    check_owner(cached, "/bin/ls", "ii coreutils 8.32-4 amd64");
+    pkg_owner_index_free(cached);
+    fail_unless(pkg_owner_index_open_cached(graph, build_fake, &cached) == 0,
+                "Failed to open cached index");
+    check_owner(cached, "/bin/ls", "ii coreutils 8.32-4 amd64");
+    pkg_owner_index_free(cached);
+    fail_unless(builds == 1, "Index built %d times", builds);
+    g_free(graph);
+}
+END_TEST
+
+START_TEST(test_no_database)
+{
+    pkg_owner_index *none = NULL;
+
+    fail_unless(pkg_owner_index_build_dpkg("/nonexistent", &none) == -ENOENT,
+                "Built an index without a database");
+    fail_unless(none == NULL, "Index returned on failure");
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("Package owner index");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_owners);
+    tcase_add_test(tcase, test_shared_path);
+    tcase_add_test(tcase, test_diversions);
+    tcase_add_test(tcase, test_symlinks);
+    tcase_add_test(tcase, test_save_load);
+    tcase_add_test(tcase, test_open_cached);
+    tcase_add_test(tcase, test_no_database);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_pkg_owner_index.log");
+    srunner_set_xml(sr, "test_pkg_owner_index.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
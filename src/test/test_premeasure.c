@@ -0,0 +1,335 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the background pre-measurement used by userspace_apb.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <check.h>
+#include <glib.h>
+
+#include <util/util.h>
+#include <util/keyvalue.h>
+#include <maat-basetypes.h>
+
+#include <../apbs/premeasure.h>
+
+static char tmpdir[] = "/tmp/test_premeasureXXXXXX";
+static meas_spec spec;
+static struct key_value dir_conf = {.key = "premeasure_dir", .value = tmpdir};
+static GList *config = NULL;
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    fail_if(register_types() != 0, "Failed to register types");
+    fail_if(mkdtemp(tmpdir) == NULL, "Failed to create temporary directory");
+    uuid_generate(spec.uuid);
+    config = g_list_append(NULL, &dir_conf);
+}
+
+static void teardown(void)
+{
+    char *cmd = g_strdup_printf("rm -rf %s", tmpdir);
+
+    fail_if(system(cmd) != 0, "Failed to remove %s", tmpdir);
+    g_free(cmd);
+    g_list_free(config);
+    config = NULL;
+    strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+    libmaat_exit();
+}
+
+/*
+ * Initialise @pm from the comma separated key=value pairs in @args,
+ * with the APB configured to keep graphs in tmpdir.
+ */
+static int init(premeasure *pm, const char *args)
+{
+    char **pairs = g_strsplit(args, ",", -1);
+    int argc = (int)g_strv_length(pairs);
+    struct key_value **kv = calloc((size_t)argc, sizeof(*kv));
+    struct key_value *kvs = calloc((size_t)argc, sizeof(*kvs));
+    int i, ret;
+
+    fail_if(kv == NULL || kvs == NULL, "Failed to allocate arguments");
+    for(i = 0; i < argc; i++) {
+        char *eq = strchr(pairs[i], '=');
+
+        fail_if(eq == NULL, "Malformed argument %s", pairs[i]);
+        *eq = '\0';
+        kvs[i].key = pairs[i];
+        kvs[i].value = eq + 1;
+        kv[i] = &kvs[i];
+    }
+    ret = premeasure_init(pm, "test", config, &spec, kv, argc);
+    free(kvs);
+    free(kv);
+    g_strfreev(pairs);
+    return ret;
+}
+
+/* graphs kept in tmpdir */
+static int count_graphs(void)
+{
+    struct dirent *de;
+    DIR *dir = opendir(tmpdir);
+    int n = 0;
+
+    fail_if(dir == NULL, "Failed to open %s", tmpdir);
+    while((de = readdir(dir)) != NULL) {
+        if(strstr(de->d_name, ".graph.") != NULL) {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+static int measure_nothing(measurement_graph *g UNUSED, void *ctxt)
+{
+    (*(int *)ctxt)++;
+    return 0;
+}
+
+static int measure_error(measurement_graph *g UNUSED, void *ctxt UNUSED)
+{
+    return -EIO;
+}
+
+static int measure_refused(measurement_graph *g UNUSED, void *ctxt UNUSED)
+{
+    return -EPERM;
+}
+
+/* Make the freshness record of the latest graph @age seconds old. */
+static void age_latest(premeasure *pm, time_t age, uint32_t max_age)
+{
+    measurement_variable var = {.type = &system_target_type};
+    measurement_graph *g;
+    freshness_data *fd;
+    char *path = g_file_read_link(pm->latest, NULL);
+    node_id_t n;
+
+    fail_if(path == NULL, "No latest graph");
+    fail_unless(map_measurement_graph(path, &g) == 0, "Failed to map %s", path);
+    var.address = alloc_address(&unit_address_space);
+    n = measurement_graph_get_node(g, &var);
+    fail_if(n == INVALID_NODE_ID, "Graph has no system node");
+    fd = (freshness_data *)alloc_measurement_data(&freshness_measurement_type);
+    fd->measured_at = (uint64_t)(time(NULL) - age);
+    fd->max_age = max_age;
+    fail_unless(measurement_node_add_rawdata(g, n, &fd->d) == 0,
+                "Failed to replace freshness record");
+    free_measurement_data(&fd->d);
+    free_address(var.address);
+    unmap_measurement_graph(g);
+    g_free(path);
+}
+
+START_TEST(test_args)
+{
+    premeasure pm;
+
+    struct key_value age_conf = {.key = "premeasure_max_age", .value = "100"};
+    struct key_value watch_conf = {.key = "premeasure_watch", .value = "/etc/passwd"};
+
+    fail_unless(premeasure_init(&pm, "test", config, &spec, NULL, 0) == 0,
+                "Pre-measurement enabled without arguments");
+    fail_unless(init(&pm, "premeasure=0") == -EINVAL, "Accepted a zero interval");
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=x") == -EINVAL,
+                "Accepted an invalid max age");
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=30") == 1,
+                "Failed to enable pre-measurement");
+    fail_unless(pm.interval == 60 && pm.max_age == 30 &&
+                pm.idle == PREMEASURE_DEFAULT_IDLE, "Wrong settings");
+    fail_unless(premeasure_take(&pm) == NULL, "Took a graph before any was measured");
+    premeasure_release(&pm);
+
+    /* the directory and watch list are only taken from the APB's
+       configuration, which also bounds the max age */
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=100000,"
+                     "premeasure_dir=/tmp,premeasure_watch=/tmp") == 1,
+                "Failed to enable pre-measurement");
+    fail_unless(strcmp(pm.dir, tmpdir) == 0, "Took premeasure_dir from the request");
+    fail_unless(pm.watch == NULL, "Took premeasure_watch from the request");
+    fail_unless(pm.max_age == PREMEASURE_DEFAULT_MAX_AGE,
+                "Request raised the max age to %ld", (long)pm.max_age);
+    premeasure_release(&pm);
+
+    config = g_list_append(config, &age_conf);
+    config = g_list_append(config, &watch_conf);
+    fail_unless(init(&pm, "premeasure=60") == 1, "Failed to enable pre-measurement");
+    fail_unless(pm.max_age == 100 && pm.watch != NULL &&
+                strcmp(pm.watch, "/etc/passwd") == 0, "Configuration not applied");
+    premeasure_release(&pm);
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=1000") == 1,
+                "Failed to enable pre-measurement");
+    fail_unless(pm.max_age == 100, "Request raised the configured max age");
+    premeasure_release(&pm);
+}
+END_TEST
+
+START_TEST(test_take)
+{
+    premeasure pm, other;
+    measurement_graph *g;
+    int measured = 0;
+
+    fail_unless(init(&pm, "premeasure=60") == 1, "Failed to enable pre-measurement");
+    fail_unless(premeasure_once(&pm, measure_nothing, &measured) == 0 && measured == 1,
+                "Failed to pre-measure");
+    fail_unless((g = premeasure_take(&pm)) != NULL, "Failed to take the latest graph");
+
+    /* a graph in use is kept when it is superseded, and removed once
+       it is no longer in use */
+    fail_unless(init(&other, "premeasure=60") == 1, "Failed to enable pre-measurement");
+    fail_unless(premeasure_once(&other, measure_nothing, &measured) == 0,
+                "Failed to pre-measure");
+    fail_unless(count_graphs() == 2, "Graph in use was removed");
+    unmap_measurement_graph(g);
+    premeasure_release(&pm);
+    fail_unless(premeasure_once(&other, measure_nothing, &measured) == 0,
+                "Failed to pre-measure");
+    fail_unless(count_graphs() == 1, "%d graphs kept", count_graphs());
+
+    /* a failed measurement publishes nothing and leaves nothing */
+    fail_unless(premeasure_once(&other, measure_error, NULL) == -EIO,
+                "Measurement error not reported");
+    fail_unless(count_graphs() == 1, "Failed measurement left a graph");
+    fail_unless((g = premeasure_take(&other)) != NULL, "Latest graph was lost");
+    unmap_measurement_graph(g);
+
+    /* nor does one that needed a request's nonce */
+    fail_unless(premeasure_once(&other, measure_refused, NULL) == -EPERM,
+                "Refused measurement not reported");
+    fail_unless(count_graphs() == 1, "Refused measurement left a graph");
+    premeasure_release(&other);
+}
+END_TEST
+
+START_TEST(test_stale)
+{
+    premeasure pm;
+    measurement_graph *g;
+    int measured = 0;
+
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=100") == 1,
+                "Failed to enable pre-measurement");
+    fail_unless(premeasure_once(&pm, measure_nothing, &measured) == 0,
+                "Failed to pre-measure");
+
+    age_latest(&pm, 50, 100);
+    fail_unless((g = premeasure_take(&pm)) != NULL, "Fresh graph refused");
+    unmap_measurement_graph(g);
+    age_latest(&pm, 150, 100);
+    fail_unless(premeasure_take(&pm) == NULL, "Stale graph taken");
+    premeasure_release(&pm);
+
+    /* the request's own bound applies as well */
+    fail_unless(init(&pm, "premeasure=60,premeasure_max_age=10") == 1,
+                "Failed to enable pre-measurement");
+    age_latest(&pm, 50, 100);
+    fail_unless(premeasure_take(&pm) == NULL, "Graph older than the request's bound taken");
+    premeasure_release(&pm);
+}
+END_TEST
+
+START_TEST(test_background)
+{
+    premeasure pm;
+    measurement_graph *g = NULL;
+    int measured = 0;
+    int lockfd, i;
+
+    fail_unless(init(&pm, "premeasure=1,premeasure_idle=1") == 1,
+                "Failed to enable pre-measurement");
+    fail_unless(premeasure_start(&pm, measure_nothing, &measured) > 0,
+                "Failed to start background pre-measurement");
+    fail_unless(premeasure_start(&pm, measure_nothing, &measured) == 0,
+                "Started a second background measurer");
+
+    for(i = 0; i < 50 && (g = premeasure_take(&pm)) == NULL; i++) {
+        usleep(100000);
+    }
+    fail_unless(g != NULL, "Background measurer published no graph");
+    unmap_measurement_graph(g);
+    premeasure_release(&pm);
+
+    /* without requests the measurer goes away */
+    fail_unless(init(&pm, "premeasure=1,premeasure_idle=1") == 1,
+                "Failed to enable pre-measurement");
+    lockfd = open(pm.lockpath, O_RDWR);
+    fail_if(lockfd < 0, "No measurer lock");
+    for(i = 0; i < 100 && flock(lockfd, LOCK_EX | LOCK_NB) != 0; i++) {
+        usleep(100000);
+    }
+    fail_unless(i < 100, "Idle background measurer did not exit");
+    close(lockfd);
+    premeasure_release(&pm);
+
+    /* nor does it stay when the spec cannot be pre-measured */
+    fail_unless(init(&pm, "premeasure=1,premeasure_idle=0") == 1,
+                "Failed to enable pre-measurement");
+    unlink(pm.latest);
+    fail_unless(premeasure_start(&pm, measure_refused, NULL) > 0,
+                "Failed to start background pre-measurement");
+    lockfd = open(pm.lockpath, O_RDWR);
+    fail_if(lockfd < 0, "No measurer lock");
+    for(i = 0; i < 100 && flock(lockfd, LOCK_EX | LOCK_NB) != 0; i++) {
+        usleep(100000);
+    }
+    fail_unless(i < 100, "Refused background measurer did not exit");
+    fail_unless(premeasure_take(&pm) == NULL, "Refused measurer published a graph");
+    close(lockfd);
+    premeasure_release(&pm);
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("Pre-measurement");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_set_timeout(tcase, 30);
+    tcase_add_test(tcase, test_args);
+    tcase_add_test(tcase, test_take);
+    tcase_add_test(tcase, test_stale);
+    tcase_add_test(tcase, test_background);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_premeasure.log");
+    srunner_set_xml(sr, "test_premeasure.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -44,14 +44,33 @@ pid_t childpid           = 0;
 char *test_string = "This string is a test. Can procmem read it?";
 unsigned char test_string_hash[64];
 
+/* read-only pages mapped by both the test and its child */
+static const unsigned char shared_pages[3 * 4096] __attribute__((aligned(4096))) = {
+    [0] = 'M', [4096] = 'a', [8191] = 'a', [8192] = 't'
+};
+
 void setup(void)
 {
+    int ready[2];
+    char c = 0;
+
+    fail_if(pipe(ready) != 0, "Failed to create pipe");
     childpid       = fork();
 
     if (childpid >= 0) { /* fork suceeded */
 
         if (childpid == 0) { /* fork() returns 0 to the child process */
+            volatile unsigned char sum = 0;
+            size_t i;
             int childcount = 0;
+
+            /* fault the pages in, so pagemap shows them mapped */
+            for(i = 0; i < sizeof(shared_pages); i += 4096) {
+                sum += shared_pages[i];
+            }
+            if(write(ready[1], &c, 1) != 1) {
+                exit(1);
+            }
             while (1) {
                 if (childcount > 100000) {
                     //dlog(0,".");
@@ -64,6 +83,9 @@ void setup(void)
             size_t csum_size = 64;
 
             measurement_variable *file_var = NULL;
+            fail_if(read(ready[0], &c, 1) != 1, "Child failed to start");
+            close(ready[0]);
+            close(ready[1]);
             libmaat_init(0, 2);
 
             asps = load_all_asps_info(ASP_PATH);
@@ -106,6 +128,72 @@ void teardown(void)
 
 int performHash(char * buffer, uint64_t length, sha256_measurement_data * hashdata);
 
+/* sha256 over the sha256 digests of the pieces of the range split on page boundaries */
+static void page_tree_hash(const unsigned char *start, size_t len, unsigned char out[SHA256_TYPE_LEN])
+{
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t addr = (uintptr_t)start;
+    uintptr_t end = addr + len;
+    GChecksum *root = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize out_len = SHA256_TYPE_LEN;
+
+    while(addr < end) {
+        uintptr_t next = (addr / page_size + 1) * page_size;
+        size_t piece = (size_t)((next < end ? next : end) - addr);
+        unsigned char digest[SHA256_TYPE_LEN];
+        gsize dlen = SHA256_TYPE_LEN;
+        GChecksum *csum = g_checksum_new(G_CHECKSUM_SHA256);
+
+        g_checksum_update(csum, (const guchar *)addr, piece);
+        g_checksum_get_digest(csum, digest, &dlen);
+        g_checksum_free(csum);
+        g_checksum_update(root, digest, SHA256_TYPE_LEN);
+        addr += piece;
+    }
+    g_checksum_get_digest(root, out, &out_len);
+    g_checksum_free(root);
+}
+
+static node_id_t add_range_node(const void *start, size_t len)
+{
+    measurement_variable *var;
+    node_id_t n;
+
+    var = new_measurement_variable(&file_target_type, alloc_address(&pid_mem_range_space));
+    ((pid_mem_range*)(var->address))->pid = childpid;
+    ((pid_mem_range*)(var->address))->offset = (unsigned long long)start;
+    ((pid_mem_range*)(var->address))->size = len;
+    fail_if(measurement_graph_add_node(graph, var, NULL, &n) < 0, "Failed adding node to graph\n");
+    free_measurement_variable(var);
+    return n;
+}
+
+static void check_pagehash(node_id_t n, const void *start, size_t len)
+{
+    char *graph_path = measurement_graph_get_path(graph);
+    node_id_str nid;
+    char *asp_argv[] = { "procmem", graph_path, nid, "pagehash"};
+    unsigned char expected[SHA256_TYPE_LEN];
+    measurement_data *got = NULL;
+    sha256_measurement_data *got_smd;
+
+    str_of_node_id(n, nid);
+    page_tree_hash(start, len, expected);
+
+    fail_if(asp_init(4, asp_argv) != 0, "ASP Init call failed\n");
+    fail_if(asp_measure(4, asp_argv) != 0, "ASP Measure call failed.\n");
+    fail_if(asp_exit(0) != 0, "ASP Exit failed\n");
+
+    fail_if(measurement_node_get_rawdata(graph, n, &sha256_measurement_type, &got) != 0,
+            "Failed to get measurement result after running procmem.");
+    got_smd = container_of(got, sha256_measurement_data, meas_data);
+    fail_if(memcmp(expected, got_smd->sha256_hash, SHA256_TYPE_LEN) != 0,
+            "Page tree hash received from procmem doesn't match expected value");
+
+    free_measurement_data(got);
+    free(graph_path);
+}
+
 START_TEST(test_asp_measure)
 {
     char *graph_path = measurement_graph_get_path(graph);
@@ -134,6 +222,34 @@ START_TEST(test_asp_measure)
 }
 END_TEST
 
+START_TEST(test_asp_pagehash)
+{
+    char *graph_path = measurement_graph_get_path(graph);
+    char *cache_file = g_strdup_printf("%s/procmem-page.cache", graph_path);
+    /* starts mid page, covers a whole page and ends mid page */
+    const unsigned char *start = shared_pages + 100;
+    size_t len = sizeof(shared_pages) - 200;
+    node_id_t first, second;
+
+    first = add_range_node(start, len);
+    second = add_range_node(start, len);
+
+    /* unaligned ranges are never cached */
+    check_pagehash(file_node, test_string, strlen(test_string)+1);
+
+    /* shared_pages is in a read-only mapping of the test binary */
+    check_pagehash(first, start, len);
+    if(access("/proc/self/pagemap", R_OK) == 0) {
+        fail_unless(file_exists(cache_file), "No page digests were cached");
+    }
+    /* the second run gets the whole page from the cache */
+    check_pagehash(second, start, len);
+
+    g_free(cache_file);
+    free(graph_path);
+}
+END_TEST
+
 int main(void)
 {
     Suite *s;
@@ -145,6 +261,7 @@ int main(void)
     procmemrangeservice = tcase_create("procmemrange");
     tcase_add_checked_fixture(procmemrangeservice, setup, teardown);
     tcase_add_test(procmemrangeservice, test_asp_measure);
+    tcase_add_test(procmemrangeservice, test_asp_pagehash);
     tcase_set_timeout(procmemrangeservice, 1000);
     suite_add_tcase(s, procmemrangeservice);
 
@@ -21,6 +21,7 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <util/util.h>
 #include <util/xml_util.h>
 #include <util/keyvalue.h>
@@ -653,6 +654,49 @@ START_TEST (test_parse_copland)
 }
 END_TEST
 
+/* a configuration with a malformed metadata file must not be reloaded */
+START_TEST (test_check_loaded)
+{
+    struct attestation_manager *am = NULL;
+    gchar *apbdir, *apbfile, *contents;
+    gsize len;
+
+    am = new_attestation_manager(ASP_DIR, SPEC_DIR, APB_DIR, "COPLAND", SELECTOR_PATH"userspace-selector-test.xml",0,0);
+    fail_if(am == NULL, "Unable to load attestation manager");
+    fail_if(am_check_loaded(am, ASP_DIR, SPEC_DIR, APB_DIR) != 0,
+            "Complete configuration was rejected");
+    free_attestation_manager(am);
+
+    apbdir = g_dir_make_tmp("test_selector_XXXXXX", NULL);
+    fail_if(apbdir == NULL, "Unable to create APB directory");
+    fail_if(!g_file_get_contents(APB_DIR "userspace_apb_test.xml", &contents, &len, NULL),
+            "Unable to read APB metadata");
+    apbfile = g_build_filename(apbdir, "userspace_apb_test.xml", NULL);
+    fail_if(!g_file_set_contents(apbfile, contents, (gssize)len, NULL),
+            "Unable to copy APB metadata");
+    g_free(contents);
+    g_free(apbfile);
+    apbfile = g_build_filename(apbdir, "broken.xml", NULL);
+    fail_if(!g_file_set_contents(apbfile, "<apb><name>broken", -1, NULL),
+            "Unable to write malformed APB metadata");
+
+    am = new_attestation_manager(ASP_DIR, SPEC_DIR, apbdir, "COPLAND", SELECTOR_PATH"userspace-selector-test.xml",0,0);
+    fail_if(am == NULL, "Unable to load attestation manager");
+    fail_if(am_nr_loaded_apbs(am) != 1, "Expected the valid APB to load");
+    fail_if(am_check_loaded(am, ASP_DIR, SPEC_DIR, apbdir) != -EINVAL,
+            "Configuration with a malformed APB was not rejected");
+    free_attestation_manager(am);
+
+    unlink(apbfile);
+    g_free(apbfile);
+    apbfile = g_build_filename(apbdir, "userspace_apb_test.xml", NULL);
+    unlink(apbfile);
+    g_free(apbfile);
+    rmdir(apbdir);
+    g_free(apbdir);
+}
+END_TEST
+
 /* START_TEST (test_check_match_conditions) */
 /* { */
 /*     int i; */
@@ -715,6 +759,7 @@ Suite* sel_suite (void)
     tcase_add_test (tc_higher, test_attr_in);
     tcase_add_test (tc_higher, test_attr_include);
     tcase_add_test (tc_higher, test_parse_copland);
+    tcase_add_test (tc_higher, test_check_loaded);
 //    tcase_add_test (tc_higher, test_check_match_conditions);
     suite_add_tcase (s, tc_basic);
     suite_add_tcase (s, tc_higher);
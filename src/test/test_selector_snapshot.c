@@ -0,0 +1,319 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the snapshot mode of the Mongo selector, loaded from a JSON
+ * dump of the selector collection so no database is needed.
+ */
+
+#include <config.h>
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <util/util.h>
+
+#include <am/selector.h>
+#include <am/am.h>
+
+#include <common/apb_info.h>
+#include <common/asp.h>
+
+#include <maat-envvars.h>
+
+#define ASP_DIR       SRCDIR "/xml/asp-info"
+#define SPEC_DIR      SRCDIR "/xml/meas-info"
+#define APB_DIR       SRCDIR "/xml/apb-info/"
+#define SELECTOR_DUMP "json:" SRCDIR "/mongo/selector-snapshot.json"
+
+#define MTAB "((USM mtab) -> SIG)"
+#define FULL "((USM full) -> SIG)"
+
+static GList *all_apbs;
+static GList *all_asps;
+static GList *all_specs;
+static char policy_file[] = "/tmp/test_selector_snapshotXXXXXX";
+
+static const char *policy =
+    "{ \"type\" : \"version\", \"version\" : %d }\n"
+    "{ \"type\" : \"collection\", \"name\" : \"known-clients\", \"items\" : [ \"127.0.0.1\" ] }\n"
+    "{ \"type\" : \"rule\", \"role\" : \"appraiser\", \"phase\" : \"initial\", "
+    "\"match_conditions\" : [ { \"operator\" : \"in\", \"attr\" : \"client\", \"value\" : \"known-clients\" } ], "
+    "\"action\" : { \"selector_action\" : \"accept\", "
+    "\"conditions\" : [ { \"name\" : \"x\", \"apb_phrase\" : \"%s\" } ] } }\n";
+
+static void setup(void)
+{
+    libmaat_init(0, 4);
+    all_asps = load_all_asps_info(ASP_DIR);
+    all_specs = load_all_measurement_specifications_info(SPEC_DIR);
+    all_apbs = load_all_apbs_info(APB_DIR, all_asps, all_specs);
+    setenv(ENV_MAAT_SELECTOR_POLL_SECS, "0", 1);
+}
+
+static void teardown(void)
+{
+    g_list_free_full(all_apbs, (GDestroyNotify)unload_apb);
+    g_list_free_full(all_asps, (GDestroyNotify)free_asp);
+    g_list_free_full(all_specs, (GDestroyNotify)free_measurement_specification_info);
+    unsetenv(ENV_MAAT_SELECTOR_POLL_SECS);
+    libmaat_exit();
+}
+
+static void set_scenario(struct scenario *scen, char *client, char *resource)
+{
+    memset(scen, 0, sizeof(*scen));
+    scen->attester_hostname = client;
+    scen->resource = resource;
+}
+
+static copland_phrase *parse_option(const char *phrase)
+{
+    copland_phrase *parsed = NULL;
+
+    fail_if(parse_copland_from_apb_list(phrase, all_apbs, &parsed) < 0,
+            "Failed to parse %s", phrase);
+    return parsed;
+}
+
+/* write the test policy at a given version, with a fresh modification time */
+static void write_policy(int version, const char *phrase)
+{
+    static time_t stamp;
+    struct timespec times[2];
+    char *contents = g_strdup_printf(policy, version, phrase);
+
+    fail_if(!g_file_set_contents(policy_file, contents, -1, NULL), "Failed to write %s", policy_file);
+    if(stamp == 0) {
+        stamp = time(NULL);
+    }
+    times[0].tv_sec = times[1].tv_sec = ++stamp;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    fail_if(utimensat(AT_FDCWD, policy_file, times, 0) != 0, "Failed to touch %s", policy_file);
+    g_free(contents);
+}
+
+START_TEST(test_load)
+{
+    selectordb_t *selector = NULL;
+
+    fail_unless(load_selector("MONGO", SELECTOR_DUMP, all_apbs, &selector) == 0,
+                "Failed to load selector snapshot");
+    free_selector(selector);
+
+    selector = NULL;
+    fail_if(load_selector("MONGO", "json:/nonexistent/selector.json", all_apbs, &selector) == 0,
+            "Loaded a missing selector dump");
+    fail_unless(selector == NULL, "Selector returned on failure");
+}
+END_TEST
+
+START_TEST(test_unknown_phrase)
+{
+    selectordb_t *selector = NULL;
+    char *location;
+    int fd;
+
+    fail_if((fd = mkstemp(policy_file)) < 0, "Failed to create %s", policy_file);
+    close(fd);
+    location = g_strconcat("json:", policy_file, NULL);
+    write_policy(1, "((USM nothing) -> SIG)");
+    fail_if(load_selector("MONGO", location, all_apbs, &selector) == 0,
+            "Loaded a phrase no APB handles");
+    g_free(location);
+    unlink(policy_file);
+    strcpy(policy_file + strlen(policy_file) - 6, "XXXXXX");
+}
+END_TEST
+
+START_TEST(test_first_conditions)
+{
+    selectordb_t *selector = NULL;
+    struct scenario scen;
+    GList *conditions = NULL;
+    copland_phrase *phrase = NULL;
+
+    fail_unless(load_selector("MONGO", SELECTOR_DUMP, all_apbs, &selector) == 0,
+                "Failed to load selector snapshot");
+
+    /* a known client gets both phrases of the first rule */
+    set_scenario(&scen, "127.0.0.1", "default");
+    fail_unless(selector_get_first_conditions(selector, APPRAISER, INITL, ACCEPT,
+                &scen, NULL, &conditions) == 2, "Wrong number of conditions");
+    fail_unless(strcmp(((copland_phrase *)conditions->data)->phrase, MTAB) == 0,
+                "Wrong first condition %s", ((copland_phrase *)conditions->data)->phrase);
+    g_list_free(conditions);
+    conditions = NULL;
+
+    fail_unless(selector_get_first_condition(selector, APPRAISER, INITL, &scen, NULL,
+                &phrase) == ACCEPT, "No first condition");
+    fail_unless(phrase != NULL && strcmp(phrase->phrase, MTAB) == 0, "Wrong first condition");
+
+    /* an unknown client gets nothing, nor does the wrong action */
+    set_scenario(&scen, "10.1.1.1", "default");
+    fail_if(selector_get_first_conditions(selector, APPRAISER, INITL, ACCEPT,
+                                          &scen, NULL, &conditions) > 0, "Unknown client matched");
+    fail_unless(conditions == NULL, "Conditions returned without a match");
+    set_scenario(&scen, "127.0.0.1", "default");
+    fail_if(selector_get_first_conditions(selector, APPRAISER, INITL, REJECT,
+                                          &scen, NULL, &conditions) > 0, "Wrong action matched");
+
+    free_selector(selector);
+}
+END_TEST
+
+START_TEST(test_options)
+{
+    selectordb_t *selector = NULL;
+    struct scenario scen;
+    copland_phrase *phrase = NULL;
+    copland_phrase *mtab = parse_option(MTAB);
+    copland_phrase *full = parse_option(FULL);
+    GList *options = NULL;
+
+    fail_unless(load_selector("MONGO", SELECTOR_DUMP, all_apbs, &selector) == 0,
+                "Failed to load selector snapshot");
+    set_scenario(&scen, "127.0.0.1", "default");
+
+    /* "include" looks for the phrase among all the options */
+    options = g_list_append(g_list_append(NULL, full), mtab);
+    fail_unless(selector_get_first_action(selector, APPRAISER, EXEC, ACCEPT, &scen,
+                                          options, &phrase) == AM_OK, "Option not found");
+    fail_unless(strcmp(phrase->phrase, MTAB) == 0, "Wrong phrase %s", phrase->phrase);
+    g_list_free(options);
+
+    options = g_list_append(NULL, full);
+    fail_if(selector_get_first_action(selector, APPRAISER, EXEC, ACCEPT, &scen,
+                                      options, &phrase) == AM_OK, "Missing option matched");
+    fail_unless(phrase == NULL, "Phrase returned without a match");
+    g_list_free(options);
+
+    /* "in" a collection and "is" the first option */
+    options = g_list_append(NULL, mtab);
+    fail_unless(selector_get_first_action(selector, APPRAISER, SPAWN, ACCEPT, &scen,
+                                          options, &phrase) == AM_OK, "Spawn rule not matched");
+    g_list_free(options);
+
+    free_selector(selector);
+    free_copland_phrase(mtab);
+    free_copland_phrase(full);
+}
+END_TEST
+
+START_TEST(test_all_conditions)
+{
+    selectordb_t *selector = NULL;
+    struct scenario scen;
+    GList *conditions = NULL;
+
+    fail_unless(load_selector("MONGO", SELECTOR_DUMP, all_apbs, &selector) == 0,
+                "Failed to load selector snapshot");
+    set_scenario(&scen, "127.0.0.1", "default");
+    fail_unless(selector_get_all_conditions(selector, APPRAISER, INITL, ACCEPT, &scen,
+                                            NULL, &conditions) == 2, "Wrong number of conditions");
+    g_list_free(conditions);
+
+    /* attester rules do not see the client */
+    fail_unless(selector_get_all_conditions(selector, ATTESTER, INITL, ACCEPT, &scen,
+                                            NULL, &conditions) == 0, "Attester rule matched");
+    free_selector(selector);
+}
+END_TEST
+
+START_TEST(test_refresh)
+{
+    selectordb_t *selector = NULL;
+    struct scenario scen;
+    copland_phrase *first = NULL, *phrase = NULL;
+    char *location;
+    int fd;
+
+    fail_if((fd = mkstemp(policy_file)) < 0, "Failed to create %s", policy_file);
+    close(fd);
+    location = g_strconcat("json:", policy_file, NULL);
+    set_scenario(&scen, "127.0.0.1", "default");
+
+    write_policy(1, MTAB);
+    fail_unless(load_selector("MONGO", location, all_apbs, &selector) == 0,
+                "Failed to load selector snapshot");
+    fail_unless(selector_get_first_action(selector, APPRAISER, INITL, ACCEPT, &scen,
+                                          NULL, &first) == AM_OK, "No phrase");
+    fail_unless(strcmp(first->phrase, MTAB) == 0, "Wrong phrase %s", first->phrase);
+
+    /* the file changed but its version did not: keep the loaded rules */
+    write_policy(1, FULL);
+    fail_unless(selector_get_first_action(selector, APPRAISER, INITL, ACCEPT, &scen,
+                                          NULL, &phrase) == AM_OK, "No phrase");
+    fail_unless(phrase == first, "Rules reloaded without a version change");
+    selector_free_condition(selector, phrase);
+
+    write_policy(2, FULL);
+    fail_unless(selector_get_first_action(selector, APPRAISER, INITL, ACCEPT, &scen,
+                                          NULL, &phrase) == AM_OK, "No phrase");
+    fail_unless(strcmp(phrase->phrase, FULL) == 0, "Rules not refreshed: %s", phrase->phrase);
+    /* phrases handed out before the refresh stay valid until released */
+    fail_unless(strcmp(first->phrase, MTAB) == 0, "Old phrase freed");
+    selector_free_condition(selector, first);
+    /* releasing every phrase of the current rules does not free them */
+    selector_free_condition(selector, phrase);
+
+    /* a policy that fails to load keeps the current rules */
+    fail_if(!g_file_set_contents(policy_file, "{ not json", -1, NULL), "Failed to write %s", policy_file);
+    fail_unless(selector_get_first_action(selector, APPRAISER, INITL, ACCEPT, &scen,
+                                          NULL, &phrase) == AM_OK, "Lost rules on a bad policy");
+    fail_unless(strcmp(phrase->phrase, FULL) == 0, "Wrong phrase %s", phrase->phrase);
+    selector_free_condition(selector, phrase);
+
+    free_selector(selector);
+    g_free(location);
+    unlink(policy_file);
+    strcpy(policy_file + strlen(policy_file) - 6, "XXXXXX");
+}
+END_TEST
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("Selector snapshot");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_load);
+    tcase_add_test(tcase, test_unknown_phrase);
+    tcase_add_test(tcase, test_first_conditions);
+    tcase_add_test(tcase, test_options);
+    tcase_add_test(tcase, test_all_conditions);
+    tcase_add_test(tcase, test_refresh);
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_selector_snapshot.log");
+    srunner_set_xml(sr, "test_selector_snapshot.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
@@ -0,0 +1,618 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests for the TPM event log parser and replay, using synthetic
+ * crypto agile event logs with SHA-1 and SHA-256 banks.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <check.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#ifdef USE_TPM
+#include <tss2/tss2_mu.h>
+#endif
+
+#include <util/util.h>
+#include <measurement_spec/find_types.h>
+#include <maat-basetypes.h>
+
+#include <../asps/tpm_eventlog_replay.h>
+
+#define EV_POST_CODE		0x00000001
+#define EV_S_CRTM_VERSION	0x00000008
+
+/* PCR 0 after extending sha256("boot") / sha1("boot") once */
+#define BOOT_PCR0_SHA256 "d65003de52b12528a1ecfedc8854e81fc8dcf52db0d49835d6ae99e2304c7c83"
+#define BOOT_PCR0_SHA1   "d0f090e8a40e33aa5d82dd536e2bdd38ad9096f4"
+
+/* offset of the Spec ID signature in the header event */
+#define SPEC_ID_SIG_OFFSET	32
+
+struct logbuf {
+    unsigned char data[4096];
+    size_t len;
+};
+
+static void put(struct logbuf *lb, const void *data, size_t len)
+{
+    fail_if(lb->len + len > sizeof(lb->data), "Synthetic log too large");
+    memcpy(lb->data + lb->len, data, len);
+    lb->len += len;
+}
+
+static void put_le16(struct logbuf *lb, uint16_t v)
+{
+    unsigned char b[2] = {v & 0xff, v >> 8};
+    put(lb, b, 2);
+}
+
+static void put_le32(struct logbuf *lb, uint32_t v)
+{
+    unsigned char b[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24};
+    put(lb, b, 4);
+}
+
+/* Spec ID event declaring SHA-1 and SHA-256 banks */
+static void put_header(struct logbuf *lb)
+{
+    static const unsigned char zero[20];
+    static const char sig[16] = "Spec ID Event03";
+
+    put_le32(lb, 0);
+    put_le32(lb, TPM_EVENTLOG_EV_NO_ACTION);
+    put(lb, zero, sizeof(zero));
+    put_le32(lb, 16 + 4 + 4 + 4 + 2 * 4 + 1);
+    put(lb, sig, sizeof(sig));
+    put_le32(lb, 0);		/* platformClass */
+    put_le32(lb, 0x00020000);	/* version 2.0, errata 0, uintnSize 0 */
+    put_le32(lb, 2);
+    put_le16(lb, TPM_EVENTLOG_ALG_SHA1);
+    put_le16(lb, 20);
+    put_le16(lb, TPM_EVENTLOG_ALG_SHA256);
+    put_le16(lb, 32);
+    put(lb, zero, 1);		/* vendorInfoSize */
+}
+
+/* event whose digests are the hashes of @data */
+static void put_event(struct logbuf *lb, uint32_t pcr, uint32_t type,
+                      const char *data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    put_le32(lb, pcr);
+    put_le32(lb, type);
+    put_le32(lb, 2);
+    EVP_Digest(data, strlen(data), digest, &len, EVP_sha1(), NULL);
+    put_le16(lb, TPM_EVENTLOG_ALG_SHA1);
+    put(lb, digest, len);
+    EVP_Digest(data, strlen(data), digest, &len, EVP_sha256(), NULL);
+    put_le16(lb, TPM_EVENTLOG_ALG_SHA256);
+    put(lb, digest, len);
+    put_le32(lb, (uint32_t)strlen(data));
+    put(lb, data, strlen(data));
+}
+
+static void put_startup_locality(struct logbuf *lb, uint8_t locality)
+{
+    static const char sig[16] = "StartupLocality";
+
+    put_le32(lb, 0);
+    put_le32(lb, TPM_EVENTLOG_EV_NO_ACTION);
+    put_le32(lb, 0);
+    put_le32(lb, sizeof(sig) + 1);
+    put(lb, sig, sizeof(sig));
+    put(lb, &locality, 1);
+}
+
+static void add_ref(tpm_eventlog_refs *refs, const char *data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    EVP_Digest(data, strlen(data), digest, &len, EVP_sha256(), NULL);
+    fail_if(tpm_eventlog_refs_add(refs, TPM_EVENTLOG_ALG_SHA256, digest, len) != 0,
+            "Failed to add reference");
+}
+
+static int pcr_is(tpm_eventlog_replay *st, uint16_t alg, uint32_t index, const char *hex)
+{
+    const unsigned char *pcr;
+    char *str;
+    size_t size;
+    int ret;
+
+    if((pcr = tpm_eventlog_replay_pcr(st, alg, index, &size)) == NULL) {
+        return 0;
+    }
+    str = bin_to_hexstr(pcr, size);
+    ret = str != NULL && strcmp(str, hex) == 0;
+    free(str);
+    return ret;
+}
+
+void setup(void)
+{
+    libmaat_init(0, 2);
+    register_types();
+}
+
+void teardown(void)
+{
+    libmaat_exit();
+}
+
+START_TEST(test_parse)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_parser p;
+    tpm_eventlog_event ev;
+    int count = 0;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+    put_event(&lb, 4, EV_POST_CODE, "loader");
+
+    fail_if(tpm_eventlog_parser_init(&p, lb.data, lb.len) != 0, "Failed to parse header");
+    fail_unless(p.nr_algs == 2, "Expected 2 banks, got %u", p.nr_algs);
+
+    while(tpm_eventlog_next(&p, &ev) == 1) {
+        /* events must point into the log rather than at copies */
+        fail_unless(ev.data >= lb.data && ev.data + ev.data_size <= lb.data + lb.len,
+                    "Event data is not within the log");
+        fail_unless(ev.digests[1].digest > lb.data &&
+                    ev.digests[1].digest < lb.data + lb.len,
+                    "Event digest is not within the log");
+        fail_unless(ev.nr_digests == 2 && ev.digests[1].size == 32,
+                    "Unexpected digests in event");
+        count++;
+    }
+    fail_unless(count == 2, "Expected 2 events, parsed %d", count);
+    fail_unless(p.offset == lb.len, "Parser did not consume the whole log");
+}
+END_TEST
+
+START_TEST(test_parse_malformed)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_parser p;
+    tpm_eventlog_event ev;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+
+    /* cut the last event short */
+    fail_if(tpm_eventlog_parser_init(&p, lb.data, lb.len - 1) != 0, "Failed to parse header");
+    fail_unless(tpm_eventlog_next(&p, &ev) < 0, "Parsed a truncated event");
+
+    /* a SHA-1 only log has no Spec ID event */
+    lb.data[SPEC_ID_SIG_OFFSET] = 'X';
+    fail_unless(tpm_eventlog_parser_init(&p, lb.data, lb.len) < 0,
+                "Parsed a log without a Spec ID event");
+}
+END_TEST
+
+START_TEST(test_replay)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_replay st;
+    tpm_eventlog_pcr pcr = {.alg_id = TPM_EVENTLOG_ALG_SHA256, .index = 0, .size = 32};
+    unsigned char *expected;
+    GList *pcrs;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+
+    tpm_eventlog_replay_init(&st);
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 1,
+                "Expected to replay 1 event");
+    fail_unless(pcr_is(&st, TPM_EVENTLOG_ALG_SHA256, 0, BOOT_PCR0_SHA256),
+                "Wrong SHA-256 PCR 0 after replay");
+    fail_unless(pcr_is(&st, TPM_EVENTLOG_ALG_SHA1, 0, BOOT_PCR0_SHA1),
+                "Wrong SHA-1 PCR 0 after replay");
+
+    expected = hexstr_to_bin(BOOT_PCR0_SHA256, strlen(BOOT_PCR0_SHA256));
+    memcpy(pcr.digest, expected, 32);
+    free(expected);
+    pcrs = g_list_append(NULL, &pcr);
+    fail_unless(tpm_eventlog_replay_check_pcrs(&st, pcrs) == 0,
+                "Replay does not match the expected PCR");
+    pcr.digest[0] ^= 1;
+    fail_unless(tpm_eventlog_replay_check_pcrs(&st, pcrs) == 1,
+                "Replay matches a tampered PCR");
+    g_list_free(pcrs);
+    tpm_eventlog_replay_release(&st);
+}
+END_TEST
+
+START_TEST(test_startup_locality)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_replay st;
+    const unsigned char *pcr;
+    size_t size;
+
+    put_header(&lb);
+    put_startup_locality(&lb, 3);
+
+    tpm_eventlog_replay_init(&st);
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 1,
+                "Failed to replay startup locality");
+    pcr = tpm_eventlog_replay_pcr(&st, TPM_EVENTLOG_ALG_SHA256, 0, &size);
+    fail_unless(pcr != NULL && pcr[size - 1] == 3 && pcr[0] == 0,
+                "Startup locality not applied to PCR 0");
+    fail_unless(st.nr_events == 0, "EV_NO_ACTION counted as a measured event");
+    tpm_eventlog_replay_release(&st);
+}
+END_TEST
+
+START_TEST(test_references)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_replay st;
+    tpm_eventlog_refs refs;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+    put_event(&lb, 4, EV_POST_CODE, "loader");
+    put_event(&lb, 4, TPM_EVENTLOG_EV_SEPARATOR, "sep");
+
+    fail_if(tpm_eventlog_refs_init(&refs) != 0, "Failed to init references");
+    add_ref(&refs, "boot");
+    add_ref(&refs, "sep");
+
+    tpm_eventlog_replay_init(&st);
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, &refs) == 3,
+                "Expected to replay 3 events");
+    fail_unless(st.nr_unmatched == 1, "Expected 1 unmatched event, got %u",
+                st.nr_unmatched);
+
+    /* a different reference set invalidates the saved checks */
+    add_ref(&refs, "loader");
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, &refs) == 3,
+                "Changed references did not trigger a full replay");
+    fail_unless(st.nr_unmatched == 0, "Expected all events to match");
+
+    tpm_eventlog_replay_release(&st);
+    tpm_eventlog_refs_free(&refs);
+}
+END_TEST
+
+/*
+ * Load @contents as a reference file into a fresh @refs and return
+ * the number of digests added.
+ */
+static int load_refs(tpm_eventlog_refs *refs, const char *contents)
+{
+    char path[] = "/tmp/maat_tpm_eventlog_refsXXXXXX";
+    FILE *f;
+    int fd;
+    int count;
+
+    fail_if((fd = mkstemp(path)) < 0 || (f = fdopen(fd, "w")) == NULL,
+            "Failed to create reference file");
+    fputs(contents, f);
+    fclose(f);
+    fail_if(tpm_eventlog_refs_init(refs) != 0, "Failed to init references");
+    count = tpm_eventlog_refs_load(refs, path);
+    unlink(path);
+    return count;
+}
+
+START_TEST(test_reference_file)
+{
+    tpm_eventlog_refs refs;
+
+    /* the shipped file lists nothing and does not ask for replay only */
+    fail_unless(load_refs(&refs, "# comment\n\n") == 0, "Expected no references");
+    fail_if(refs.replay_only, "Empty reference file is replay only");
+    tpm_eventlog_refs_free(&refs);
+
+    fail_unless(load_refs(&refs, "# comment\n  replay-only\n") == 0,
+                "Expected no references");
+    fail_unless(refs.replay_only, "replay-only was not recognized");
+    tpm_eventlog_refs_free(&refs);
+
+    fail_unless(load_refs(&refs, "sha256:d4735e3a265e16eee03f59718b9b5d03019c07d8b6c51f90da3a666eec13ab35\n"
+                          "sha256:xyz\n") == 1, "Expected 1 reference");
+    fail_if(refs.replay_only, "Reference file with digests is replay only");
+    tpm_eventlog_refs_free(&refs);
+}
+END_TEST
+
+START_TEST(test_incremental)
+{
+    char path[] = "/tmp/maat_tpm_eventlogXXXXXX";
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_replay st, full;
+    tpm_eventlog_parser p;
+    tpm_eventlog_event ev;
+    int fd;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+    put_event(&lb, 4, EV_POST_CODE, "loader");
+
+    fail_if((fd = mkstemp(path)) < 0, "Failed to create state file");
+    close(fd);
+
+    tpm_eventlog_replay_init(&st);
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 2,
+                "Expected to replay 2 events");
+    fail_if(tpm_eventlog_replay_save(&st, path) != 0, "Failed to save replay");
+
+    /* the log grows; only the new event is replayed */
+    put_event(&lb, 7, EV_POST_CODE, "kernel");
+    fail_if(tpm_eventlog_replay_load(&st, path) != 0, "Failed to load replay");
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 1,
+                "Saved replay was not resumed");
+
+    tpm_eventlog_replay_init(&full);
+    fail_unless(tpm_eventlog_replay_log(&full, lb.data, lb.len, NULL) == 3,
+                "Expected to replay 3 events");
+    fail_unless(memcmp(st.banks, full.banks, sizeof(st.banks)) == 0 &&
+                st.offset == full.offset &&
+                memcmp(st.prefix, full.prefix, (size_t)st.offset) == 0 &&
+                st.extended == full.extended && st.nr_events == full.nr_events,
+                "Incremental replay differs from full replay");
+    tpm_eventlog_replay_release(&full);
+
+    /* an unchanged log replays nothing */
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 0,
+                "Unchanged log was replayed again");
+
+    /* a rewritten prefix forces a full replay */
+    fail_if(tpm_eventlog_parser_init(&p, lb.data, lb.len) != 0, "Failed to parse header");
+    fail_unless(tpm_eventlog_next(&p, &ev) == 1, "Failed to parse first event");
+    lb.data[ev.offset + ev.length - 1] ^= 1;
+    fail_if(tpm_eventlog_replay_load(&st, path) != 0, "Failed to load replay");
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 3,
+                "Modified log was not replayed from the start");
+
+    /* a damaged state file is not loaded */
+    fail_if(truncate(path, 16) != 0, "Failed to truncate state file");
+    fail_unless(tpm_eventlog_replay_load(&st, path) < 0 && st.offset == 0,
+                "Loaded a damaged replay");
+
+    tpm_eventlog_replay_release(&st);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_serialize)
+{
+    struct logbuf lb = {.len = 0};
+    tpm_eventlog_data *ted, *out;
+    tpm_eventlog_pcr *pcr;
+    measurement_data *d = NULL;
+    char *serial;
+    size_t serial_size;
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+
+    ted = (tpm_eventlog_data *)alloc_measurement_data(&tpm_eventlog_measurement_type);
+    fail_if(ted == NULL, "Failed to allocate measurement data");
+    ted->log = malloc(lb.len);
+    fail_if(ted->log == NULL, "Failed to allocate log");
+    memcpy(ted->log, lb.data, lb.len);
+    ted->log_size = (uint32_t)lb.len;
+    pcr = calloc(1, sizeof(*pcr));
+    fail_if(pcr == NULL, "Failed to allocate PCR");
+    pcr->alg_id = TPM_EVENTLOG_ALG_SHA256;
+    pcr->index  = 7;
+    pcr->size   = 32;
+    memset(pcr->digest, 0xab, 32);
+    ted->pcrs = g_list_append(NULL, pcr);
+    ted->quote = (unsigned char *)strdup("quote");
+    ted->quote_size = 5;
+    ted->quote_sig = (unsigned char *)strdup("signature");
+    ted->quote_sig_size = 9;
+
+    fail_if(ted->d.type->serialize_data(&ted->d, &serial, &serial_size) != 0,
+            "Failed to serialize event log");
+    fail_if(tpm_eventlog_measurement_type.unserialize_data(serial, serial_size,
+                                                           &d) != 0 || d == NULL,
+            "Failed to unserialize event log");
+    out = container_of(d, tpm_eventlog_data, d);
+
+    fail_unless(out->log_size == lb.len && memcmp(out->log, lb.data, lb.len) == 0,
+                "Event log changed by serialization");
+    fail_unless(g_list_length(out->pcrs) == 1, "PCR values lost in serialization");
+    fail_unless(memcmp(out->pcrs->data, pcr, sizeof(*pcr)) == 0,
+                "PCR value changed by serialization");
+    fail_unless(out->quote_size == 5 && memcmp(out->quote, "quote", 5) == 0 &&
+                out->quote_sig_size == 9 && memcmp(out->quote_sig, "signature", 9) == 0,
+                "Quote changed by serialization");
+
+    free(serial);
+    free_measurement_data(d);
+    free_measurement_data(&ted->d);
+}
+END_TEST
+
+#ifdef USE_TPM
+/*
+ * Quote of the SHA-256 PCRs in @mask as replayed in @st, over @nonce,
+ * signed with @key the way a TPM signs with an RSASSA AK.
+ */
+static void make_quote(tpm_eventlog_replay *st, uint32_t mask, const char *nonce,
+                       EVP_PKEY *key, unsigned char *quote, size_t *quote_size,
+                       unsigned char *sig, size_t *sig_size)
+{
+    TPMS_ATTEST attest;
+    TPMT_SIGNATURE signature;
+    unsigned char digest[TPM_EVENTLOG_MAX_DIGEST_SIZE];
+    unsigned char *nonce_bin;
+    size_t size, off = 0;
+    unsigned int len;
+    EVP_PKEY_CTX *ctx;
+
+    memset(&attest, 0, sizeof(attest));
+    attest.magic = TPM2_GENERATED_VALUE;
+    attest.type	 = TPM2_ST_ATTEST_QUOTE;
+    nonce_bin = hexstr_to_bin(nonce, strlen(nonce));
+    fail_if(nonce_bin == NULL, "Failed to decode nonce");
+    attest.extraData.size = (UINT16)(strlen(nonce) / 2);
+    memcpy(attest.extraData.buffer, nonce_bin, attest.extraData.size);
+    free(nonce_bin);
+    attest.attested.quote.pcrSelect.count = 1;
+    attest.attested.quote.pcrSelect.pcrSelections[0].hash = TPM2_ALG_SHA256;
+    attest.attested.quote.pcrSelect.pcrSelections[0].sizeofSelect = 3;
+    attest.attested.quote.pcrSelect.pcrSelections[0].pcrSelect[0] = mask & 0xff;
+    attest.attested.quote.pcrSelect.pcrSelections[0].pcrSelect[1] = (mask >> 8) & 0xff;
+    attest.attested.quote.pcrSelect.pcrSelections[0].pcrSelect[2] = (mask >> 16) & 0xff;
+    fail_if(tpm_eventlog_replay_pcr_digest(st, TPM_EVENTLOG_ALG_SHA256, mask,
+                                           TPM_EVENTLOG_ALG_SHA256, digest, &size) != 0,
+            "Failed to compute PCR composite");
+    attest.attested.quote.pcrDigest.size = (UINT16)size;
+    memcpy(attest.attested.quote.pcrDigest.buffer, digest, size);
+    fail_if(Tss2_MU_TPMS_ATTEST_Marshal(&attest, quote, *quote_size, &off) != TSS2_RC_SUCCESS,
+            "Failed to marshal quote");
+    *quote_size = off;
+
+    memset(&signature, 0, sizeof(signature));
+    signature.sigAlg = TPM2_ALG_RSASSA;
+    signature.signature.rsassa.hash = TPM2_ALG_SHA256;
+    EVP_Digest(quote, *quote_size, digest, &len, EVP_sha256(), NULL);
+    size = sizeof(signature.signature.rsassa.sig.buffer);
+    fail_if((ctx = EVP_PKEY_CTX_new(key, NULL)) == NULL ||
+            EVP_PKEY_sign_init(ctx) != 1 ||
+            EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) != 1 ||
+            EVP_PKEY_sign(ctx, signature.signature.rsassa.sig.buffer, &size,
+                          digest, len) != 1, "Failed to sign quote");
+    EVP_PKEY_CTX_free(ctx);
+    signature.signature.rsassa.sig.size = (UINT16)size;
+    off = 0;
+    fail_if(Tss2_MU_TPMT_SIGNATURE_Marshal(&signature, sig, *sig_size, &off) != TSS2_RC_SUCCESS,
+            "Failed to marshal signature");
+    *sig_size = off;
+}
+
+START_TEST(test_quote)
+{
+    char akpub[] = "/tmp/maat_tpm_eventlog_akXXXXXX";
+    const char *nonce = "4e6f6e6365206f6620746869732061747465737461";
+    struct logbuf lb = {.len = 0};
+    struct logbuf other = {.len = 0};
+    tpm_eventlog_replay st, forged;
+    unsigned char quote[sizeof(TPMS_ATTEST)], sig[sizeof(TPMT_SIGNATURE)];
+    size_t quote_size, sig_size;
+    EVP_PKEY_CTX *ctx;
+    EVP_PKEY *key = NULL;
+    FILE *f;
+    int fd;
+
+    fail_if((ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL)) == NULL ||
+            EVP_PKEY_keygen_init(ctx) != 1 ||
+            EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) != 1 ||
+            EVP_PKEY_keygen(ctx, &key) != 1, "Failed to generate AK");
+    EVP_PKEY_CTX_free(ctx);
+    fail_if((fd = mkstemp(akpub)) < 0 || (f = fdopen(fd, "w")) == NULL,
+            "Failed to create AK public key file");
+    fail_unless(PEM_write_PUBKEY(f, key) == 1, "Failed to write AK public key");
+    fclose(f);
+
+    put_header(&lb);
+    put_event(&lb, 0, EV_S_CRTM_VERSION, "boot");
+    put_event(&lb, 4, EV_POST_CODE, "loader");
+    tpm_eventlog_replay_init(&st);
+    fail_unless(tpm_eventlog_replay_log(&st, lb.data, lb.len, NULL) == 2,
+                "Expected to replay 2 events");
+
+    /* the TPM's quote of the PCRs the log extends */
+    quote_size = sizeof(quote);
+    sig_size = sizeof(sig);
+    make_quote(&st, 0x11, nonce, key, quote, &quote_size, sig, &sig_size);
+    fail_unless(tpm_eventlog_replay_check_quote(&st, quote, quote_size, sig, sig_size,
+                nonce, akpub) == 0, "Quote of the replayed PCRs rejected");
+
+    /* a quote made for another attestation */
+    fail_unless(tpm_eventlog_replay_check_quote(&st, quote, quote_size, sig, sig_size,
+                "00112233445566778899", akpub) == -EINVAL,
+                "Quote over another nonce accepted");
+
+    /* a log that is not the one the TPM measured */
+    put_header(&other);
+    put_event(&other, 0, EV_S_CRTM_VERSION, "boot");
+    put_event(&other, 4, EV_POST_CODE, "other loader");
+    tpm_eventlog_replay_init(&forged);
+    fail_unless(tpm_eventlog_replay_log(&forged, other.data, other.len, NULL) == 2,
+                "Expected to replay 2 events");
+    fail_unless(tpm_eventlog_replay_check_quote(&forged, quote, quote_size, sig, sig_size,
+                nonce, akpub) == -EPERM, "Quote accepted for a different log");
+    tpm_eventlog_replay_release(&forged);
+
+    /* a quote leaving out a PCR the log extends */
+    quote_size = sizeof(quote);
+    sig_size = sizeof(sig);
+    make_quote(&st, 0x01, nonce, key, quote, &quote_size, sig, &sig_size);
+    fail_unless(tpm_eventlog_replay_check_quote(&st, quote, quote_size, sig, sig_size,
+                nonce, akpub) == -EPERM, "Quote missing PCR 4 accepted");
+
+    /* a tampered quote */
+    quote_size = sizeof(quote);
+    sig_size = sizeof(sig);
+    make_quote(&st, 0x11, nonce, key, quote, &quote_size, sig, &sig_size);
+    quote[quote_size - 1] ^= 1;
+    fail_unless(tpm_eventlog_replay_check_quote(&st, quote, quote_size, sig, sig_size,
+                nonce, akpub) == -EINVAL, "Tampered quote accepted");
+
+    tpm_eventlog_replay_release(&st);
+    EVP_PKEY_free(key);
+    unlink(akpub);
+}
+END_TEST
+#endif
+
+int main(void)
+{
+    Suite *s;
+    SRunner *sr;
+    TCase *tcase;
+    int number_failed;
+
+    s = suite_create("TPM event log");
+    tcase = tcase_create("Feature Tests");
+    tcase_add_checked_fixture(tcase, setup, teardown);
+    tcase_add_test(tcase, test_parse);
+    tcase_add_test(tcase, test_parse_malformed);
+    tcase_add_test(tcase, test_replay);
+    tcase_add_test(tcase, test_startup_locality);
+    tcase_add_test(tcase, test_references);
+    tcase_add_test(tcase, test_reference_file);
+    tcase_add_test(tcase, test_incremental);
+    tcase_add_test(tcase, test_serialize);
+#ifdef USE_TPM
+    tcase_add_test(tcase, test_quote);
+#endif
+    suite_add_tcase(s, tcase);
+
+    sr = srunner_create(s);
+    srunner_set_log(sr, "test_tpm_eventlog.log");
+    srunner_set_xml(sr, "test_tpm_eventlog.xml");
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed;
+}
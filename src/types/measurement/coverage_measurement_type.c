@@ -0,0 +1,198 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include <tpl.h>
+#include <util/util.h>
+#include <util/base64.h>
+
+#include "coverage_measurement_type.h"
+
+#define COVERAGE_TPL_FMT "uuuUuu"
+
+static measurement_data *coverage_alloc_data(void)
+{
+    coverage_data *cd = calloc(1, sizeof(*cd));
+    if(cd == NULL) {
+        return NULL;
+    }
+    cd->d.type = &coverage_measurement_type;
+    return &cd->d;
+}
+
+static measurement_data *coverage_copy_data(measurement_data *d)
+{
+    coverage_data *cd = (coverage_data *)d;
+    coverage_data *ret = (coverage_data *)coverage_alloc_data();
+
+    if(ret != NULL) {
+        *ret = *cd;
+    }
+    return (measurement_data *)ret;
+}
+
+static void coverage_free_data(measurement_data *d)
+{
+    free(d);
+}
+
+static int coverage_serialize_data(measurement_data *d, char **serial_data,
+                                   size_t *serial_data_size)
+{
+    coverage_data *cd = (coverage_data *)d;
+    tpl_node *tn;
+    void *tplbuf = NULL;
+    size_t tplsize;
+    char *b64;
+
+    tn = tpl_map(COVERAGE_TPL_FMT, &cd->evaluated, &cd->skipped,
+                 &cd->measurements, &cd->bytes, &cd->elapsed, &cd->exhausted);
+    if(tn == NULL) {
+        return -ENOMEM;
+    }
+    if(tpl_pack(tn, 0) < 0 ||
+            tpl_dump(tn, TPL_MEM, &tplbuf, &tplsize) < 0 || tplbuf == NULL) {
+        tpl_free(tn);
+        free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+
+    b64 = b64_encode(tplbuf, tplsize);
+    free(tplbuf);
+    if(b64 == NULL) {
+        return -ENOMEM;
+    }
+    *serial_data = b64;
+    *serial_data_size = strlen(b64) + 1;
+    return 0;
+}
+
+static int coverage_unserialize_data(char *sd, size_t sd_size UNUSED,
+                                     measurement_data **d)
+{
+    coverage_data *cd;
+    tpl_node *tn;
+    void *tplbuf;
+    size_t tplsize;
+
+    tplbuf = b64_decode(sd, &tplsize);
+    if(tplbuf == NULL) {
+        dlog(0, "Base64 decode of serialized data failed\n");
+        return -EINVAL;
+    }
+    if((cd = (coverage_data *)alloc_measurement_data(&coverage_measurement_type)) == NULL) {
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+
+    tn = tpl_map(COVERAGE_TPL_FMT, &cd->evaluated, &cd->skipped,
+                 &cd->measurements, &cd->bytes, &cd->elapsed, &cd->exhausted);
+    if(tn == NULL) {
+        free_measurement_data(&cd->d);
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+    if(tpl_load(tn, TPL_MEM, tplbuf, tplsize) < 0 || tpl_unpack(tn, 0) < 0) {
+        dlog(0, "Failed to unpack coverage data\n");
+        tpl_free(tn);
+        free_measurement_data(&cd->d);
+        b64_free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+    b64_free(tplbuf);
+
+    *d = &cd->d;
+    return 0;
+}
+
+static const char *limit_name(uint32_t exhausted)
+{
+    switch(exhausted) {
+    case COVERAGE_COMPLETE:
+        return "none";
+    case COVERAGE_LIMIT_SECONDS:
+        return "seconds";
+    case COVERAGE_LIMIT_BYTES:
+        return "bytes";
+    case COVERAGE_LIMIT_MEASUREMENTS:
+        return "measurements";
+    }
+    return "unknown";
+}
+
+static int coverage_get_feature(measurement_data *d, char *feature, GList **out)
+{
+    coverage_data *cd = (coverage_data *)d;
+    char *val;
+
+    if(strcmp(feature, "complete") == 0) {
+        val = strdup(coverage_is_complete(cd) ? "true" : "false");
+    } else if(strcmp(feature, "exhausted") == 0) {
+        val = strdup(limit_name(cd->exhausted));
+    } else if(strcmp(feature, "evaluated") == 0) {
+        val = g_strdup_printf("%"PRIu32, cd->evaluated);
+    } else if(strcmp(feature, "skipped") == 0) {
+        val = g_strdup_printf("%"PRIu32, cd->skipped);
+    } else {
+        return -ENOENT;
+    }
+
+    if(val == NULL) {
+        return -ENOMEM;
+    }
+    *out = g_list_append(NULL, val);
+    return 0;
+}
+
+static int coverage_human_readable(measurement_data *d, char **out, size_t *outsize)
+{
+    coverage_data *cd = (coverage_data *)d;
+    char *tmp;
+
+    tmp = g_strdup_printf("%s: %"PRIu32" obligations evaluated, %"PRIu32" skipped, "
+                          "%"PRIu32" measurements, %"PRIu64" bytes, %"PRIu32"s%s%s",
+                          coverage_is_complete(cd) ? "complete" : "partial",
+                          cd->evaluated, cd->skipped, cd->measurements,
+                          cd->bytes, cd->elapsed,
+                          coverage_is_complete(cd) ? "" : ", budget exhausted: ",
+                          coverage_is_complete(cd) ? "" : limit_name(cd->exhausted));
+    if(tmp == NULL) {
+        return -ENOMEM;
+    }
+    *out = tmp;
+    *outsize = strlen(tmp) + 1;
+    return 0;
+}
+
+measurement_type coverage_measurement_type = {
+    .magic		= COVERAGE_TYPE_MAGIC,
+    .name		= COVERAGE_TYPE_NAME,
+    .alloc_data		= coverage_alloc_data,
+    .copy_data		= coverage_copy_data,
+    .free_data		= coverage_free_data,
+    .serialize_data	= coverage_serialize_data,
+    .unserialize_data	= coverage_unserialize_data,
+    .get_feature	= coverage_get_feature,
+    .human_readable	= coverage_human_readable,
+};
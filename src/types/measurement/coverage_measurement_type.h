@@ -0,0 +1,71 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __COVERAGE_MEASUREMENT_TYPE_H__
+#define __COVERAGE_MEASUREMENT_TYPE_H__
+
+/*! \file
+ * measurement_type recording how much of a measurement specification
+ * was evaluated. An APB that runs under a budget attaches one to the
+ * system node of its graph so that appraisers can tell partial
+ * evidence from complete evidence.
+ */
+
+#include <stdint.h>
+#include <measurement_spec/meas_spec-api.h>
+
+/**
+ * coverage measurement_type universally unique 'magic' id number
+ */
+#define COVERAGE_TYPE_MAGIC (0xC0FE4A6E)
+
+/**
+ * coverage measurement_type universally unique name
+ */
+#define COVERAGE_TYPE_NAME "coverage"
+
+/*
+ * Values of ->exhausted. These match measurement_budget_limit in
+ * measurement_spec.h.
+ */
+#define COVERAGE_COMPLETE		0
+#define COVERAGE_LIMIT_SECONDS		1
+#define COVERAGE_LIMIT_BYTES		2
+#define COVERAGE_LIMIT_MEASUREMENTS	3
+
+typedef struct coverage_data {
+    measurement_data d;
+    uint32_t evaluated;		/* obligations evaluated */
+    uint32_t skipped;		/* obligations dropped when the budget ran out */
+    uint32_t measurements;	/* measurements taken */
+    uint64_t bytes;		/* bytes hashed */
+    uint32_t elapsed;		/* seconds spent evaluating */
+    uint32_t exhausted;		/* budget limit reached, or COVERAGE_COMPLETE */
+} coverage_data;
+
+static inline int coverage_is_complete(coverage_data *cd)
+{
+    return cd->exhausted == COVERAGE_COMPLETE && cd->skipped == 0;
+}
+
+/**
+ * Supports the features "complete" ("true" or "false"), "exhausted"
+ * (name of the limit reached, or "none"), "evaluated" and "skipped".
+ */
+extern measurement_type coverage_measurement_type;
+
+#endif /* __COVERAGE_MEASUREMENT_TYPE_H__ */
@@ -79,9 +79,10 @@ static measurement_data *copy_elfheader_measurement_data(measurement_data *d)
         elfSecHdr->section_hdr.sh_addralign = orgSecHdr->section_hdr.sh_addralign;
         elfSecHdr->section_hdr.sh_entsize = orgSecHdr->section_hdr.sh_entsize;
 
-        ret->section_headers = g_list_append(ret->section_headers, elfSecHdr);
+        ret->section_headers = g_list_prepend(ret->section_headers, elfSecHdr);
         elfSecHdr = NULL;
     }
+    ret->section_headers = g_list_reverse(ret->section_headers);
 
     for (iter = g_list_first(elfdata->symbols); iter != NULL; iter = g_list_next(iter)) {
         elf_symbol *orgSym = (elf_symbol *)iter->data;
@@ -107,9 +108,10 @@ static measurement_data *copy_elfheader_measurement_data(measurement_data *d)
         elfSym->symbol.st_value = orgSym->symbol.st_value;
         elfSym->symbol.st_size	= orgSym->symbol.st_size;
 
-        ret->symbols = g_list_append(ret->symbols, elfSym);
+        ret->symbols = g_list_prepend(ret->symbols, elfSym);
         elfSym = NULL;
     }
+    ret->symbols = g_list_reverse(ret->symbols);
 
     for (iter = g_list_first(elfdata->dependencies); iter != NULL; iter = g_list_next(iter)) {
 
@@ -118,9 +120,10 @@ static measurement_data *copy_elfheader_measurement_data(measurement_data *d)
         if (elfDependency == NULL) {
             goto memerror_depends;
         }
-        ret->dependencies = g_list_append(ret->dependencies, elfDependency);
+        ret->dependencies = g_list_prepend(ret->dependencies, elfDependency);
         elfDependency = NULL;
     }
+    ret->dependencies = g_list_reverse(ret->dependencies);
 
     return (measurement_data *)ret;
 
@@ -445,14 +448,15 @@ static int elfheader_type_unserialize_data(char *sd, size_t sd_size, measurement
         elfSectHdr->section_name		= sectName;
         sectName				= NULL;
 
-        // append new section header to list of section headers
-        elfdata->section_headers = g_list_append(elfdata->section_headers, elfSectHdr);
+        // prepend new section header, the list is reversed once all are unpacked
+        elfdata->section_headers = g_list_prepend(elfdata->section_headers, elfSectHdr);
         continue;
 
 error_alloc_elfsecthdr:
         free(sectName);
         goto error_section_processing;
     }
+    elfdata->section_headers = g_list_reverse(elfdata->section_headers);
 
 
     // unpack symbols
@@ -479,7 +483,7 @@ error_alloc_elfsecthdr:
         fileName		= NULL;
         refName			= NULL;
 
-        elfdata->symbols = g_list_append(elfdata->symbols, elfSym);
+        elfdata->symbols = g_list_prepend(elfdata->symbols, elfSym);
 
         continue;
 
@@ -489,12 +493,14 @@ error_alloc_elfsym:
         free(refName);
         goto error_symbol_processing;
     }
+    elfdata->symbols = g_list_reverse(elfdata->symbols);
 
 
     // unpack dependencies
     while (tpl_unpack( tn, 4) > 0) {
-        elfdata->dependencies = g_list_append(elfdata->dependencies, dependName);
+        elfdata->dependencies = g_list_prepend(elfdata->dependencies, dependName);
     }
+    elfdata->dependencies = g_list_reverse(elfdata->dependencies);
 
     elfdata->d.type = &elfheader_measurement_type;
 
@@ -547,8 +553,9 @@ static int get_feature(measurement_data *d, char *feature, GList **out)
                 dlog(0, "Insuffiecent Memory to Allocate String\n");
                 goto memerror;
             }
-            res = g_list_append(res, filename);
+            res = g_list_prepend(res, filename);
         }
+        res = g_list_reverse(res);
     }
     *out = res;
     return 0;
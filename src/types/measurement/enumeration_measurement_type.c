@@ -150,6 +150,7 @@ int unserialize_enumeration_data(char *serialized, size_t serialized_sz, measure
     size_t tplsize   = 0;
     uint32_t as_magic;
     GList *tmp = NULL;
+    uint64_t nr_entries = 0;
 
     char *entry = NULL;
     int ret_val = 0;
@@ -193,21 +194,18 @@ int unserialize_enumeration_data(char *serialized, size_t serialized_sz, measure
     while(tpl_unpack(tn, 1) > 0) {
         if(entry == NULL) {
             dlog(0, "Error: Null entry\n");
+            e_data->entries = tmp;
             ret_val = -1;
             goto error_loop;
         }
 
-        tmp = g_list_append(tmp, entry);
-        if(tmp == NULL) {
-            dlog(0, "Error: failed to add entry\n");
-            free(entry);
-            ret_val = -1;
-            goto error_loop;
-        }
+        /* prepend and reverse once done, appending is quadratic */
+        tmp = g_list_prepend(tmp, entry);
+        nr_entries++;
     }
-    e_data->entries = tmp;
+    e_data->entries = g_list_reverse(tmp);
 
-    if (g_list_length(e_data->entries) != e_data->num_entries) {
+    if (nr_entries != e_data->num_entries) {
         dlog(0, "Error: incorrect number of entries\n");
         ret_val = -1;
         goto error_num_entries;
@@ -265,8 +263,9 @@ static int enumeration_get_feature(measurement_data *d, char *feature, GList **o
                 goto error;
             }
 
-            res = g_list_append(res, avalue);
+            res = g_list_prepend(res, avalue);
         }
+        res = g_list_reverse(res);
     }
     *out = res;
     return 0;
@@ -18,6 +18,7 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <glib.h>
 
@@ -72,7 +73,7 @@ int file_metadata_type_serialize_data(measurement_data *d, char **serial_data, s
     size_t tplsize;
     char *b64;
     if(tpl_jot(TPL_MEM, &tplbuf, &tplsize,
-               "c#c#c#c#iiiiiiiiiiiiiiiiiii",
+               "c#c#c#c#iiiiiiiiiiiiiiiiiiiuuiUUUc#",
                fmd->file_metadata.filepath, 64,
                fmd->file_metadata.path, 64,
                fmd->file_metadata.filename, 64,
@@ -95,7 +96,14 @@ int file_metadata_type_serialize_data(measurement_data *d, char **serial_data, s
                &fmd->file_metadata.oread,
                &fmd->file_metadata.owrite,
                &fmd->file_metadata.oexec,
-               &fmd->file_metadata.has_extended_acl) < 0) {
+               &fmd->file_metadata.has_extended_acl,
+               &fmd->file_metadata.mode,
+               &fmd->file_metadata.nlink,
+               &fmd->file_metadata.has_ima,
+               &fmd->file_metadata.inode,
+               &fmd->file_metadata.mount_id,
+               &fmd->file_metadata.attributes,
+               fmd->file_metadata.selinux_label, 64) < 0) {
         goto out_err;
     }
 
@@ -139,7 +147,7 @@ int file_metadata_type_unserialize_data(char *sd, size_t sd_size, measurement_da
         return -1;
     }
 
-    tn = tpl_map("c#c#c#c#iiiiiiiiiiiiiiiiiii",
+    tn = tpl_map("c#c#c#c#iiiiiiiiiiiiiiiiiiiuuiUUUc#",
                  fmd->file_metadata.filepath, 64,
                  fmd->file_metadata.path, 64,
                  fmd->file_metadata.filename, 64,
@@ -162,7 +170,14 @@ int file_metadata_type_unserialize_data(char *sd, size_t sd_size, measurement_da
                  &fmd->file_metadata.oread,
                  &fmd->file_metadata.owrite,
                  &fmd->file_metadata.oexec,
-                 &fmd->file_metadata.has_extended_acl);
+                 &fmd->file_metadata.has_extended_acl,
+               &fmd->file_metadata.mode,
+               &fmd->file_metadata.nlink,
+               &fmd->file_metadata.has_ima,
+               &fmd->file_metadata.inode,
+               &fmd->file_metadata.mount_id,
+               &fmd->file_metadata.attributes,
+               fmd->file_metadata.selinux_label, 64);
 
     if(!tn) {
         b64_free(tplbuf);
@@ -194,6 +209,13 @@ int file_metadata_type_unserialize_data(char *sd, size_t sd_size, measurement_da
     tpl_unpack(tn, 0); /* owrite */
     tpl_unpack(tn, 0); /* oexec */
     tpl_unpack(tn, 0); /* has_extended_acl */
+    tpl_unpack(tn, 0); /* mode */
+    tpl_unpack(tn, 0); /* nlink */
+    tpl_unpack(tn, 0); /* has_ima */
+    tpl_unpack(tn, 0); /* inode */
+    tpl_unpack(tn, 0); /* mount_id */
+    tpl_unpack(tn, 0); /* attributes */
+    tpl_unpack(tn, 0); /* selinux_label[64] */
 
     fmd->meas_data.type = &file_metadata_measurement_type;
 
@@ -232,7 +254,14 @@ static int file_metadata_human_readable(measurement_data *d, char **out, size_t
                       "\toread:\t%d\n"
                       "\towrite:\t%d\n"
                       "\toexec:\t%d\n"
-                      "\thas_extended_acl:\t%d\n}",
+                      "\thas_extended_acl:\t%d\n"
+                      "\tmode:\t%o\n"
+                      "\tnlink:\t%u\n"
+                      "\thas_ima:\t%d\n"
+                      "\tinode:\t%"PRIu64"\n"
+                      "\tmount_id:\t%"PRIu64"\n"
+                      "\tattributes:\t0x%"PRIx64"\n"
+                      "\tselinux_label:\t\"%.*s\"\n}",
                       fmd->file_metadata.filepath, fmd->file_metadata.path,
                       fmd->file_metadata.filename, fmd->file_metadata.type,
                       fmd->file_metadata.group_id, fmd->file_metadata.user_id,
@@ -244,7 +273,12 @@ static int file_metadata_human_readable(measurement_data *d, char **out, size_t
                       fmd->file_metadata.gread, fmd->file_metadata.gwrite,
                       fmd->file_metadata.gexec, fmd->file_metadata.oread,
                       fmd->file_metadata.owrite, fmd->file_metadata.oexec,
-                      fmd->file_metadata.has_extended_acl);
+                      fmd->file_metadata.has_extended_acl,
+                      fmd->file_metadata.mode, fmd->file_metadata.nlink,
+                      fmd->file_metadata.has_ima, fmd->file_metadata.inode,
+                      fmd->file_metadata.mount_id, fmd->file_metadata.attributes,
+                      (int)sizeof(fmd->file_metadata.selinux_label),
+                      fmd->file_metadata.selinux_label);
     if(rc < 0) {
         return -1;
     } else if (INT_MAX > SIZE_MAX && (unsigned int)rc > SIZE_MAX) {
@@ -41,7 +41,12 @@
 
 /**
    To start, the actual metadata is based off of OVAL file_state (with comparable types).
-   It does not included extended attributes (a separate OVAL structure).
+   It does not included extended attributes (a separate OVAL structure), other
+   than the SELinux label and whether the file has an IMA xattr.
+
+   The fields after has_extended_acl come from statx(2). mount_id is the
+   mnt_id of /proc/self/mountinfo (0 before Linux 5.8) and attributes
+   holds the STATX_ATTR_* flags the filesystem reported.
  */
 struct file_metadata_struct  {
     char     filepath[64];
@@ -67,6 +72,13 @@ struct file_metadata_struct  {
     int32_t  owrite;
     int32_t  oexec;
     int32_t  has_extended_acl;
+    uint32_t mode;
+    uint32_t nlink;
+    int32_t  has_ima;
+    uint64_t inode;
+    uint64_t mount_id;
+    uint64_t attributes;
+    char     selinux_label[64];
 };
 
 /**
@@ -0,0 +1,206 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include <tpl.h>
+#include <util/util.h>
+#include <util/base64.h>
+
+#include "file_sampling_measurement_type.h"
+
+#define FILE_SAMPLING_TPL_FMT "uuuuuuuc#"
+
+#define FILE_SAMPLING_TPL_MAP(fsd)					\
+    tpl_map(FILE_SAMPLING_TPL_FMT, &(fsd)->rate_ppm, &(fsd)->rounds,	\
+            &(fsd)->round, &(fsd)->files, &(fsd)->sampled,		\
+            &(fsd)->overdue, &(fsd)->oldest, (fsd)->key_id,		\
+            FILE_SAMPLING_KEY_ID_SIZE)
+
+static measurement_data *file_sampling_alloc_data(void)
+{
+    file_sampling_data *fsd = calloc(1, sizeof(*fsd));
+    if(fsd == NULL) {
+        return NULL;
+    }
+    fsd->d.type = &file_sampling_measurement_type;
+    return &fsd->d;
+}
+
+static measurement_data *file_sampling_copy_data(measurement_data *d)
+{
+    file_sampling_data *fsd = (file_sampling_data *)d;
+    file_sampling_data *ret = (file_sampling_data *)file_sampling_alloc_data();
+
+    if(ret != NULL) {
+        *ret = *fsd;
+    }
+    return (measurement_data *)ret;
+}
+
+static void file_sampling_free_data(measurement_data *d)
+{
+    free(d);
+}
+
+static int file_sampling_serialize_data(measurement_data *d, char **serial_data,
+                                        size_t *serial_data_size)
+{
+    file_sampling_data *fsd = (file_sampling_data *)d;
+    tpl_node *tn;
+    void *tplbuf = NULL;
+    size_t tplsize;
+    char *b64;
+
+    tn = FILE_SAMPLING_TPL_MAP(fsd);
+    if(tn == NULL) {
+        return -ENOMEM;
+    }
+    if(tpl_pack(tn, 0) < 0 ||
+            tpl_dump(tn, TPL_MEM, &tplbuf, &tplsize) < 0 || tplbuf == NULL) {
+        tpl_free(tn);
+        free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+
+    b64 = b64_encode(tplbuf, tplsize);
+    free(tplbuf);
+    if(b64 == NULL) {
+        return -ENOMEM;
+    }
+    *serial_data = b64;
+    *serial_data_size = strlen(b64) + 1;
+    return 0;
+}
+
+static int file_sampling_unserialize_data(char *sd, size_t sd_size UNUSED,
+        measurement_data **d)
+{
+    file_sampling_data *fsd;
+    tpl_node *tn;
+    void *tplbuf;
+    size_t tplsize;
+
+    tplbuf = b64_decode(sd, &tplsize);
+    if(tplbuf == NULL) {
+        dlog(0, "Base64 decode of serialized data failed\n");
+        return -EINVAL;
+    }
+    fsd = (file_sampling_data *)alloc_measurement_data(&file_sampling_measurement_type);
+    if(fsd == NULL) {
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+
+    tn = FILE_SAMPLING_TPL_MAP(fsd);
+    if(tn == NULL) {
+        free_measurement_data(&fsd->d);
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+    if(tpl_load(tn, TPL_MEM, tplbuf, tplsize) < 0 || tpl_unpack(tn, 0) < 0) {
+        dlog(0, "Failed to unpack file sampling data\n");
+        tpl_free(tn);
+        free_measurement_data(&fsd->d);
+        b64_free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+    b64_free(tplbuf);
+
+    *d = &fsd->d;
+    return 0;
+}
+
+static int file_sampling_get_feature(measurement_data *d, char *feature, GList **out)
+{
+    file_sampling_data *fsd = (file_sampling_data *)d;
+    uint32_t *field = NULL;
+    char *val;
+
+    if(strcmp(feature, "rate_ppm") == 0) {
+        field = &fsd->rate_ppm;
+    } else if(strcmp(feature, "rounds") == 0) {
+        field = &fsd->rounds;
+    } else if(strcmp(feature, "round") == 0) {
+        field = &fsd->round;
+    } else if(strcmp(feature, "files") == 0) {
+        field = &fsd->files;
+    } else if(strcmp(feature, "sampled") == 0) {
+        field = &fsd->sampled;
+    } else if(strcmp(feature, "overdue") == 0) {
+        field = &fsd->overdue;
+    } else if(strcmp(feature, "oldest") == 0) {
+        field = &fsd->oldest;
+    } else if(strcmp(feature, "key_id") != 0) {
+        return -ENOENT;
+    }
+
+    if(field != NULL) {
+        val = g_strdup_printf("%"PRIu32, *field);
+    } else {
+        val = bin_to_hexstr(fsd->key_id, FILE_SAMPLING_KEY_ID_SIZE);
+    }
+    if(val == NULL) {
+        return -ENOMEM;
+    }
+    *out = g_list_append(NULL, val);
+    return 0;
+}
+
+static int file_sampling_human_readable(measurement_data *d, char **out,
+                                        size_t *outsize)
+{
+    file_sampling_data *fsd = (file_sampling_data *)d;
+    char *key_id;
+    char *tmp;
+
+    if((key_id = bin_to_hexstr(fsd->key_id, FILE_SAMPLING_KEY_ID_SIZE)) == NULL) {
+        return -ENOMEM;
+    }
+    tmp = g_strdup_printf("round %"PRIu32": %"PRIu32" of %"PRIu32" files hashed "
+                          "(%"PRIu32" sampled at %"PRIu32" ppm, %"PRIu32" overdue), "
+                          "coverage window %"PRIu32" rounds, oldest %"PRIu32" rounds, "
+                          "key id %s",
+                          fsd->round, fsd->sampled + fsd->overdue, fsd->files,
+                          fsd->sampled, fsd->rate_ppm, fsd->overdue,
+                          fsd->rounds, fsd->oldest, key_id);
+    free(key_id);
+    if(tmp == NULL) {
+        return -ENOMEM;
+    }
+    *out = tmp;
+    *outsize = strlen(tmp) + 1;
+    return 0;
+}
+
+measurement_type file_sampling_measurement_type = {
+    .magic		= FILE_SAMPLING_TYPE_MAGIC,
+    .name		= FILE_SAMPLING_TYPE_NAME,
+    .alloc_data		= file_sampling_alloc_data,
+    .copy_data		= file_sampling_copy_data,
+    .free_data		= file_sampling_free_data,
+    .serialize_data	= file_sampling_serialize_data,
+    .unserialize_data	= file_sampling_unserialize_data,
+    .get_feature	= file_sampling_get_feature,
+    .human_readable	= file_sampling_human_readable,
+};
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __FILE_SAMPLING_MEASUREMENT_TYPE_H__
+#define __FILE_SAMPLING_MEASUREMENT_TYPE_H__
+
+/*! \file
+ * measurement_type describing a round of rolling coverage file
+ * sampling. An APB that hashes only a sample of the files it lists
+ * attaches one to the system node of its graph. The key id lets the
+ * appraiser confirm that the sample was drawn with the key derived
+ * from its nonce, and the counters describe how far behind the
+ * rolling coverage is.
+ */
+
+#include <stdint.h>
+#include <measurement_spec/meas_spec-api.h>
+
+/**
+ * file_sampling measurement_type universally unique 'magic' id number
+ */
+#define FILE_SAMPLING_TYPE_MAGIC (0x5A3F11E5)
+
+/**
+ * file_sampling measurement_type universally unique name
+ */
+#define FILE_SAMPLING_TYPE_NAME "file_sampling"
+
+#define FILE_SAMPLING_KEY_ID_SIZE 32
+
+typedef struct file_sampling_data {
+    measurement_data d;
+    uint32_t rate_ppm;		/* sampling rate, parts per million */
+    uint32_t rounds;		/* coverage window, 0 for none */
+    uint32_t round;		/* rounds sampled so far, including this one */
+    uint32_t files;		/* files considered */
+    uint32_t sampled;		/* of those, selected by the keyed sample */
+    uint32_t overdue;		/* of those, hashed to keep coverage */
+    uint32_t oldest;		/* rounds since the least recently hashed file was */
+    unsigned char key_id[FILE_SAMPLING_KEY_ID_SIZE]; /* sha256 of the sampling key */
+} file_sampling_data;
+
+/**
+ * Supports the features "rate_ppm", "rounds", "round", "files",
+ * "sampled", "overdue", "oldest" and "key_id" (hex).
+ */
+extern measurement_type file_sampling_measurement_type;
+
+#endif /* __FILE_SAMPLING_MEASUREMENT_TYPE_H__ */
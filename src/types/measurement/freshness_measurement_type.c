@@ -0,0 +1,174 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include <tpl.h>
+#include <util/util.h>
+#include <util/base64.h>
+
+#include "freshness_measurement_type.h"
+
+#define FRESHNESS_TPL_FMT "Uu"
+
+static measurement_data *freshness_alloc_data(void)
+{
+    freshness_data *fd = calloc(1, sizeof(*fd));
+    if(fd == NULL) {
+        return NULL;
+    }
+    fd->d.type = &freshness_measurement_type;
+    return &fd->d;
+}
+
+static measurement_data *freshness_copy_data(measurement_data *d)
+{
+    freshness_data *fd = (freshness_data *)d;
+    freshness_data *ret = (freshness_data *)freshness_alloc_data();
+
+    if(ret != NULL) {
+        *ret = *fd;
+    }
+    return (measurement_data *)ret;
+}
+
+static void freshness_free_data(measurement_data *d)
+{
+    free(d);
+}
+
+static int freshness_serialize_data(measurement_data *d, char **serial_data,
+                                    size_t *serial_data_size)
+{
+    freshness_data *fd = (freshness_data *)d;
+    tpl_node *tn;
+    void *tplbuf = NULL;
+    size_t tplsize;
+    char *b64;
+
+    tn = tpl_map(FRESHNESS_TPL_FMT, &fd->measured_at, &fd->max_age);
+    if(tn == NULL) {
+        return -ENOMEM;
+    }
+    if(tpl_pack(tn, 0) < 0 ||
+            tpl_dump(tn, TPL_MEM, &tplbuf, &tplsize) < 0 || tplbuf == NULL) {
+        tpl_free(tn);
+        free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+
+    b64 = b64_encode(tplbuf, tplsize);
+    free(tplbuf);
+    if(b64 == NULL) {
+        return -ENOMEM;
+    }
+    *serial_data = b64;
+    *serial_data_size = strlen(b64) + 1;
+    return 0;
+}
+
+static int freshness_unserialize_data(char *sd, size_t sd_size UNUSED,
+                                      measurement_data **d)
+{
+    freshness_data *fd;
+    tpl_node *tn;
+    void *tplbuf;
+    size_t tplsize;
+
+    tplbuf = b64_decode(sd, &tplsize);
+    if(tplbuf == NULL) {
+        dlog(0, "Base64 decode of serialized data failed\n");
+        return -EINVAL;
+    }
+    if((fd = (freshness_data *)alloc_measurement_data(&freshness_measurement_type)) == NULL) {
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+
+    tn = tpl_map(FRESHNESS_TPL_FMT, &fd->measured_at, &fd->max_age);
+    if(tn == NULL) {
+        free_measurement_data(&fd->d);
+        b64_free(tplbuf);
+        return -ENOMEM;
+    }
+    if(tpl_load(tn, TPL_MEM, tplbuf, tplsize) < 0 || tpl_unpack(tn, 0) < 0) {
+        dlog(0, "Failed to unpack freshness data\n");
+        tpl_free(tn);
+        free_measurement_data(&fd->d);
+        b64_free(tplbuf);
+        return -EINVAL;
+    }
+    tpl_free(tn);
+    b64_free(tplbuf);
+
+    *d = &fd->d;
+    return 0;
+}
+
+static int freshness_get_feature(measurement_data *d, char *feature, GList **out)
+{
+    freshness_data *fd = (freshness_data *)d;
+    char *val;
+
+    if(strcmp(feature, "measured_at") == 0) {
+        val = g_strdup_printf("%"PRIu64, fd->measured_at);
+    } else if(strcmp(feature, "max_age") == 0) {
+        val = g_strdup_printf("%"PRIu32, fd->max_age);
+    } else if(strcmp(feature, "expires") == 0) {
+        val = g_strdup_printf("%"PRIu64, fd->measured_at + fd->max_age);
+    } else {
+        return -ENOENT;
+    }
+
+    if(val == NULL) {
+        return -ENOMEM;
+    }
+    *out = g_list_append(NULL, val);
+    return 0;
+}
+
+static int freshness_human_readable(measurement_data *d, char **out, size_t *outsize)
+{
+    freshness_data *fd = (freshness_data *)d;
+    char *tmp;
+
+    tmp = g_strdup_printf("measured at %"PRIu64", valid for %"PRIu32"s",
+                          fd->measured_at, fd->max_age);
+    if(tmp == NULL) {
+        return -ENOMEM;
+    }
+    *out = tmp;
+    *outsize = strlen(tmp) + 1;
+    return 0;
+}
+
+measurement_type freshness_measurement_type = {
+    .magic		= FRESHNESS_TYPE_MAGIC,
+    .name		= FRESHNESS_TYPE_NAME,
+    .alloc_data		= freshness_alloc_data,
+    .copy_data		= freshness_copy_data,
+    .free_data		= freshness_free_data,
+    .serialize_data	= freshness_serialize_data,
+    .unserialize_data	= freshness_unserialize_data,
+    .get_feature	= freshness_get_feature,
+    .human_readable	= freshness_human_readable,
+};
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __FRESHNESS_MEASUREMENT_TYPE_H__
+#define __FRESHNESS_MEASUREMENT_TYPE_H__
+
+/*! \file
+ * measurement_type recording when the measurements of a graph were
+ * taken. An APB that answers a request from a graph measured in the
+ * background, before the request arrived, attaches one to the system
+ * node of the graph so that appraisers can tell how old the evidence
+ * is. Evidence without one was measured for the request it answers.
+ */
+
+#include <stdint.h>
+#include <measurement_spec/meas_spec-api.h>
+
+/**
+ * freshness measurement_type universally unique 'magic' id number
+ */
+#define FRESHNESS_TYPE_MAGIC (0xF2E5A6E0)
+
+/**
+ * freshness measurement_type universally unique name
+ */
+#define FRESHNESS_TYPE_NAME "freshness"
+
+typedef struct freshness_data {
+    measurement_data d;
+    uint64_t measured_at;	/* when measurement started, seconds since the epoch */
+    uint32_t max_age;		/* seconds after measured_at the attester
+				   stops answering requests from the graph */
+} freshness_data;
+
+/**
+ * Supports the features "measured_at", "max_age" and "expires"
+ * (measured_at + max_age), all in seconds.
+ */
+extern measurement_type freshness_measurement_type;
+
+#endif /* __FRESHNESS_MEASUREMENT_TYPE_H__ */
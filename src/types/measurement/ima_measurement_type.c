@@ -153,8 +153,10 @@ int ima_unserialize_data( char *sd, size_t sd_size, measurement_data **d)
 
     tpl_load(tn, TPL_MEM, tplbuf, tplsize);
     tpl_unpack(tn, 0);
+    /* prepend and reverse once done, appending is quadratic */
     while(tpl_unpack(tn, 1) > 0)
-        imd->msmts = g_list_append(imd->msmts, tmp);
+        imd->msmts = g_list_prepend(imd->msmts, tmp);
+    imd->msmts = g_list_reverse(imd->msmts);
 
     tpl_free(tn);
     b64_free(tplbuf);
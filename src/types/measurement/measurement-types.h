@@ -58,6 +58,10 @@
 #include <measurement/reloc_list.h>
 #include <measurement/fds_measurement_type.h>
 #include <measurement/kernel_measurement_type.h>
+#include <measurement/tpm_eventlog_measurement_type.h>
+#include <measurement/coverage_measurement_type.h>
+#include <measurement/freshness_measurement_type.h>
+#include <measurement/file_sampling_measurement_type.h>
 
 static inline int register_measurement_types(void)
 {
@@ -212,6 +216,22 @@ static inline int register_measurement_types(void)
         dlog(0, "Failed to register kernel measurement type: %d\n", ret_val);
         return ret_val;
     }
+    if ((ret_val = register_measurement_type(&tpm_eventlog_measurement_type))) {
+        dlog(0, "Failed to register tpm eventlog measurement type: %d\n", ret_val);
+        return ret_val;
+    }
+    if ((ret_val = register_measurement_type(&coverage_measurement_type))) {
+        dlog(0, "Failed to register coverage measurement type: %d\n", ret_val);
+        return ret_val;
+    }
+    if ((ret_val = register_measurement_type(&freshness_measurement_type))) {
+        dlog(0, "Failed to register freshness measurement type: %d\n", ret_val);
+        return ret_val;
+    }
+    if ((ret_val = register_measurement_type(&file_sampling_measurement_type))) {
+        dlog(0, "Failed to register file sampling measurement type: %d\n", ret_val);
+        return ret_val;
+    }
 
 
     return 0;
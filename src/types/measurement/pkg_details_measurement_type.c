@@ -164,6 +164,7 @@ int unserialize_pkg_details(char *serialized, size_t serialized_sz, measurement_
     char *md5      = NULL;
     uint64_t fnlen = 0;
     uint64_t md5len = 0;
+    size_t nr_filehashs = 0;
 
     uint32_t as_magic;
 
@@ -226,16 +227,12 @@ int unserialize_pkg_details(char *serialized, size_t serialized_sz, measurement_
         fh->filename_len = fnlen;
         fh->filename     = fn;
 
-        iter = g_list_append(iter, fh);
-        if(iter == NULL) {
-            dlog(0, "Error: failed to add entry\n");
-            free_file_hash(fh);
-            ret_val = -1;
-            break;
-        }
+        /* prepend and reverse once done, appending is quadratic */
+        iter = g_list_prepend(iter, fh);
+        nr_filehashs++;
     }
-    pkg_data->filehashs = iter;
-    pkg_data->filehashs_len = g_list_length(iter);
+    pkg_data->filehashs = g_list_reverse(iter);
+    pkg_data->filehashs_len = nr_filehashs;
 
     b64_free(tplbuf);
     tpl_free(tn);
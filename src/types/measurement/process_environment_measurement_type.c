@@ -66,8 +66,9 @@ static measurement_data *copy_proc_env_measurement_data(measurement_data *d)
         if (envKVEntry->value == NULL) {
             goto memerror_value;
         }
-        ret->envpairs = g_list_append(ret->envpairs, envKVEntry);
+        ret->envpairs = g_list_prepend(ret->envpairs, envKVEntry);
     }
+    ret->envpairs = g_list_reverse(ret->envpairs);
 
     return (measurement_data *)ret;
 
@@ -213,9 +214,10 @@ int proc_env_type_unserialize_data(char *sd, size_t sd_size, measurement_data **
         env_entry->key = keyname;
         env_entry->value = valuename;
 
-        // append new environment entry
-        envdata->envpairs = g_list_append(envdata->envpairs, env_entry);
+        // prepend new environment entry, the list is reversed once all are unpacked
+        envdata->envpairs = g_list_prepend(envdata->envpairs, env_entry);
     }
+    envdata->envpairs = g_list_reverse(envdata->envpairs);
 
     tpl_free(tn);
     b64_free(tplbuf);
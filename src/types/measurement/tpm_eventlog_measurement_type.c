@@ -0,0 +1,464 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*! \file tpm_eventlog_measurement_type.c
+ * Implements manipulators for the TPM event log measurement type and
+ * an in place parser for TCG2 crypto agile event logs (TCG PC Client
+ * Platform Firmware Profile, section 10).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <glib.h>
+
+#include <tpl.h>
+#include <util/base64.h>
+#include <util/util.h>
+
+#include "tpm_eventlog_measurement_type.h"
+
+#define SPEC_ID_SIGNATURE "Spec ID Event03"
+#define SPEC_ID_SIGNATURE_SIZE 16
+
+/* log, quote, quote signature, then the PCR values */
+#define TPM_EVENTLOG_TPL_FMT "BBBA(vuB)"
+
+/* size of the SHA1-only TCG_PCR_EVENT header that holds the Spec ID */
+#define PCR_EVENT_HDR_SIZE (4 + 4 + 20 + 4)
+
+static const struct {
+    uint16_t alg_id;
+    const char *name;
+} alg_names[] = {
+    {TPM_EVENTLOG_ALG_SHA1,	"sha1"},
+    {TPM_EVENTLOG_ALG_SHA256,	"sha256"},
+    {TPM_EVENTLOG_ALG_SHA384,	"sha384"},
+    {TPM_EVENTLOG_ALG_SHA512,	"sha512"},
+    {TPM_EVENTLOG_ALG_SM3_256,	"sm3_256"},
+};
+
+const char *tpm_eventlog_alg_name(uint16_t alg_id)
+{
+    size_t i;
+    for(i = 0; i < sizeof(alg_names)/sizeof(alg_names[0]); i++) {
+        if(alg_names[i].alg_id == alg_id) {
+            return alg_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+uint16_t tpm_eventlog_alg_id(const char *name)
+{
+    size_t i;
+    for(i = 0; i < sizeof(alg_names)/sizeof(alg_names[0]); i++) {
+        if(strcmp(alg_names[i].name, name) == 0) {
+            return alg_names[i].alg_id;
+        }
+    }
+    return 0;
+}
+
+/* The event log is always little endian */
+static inline uint16_t get_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int tpm_eventlog_parser_init(tpm_eventlog_parser *p,
+                             const unsigned char *log, size_t size)
+{
+    const unsigned char *ev;
+    size_t ev_size;
+    size_t pos;
+    uint32_t i;
+
+    memset(p, 0, sizeof(*p));
+
+    if(size < PCR_EVENT_HDR_SIZE ||
+            get_le32(log + 4) != TPM_EVENTLOG_EV_NO_ACTION) {
+        return -EINVAL;
+    }
+    ev_size = get_le32(log + PCR_EVENT_HDR_SIZE - 4);
+    if(ev_size > size - PCR_EVENT_HDR_SIZE) {
+        return -EINVAL;
+    }
+    ev = log + PCR_EVENT_HDR_SIZE;
+
+    /* signature, platformClass, version and errata, uintnSize, numberOfAlgorithms */
+    if(ev_size < SPEC_ID_SIGNATURE_SIZE + 4 + 4 + 4 ||
+            memcmp(ev, SPEC_ID_SIGNATURE, SPEC_ID_SIGNATURE_SIZE) != 0) {
+        dlog(2, "Event log is not in the crypto agile format\n");
+        return -EINVAL;
+    }
+    pos = SPEC_ID_SIGNATURE_SIZE + 4 + 4;
+
+    p->nr_algs = get_le32(ev + pos);
+    pos += 4;
+    if(p->nr_algs == 0 || p->nr_algs > TPM_EVENTLOG_MAX_ALGS ||
+            ev_size - pos < (size_t)p->nr_algs * 4) {
+        dlog(2, "Event log declares %"PRIu32" digest algorithms\n", p->nr_algs);
+        return -EINVAL;
+    }
+    for(i = 0; i < p->nr_algs; i++, pos += 4) {
+        p->algs[i].alg_id	= get_le16(ev + pos);
+        p->algs[i].digest_size	= get_le16(ev + pos + 2);
+        if(p->algs[i].digest_size == 0 ||
+                p->algs[i].digest_size > TPM_EVENTLOG_MAX_DIGEST_SIZE) {
+            return -EINVAL;
+        }
+    }
+
+    p->log		= log;
+    p->size		= size;
+    p->header_size	= PCR_EVENT_HDR_SIZE + ev_size;
+    p->offset		= p->header_size;
+    return 0;
+}
+
+int tpm_eventlog_parser_seek(tpm_eventlog_parser *p, size_t offset)
+{
+    if(offset < p->header_size || offset > p->size) {
+        return -EINVAL;
+    }
+    p->offset = offset;
+    return 0;
+}
+
+int tpm_eventlog_next(tpm_eventlog_parser *p, tpm_eventlog_event *ev)
+{
+    const unsigned char *rec = p->log + p->offset;
+    size_t left = p->size - p->offset;
+    size_t pos;
+    uint32_t i, j;
+
+    if(left == 0) {
+        return 0;
+    }
+    if(left < 12) {
+        goto malformed;
+    }
+
+    ev->offset		= p->offset;
+    ev->pcr_index	= get_le32(rec);
+    ev->event_type	= get_le32(rec + 4);
+    ev->nr_digests	= get_le32(rec + 8);
+    pos = 12;
+
+    if(ev->nr_digests > TPM_EVENTLOG_MAX_ALGS) {
+        goto malformed;
+    }
+
+    for(i = 0; i < ev->nr_digests; i++) {
+        uint16_t alg_id;
+        if(left - pos < 2) {
+            goto malformed;
+        }
+        alg_id = get_le16(rec + pos);
+        pos += 2;
+
+        for(j = 0; j < p->nr_algs && p->algs[j].alg_id != alg_id; j++);
+        if(j == p->nr_algs) {
+            dlog(2, "Event at offset %zu uses undeclared algorithm 0x%04"PRIx16"\n",
+                 ev->offset, alg_id);
+            goto malformed;
+        }
+        if(left - pos < p->algs[j].digest_size) {
+            goto malformed;
+        }
+        ev->digests[i].alg_id	= alg_id;
+        ev->digests[i].size	= p->algs[j].digest_size;
+        ev->digests[i].digest	= rec + pos;
+        pos += p->algs[j].digest_size;
+    }
+
+    if(left - pos < 4) {
+        goto malformed;
+    }
+    ev->data_size = get_le32(rec + pos);
+    pos += 4;
+    if(left - pos < ev->data_size) {
+        goto malformed;
+    }
+    ev->data	= rec + pos;
+    pos	       += ev->data_size;
+
+    ev->length	= pos;
+    p->offset  += pos;
+    return 1;
+
+malformed:
+    dlog(2, "Malformed event log record at offset %zu\n", p->offset);
+    return -EINVAL;
+}
+
+static measurement_data *tpm_eventlog_alloc_data(void)
+{
+    tpm_eventlog_data *ret;
+
+    ret = (tpm_eventlog_data *)malloc(sizeof(*ret));
+    if(ret == NULL) {
+        return NULL;
+    }
+
+    memset(ret, 0, sizeof(*ret));
+    ret->d.type = &tpm_eventlog_measurement_type;
+
+    return (measurement_data *)ret;
+}
+
+static void *copy_pcr(const void *src, void *data UNUSED)
+{
+    tpm_eventlog_pcr *ret = malloc(sizeof(*ret));
+    if(ret != NULL) {
+        memcpy(ret, src, sizeof(*ret));
+    }
+    return ret;
+}
+
+static unsigned char *dup_bytes(const unsigned char *src, size_t size)
+{
+    unsigned char *ret = malloc(size);
+    if(ret != NULL) {
+        memcpy(ret, src, size);
+    }
+    return ret;
+}
+
+static void tpm_eventlog_free_data(measurement_data *d)
+{
+    tpm_eventlog_data *ted = (tpm_eventlog_data *)d;
+
+    if(ted != NULL) {
+        g_list_free_full(ted->pcrs, free);
+        free(ted->log);
+        free(ted->quote);
+        free(ted->quote_sig);
+        free(ted);
+    }
+}
+
+static measurement_data *tpm_eventlog_copy_data(measurement_data *d)
+{
+    tpm_eventlog_data *ted = (tpm_eventlog_data *)d;
+    tpm_eventlog_data *ret;
+
+    ret = (tpm_eventlog_data *)alloc_measurement_data(&tpm_eventlog_measurement_type);
+    if(ret == NULL) {
+        return NULL;
+    }
+
+    if(ted->log_size > 0) {
+        ret->log = malloc(ted->log_size);
+        if(ret->log == NULL) {
+            free_measurement_data(&ret->d);
+            return NULL;
+        }
+        memcpy(ret->log, ted->log, ted->log_size);
+    }
+    ret->log_size = ted->log_size;
+    ret->pcrs = g_list_copy_deep(ted->pcrs, (GCopyFunc)copy_pcr, NULL);
+
+    if((ted->quote_size > 0 &&
+            (ret->quote = dup_bytes(ted->quote, ted->quote_size)) == NULL) ||
+            (ted->quote_sig_size > 0 &&
+             (ret->quote_sig = dup_bytes(ted->quote_sig, ted->quote_sig_size)) == NULL)) {
+        free_measurement_data(&ret->d);
+        return NULL;
+    }
+    ret->quote_size	= ted->quote_size;
+    ret->quote_sig_size = ted->quote_sig_size;
+
+    return (measurement_data *)ret;
+}
+
+static int tpm_eventlog_serialize_data(measurement_data *d, char **serial_data,
+                                       size_t *serial_data_size)
+{
+    tpm_eventlog_data *ted = (tpm_eventlog_data *)d;
+    tpm_eventlog_pcr pcr;
+    tpl_node *tn;
+    tpl_bin tb_log;
+    tpl_bin tb_quote;
+    tpl_bin tb_sig;
+    tpl_bin tb_pcr;
+    GList *iter;
+    void *tplbuf;
+    size_t tplsize;
+    char *b64;
+    int rc;
+
+    *serial_data = NULL;
+    *serial_data_size = 0;
+
+    tn = tpl_map(TPM_EVENTLOG_TPL_FMT, &tb_log, &tb_quote, &tb_sig,
+                 &pcr.alg_id, &pcr.index, &tb_pcr);
+    if(tn == NULL) {
+        return -ENOMEM;
+    }
+
+    tb_log.addr	  = ted->log;
+    tb_log.sz	  = ted->log_size;
+    tb_quote.addr = ted->quote;
+    tb_quote.sz	  = ted->quote_size;
+    tb_sig.addr	  = ted->quote_sig;
+    tb_sig.sz	  = ted->quote_sig_size;
+    tpl_pack(tn, 0);
+
+    for(iter = ted->pcrs; iter != NULL; iter = g_list_next(iter)) {
+        memcpy(&pcr, iter->data, sizeof(pcr));
+        tb_pcr.addr = pcr.digest;
+        tb_pcr.sz   = pcr.size;
+        tpl_pack(tn, 1);
+    }
+
+    rc = tpl_dump(tn, TPL_MEM, &tplbuf, &tplsize);
+    tpl_free(tn);
+    if(rc < 0 || tplbuf == NULL) {
+        return -ENOMEM;
+    }
+
+    b64 = b64_encode(tplbuf, tplsize);
+    free(tplbuf);
+    if(b64 == NULL) {
+        return -ENOMEM;
+    }
+
+    *serial_data = b64;
+    *serial_data_size = strlen(b64) + 1;
+    return 0;
+}
+
+static int tpm_eventlog_unserialize_data(char *sd, size_t sd_size UNUSED,
+        measurement_data **d)
+{
+    tpm_eventlog_data *ted;
+    tpm_eventlog_pcr pcr;
+    tpl_node *tn;
+    tpl_bin tb_log;
+    tpl_bin tb_quote;
+    tpl_bin tb_sig;
+    tpl_bin tb_pcr;
+    void *tplbuf;
+    size_t tplsize;
+    int rc = -EINVAL;
+
+    *d = NULL;
+
+    tplbuf = b64_decode(sd, &tplsize);
+    if(tplbuf == NULL) {
+        return -EINVAL;
+    }
+
+    ted = (tpm_eventlog_data *)alloc_measurement_data(&tpm_eventlog_measurement_type);
+    if(ted == NULL) {
+        rc = -ENOMEM;
+        goto alloc_failed;
+    }
+
+    tn = tpl_map(TPM_EVENTLOG_TPL_FMT, &tb_log, &tb_quote, &tb_sig,
+                 &pcr.alg_id, &pcr.index, &tb_pcr);
+    if(tn == NULL) {
+        rc = -ENOMEM;
+        goto tpl_map_failed;
+    }
+
+    if(tpl_load(tn, TPL_MEM, tplbuf, tplsize) != 0) {
+        goto tpl_load_failed;
+    }
+    tpl_unpack(tn, 0);
+    ted->log		= tb_log.addr;
+    ted->log_size	= tb_log.sz;
+    ted->quote		= tb_quote.addr;
+    ted->quote_size	= tb_quote.sz;
+    ted->quote_sig	= tb_sig.addr;
+    ted->quote_sig_size = tb_sig.sz;
+
+    while(tpl_unpack(tn, 1) > 0) {
+        tpm_eventlog_pcr *p;
+
+        if(tb_pcr.sz > TPM_EVENTLOG_MAX_DIGEST_SIZE ||
+                (p = calloc(1, sizeof(*p))) == NULL) {
+            free(tb_pcr.addr);
+            goto tpl_load_failed;
+        }
+        p->alg_id = pcr.alg_id;
+        p->index  = pcr.index;
+        p->size	  = tb_pcr.sz;
+        memcpy(p->digest, tb_pcr.addr, tb_pcr.sz);
+        free(tb_pcr.addr);
+        ted->pcrs = g_list_append(ted->pcrs, p);
+    }
+
+    tpl_free(tn);
+    b64_free(tplbuf);
+    *d = &ted->d;
+    return 0;
+
+tpl_load_failed:
+    tpl_free(tn);
+tpl_map_failed:
+    free_measurement_data(&ted->d);
+alloc_failed:
+    b64_free(tplbuf);
+    return rc;
+}
+
+static int tpm_eventlog_get_feature(measurement_data *d, char *feature, GList **out)
+{
+    tpm_eventlog_data *ted = (tpm_eventlog_data *)d;
+    tpm_eventlog_parser p;
+    uint32_t i;
+
+    *out = NULL;
+
+    if(strcmp(feature, "algorithms") == 0) {
+        if(tpm_eventlog_parser_init(&p, ted->log, ted->log_size) != 0) {
+            return -EINVAL;
+        }
+        for(i = 0; i < p.nr_algs; i++) {
+            const char *name = tpm_eventlog_alg_name(p.algs[i].alg_id);
+            char *tmp = name ? strdup(name) : g_strdup_printf("0x%04"PRIx16, p.algs[i].alg_id);
+            if(tmp != NULL) {
+                *out = g_list_append(*out, tmp);
+            }
+        }
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+measurement_type tpm_eventlog_measurement_type = {
+    .magic		= TPM_EVENTLOG_TYPE_MAGIC,
+    .name		= TPM_EVENTLOG_TYPE_NAME,
+    .alloc_data		= tpm_eventlog_alloc_data,
+    .copy_data		= tpm_eventlog_copy_data,
+    .free_data		= tpm_eventlog_free_data,
+    .serialize_data	= tpm_eventlog_serialize_data,
+    .unserialize_data	= tpm_eventlog_unserialize_data,
+    .get_feature	= tpm_eventlog_get_feature,
+};
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2023 United States Government
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __TPM_EVENTLOG_MEASUREMENT_TYPE_H__
+#define __TPM_EVENTLOG_MEASUREMENT_TYPE_H__
+
+/*! \file
+ * measurement_type for the TCG2 (crypto agile) measured boot event
+ * log, as exported by the kernel in
+ * /sys/kernel/security/tpm0/binary_bios_measurements.
+ *
+ * The measurement keeps the raw log together with a TPM2 quote of the
+ * PCRs the log extends, made over the requester's nonce, which is what
+ * binds the log to the TPM, and the PCR values read from sysfs, which
+ * are informational only. The log is parsed in place by
+ * tpm_eventlog_parser_init() and tpm_eventlog_next(); parsed events
+ * point into the log buffer and nothing is copied.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <glib.h>
+#include <measurement_spec/meas_spec-api.h>
+
+/**
+ * TPM event log measurement_type universally unique 'magic' id number
+ */
+#define TPM_EVENTLOG_TYPE_MAGIC (0x7B0071E6)
+
+/**
+ * TPM event log measurement_type universally unique name
+ */
+#define TPM_EVENTLOG_TYPE_NAME "tpm_eventlog"
+
+/* TPM_ALG_ID values of the digest algorithms that may appear in a log */
+#define TPM_EVENTLOG_ALG_SHA1	0x0004
+#define TPM_EVENTLOG_ALG_SHA256	0x000B
+#define TPM_EVENTLOG_ALG_SHA384	0x000C
+#define TPM_EVENTLOG_ALG_SHA512	0x000D
+#define TPM_EVENTLOG_ALG_SM3_256	0x0012
+
+/* Event types with special meaning to a parser or verifier */
+#define TPM_EVENTLOG_EV_NO_ACTION	0x00000003
+#define TPM_EVENTLOG_EV_SEPARATOR	0x00000004
+
+#define TPM_EVENTLOG_NR_PCRS		24
+#define TPM_EVENTLOG_MAX_ALGS		8
+#define TPM_EVENTLOG_MAX_DIGEST_SIZE	64
+
+/**
+ * A PCR value read from the TPM when the log was collected.
+ */
+typedef struct tpm_eventlog_pcr {
+    uint16_t alg_id;
+    uint32_t index;
+    uint32_t size;
+    unsigned char digest[TPM_EVENTLOG_MAX_DIGEST_SIZE];
+} tpm_eventlog_pcr;
+
+/**
+ * TPM event log specialization of the measurement data structure.
+ */
+typedef struct tpm_eventlog_data {
+    struct measurement_data d;
+    unsigned char *log;
+    uint32_t log_size;
+    GList *pcrs; /* list of tpm_eventlog_pcr * */
+    unsigned char *quote;	/* marshalled TPMS_ATTEST, or NULL */
+    uint32_t quote_size;
+    unsigned char *quote_sig;	/* marshalled TPMT_SIGNATURE of quote */
+    uint32_t quote_sig_size;
+} tpm_eventlog_data;
+
+/**
+ * A digest algorithm declared in the log's Spec ID event.
+ */
+typedef struct tpm_eventlog_alg {
+    uint16_t alg_id;
+    uint16_t digest_size;
+} tpm_eventlog_alg;
+
+/**
+ * One event of the log. All pointers refer into the parsed buffer.
+ */
+typedef struct tpm_eventlog_event {
+    size_t offset;		/* of the event record in the log */
+    size_t length;		/* of the whole event record */
+    uint32_t pcr_index;
+    uint32_t event_type;
+    uint32_t nr_digests;
+    struct {
+        uint16_t alg_id;
+        uint16_t size;
+        const unsigned char *digest;
+    } digests[TPM_EVENTLOG_MAX_ALGS];
+    uint32_t data_size;
+    const unsigned char *data;
+} tpm_eventlog_event;
+
+/**
+ * Cursor over a crypto agile event log.
+ */
+typedef struct tpm_eventlog_parser {
+    const unsigned char *log;
+    size_t size;
+    size_t offset;
+    size_t header_size;		/* of the leading Spec ID event */
+    uint32_t nr_algs;
+    tpm_eventlog_alg algs[TPM_EVENTLOG_MAX_ALGS];
+} tpm_eventlog_parser;
+
+/**
+ * Parse the Spec ID event at the start of @log and position @p at the
+ * first crypto agile event. Returns 0 on success or -EINVAL if @log
+ * is not a crypto agile event log.
+ */
+int tpm_eventlog_parser_init(tpm_eventlog_parser *p,
+                             const unsigned char *log, size_t size);
+
+/**
+ * Move @p to @offset, which must be the offset of an event record
+ * previously returned by the parser (or the end of one).
+ * Returns 0 on success or -EINVAL if @offset lies outside the log.
+ */
+int tpm_eventlog_parser_seek(tpm_eventlog_parser *p, size_t offset);
+
+/**
+ * Parse the next event of the log into @ev. Returns 1 if an event was
+ * parsed, 0 at the end of the log, or -EINVAL if the log is
+ * malformed.
+ */
+int tpm_eventlog_next(tpm_eventlog_parser *p, tpm_eventlog_event *ev);
+
+/**
+ * Return the name ("sha256", ...) of TPM algorithm @alg_id, or NULL.
+ */
+const char *tpm_eventlog_alg_name(uint16_t alg_id);
+
+/**
+ * Return the TPM algorithm id for @name, or 0 if it is unknown.
+ */
+uint16_t tpm_eventlog_alg_id(const char *name);
+
+extern measurement_type tpm_eventlog_measurement_type;
+
+#endif /* __TPM_EVENTLOG_MEASUREMENT_TYPE_H__ */